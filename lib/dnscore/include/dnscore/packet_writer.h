@@ -51,15 +51,28 @@ extern "C"
 {
 #endif
 
+/**
+ * The compression dictionary is a hash of the name suffixes already written
+ * (at an offset that can be pointed to : 0x3fff at most).
+ * A suffix is identified by its first label and the node of the rest of the
+ * name (its parent).
+ *
+ * The slots are not cleared : a slot is only used if the node it points to
+ * has been added and points back to it.
+ */
+
+#define PACKET_DICTIONARY_SIZE  6144 /* more than enough for the 16KB that can be pointed to */
+#define PACKET_DICTIONARY_SLOTS 8192 /* power of 2, > PACKET_DICTIONARY_SIZE */
+
 typedef struct packet_dictionary_node packet_dictionary_node;
 
 
 struct packet_dictionary_node
 {
-    packet_dictionary_node* next;
-    packet_dictionary_node* child;
-    u8* label;
-    u32 offset;
+    u32 hash;
+    u16 offset;     /* of the label in the packet */
+    u16 parent;     /* node of the rest of the name */
+    u16 slot;
 };
 
 typedef struct packet_writer packet_writer;
@@ -67,15 +80,14 @@ typedef struct packet_writer packet_writer;
 
 struct packet_writer
 {
-    packet_dictionary_node* head;
-    packet_dictionary_node* pool_head;
-    
     u8* packet;
 
     u32 packet_offset;
     u32 packet_limit;
 
-    packet_dictionary_node pool[4096];
+    u32 dictionary_count;
+    u16 dictionary_slots[PACKET_DICTIONARY_SLOTS];
+    packet_dictionary_node dictionary[PACKET_DICTIONARY_SIZE];
 };
 
 void packet_writer_create(packet_writer* pc, u8* packet, u16 limit);
@@ -533,6 +533,8 @@
 #define     DNSKEY_ALGORITHM_RSASHA1        5
 #define     DNSKEY_ALGORITHM_DSASHA1_NSEC3  6
 #define     DNSKEY_ALGORITHM_RSASHA1_NSEC3  7
+#define     DNSKEY_ALGORITHM_ECDSAP256SHA256 13     /* RFC 6605 */
+#define     DNSKEY_ALGORITHM_ECDSAP384SHA384 14     /* RFC 6605 */
 
 #define     NSEC3_FLAGS_OPTOUT              1           /*  */
 
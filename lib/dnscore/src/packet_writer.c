@@ -48,6 +48,102 @@
 #include "dnscore/rfc.h"
 #include "dnscore/message.h"
 
+#define PACKET_DICTIONARY_ROOT      0xffff
+#define PACKET_DICTIONARY_SLOTS_MASK (PACKET_DICTIONARY_SLOTS - 1)
+
+/*
+ * Hash of a label (case-insensitive) under a given parent
+ */
+
+static inline u32
+packet_dictionary_hash(const u8* label, u32 parent)
+{
+    u32 len = *label++;
+    u32 hash = (0x811c9dc5 ^ parent) * 0x01000193;
+
+    hash = (hash ^ len) * 0x01000193;
+
+    const u8* limit = &label[len];
+
+    while(label != limit)
+    {
+        hash = (hash ^ (u8)LOCASE(*label++)) * 0x01000193;
+    }
+
+    return hash ^ (hash >> 16);
+}
+
+/*
+ * Returns the node of the label under parent, or PACKET_DICTIONARY_ROOT
+ */
+
+static inline u32
+packet_dictionary_find(const packet_writer* pc, const u8* label, u32 parent, u32 hash)
+{
+    u32 slot = hash & PACKET_DICTIONARY_SLOTS_MASK;
+
+    for(;;)
+    {
+        u32 index = pc->dictionary_slots[slot];
+
+        if((index >= pc->dictionary_count) || (pc->dictionary[index].slot != slot))
+        {
+            /* empty slot */
+
+            return PACKET_DICTIONARY_ROOT;
+        }
+
+        const packet_dictionary_node* node = &pc->dictionary[index];
+
+        if((node->hash == hash) && (node->parent == parent) && dnslabel_equals_ignorecase_left(label, &pc->packet[node->offset]))
+        {
+            return index;
+        }
+
+        slot = (slot + 1) & PACKET_DICTIONARY_SLOTS_MASK;
+    }
+}
+
+/*
+ * Adds the label at offset under parent.  The caller ensures it was not there.
+ * Returns the node, or PACKET_DICTIONARY_ROOT if it cannot be added.
+ */
+
+static inline u32
+packet_dictionary_add(packet_writer* pc, u32 offset, u32 parent, u32 hash)
+{
+    if((offset > 0x3fff) || (pc->dictionary_count >= PACKET_DICTIONARY_SIZE))
+    {
+        return PACKET_DICTIONARY_ROOT;
+    }
+
+    u32 slot = hash & PACKET_DICTIONARY_SLOTS_MASK;
+
+    for(;;)
+    {
+        u32 index = pc->dictionary_slots[slot];
+
+        if((index >= pc->dictionary_count) || (pc->dictionary[index].slot != slot))
+        {
+            break;
+        }
+
+        slot = (slot + 1) & PACKET_DICTIONARY_SLOTS_MASK;
+    }
+
+    u32 index = pc->dictionary_count++;
+
+    packet_dictionary_node* node = &pc->dictionary[index];
+    node->hash = hash;
+    node->offset = offset;
+    node->parent = parent;
+    node->slot = slot;
+
+    pc->dictionary_slots[slot] = index;
+
+    return index;
+}
+
 /*
  *
  */
@@ -55,39 +151,47 @@
 ya_result
 packet_writer_init(packet_writer* pc, u8* packet, u32 packet_offset, u32 size_limit)
 {
-    pc->pool_head = pc->pool;
-    pc->head = NULL;
+    pc->dictionary_count = 0;
+    pc->packet = packet;
 
 #ifndef NDEBUG
     memset(&packet[packet_offset], 0xff, size_limit - packet_offset);
 #endif
 
-    packet_dictionary_node* child_node = NULL;
+    /* the question : its labels have to be added from the top */
+
+    u32 label_offset[MAX_LABEL_COUNT];
+    s32 top = -1;
 
     u32 offset = DNS_HEADER_LENGTH;
     u8* fqdn = &packet[offset];
 
     while(*fqdn != 0)
     {
-        packet_dictionary_node* node = pc->pool_head++;
-
-        node->next = NULL;
-        node->child = child_node;
-        node->label = fqdn;
-        node->offset = offset;
+        label_offset[++top] = offset;
 
         u8 len = fqdn[0] + 1;
 
         fqdn += len;
         offset += len;
-
-        child_node = node;
     }
 
     *fqdn = 0;
 
-    pc->head = child_node;
-    pc->packet = packet;
+    u32 parent = PACKET_DICTIONARY_ROOT;
+
+    while(top >= 0)
+    {
+        const u8* label = &packet[label_offset[top]];
+
+        if((parent = packet_dictionary_add(pc, label_offset[top], parent, packet_dictionary_hash(label, parent))) == PACKET_DICTIONARY_ROOT)
+        {
+            break;
+        }
+
+        top--;
+    }
+
     pc->packet_offset = packet_offset;
     pc->packet_limit = size_limit;
 
@@ -97,9 +201,8 @@ packet_writer_init(packet_writer* pc, u8* packet, u32 packet_offset, u32 size_li
 void
 packet_writer_create(packet_writer* pc, u8* packet, u16 limit)
 {
-    pc->pool_head = pc->pool;
-    
-    pc->head = NULL;
+    pc->dictionary_count = 0;
+
     pc->packet = packet;
     pc->packet_offset = DNS_HEADER_LENGTH;
     pc->packet_limit = limit;
@@ -117,99 +220,80 @@ ya_result
 packet_writer_add_fqdn(packet_writer* pc, const u8* fqdn)
 {
     dnslabel_vector name;
+    u32 hash[MAX_LABEL_COUNT];
     s32 top = dnsname_to_dnslabel_vector(fqdn, name);
     s32 best_top = top + 1;
-    packet_dictionary_node* best = NULL;
-    packet_dictionary_node* node = pc->head;
-    u8* packet_base = pc->packet;
+    u32 best = PACKET_DICTIONARY_ROOT;
     u32 offset = pc->packet_offset;
 
-    /* Look for the name in the compression dictionary */
+    /* Look for the longest known suffix, from the top */
 
-    while((top >= 0) && (node != NULL))
+    while(top >= 0)
     {
-        if(dnslabel_equals_ignorecase_left(name[top], node->label))
-        {
-            /* we got a match on this level */
-
-            best = node;
-            best_top = top;
-
-            node = node->child;
+        u32 h = packet_dictionary_hash(name[top], best);
+        u32 index = packet_dictionary_find(pc, name[top], best, h);
 
-            top--;
-        }
-        else
+        if(index == PACKET_DICTIONARY_ROOT)
         {
-            /* no match, try the next sibling */
+            /* the first label of the suffix is needed to add the new ones */
 
-            node = node->next;
+            hash[top] = h;
+            break;
         }
+
+        best = index;
+        best_top = top;
+
+        top--;
     }
 
-    /* Every label in the interval [0;best_top is new */
-    /* Create a compression dictionary entry for each of them
-     * along with their writing.
-     */
+    /* Every label in the interval [0;best_top[ is new */
+    /* Write them, then add them to the dictionary from the top */
 
-    packet_dictionary_node* child_node = NULL;
+    u32 label_offset[MAX_LABEL_COUNT];
 
-    u8* packet = &packet_base[offset];
+    u8* packet = &pc->packet[offset];
 
-    top = 0;
-    while(top < best_top)
+    for(top = 0; top < best_top; top++)
     {
         u8 len = name[top][0] + 1;
         MEMCOPY(packet, name[top], len);
 
-        if(offset <= 0x3fff)
-        {
-            node = pc->pool_head++;
-            node->next = NULL;
-            node->child = child_node;
-            node->label = packet;
-            node->offset = offset;
-
-            child_node = node;
-        }
+        label_offset[top] = offset;
 
         packet += len;
         offset += len;
-
-        top++;
     }
 
-    if(best != NULL)
+    u32 parent = best;
+
+    for(top = best_top - 1; top >= 0; top--)
     {
-        /* found a (partial) match */
-        /* Add the new chain to the parent */
+        /* the hash of the first new label is already known */
+
+        u32 h = (top == best_top - 1)?hash[top]:packet_dictionary_hash(name[top], parent);
+
+        /* labels beyond the 0x3fff limit are not added, nor the ones before them */
 
-        if(child_node != NULL)
+        if((parent = packet_dictionary_add(pc, label_offset[top], parent, h)) == PACKET_DICTIONARY_ROOT)
         {
-            child_node->next = best->child;
-            best->child = child_node;
+            break;
         }
+    }
+
+    if(best != PACKET_DICTIONARY_ROOT)
+    {
+        /* found a (partial) match */
+
+        u32 best_offset = pc->dictionary[best].offset;
 
-        *packet++ = (best->offset >> 8) | 0xc0;
-        *packet = (best->offset & 0xff);
+        *packet++ = (best_offset >> 8) | 0xc0;
+        *packet = (best_offset & 0xff);
 
         offset += 2;
     }
     else
     {
-        /* create a new entry */
-
-        /* child_node can be null if we tried to write something beyond the
-         * 16KB limit
-         *
-         */
-
-        if(child_node != NULL)
-        {
-            child_node->next = pc->head;
-            pc->head = child_node;
-        }
-
         *packet = 0;
 
         offset++;
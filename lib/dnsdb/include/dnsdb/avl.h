@@ -298,6 +298,17 @@ void* avl_delete(avl_tree* tree, hashcode obj_hash);
 
 void avl_destroy(avl_tree* tree);
 
+/** @brief Releases all the nodes of a tree once no reader can be walking it
+ *
+ *  Detaches the nodes from the tree then releases them through the epoch
+ *  (zdb_epoch.h) when ZDB_EXPLICIT_READER_ZONE_LOCK == 2, else same as
+ *  avl_destroy.  Data is not destroyed.
+ *
+ *  @param[in] tree the tree to empty
+ */
+
+void avl_retire(avl_tree* tree);
+
 void avl_iterator_init(avl_tree tree, avl_iterator* iter);
 bool avl_iterator_hasnext(avl_iterator* iter);
 void** avl_iterator_next(avl_iterator* iter);
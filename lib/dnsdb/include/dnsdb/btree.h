@@ -74,6 +74,7 @@ typedef avl_iterator btree_iterator;
 #define btree_insert avl_insert
 #define btree_delete avl_delete
 #define btree_destroy avl_destroy
+#define btree_retire avl_retire
 #define btree_callback_and_destroy avl_callback_and_destroy
 
 #define btree_iterator_init          avl_iterator_init
@@ -45,6 +45,8 @@
 #include <dnscore/sys_types.h>
 #include "btree.h"
 #include "htbt.h"
+#include "htoa.h"
+#include "zdb_epoch.h"
 
 #ifdef	__cplusplus
 extern "C"
@@ -168,6 +170,7 @@ struct dictionary
     {
 	btree btree_collection; /*  4  8 */
 	htbt htbt_collection; /*  4  8 */
+	htoa htoa_collection; /*  4  8 */
     } ct; /* Collection-type*/
     struct dictionary_vtbl* vtbl; /*  4  8 */
     u32 count; /*  4  4 */
@@ -192,6 +195,7 @@ struct dictionary_iterator
     {
 	btree_iterator as_btree;
 	htbt_iterator as_htbt;
+	htoa_iterator as_htoa;
     } ct;
 };
 
@@ -465,8 +469,47 @@ void dictionary_mutate(dictionary* dico);
 #define dictionary_destroy_ex(dico_, destroy_, arg_) (dico_)->vtbl->dictionary_destroy_ex_call((dico_), (destroy_), (arg_))
 /** @brief helper macro */
 #define dictionary_add(dico_, key_, record_match_data_, compare_, create_) (dico_)->vtbl->dictionary_add_call((dico_), (key_), (record_match_data_), (compare_), (create_))
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+
+/**
+ * @brief Looks for a node in a dictionary that may be mutating
+ *
+ * The readers do not hold the zone lock : dictionary_mutate clears the vtbl
+ * while the collection changes, so the vtbl and the collection are read as a
+ * pair that has not been changed in between.  The old collection is released
+ * through the epoch.
+ */
+
+static inline dictionary_node*
+dictionary_find_mt(const dictionary* dico, hashcode key, const void* record_match_data, dictionary_data_record_compare_function compare)
+{
+    dictionary snapshot;
+    struct dictionary_vtbl* vtbl;
+
+    for(;;)
+    {
+        vtbl = ((volatile dictionary*)dico)->vtbl;
+        ZDB_EPOCH_READ_BARRIER();
+        snapshot.ct = ((volatile dictionary*)dico)->ct;
+        ZDB_EPOCH_READ_BARRIER();
+
+        if((vtbl != NULL) && (vtbl == ((volatile dictionary*)dico)->vtbl))
+        {
+            break;
+        }
+    }
+
+    snapshot.vtbl = vtbl;
+
+    return vtbl->dictionary_find_call(&snapshot, key, record_match_data, compare);
+}
+
+/** @brief helper macro */
+#define dictionary_find(dico_, key_, record_match_data_, compare_) dictionary_find_mt((dico_), (key_), (record_match_data_), (compare_))
+#else
 /** @brief helper macro */
 #define dictionary_find(dico_, key_, record_match_data_, compare_) (dico_)->vtbl->dictionary_find_call((dico_), (key_), (record_match_data_), (compare_))
+#endif
 /** @brief helper macro */
 #define dictionary_findp(dico_, key_, record_match_data_, compare_) (dico_)->vtbl->dictionary_findp_call((dico_), (key_), (record_match_data_), (compare_))
 /** @brief helper macro */
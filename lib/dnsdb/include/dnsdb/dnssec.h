@@ -50,6 +50,7 @@
 #include <dnsdb/dnssec_keystore.h>
 #include <dnsdb/dnssec_rsa.h>
 #include <dnsdb/dnssec_dsa.h>
+#include <dnsdb/dnssec_ecdsa.h>
 #include <dnsdb/dnssec_scheduler.h>
 
 
@@ -93,6 +94,35 @@ ya_result zdb_update_zone_signatures_alarm(void* zone);     /* zdb_zone* */
 ya_result zdb_update_zone_signatures(zdb_zone* zone, bool scheduled);
 ya_result zdb_update_signatures(zdb* db, bool scheduled);
 
+/*
+ * Incremental signature maintenance.
+ *
+ * With a rate set, the signature alarm of a zone only re-signs, each second, up to rate signatures
+ * among the labels entering the regeneration window, then re-arms itself.
+ * A rate of 0 (default) keeps the whole zone passes.
+ */
+
+void zdb_update_zone_signatures_set_rate(u32 signatures_per_second);
+u32 zdb_update_zone_signatures_get_rate();
+
+/**
+ * Re-signs the labels of the zone whose signatures enter the regeneration window, up to a number of signatures.
+ *
+ * @param zone the zone
+ * @param signatures_max the maximum number of signatures to generate
+ * @param next_epochp receives the time of the next slice, MAX_U32 if nothing is expected to expire
+ *
+ * @return the number of labels processed or an error code
+ */
+
+ya_result zdb_update_zone_signatures_slice(zdb_zone* zone, u32 signatures_max, u32 *next_epochp);
+
+/**
+ * Returns the time at which the first signature of the zone enters the regeneration window
+ */
+
+u32 zdb_update_zone_signatures_next_epoch(zdb_zone* zone);
+
 
 #ifdef	__cplusplus
 }
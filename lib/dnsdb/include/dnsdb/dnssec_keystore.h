@@ -45,6 +45,7 @@
  *
  * USE INCLUDES */
 #include <openssl/engine.h>
+#include <openssl/ec.h>
 
 #include <dnscore/sys_types.h>
 #include <dnsdb/btree.h>
@@ -74,6 +75,7 @@ union dnssec_key_key_types
     void* any;
     RSA* rsa;
     DSA* dsa;
+    EC_KEY* ec;
 };
 
 typedef union dnssec_key_key_types dnssec_key_key_types;
@@ -89,8 +91,8 @@ struct dnssec_key
     char* origin;
     u8* owner_name;		/* = zone origin */
 
-    dnssec_key_key_types key;	/* RSA* or DSA* */
-    int	    nid;		/* NID_sha1, NID_md5 */
+    dnssec_key_key_types key;	/* RSA*, DSA* or EC_KEY* */
+    int	    nid;		/* NID_sha1, NID_sha256, NID_sha384, NID_md5 : the digest of the signatures */
 
     u16 flags;
     u16 tag;
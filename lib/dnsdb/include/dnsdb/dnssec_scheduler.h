@@ -119,6 +119,7 @@ extern "C"
 
     /*
      *  Use this to create and add a key in background
+     *  algorithm is one of RSASHA1, RSASHA1_NSEC3, ECDSAP256SHA256, ECDSAP384SHA384
      */
 
     void scheduler_queue_dnskey_create(zdb_zone* zone, u16 flags, u8 algorithm, u16 size);
@@ -130,6 +131,15 @@ extern "C"
 
     void scheduler_task_rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata* added_rrsig_sll, zdb_rr_label* label, zdb_zone* zone, dnsname_stack* name, void* context_to_destroy);
 
+    /*
+     * Takes the results of a batch of labels and schedule to commits them all under one lock.
+     * The batch is destroyed by the task.
+     */
+
+    struct rrsig_update_batch;
+
+    void scheduler_task_rrsig_update_batch_commit(struct rrsig_update_batch* batch);
+
 #endif
 
 #if ZDB_NSEC3_SUPPORT != 0
@@ -154,10 +164,23 @@ extern "C"
 
     ya_result scheduler_queue_zone_write(zdb_zone* zone, const char* path, callback_function *cb, void *cb_args);
 
+    /*
+     * If enabled, the zone writer also writes a binary snapshot of the zone (path + ".snapshot")
+     */
+
+    void      scheduler_queue_zone_write_set_snapshot(bool enabled);
+
     void      scheduler_queue_zone_write_axfr(zdb_zone* zone, const char* dirpath, u32 packet_size_limit, u32 packet_records_limit, bool compress_dname_rdata);
 
     void      scheduler_queue_zone_send_axfr(zdb_zone *zone, const char *directory, u32 packet_size_limit, u32 packet_records_limit, bool compress_dname_rdata, message_data *mesg);
 
+    /*
+     * By default an AXFR answer is streamed from the zone as it is sent (see zdb_zone_axfr_input_stream.h).
+     * If enabled, it is sent from an image of the zone stored in (and read from) a file in the xfr directory instead.
+     */
+
+    void      scheduler_queue_zone_send_axfr_set_file_cache(bool enabled);
+
     void      scheduler_queue_zone_send_ixfr(zdb_zone* zone, const char* directory, u32 packet_size_limit, u32 packet_records_limit, bool compress_dname_rdata, message_data *mesg);
 
     ya_result scheduler_queue_zone_freeze(zdb_zone* zone, const char* path, const char* filename);
@@ -61,6 +61,8 @@ extern "C" {
 
 typedef struct dnssec_task dnssec_task;
 
+struct rrsig_update_batch;
+
 
 typedef void* dnssec_thread_function(void*);
 typedef ya_result dnssec_task_initializer(dnssec_task*);
@@ -74,12 +76,14 @@ struct dnssec_task
     
     u32 task_flags;
     
-#if __SIZEOF_POINTER__ >= 8
-    u32 reserved;
-#endif
+    /* The size of the query queue, QUEUE_MAX_SIZE if 0 */
+    u32 queue_size;
 
     const char* descriptor_name;
 
+    /* The batch of labels being filled for the signers (RRSIG updater) */
+    struct rrsig_update_batch* batch;
+
     /*
      * STACK !
      */
@@ -97,6 +101,7 @@ struct dnssec_task_descriptor
     dnssec_thread_function* query_thread;
     dnssec_thread_function* answer_thread;
     const char* name;
+    u32 queue_size;     /* 0 for the default */
 };
 
 ya_result   dnssec_process_initialize(dnssec_task* task,dnssec_task_descriptor* desc);
@@ -125,6 +130,19 @@ ya_result dnssec_process_zone_nsec3(zdb_zone* zone, dnssec_task* task);
  */
 
 void dnssec_process_database(zdb* db, dnssec_task* task);
+
+/**
+ *
+ * Queues the label at task->path for the RRSIG updater.
+ * The labels are sent to the signers by batches.
+ *
+ * @param zone
+ * @param task
+ * @param label
+ * @param delegation
+ */
+
+void dnssec_process_queue_label(zdb_zone* zone, dnssec_task* task, zdb_rr_label* label, bool delegation);
 void dnssec_process_finalize(dnssec_task* task);
 
 typedef ya_result dnssec_process_task_callback(zdb_zone* zone, dnssec_task* task, void* whatyouwant);
@@ -140,6 +158,19 @@ typedef ya_result dnssec_process_task_callback(zdb_zone* zone, dnssec_task* task
 
 ya_result dnssec_process_task(zdb_zone* zone, dnssec_task* task, dnssec_process_task_callback *callback, void *whatyouwant);
 
+/**
+ * Same as dnssec_process_task but the changes are written in the journal of the zone.
+ * This is what dnssec_process_zone does with a callback queuing all the labels.
+ *
+ * @param zone
+ * @param task
+ * @param callback queues the labels to process
+ * @param whatyouwant
+ * @return
+ */
+
+ya_result dnssec_process_zone_journal(zdb_zone* zone, dnssec_task* task, dnssec_process_task_callback *callback, void *whatyouwant);
+
 #ifdef	__cplusplus
 }
 #endif
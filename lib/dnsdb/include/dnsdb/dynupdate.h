@@ -46,6 +46,7 @@
 #include <dnsdb/zdb_types.h>
 #include <dnscore/output_stream.h>
 #include <dnscore/packet_reader.h>
+#include <dnsdb/treeset.h>
 
 #ifdef	__cplusplus
 extern "C"
@@ -84,6 +85,28 @@ ya_result dynupdate_check_prerequisites(zdb_zone* zone, packet_unpack_reader_dat
 
 ya_result dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, bool dryrun);
 
+/*
+ * Several updates of the same zone can be applied as a batch :
+ * 
+ * Each update has its prerequisites checked and is dry-run as usual, then applied with dynupdate_batch_update.
+ * The NSEC/NSEC3 chains and the signatures of all the labels changed are only fixed once, by dynupdate_batch_commit.
+ * 
+ * The zone must be locked (ZDB_ZONE_MUTEX_DYNUPDATE) from the first dynupdate_batch_update up to the commit,
+ * all of it inside the same incremental journal page.
+ */
+
+typedef struct dynupdate_batch dynupdate_batch;
+
+struct dynupdate_batch
+{
+    treeset_tree lus_set;   /* the labels changed so far */
+    u32 count;              /* the updates applied so far */
+};
+
+void dynupdate_batch_init(dynupdate_batch *batch);
+ya_result dynupdate_batch_update(zdb_zone* zone, dynupdate_batch *batch, packet_unpack_reader_data *reader, u16 count);
+ya_result dynupdate_batch_commit(zdb_zone* zone, dynupdate_batch *batch);
+
 /*
  * Call this before an update.
  */
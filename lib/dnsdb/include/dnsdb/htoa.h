@@ -0,0 +1,245 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbcollection Collections used by the database
+ *  @ingroup dnsdb
+ *  @brief Open addressing hash table structure and functions.
+ *
+ *  Implementation of an open addressing (linear probing) hash table mapping a hashcode to a data pointer.
+ *
+ *  Meant for the labels with a lot of children (ie: the apex of a TLD).
+ *  Each slot is split across three arrays : a one byte tag, the hashcode and the data.
+ *  A probe mostly reads the tags (64 slots per cache line), then the hashcode on a tag match.
+ *  The data is only read for the slot found.
+ *
+ *  The table grows when it is 3/4 full and shrinks when it is less than 1/8 full.
+ *  An insert or a delete may move the slots : the pointers returned by the find/insert functions are
+ *  only valid until the next change of the collection.
+ *
+ *  A slot never moves inside a table : a deleted slot is only marked and the table is compacted
+ *  when it is resized.  The new table is published with a single pointer store and the old one
+ *  is released through the epoch (zdb_epoch.h), so a reader inside an epoch can probe the
+ *  collection while one writer changes it.
+ *
+ * @{
+ */
+#ifndef _HTOA_H
+#define	_HTOA_H
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include "hash.h"
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#define HTOA_TAG_EMPTY              0
+#define HTOA_TAG_DELETED            1
+
+/* a used slot always has its high bit set */
+#define HTOA_TAG(hash_)             ((u8)(0x80 | ((hash_) & 0x7f)))
+#define HTOA_TAG_USED(tag_)         (((tag_) & 0x80) != 0)
+
+/* Fibonacci hashing, the tag is taken from the low bits, the slot from the high ones */
+#define HTOA_HOME(table_, hash_)    ((u32)((hash_) * 2654435769U) >> (table_)->shift)
+
+typedef struct htoa_table htoa_table;
+
+struct htoa_table
+{
+    void **data;
+    hashcode *hashes;
+    u8 *tags;
+    u32 mask;       /* the capacity - 1, the capacity being a power of two */
+    u32 shift;      /* 32 - log2(capacity) */
+    u32 used;       /* slots used */
+    u32 deleted;    /* slots deleted, dropped at the next resize */
+};
+
+typedef htoa_table* htoa;
+
+/** @brief Initializes the collection
+ *
+ *  Initializes the collection.
+ *  The table is only allocated by the first insertion.
+ *
+ *  @param[in]  collection the collection to initialize
+ */
+
+void htoa_init(htoa* collection);
+
+/** @brief Inserts data into the collection.
+ *
+ *  Insert datat into the collection.
+ *  The caller will then have to use the returned void** to set his data.
+ *
+ *  THIS CALL IS NOT THREAD SAFE
+ *
+ *  @param[in]  collection the collection where the insertion should be made
+ *  @param[in]  obj_hash the hash associated to the node
+ *
+ *  @return A pointer to the data field associated to the hash (NULL for a new slot)
+ */
+
+void** htoa_insert(htoa* collection, hashcode obj_hash);
+
+/** @brief Deletes a slot of the collection.
+ *
+ *  Deletes a slot of the collection.
+ *
+ *  THIS CALL IS NOT THREAD SAFE
+ *
+ *  @param[in]  collection the collection
+ *  @param[in]  obj_hash the hash of the slot
+ *
+ *  @return The data of the slot, or NULL if there was no such slot.
+ */
+
+void* htoa_delete(htoa* collection, hashcode obj_hash);
+
+/** @brief Destroys the collection
+ *
+ *  Releases the table at once (no reader may be using it).  The data is not touched.
+ *
+ *  @param[in]  collection the collection to destroy
+ */
+
+void htoa_destroy(htoa* collection);
+
+/** @brief Destroys the collection once no reader can be probing it
+ *
+ *  Detaches the table from the collection then releases it through the epoch.
+ *  The data is not touched.
+ *
+ *  @param[in]  collection the collection to destroy
+ */
+
+void htoa_retire(htoa* collection);
+
+typedef struct htoa_iterator
+{
+    htoa table;
+    u32 index;      /* the next slot used */
+} htoa_iterator;
+
+void htoa_iterator_init(htoa table, htoa_iterator* iter);
+
+/**
+ * Returns a pointer to the data of the next slot and, if keyp is not NULL, its hash.
+ */
+
+void** htoa_iterator_next_key(htoa_iterator* iter, hashcode *keyp);
+
+static inline bool htoa_iterator_hasnext(htoa_iterator* iter)
+{
+    return (iter->table != NULL) && (iter->index <= iter->table->mask);
+}
+
+static inline void** htoa_iterator_next(htoa_iterator* iter)
+{
+    return htoa_iterator_next_key(iter, NULL);
+}
+
+/** @brief Finds the slot of a hash.
+ *
+ *  Finds the slot of a hash.
+ *
+ *  Can run concurrently with one writer if the caller is inside an epoch.
+ *
+ *  @param[in]  collection the collection to search in
+ *  @param[in]  obj_hash the hash to find
+ *
+ *  @return A pointer to the data of the slot or NULL if there is no such slot.
+ */
+
+static inline void** htoa_findp(htoa collection, hashcode obj_hash)
+{
+    if(collection != NULL)
+    {
+        u8 tag = HTOA_TAG(obj_hash);
+        u32 i = HTOA_HOME(collection, obj_hash);
+
+        for(;;)
+        {
+            u8 slot_tag = collection->tags[i];
+
+            if(slot_tag == tag)
+            {
+                if(collection->hashes[i] == obj_hash)
+                {
+                    return &collection->data[i];
+                }
+            }
+            else if(slot_tag == HTOA_TAG_EMPTY)
+            {
+                break;
+            }
+
+            i = (i + 1) & collection->mask;
+        }
+    }
+
+    return NULL;
+}
+
+/** @brief Finds the data of a hash.
+ *
+ *  Finds the data of a hash.
+ *
+ *  Can run concurrently with one writer if the caller is inside an epoch.
+ *
+ *  @param[in]  collection the collection to search in
+ *  @param[in]  obj_hash the hash to find
+ *
+ *  @return The data or NULL if there is no such slot.
+ */
+
+static inline void* htoa_find(htoa collection, hashcode obj_hash)
+{
+    void **datap = htoa_findp(collection, obj_hash);
+
+    return (datap != NULL)?*datap:NULL;
+}
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _HTOA_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
@@ -53,6 +53,7 @@
 #include <dnsdb/nsec3_name_error.h>
 #include <dnsdb/nsec3_nodata_error.h>
 #include <dnsdb/nsec3_owner.h>
+#include <dnsdb/nsec3_proof_cache.h>
 #include <dnsdb/nsec3_update.h>
 #include <dnsdb/nsec3_zone.h>
 
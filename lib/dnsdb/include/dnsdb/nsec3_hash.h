@@ -54,6 +54,16 @@ typedef ya_result nsec3_hash_function(const u8*, u32, const u8*, u32, u32, u8*,
 
 nsec3_hash_function* nsec3_hash_get_function(u8 algorithm);
 
+/*
+ * names, name_lens, count, salt, salt_len, iterations, digests, wild
+ *
+ * digests[i] receives the digest of names[i]
+ */
+
+typedef ya_result nsec3_hash_batch_function(const u8 * const *, const u32 *, u32, const u8*, u32, u32, u8 * const *, bool);
+
+nsec3_hash_batch_function* nsec3_hash_get_batch_function(u8 algorithm);
+
 u8 nsec3_hash_len(u8 algorithm);
 
 #ifdef	__cplusplus
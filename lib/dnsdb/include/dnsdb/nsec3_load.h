@@ -57,6 +57,10 @@ ya_result nsec3_load_add_nsec3param(nsec3_load_context* context, const u8* entry
 ya_result nsec3_load_add_nsec3(nsec3_load_context* context, const u8* entry_name, u32 entry_ttl, const u8* entry_rdata, u16 entry_rdata_size);
 ya_result nsec3_load_add_rrsig(nsec3_load_context* context, const u8* entry_name, u32 entry_ttl, const u8* entry_rdata, u16 entry_rdata_size);
 
+/* The digests given by the hint are not computed by nsec3_load_compile */
+
+void nsec3_load_set_digest_hint(nsec3_load_context* context, nsec3_digest_hint_callback *digest_hint, void *digest_hint_args);
+
 ya_result nsec3_load_compile(nsec3_load_context* context);
 
 bool nsec3_load_is_context_empty(nsec3_load_context* ctx);
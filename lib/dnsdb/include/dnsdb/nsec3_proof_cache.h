@@ -0,0 +1,168 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup nsec3 NSEC3 functions
+ *  @ingroup dnsdbdnssec
+ *  @brief Cache of the NSEC3 name error proofs
+ *
+ *  A name error proof only depends on the closest provable encloser of the
+ *  query and on the NSEC3 interval covering the hash of the next closer name.
+ *  Once built, the (up to) three NSEC3 records and their signatures are kept
+ *  for that (encloser, interval) pair so that the next misses under the same
+ *  encloser only cost the hash of their next closer name.
+ *
+ *  The cache is a direct-mapped array of immutable entries.  Readers never
+ *  lock, an entry that is replaced is released through the epoch
+ *  (see zdb_epoch.h) so it has to be used inside one.
+ *
+ *  A change of a zone invalidates the proofs of that zone only (generation
+ *  counter of the zone, bumped when a writer releases it).  Mounting or
+ *  destroying a zone invalidates the whole cache.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+#ifndef _NSEC3_PROOF_CACHE_H
+#define	_NSEC3_PROOF_CACHE_H
+
+#include <dnsdb/zdb_types.h>
+#include <dnsdb/nsec3_types.h>
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * The records of a proof, in this order.
+ * A record that is the same as an earlier one is not repeated (NULL).
+ */
+
+#define NSEC3_PROOF_CACHE_NEXT_CLOSER           0
+#define NSEC3_PROOF_CACHE_CLOSEST_ENCLOSER      1
+#define NSEC3_PROOF_CACHE_WILD_CLOSEST_ENCLOSER 2
+#define NSEC3_PROOF_CACHE_RECORDS               3
+
+#define NSEC3_PROOF_CACHE_SLOTS_MAX             0x100000
+
+/**
+ * Sets up the cache.
+ * 
+ * @param slots the number of entries, rounded down to a power of 2, 0 disables the cache
+ */
+
+void nsec3_proof_cache_init(u32 slots);
+
+/**
+ * Releases everything.  No query can be running anymore.
+ */
+
+void nsec3_proof_cache_finalize();
+
+bool nsec3_proof_cache_enabled();
+
+/**
+ * Returns the current generation of the proofs of a zone.
+ * It has to be read BEFORE looking for the closest provable encloser and
+ * given to nsec3_proof_cache_put.
+ * 
+ * @param zone the zone of the proof
+ */
+
+u64 nsec3_proof_cache_generation(const zdb_zone *zone);
+
+/**
+ * Looks for the proof of the closest provable encloser covering the digest
+ * of the next closer name.
+ * 
+ * Must be called inside an epoch.
+ * 
+ * @param zone the zone of the proof
+ * @param label the closest provable encloser
+ * @param next_closer_digest the digest of the next closer name (length-prefixed)
+ * @param out_owners receives the owners of the records found
+ * @param out_nsec3 receives the NSEC3 records, allocated by a malloc, or NULL
+ * @param out_nsec3_rrsig receives references to the signatures of the records
+ * 
+ * @return TRUE if the proof has been found
+ */
+
+bool nsec3_proof_cache_get(const zdb_zone *zone, const zdb_rr_label *label, const u8 *next_closer_digest,
+                           u8 * const *out_owners,
+                           zdb_packed_ttlrdata **out_nsec3,
+                           zdb_packed_ttlrdata **out_nsec3_rrsig);
+
+/**
+ * Stores a proof that has just been built by nsec3_name_error.
+ * 
+ * Must be called inside the same epoch as the proof has been built.
+ * 
+ * @param generation the value of nsec3_proof_cache_generation(zone) before the proof has been built
+ * @param zone the zone of the proof
+ * @param label the closest provable encloser
+ * @param next_closer_digest the digest of the next closer name (length-prefixed)
+ * @param next_closer_nsec3 the NSEC3 item covering next_closer_digest
+ * @param owners the owners of the records
+ * @param nsec3 the NSEC3 records, or NULL
+ * @param nsec3_rrsig the signatures of the records
+ */
+
+void nsec3_proof_cache_put(u64 generation, const zdb_zone *zone, const zdb_rr_label *label, const u8 *next_closer_digest,
+                           const nsec3_zone_item *next_closer_nsec3,
+                           u8 * const *owners,
+                           zdb_packed_ttlrdata * const *nsec3,
+                           zdb_packed_ttlrdata * const *nsec3_rrsig);
+
+/**
+ * Invalidates the cached proofs of a zone.
+ * Called when a writer releases the zone.
+ */
+
+void nsec3_proof_cache_invalidate(zdb_zone *zone);
+
+/**
+ * Invalidates every cached proof.
+ * Called when a zone is mounted or destroyed.
+ */
+
+void nsec3_proof_cache_invalidate_all();
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _NSEC3_PROOF_CACHE_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
@@ -78,6 +78,9 @@ extern "C"
 #define NSEC3_LABELEXT_TAG	    0x54584542414c334e	/* N3LABEXT */
 #define NSEC3_TYPEBITMAPS_TAG	    0x5350414d4254334e	/* N3TBMAPS */
 #define NSEC3_LABELPTRARRAY_TAG	    0x595252412a4c334e	/* N3L*ARRY */
+#define NSEC3_UPDATEBATCH_TAG	    0x544142445055334e	/* N3UPDBAT */
+#define NSEC3_PROOFCACHESLOTS_TAG   0x544f4c534350334e	/* N3PCSLOT */
+#define NSEC3_PROOFCACHEENTRY_TAG   0x5952544e4350334e	/* N3PCNTRY */
 
     /** The NSEC3 node with this flag on is scheduled for a processing (ie: signature)
      *  It is thus FORBIDDEN to delete it (but it MUST be removed from the NSEC3 collection)
@@ -148,6 +151,14 @@ struct nsec3_chain_context
 
 typedef struct nsec3_chain_context nsec3_chain_context;
 
+/*
+ * Gives the digest of fqdn for the chain of the nsec3param_rdata, when it is already known.
+ * digest[0] holds the size of the digest, the callback sets the digest from digest[1].
+ * Returns FALSE if the digest has to be computed.
+ */
+
+typedef bool nsec3_digest_hint_callback(void *args, const u8 *nsec3param_rdata, const u8 *fqdn, u32 fqdn_len, u8 *digest);
+
 struct nsec3_load_context
 {
     ptr_vector  nsec3;
@@ -155,6 +166,9 @@ struct nsec3_load_context
     nsec3_chain_context *chain;
     zdb_zone* zone;
     
+    nsec3_digest_hint_callback *digest_hint;
+    void *digest_hint_args;
+    
     u32 rrsig_added;
     u32 rrsig_ignored;
     u32 rrsig_discarded;
@@ -55,6 +55,10 @@ extern "C"
     
 ya_result nsec3_update_zone(zdb_zone* zone);
 
+/* Same as nsec3_update_zone, the digests given by the hint are not computed */
+
+ya_result nsec3_update_zone_with_hint(zdb_zone* zone, nsec3_digest_hint_callback *digest_hint, void *digest_hint_args);
+
 bool nsec3_is_label_covered(zdb_rr_label *label, bool opt_out);
 
 void nsec3_update_rrsig_commit(zdb_packed_ttlrdata *removed_rrsig_sll, zdb_packed_ttlrdata *added_rrsig_sll, nsec3_zone_item *item, zdb_zone *zone);
@@ -82,6 +82,18 @@
 #define QUEUE_MAX_SIZE          65536
 #define MAX_ENGINE_PRESET_COUNT 128
 
+/*
+ * The labels of a zone are sent to the signers in batches of consecutive
+ * labels (tree order).  A batch carries the relative paths of its labels in
+ * a shared pool and the signatures computed for it in an arena that is
+ * released at once after the commit.
+ */
+
+#define RRSIG_UPDATE_BATCH_SIZE         256
+#define RRSIG_UPDATE_BATCH_PATH_SIZE    (RRSIG_UPDATE_BATCH_SIZE * 8)
+#define RRSIG_UPDATE_BATCH_QUEUE_SIZE   (QUEUE_MAX_SIZE / RRSIG_UPDATE_BATCH_SIZE)
+#define RRSIG_OUTPUT_ARENA_SIZE         65536
+
 /** The label is not signed */
 #define RRSIG_VERIFIER_RESULT_LABELNOTSIGNED    4
 /** The type is not signed */
@@ -126,6 +138,21 @@
 extern "C" {
 #endif
 
+typedef struct rrsig_output_arena rrsig_output_arena;
+
+/*
+ * A chunk of signature records, allocated by bumping "used".
+ * The records of the chunk are released all at once.
+ */
+
+struct rrsig_output_arena
+{
+    rrsig_output_arena* next;
+    u32 used;
+    u32 size;
+    /* followed by "size" bytes */
+};
+
 typedef struct rrsig_context rrsig_context;
 
 
@@ -153,6 +180,13 @@ struct rrsig_context
 
     zdb_packed_ttlrdata* removed_rrsig_sll;
 
+    /*
+     * If not NULL, the added/removed signatures are allocated in this arena
+     * (chain of chunks) instead of being MALLOC'ed one by one.
+     */
+
+    rrsig_output_arena** output_arenap;
+
     /* Used for RR canonization */
     ptr_vector rrs;
 
@@ -267,40 +301,59 @@ typedef struct rrsig_update_query rrsig_update_query;
 struct rrsig_update_query
 {
     /*
-     * So I can reschedule verifications
-     */
-
-    zdb_zone* zone;
-    
-    /*
-     * I need the full path to the label
-     *
      * I need the said label
      */
 
     zdb_rr_label* label;
 
     /*
-     * New rrsig_ssl (MALLOC)
+     * New rrsig_ssl (batch arena)
      */
 
     zdb_packed_ttlrdata* added_rrsig_sll;
 
     /*
-     * Expired/invalid rrsig_ssl (MALLOC)
+     * Expired/invalid rrsig_ssl (batch arena)
      */
 
     zdb_packed_ttlrdata* removed_rrsig_sll;
 
-    /* STACK! */
-    
-    dnsname_stack path;
+    /*
+     * I need the full path to the label:
+     * path[path_offset] to path[path_offset + path_size] in the batch pool
+     */
+
+    u16 path_offset;
+    s16 path_size;
 
     /* We are not at the apex and we have at least one NS record */
 
     bool delegation;
 };
 
+typedef struct rrsig_update_batch rrsig_update_batch;
+
+
+struct rrsig_update_batch
+{
+    /*
+     * So I can reschedule verifications
+     */
+
+    zdb_zone* zone;
+
+    /* The signatures of the batch */
+
+    rrsig_output_arena* arena;
+
+    u32 count;
+    u32 path_count;
+
+    rrsig_update_query queries[RRSIG_UPDATE_BATCH_SIZE];
+
+    u8* path[RRSIG_UPDATE_BATCH_PATH_SIZE];
+};
+
 #if ZDB_NSEC3_SUPPORT != 0
 
 typedef struct nsec3_rrsig_update_query nsec3_rrsig_update_query;
@@ -369,6 +422,29 @@ ya_result rrsig_update_label(rrsig_context* context, zdb_rr_label* label, bool d
 void
 rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata* added_rrsig_sll, zdb_rr_label* label, zdb_zone* zone, dnsname_stack* name);
 
+/*
+ * Batches of labels for the signers
+ */
+
+rrsig_update_batch* rrsig_update_batch_new(zdb_zone* zone);
+
+/* Returns TRUE if the batch cannot take another label with that path */
+bool rrsig_update_batch_full(const rrsig_update_batch* batch, const dnsname_stack* path);
+
+void rrsig_update_batch_add(rrsig_update_batch* batch, zdb_rr_label* label, const dnsname_stack* path, bool delegation);
+
+/* Restores the path of a query of the batch */
+void rrsig_update_batch_get_path(const rrsig_update_batch* batch, const rrsig_update_query* query, dnsname_stack* path);
+
+/*
+ * Commits all the results of the batch.  The caller is expected to hold the zone.
+ * The signatures are not released : rrsig_update_batch_free does it.
+ */
+
+void rrsig_update_batch_commit(rrsig_update_batch* batch);
+
+void rrsig_update_batch_free(rrsig_update_batch* batch);
+
 /*
  * Returns the first rrsig record that applies to the give type.
  */
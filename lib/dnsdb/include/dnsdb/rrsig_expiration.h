@@ -0,0 +1,134 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup rrsig RRSIG functions
+ *  @ingroup dnsdbdnssec
+ *  @brief Index of the signature expirations of a zone
+ *
+ *  Keeps, for each zone, the owner names of the signatures sorted by the
+ *  time at which they expire.  Names are grouped in buckets of
+ *  RRSIG_EXPIRATION_BUCKET_SECONDS so the tree only has a node per bucket.
+ *
+ *  The index is fed by the zone loader and by the signature commits and
+ *  drained by the incremental signature maintenance which only re-signs the
+ *  labels entering the regeneration window.
+ *
+ *  A name can be present more than once and can refer to a label that does
+ *  not exist anymore : the re-signer skips both cases.
+ *
+ *  NSEC3 signatures are not bound to a label, only their earliest expiration
+ *  is kept.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+#ifndef _RRSIG_EXPIRATION_H
+#define	_RRSIG_EXPIRATION_H
+
+#include <dnscore/sys_types.h>
+#include <dnscore/mutex.h>
+#include <dnsdb/avl.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define RRSIG_EXPIRATION_BUCKET_SECONDS 3600
+
+typedef struct rrsig_expiration_index rrsig_expiration_index;
+
+struct rrsig_expiration_index
+{
+    avl_tree buckets;           /* epoch / RRSIG_EXPIRATION_BUCKET_SECONDS -> rrsig_expiration_bucket* */
+    mutex_t mutex;
+    u32 count;                  /* names in the index */
+    u32 nsec3_invalid_first;    /* earliest expiration of an NSEC3 signature */
+};
+
+/**
+ * Enables or disables the indexing (disabled by default)
+ */
+
+void rrsig_expiration_index_enable(bool enable);
+bool rrsig_expiration_index_enabled();
+
+void rrsig_expiration_index_init(rrsig_expiration_index* index);
+void rrsig_expiration_index_destroy(rrsig_expiration_index* index);
+
+/**
+ * Records that a signature of the owner fqdn expires at valid_until
+ */
+
+void rrsig_expiration_index_add(rrsig_expiration_index* index, const u8* fqdn, u32 valid_until);
+
+/**
+ * Records that a signature of the NSEC3 chain expires at valid_until
+ */
+
+void rrsig_expiration_index_add_nsec3(rrsig_expiration_index* index, u32 valid_until);
+
+/**
+ * Forgets the expiration of the NSEC3 chain signatures (before the chain is processed)
+ */
+
+void rrsig_expiration_index_clear_nsec3(rrsig_expiration_index* index);
+
+/**
+ * Takes out one name whose signatures expire before the until epoch.
+ * Only the buckets ending before until are considered.
+ *
+ * @param index the index
+ * @param until the end of the window
+ * @param fqdn receives the name (MAX_DOMAIN_LENGTH bytes)
+ *
+ * @return TRUE if a name has been copied to fqdn
+ */
+
+bool rrsig_expiration_index_pop(rrsig_expiration_index* index, u32 until, u8* fqdn);
+
+/**
+ * Returns the earliest expiration in the index (labels and NSEC3 chain), MAX_U32 if the index is empty.
+ * For labels, this is the end of the earliest bucket : all its signatures have expired at that time.
+ */
+
+u32 rrsig_expiration_index_first(rrsig_expiration_index* index);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _RRSIG_EXPIRATION_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
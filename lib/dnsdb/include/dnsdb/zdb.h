@@ -160,6 +160,9 @@ static inline void zdb_query_ex_answer_create(zdb_query_ex_answer *ans_auth_add)
  *
  *  After the answer has been processed, it must be destroyed using zdb_query_ex_answer_destroy
  *
+ *  The answer points into the database.  When ZDB_EXPLICIT_READER_ZONE_LOCK == 2, the caller
+ *  must be in an epoch (zdb_epoch_enter) from the query until the answer has been written.
+ *
  * @param db
  * @param mesg
  * @param ans_auth_add
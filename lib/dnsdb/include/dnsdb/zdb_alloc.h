@@ -127,6 +127,27 @@ void zdb_mfree(void* ptr, u32 page_index);
 u64 zdb_mheap(u32 page);
 u64 zdb_mavail(u32 page);
 
+/**
+ * Number of free slots of a memory set held in the per-thread caches
+ */
+
+u64 zdb_mcached(u32 page);
+
+/**
+ * Gives the slots cached by the calling thread back to the shared pool.
+ * Meant for a thread that is about to stop allocating for a long time.
+ * (The cache of a thread is flushed automatically when it ends.)
+ */
+
+void zdb_mcache_flush();
+
+/**
+ * Allocations served by the per-thread caches (hits) and refills from the
+ * shared pool (misses)
+ */
+
+void zdb_mcache_stats(u64 *hits, u64 *misses);
+
 #ifndef _ZALLOC_C
 extern pthread_t zalloc_owner;
 #endif
@@ -0,0 +1,174 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup answer_cache Cache of fully built answers
+ *  @ingroup dnsdb
+ *  @brief Cache of fully built answers
+ *
+ *  The wire answers to the most asked (qname, qtype, class, DO, EDNS size)
+ *  tuples are kept so that they can be sent again without going through
+ *  zdb_query_ex and zdb_query_message_update.
+ *
+ *  A change to a zone invalidates the answers of that zone only : every
+ *  change is made under a writer lock, and releasing it bumps the generation
+ *  of the zone.  Mounting or destroying a zone changes which zone answers a
+ *  name and invalidates the whole cache.
+ *  Entries from an older generation are ignored then recycled.
+ *
+ *  The cache relies on the query being made inside an epoch
+ *  (see zdb_epoch.h) as an entry references its zone.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+#ifndef _ZDB_ANSWER_CACHE_H
+#define	_ZDB_ANSWER_CACHE_H
+
+#include <dnscore/message.h>
+
+#include <dnsdb/zdb_types.h>
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Number of independently locked parts of the cache.  Power of 2.
+ */
+
+#define ZDB_ANSWER_CACHE_STRIPES        256
+
+#define ZDB_ANSWER_CACHE_BUCKETS_MIN    256
+#define ZDB_ANSWER_CACHE_BUCKETS_MAX    0x100000
+
+typedef struct zdb_answer_cache_stats zdb_answer_cache_stats;
+
+struct zdb_answer_cache_stats
+{
+    u64 hits;
+    u64 misses;
+    u32 count;
+    u32 bytes;
+};
+
+typedef struct zdb_answer_cache_snapshot zdb_answer_cache_snapshot;
+
+struct zdb_answer_cache_snapshot
+{
+    zdb_zone *zone;             /* the zone that answers the query, or NULL */
+    u32 zones_generation;
+    u32 generation;             /* of the zone */
+};
+
+/**
+ * Sets up the cache.
+ * 
+ * @param max_bytes the memory the cache is allowed to use, 0 disables it
+ */
+
+void zdb_answer_cache_init(u32 max_bytes);
+
+/**
+ * Releases everything.  No query can be running anymore.
+ */
+
+void zdb_answer_cache_finalize();
+
+bool zdb_answer_cache_enabled();
+
+/**
+ * Finds the zone that answers the query and reads the generations.
+ * It has to be done BEFORE computing an answer and given to zdb_answer_cache_put.
+ * 
+ * Must be called inside the epoch of the query.
+ * 
+ * @param snapshot receives the zone and the generations
+ * @param db the database the answer comes from
+ * @param mesg the query
+ */
+
+void zdb_answer_cache_snapshot_init(zdb_answer_cache_snapshot *snapshot, const zdb *db, const message_data *mesg);
+
+/**
+ * Looks for a cached answer to the query in mesg.
+ * On a hit, the answer is written into mesg (buffer, send_length, status
+ * and referral) keeping the ID and the case of the question.
+ * 
+ * Must be called inside an epoch.
+ * 
+ * @param mesg the query
+ * @param zonep if not NULL, receives the zone of the answer on a hit
+ * 
+ * @return TRUE if the answer has been written
+ */
+
+bool zdb_answer_cache_get(message_data *mesg, const zdb_zone **zonep);
+
+/**
+ * Stores the answer that has just been built in mesg, if it can be.
+ * 
+ * Must be called inside the same epoch as the query.
+ * 
+ * @param mesg the answered message
+ * @param snapshot as set by zdb_answer_cache_snapshot_init before the query
+ */
+
+void zdb_answer_cache_put(message_data *mesg, const zdb_answer_cache_snapshot *snapshot);
+
+/**
+ * Invalidates the cached answers of a zone.
+ * Called when a writer releases the zone.
+ */
+
+void zdb_answer_cache_invalidate(zdb_zone *zone);
+
+/**
+ * Invalidates every cached answer.
+ * Called when a zone is mounted or destroyed.
+ */
+
+void zdb_answer_cache_invalidate_all();
+
+void zdb_answer_cache_get_stats(zdb_answer_cache_stats *stats);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ZDB_ANSWER_CACHE_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
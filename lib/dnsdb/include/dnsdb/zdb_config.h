@@ -175,6 +175,18 @@ extern "C"
     
 #define ZDB_ZALLOC_THREAD_SAFE  1
 
+/**
+ * When ZALLOC is thread-safe, each thread keeps up to this number of free
+ * slots by size class (a magazine) and only goes to the shared (locked) pool
+ * to refill or drain half of it.
+ *
+ * 0 disables the magazines.
+ *
+ * Recommended value: 64
+ */
+
+#define ZDB_ZALLOC_MAGAZINE_SIZE 64
+
 /**
  * Debugging with ZALLOC enabled can be difficult.  This flag disables ZALLOC on debug builds.
  */
@@ -206,13 +218,15 @@ extern "C"
 
 /**
  * If the number of items in a dictionnary goes beyond this number, the dictionnary
- * will change from a balanced tree (AVL) to an hash-table of balanced trees.
+ * will change from a balanced tree (AVL) to an open addressing hash-table.
  *
- * Recommended value: 500000
+ * Below that, the tree is as fast and lighter for the few children most labels have.
+ *
+ * Recommended value: 16
  *
  */
 
-#define ZDB_HASHTABLE_THRESHOLD 500000
+#define ZDB_HASHTABLE_THRESHOLD 16
 
 /**
  *
@@ -239,13 +253,23 @@ extern "C"
  * The lock can still be drastically improved.
  * 
  * == 0: no lock
- * != 0: lock
+ * == 1: lock
+ * == 2: epoch: the readers only announce themselves (see zdb_epoch.h),
+ *       the writers defer the release of what they remove from the zone:
+ *       labels, records, AVL nodes (the nodes moved by a rotation or a
+ *       delete are copied first) and the collections replaced by
+ *       dictionary_mutate.
+ *       The DNSSEC queries on a NSEC or NSEC3 zone still take the lock as
+ *       the chains are updated in place.
+ * 
+ * Whatever the value, queries run inside an epoch: the zone index and the
+ * answer caches are read without a lock and rely on it.
  * 
- * The locking mechanism itself can be vastly improved
+ * Recommended value: 2
  */
     
 
-#define ZDB_EXPLICIT_READER_ZONE_LOCK 1
+#define ZDB_EXPLICIT_READER_ZONE_LOCK 2
     
 /**
  *
@@ -0,0 +1,166 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup epoch Epoch-based reclamation for the zone readers
+ *  @ingroup dnsdb
+ *  @brief Epoch-based reclamation for the zone readers
+ *
+ *  A reader only announces, in its own (cache-line sized) slot, the global
+ *  epoch it entered with.  Writers, instead of freeing what they unlinked
+ *  from a structure the readers walk without a lock (the zone index, the
+ *  answer and proof caches, and the whole zone when
+ *  ZDB_EXPLICIT_READER_ZONE_LOCK == 2), hand it to zdb_epoch_defer.
+ *  The memory is released once every reader that may have seen it has left
+ *  its critical section (grace period).
+ *
+ *  Readers never wait.  Writers only wait in zdb_epoch_synchronize, which is
+ *  used when a whole zone is about to be destroyed.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+#ifndef _ZDB_EPOCH_H
+#define	_ZDB_EPOCH_H
+
+#include <dnscore/sys_types.h>
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Maximum number of threads that can be inside a zone at the same time.
+ * A slot is taken by a thread the first time it enters and given back when
+ * the thread ends.
+ */
+
+#define ZDB_EPOCH_READER_MAX        1024
+
+/**
+ * Number of deferred items held by one limbo chunk
+ */
+
+#define ZDB_EPOCH_LIMBO_CHUNK_SIZE  254
+
+/**
+ * zdb_epoch_reclaim_bounded does nothing below this many deferred items
+ */
+
+#define ZDB_EPOCH_RECLAIM_THRESHOLD 1024
+
+/**
+ * Maximum number of items released by one call to zdb_epoch_reclaim_bounded
+ */
+
+#define ZDB_EPOCH_RECLAIM_MAX       4096
+
+typedef void zdb_epoch_free_callback(void *ptr);
+
+/**
+ * Orders two loads made by a reader: the second one cannot be satisfied
+ * before the first one.  Loads are not reordered on x86, only the compiler
+ * has to be stopped there.
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+#define ZDB_EPOCH_READ_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define ZDB_EPOCH_READ_BARRIER() __sync_synchronize()
+#endif
+
+/**
+ * Enters a read-side critical section.
+ * Nestable.  Never blocks.
+ */
+
+void zdb_epoch_enter();
+
+/**
+ * Leaves a read-side critical section.
+ */
+
+void zdb_epoch_leave();
+
+/**
+ * Queues the release of ptr until all the readers currently inside a zone
+ * have left.  The item MUST already be unreachable from the database.
+ * 
+ * @param callback the function that will release the memory
+ * @param ptr the memory
+ */
+
+void zdb_epoch_defer(zdb_epoch_free_callback *callback, void *ptr);
+
+/**
+ * Releases every deferred item whose grace period has elapsed.
+ * Never blocks on a reader.
+ * 
+ * @return the number of items still waiting
+ */
+
+u32 zdb_epoch_reclaim();
+
+/**
+ * Cheap version of zdb_epoch_reclaim for the writers' hot paths.
+ * Does nothing unless at least ZDB_EPOCH_RECLAIM_THRESHOLD items are waiting
+ * or if another thread is already reclaiming, and releases at most
+ * ZDB_EPOCH_RECLAIM_MAX items.
+ */
+
+void zdb_epoch_reclaim_bounded();
+
+/**
+ * Waits for every reader currently in a critical section to leave it,
+ * then releases all the deferred items.
+ * Must not be called from inside a read-side critical section.
+ */
+
+void zdb_epoch_synchronize();
+
+/**
+ * Releases everything.  To be called once no reader can be running anymore.
+ */
+
+void zdb_epoch_finalize();
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ZDB_EPOCH_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
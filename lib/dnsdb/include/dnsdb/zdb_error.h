@@ -94,6 +94,8 @@ extern "C" {
 #define ZDB_READER_MIXED_DNSSEC_VERSIONS        ZDB_ERROR_CODE(28)
 #define ZDB_READER_ALREADY_LOADED               ZDB_ERROR_CODE(28)
 
+#define ZDB_ERROR_ZONE_CHANGED_DURING_AXFR      ZDB_ERROR_CODE(29)
+
 #define DNSSEC_ERROR_BASE		        0x80050000
 #define DNSSEC_ERROR_CODE(code_)	        ((s32)(DNSSEC_ERROR_BASE+(code_)))
 
@@ -120,6 +122,7 @@ extern "C" {
 #define DNSSEC_ERROR_KEYISTOOBIG		    DNSSEC_ERROR_CODE( 72)
 
 #define DNSSEC_ERROR_RSASIGNATUREFAILED		DNSSEC_ERROR_CODE(128)
+#define DNSSEC_ERROR_ECDSASIGNATUREFAILED	DNSSEC_ERROR_CODE(129)
 
 #define DNSSEC_ERROR_NSEC3_INVALIDZONESTATE	DNSSEC_ERROR_CODE(256)
 #define DNSSEC_ERROR_NSEC3_LABELTODIGESTFAILED	DNSSEC_ERROR_CODE(257)
@@ -53,7 +53,8 @@ extern "C"
 #endif
 
 /**
- * The incremental changes are in two files.  This way we don't care about intertwined ADD & REMOVE.
+ * The incremental changes are recorded in two streams.  This way we don't care about intertwined ADD & REMOVE.
+ * They are kept in memory (in temporary files when they are big) then appended to the journal of the zone.
  */
 
 /*
@@ -82,6 +83,13 @@ extern "C"
 
 #define ICMTL_WIRE_FILE_FORMAT "%s/%{dnsname}%08x-%08x." ICMTL_EXT
 
+/*
+ * The journals appended to within that many milliseconds are synced together.
+ * zdb_icmtl_end waits for that sync.
+ */
+
+#define ZDB_ICMTL_SYNC_WINDOW_DEFAULT 5
+
 #define ZDB_ICMTL_ITEM_ADD	1
 #define ZDB_ICMTL_ITEM_REMOVE	2
 #define ZDB_ICMTL_ITEM_NOP	(ZDB_ICMTL_ITEM_ADD|ZDB_ICMTL_ITEM_REMOVE)
@@ -104,8 +112,8 @@ typedef struct zdb_icmtl zdb_icmtl;
 
 struct zdb_icmtl
 {
-    output_stream os_remove_;
-    output_stream os_add_;
+    output_stream os_remove_;   /* memory, then temporary file */
+    output_stream os_add_;      /* memory, then temporary file */
     
     output_stream os_remove;
     output_stream os_add;
@@ -119,6 +127,7 @@ struct zdb_icmtl
     counter_output_stream_data os_add_stats;
     
     u32 patch_index;
+    u32 serial_increment;   /* added to the serial at the end if the SOA has not been changed, defaults to 1 */
         
     u32 soa_ttl;    
     u16 soa_rdata_size;     
@@ -163,6 +172,7 @@ ya_result zdb_icmtl_begin(zdb_zone *zone, zdb_icmtl *icmtl, const char *folder);
 
 /**
  * Disables incremental changes recording in the zone and record them into a file
+ * Returns once the file has been synced (see zdb_icmtl_set_sync_window)
  */
 
 ya_result zdb_icmtl_end(zdb_icmtl* icmtl, const char *folder);
@@ -219,6 +229,21 @@ ya_result zdb_icmtl_get_last_soa_from(u32 serial, u8 *origin, const char* direct
 
 ya_result zdb_icmtl_open_ix_get_soa(const u8 *origin, const char *directory, u32 serial, input_stream *is, struct type_class_ttl_rdlen *tctrp, u8 *rdata_buffer_780, u32 *rdata_size);
 
+/**
+ * Sets the time (ms) the sync of a journal can be delayed for after changes have been appended to it,
+ * when another sync is already pending or running (a lone commit is synced right away).
+ * The changes appended in the meantime are synced with the same call.
+ * 0 syncs after each append.
+ */
+
+void zdb_icmtl_set_sync_window(u32 milliseconds);
+
+/**
+ * Syncs the journals waiting for it and releases the indexes of the journals
+ */
+
+void zdb_icmtl_finalize();
+
 
 #ifdef	__cplusplus
 }
@@ -0,0 +1,202 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbicmtl Journal
+ *  @ingroup dnsdb
+ *  @brief Index of the deltas of a zone journal
+ *
+ *  The journal of a zone (the ".ix" file) is a plain sequence of records that
+ *  is also appended to by the slave transfers and served as-is for IXFR, so it
+ *  cannot hold anything but records.  Its index is kept next to it, in
+ *  "<origin>ixi", and maps the serial each delta starts from to the position
+ *  of that delta in the journal, with its size and checksum.
+ *
+ *  The index is a cache: it is checked against the journal it describes and
+ *  rebuilt, or completed, from the journal itself when it does not match.
+ *
+ *  The deltas are appended to the journal in place : its name keeps the serials
+ *  it was created with, the serial it really ends at is the one of its index.
+ *
+ *  All the integers are in network order.
+ *
+ *  header (32 bytes)
+ *
+ *      0  u32 magic ('YJIX')
+ *      4  u16 version
+ *      6  u16 reserved
+ *      8  u32 serial the journal starts from
+ *     12  u32 serial the name of the journal ends at
+ *     16  u64 device of the journal
+ *     24  u64 inode of the journal
+ *
+ *  entries (32 bytes each), in the order of the journal
+ *
+ *      0  u32 serial the delta starts from
+ *      4  u32 serial the delta ends at
+ *      8  u64 offset of the delta in the journal
+ *     16  u64 size of the delta
+ *     24  u64 checksum of the delta (zdb_zone_snapshot_checksum)
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+#ifndef _ZDB_ICMTL_INDEX_H
+#define	_ZDB_ICMTL_INDEX_H
+
+#include <dnsdb/zdb_types.h>
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#define ZDB_ICMTL_INDEX_MAGIC               0x594a4958 /* YJIX */
+#define ZDB_ICMTL_INDEX_VERSION             2
+
+#define ZDB_ICMTL_INDEX_HEADER_SIZE         32
+#define ZDB_ICMTL_INDEX_ENTRY_SIZE          32
+
+#define ICMTL_INDEX_FILE_FORMAT             "%s/%{dnsname}ixi"
+
+typedef struct zdb_icmtl_index_entry zdb_icmtl_index_entry;
+
+struct zdb_icmtl_index_entry
+{
+    u32 serial_from;
+    u32 serial_to;
+    u64 offset;
+    u64 size;
+    u64 checksum;
+};
+
+/**
+ * Gives the serials of the journal of a zone, as they are known by its index.
+ * This allows to open the journal without looking for it in the directory.
+ * 
+ * @param origin the zone
+ * @param folder the directory of the journal
+ * @param fromp will receive the serial the journal starts from
+ * @param top will receive the serial the journal ends at
+ * @param name_top will receive the serial the name of the journal ends at
+ * 
+ * @return TRUE if the index has at least one delta
+ */
+
+bool zdb_icmtl_index_get_range(const u8 *origin, const char *folder, u32 *fromp, u32 *top, u32 *name_top);
+
+/**
+ * Gives the serial a journal found in the directory really ends at.
+ * Its name only tells where it ended when it was created.
+ * 
+ * @param origin the zone
+ * @param folder the directory of the journal
+ * @param fd the journal, opened for reading
+ * @param journal_from the serial the journal starts from (in its name)
+ * @param journal_to the serial the journal ends at (in its name)
+ * @param top will receive the serial of the end of the last complete delta
+ * 
+ * @return an error code, ZDB_ERROR_ICMTL_NOTFOUND if the journal holds no complete delta
+ */
+
+ya_result zdb_icmtl_index_get_end(const u8 *origin, const char *folder, int fd, u32 journal_from, u32 journal_to, u32 *top);
+
+/**
+ * Gives the position of the delta starting at a serial in the journal.
+ * 
+ * @param origin the zone
+ * @param folder the directory of the journal
+ * @param fd the journal, opened for reading
+ * @param journal_from the serial the journal starts from (in its name)
+ * @param journal_to the serial the journal ends at (in its name)
+ * @param serial the serial of the delta
+ * @param offsetp will receive the position of the delta
+ * 
+ * @return an error code, ZDB_ERROR_ICMTL_SOANOTFOUND if the serial is not in the journal
+ */
+
+ya_result zdb_icmtl_index_find(const u8 *origin, const char *folder, int fd, u32 journal_from, u32 journal_to, u32 serial, u64 *offsetp);
+
+/**
+ * Brings the index up to date with the journal before a delta is appended to it.
+ * An incomplete delta at the end of the journal is cut.
+ * Until zdb_icmtl_index_append, the readers ignore what follows that position.
+ * 
+ * @param origin the zone
+ * @param folder the directory of the journal
+ * @param fd the journal, opened for writing
+ * @param journal_from the serial the journal starts from (in its name)
+ * @param journal_to the serial the journal ends at (in its name)
+ * @param offsetp will receive the position the next delta will be written at
+ * 
+ * @return an error code
+ */
+
+ya_result zdb_icmtl_index_prepare_append(const u8 *origin, const char *folder, int fd, u32 journal_from, u32 journal_to, u64 *offsetp);
+
+/**
+ * Adds the delta that has just been appended to the journal.
+ * Must follow zdb_icmtl_index_prepare_append, even if the append failed.
+ * 
+ * @param origin the zone
+ * @param folder the directory of the journal
+ * @param entry the delta, NULL if it could not be appended
+ */
+
+void zdb_icmtl_index_append(const u8 *origin, const char *folder, const zdb_icmtl_index_entry *entry);
+
+/**
+ * Gives a descriptor of the index file, so it can be synced with its journal.
+ * 
+ * @param origin the zone
+ * 
+ * @return a descriptor the caller has to close, -1 if the index has no file
+ */
+
+int zdb_icmtl_index_dup_file(const u8 *origin);
+
+/**
+ * Releases all the indexes.
+ */
+
+void zdb_icmtl_index_finalize();
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ZDB_ICMTL_INDEX_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
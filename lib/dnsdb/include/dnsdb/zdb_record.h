@@ -179,6 +179,17 @@ ya_result zdb_record_delete(zdb_rr_collection* collection, u16 type);
 /* 4 USES */
 ya_result zdb_record_delete_exact(zdb_rr_collection* collection, u16 type, zdb_ttlrdata* ttl_rdata);
 
+/** @brief Releases a resource record removed from a zone
+ *
+ *  Releases a resource record that has been unlinked from a zone, once no
+ *  query can be reading it anymore (ZDB_EXPLICIT_READER_ZONE_LOCK == 2),
+ *  else at once.  The next field is not touched.
+ *
+ *  @param[in]  record the record to release
+ */
+
+void zdb_record_retire(zdb_packed_ttlrdata* record);
+
 /** @brief Destroys all the a resource record of the collection
  *
  *  Destroys all the a resource record of the collection
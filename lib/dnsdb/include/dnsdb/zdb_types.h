@@ -50,6 +50,9 @@
 #include <dnscore/message.h>
 #include <dnscore/mutex.h>
 #include <dnscore/alarm.h>
+#if ZDB_DNSSEC_SUPPORT != 0
+#include <dnsdb/rrsig_expiration.h>
+#endif
 
 #ifdef	__cplusplus
 extern "C"
@@ -227,7 +230,7 @@ struct zdb_packed_ttlrdata
 #define ZDB_RECORD_MALLOC_EMPTY(record_,ttl_,len_)                      \
     {                                                                   \
         u32 size=sizeof(zdb_packed_ttlrdata)-1+len_;                    \
-	MALLOC_OR_DIE(zdb_packed_ttlrdata*,(record_),sizeof(zdb_packed_ttlrdata)-1+len_,ZDB_RECORD_TAG); /* ZALLOC IMPOSSIBLE */ \
+	MALLOC_OR_DIE(zdb_packed_ttlrdata*,(record_),size,ZDB_RECORD_TAG); /* ZALLOC IMPOSSIBLE */ \
                                                                         \
         (record_)->ttl=ttl_;                                            \
         (record_)->rdata_size=len_;                                     \
@@ -510,6 +513,12 @@ struct zdb_zone
     
     u32 min_ttl;        /* a copy of the min-ttl from the SOA */
 
+    volatile u32 answer_cache_generation;   /* bumped when a writer releases the zone */
+#if ZDB_NSEC3_SUPPORT != 0
+    volatile u32 proof_cache_generation;    /* bumped when a writer releases the zone */
+#endif
+    volatile bool axfr_stream_locked;       /* a writer cut the last AXFR streamed in an epoch : the next one holds the reader lock */
+
 #if ZDB_DNSSEC_SUPPORT != 0
     
     u32 sig_validity_regeneration_seconds;
@@ -523,6 +532,13 @@ struct zdb_zone
      */
     
     u32 sig_invalid_first;
+
+    /**
+     * The owners of the signatures, by expiration time.
+     * Used by the incremental signature maintenance.
+     */
+
+    rrsig_expiration_index sig_expiration;
 #endif
     
     alarm_t alarm_handle;
@@ -534,6 +550,9 @@ struct zdb_zone
 #endif
     
     mutex_t mutex;
+#if MUTEX_USE_SPINLOCK == 0
+    pthread_cond_t mutex_cond;  /* broadcasted when the lock is released */
+#endif
 
     dnsname_vector origin_vector;
 
@@ -556,7 +575,9 @@ struct zdb_zone_label
     zdb_rr_collection global_resource_record_set;
 #endif
     zdb_zone* zone; /* zone cut starting at this level                   */
-}; /* 32 56 */
+    zdb_zone_label* parent; /* label of the upper level, NULL for "."          */
+    zdb_zone_label* index_next; /* labels sharing a hash in the zone index       */
+}; /* 40 72 */
 
 typedef zdb_zone_label* zdb_zone_label_pointer_array[DNSNAME_MAX_SECTIONS];
 
@@ -568,6 +589,8 @@ typedef struct zdb zdb;
 struct zdb
 {
     zdb_zone_label* root[ZDB_RECORDS_MAX_CLASS];
+    htoa zone_index[ZDB_RECORDS_MAX_CLASS]; /* every zone label, by hash of its full name */
+    u8 zone_index_depth[ZDB_RECORDS_MAX_CLASS]; /* deepest label ever indexed */
     alarm_t alarm_handle;
     /* u32 items; */
 };
@@ -585,6 +608,7 @@ struct zdb_query_ex_answer
     zdb_resourcerecord *answer;
     zdb_resourcerecord *authority;
     zdb_resourcerecord *additional;
+    const zdb_zone *zone; // the last zone the answer has been looked for in, NULL if none
     u8 depth;           // CNAME
     u8 delegation;      // set as an integer to avoid testing for it
 };
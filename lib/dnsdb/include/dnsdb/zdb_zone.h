@@ -312,6 +312,12 @@ bool zdb_zone_trylock(zdb_zone *zone, u8 owner);
 
 void zdb_zone_unlock(zdb_zone *zone, u8 owner);
 
+/**
+ * Tells if the zone is currently locked by an owner that can change its content.
+ */
+
+bool zdb_zone_iswritelocked(zdb_zone *zone);
+
 /**
  * Exchange the current zone with a dummy invalid one.
  * Do nothing if the zone in place is already invalid.
@@ -326,6 +332,20 @@ void zdb_zone_unlock(zdb_zone *zone, u8 owner);
 zdb_zone*
 zdb_zone_xchg_with_invalid(zdb *db, const u8 *origin, u16 zclass, u16 or_flags);
 
+/**
+ * Mounts a fully built (shadow) zone in place of the current one, in one pointer store.
+ * Queries see either the whole previous zone or the whole new one.
+ * Returns the previous zone (or NULL) : the queries already in it can still be
+ * reading it, it has to be released with zdb_zone_destroy, that waits for them.
+ * 
+ * @param db
+ * @param zone
+ * @return 
+ */
+
+zdb_zone*
+zdb_zone_xchg(zdb *db, zdb_zone *zone);
+
 bool
 zdb_zone_isinvalid(zdb *db, const u8 *origin, u16 zclass);
 
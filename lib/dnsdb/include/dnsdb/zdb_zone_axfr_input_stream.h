@@ -0,0 +1,91 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbscheduler Scheduled tasks of the database
+ *  @ingroup dnsdb
+ *  @brief AXFR stream of a zone
+ *
+ *  Reads the records of a zone, as zdb_zone_store_axfr writes them, straight
+ *  from the zone while they are being sent to a slave.  Nothing is copied
+ *  beyond a buffer of a few records.
+ *
+ *  The stream stays in an epoch (zdb_epoch_enter) from its opening up to its
+ *  closing : what a writer retires meanwhile is kept, and a zone replaced by
+ *  zdb_zone_xchg is only destroyed once the transfers still reading it are
+ *  done.  A writer committing on the zone during the transfer would make it
+ *  inconsistent : the stream then fails before the closing SOA (the slave
+ *  drops the transfer and retries) and the next stream of the zone holds the
+ *  reader lock from its opening up to its closing instead.
+ *
+ *  The stream must be closed by the thread that opened it.
+ *
+ * @{
+ *----------------------------------------------------------------------------*/
+#ifndef _ZDB_ZONE_AXFR_INPUT_STREAM_H
+#define	_ZDB_ZONE_AXFR_INPUT_STREAM_H
+
+#include <dnscore/input_stream.h>
+
+#include <dnsdb/zdb_types.h>
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+/* large enough for the biggest record : name, type, class, ttl, rdata size and rdata */
+
+#define ZDB_ZONE_AXFR_INPUT_STREAM_BUFFER_SIZE 131072
+
+/**
+ * Opens a stream on the records of the zone.
+ * The zone MUST NOT be locked by the caller.
+ * 
+ * @param zone the zone
+ * @param is the stream to initialise
+ * @param serialp receives the serial of the zone being sent
+ * @return an error code if the zone is invalid or has no SOA
+ */
+
+ya_result zdb_zone_axfr_input_stream_open(zdb_zone *zone, input_stream *is, u32 *serialp);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ZDB_ZONE_AXFR_INPUT_STREAM_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
@@ -0,0 +1,115 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbscheduler Scheduled tasks of the database
+ *  @ingroup dnsdb
+ *  @brief Pre-framed IXFR answers kept in the xfr directory
+ *
+ *  The answer to an IXFR from a given serial to the current serial of a zone,
+ *  as the TCP messages (with their length prefix) to send, written once in
+ *  a file next to the journal.  Every slave asking for the same delta is
+ *  answered from that file.
+ *
+ *  The messages are stored without TSIG and with a zero ID.  The header is
+ *  set for each transfer and, when needed, each message is signed on its way
+ *  out.  Without TSIG the records are sent straight from the file by the
+ *  kernel (sendfile).
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+#ifndef _ZDB_ZONE_IXFR_IMAGE_H
+#define	_ZDB_ZONE_IXFR_IMAGE_H
+
+#include <dnscore/message.h>
+#include <dnscore/rfc.h>
+
+#include <dnsdb/zdb_types.h>
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#define ZDB_ZONE_IXFR_IMAGE_FILE_FORMAT "%s/%{dnsname}%08x-%08x.ixfr"
+
+typedef struct zdb_zone_ixfr_image zdb_zone_ixfr_image;
+
+/**
+ * Gets the IXFR answer of the zone from the given serial to the current SOA, building it if needed.
+ * 
+ * @param origin the origin of the zone
+ * @param data_path the xfr directory of the zone (xfr_copy_make_data_path)
+ * @param from_serial the serial of the slave
+ * @param soa_tctrl the type class ttl rdata length of the current SOA
+ * @param soa_rdata the rdata of the current SOA
+ * @param soa_rdata_size the size of the rdata of the current SOA
+ * @param imagep receives a reference to the image
+ * 
+ * @return an error code, typically if the journal does not cover the serial
+ */
+
+ya_result zdb_zone_ixfr_image_acquire(const u8 *origin, const char *data_path, u32 from_serial, const struct type_class_ttl_rdlen *soa_tctrl, const u8 *soa_rdata, u32 soa_rdata_size, zdb_zone_ixfr_image **imagep);
+
+/**
+ * Releases a reference obtained with zdb_zone_ixfr_image_acquire
+ */
+
+void zdb_zone_ixfr_image_release(zdb_zone_ixfr_image *image);
+
+/**
+ * Sends the image on a (blocking) TCP socket as the answer to the query in mesg.
+ * The ID and the flags of the query are set on each message.
+ * If the query is signed, each message is signed.
+ * 
+ * @param image the image
+ * @param tcpfd the socket
+ * @param mesg the query, mesg->buffer is used to sign the messages
+ * 
+ * @return an error code
+ */
+
+ya_result zdb_zone_ixfr_image_send(zdb_zone_ixfr_image *image, int tcpfd, message_data *mesg);
+
+u64 zdb_zone_ixfr_image_size(const zdb_zone_ixfr_image *image);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ZDB_ZONE_IXFR_IMAGE_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
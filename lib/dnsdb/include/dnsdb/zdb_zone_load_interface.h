@@ -100,6 +100,13 @@ typedef ya_result zone_reader_free_record_method(zone_reader *, resource_record
 typedef void zone_reader_close_method(zone_reader *);
 typedef void zone_reader_handle_error_method(zone_reader *zr, ya_result error_code);
 
+/*
+ * Optional (NULL): gives the NSEC3 digest of an fqdn if the source already knows it.
+ * digest[0] holds the expected size, the digest is written from digest[1].
+ */
+
+typedef bool zone_reader_nsec3_digest_method(zone_reader *zr, const u8 *nsec3param_rdata, const u8 *fqdn, u32 fqdn_len, u8 *digest);
+
 typedef struct zone_reader_vtbl zone_reader_vtbl;
 struct zone_reader_vtbl
 {
@@ -107,6 +114,7 @@ struct zone_reader_vtbl
     zone_reader_free_record_method *zone_reader_free_record;
     zone_reader_close_method *zone_reader_close;
     zone_reader_handle_error_method *zone_reader_handle_error;
+    zone_reader_nsec3_digest_method *zone_reader_nsec3_digest;
     const char* __class__;
 };
 
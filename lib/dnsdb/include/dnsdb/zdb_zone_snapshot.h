@@ -0,0 +1,147 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbzone Zone related functions
+ *  @ingroup dnsdb
+ *  @brief Binary snapshot of a zone
+ *
+ *  A snapshot is written next to the text file of a zone.  It holds the same
+ *  records in a compact binary form, with the digests of the NSEC3 chains
+ *  already computed, so that the zone can be restarted from it without
+ *  parsing the text nor hashing every name again.
+ *
+ *  All the integers are in network order.
+ *
+ *  header (64 bytes)
+ *
+ *      0  u32 magic ('YZSN')
+ *      4  u16 version
+ *      6  u16 class
+ *      8  u32 serial
+ *     12  u32 number of records (final SOA excluded)
+ *     16  u64 size of the text file the snapshot was made with
+ *     24  u64 modification time of that text file
+ *     32  u64 offset of the records
+ *     40  u64 offset of the NSEC3 digest index (0 if none)
+ *     48  u64 size of the snapshot
+ *     56  u64 checksum of everything following the header
+ *
+ *  origin
+ *
+ *  records : one group per owner name, the SOA alone in the first one.
+ *
+ *      name, u16 rrset count, for each rrset:
+ *          u16 type, u16 record count, for each record:
+ *              u32 ttl, u16 rdata size, rdata
+ *
+ *  NSEC3 digest index : u16 chain count, for each chain:
+ *
+ *      u16 NSEC3PARAM rdata size, NSEC3PARAM rdata, u8 digest size,
+ *      u32 slot count (a power of two), u32 entries size,
+ *      slots (u32, 1 + offset of the entry in the entries, 0 if empty),
+ *      entries (name, digest)
+ *
+ *      The name of a label maps to its own digest, "*." + the name of a label
+ *      maps to the digest of the NSEC3 record covering it.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+#ifndef _ZDB_ZONE_SNAPSHOT_H
+#define	_ZDB_ZONE_SNAPSHOT_H
+
+#include <dnsdb/zdb_types.h>
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#define ZDB_ZONE_SNAPSHOT_MAGIC             0x595a534e /* YZSN */
+#define ZDB_ZONE_SNAPSHOT_VERSION           1
+
+#define ZDB_ZONE_SNAPSHOT_HEADER_SIZE       64
+
+#define ZDB_ZONE_SNAPSHOT_MAGIC_OFFSET      0
+#define ZDB_ZONE_SNAPSHOT_VERSION_OFFSET    4
+#define ZDB_ZONE_SNAPSHOT_CLASS_OFFSET      6
+#define ZDB_ZONE_SNAPSHOT_SERIAL_OFFSET     8
+#define ZDB_ZONE_SNAPSHOT_COUNT_OFFSET      12
+#define ZDB_ZONE_SNAPSHOT_SOURCE_SIZE_OFFSET  16
+#define ZDB_ZONE_SNAPSHOT_SOURCE_MTIME_OFFSET 24
+#define ZDB_ZONE_SNAPSHOT_RECORDS_OFFSET    32
+#define ZDB_ZONE_SNAPSHOT_INDEX_OFFSET      40
+#define ZDB_ZONE_SNAPSHOT_SIZE_OFFSET       48
+#define ZDB_ZONE_SNAPSHOT_CHECKSUM_OFFSET   56
+
+#define ZDB_ZONE_SNAPSHOT_SUFFIX            ".snapshot"
+
+/**
+ * Writes the snapshot of a zone.
+ * The zone MUST be locked (reader) by the caller.
+ * 
+ * The file is written with a temporary name then renamed.
+ * 
+ * @param zone the zone
+ * @param path the name of the snapshot
+ * @param source_size the size of the text file the zone has been written to (or loaded from)
+ * @param source_mtime the modification time of that text file
+ * 
+ * @return an error code
+ */
+
+ya_result zdb_zone_write_snapshot_file(const zdb_zone *zone, const char *path, u64 source_size, u64 source_mtime);
+
+/**
+ * The checksum of the snapshot, to be computed over the bytes following the header.
+ * Start with 0.
+ */
+
+u64 zdb_zone_snapshot_checksum(u64 checksum, const u8 *buffer, size_t size);
+
+/**
+ * The hash used for the slots of the NSEC3 digest index.
+ */
+
+u32 zdb_zone_snapshot_name_hash(const u8 *name, u32 name_len);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ZDB_ZONE_SNAPSHOT_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
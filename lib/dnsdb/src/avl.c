@@ -62,6 +62,7 @@
 #endif
 
 #include "dnsdb/avl.h"
+#include "dnsdb/zdb_epoch.h"
 
 /* This should be closer to 40 */
 
@@ -121,88 +122,175 @@ static s8 BALANCE_TO_DIR_[5] = {DIR_LEFT, DIR_LEFT, DIR_CRASH, DIR_RIGHT, DIR_RI
 
 #define MUST_REBALANCE(node) ((BALANCE(node)<LEFT)||(BALANCE(node)>RIGHT))
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+
+/*
+ * The readers walk the trees without the lock (see zdb_epoch.h) :
+ * a node that moves down the tree during a rotation, or that takes the place
+ * of a deleted node, is replaced by a copy made before it is linked, so that
+ * every node a reader is standing on keeps pointing to a valid subtree.
+ * The replaced nodes are released through the epoch.
+ */
+
+#define AVL_PUBLISH() __sync_synchronize()
+
+static void
+avl_node_free_epoch_callback(void* node)
+{
+    ZFREE(node, avl_node);
+}
+
+static inline avl_node*
+avl_node_clone(avl_node* node)
+{
+    avl_node* clone;
+
+    ZALLOC_OR_DIE(avl_node*, clone, avl_node, AVL_NODE_TAG);
+
+    *clone = *node;
+
+    return clone;
+}
+
+#define avl_retire_node(node) zdb_epoch_defer(avl_node_free_epoch_callback, (node))
+
+#else
+
+#define AVL_PUBLISH()
+
+#define avl_retire_node(node) avl_destroy_node(node)
+
+#endif
+
+/*
+ * The rotations link the new root of the subtree into *slot themselves.
+ */
+
 static inline avl_node*
-avl_node_single_rotation2(avl_node* node)
+avl_node_single_rotation2(avl_node* node, avl_node** slot)
 {
     avl_node* save;
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    avl_node* old_node = node;
+    node = avl_node_clone(node);
+#endif
 
     if(BALANCE(node) < 0) /* balance = LEFT -> dir = RIGHT other = LEFT */
     {
         save = LEFT_CHILD(node);
         LEFT_CHILD(node) = RIGHT_CHILD(save);
+        AVL_PUBLISH();
         RIGHT_CHILD(save) = node;
     }
     else
     {
         save = RIGHT_CHILD(node);
         RIGHT_CHILD(node) = LEFT_CHILD(save);
+        AVL_PUBLISH();
         LEFT_CHILD(save) = node;
     }
 
     BALANCE(node) = MIDDLE;
     BALANCE(save) = MIDDLE;
 
+    *slot = save;
+
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    avl_retire_node(old_node);
+#endif
+
     return save;
 }
 
 static inline avl_node*
-avl_node_double_rotation2(avl_node* node)
+avl_node_double_rotation2(avl_node* node, avl_node** slot)
 {
     avl_node* save;
+    avl_node* child;
 
     if(BALANCE(node) < 0) /* balance = LEFT -> dir = RIGHT other = LEFT */
     {
-        save = RIGHT_CHILD(LEFT_CHILD(node));
+        child = LEFT_CHILD(node);
+        save = RIGHT_CHILD(child);
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+        avl_node* old_node = node;
+        avl_node* old_child = child;
+        node = avl_node_clone(node);
+        child = avl_node_clone(child);
+#endif
 
         if(BALANCE(save) == MIDDLE)
         {
 
-            BALANCE(LEFT_CHILD(node)) = MIDDLE;
+            BALANCE(child) = MIDDLE;
             BALANCE(node) = MIDDLE;
         }
         else if(BALANCE(save) > 0) /* dir right & balance right */
         {
-            BALANCE(LEFT_CHILD(node)) = LEFT;
+            BALANCE(child) = LEFT;
             BALANCE(node) = MIDDLE;
         }
         else /* BALANCE(save)<0 */
         {
-            BALANCE(LEFT_CHILD(node)) = MIDDLE;
+            BALANCE(child) = MIDDLE;
             BALANCE(node) = RIGHT;
         }
 
         BALANCE(save) = MIDDLE;
-        RIGHT_CHILD(LEFT_CHILD(node)) = LEFT_CHILD(save);
-        LEFT_CHILD(save) = LEFT_CHILD(node);
+        RIGHT_CHILD(child) = LEFT_CHILD(save);
         LEFT_CHILD(node) = RIGHT_CHILD(save);
+        AVL_PUBLISH();
+        LEFT_CHILD(save) = child;
         RIGHT_CHILD(save) = node;
+
+        *slot = save;
+
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+        avl_retire_node(old_node);
+        avl_retire_node(old_child);
+#endif
     }
     else /* balance = RIGHT -> dir = LEFT other = RIGHT */
     {
-        save = LEFT_CHILD(RIGHT_CHILD(node));
+        child = RIGHT_CHILD(node);
+        save = LEFT_CHILD(child);
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+        avl_node* old_node = node;
+        avl_node* old_child = child;
+        node = avl_node_clone(node);
+        child = avl_node_clone(child);
+#endif
 
         if(BALANCE(save) == MIDDLE)
         {
 
-            BALANCE(RIGHT_CHILD(node)) = MIDDLE;
+            BALANCE(child) = MIDDLE;
             BALANCE(node) = MIDDLE;
         }
         else if(BALANCE(save) < 0) /* dir left & balance left */
         {
-            BALANCE(RIGHT_CHILD(node)) = RIGHT;
+            BALANCE(child) = RIGHT;
             BALANCE(node) = MIDDLE;
         }
         else /* BALANCE(save)>0 */
         {
-            BALANCE(RIGHT_CHILD(node)) = MIDDLE;
+            BALANCE(child) = MIDDLE;
             BALANCE(node) = LEFT;
         }
 
         BALANCE(save) = MIDDLE;
-        LEFT_CHILD(RIGHT_CHILD(node)) = RIGHT_CHILD(save);
-        RIGHT_CHILD(save) = RIGHT_CHILD(node);
+        LEFT_CHILD(child) = RIGHT_CHILD(save);
         RIGHT_CHILD(node) = LEFT_CHILD(save);
+        AVL_PUBLISH();
+        RIGHT_CHILD(save) = child;
         LEFT_CHILD(save) = node;
+
+        *slot = save;
+
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+        avl_retire_node(old_node);
+        avl_retire_node(old_child);
+#endif
     }
 
     return save;
@@ -406,7 +494,9 @@ avl_insert(avl_tree* root, hashcode obj_hash)
 
     if(*root == NULL)
     {
-        *root = avl_create_node(obj_hash);
+        avl_node* first = avl_create_node(obj_hash);
+        AVL_PUBLISH();
+        *root = first;
 
         LDEBUG(9, "First node (root) (%p)\n", *root);
 
@@ -452,6 +542,7 @@ avl_insert(avl_tree* root, hashcode obj_hash)
     /* the parent is node */
 
     avl_node* ret = avl_create_node(obj_hash);
+    AVL_PUBLISH();
     CHILD(node, dir) = ret;
 
     LDEBUG(9, "Created a new node from %08x, going %i (%p)\n", node->hash, dir, ret);
@@ -532,10 +623,14 @@ avl_insert(avl_tree* root, hashcode obj_hash)
 
             /* HERE THE BALANCES ARE LOST/CORRUPTED !!! */
 
+            /* the parent's parent has to be updated (to node) */
+
+            avl_node** slot = (level > 1)?&CHILD(nodes[level - 2], dirs[level - 2]):root;
+
             if(BALANCE(node) == BALANCE(parent)) /* if the sign is the same ... */
             {
                 /* BALANCE(node)=0; */
-                node = avl_node_single_rotation2(parent);
+                node = avl_node_single_rotation2(parent, slot);
 
                 /* the parent's parent has to be updated (to node) */
 
@@ -544,7 +639,7 @@ avl_insert(avl_tree* root, hashcode obj_hash)
             else
             {
                 /* BALANCE(node)=0; */
-                node = avl_node_double_rotation2(parent);
+                node = avl_node_double_rotation2(parent, slot);
 
                 /* the parent's parent has to be updated (to node) */
 
@@ -559,19 +654,10 @@ avl_insert(avl_tree* root, hashcode obj_hash)
              * -> I have to get the parent on level-2 (oops if level is < 2 :
              *      it means that the parent is the root, thus that we have to fix the root)
              * -> I have to get the dir used on level-2 and set it to node
+             *
+             * (done by the rotation, through slot)
              */
 
-            if(level > 1) /* 2 or more ... */
-            {
-                CHILD(nodes[level - 2], dirs[level - 2]) = node;
-            }
-            else /* root */
-            {
-                LDEBUG(9, "Root changing from %08x to %08x\n", (*root)->hash, node->hash);
-
-                *root = node;
-            }
-
             /* rebalancing -> done */
 
             LDEBUG(9, "Done (I)\n");
@@ -656,6 +742,10 @@ avl_delete(avl_tree* root, hashcode obj_hash)
     balances[level] = BALANCE(node);
     dirs[level++] = dir; /* THIS IS WRONG */
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    int victim_level = level - 1;
+#endif
+
     /* Remove "node" from the parent */
     /* Keep the pointer for the find & destroy operation */
 
@@ -688,6 +778,10 @@ avl_delete(avl_tree* root, hashcode obj_hash)
      *       We link the parent of the successor
      *       We then rebalance from the node right before where successor was.
      *
+     *       When the readers walk the tree without the lock, the payload of a
+     *       node cannot change under them : a copy of the successor replaces
+     *       the victim instead (method 1 without the 10 moves).
+     *
      *  #3 is dependant on #1 and #2 so let's handle #3 first.
      */
 
@@ -748,6 +842,40 @@ avl_delete(avl_tree* root, hashcode obj_hash)
         DUMP_NODE(successor);
         LDEBUG(9, "\n");
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+        avl_node* replacement = avl_node_clone(successor);
+
+        LEFT_CHILD(replacement) = (beforesuccessor != victim)?victim_left:LEFT_CHILD(successor);
+        RIGHT_CHILD(replacement) = victim_right;
+        BALANCE(replacement) = BALANCE(victim);
+
+        AVL_PUBLISH();
+
+        /* the successor is reachable twice until it is unlinked below */
+
+        if(victim_level > 0)
+        {
+            CHILD(nodes[victim_level - 1], dirs[victim_level - 1]) = replacement;
+        }
+        else
+        {
+            *root = replacement;
+        }
+
+        nodes[victim_level] = replacement;
+
+        if(beforesuccessor != victim)
+        {
+            RIGHT_CHILD(beforesuccessor) = LEFT_CHILD(successor);
+            BALANCE(beforesuccessor)--;
+        }
+        else
+        {
+            BALANCE(replacement)++;
+        }
+
+        avl_retire_node(victim);
+#else
         /* Method 2 uses 3 moves, method 1 uses 10 */
         victim->data = successor->data;
         victim->hash = successor->hash;
@@ -762,11 +890,11 @@ avl_delete(avl_tree* root, hashcode obj_hash)
             LEFT_CHILD(beforesuccessor) = LEFT_CHILD(successor);
             BALANCE(beforesuccessor)++;
         }
-
+#endif
 
         DUMP_NODE(successor);
         LDEBUG(9, " : avl_destroy_node(%p)\n", successor);
-        avl_destroy_node(successor); /* avl_destroy_node(successor); */
+        avl_retire_node(successor); /* avl_destroy_node(successor); */
 
         level -= 2;
 
@@ -778,8 +906,6 @@ avl_delete(avl_tree* root, hashcode obj_hash)
         DUMP_NODE(victim);
         LDEBUG(9, " : avl_destroy_node(%p)\n", victim);
 
-        avl_destroy_node(victim); /* avl_destroy_node(victim); */
-
         if(level > 1)
         {
             avl_node* victim_parent = nodes[level - 2];
@@ -793,12 +919,17 @@ avl_delete(avl_tree* root, hashcode obj_hash)
             /* At this point the victim is detached from the tree */
             /* I can delete it */
 
+            avl_retire_node(victim); /* avl_destroy_node(victim); */
+
             level -= 2;
         }
         else /* Else we have no parent, so we change the root */
         {
             /* ONE or BOTH are NULL, this is the best alternative to the if/elseif/else above */
             *root = (avl_node*)((intptr)victim_left | (intptr)victim_right);
+
+            avl_retire_node(victim); /* avl_destroy_node(victim); */
+
             return data;
         }
     }
@@ -884,30 +1015,33 @@ avl_delete(avl_tree* root, hashcode obj_hash)
 
         BALANCE(node) >>= 1;
 
-        avl_node* child = CHILD(node, BALANCE_TO_DIR(BALANCE(node)));
+        u8 child_dir = BALANCE_TO_DIR(BALANCE(node));
+        avl_node* child = CHILD(node, child_dir);
         s8 parent_balance = BALANCE(node);
         s8 child_balance = BALANCE(child);
 
+        /* the rotations link the parent to its new child */
+
+        avl_node** slot = (level > 0)?&CHILD(nodes[level - 1], dirs[level - 1]):root;
+
         if(child_balance == MIDDLE) /* patched single rotation */
         {
             LDEBUG(9, "Single Rotation (delete)\n");
 
-            avl_node* root = node;
+            node = avl_node_single_rotation2(node, slot);
 
-            root = avl_node_single_rotation2(node);
+            zassert(node == child);
 
-            zassert(root == child);
+            /* the old parent (or its copy) is now on the other side of the child */
 
             BALANCE(child) = -parent_balance;
-            BALANCE(node) = parent_balance;
-
-            node = root;
+            BALANCE(CHILD(child, child_dir ^ 1)) = parent_balance;
         }
         else if(parent_balance == child_balance) /* single rotation case */
         {
             LDEBUG(9, "Single Rotation\n");
 
-            node = avl_node_single_rotation2(node);
+            node = avl_node_single_rotation2(node, slot);
 
             zassert(node == child);
         }
@@ -915,34 +1049,21 @@ avl_delete(avl_tree* root, hashcode obj_hash)
         {
             LDEBUG(9, "Double Rotation\n");
 
-            node = avl_node_double_rotation2(node);
+            node = avl_node_double_rotation2(node, slot);
         }
 
         if(level == 0) /* 2 or more ... */
         {
             /* root */
 
-            LDEBUG(9, "Root changing from %08x to %08x\n", (*root)->hash, node->hash);
+            LDEBUG(9, "Root changed to %08x\n", node->hash);
 
-            *root = node;
             break;
         }
 
-        /* link the parent to its new child */
-
-        /*
-           level--;
-
-           CHILD(nodes[level],dirs[level])=node;
-
-           node=nodes[level];
-         */
-
         /* The rotations could have changed something */
         /* I'll process the same level again */
 
-        CHILD(nodes[level - 1], dirs[level - 1]) = node;
-
         /* node=nodes[level]; */
     }
 
@@ -985,6 +1106,30 @@ avl_destroy(avl_tree* tree)
     }
 }
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+static void
+avl_destroy_epoch_callback(void* node)
+{
+    avl_destroy_((avl_node*)node);
+}
+#endif
+
+void
+avl_retire(avl_tree* tree)
+{
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    avl_node* node = *tree;
+
+    if(node != NULL)
+    {
+        *tree = NULL;
+        zdb_epoch_defer(avl_destroy_epoch_callback, node);
+    }
+#else
+    avl_destroy(tree);
+#endif
+}
+
 /* Iterators -> */
 
 void
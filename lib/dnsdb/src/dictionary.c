@@ -50,6 +50,8 @@
 void dictionary_btree_init(dictionary* dico);
 void
 dictionary_htbt_init(dictionary* dico);
+void
+dictionary_htoa_init(dictionary* dico);
 
 struct dictionary_mutation_table_entry
 {
@@ -59,7 +61,7 @@ struct dictionary_mutation_table_entry
 
 static struct dictionary_mutation_table_entry dictionary_mutation_table[2] = {
     { ZDB_HASHTABLE_THRESHOLD, dictionary_btree_init},
-    { MAX_U32, dictionary_htbt_init},
+    { MAX_U32, dictionary_htoa_init},
 };
 
 static struct dictionary_mutation_table_entry*
@@ -82,12 +84,14 @@ dictionary_bucket_record_callback(void* bucket_data, hashcode key, dictionary_no
     dictionary_fills((dictionary*)bucket_data, key, node);
 }
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK != 2
 static void
 dictionary_destroy_record_callback(dictionary_node* node)
 {
     /* This should NEVER be called */
     assert(FALSE); /* NOT zassert ! */
 }
+#endif
 
 void
 dictionary_init(dictionary* dico)
@@ -117,10 +121,32 @@ dictionary_mutate(dictionary* dico)
 
     new_dico.threshold = entry->threshold;
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    /*
+     * The readers (dictionary_find_mt) wait while the vtbl is NULL, then
+     * see the new collection with its vtbl.
+     * The old collection is retired by the empties.
+     */
+
+    struct dictionary_vtbl* vtbl = dico->vtbl;
+
+    dico->vtbl = NULL;
+    __sync_synchronize();
+
+    vtbl->dictionary_empties_call(dico, &new_dico, dictionary_bucket_record_callback);
+
+    dico->ct = new_dico.ct;
+    dico->count = new_dico.count;
+    dico->threshold = new_dico.threshold;
+    __sync_synchronize();
+
+    dico->vtbl = new_dico.vtbl;
+#else
     dictionary_empties(dico, &new_dico, dictionary_bucket_record_callback);
     dictionary_destroy(dico, dictionary_destroy_record_callback);
 
     MEMCOPY(dico, &new_dico, sizeof (dictionary));
+#endif
 }
 
 /** @} */
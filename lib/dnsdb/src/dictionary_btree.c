@@ -255,7 +255,9 @@ dictionary_btree_remove(dictionary* dico, hashcode key, void* record_match_data,
             else
             {
                 *node_sll_p = node->next;
-                node->next = NULL;
+#if ZDB_EXPLICIT_READER_ZONE_LOCK != 2
+                node->next = NULL; /* else a reader standing on the node would stop there */
+#endif
             }
 
             return node;
@@ -399,7 +401,9 @@ dictionary_btree_empties(dictionary* dico, void* bucket_data, dictionary_bucket_
             }
         }
 
-        btree_destroy(&dico->ct.btree_collection);
+        /* the readers may still be walking the collection */
+
+        btree_retire(&dico->ct.btree_collection);
         dico->count = 0;
     }
 }
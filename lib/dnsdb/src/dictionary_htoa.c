@@ -0,0 +1,420 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbcollection Collections used by the database
+ *  @ingroup dnsdb
+ *  @brief Dictionary module based on an open addressing hash table
+ *
+ *  Dictionary module based on an open addressing hash table.
+ *  The nodes sharing the same hashcode are chained from the same slot.
+ *
+ * @{
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <dnscore/sys_types.h>
+#include "dnsdb/zdb_error.h"
+#include "dnsdb/dictionary.h"
+
+/*
+ *
+ */
+
+void dictionary_htoa_init(dictionary* dico);
+void dictionary_htoa_destroy(dictionary* dico, dictionary_destroy_record_function destroy);
+void dictionary_htoa_destroy_ex(dictionary* dico, dictionary_destroy_ex_record_function destroy, void* arg);
+dictionary_node* dictionary_htoa_add(dictionary* dico, hashcode key, const void* record_match_data, dictionary_data_record_compare_function compare, dictionary_data_record_create_function create);
+dictionary_node* dictionary_htoa_find(const dictionary* dico, hashcode key, const void* record_match_data, dictionary_data_record_compare_function compare);
+dictionary_node** dictionary_htoa_findp(const dictionary* dico, hashcode key, const void* record_match_data, dictionary_data_record_compare_function compare);
+dictionary_node* dictionary_htoa_remove(dictionary* dico, hashcode key, void* record_match_data, dictionary_data_record_compare_function compare);
+ya_result dictionary_htoa_process(dictionary* dico, hashcode key, void* record_match_data, dictionary_process_record_function compare);
+void dictionary_htoa_iterator_init(const dictionary* dico, dictionary_iterator* iter);
+bool dictionary_htoa_iterator_hasnext(dictionary_iterator* dico);
+void** dictionary_htoa_iterator_next(dictionary_iterator* dico);
+
+void dictionary_htoa_empties(dictionary* dico, void* bucket, dictionary_bucket_record_function destroy);
+void
+dictionary_htoa_fills(dictionary* dico, hashcode key, dictionary_node* node);
+
+
+static struct dictionary_vtbl dictionary_htoa_vtbl = {
+    /*dictionary_htoa_init,*/
+    dictionary_htoa_destroy,
+    dictionary_htoa_add,
+    dictionary_htoa_find,
+    dictionary_htoa_findp,
+    dictionary_htoa_remove,
+    dictionary_htoa_process,
+    dictionary_htoa_destroy_ex,
+    dictionary_htoa_iterator_init,
+    dictionary_htoa_empties,
+    dictionary_htoa_fills,
+    "HTOA"
+};
+
+static struct dictionary_iterator_vtbl dictionary_iterator_htoa_vtbl = {
+    dictionary_htoa_iterator_hasnext,
+    dictionary_htoa_iterator_next
+};
+
+void
+dictionary_htoa_init(dictionary* dico)
+{
+    htoa_init(&(dico->ct.htoa_collection));
+    dico->vtbl = &dictionary_htoa_vtbl;
+    dico->count = 0;
+    dico->threshold = ~0;
+}
+
+void
+dictionary_htoa_destroy(dictionary* dico, dictionary_destroy_record_function destroy)
+{
+    zassert(dico != NULL);
+
+    if(dico->ct.htoa_collection != NULL)
+    {
+        htoa_iterator iter;
+
+        htoa_iterator_init(dico->ct.htoa_collection, &iter);
+
+        while(htoa_iterator_hasnext(&iter))
+        {
+            dictionary_node** node_sll_p = (dictionary_node**)htoa_iterator_next(&iter);
+            dictionary_node* node = *node_sll_p;
+            *node_sll_p = NULL;
+
+            while(node != NULL)
+            {
+                dictionary_node* tmp = node;
+                node = node->next;
+                tmp->next = NULL;
+
+                destroy(tmp);
+            }
+
+
+        }
+
+        htoa_destroy(&dico->ct.htoa_collection);
+
+        dico->count = 0;
+    }
+}
+
+void
+dictionary_htoa_destroy_ex(dictionary* dico, dictionary_destroy_ex_record_function destroyex, void* arg)
+{
+    zassert(dico != NULL);
+
+    if(dico->ct.htoa_collection != NULL)
+    {
+        htoa_iterator iter;
+
+        htoa_iterator_init(dico->ct.htoa_collection, &iter);
+
+        while(htoa_iterator_hasnext(&iter))
+        {
+            dictionary_node** node_sll_p = (dictionary_node**)htoa_iterator_next(&iter);
+            dictionary_node* node = *node_sll_p;
+            *node_sll_p = NULL;
+
+            while(node != NULL)
+            {
+                dictionary_node* tmp = node;
+                node = node->next;
+                tmp->next = NULL;
+
+                destroyex(tmp, arg);
+            }
+        }
+
+        htoa_destroy(&dico->ct.htoa_collection);
+
+        dico->count = 0;
+    }
+}
+
+dictionary_node*
+dictionary_htoa_add(dictionary* dico, hashcode key, const void* record_match_data, dictionary_data_record_compare_function compare,
+                    dictionary_data_record_create_function create)
+{
+    dictionary_node** node_sll_p = (dictionary_node**)htoa_insert(&dico->ct.htoa_collection, key);
+    dictionary_node* node = *node_sll_p;
+
+    while(node != NULL)
+    {
+        if(compare(record_match_data, node))
+        {
+            return node;
+        }
+
+        node = node->next;
+    }
+
+    node = create(record_match_data);
+    node->next = (*node_sll_p);
+    (*node_sll_p) = node;
+
+    dico->count++;
+
+    return node;
+}
+
+dictionary_node*
+dictionary_htoa_find(const dictionary* dico, hashcode key, const void* record_match_data, dictionary_data_record_compare_function compare)
+{
+    dictionary_node* node = (dictionary_node*)htoa_find(dico->ct.htoa_collection, key);
+
+    while(node != NULL)
+    {
+        if(compare(record_match_data, node))
+        {
+            return node;
+        }
+
+        node = node->next;
+    }
+
+    return NULL;
+}
+
+dictionary_node**
+dictionary_htoa_findp(const dictionary* dico, hashcode key, const void* record_match_data, dictionary_data_record_compare_function compare)
+{
+    dictionary_node** node_sll_p = (dictionary_node**)htoa_findp(dico->ct.htoa_collection, key);
+
+    if(node_sll_p != NULL)
+    {
+        while(*node_sll_p != NULL)
+        {
+            if(compare(record_match_data, *node_sll_p))
+            {
+                return node_sll_p;
+            }
+
+            node_sll_p = &(*node_sll_p)->next;
+        }
+    }
+
+    return NULL;
+}
+
+dictionary_node*
+dictionary_htoa_remove(dictionary* dico, hashcode key, void* record_match_data, dictionary_data_record_compare_function compare)
+{
+    dictionary_node** node_sll_head_p = (dictionary_node**)htoa_findp(dico->ct.htoa_collection, key);
+
+    if(node_sll_head_p == NULL)
+    {
+        return NULL;
+    }
+
+    dictionary_node** node_sll_p = node_sll_head_p;
+    dictionary_node* node = *node_sll_p;
+
+    while(node != NULL)
+    {
+        if(compare(record_match_data, node))
+        {
+            dico->count--;
+
+            /* detach */
+            *node_sll_p = node->next;
+#if ZDB_EXPLICIT_READER_ZONE_LOCK != 2
+            node->next = NULL; /* else a reader standing on the node would stop there */
+#endif
+
+            if(*node_sll_head_p == NULL)
+            {
+                /* remove the slot of the (now empty) sll */
+                htoa_delete(&dico->ct.htoa_collection, key);
+            }
+
+            return node;
+        }
+
+        node_sll_p = &(node->next);
+        node = node->next;
+    }
+
+    return NULL;
+}
+
+ya_result
+dictionary_htoa_process(dictionary* dico, hashcode key, void* record_match_data, dictionary_process_record_function process)
+{
+    dictionary_node** node_sll_p = (dictionary_node**)htoa_findp(dico->ct.htoa_collection, key);
+
+    if(node_sll_p == NULL)
+    {
+        return ZDB_ERROR_KEY_NOTFOUND; /* NOT FOUND */
+    }
+
+    const dictionary_node** node_sll_head_p = (const dictionary_node**)node_sll_p;
+
+    dictionary_node* node = *node_sll_p;
+
+    while(node != NULL)
+    {
+        /* To allow to destroy the node inside, I should ...
+         * dictionary_node* node_next=node->next; */
+
+        dictionary_node* node_next = node->next;
+        int op = process(record_match_data, node);
+
+        switch(op)
+        {
+            case COLLECTION_PROCESS_NEXT:
+            {
+                node_sll_p = &(node->next);
+                node = node_next;
+                continue;
+            }
+
+            case COLLECTION_PROCESS_DELETENODE:
+            {
+                /* remove sll node
+                 *
+                 * I could have to remove the slot too
+                 */
+
+                dico->count--;
+
+                *node_sll_p = node_next;
+
+                /* detach */
+                if(*node_sll_head_p == NULL)
+                {
+                    /* remove the slot of the (now empty) sll */
+                    htoa_delete(&dico->ct.htoa_collection, key);
+                }
+
+                /* fall trough ... retorn op */
+            }
+
+            default:
+            {
+                return op;
+            }
+        }
+    }
+
+    return COLLECTION_PROCESS_NEXT;
+}
+
+void
+dictionary_htoa_iterator_init(const dictionary* dico, dictionary_iterator* iter)
+{
+    iter->vtbl = &dictionary_iterator_htoa_vtbl;
+    iter->sll = NULL;
+    htoa_iterator_init(dico->ct.htoa_collection, &(iter->ct.as_htoa));
+}
+
+bool
+dictionary_htoa_iterator_hasnext(dictionary_iterator* iter)
+{
+    return (iter->sll != NULL && iter->sll->next != NULL) ?
+            TRUE
+            :
+            htoa_iterator_hasnext(&iter->ct.as_htoa)
+            ;
+}
+
+void**
+dictionary_htoa_iterator_next(dictionary_iterator* iter)
+{
+    void* vpp;
+
+    if(iter->sll != NULL && iter->sll->next != NULL)
+    {
+        /* pointer is into a sll node */
+        vpp = &iter->sll->next;
+        iter->sll = iter->sll->next;
+        return vpp;
+    }
+
+    /* pointer is into a slot */
+    vpp = htoa_iterator_next(&iter->ct.as_htoa);
+    iter->sll = ((dictionary_node*)vpp)->next;
+    return vpp;
+}
+
+void
+dictionary_htoa_empties(dictionary* dico, void* bucket_data, dictionary_bucket_record_function bucket)
+{
+    zassert(dico != NULL);
+
+    if(dico->ct.htoa_collection != NULL)
+    {
+        htoa_iterator iter;
+
+        htoa_iterator_init(dico->ct.htoa_collection, &iter);
+
+        while(htoa_iterator_hasnext(&iter))
+        {
+            hashcode key;
+
+            dictionary_node* node = *(dictionary_node**)htoa_iterator_next_key(&iter, &key);
+
+            while(node != NULL)
+            {
+                dictionary_node* tmp = node;
+                node = node->next;
+                tmp->next = NULL;
+
+                bucket(bucket_data, key, tmp); /* free, if any, is made here */
+            }
+        }
+
+        /* the readers may still be walking the collection */
+
+        htoa_retire(&dico->ct.htoa_collection);
+
+        dico->count = 0;
+    }
+}
+
+void
+dictionary_htoa_fills(dictionary* dico, hashcode key, dictionary_node* node)
+{
+    dictionary_node** node_sll_p = (dictionary_node**)htoa_insert(&dico->ct.htoa_collection, key);
+    node->next = (*node_sll_p);
+    *node_sll_p = node;
+    dico->count++;
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
@@ -0,0 +1,678 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnskey DNSSEC keys functions
+ *  @ingroup dnsdbdnssec
+ *  @brief ECDSA P-256/SHA-256 and P-384/SHA-384 keys (RFC 6605)
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#include <openssl/ssl.h>
+#include <openssl/engine.h>
+
+#include <dnscore/sys_types.h>
+#include <dnscore/base64.h>
+
+#include <dnscore/logger.h>
+
+#include "dnsdb/dnsrdata.h"
+#include "dnsdb/dnssec.h"
+#include "dnsdb/dnssec_keystore.h"
+#include "dnsdb/zdb_error.h"
+#include "dnsdb/zdb_utils.h"
+
+#define MODULE_MSG_HANDLE g_dnssec_logger
+
+/*
+ * The biggest supported curve is P-384 : 48 bytes per coordinate/integer
+ */
+
+#define ECDSA_MAXIMUM_FIELD_SIZE 48
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+
+static void
+ECDSA_SIG_get0(const ECDSA_SIG *sig, const BIGNUM **r, const BIGNUM **s)
+{
+    *r = sig->r;
+    *s = sig->s;
+}
+
+static int
+ECDSA_SIG_set0(ECDSA_SIG *sig, BIGNUM *r, BIGNUM *s)
+{
+    BN_free(sig->r);
+    BN_free(sig->s);
+    sig->r = r;
+    sig->s = s;
+    return 1;
+}
+
+#endif
+
+/*
+ * Returns the curve, the digest and the size (bytes) of an integer for an algorithm
+ */
+
+static int
+ecdsa_getcurve(u8 algorithm)
+{
+    switch(algorithm)
+    {
+        case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+        {
+            return NID_X9_62_prime256v1;
+        }
+        case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+        {
+            return NID_secp384r1;
+        }
+        default:
+        {
+            return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
+        }
+    }
+}
+
+static int
+ecdsa_getnid(u8 algorithm)
+{
+    switch(algorithm)
+    {
+        case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+        {
+            return NID_sha256;
+        }
+        case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+        {
+            return NID_sha384;
+        }
+        default:
+        {
+            return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
+        }
+    }
+}
+
+static u32
+ecdsa_getfieldsize(u8 algorithm)
+{
+    return (algorithm == DNSKEY_ALGORITHM_ECDSAP384SHA384) ? 48 : 32;
+}
+
+static const char*
+ecdsa_getname(u8 algorithm)
+{
+    return (algorithm == DNSKEY_ALGORITHM_ECDSAP384SHA384) ? "ECDSAP384SHA384" : "ECDSAP256SHA256";
+}
+
+/*
+ * Writes a big number left-padded with zeroes on exactly size bytes
+ */
+
+static bool
+ecdsa_bn2bin_padded(const BIGNUM *num, u8 *output, u32 size)
+{
+    u32 n = BN_num_bytes(num);
+
+    if(n > size)
+    {
+        return FALSE;
+    }
+
+    memset(output, 0, size - n);
+    BN_bn2bin(num, &output[size - n]);
+
+    return TRUE;
+}
+
+static EC_KEY*
+ecdsa_dnskey_key_scan(FILE *f, u8 algorithm)
+{
+    char tmp_label[1024];
+    u8 tmp_out[DNSSEC_MAXIMUM_KEY_SIZE_BYTES];
+    char algorithm_text[8];
+
+    BIGNUM *private_key = NULL;
+    EC_KEY *ec = NULL;
+
+    snprintf(algorithm_text, sizeof(algorithm_text), "%i", algorithm);
+
+    while(!feof(f))
+    {
+        tmp_label[0] = '\0';
+
+        if(fgets(tmp_label, sizeof (tmp_label), f) == NULL)
+        {
+            break;
+        }
+
+        char *tmp_in = strchr(tmp_label, ':');
+
+        if(tmp_in == NULL)
+        {
+            /* error */
+
+            break;
+        }
+
+        *tmp_in = '\0';
+        while(*++tmp_in == ' ');
+        size_t tmp_in_len = strcspn(tmp_in, " \t\r\n");
+        tmp_in[tmp_in_len] = '\0';
+
+        if(strcmp(tmp_label, "Private-key-format") == 0)
+        {
+            if(memcmp(tmp_in, "v1.", 3) != 0) /* Assume that all 1.x formatted keys will be recognisable */
+            {
+                break;
+            }
+        }
+        else if(strcmp(tmp_label, "Algorithm") == 0) /* only accept the algorithm of the file name */
+        {
+            if(strcmp(tmp_in, algorithm_text) != 0)
+            {
+                log_err("unexpected ECDSA algorithm '%s'", tmp_in);
+
+                break;
+            }
+        }
+        else if(strcmp(tmp_label, "PrivateKey") == 0)
+        {
+            if(private_key != NULL)
+            {
+                log_err("field %s has already been initialized", tmp_label);
+                break;
+            }
+
+            if(BASE64_DECODED_SIZE(tmp_in_len) > sizeof(tmp_out))
+            {
+                log_err("field %s is too big", tmp_label);
+                break;
+            }
+
+            ya_result n = base64_decode(tmp_in, tmp_in_len, tmp_out);
+
+            if(FAIL(n))
+            {
+                log_err("unable to decode field %s (%s)", tmp_label, tmp_in);
+                break;
+            }
+
+            private_key = BN_bin2bn(tmp_out, n, NULL);
+        }
+        /* other fields (Created, Publish, Activate) are ignored */
+    }
+
+    if(private_key == NULL)
+    {
+        return NULL;
+    }
+
+    /* the public key is not stored in the file : Q = d.G */
+
+    BN_CTX *ctx = BN_CTX_new();
+
+    zassert(ctx != NULL);
+
+    ec = EC_KEY_new_by_curve_name(ecdsa_getcurve(algorithm));
+
+    zassert(ec != NULL);
+
+    const EC_GROUP *group = EC_KEY_get0_group(ec);
+    EC_POINT *public_key = EC_POINT_new(group);
+
+    if((public_key == NULL) ||
+       (EC_KEY_set_private_key(ec, private_key) == 0) ||
+       (EC_POINT_mul(group, public_key, private_key, NULL, NULL, ctx) == 0) ||
+       (EC_KEY_set_public_key(ec, public_key) == 0))
+    {
+        log_err("unable to compute the ECDSA public key");
+
+        EC_KEY_free(ec);
+        ec = NULL;
+    }
+
+    EC_POINT_free(public_key);
+    BN_clear_free(private_key);
+    BN_CTX_free(ctx);
+
+    return ec;
+}
+
+static EC_KEY*
+ecdsa_genkey(u8 algorithm)
+{
+    EC_KEY* ec = EC_KEY_new_by_curve_name(ecdsa_getcurve(algorithm));
+
+    zassert(ec != NULL);
+
+    if(EC_KEY_generate_key(ec) == 0)
+    {
+        EC_KEY_free(ec);
+        ec = NULL;
+    }
+
+    return ec;
+}
+
+/*
+ * The signature is r | s, each integer taking exactly the size of the field (RFC 6605 4)
+ */
+
+static ya_result
+ecdsa_signdigest(dnssec_key *key, u8 *digest, u32 digest_len, u8 *output)
+{
+    ECDSA_SIG *sig = ECDSA_do_sign(digest, digest_len, key->key.ec);
+
+    if(sig == NULL)
+    {
+#ifndef NDEBUG
+        ERR_print_errors_fp(stderr);
+#endif
+        return DNSSEC_ERROR_ECDSASIGNATUREFAILED;
+    }
+
+    const BIGNUM *r;
+    const BIGNUM *s;
+    u32 field_size = ecdsa_getfieldsize(key->algorithm);
+
+    ECDSA_SIG_get0(sig, &r, &s);
+
+    ya_result return_value = DNSSEC_ERROR_ECDSASIGNATUREFAILED;
+
+    if(ecdsa_bn2bin_padded(r, output, field_size) && ecdsa_bn2bin_padded(s, &output[field_size], field_size))
+    {
+        return_value = field_size << 1;
+    }
+
+    ECDSA_SIG_free(sig);
+
+    return return_value;
+}
+
+static bool
+ecdsa_verifydigest(dnssec_key* key, u8* digest, u32 digest_len, u8* signature, u32 signature_len)
+{
+    u32 field_size = ecdsa_getfieldsize(key->algorithm);
+
+    if(signature_len != (field_size << 1))
+    {
+        log_err("digest verification: ECDSA signature size %u instead of %u", signature_len, field_size << 1);
+
+        return FALSE;
+    }
+
+    ECDSA_SIG *sig = ECDSA_SIG_new();
+
+    zassert(sig != NULL);
+
+    BIGNUM *r = BN_bin2bn(signature, field_size, NULL);
+    BIGNUM *s = BN_bin2bn(&signature[field_size], field_size, NULL);
+
+    ECDSA_SIG_set0(sig, r, s);
+
+    int err = ECDSA_do_verify(digest, digest_len, sig, key->key.ec);
+
+    ECDSA_SIG_free(sig);
+
+    if(err != 1)
+    {
+        unsigned long ssl_err;
+
+        while((ssl_err = ERR_get_error()) != 0)
+        {
+            char buffer[128];
+            ERR_error_string_n(ssl_err, buffer, sizeof (buffer));
+
+            log_err("digest verification returned an ssl error %08x %s", ssl_err, buffer);
+        }
+
+        ERR_clear_error();
+
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * The public key is the uncompressed point without its 0x04 prefix : x | y (RFC 6605 4)
+ */
+
+static EC_KEY*
+ecdsa_public_load(u8 algorithm, const u8* rdata, u16 rdata_size)
+{
+    u8 tmp[1 + 2 * ECDSA_MAXIMUM_FIELD_SIZE];
+
+    u32 field_size = ecdsa_getfieldsize(algorithm);
+
+    if(rdata_size != (field_size << 1))
+    {
+        return NULL;
+    }
+
+    tmp[0] = POINT_CONVERSION_UNCOMPRESSED;
+    memcpy(&tmp[1], rdata, rdata_size);
+
+    EC_KEY *ec = EC_KEY_new_by_curve_name(ecdsa_getcurve(algorithm));
+
+    zassert(ec != NULL);
+
+    const EC_GROUP *group = EC_KEY_get0_group(ec);
+    EC_POINT *public_key = EC_POINT_new(group);
+
+    if((public_key == NULL) ||
+       (EC_POINT_oct2point(group, public_key, tmp, rdata_size + 1, NULL) == 0) ||
+       (EC_KEY_set_public_key(ec, public_key) == 0))
+    {
+        EC_KEY_free(ec);
+        ec = NULL;
+    }
+
+    EC_POINT_free(public_key);
+
+    return ec;
+}
+
+static u32
+ecdsa_public_store(EC_KEY* ec, u8 algorithm, u8* output_buffer)
+{
+    u8 tmp[1 + 2 * ECDSA_MAXIMUM_FIELD_SIZE];
+
+    u32 n = EC_POINT_point2oct(EC_KEY_get0_group(ec), EC_KEY_get0_public_key(ec), POINT_CONVERSION_UNCOMPRESSED, tmp, sizeof(tmp), NULL);
+
+    if(n != 1 + (ecdsa_getfieldsize(algorithm) << 1))
+    {
+        return 0;
+    }
+
+    memcpy(output_buffer, &tmp[1], n - 1);
+
+    return n - 1;
+}
+
+static u32
+ecdsa_dnskey_public_store(dnssec_key* key, u8* output_buffer)
+{
+    return ecdsa_public_store(key->key.ec, key->algorithm, output_buffer);
+}
+
+static u32
+ecdsa_dnskey_public_getsize(dnssec_key* key)
+{
+    return ecdsa_getfieldsize(key->algorithm) << 1;
+}
+
+static void
+ecdsa_free(dnssec_key* key)
+{
+    EC_KEY* ec = key->key.ec;
+    EC_KEY_free(ec);
+
+    key->key.ec = NULL;
+}
+
+static dnssec_key_vtbl ecdsa_vtbl = {
+    ecdsa_signdigest,
+    ecdsa_verifydigest,
+    ecdsa_dnskey_public_getsize,
+    ecdsa_dnskey_public_store,
+    ecdsa_free
+};
+
+ya_result
+ecdsa_initinstance(EC_KEY* ec, u8 algorithm, u16 flags, const char* origin, dnssec_key** out_key)
+{
+    int nid;
+
+    u8 rdata[4 + 2 * ECDSA_MAXIMUM_FIELD_SIZE];
+
+    *out_key = NULL;
+
+    if(FAIL(nid = ecdsa_getnid(algorithm)))
+    {
+        return nid;
+    }
+
+    u32 rdata_size = ecdsa_getfieldsize(algorithm) << 1;
+
+    SET_U16_AT(rdata[0], htons(flags)); /** @todo: NATIVEFLAGS */
+    rdata[2] = DNSKEY_PROTOCOL_FIELD;
+    rdata[3] = algorithm;
+
+    if(ecdsa_public_store(ec, algorithm, &rdata[4]) != rdata_size)
+    {
+        return DNSSEC_ERROR_UNEXPECTEDKEYSIZE; /* Computed size != real size */
+    }
+
+    /* Note : + 4 because of the flags,protocol & algorithm bytes
+     *        are not taken in account
+     */
+
+    u16 tag = dnskey_getkeytag(rdata, rdata_size + 4);
+
+    dnssec_key* key = dnssec_key_newemptyinstance(algorithm, flags, origin);
+
+    key->key.ec = ec;
+    key->vtbl = &ecdsa_vtbl;
+    key->tag = tag;
+    key->nid = nid;
+    key->is_private = (EC_KEY_get0_private_key(ec) != NULL);
+
+    *out_key = key;
+
+    return SUCCESS;
+}
+
+ya_result
+ecdsa_loadprivate(FILE* private, u8 algorithm, u16 flags, const char* origin, dnssec_key** out_key)
+{
+    *out_key = NULL;
+
+    if(private == NULL)
+    {
+        return ERROR;
+    }
+
+    if(FAIL(ecdsa_getnid(algorithm)))
+    {
+        return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
+    }
+
+    ya_result return_value = ERROR;
+
+    EC_KEY *ec = ecdsa_dnskey_key_scan(private, algorithm);
+
+    if(ec != NULL)
+    {
+        dnssec_key *key;
+
+        if(ISOK(return_value = ecdsa_initinstance(ec, algorithm, flags, origin, &key)))
+        {
+            *out_key = key;
+
+            return return_value;
+        }
+
+        EC_KEY_free(ec);
+    }
+
+    return return_value;
+}
+
+ya_result
+ecdsa_loadpublic(const u8 *rdata, u16 rdata_size, const char *origin, dnssec_key** out_key)
+{
+    *out_key = NULL;
+
+    if(rdata == NULL || rdata_size <= 6 || origin == NULL)
+    {
+        /* bad */
+
+        return ERROR;
+    }
+
+    u16 flags = ntohs(GET_U16_AT(rdata[0]));
+    u8 algorithm = rdata[3];
+
+    if(FAIL(ecdsa_getnid(algorithm)))
+    {
+        return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
+    }
+
+    rdata += 4;
+    rdata_size -= 4;
+
+    ya_result return_value = DNSSEC_ERROR_UNEXPECTEDKEYSIZE;
+
+    EC_KEY *ec = ecdsa_public_load(algorithm, rdata, rdata_size);
+
+    if(ec != NULL)
+    {
+        dnssec_key *key;
+
+        if(ISOK(return_value = ecdsa_initinstance(ec, algorithm, flags, origin, &key)))
+        {
+            *out_key = key;
+
+            return return_value;
+        }
+
+        EC_KEY_free(ec);
+    }
+
+    return return_value;
+}
+
+/*
+ * The size of an ECDSA key is given by its algorithm : size is only checked if set
+ */
+
+ya_result
+ecdsa_newinstance(u32 size, u8 algorithm, u16 flags, const char* origin, dnssec_key** out_key)
+{
+    *out_key = NULL;
+
+    if(FAIL(ecdsa_getnid(algorithm)))
+    {
+        return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
+    }
+
+    if((size != 0) && (size != (ecdsa_getfieldsize(algorithm) << 3)))
+    {
+        return DNSSEC_ERROR_UNEXPECTEDKEYSIZE;
+    }
+
+    ya_result return_value = ERROR;
+
+    EC_KEY *ec = ecdsa_genkey(algorithm);
+
+    if(ec != NULL)
+    {
+        dnssec_key *key;
+
+        if(ISOK(return_value = ecdsa_initinstance(ec, algorithm, flags, origin, &key)))
+        {
+            *out_key = key;
+
+            return return_value;
+        }
+
+        EC_KEY_free(ec);
+    }
+
+    return return_value;
+}
+
+ya_result
+ecdsa_storeprivate(FILE* private, dnssec_key* key)
+{
+    if(private == NULL)
+    {
+        return ERROR;
+    }
+
+    if(FAIL(ecdsa_getnid(key->algorithm)))
+    {
+        return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
+    }
+
+    u8 tmp_in[ECDSA_MAXIMUM_FIELD_SIZE];
+    char tmp_out[BASE64_ENCODED_SIZE(ECDSA_MAXIMUM_FIELD_SIZE)];
+
+    const BIGNUM *private_key = EC_KEY_get0_private_key(key->key.ec);
+
+    if(private_key == NULL)
+    {
+        return DNSSEC_ERROR_BNISNULL;
+    }
+
+    u32 field_size = ecdsa_getfieldsize(key->algorithm);
+
+    if(!ecdsa_bn2bin_padded(private_key, tmp_in, field_size))
+    {
+        return DNSSEC_ERROR_BNISBIGGERTHANBUFFER;
+    }
+
+    u32 n = base64_encode(tmp_in, field_size, tmp_out);
+
+    fprintf(private, "Private-key-format: v1.2\nAlgorithm: %i (%s)\nPrivateKey: ", key->algorithm, ecdsa_getname(key->algorithm));
+
+    if(fwrite(tmp_out, n, 1, private) != 1)
+    {
+        return DNSSEC_ERROR_KEYWRITEERROR;
+    }
+
+    fputs("\n", private);
+
+    return SUCCESS;
+}
+
+/*    ------------------------------------------------------------    */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
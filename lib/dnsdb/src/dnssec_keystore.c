@@ -51,6 +51,7 @@
 
 #include <openssl/rsa.h>
 #include <openssl/bn.h>
+#include <openssl/ec.h>
 
 #include <dnscore/base64.h>
 
@@ -398,6 +399,16 @@ dnssec_key_equals(dnssec_key* a, dnssec_key* b)
 
                     return FALSE;
                 }
+                case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+                case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+                {
+                    /* ECDSA, compare the public points (same algorithm implies same curve) */
+
+                    EC_KEY* a_ec = a->key.ec;
+                    EC_KEY* b_ec = b->key.ec;
+
+                    return EC_POINT_cmp(EC_KEY_get0_group(a_ec), EC_KEY_get0_public_key(a_ec), EC_KEY_get0_public_key(b_ec), NULL) == 0;
+                }
                 default:
                 {
                     DIE(DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM); /* Unsupported */
@@ -477,6 +488,16 @@ dnssec_key_createnew(u8 algorithm, u32 size, u16 flags, const char *origin, dnss
 
                 break;
             }
+            case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+            case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+            {
+                if(FAIL(return_value = ecdsa_newinstance(size, algorithm, flags, clean_origin, &key)))
+                {
+                    return return_value;
+                }
+
+                break;
+            }
             default:
             {
                 return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
@@ -485,15 +506,17 @@ dnssec_key_createnew(u8 algorithm, u32 size, u16 flags, const char *origin, dnss
 
         dnssec_key* same_tag_key;
         
-        if(ISOK(return_value = dnssec_key_load_private(algorithm, key->tag, flags, clean_origin, &same_tag_key)))
+        /**
+         * @note The error here should be the one derived from errno : file not found
+         */
+        
+        if(FAIL(return_value = dnssec_key_load_private(algorithm, key->tag, flags, clean_origin, &same_tag_key)))
         {
             dnssec_keystore_add(key);
             break;
         }
         
-        /**
-         * @note The error here should be the one derived from errno : file not found
-         */
+        /* a key with the same tag already exists : try again */
         
         ZFREE_STRING(key->owner_name);
         ZFREE_STRING(key->origin);
@@ -538,7 +561,22 @@ dnskey_load_public(const u8 *rdata, u16 rdata_size, const char *origin, dnssec_k
 
     if(key == NULL)
     {
-        if(ISOK(return_value = rsa_loadpublic(rdata, rdata_size, origin, &key)))
+        switch(algorithm)
+        {
+            case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+            case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+            {
+                return_value = ecdsa_loadpublic(rdata, rdata_size, origin, &key);
+                break;
+            }
+            default:
+            {
+                return_value = rsa_loadpublic(rdata, rdata_size, origin, &key);
+                break;
+            }
+        }
+
+        if(ISOK(return_value))
         {
             dnssec_keystore_add(key);
         }
@@ -598,6 +636,13 @@ dnssec_key_load_private(u8 algorithm, u16 tag, u16 flags, const char* origin, dn
 
                 break;
             }
+            case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+            case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+            {
+                return_value = ecdsa_loadprivate(f, algorithm, flags, clean_origin, &key);
+
+                break;
+            }
             default:
             {
                 return_value = DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
@@ -663,8 +708,19 @@ dnssec_key_store_private(dnssec_key* key)
             rsa_storeprivate(f, key);
             break;
         }
+        case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+        case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+        {
+            ya_result return_value = ecdsa_storeprivate(f, key);
+
+            fclose(f);
+
+            return (ISOK(return_value)) ? SUCCESS : return_value;
+        }
         default:
         {
+            fclose(f);
+
             return DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM;
         }
     }
@@ -113,7 +113,37 @@ dnssec_process_setthreadcount(int count)
         count = -1;
     }
 
-    processor_threads_count = count;
+    dnssec_process_threadcount = count;
+}
+
+/**
+ * Sends the batch being filled (if any) to the signers.
+ */
+
+static void
+dnssec_process_flush_batch(dnssec_task* task)
+{
+    if(task->batch != NULL)
+    {
+        threaded_queue_enqueue(task->query, task->batch);
+        task->batch = NULL;
+    }
+}
+
+void
+dnssec_process_queue_label(zdb_zone* zone, dnssec_task* task, zdb_rr_label* label, bool delegation)
+{
+    if((task->batch != NULL) && rrsig_update_batch_full(task->batch, &task->path))
+    {
+        dnssec_process_flush_batch(task);
+    }
+
+    if(task->batch == NULL)
+    {
+        task->batch = rrsig_update_batch_new(zone);
+    }
+
+    rrsig_update_batch_add(task->batch, label, &task->path, delegation);
 }
 
 /**
@@ -157,22 +187,6 @@ dnssec_process_rr_label(zdb_zone* zone, zdb_rr_label* rr_label, dnssec_task* tas
 
     if(LABEL_HAS_RECORDS(rr_label))
     {
-        rrsig_update_query* query;
-
-        MALLOC_OR_DIE(rrsig_update_query*, query, sizeof (rrsig_update_query), ZDB_RRSIGUPQ_TAG);
-
-        query->label = rr_label;
-
-        MEMCOPY(&query->path.labels[0], &task->path.labels[0], (task->path.size + 1) * sizeof (u8*));
-        query->path.size = task->path.size;
-
-        query->added_rrsig_sll = NULL;
-        query->removed_rrsig_sll = NULL;
-
-        query->delegation = FALSE;
-
-        query->zone = zone;
-
         /*
          * The label from root TLD and the zone cut have one thing in common:
          * The label (relative path from the previous node) has got a size of 0
@@ -182,11 +196,9 @@ dnssec_process_rr_label(zdb_zone* zone, zdb_rr_label* rr_label, dnssec_task* tas
         {
             ns_sll = zdb_record_find(&rr_label->resource_record_set, TYPE_NS);
             /** NOTE: Should I set a "delegation" flag (?) */
-
-            query->delegation = (ns_sll != NULL);
         }
 
-        threaded_queue_enqueue(task->query, query);
+        dnssec_process_queue_label(zone, task, rr_label, ns_sll != NULL);
     }
 
     /*
@@ -238,7 +250,7 @@ dnssec_process_task(zdb_zone* zone, dnssec_task* task, dnssec_process_task_callb
     log_debug("dnssec_process_zone: creating queues");
 #endif
 
-    u32 dnssec_process_queue_size = QUEUE_MAX_SIZE;
+    u32 dnssec_process_queue_size = (task->queue_size != 0)?task->queue_size:QUEUE_MAX_SIZE;
 
     threaded_queue_init(&dnssec_task_query_queue, dnssec_process_queue_size);
     threaded_queue_init(&dnssec_answer_query_queue, dnssec_process_queue_size);
@@ -250,6 +262,7 @@ dnssec_process_task(zdb_zone* zone, dnssec_task* task, dnssec_process_task_callb
 #endif
 
     task->query = &dnssec_task_query_queue;
+    task->batch = NULL;
 
     /*
      * Prepare & Start the threads
@@ -338,6 +351,10 @@ dnssec_process_task(zdb_zone* zone, dnssec_task* task, dnssec_process_task_callb
         callback(zone, task, whatyouwant);
     }
 
+    /* The last labels queued by the callback */
+
+    dnssec_process_flush_batch(task);
+
     /*
      * End of the core of the function
      */
@@ -555,6 +572,8 @@ dnssec_process_initialize(dnssec_task* task, dnssec_task_descriptor* desc)
     task->query_thread = desc->query_thread;
     task->answer_thread = desc->answer_thread;
     task->descriptor_name = desc->name;
+    task->queue_size = desc->queue_size;
+    task->batch = NULL;
     return SUCCESS;
 }
 
@@ -606,7 +625,7 @@ dnssec_process_zone_body(zdb_zone* zone, dnssec_task* task, void* whatyouwant)
 }
 
 ya_result
-dnssec_process_zone(zdb_zone* zone, dnssec_task* task)
+dnssec_process_zone_journal(zdb_zone* zone, dnssec_task* task, dnssec_process_task_callback *callback, void *whatyouwant)
 {
     /*************************************************************************************************
      *
@@ -640,7 +659,7 @@ dnssec_process_zone(zdb_zone* zone, dnssec_task* task)
 
     if(ISOK(return_code = zdb_icmtl_begin(zone, &icmtl, data_path)))
     {
-        if(ISOK(return_code = dnssec_process_task(zone, task, &dnssec_process_zone_body, NULL)))
+        if(ISOK(return_code = dnssec_process_task(zone, task, callback, whatyouwant)))
         {
             if(!dnscore_shuttingdown())
             {
@@ -660,6 +679,12 @@ dnssec_process_zone(zdb_zone* zone, dnssec_task* task)
     return return_code;
 }
 
+ya_result
+dnssec_process_zone(zdb_zone* zone, dnssec_task* task)
+{
+    return dnssec_process_zone_journal(zone, task, &dnssec_process_zone_body, NULL);
+}
+
 #if ZDB_NSEC3_SUPPORT != 0
 
 static ya_result
@@ -371,6 +371,7 @@ ya_result
 dynupdate_icmtlhook_disable()
 {
     zdb_listener_unchain((zdb_listener*) & icmtl_listener);
+    icmtl_listener.next = NULL; /* other listeners may be chained for good */
 
 #ifndef NDEBUG
     log_debug("incremental: disabled %{dnsname} for updates", icmtl_listener.origin);
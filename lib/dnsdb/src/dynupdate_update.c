@@ -160,18 +160,7 @@ dynupdate_update_rrsig_body(zdb_zone* zone, dnssec_task* task, void* whatyouwant
         {
             lus->label->flags &= ~ZDB_RR_LABEL_UPDATING;
 
-            rrsig_update_query* query;
-
-            MALLOC_OR_DIE(rrsig_update_query*, query, sizeof (rrsig_update_query), ZDB_RRSIGUPQ_TAG);
-
-            query->zone = zone;
-            query->label = lus->label;
-            MEMCOPY(&query->path.labels[0], &task->path.labels[0], (task->path.size + 1) * sizeof (u8*));
-            query->path.size = task->path.size;
-            query->added_rrsig_sll = NULL;
-            query->removed_rrsig_sll = NULL;
-
-            query->delegation = FALSE;
+            bool delegation = FALSE;
 
             /*
              * The label from root TLD and the zone cut have one thing in common:
@@ -180,7 +169,7 @@ dynupdate_update_rrsig_body(zdb_zone* zone, dnssec_task* task, void* whatyouwant
 
             if(lus->label->name[0] != 0)
             {
-                query->delegation = (zdb_record_find(&lus->label->resource_record_set, TYPE_NS) != NULL);
+                delegation = (zdb_record_find(&lus->label->resource_record_set, TYPE_NS) != NULL);
 
                 /** NOTE: Should I set a "delegation" flag (?) */
             }
@@ -189,7 +178,7 @@ dynupdate_update_rrsig_body(zdb_zone* zone, dnssec_task* task, void* whatyouwant
             log_debug("dynupdate_update_rrsig_body: queuing %{dnsnamestack}", &task->path);
 #endif
 
-            threaded_queue_enqueue(task->query, query);
+            dnssec_process_queue_label(zone, task, lus->label, delegation);
         }
     }
 
@@ -867,24 +856,24 @@ static void label_update_status_destroy(treeset_tree* lus_setp)
     {
         treeset_node *lus_node = treeset_avl_iterator_next_node(&lus_iter);
         label_update_status *lus = (label_update_status *)lus_node->data;
+        if(!lus->inversed)
+        {
+            free(lus->dname);
+        }
         ZFREE(lus,sizeof(label_update_status));
     }
     treeset_avl_destroy(lus_setp);
 }
 
-ya_result
-dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, bool dryrun)
+/**
+ * Reads and applies (or only checks if dryrun) the records of the update section.
+ * The labels changed are added to the set : they have to be sanitised and have their NSEC/NSEC3/RRSIG fixed.
+ * The set is owned by the caller, who has to destroy it even on error.
+ */
+
+static ya_result
+dynupdate_update_records(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, bool dryrun, treeset_tree *lus_set)
 {
-    if(ZDB_ZONE_INVALID(zone))
-    {
-        return ERROR; /* todo: use a specific code */
-    }
-     
-    if(count == 0)
-    {
-        return SUCCESS;
-    }
-     
     dnsname_vector origin_path;
     dnsname_vector name_path;
 
@@ -965,13 +954,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
         }
     }
 
-    treeset_tree lus_set = TREESET_EMPTY;
-    treeset_avl_iterator lus_iter;
-    
-#ifndef NDEBUG
-    memset(&lus_iter, 0xff, sizeof(lus_iter));
-#endif
-
     ptr_vector_init(&nsec3param_rrset);
     
     zdb_packed_ttlrdata *n3prrset = zdb_record_find(&zone->apex->resource_record_set, TYPE_NSEC3PARAM);
@@ -1013,8 +995,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                 }
             }
             
-            label_update_status_destroy(&lus_set);
-
             return SERVER_ERROR_CODE(RCODE_FORMERR);
         }        
 
@@ -1032,8 +1012,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
         
         if((rdata_size == 0) && (rclass != CLASS_ANY))
         {
-            label_update_status_destroy(&lus_set);
-            
             return SERVER_ERROR_CODE(RCODE_FORMERR);
         }
 
@@ -1047,8 +1025,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
             {
                 log_err("update: %{dnsname} manual add/del of %{dnstype} records refused", rname, &rtype);
                 
-                label_update_status_destroy(&lus_set);
-
                 return SERVER_ERROR_CODE(RCODE_NOTZONE);
             }
         }
@@ -1059,8 +1035,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
             
             log_err("update: %{dnsname} manual add/del of %{dnstype} records refused", rname, &rtype);
             
-            label_update_status_destroy(&lus_set);
-
             return SERVER_ERROR_CODE(RCODE_REFUSED);
         }
         
@@ -1073,8 +1047,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                 
                 log_err("update: %{dnsname} NSEC3PARAM add/del refused on an non-dnssec3 zone", rname);
                 
-                label_update_status_destroy(&lus_set);
-
                 return SERVER_ERROR_CODE(RCODE_REFUSED);
             }
             else
@@ -1085,8 +1057,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                     
                     log_err("update: %{dnsname} NSEC3PARAM with unsupported digest algorithm", rname);
                     
-                    label_update_status_destroy(&lus_set);
-
                     return SERVER_ERROR_CODE(RCODE_REFUSED);
                 }
                 
@@ -1096,8 +1066,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                     
                     log_err("update: %{dnsname} cannot remove all NSEC3PARAM of an NSEC3 zone", rname);
                     
-                    label_update_status_destroy(&lus_set);
-
                     return SERVER_ERROR_CODE(RCODE_REFUSED);
                 }
                 else if(rclass == CLASS_NONE)
@@ -1123,8 +1091,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                         
                         log_err("update: %{dnsname} cannot remove the last NSEC3PARAM of an NSEC3 zone", rname);
                     
-                        label_update_status_destroy(&lus_set);
-
                         return SERVER_ERROR_CODE(RCODE_REFUSED);
                     }
                 }
@@ -1137,8 +1103,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
 
             if(rttl != 0)
             {
-                label_update_status_destroy(&lus_set);
-
                 return SERVER_ERROR_CODE(RCODE_FORMERR);
             }
             
@@ -1193,7 +1157,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                                 {
                                     label->flags |= ZDB_RR_LABEL_UPDATING;
 
-                                    treeset_node *lus_node = treeset_avl_insert(&lus_set, label);
+                                    treeset_node *lus_node = treeset_avl_insert(lus_set, label);
 
                                     if(lus_node->data == NULL)
                                     {
@@ -1202,7 +1166,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                                         ZALLOC_OR_DIE(label_update_status*,lus,label_update_status,GENERIC_TAG);
 
                                         lus->label = label;
-                                        lus->dname = rname;
+                                        lus->dname = dnsname_dup(rname);
                                         lus->rtype = rtype;
                                         lus->remove = TRUE;
                                         lus->inversed = FALSE;
@@ -1227,8 +1191,6 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
         {   
             if((rttl != 0) || (rdata_size != 0))
             {
-                label_update_status_destroy(&lus_set);
-
                 return SERVER_ERROR_CODE(RCODE_FORMERR);
             }
             
@@ -1280,7 +1242,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                                 
                                 label->flags |= ZDB_RR_LABEL_UPDATING;
 
-                                treeset_node *lus_node = treeset_avl_insert(&lus_set, label);
+                                treeset_node *lus_node = treeset_avl_insert(lus_set, label);
                                 
                                 if(lus_node->data == NULL)
                                 {
@@ -1289,7 +1251,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                                     ZALLOC_OR_DIE(label_update_status*,lus,label_update_status,GENERIC_TAG);
 
                                     lus->label = label;
-                                    lus->dname = rname;
+                                    lus->dname = dnsname_dup(rname);
                                     lus->rtype = rtype;
                                     lus->remove = TRUE;
                                     lus->inversed = FALSE;
@@ -1400,7 +1362,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                         }
 #endif
 
-                        treeset_node *lus_node = treeset_avl_insert(&lus_set, label);
+                        treeset_node *lus_node = treeset_avl_insert(lus_set, label);
 
                         if(lus_node->data == NULL)
                         {
@@ -1409,7 +1371,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
                             ZALLOC_OR_DIE(label_update_status*,lus,label_update_status,GENERIC_TAG);
 
                             lus->label = label;
-                            lus->dname = rname;
+                            lus->dname = dnsname_dup(rname);
                             lus->rtype = rtype;
                             lus->remove = FALSE;
                             lus->inversed = FALSE;
@@ -1451,49 +1413,56 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
         }
     }
     while(--count > 0);
+    
+    return SUCCESS;
+}
+
+/**
+ * Sanitises the labels changed by one or more updates then fixes their NSEC/NSEC3 chains and signatures.
+ * Destroys the set.
+ */
+
+static ya_result
+dynupdate_update_finalize(zdb_zone* zone, treeset_tree *lus_set)
+{
+    treeset_avl_iterator lus_iter;
+    dnsname_stack name_stack;
+    ya_result return_value = SUCCESS;
 
-    if(!dryrun)
+    treeset_avl_iterator_init(lus_set, &lus_iter);
+
+    while(treeset_avl_iterator_hasnext(&lus_iter))
     {
-        ya_result return_value;
-        dnsname_stack name_stack;        
+        treeset_node *lus_node = treeset_avl_iterator_next_node(&lus_iter);
+        label_update_status *lus = (label_update_status *)lus_node->data;
 
-        treeset_avl_iterator_init(&lus_set, &lus_iter);
-        
-        while(treeset_avl_iterator_hasnext(&lus_iter))
-        {
-            treeset_node *lus_node = treeset_avl_iterator_next_node(&lus_iter);
-            label_update_status *lus = (label_update_status *)lus_node->data;
-            
 #ifndef NDEBUG
-            memset(&name_stack, 0xff, sizeof(name_stack));
+        memset(&name_stack, 0xff, sizeof(name_stack));
 #endif
-            
-            dnsname_to_dnsname_stack(lus->dname, &name_stack);
+
+        dnsname_to_dnsname_stack(lus->dname, &name_stack);
 
 #ifndef NDEBUG
-            log_debug("update: sanitise %{dnsnamestack}", &name_stack);
+        log_debug("update: sanitise %{dnsnamestack}", &name_stack);
 #endif
 
-            if(((return_value = zdb_sanitize_rr_label_with_parent(zone, lus->label, &name_stack)) & SANITY_MUSTDROPZONE) != 0)
-            {
-                /**
-                 * Something bad happened.
-                 *
-                 * What do I do ? I can't really rollback because I already destroyed sets of records.
-                 * On another hand AFAIK only multiple SOAs can do this ...
-                 * 
-                 */
+        if((zdb_sanitize_rr_label_with_parent(zone, lus->label, &name_stack) & SANITY_MUSTDROPZONE) != 0)
+        {
+            /**
+             * Something bad happened.
+             *
+             * What do I do ? I can't really rollback because I already destroyed sets of records.
+             * On another hand AFAIK only multiple SOAs can do this ...
+             * 
+             */
 
-                log_err("update: sanitise reports that the zone should be dropped");
-            }
+            log_err("update: sanitise reports that the zone should be dropped");
         }
     }
-    
-    ya_result return_value = SUCCESS;
 
 #if ZDB_DNSSEC_SUPPORT != 0
     
-    if( !dryrun && (zone->apex->nsec.dnssec != NULL) )
+    if(zone->apex->nsec.dnssec != NULL)
     {
         /*
          * @TODO
@@ -1514,7 +1483,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
 #if ZDB_NSEC_SUPPORT != 0
         if((zone->apex->flags & ZDB_RR_LABEL_NSEC) != 0)
         {
-            treeset_avl_iterator_init(&lus_set, &lus_iter);
+            treeset_avl_iterator_init(lus_set, &lus_iter);
             while(treeset_avl_iterator_hasnext(&lus_iter))
             {
                 treeset_node *lus_node = treeset_avl_iterator_next_node(&lus_iter);
@@ -1527,21 +1496,21 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
              */
 
             zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_DYNUPDATE); /** @todo : "give" the mutex instead of this */
-            dynupdate_update_nsec(zone, &lus_set);
+            dynupdate_update_nsec(zone, lus_set);
             zdb_zone_lock(zone, ZDB_ZONE_MUTEX_DYNUPDATE); /** @todo : "give" the mutex instead of this */
         }
 #endif
 
         dnssec_process_initialize(&task, main_task);
         zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_DYNUPDATE); /** @todo : "give" the mutex instead of this */
-        return_value = dnssec_process_task(zone, &task, dynupdate_update_rrsig_body, &lus_set);
+        return_value = dnssec_process_task(zone, &task, dynupdate_update_rrsig_body, lus_set);
         zdb_zone_lock(zone, ZDB_ZONE_MUTEX_DYNUPDATE); /** @todo : "give" the mutex instead of this */
         dnssec_process_finalize(&task);
 
 #if ZDB_NSEC3_SUPPORT != 0
         if(ISOK(return_value) && ((zone->apex->flags & ZDB_RR_LABEL_NSEC3) != 0))
         {
-            treeset_avl_iterator_init(&lus_set, &lus_iter);
+            treeset_avl_iterator_init(lus_set, &lus_iter);
             while(treeset_avl_iterator_hasnext(&lus_iter))
             {
                 treeset_node *lus_node = treeset_avl_iterator_next_node(&lus_iter);
@@ -1554,7 +1523,7 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
 
             dnssec_process_initialize(&task, dnssec_task);
             zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_DYNUPDATE); /** @todo : "give" the mutex instead of this */
-            return_value = dnssec_process_task(zone, &task, dynupdate_update_nsec3_body, &lus_set);
+            return_value = dnssec_process_task(zone, &task, dynupdate_update_nsec3_body, lus_set);
             zdb_zone_lock(zone, ZDB_ZONE_MUTEX_DYNUPDATE); /** @todo : "give" the mutex instead of this */
             dnssec_process_finalize(&task);
         }
@@ -1564,11 +1533,93 @@ dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, b
 
 #endif
 
-    label_update_status_destroy(&lus_set);
+    label_update_status_destroy(lus_set);
 
     return return_value;
 }
 
+ya_result
+dynupdate_update(zdb_zone* zone, packet_unpack_reader_data *reader, u16 count, bool dryrun)
+{
+    if(ZDB_ZONE_INVALID(zone))
+    {
+        return ERROR; /* todo: use a specific code */
+    }
+     
+    if(count == 0)
+    {
+        return SUCCESS;
+    }
+    
+    treeset_tree lus_set = TREESET_EMPTY;
+    
+    ya_result return_value = dynupdate_update_records(zone, reader, count, dryrun, &lus_set);
+    
+    if(ISOK(return_value) && !dryrun)
+    {
+        return_value = dynupdate_update_finalize(zone, &lus_set);
+    }
+    else
+    {
+        label_update_status_destroy(&lus_set);
+    }
+    
+    return return_value;
+}
+
+void
+dynupdate_batch_init(dynupdate_batch *batch)
+{
+    batch->lus_set.root = NULL;
+    batch->lus_set.compare = treeset_default_node_compare;
+    batch->count = 0;
+}
+
+ya_result
+dynupdate_batch_update(zdb_zone* zone, dynupdate_batch *batch, packet_unpack_reader_data *reader, u16 count)
+{
+    if(ZDB_ZONE_INVALID(zone))
+    {
+        return ERROR; /* todo: use a specific code */
+    }
+    
+    if(count == 0)
+    {
+        batch->count++;
+        
+        return SUCCESS;
+    }
+    
+    /*
+     * Even if it fails, the labels changed until then stay in the set so their chains and signatures are fixed
+     * with the rest of the batch.
+     */
+    
+    ya_result return_value = dynupdate_update_records(zone, reader, count, DYNUPDATE_UPDATE_RUN, &batch->lus_set);
+    
+    if(ISOK(return_value))
+    {
+        batch->count++;
+    }
+    
+    return return_value;
+}
+
+ya_result
+dynupdate_batch_commit(zdb_zone* zone, dynupdate_batch *batch)
+{
+    ya_result return_value = SUCCESS;
+    
+    if(!treeset_avl_isempty(&batch->lus_set))
+    {
+        return_value = dynupdate_update_finalize(zone, &batch->lus_set);
+    }
+    
+    dynupdate_batch_init(batch);
+    
+    return return_value;
+}
+
 /*    ------------------------------------------------------------    */
 
 /** @} */
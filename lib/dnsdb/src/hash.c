@@ -163,6 +163,32 @@ hash_pascalname(const u8* pascal_name)
     return hash;
 }
 
+/** @brief Compute the hash code of a dns name
+ *
+ *  Compute the hash code of a dns name by combining the hash codes of its labels.
+ *  The function hash_init() MUST be called once first.
+ *
+ *  @param[in]  dns_name the name in its DNS form
+ *
+ *  @return the hash code as a 32 bits integer
+ */
+
+hashcode
+hash_dnsname(const u8* dns_name)
+{
+    assert(dns_name != NULL);
+
+    u32 hash = 0;
+
+    while(*dns_name != 0)
+    {
+        hash = ((hash << 5) | (hash >> 27)) ^ hash_dnslabel(dns_name);
+        dns_name += *dns_name + 1;
+    }
+
+    return hash;
+}
+
 /** @brief Compute the hash code of an asciiz name
  *
  *  Compute the hash code of a pascal name from its asciiz form.
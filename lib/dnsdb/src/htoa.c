@@ -0,0 +1,315 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbcollection Collections used by the database
+ *  @ingroup dnsdb
+ *  @brief Open addressing hash table structure and functions.
+ *
+ *  Implementation of an open addressing (linear probing) hash table mapping a hashcode to a data pointer.
+ *  The deleted slots are marked (tombstones) so that a slot never moves while a reader may be probing
+ *  the table.  The tombstones are dropped when the table is resized, into a new table that replaces
+ *  the old one with a single pointer store, the old one being released through the epoch.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdlib.h>
+
+#include <dnscore/sys_types.h>
+
+#include "dnsdb/htoa.h"
+#include "dnsdb/zdb_epoch.h"
+
+#define ZDBHTOAT_TAG 0x54414f544842445a /* ZDBHTOAT */
+
+#define HTOA_CAPACITY_MIN   8
+
+static htoa
+htoa_alloc(u32 capacity)
+{
+    htoa table;
+    
+    /* one block : the header, the data, the hashes then the tags */
+    
+    MALLOC_OR_DIE(htoa, table, sizeof(htoa_table) + (sizeof(void*) + sizeof(hashcode) + sizeof(u8)) * capacity, ZDBHTOAT_TAG);
+    
+    table->data = (void**)&table[1];
+    table->hashes = (hashcode*)&table->data[capacity];
+    table->tags = (u8*)&table->hashes[capacity];
+    table->mask = capacity - 1;
+    table->shift = 32;
+    table->used = 0;
+    table->deleted = 0;
+    
+    while(capacity > 1)
+    {
+        table->shift--;
+        capacity >>= 1;
+    }
+    
+    ZEROMEMORY(table->tags, table->mask + 1);
+    
+    return table;
+}
+
+/**
+ * Returns the slot of the hash, or the empty slot where it would be.
+ * The deleted slots are skipped and never reused.
+ */
+
+static inline u32
+htoa_probe(htoa table, hashcode obj_hash)
+{
+    u8 tag = HTOA_TAG(obj_hash);
+    u32 i = HTOA_HOME(table, obj_hash);
+    
+    for(;;)
+    {
+        u8 slot_tag = table->tags[i];
+        
+        if(slot_tag == HTOA_TAG_EMPTY)
+        {
+            return i;
+        }
+        
+        if((slot_tag == tag) && (table->hashes[i] == obj_hash))
+        {
+            return i;
+        }
+
+        i = (i + 1) & table->mask;
+    }
+}
+
+static void
+htoa_free_callback(void *table)
+{
+    free(table);
+}
+
+/**
+ * Copies the used slots into a new table of the given capacity then
+ * replaces the table of the collection by it.
+ * The old table is released once no reader can be probing it anymore.
+ */
+
+static htoa
+htoa_resize(htoa* collection, u32 capacity)
+{
+    htoa table = *collection;
+    htoa new_table = htoa_alloc(capacity);
+    u32 i;
+    
+    for(i = 0; i <= table->mask; i++)
+    {
+        if(HTOA_TAG_USED(table->tags[i]))
+        {
+            u32 j = htoa_probe(new_table, table->hashes[i]);
+            
+            new_table->tags[j] = table->tags[i];
+            new_table->hashes[j] = table->hashes[i];
+            new_table->data[j] = table->data[i];
+        }
+    }
+    
+    new_table->used = table->used;
+    
+    /* the new table must be complete before it can be seen */
+    
+    __sync_synchronize();
+    
+    *collection = new_table;
+    
+    zdb_epoch_defer(htoa_free_callback, table);
+    
+    return new_table;
+}
+
+void
+htoa_init(htoa* collection)
+{
+    *collection = NULL;
+}
+
+void**
+htoa_insert(htoa* collection, hashcode obj_hash)
+{
+    htoa table = *collection;
+    
+    if(table == NULL)
+    {
+        table = htoa_alloc(HTOA_CAPACITY_MIN);
+        __sync_synchronize();
+        *collection = table;
+    }
+    
+    u32 i = htoa_probe(table, obj_hash);
+    
+    if(table->tags[i] != HTOA_TAG_EMPTY)
+    {
+        return &table->data[i];
+    }
+    
+    /* keep the table at most 3/4 full, the deleted slots included */
+    
+    if(((table->used + table->deleted + 1) << 2) > ((table->mask + 1) * 3))
+    {
+        /* only grow if the deleted slots are not enough to make room */
+        
+        u32 capacity = table->mask + 1;
+        
+        if(((table->used + 1) << 1) > capacity)
+        {
+            capacity <<= 1;
+        }
+        
+        table = htoa_resize(collection, capacity);
+        
+        i = htoa_probe(table, obj_hash);
+    }
+    
+    table->hashes[i] = obj_hash;
+    table->data[i] = NULL;
+    
+    /* the slot must be complete before its tag can be seen */
+    
+    __sync_synchronize();
+    
+    table->tags[i] = HTOA_TAG(obj_hash);
+    table->used++;
+    
+    return &table->data[i];
+}
+
+void*
+htoa_delete(htoa* collection, hashcode obj_hash)
+{
+    htoa table = *collection;
+    
+    if(table == NULL)
+    {
+        return NULL;
+    }
+    
+    u32 i = htoa_probe(table, obj_hash);
+    
+    if(table->tags[i] == HTOA_TAG_EMPTY)
+    {
+        return NULL;
+    }
+    
+    void *data = table->data[i];
+    
+    /*
+     * Only the tag changes : a reader that already matched the slot still
+     * reads the data it was looking for, the others keep probing past it.
+     */
+    
+    table->tags[i] = HTOA_TAG_DELETED;
+    table->used--;
+    table->deleted++;
+    
+    if(table->used == 0)
+    {
+        *collection = NULL;
+        
+        zdb_epoch_defer(htoa_free_callback, table);
+    }
+    else if((table->mask + 1 > HTOA_CAPACITY_MIN) && ((table->used << 3) < (table->mask + 1)))
+    {
+        htoa_resize(collection, (table->mask + 1) >> 1);
+    }
+    
+    return data;
+}
+
+void
+htoa_destroy(htoa* collection)
+{
+    free(*collection);
+    *collection = NULL;
+}
+
+void
+htoa_retire(htoa* collection)
+{
+    htoa table = *collection;
+    
+    if(table != NULL)
+    {
+        *collection = NULL;
+        
+        zdb_epoch_defer(htoa_free_callback, table);
+    }
+}
+
+static inline u32
+htoa_iterator_skip(htoa table, u32 index)
+{
+    while((index <= table->mask) && !HTOA_TAG_USED(table->tags[index]))
+    {
+        index++;
+    }
+    
+    return index;
+}
+
+void
+htoa_iterator_init(htoa table, htoa_iterator* iter)
+{
+    iter->table = table;
+    iter->index = (table != NULL)?htoa_iterator_skip(table, 0):0;
+}
+
+void**
+htoa_iterator_next_key(htoa_iterator* iter, hashcode *keyp)
+{
+    htoa table = iter->table;
+    u32 index = iter->index;
+    
+    if(keyp != NULL)
+    {
+        *keyp = table->hashes[index];
+    }
+    
+    iter->index = htoa_iterator_skip(table, index + 1);
+    
+    return &table->data[index];
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
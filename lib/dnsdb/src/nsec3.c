@@ -645,9 +645,9 @@ nsec3_add_label(zdb_zone* zone, zdb_rr_label* label, dnslabel_vector_reference l
 
         if(self_prev->rrsig != NULL)
         {
-            ZDB_RECORD_ZFREE(self_prev->rrsig);
+            zdb_packed_ttlrdata* rrsig = self_prev->rrsig;
             self_prev->rrsig = NULL;
-
+            zdb_record_retire(rrsig);
         }
 
         /*
@@ -1359,8 +1359,6 @@ void nsec3_closest_encloser_proof(
 {
     u8 closest_provable_encloser[MAX_DOMAIN_LENGTH];
     u8 encloser[MAX_DOMAIN_LENGTH];
-    u8 digest[64 + 1];
-    digest[0] = 20;
 
     const_dnslabel_vector_reference qname_sections = qname->labels;
     s32 closest_encloser_index_limit = qname->size - apex_index + 1; /* not "+1'" because it starts at the apex */
@@ -1383,32 +1381,83 @@ void nsec3_closest_encloser_proof(
         u8 salt_len = NSEC3_ZONE_SALT_LEN(n3);
         u8* salt = NSEC3_ZONE_SALT(n3);
 
-        nsec3_hash_function* digestname = nsec3_hash_get_function(NSEC3_ZONE_ALGORITHM(n3));
-
         /** @note log_* cannot be used here */
 
+        /*
+         * The digests that are not known yet are computed together
+         */
+
+        const u8 *names[3];
+        u32 name_lens[3];
+        u8 *digests[3];
+        u32 count = 0;
+
+        u8 encloser_digest[1 + MAX_DIGEST_LENGTH];
+        u8 closest_provable_encloser_digest[1 + MAX_DIGEST_LENGTH];
+        u8 wild_closest_provable_encloser_digest[1 + MAX_DIGEST_LENGTH];
+        u8 wild_closest_provable_encloser[2 + MAX_DOMAIN_LENGTH];
+
+        u8 digest_len = nsec3_hash_len(NSEC3_ZONE_ALGORITHM(n3));
+        encloser_digest[0] = digest_len;
+        closest_provable_encloser_digest[0] = digest_len;
+        wild_closest_provable_encloser_digest[0] = digest_len;
+
         if(encloser_nsec3p != NULL)
         {
             zassert((closest_provable_encloser_label != NULL) && (closest_encloser_index_limit > 0));
 
-            nsec3_zone_item* encloser_nsec3;
             dnsname_vector_sub_to_dnsname(qname, closest_encloser_index_limit - 1, encloser);
-            digestname(encloser, dnsname_len(encloser), salt, salt_len, iterations, &digest[1], FALSE);
+
+            names[count] = encloser;
+            name_lens[count] = dnsname_len(encloser);
+            digests[count++] = &encloser_digest[1];
+        }
+
+        if((closest_provable_encloser_nsec3p != NULL) || (wild_closest_provable_encloser_nsec3p != NULL))
+        {
+            dnsname_vector_sub_to_dnsname(qname, closest_encloser_index_limit  , closest_provable_encloser);
+        }
+
+        if((closest_provable_encloser_nsec3p != NULL) && (closest_provable_encloser_label->nsec.nsec3->self == NULL))
+        {
+            names[count] = closest_provable_encloser;
+            name_lens[count] = dnsname_len(closest_provable_encloser);
+            digests[count++] = &closest_provable_encloser_digest[1];
+        }
+
+        if((wild_closest_provable_encloser_nsec3p != NULL) && (closest_provable_encloser_label->nsec.nsec3->star == NULL))
+        {
+            u32 closest_provable_encloser_len = dnsname_len(closest_provable_encloser);
+
+            wild_closest_provable_encloser[0] = 1;
+            wild_closest_provable_encloser[1] = '*';
+            MEMCOPY(&wild_closest_provable_encloser[2], closest_provable_encloser, closest_provable_encloser_len);
+
+            names[count] = wild_closest_provable_encloser;
+            name_lens[count] = closest_provable_encloser_len + 2;
+            digests[count++] = &wild_closest_provable_encloser_digest[1];
+        }
+
+        if(count > 0)
+        {
+            nsec3_hash_get_batch_function(NSEC3_ZONE_ALGORITHM(n3))(names, name_lens, count, salt, salt_len, iterations, digests, FALSE);
+        }
+
+        if(encloser_nsec3p != NULL)
+        {
+            nsec3_zone_item* encloser_nsec3;
             //OSDEBUG("nsec3_closest_encloser_proof: next digest %{dnsname}: %{digest32h}", encloser, encloser_nsec3->digest);
-            encloser_nsec3 = nsec3_zone_item_find(n3, digest);
+            encloser_nsec3 = nsec3_zone_item_find(n3, encloser_digest);
             *encloser_nsec3p = encloser_nsec3;
             //OSDEBUG("nsec3_closest_encloser_proof: next encloser %{dnsname}: %{digest32h}", encloser, encloser_nsec3->digest);
         }
 
         if(closest_provable_encloser_nsec3p != NULL)
         {
-            dnsname_vector_sub_to_dnsname(qname, closest_encloser_index_limit  , closest_provable_encloser);
-
             nsec3_zone_item* closest_provable_encloser_nsec3;
             if((closest_provable_encloser_nsec3 = closest_provable_encloser_label->nsec.nsec3->self) == NULL)
             {
-                digestname(closest_provable_encloser, dnsname_len(closest_provable_encloser), salt, salt_len, iterations, &digest[1], FALSE);
-                closest_provable_encloser_nsec3 = nsec3_avl_find(&n3->items, digest);
+                closest_provable_encloser_nsec3 = nsec3_avl_find(&n3->items, closest_provable_encloser_digest);
 
                 nsec3_add_owner(closest_provable_encloser_nsec3, closest_provable_encloser_label);
                 closest_provable_encloser_label->nsec.nsec3->self = closest_provable_encloser_nsec3; /* @TODO check multiples */
@@ -1419,17 +1468,11 @@ void nsec3_closest_encloser_proof(
 
         if(wild_closest_provable_encloser_nsec3p != NULL)
         {
-            if(closest_provable_encloser_nsec3p == NULL)
-            {
-                dnsname_vector_sub_to_dnsname(qname, closest_encloser_index_limit  , closest_provable_encloser);
-            }
-
             nsec3_zone_item* wild_closest_provable_encloser_nsec3;
 
             if((wild_closest_provable_encloser_nsec3 = closest_provable_encloser_label->nsec.nsec3->star) == NULL)
             {
-                digestname(closest_provable_encloser, dnsname_len(closest_provable_encloser), salt, salt_len, iterations, &digest[1], TRUE);
-                wild_closest_provable_encloser_nsec3 = nsec3_avl_find_interval_start(&n3->items, digest);
+                wild_closest_provable_encloser_nsec3 = nsec3_avl_find_interval_start(&n3->items, wild_closest_provable_encloser_digest);
 
                 nsec3_add_star(wild_closest_provable_encloser_nsec3, closest_provable_encloser_label);
                 closest_provable_encloser_label->nsec.nsec3->star = wild_closest_provable_encloser_nsec3; /* @TODO check multiples */
@@ -334,7 +334,7 @@ nsec3_zone_item_rrsig_del_by_keytag(nsec3_zone_item *item, u16 native_key_tag)
             {
                 /* Remove from the list */
                 *rrsigp = rrsig->next;
-                ZDB_RECORD_ZFREE(rrsig);
+                zdb_record_retire(rrsig);
                 break;
             }
 
@@ -360,7 +360,7 @@ nsec3_zone_item_rrsig_del(nsec3_zone_item *item, zdb_ttlrdata *nsec3_rrsig)
                 {
                     /* Remove from the list */
                     *rrsigp = rrsig->next;
-                    ZDB_RECORD_ZFREE(rrsig);
+                    zdb_record_retire(rrsig);
                     break;
                 }
 
@@ -451,7 +451,7 @@ nsec3_zone_item_rrsig_delete_all(nsec3_zone_item *item)
 
         rrsig = rrsig->next;
 
-        ZDB_RECORD_ZFREE(tmp);
+        zdb_record_retire(tmp);
     }
 }
 
@@ -304,6 +304,13 @@ nsec3_load_init(nsec3_load_context *context, zdb_zone* zone)
     return SUCCESS;
 }
 
+void
+nsec3_load_set_digest_hint(nsec3_load_context *context, nsec3_digest_hint_callback *digest_hint, void *digest_hint_args)
+{
+    context->digest_hint = digest_hint;
+    context->digest_hint_args = digest_hint_args;
+}
+
 /*
  *
  */
@@ -433,7 +440,7 @@ nsec3_load_compile(nsec3_load_context *context)
         context->zone->apex->flags &= ~ZDB_RR_LABEL_NSEC3_OPTOUT;
     }
     
-    nsec3_update_zone(context->zone);
+    nsec3_update_zone_with_hint(context->zone, context->digest_hint, context->digest_hint_args);
 
     //nsec3_check(context->zone);
 
@@ -680,7 +687,7 @@ nsec3_load_forced(nsec3_load_context *context)
 
     /* 1) */
 
-    nsec3_update_zone(context->zone);
+    nsec3_update_zone_with_hint(context->zone, context->digest_hint, context->digest_hint_args);
 
     /* 2) */
 
@@ -46,7 +46,9 @@
 #include <stdlib.h>
 
 #include "dnsdb/nsec3_types.h"
+#include "dnsdb/nsec3.h"
 #include "dnsdb/nsec3_item.h"
+#include "dnsdb/nsec3_proof_cache.h"
 
 #include "dnsdb/rrsig.h"
 
@@ -90,17 +92,84 @@ nsec3_name_error(const zdb_zone* zone, const dnsname_vector *qname, u32 apex_ind
     nsec3_zone_item *closest_provable_encloser_nsec3;
     nsec3_zone_item *wild_closest_provable_encloser_nsec3;
 
-    nsec3_closest_encloser_proof(zone, qname, apex_index,
-                                 &encloser_nsec3,
-                                 &closest_provable_encloser_nsec3,
-                                 &wild_closest_provable_encloser_nsec3
-                                 );
+    nsec3_zone* n3 = zone->nsec.nsec3;
+    
+    u8 * const owners[NSEC3_PROOF_CACHE_RECORDS] =
+    {
+        out_next_closer_nsec3_owner,
+        out_closest_encloser_nsec3_owner,
+        out_wild_closest_encloser_nsec3_owner
+    };
+    
+    zdb_packed_ttlrdata *nsec3[NSEC3_PROOF_CACHE_RECORDS];
+    zdb_packed_ttlrdata *nsec3_rrsig[NSEC3_PROOF_CACHE_RECORDS];
+    
+    const zdb_rr_label *closest_provable_encloser_label = NULL;
+    u8 next_closer_digest[1 + MAX_DIGEST_LENGTH];
+    u64 generation = 0;
+    
+    if(nsec3_proof_cache_enabled())
+    {
+        /*
+         * The proof only depends on the closest provable encloser and on the
+         * interval covering the next closer name: one hash to look for it.
+         */
+        
+        generation = nsec3_proof_cache_generation(zone);
+        
+        s32 closest_encloser_index_limit = qname->size - apex_index + 1;
+        
+        if(closest_encloser_index_limit > 0)
+        {
+            closest_provable_encloser_label = nsec3_get_closest_provable_encloser(zone->apex, qname->labels, &closest_encloser_index_limit);
+            
+            const nsec3_label_extension *n3ext = closest_provable_encloser_label->nsec.nsec3;
+            
+            if((closest_encloser_index_limit > 0) && (n3ext != NULL) && (n3ext->self != NULL) && (n3ext->star != NULL))
+            {
+                u8 next_closer[MAX_DOMAIN_LENGTH];
+                
+                dnsname_vector_sub_to_dnsname(qname, closest_encloser_index_limit - 1, next_closer);
+                
+                nsec3_compute_digest_from_fqdn(n3, next_closer, next_closer_digest);
+                
+                if(nsec3_proof_cache_get(zone, closest_provable_encloser_label, next_closer_digest, owners, nsec3, nsec3_rrsig))
+                {
+                    *out_encloser_nsec3 = nsec3[NSEC3_PROOF_CACHE_NEXT_CLOSER];
+                    *out_encloser_nsec3_rrsig = nsec3_rrsig[NSEC3_PROOF_CACHE_NEXT_CLOSER];
+                    *out_closest_encloser_nsec3 = nsec3[NSEC3_PROOF_CACHE_CLOSEST_ENCLOSER];
+                    *out_closest_encloser_nsec3_rrsig = nsec3_rrsig[NSEC3_PROOF_CACHE_CLOSEST_ENCLOSER];
+                    *out_wild_closest_encloser_nsec3 = nsec3[NSEC3_PROOF_CACHE_WILD_CLOSEST_ENCLOSER];
+                    *out_wild_closest_encloser_nsec3_rrsig = nsec3_rrsig[NSEC3_PROOF_CACHE_WILD_CLOSEST_ENCLOSER];
+                    
+                    return;
+                }
+                
+                encloser_nsec3 = nsec3_zone_item_find(n3, next_closer_digest);
+                closest_provable_encloser_nsec3 = n3ext->self;
+                wild_closest_provable_encloser_nsec3 = n3ext->star;
+            }
+            else
+            {
+                /* the self/star links of the encloser are made by the complete proof */
+                
+                closest_provable_encloser_label = NULL;
+            }
+        }
+    }
+
+    if(closest_provable_encloser_label == NULL)
+    {
+        nsec3_closest_encloser_proof(zone, qname, apex_index,
+                                     &encloser_nsec3,
+                                     &closest_provable_encloser_nsec3,
+                                     &wild_closest_provable_encloser_nsec3
+                                     );
+    }
 
     /* Append all items + sig to the authority
      * Don't do dups
      */
-
-    nsec3_zone* n3 = zone->nsec.nsec3;
     
     u32 min_ttl = 900;
     
@@ -139,6 +208,18 @@ nsec3_name_error(const zdb_zone* zone, const dnsname_vector *qname, u32 apex_ind
                                             out_wild_closest_encloser_nsec3,
                                             out_wild_closest_encloser_nsec3_rrsig);
     }
+    
+    if(closest_provable_encloser_label != NULL)
+    {
+        nsec3[NSEC3_PROOF_CACHE_NEXT_CLOSER] = *out_encloser_nsec3;
+        nsec3_rrsig[NSEC3_PROOF_CACHE_NEXT_CLOSER] = *out_encloser_nsec3_rrsig;
+        nsec3[NSEC3_PROOF_CACHE_CLOSEST_ENCLOSER] = *out_closest_encloser_nsec3;
+        nsec3_rrsig[NSEC3_PROOF_CACHE_CLOSEST_ENCLOSER] = (*out_closest_encloser_nsec3 != NULL)?*out_closest_encloser_nsec3_rrsig:NULL;
+        nsec3[NSEC3_PROOF_CACHE_WILD_CLOSEST_ENCLOSER] = *out_wild_closest_encloser_nsec3;
+        nsec3_rrsig[NSEC3_PROOF_CACHE_WILD_CLOSEST_ENCLOSER] = (*out_wild_closest_encloser_nsec3 != NULL)?*out_wild_closest_encloser_nsec3_rrsig:NULL;
+        
+        nsec3_proof_cache_put(generation, zone, closest_provable_encloser_label, next_closer_digest, encloser_nsec3, owners, nsec3, nsec3_rrsig);
+    }
 }
 
 /** @} */
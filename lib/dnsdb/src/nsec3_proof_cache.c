@@ -0,0 +1,414 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup nsec3 NSEC3 functions
+ *  @ingroup dnsdbdnssec
+ *  @brief Cache of the NSEC3 name error proofs
+ *
+ *  The slot of a proof is chosen from its closest provable encloser and from
+ *  the first bits of the digest of the next closer name.  As the digests are
+ *  sorted in the chain, names falling in the same NSEC3 interval mostly end
+ *  up in the same slot and a given encloser gets its intervals spread over
+ *  the array.
+ *
+ *  An entry is made of one allocation : the key, the prebuilt NSEC3 records
+ *  and their owners.  The signatures are references into the database, valid
+ *  as long as the generation of the entry is the current one : the one of
+ *  its zone, bumped when a writer releases the zone, and the one of the
+ *  zones of the database, bumped when a zone is mounted or destroyed.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dnscore/dnscore.h>
+#include <dnscore/logger.h>
+#include <dnscore/dnsname.h>
+
+#include "dnsdb/nsec3.h"
+#include "dnsdb/nsec3_proof_cache.h"
+#include "dnsdb/zdb_epoch.h"
+
+extern logger_handle* g_dnssec_logger;
+#define MODULE_MSG_HANDLE g_dnssec_logger
+
+/* every that many replaced entries, the deferred ones are released */
+
+#define NSEC3_PROOF_CACHE_RECLAIM_PERIOD 256
+
+typedef struct nsec3_proof_cache_entry nsec3_proof_cache_entry;
+
+struct nsec3_proof_cache_entry
+{
+    const zdb_zone *zone;
+    const zdb_rr_label *label;
+    zdb_packed_ttlrdata *nsec3[NSEC3_PROOF_CACHE_RECORDS];       /* into the entry */
+    zdb_packed_ttlrdata *nsec3_rrsig[NSEC3_PROOF_CACHE_RECORDS]; /* into the database */
+    u8 *owners[NSEC3_PROOF_CACHE_RECORDS];                       /* into the entry */
+    u64 generation;
+    bool wraps;                                 /* the interval is the last one of the chain */
+    u8 interval_start[1 + MAX_DIGEST_LENGTH];
+    u8 interval_end[1 + MAX_DIGEST_LENGTH];
+    /* records then owners */
+};
+
+typedef struct nsec3_proof_cache_slot nsec3_proof_cache_slot;
+
+struct nsec3_proof_cache_slot
+{
+    nsec3_proof_cache_entry * volatile entry;
+    volatile u32 candidate;     /* the last proof that has been refused */
+};
+
+static nsec3_proof_cache_slot *nsec3_proof_cache_slots = NULL;
+static u32 nsec3_proof_cache_mask = 0;
+static u32 nsec3_proof_cache_bits = 0;
+
+/* 0 is never used so an entry of a destroyed zone can never match once the counter wrapped */
+
+static volatile u32 nsec3_proof_cache_zones_gen = 1;
+static volatile u32 nsec3_proof_cache_replaced = 0;
+
+/*
+ * Helpers
+ */
+
+static inline u32
+nsec3_proof_cache_label_hash(const zdb_rr_label *label)
+{
+    u32 h = (u32)(((intptr)label) >> 4);
+    h *= 0x9e3779b1;
+    h ^= h >> 16;
+    
+    return h;
+}
+
+static inline u32
+nsec3_proof_cache_slot_index(const zdb_rr_label *label, const u8 *next_closer_digest)
+{
+    u32 h = nsec3_proof_cache_label_hash(label);
+    
+    /* the first bits of the digest : a contiguous range of the chain */
+    
+    u32 range = ((u32)next_closer_digest[1] << 16) | ((u32)next_closer_digest[2] << 8) | next_closer_digest[3];
+    
+    return (h + (range >> (24 - nsec3_proof_cache_bits))) & nsec3_proof_cache_mask;
+}
+
+static inline bool
+nsec3_proof_cache_entry_covers(const nsec3_proof_cache_entry *entry, const u8 *digest)
+{
+    u32 len = digest[0];
+    
+    if(entry->interval_start[0] != len)
+    {
+        return FALSE;
+    }
+    
+    bool after_start = memcmp(&digest[1], &entry->interval_start[1], len) >= 0;
+    bool before_end = memcmp(&digest[1], &entry->interval_end[1], len) < 0;
+    
+    if(!entry->wraps)
+    {
+        return after_start && before_end;
+    }
+    else
+    {
+        /* last interval of the chain (or the only one) */
+        
+        return after_start || before_end;
+    }
+}
+
+static void
+nsec3_proof_cache_entry_free(void *ptr)
+{
+    free(ptr);
+}
+
+#define NSEC3_PROOF_CACHE_ALIGN(x_) (((x_) + 7) & ~7)
+
+/*
+ * API
+ */
+
+void
+nsec3_proof_cache_init(u32 slots)
+{
+    if(nsec3_proof_cache_slots != NULL)
+    {
+        return;
+    }
+    
+    if(slots == 0)
+    {
+        return;
+    }
+    
+    if(slots > NSEC3_PROOF_CACHE_SLOTS_MAX)
+    {
+        slots = NSEC3_PROOF_CACHE_SLOTS_MAX;
+    }
+    
+    u32 bits = 0;
+    
+    while((2U << bits) <= slots)
+    {
+        bits++;
+    }
+    
+    slots = 1U << bits;
+    
+    MALLOC_OR_DIE(nsec3_proof_cache_slot*, nsec3_proof_cache_slots, sizeof(nsec3_proof_cache_slot) * slots, NSEC3_PROOFCACHESLOTS_TAG);
+    memset(nsec3_proof_cache_slots, 0, sizeof(nsec3_proof_cache_slot) * slots);
+    
+    nsec3_proof_cache_mask = slots - 1;
+    nsec3_proof_cache_bits = bits;
+    
+    log_info("nsec3 proof cache: %u slots", slots);
+}
+
+void
+nsec3_proof_cache_finalize()
+{
+    if(nsec3_proof_cache_slots == NULL)
+    {
+        return;
+    }
+    
+    for(u32 i = 0; i <= nsec3_proof_cache_mask; i++)
+    {
+        free(nsec3_proof_cache_slots[i].entry);
+    }
+    
+    free(nsec3_proof_cache_slots);
+    nsec3_proof_cache_slots = NULL;
+    nsec3_proof_cache_mask = 0;
+    nsec3_proof_cache_bits = 0;
+}
+
+bool
+nsec3_proof_cache_enabled()
+{
+    return nsec3_proof_cache_slots != NULL;
+}
+
+u64
+nsec3_proof_cache_generation(const zdb_zone *zone)
+{
+    return (((u64)nsec3_proof_cache_zones_gen) << 32) | zone->proof_cache_generation;
+}
+
+void
+nsec3_proof_cache_invalidate(zdb_zone *zone)
+{
+    __sync_add_and_fetch(&zone->proof_cache_generation, 1);
+}
+
+void
+nsec3_proof_cache_invalidate_all()
+{
+    u32 gen = __sync_add_and_fetch(&nsec3_proof_cache_zones_gen, 1);
+    
+    if(gen == 0)
+    {
+        __sync_bool_compare_and_swap(&nsec3_proof_cache_zones_gen, 0, 1);
+    }
+}
+
+bool
+nsec3_proof_cache_get(const zdb_zone *zone, const zdb_rr_label *label, const u8 *next_closer_digest,
+                      u8 * const *out_owners,
+                      zdb_packed_ttlrdata **out_nsec3,
+                      zdb_packed_ttlrdata **out_nsec3_rrsig)
+{
+    const nsec3_proof_cache_entry *entry = nsec3_proof_cache_slots[nsec3_proof_cache_slot_index(label, next_closer_digest)].entry;
+    
+    if((entry == NULL) || (entry->zone != zone) || (entry->label != label) ||
+       (entry->generation != nsec3_proof_cache_generation(zone)) || !nsec3_proof_cache_entry_covers(entry, next_closer_digest))
+    {
+        return FALSE;
+    }
+    
+    for(u32 i = 0; i < NSEC3_PROOF_CACHE_RECORDS; i++)
+    {
+        const zdb_packed_ttlrdata *cached = entry->nsec3[i];
+        
+        if(cached != NULL)
+        {
+            /* the caller destroys the NSEC3 records of the answer */
+            
+            zdb_packed_ttlrdata *nsec3;
+            
+            ZDB_RECORD_MALLOC_EMPTY(nsec3, cached->ttl, cached->rdata_size);
+            nsec3->next = NULL;
+            MEMCOPY(nsec3->rdata_start, cached->rdata_start, cached->rdata_size);
+            
+            MEMCOPY(out_owners[i], entry->owners[i], dnsname_len(entry->owners[i]));
+            
+            out_nsec3[i] = nsec3;
+            out_nsec3_rrsig[i] = entry->nsec3_rrsig[i];
+        }
+        else
+        {
+            out_nsec3[i] = NULL;
+            out_nsec3_rrsig[i] = NULL;
+        }
+    }
+    
+    return TRUE;
+}
+
+void
+nsec3_proof_cache_put(u64 generation, const zdb_zone *zone, const zdb_rr_label *label, const u8 *next_closer_digest,
+                      const nsec3_zone_item *next_closer_nsec3,
+                      u8 * const *owners,
+                      zdb_packed_ttlrdata * const *nsec3,
+                      zdb_packed_ttlrdata * const *nsec3_rrsig)
+{
+    if(generation != nsec3_proof_cache_generation(zone))
+    {
+        return;
+    }
+    
+    nsec3_proof_cache_slot *slot = &nsec3_proof_cache_slots[nsec3_proof_cache_slot_index(label, next_closer_digest)];
+    
+    const nsec3_proof_cache_entry *current = slot->entry;
+    
+    if((current != NULL) && (current->generation == generation))
+    {
+        /*
+         * A valid proof is only evicted by one that missed twice in a row so
+         * that names spread over the whole chain do not keep replacing entries.
+         */
+        
+        u32 candidate = nsec3_proof_cache_label_hash(label) ^ (u32)(((intptr)next_closer_nsec3) >> 4);
+        
+        if(slot->candidate != candidate)
+        {
+            slot->candidate = candidate;
+            
+            return;
+        }
+    }
+    
+    u32 size = NSEC3_PROOF_CACHE_ALIGN(sizeof(nsec3_proof_cache_entry));
+    
+    for(u32 i = 0; i < NSEC3_PROOF_CACHE_RECORDS; i++)
+    {
+        if(nsec3[i] != NULL)
+        {
+            size += NSEC3_PROOF_CACHE_ALIGN(sizeof(zdb_packed_ttlrdata) - 1 + nsec3[i]->rdata_size);
+            size += dnsname_len(owners[i]);
+        }
+    }
+    
+    nsec3_proof_cache_entry *entry;
+    
+    MALLOC_OR_DIE(nsec3_proof_cache_entry*, entry, size, NSEC3_PROOFCACHEENTRY_TAG);
+    
+    u8 *p = (u8*)entry + NSEC3_PROOF_CACHE_ALIGN(sizeof(nsec3_proof_cache_entry));
+    
+    for(u32 i = 0; i < NSEC3_PROOF_CACHE_RECORDS; i++)
+    {
+        if(nsec3[i] != NULL)
+        {
+            u32 record_size = sizeof(zdb_packed_ttlrdata) - 1 + nsec3[i]->rdata_size;
+            
+            entry->nsec3[i] = (zdb_packed_ttlrdata*)p;
+            MEMCOPY(p, nsec3[i], record_size);
+            entry->nsec3[i]->next = NULL;
+            p += NSEC3_PROOF_CACHE_ALIGN(record_size);
+        }
+        else
+        {
+            entry->nsec3[i] = NULL;
+        }
+        
+        entry->nsec3_rrsig[i] = nsec3_rrsig[i];
+    }
+    
+    for(u32 i = 0; i < NSEC3_PROOF_CACHE_RECORDS; i++)
+    {
+        if(nsec3[i] != NULL)
+        {
+            u32 owner_len = dnsname_len(owners[i]);
+            
+            entry->owners[i] = p;
+            MEMCOPY(p, owners[i], owner_len);
+            p += owner_len;
+        }
+        else
+        {
+            entry->owners[i] = NULL;
+        }
+    }
+    
+    zassert(p <= (u8*)entry + size);
+    
+    const nsec3_zone_item *next = nsec3_avl_node_mod_next((nsec3_zone_item*)next_closer_nsec3);
+    
+    entry->zone = zone;
+    entry->label = label;
+    entry->generation = generation;
+    MEMCOPY(entry->interval_start, next_closer_nsec3->digest, next_closer_nsec3->digest[0] + 1);
+    MEMCOPY(entry->interval_end, next->digest, next->digest[0] + 1);
+    entry->wraps = memcmp(&entry->interval_start[1], &entry->interval_end[1], entry->interval_start[0]) >= 0;
+    
+    /* the entry is complete before it can be seen */
+    
+    __sync_synchronize();
+    
+    nsec3_proof_cache_entry *old = __sync_lock_test_and_set(&slot->entry, entry);
+    
+    if(old != NULL)
+    {
+        /* a reader may still be looking at it */
+        
+        zdb_epoch_defer(nsec3_proof_cache_entry_free, old);
+        
+        if((__sync_add_and_fetch(&nsec3_proof_cache_replaced, 1) & (NSEC3_PROOF_CACHE_RECLAIM_PERIOD - 1)) == 0)
+        {
+            zdb_epoch_reclaim_bounded();
+        }
+    }
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
@@ -44,6 +44,7 @@
  * USE INCLUDES */
 #include <stdio.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
 
 #include <dnscore/format.h>
 #include <dnscore/typebitmap.h>
@@ -135,10 +136,10 @@ nsec3_update_rrsig_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttl
                      */
 
                     *rrsig_recordp = rrsig_record->next;
-    #ifndef NDEBUG
+    #if !defined(NDEBUG) && (ZDB_EXPLICIT_READER_ZONE_LOCK != 2)
                     rrsig_record->next = (zdb_packed_ttlrdata*)~0;
     #endif
-                    ZDB_RECORD_ZFREE(rrsig_record);
+                    zdb_record_retire(rrsig_record);
 
                     /*
                      * I can stop here.
@@ -182,6 +183,8 @@ nsec3_update_rrsig_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttl
         log_debug("rrsig: adding: %{digest32h} %{typerdatadesc}", item->digest, &rdatadesc);
 #endif
 
+        rrsig_expiration_index_add_nsec3(&zone->sig_expiration, ntohl(GET_U32_AT(ZDB_PACKEDRECORD_PTR_RDATAPTR(sig)[8])));
+
         ZDB_RECORD_ZALLOC(rrsig_record, sig->ttl, ZDB_PACKEDRECORD_PTR_RDATASIZE(sig), ZDB_PACKEDRECORD_PTR_RDATAPTR(sig));
 
         rrsig_record->next = *rrsig_sllp;
@@ -289,6 +292,32 @@ bool nsec3_is_label_covered(zdb_rr_label *label, bool opt_out)
     return nsec3_covered;
 }
 
+/*
+ * The labels waiting for their NSEC3 digests
+ */
+
+#define NSEC3_UPDATE_BATCH_SIZE 64
+
+typedef struct nsec3_update_batch_entry nsec3_update_batch_entry;
+
+struct nsec3_update_batch_entry
+{
+    zdb_rr_label *label;
+    nsec3_label_extension *n3ext;   /* the extension of the chain being processed */
+    u32 name_len;
+    bool force_rrsig;
+    u8 digest[1 + MAX_DIGEST_LENGTH];
+    u8 name[2 + MAX_DOMAIN_LENGTH];
+};
+
+typedef struct nsec3_update_batch nsec3_update_batch;
+
+struct nsec3_update_batch
+{
+    u32 count;
+    nsec3_update_batch_entry entries[NSEC3_UPDATE_BATCH_SIZE];
+};
+
 typedef struct nsec3_update_zone_nsec3_nodes_recursive_args nsec3_update_zone_nsec3_nodes_recursive_args;
 
 struct nsec3_update_zone_nsec3_nodes_recursive_args
@@ -301,7 +330,11 @@ struct nsec3_update_zone_nsec3_nodes_recursive_args
     bool opt_out;
     zdb_rr_label *label_stack[128];
     u8 name[2 + MAX_DOMAIN_LENGTH];
-    u8 digest[1 + MAX_DIGEST_LENGTH];
+    
+    nsec3_update_batch *batch;
+    
+    nsec3_digest_hint_callback *digest_hint;
+    void *digest_hint_args;
     
     u32 internal_statistics_label_count;
     u32 internal_statistics_delegation_count;
@@ -310,6 +343,284 @@ struct nsec3_update_zone_nsec3_nodes_recursive_args
     type_bit_maps_context type_context;
 };
 
+/*
+ * Computes the digests of the batch for the chain of the current extensions of the entries.
+ * The labels already linked to an NSEC3 node (self or star) are skipped.
+ */
+
+static void
+nsec3_update_batch_digest(nsec3_update_batch *batch, nsec3_zone *n3, bool star, nsec3_digest_hint_callback *digest_hint, void *digest_hint_args)
+{
+    const u8 *names[NSEC3_UPDATE_BATCH_SIZE];
+    u32 name_lens[NSEC3_UPDATE_BATCH_SIZE];
+    u8 *digests[NSEC3_UPDATE_BATCH_SIZE];
+    u32 count = 0;
+    
+    u8 digest_len = nsec3_hash_len(NSEC3_ZONE_ALGORITHM(n3));
+
+    for(u32 i = 0; i < batch->count; i++)
+    {
+        nsec3_update_batch_entry *entry = &batch->entries[i];
+        
+        zassert(entry->n3ext != NULL); /* The label is supposed to be ready */
+        
+        if(((star)?entry->n3ext->star:entry->n3ext->self) != NULL)
+        {
+            continue;
+        }
+        
+        entry->digest[0] = digest_len;
+        
+        /*
+         * Unless it is already known, the digest of this fqdn is computed with the others
+         */
+        
+        if((digest_hint != NULL) && digest_hint(digest_hint_args, n3->rdata, entry->name, entry->name_len, entry->digest))
+        {
+            continue;
+        }
+        
+        names[count] = entry->name;
+        name_lens[count] = entry->name_len;
+        digests[count] = &entry->digest[1];
+        count++;
+    }
+    
+    if(count > 0)
+    {
+        nsec3_hash_get_batch_function(NSEC3_ZONE_ALGORITHM(n3))(
+                names,
+                name_lens,
+                count,
+                NSEC3_ZONE_SALT(n3),
+                NSEC3_ZONE_SALT_LEN(n3),
+                nsec3_zone_get_iterations(n3),
+                digests,
+                FALSE);
+    }
+}
+
+/*
+ * Makes the NSEC3 nodes of the labels in the batch, for each NSEC3PARAM
+ */
+
+static void
+nsec3_update_label_nsec3_nodes_flush(nsec3_update_zone_nsec3_nodes_recursive_args *commonargs)
+{
+    nsec3_update_batch *batch = commonargs->batch;
+    zdb_zone* zone = commonargs->zone;
+    type_bit_maps_context *type_context = &commonargs->type_context;
+    u8 nsec3_flags = commonargs->nsec3_flags;
+    u32 min_ttl = commonargs->min_ttl;
+    
+    for(u32 i = 0; i < batch->count; i++)
+    {
+        batch->entries[i].n3ext = batch->entries[i].label->nsec.nsec3;
+    }
+    
+    nsec3_zone* n3 = zone->nsec.nsec3;
+
+    /* For each NSEC3PARAM */        
+
+    do
+    {
+        nsec3_update_batch_digest(batch, n3, FALSE, commonargs->digest_hint, commonargs->digest_hint_args);
+        
+        for(u32 i = 0; i < batch->count; i++)
+        {
+            nsec3_update_batch_entry *entry = &batch->entries[i];
+            nsec3_label_extension* n3ext = entry->n3ext;
+            
+            entry->n3ext = n3ext->next;
+
+            /*
+             * If the NSEC3 extension has been set up already
+             */
+            
+            if(n3ext->self != NULL)
+            {
+#if NSEC3_UPDATE_ZONE_DEBUG!=0
+                log_debug("nsec3: done '%{dnsname}' %{digest32h} ", entry->name, n3ext->self->digest);
+#endif
+                continue;
+            }
+            
+            u8 *digest = entry->digest;
+
+            commonargs->internal_statistics_nsec3_count++;
+
+#if NSEC3_UPDATE_ZONE_DEBUG!=0
+            log_debug("nsec3: made '%{dnsname}' %{digest32h} ", entry->name, digest);
+#endif
+            /*
+                * DYNUPDATE:
+                *
+                * Seek for digest
+                *
+                * If the digest does not exists:
+                *	Get the predecessor.
+                *      If the predecessor is not marked:
+                *	    Mark the predecessor for future add and output it right now
+                *
+                */
+
+            /*
+                * Find the node with the computed digest
+                */
+
+            nsec3_zone_item* node;
+
+            node = nsec3_avl_find(&n3->items, digest);
+
+            if(node != NULL)
+            {
+                /*
+                    * If the node exists, get the previous node and mark it for incremental delete
+                    * ( I don't remember why I do this )
+                    */
+
+                nsec3_zone_item* node_prev = nsec3_avl_node_mod_prev(node);
+
+                if((node_prev->flags & NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD) == 0)
+                {
+                    zdb_listener_notify_remove_nsec3(node_prev, n3, min_ttl);
+                    node_prev->flags |= NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD;
+                }
+            }
+            else
+            {
+                /*
+                    * Insert the node for that digest and mark it for incremental add
+                    */
+
+                node = nsec3_avl_insert(&n3->items, digest);
+
+                node->flags |= NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD;
+            }
+
+            /*
+                * Sets the nsec3 -> owner label link
+                */
+
+            nsec3_add_owner(node, entry->label);
+
+            /*
+                * The self is edited later
+                */
+
+            node->flags |= nsec3_flags;
+
+            /*
+                * Update (or create) the bitmap of the types
+                */
+
+            u16 type_bit_maps_size = type_bit_maps_initialize(type_context, entry->label, FALSE, entry->force_rrsig);
+
+            if(node->type_bit_maps_size == 0)
+            {
+                /*
+                    * Create the bitmap
+                    */
+
+                node->type_bit_maps_size = type_bit_maps_size;
+
+                if(type_bit_maps_size > 0)
+                {
+                    /* LOCK */
+                    ZALLOC_ARRAY_OR_DIE(u8*, node->type_bit_maps, type_bit_maps_size, NSEC3_TYPEBITMAPS_TAG);
+                    /* UNLOCK */
+
+                    type_bit_maps_write(node->type_bit_maps, type_context);
+                }
+            }
+            else
+            {
+                /* Merge the existing bitmap with the new one */
+
+                u8* tmp_type_bit_maps;
+
+                /* LOCK */
+                ZALLOC_ARRAY_OR_DIE(u8*, tmp_type_bit_maps, type_bit_maps_size, NSEC3_TYPEBITMAPS_TAG);
+                /* UNLOCK */
+
+                type_bit_maps_write(tmp_type_bit_maps, type_context);
+
+                if(type_bit_maps_merge(type_context, node->type_bit_maps, node->type_bit_maps_size, tmp_type_bit_maps, type_bit_maps_size))
+                {
+                    /**
+                        * TRUE : a merge occurred
+                        * NOTE : this case never occurred while testing.  It has
+                        * to be triggered with a dynupdate or a wrong zone file.
+                        * @todo : factorize with "nsec3_add_label" (if possible ?)
+                        */
+
+                    /*
+                        * The node existed already but has now been changed.
+                        */
+
+                    /*
+                        * DYNUPDATE:
+                        *
+                        * The node will change.
+                        *
+                        * If the node is not marked
+                        *   Mark the node for future add and output it now
+                        *
+                        */
+
+                    if((node->flags & NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD) == 0)
+                    {
+                        zdb_listener_notify_remove_nsec3(node, n3, min_ttl);
+                        node->flags |= NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD;
+                    }
+
+                    type_bit_maps_size = type_context->type_bit_maps_size;
+
+                    /* LOCK */
+                    ZFREE_ARRAY(node->type_bit_maps, node->type_bit_maps_size);
+                    /* UNLOCK */
+
+                    if(type_bit_maps_size > 0)
+                    {
+                        /* LOCK */
+                        ZALLOC_ARRAY_OR_DIE(u8*, node->type_bit_maps, type_bit_maps_size, NSEC3_TYPEBITMAPS_TAG);
+                        /* UNLOCK */
+
+                        node->type_bit_maps_size = type_bit_maps_size;
+
+                        type_bit_maps_write(node->type_bit_maps, type_context);
+                    }
+                    /*
+                        * This case does not exist:  A merge of something of size > 0
+                        * with anything will always give a size > 0
+                        *
+                        * else
+                        * {
+                        *   node->type_bit_maps_size = 0;
+                        * }
+                        *
+                        */
+                }
+
+                /* LOCK */
+                ZFREE_ARRAY(tmp_type_bit_maps, type_bit_maps_size);
+                /* UNLOCK */
+            }
+
+            /* nsec3_set_label_extension */
+
+            zassert(node != NULL);
+
+            n3ext->self = node;
+        }
+
+        n3 = n3->next;
+    }
+    while(n3 != NULL);
+    
+    batch->count = 0;
+}
+
 static bool
 nsec3_update_label_nsec3_nodes_recursive(nsec3_update_zone_nsec3_nodes_recursive_args *commonargs)
 {
@@ -322,10 +633,6 @@ nsec3_update_label_nsec3_nodes_recursive(nsec3_update_zone_nsec3_nodes_recursive
     bool opt_in = !opt_out;
     zdb_rr_label **label_stack = &commonargs->label_stack[0];
     u8 *name = &commonargs->name[0];
-    u8 *digest = &commonargs->digest[0];
-    type_bit_maps_context *type_context = &commonargs->type_context;
-    u8 nsec3_flags = commonargs->nsec3_flags;
-    u32 min_ttl = commonargs->min_ttl;
     
     /* build the current name */
     
@@ -485,8 +792,6 @@ nsec3_update_label_nsec3_nodes_recursive(nsec3_update_zone_nsec3_nodes_recursive
      * This label can now be processed for NSEC3
      */
 
-    u16 type_bit_maps_size = type_bit_maps_initialize(type_context, label, FALSE, force_rrsig);
-
     nsec3_zone* n3 = zone->nsec.nsec3;
 
     nsec3_label_extension* n3ext = label->nsec.nsec3;
@@ -526,221 +831,24 @@ nsec3_update_label_nsec3_nodes_recursive(nsec3_update_zone_nsec3_nodes_recursive
 
         label->nsec.nsec3 = n3ext_first;
         label->flags |= ZDB_RR_LABEL_NSEC3;
-
-        n3ext = n3ext_first;
-
-        n3 = zone->nsec.nsec3;
     }
 
-    /* For each NSEC3PARAM */        
-
-    do
+    /*
+     * The NSEC3 nodes are made by batches so the digests can be computed together
+     */
+    
+    nsec3_update_batch *batch = commonargs->batch;
+    nsec3_update_batch_entry *entry = &batch->entries[batch->count++];
+    
+    entry->label = label;
+    entry->force_rrsig = force_rrsig;
+    entry->name_len = name_len;
+    memcpy(entry->name, name, name_len);
+    
+    if(batch->count == NSEC3_UPDATE_BATCH_SIZE)
     {
-        zassert(n3ext != NULL); /* The label is supposed to be ready */
-
-        /*
-            * If the NSEC3 extension has not been set up yet
-            */
-
-        if(n3ext->self == NULL)
-        {
-            /*
-                * Retrieve the NSEC3 hash algorithm size
-                */
-
-            digest[0] = nsec3_hash_len(NSEC3_ZONE_ALGORITHM(n3));
-
-            /*
-                * Retrieve the NSEC3 hash algorithm function and compute the digest for this fqdn
-                */
-
-            nsec3_hash_get_function(NSEC3_ZONE_ALGORITHM(n3))(
-                    name,
-                    name_len,
-                    NSEC3_ZONE_SALT(n3),
-                    NSEC3_ZONE_SALT_LEN(n3),
-                    nsec3_zone_get_iterations(n3),
-                    &digest[1],
-                    FALSE);
-
-            commonargs->internal_statistics_nsec3_count++;
-
-#if NSEC3_UPDATE_ZONE_DEBUG!=0
-            log_debug("nsec3: made '%{dnsname}' %{digest32h} ", name, digest);
-#endif
-            /*
-                * DYNUPDATE:
-                *
-                * Seek for digest
-                *
-                * If the digest does not exists:
-                *	Get the predecessor.
-                *      If the predecessor is not marked:
-                *	    Mark the predecessor for future add and output it right now
-                *
-                */
-
-            /*
-                * Find the node with the computed digest
-                */
-
-            nsec3_zone_item* node;
-
-            node = nsec3_avl_find(&n3->items, digest);
-
-            if(node != NULL)
-            {
-                /*
-                    * If the node exists, get the previous node and mark it for incremental delete
-                    * ( I don't remember why I do this )
-                    */
-
-                nsec3_zone_item* node_prev = nsec3_avl_node_mod_prev(node);
-
-                if((node_prev->flags & NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD) == 0)
-                {
-                    zdb_listener_notify_remove_nsec3(node_prev, n3, min_ttl);
-                    node_prev->flags |= NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD;
-                }
-            }
-            else
-            {
-                /*
-                    * Insert the node for that digest and mark it for incremental add
-                    */
-
-                node = nsec3_avl_insert(&n3->items, digest);
-
-                node->flags |= NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD;
-            }
-
-            /*
-                * Sets the nsec3 -> owner label link
-                */
-
-            nsec3_add_owner(node, label);
-
-            /*
-                * The self is edited later
-                */
-
-            node->flags |= nsec3_flags;
-
-            /*
-                * Update (or create) the bitmap of the types
-                */
-
-            if(node->type_bit_maps_size == 0)
-            {
-                /*
-                    * Create the bitmap
-                    */
-
-                node->type_bit_maps_size = type_bit_maps_size;
-
-                if(type_bit_maps_size > 0)
-                {
-                    /* LOCK */
-                    ZALLOC_ARRAY_OR_DIE(u8*, node->type_bit_maps, type_bit_maps_size, NSEC3_TYPEBITMAPS_TAG);
-                    /* UNLOCK */
-
-                    type_bit_maps_write(node->type_bit_maps, type_context);
-                }
-            }
-            else
-            {
-                /* Merge the existing bitmap with the new one */
-
-                u8* tmp_type_bit_maps;
-
-                /* LOCK */
-                ZALLOC_ARRAY_OR_DIE(u8*, tmp_type_bit_maps, type_bit_maps_size, NSEC3_TYPEBITMAPS_TAG);
-                /* UNLOCK */
-
-                type_bit_maps_write(tmp_type_bit_maps, type_context);
-
-                if(type_bit_maps_merge(type_context, node->type_bit_maps, node->type_bit_maps_size, tmp_type_bit_maps, type_bit_maps_size))
-                {
-                    /**
-                        * TRUE : a merge occurred
-                        * NOTE : this case never occurred while testing.  It has
-                        * to be triggered with a dynupdate or a wrong zone file.
-                        * @todo : factorize with "nsec3_add_label" (if possible ?)
-                        */
-
-                    /*
-                        * The node existed already but has now been changed.
-                        */
-
-                    /*
-                        * DYNUPDATE:
-                        *
-                        * The node will change.
-                        *
-                        * If the node is not marked
-                        *   Mark the node for future add and output it now
-                        *
-                        */
-
-                    if((node->flags & NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD) == 0)
-                    {
-                        zdb_listener_notify_remove_nsec3(node, n3, min_ttl);
-                        node->flags |= NSEC3_FLAGS_MARKED_FOR_ICMTL_ADD;
-                    }
-
-                    type_bit_maps_size = type_context->type_bit_maps_size;
-
-                    /* LOCK */
-                    ZFREE_ARRAY(node->type_bit_maps, node->type_bit_maps_size);
-                    /* UNLOCK */
-
-                    if(type_bit_maps_size > 0)
-                    {
-                        /* LOCK */
-                        ZALLOC_ARRAY_OR_DIE(u8*, node->type_bit_maps, type_bit_maps_size, NSEC3_TYPEBITMAPS_TAG);
-                        /* UNLOCK */
-
-                        node->type_bit_maps_size = type_bit_maps_size;
-
-                        type_bit_maps_write(node->type_bit_maps, type_context);
-                    }
-                    /*
-                        * This case does not exist:  A merge of something of size > 0
-                        * with anything will always give a size > 0
-                        *
-                        * else
-                        * {
-                        *   node->type_bit_maps_size = 0;
-                        * }
-                        *
-                        */
-                }
-
-                /* LOCK */
-                ZFREE_ARRAY(tmp_type_bit_maps, type_bit_maps_size);
-                /* UNLOCK */
-            }
-
-            /* nsec3_set_label_extension */
-
-            zassert(node != NULL);
-
-            n3ext->self = node;
-            n3ext = n3ext->next;
-
-        }
-#if NSEC3_UPDATE_ZONE_DEBUG!=0
-        else
-        {
-            MEMCOPY(&digest[1], &n3ext->self->digest[1], n3ext->self->digest[0]);
-
-            log_debug("nsec3: done '%{dnsname}' %{digest32h} ", name, digest);
-        }
-#endif
-
-        n3 = n3->next;
+        nsec3_update_label_nsec3_nodes_flush(commonargs);
     }
-    while(n3 != NULL);
     
 #if NSEC3_UPDATE_ZONE_DEBUG != 0
     log_debug("nsec3_update_label_nsec3_nodes_recursive(%3d, %{dnsname}) : NSEC3", label_stack_level, debug_name);
@@ -750,7 +858,7 @@ nsec3_update_label_nsec3_nodes_recursive(nsec3_update_zone_nsec3_nodes_recursive
 }
 
 static void
-nsec3_update_zone_nsec3_nodes_recursive(zdb_zone *zone, bool opt_out)
+nsec3_update_zone_nsec3_nodes_recursive(zdb_zone *zone, bool opt_out, nsec3_update_batch *batch, nsec3_digest_hint_callback *digest_hint, void *digest_hint_args)
 {
     nsec3_update_zone_nsec3_nodes_recursive_args commonargs;
       
@@ -763,9 +871,19 @@ nsec3_update_zone_nsec3_nodes_recursive(zdb_zone *zone, bool opt_out)
     zdb_zone_getminttl(zone, &commonargs.min_ttl);
     commonargs.opt_out = opt_out;
     commonargs.nsec3_flags = (opt_out)?1:0;
+    commonargs.digest_hint = digest_hint;
+    commonargs.digest_hint_args = digest_hint_args;
+    commonargs.batch = batch;
+    
+    batch->count = 0;
     
     nsec3_update_label_nsec3_nodes_recursive(&commonargs);
     
+    if(batch->count > 0)
+    {
+        nsec3_update_label_nsec3_nodes_flush(&commonargs);
+    }
+    
     log_debug("nsec3: parsed %u labels, seen %u delegations, made %u NSEC3 records",
               commonargs.internal_statistics_label_count,
               commonargs.internal_statistics_delegation_count,
@@ -780,6 +898,18 @@ nsec3_update_zone_nsec3_nodes_recursive(zdb_zone *zone, bool opt_out)
 
 ya_result
 nsec3_update_zone(zdb_zone* zone)
+{
+    return nsec3_update_zone_with_hint(zone, NULL, NULL);
+}
+
+/**
+ * Updates ALL the NSEC3 records for ALL the labels, and this for ALL the NSEC3PARAM of the zone.
+ * The digests known by the hint (ie: because the zone has been loaded from a snapshot) are not computed.
+ *
+ */
+
+ya_result
+nsec3_update_zone_with_hint(zdb_zone* zone, nsec3_digest_hint_callback *digest_hint, void *digest_hint_args)
 {
     /**
      * @todo : check if the zone is NSEC or NSEC3
@@ -808,8 +938,6 @@ nsec3_update_zone(zdb_zone* zone)
     
     zdb_zone_getminttl(zone, &min_ttl);
 
-    u8 name[2 + MAX_DOMAIN_LENGTH];
-
 #if NSEC3_UPDATE_ZONE_DEBUG!=0
     log_debug("nsec3: zone '%{dnsname}'", zone->origin);
 #endif
@@ -819,10 +947,10 @@ nsec3_update_zone(zdb_zone* zone)
      * These ones must be handled differently than the ones in the zone.
      */
 
-    u8 digest[1 + MAX_DIGEST_LENGTH];
-
 #if NSEC3_INCLUDE_ZONE_PATH != 0
 
+    u8 digest[1 + MAX_DIGEST_LENGTH];
+
     u8* zone_path = zone->origin;
     zone_path += (*zone_path) + 1;
 
@@ -882,7 +1010,11 @@ nsec3_update_zone(zdb_zone* zone)
     
     zdb_zone_label_iterator label_iterator;
   
-    nsec3_update_zone_nsec3_nodes_recursive(zone, opt_out);
+    nsec3_update_batch *batch;
+    
+    MALLOC_OR_DIE(nsec3_update_batch*, batch, sizeof(nsec3_update_batch), NSEC3_UPDATEBATCH_TAG);
+  
+    nsec3_update_zone_nsec3_nodes_recursive(zone, opt_out, batch, digest_hint, digest_hint_args);
 
     /**
      * NSEC3 nodes have been removed (ixfr) as soon as it was required
@@ -930,82 +1062,104 @@ nsec3_update_zone(zdb_zone* zone)
 
     /*
      * In order to avoid computing the *.fqdn digest when needed, we do it here and store it for later
+     * The digests are computed by batches of labels.
      */
-
-    name[0] = 1;
-    name[1] = '*';
     
-    //zdb_zone_label_iterator label_iterator;
+    batch->count = 0;
 
     zdb_zone_label_iterator_init(zone, &label_iterator);
 
-    while(zdb_zone_label_iterator_hasnext(&label_iterator))
+    for(;;)
     {
-        u32 name_len = zdb_zone_label_iterator_nextname(&label_iterator, &name[2]) + 2;
+        bool hasnext = zdb_zone_label_iterator_hasnext(&label_iterator);
+        
+        if(hasnext)
+        {
+            nsec3_update_batch_entry *entry = &batch->entries[batch->count];
+            
+            entry->name[0] = 1;
+            entry->name[1] = '*';
+            
+            u32 name_len = zdb_zone_label_iterator_nextname(&label_iterator, &entry->name[2]) + 2;
 
 #if NSEC3_UPDATE_ZONE_DEBUG!=0
-        log_debug("nsec3: wild '%{dnsname}'", name);
+            log_debug("nsec3: wild '%{dnsname}'", entry->name);
 #endif
 
-        zdb_rr_label* label = zdb_zone_label_iterator_next(&label_iterator);
+            zdb_rr_label* label = zdb_zone_label_iterator_next(&label_iterator);
 
-        if(label->nsec.nsec3 == NULL || label->nsec.nsec3->star != NULL)
-        {
-            /*
-             * Already done.
-             */
+            if(label->nsec.nsec3 == NULL || label->nsec.nsec3->star != NULL)
+            {
+                /*
+                 * Already done.
+                 */
 
 #if NSEC3_UPDATE_ZONE_DEBUG!=0
-            log_debug("nsec3: wild '%{dnsname}' already set", name);
+                log_debug("nsec3: wild '%{dnsname}' already set", entry->name);
 #endif
-            continue;
+                continue;
+            }
+            
+            entry->label = label;
+            entry->n3ext = label->nsec.nsec3;
+            entry->name_len = name_len;
+            
+            if(++batch->count < NSEC3_UPDATE_BATCH_SIZE)
+            {
+                continue;
+            }
         }
-
-        nsec3_zone* n3 = zone->nsec.nsec3;
-
-        nsec3_label_extension* n3ext = label->nsec.nsec3;
-
-        do
+        
+        if(batch->count > 0)
         {
-            zassert(n3ext != NULL);
-
-            /* Compute the digest */
+            nsec3_zone* n3 = zone->nsec.nsec3;
             
-            digest[0] = nsec3_hash_len(NSEC3_ZONE_ALGORITHM(n3));
-
-            nsec3_hash_get_function(NSEC3_ZONE_ALGORITHM(n3))(
-                    name,
-                    name_len,
-                    NSEC3_ZONE_SALT(n3),
-                    NSEC3_ZONE_SALT_LEN(n3),
-                    nsec3_zone_get_iterations(n3),
-                    &digest[1],
-                    FALSE);
-
-            //log_debug("nsec3_update_zone: \"precalc\" node: %{digest32h} NSEC3 ; %{dnsname}", digest, name);
+            do
+            {
+                /* Compute the digests (the hint gives the ones of the interval starts) */
+                
+                nsec3_update_batch_digest(batch, n3, TRUE, digest_hint, digest_hint_args);
+                
+                for(u32 i = 0; i < batch->count; i++)
+                {
+                    nsec3_update_batch_entry *entry = &batch->entries[i];
+                    nsec3_label_extension* n3ext = entry->n3ext;
+                    
+                    zassert(n3ext != NULL);
+                    
+                    //log_debug("nsec3_update_zone: \"precalc\" node: %{digest32h} NSEC3 ; %{dnsname}", entry->digest, entry->name);
 
 #if NSEC3_UPDATE_ZONE_DEBUG!=0
-            log_debug("nsec3: wild '%{dnsname}' %{digest32h} ", name, digest);
+                    log_debug("nsec3: wild '%{dnsname}' %{digest32h} ", entry->name, entry->digest);
 #endif
-            nsec3_zone_item* node = nsec3_avl_find_interval_start(&n3->items, digest);
+                    nsec3_zone_item* node = nsec3_avl_find_interval_start(&n3->items, entry->digest);
 
 #if NSEC3_UPDATE_ZONE_DEBUG!=0
-            log_debug("nsec3: *. => %{digest32h} ", node->digest);
+                    log_debug("nsec3: *. => %{digest32h} ", node->digest);
 #endif
 
-            nsec3_add_star(node, label);
+                    nsec3_add_star(node, entry->label);
 
-            zassert(n3ext->star == NULL);
+                    zassert(n3ext->star == NULL);
 
-            n3ext->star = node;
-            n3ext = n3ext->next;
+                    n3ext->star = node;
+                    entry->n3ext = n3ext->next;
+                }
 
-            n3 = n3->next;
+                n3 = n3->next;
+            }
+            while(n3 != NULL);
+            
+            batch->count = 0;
+        }
+        
+        if(!hasnext)
+        {
+            break;
         }
-        while(n3 != NULL);
-
-        zassert(n3ext == NULL);
     }
+    
+    free(batch);
 
     /** @todo: SCHEDULE a signature for all NSEC3 of the zone */
 
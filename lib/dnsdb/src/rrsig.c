@@ -48,6 +48,7 @@
 #include <arpa/inet.h>
 #include <openssl/sha.h>
 #include <openssl/engine.h>
+#include <openssl/objects.h>
 
 #include <dnscore/sys_types.h>
 #include <dnscore/logger.h>
@@ -68,6 +69,11 @@
 
 #define MODULE_MSG_HANDLE g_dnssec_logger
 
+#define RRSIG_OUTPUT_ARENA_TAG	0x414e524154554f52	/* ROUTARNA */
+#define RRSIG_UPDATE_BATCH_TAG	0x4843544250554752	/* RGUPBTCH */
+
+#define RRSIG_DIGEST_MAXIMUM_LENGTH SHA384_DIGEST_LENGTH
+
 /* EDF: Don't ZALLOC */
 
 #define ALLOW_ZALLOC 0
@@ -407,8 +413,39 @@ rrsig_update_context_set_key(rrsig_context* context, dnssec_key* key)
     context->rrsig_header_length = dnsname_canonize(key->owner_name, &context->rrsig_header[RRSIG_RDATA_HEADER_LEN]) + RRSIG_RDATA_HEADER_LEN;
 }
 
+/*
+ * The digest of the signature depends on the algorithm of the key (key->nid)
+ */
+
+typedef union rrsig_digest_ctx rrsig_digest_ctx;
+
+union rrsig_digest_ctx
+{
+    SHA_CTX sha1;
+    SHA256_CTX sha256;
+    SHA512_CTX sha384;
+};
+
 static void
-rrsig_compute_digest(u8 * restrict rrsig_header,
+rrsig_digest_update(int nid, rrsig_digest_ctx *ctx, const void *data, size_t len)
+{
+    switch(nid)
+    {
+        case NID_sha256:
+            SHA256_Update(&ctx->sha256, data, len);
+            break;
+        case NID_sha384:
+            SHA384_Update(&ctx->sha384, data, len);
+            break;
+        default:
+            SHA1_Update(&ctx->sha1, data, len);
+            break;
+    }
+}
+
+static u32
+rrsig_compute_digest(int nid,
+                     u8 * restrict rrsig_header,
                      u32 rrsig_header_length,
                      u8 * restrict record_header_label_type_class_ttl,
                      u32 record_header_label_type_class_ttl_length,
@@ -416,15 +453,29 @@ rrsig_compute_digest(u8 * restrict rrsig_header,
                      u8 * restrict digest_out)
 {
     /**
-     * Only supported digest is SHA1 because we do RSA-SHA1 or DSA-SHA1
-     * @todo: Other digests ... later
+     * SHA1 for RSA-SHA1 & DSA-SHA1, SHA256 & SHA384 for ECDSA P-256 & P-384
      */
 
     assert( (offsetof(zdb_canonized_packed_ttlrdata, rdata_start) - offsetof(zdb_canonized_packed_ttlrdata, rdata_canonized_size)) == 2  );
 
-    SHA_CTX sha1;
+    rrsig_digest_ctx ctx;
+    u32 digest_len;
 
-    SHA1_Init(&sha1);
+    switch(nid)
+    {
+        case NID_sha256:
+            SHA256_Init(&ctx.sha256);
+            digest_len = SHA256_DIGEST_LENGTH;
+            break;
+        case NID_sha384:
+            SHA384_Init(&ctx.sha384);
+            digest_len = SHA384_DIGEST_LENGTH;
+            break;
+        default:
+            SHA1_Init(&ctx.sha1);
+            digest_len = SHA_DIGEST_LENGTH;
+            break;
+    }
 
     /*
      * Add the rrsig (except the signature) to the digest.
@@ -448,7 +499,7 @@ rrsig_compute_digest(u8 * restrict rrsig_header,
      * Type covered | algorithm | labels | original_ttl | exp | inception | tag | origin
      *
      */
-    SHA1_Update(&sha1, rrsig_header, rrsig_header_length);
+    rrsig_digest_update(nid, &ctx, rrsig_header, rrsig_header_length);
 
     /* For EACH rr, canonization-order :
      *
@@ -493,7 +544,7 @@ rrsig_compute_digest(u8 * restrict rrsig_header,
         log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, record_header_label_type_class_ttl, record_header_label_type_class_ttl_length, 32, TRUE, TRUE);
 #endif
 
-        SHA1_Update(&sha1, record_header_label_type_class_ttl, record_header_label_type_class_ttl_length);
+        rrsig_digest_update(nid, &ctx, record_header_label_type_class_ttl, record_header_label_type_class_ttl_length);
 
         /*
          * ttl
@@ -503,7 +554,7 @@ rrsig_compute_digest(u8 * restrict rrsig_header,
         log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, &rrsig_header[4], 4, 32, TRUE, TRUE);
 #endif
 
-        SHA1_Update(&sha1, &rrsig_header[4], 4);
+        rrsig_digest_update(nid, &ctx, &rrsig_header[4], 4);
 
         /*
          * rdata+ , canonical order
@@ -512,7 +563,7 @@ rrsig_compute_digest(u8 * restrict rrsig_header,
 #if RRSIG_DUMP>=2
         log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, &rdata->rdata_canonized_size, rdata->rdata_size + 2, 32, TRUE, TRUE);
 #endif
-        SHA1_Update(&sha1, &rdata->rdata_canonized_size, rdata->rdata_size + 2);
+        rrsig_digest_update(nid, &ctx, &rdata->rdata_canonized_size, rdata->rdata_size + 2);
 
         /* I used to free the rdata here.  I cannot do this anymore since
          * the digest could be recomputed with slight variations
@@ -525,20 +576,70 @@ rrsig_compute_digest(u8 * restrict rrsig_header,
      * Retrieve the digest
      */
 
-    SHA1_Final(digest_out, &sha1);
+    switch(nid)
+    {
+        case NID_sha256:
+            SHA256_Final(digest_out, &ctx.sha256);
+            break;
+        case NID_sha384:
+            SHA384_Final(digest_out, &ctx.sha384);
+            break;
+        default:
+            SHA1_Final(digest_out, &ctx.sha1);
+            break;
+    }
 
 #if RRSIG_DUMP!=0
     log_debug5("rrsig: digest:");
-    log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, digest_out, SHA_DIGEST_LENGTH, 32, TRUE, FALSE);
+    log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, digest_out, digest_len, 32, TRUE, FALSE);
 #endif
+
+    return digest_len;
+}
+
+/**
+ * Allocates a signature record for the added/removed lists.
+ * Uses the output arena of the context if any, else MALLOC.
+ */
+
+static zdb_packed_ttlrdata*
+rrsig_output_alloc(rrsig_context* context, u32 size)
+{
+    zdb_packed_ttlrdata* record;
+
+    if(context->output_arenap == NULL)
+    {
+        MALLOC_OR_DIE(zdb_packed_ttlrdata*, record, size, RRSIG_TTLRDATA_TAG);
+
+        return record;
+    }
+
+    size = (size + 7) & ~7;
+
+    rrsig_output_arena* arena = *context->output_arenap;
+
+    if((arena == NULL) || (arena->used + size > arena->size))
+    {
+        u32 arena_size = MAX(size, RRSIG_OUTPUT_ARENA_SIZE);
+
+        MALLOC_OR_DIE(rrsig_output_arena*, arena, sizeof(rrsig_output_arena) + arena_size, RRSIG_OUTPUT_ARENA_TAG);
+
+        arena->next = *context->output_arenap;
+        arena->used = 0;
+        arena->size = arena_size;
+        *context->output_arenap = arena;
+    }
+
+    record = (zdb_packed_ttlrdata*)&((u8*)&arena[1])[arena->used];
+    arena->used += size;
+
+    return record;
 }
 
 static void
 rrsig_schedule_delete_signature(rrsig_context* context, zdb_packed_ttlrdata* rrsig)
 {
-    zdb_packed_ttlrdata* rrsig_clone;
-
-    MALLOC_OR_DIE(zdb_packed_ttlrdata*, rrsig_clone, ZDB_RECORD_SIZE(rrsig), RRSIG_TTLRDATA_TAG);
+    zdb_packed_ttlrdata* rrsig_clone = rrsig_output_alloc(context, ZDB_RECORD_SIZE(rrsig));
 
     rrsig_clone->ttl = rrsig->ttl;
     rrsig_clone->rdata_size = rrsig->rdata_size;
@@ -551,7 +652,7 @@ rrsig_schedule_delete_signature(rrsig_context* context, zdb_packed_ttlrdata* rrs
 static bool
 rrsig_verify_signature(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrdata* rrsig)
 {
-    u8 digest[SHA_DIGEST_LENGTH];
+    u8 digest[RRSIG_DIGEST_MAXIMUM_LENGTH];
 
     u8* rrsig_name = &rrsig->rdata_start[RRSIG_RDATA_HEADER_LEN];
 
@@ -599,7 +700,8 @@ rrsig_verify_signature(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrd
          * The length of the
          */
         u32 rrsig_start_len = RRSIG_RDATA_HEADER_LEN + context->origin_len;
-        rrsig_compute_digest(rrsig->rdata_start,
+        u32 digest_len = rrsig_compute_digest(key->nid,
+                             rrsig->rdata_start,
                              rrsig_start_len,
                              context->record_header_label_type_class_ttl,
                              context->record_header_label_type_class_ttl_length,
@@ -615,7 +717,7 @@ rrsig_verify_signature(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrd
         log_debug5("rrsig: signature to verify:");
         log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, signature, signature_len, 32, TRUE, TRUE);
         log_debug5("rrsig: verifying digest:");
-        log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, digest, SHA_DIGEST_LENGTH, 32, TRUE, TRUE);
+        log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, digest, digest_len, 32, TRUE, TRUE);
 #endif
 
         /**
@@ -623,7 +725,7 @@ rrsig_verify_signature(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrd
          *        And said digest only needs to be verified if it comes from a zone file or dynupdate
          */
 
-        if(key->vtbl->dnssec_key_verify_digest(key, digest, SHA_DIGEST_LENGTH, signature, signature_len))
+        if(key->vtbl->dnssec_key_verify_digest(key, digest, digest_len, signature, signature_len))
         {
 #if RRSIG_DUMP!=0
             log_debug5("rrsig: verify: -- OK");
@@ -663,7 +765,7 @@ rrsig_verify_signature(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrd
 ya_result
 rrsig_update_records(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrdata* rr_sll, u16 type, bool do_update)
 {
-    u8 digest[SHA_DIGEST_LENGTH];
+    u8 digest[RRSIG_DIGEST_MAXIMUM_LENGTH];
 
     do_update &= key->is_private;
 
@@ -832,7 +934,8 @@ rrsig_update_records(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrdat
         log_debug5("rrsig: create: computing digest");
 #endif
 
-        rrsig_compute_digest(context->rrsig_header,
+        u32 digest_len = rrsig_compute_digest(key->nid,
+                             context->rrsig_header,
                              context->rrsig_header_length,
                              context->record_header_label_type_class_ttl,
                              context->record_header_label_type_class_ttl_length,
@@ -843,13 +946,13 @@ rrsig_update_records(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrdat
 
 #if RRSIG_DUMP>2
         log_debug5("rrsig: signing digest:");
-        log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, digest, SHA_DIGEST_LENGTH, 32, TRUE, TRUE);
+        log_memdump(MODULE_MSG_HANDLE, MSG_DEBUG5, digest, digest_len, 32, TRUE, TRUE);
 #endif
 
         u32 signature_len;
         u8 signature[DNSSEC_MAXIMUM_KEY_SIZE_BYTES];
 
-        signature_len = key->vtbl->dnssec_key_sign_digest(key, digest, SHA_DIGEST_LENGTH, signature);
+        signature_len = key->vtbl->dnssec_key_sign_digest(key, digest, digest_len, signature);
 
         zassert(signature_len > 0);
 
@@ -861,7 +964,9 @@ rrsig_update_records(rrsig_context* context, dnssec_key* key, zdb_packed_ttlrdat
         log_debug5("<< ------------------------------------------------------------------------");
 #endif
 
-        ZDB_RECORD_MALLOC_EMPTY(rrsig, context->original_ttl, context->rrsig_header_length + signature_len);
+        rrsig = rrsig_output_alloc(context, sizeof(zdb_packed_ttlrdata) - 1 + context->rrsig_header_length + signature_len);
+        rrsig->ttl = context->original_ttl;
+        rrsig->rdata_size = context->rrsig_header_length + signature_len;
 
         /* Copy the header */
 
@@ -1170,12 +1275,11 @@ rrsig_update_label(rrsig_context* context, zdb_rr_label* label, bool delegation)
 
 /**
  * Takes the result of an update and commits it to the label
- *
- * @todo Have an alternative function using the scheduler.
+ * If release is TRUE, the records of both lists are freed.
  */
 
-void
-rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata* added_rrsig_sll, zdb_rr_label* label, zdb_zone* zone, dnsname_stack* name)
+static void
+rrsig_update_commit_sll(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata* added_rrsig_sll, zdb_rr_label* label, zdb_zone* zone, dnsname_stack* name, bool release)
 {
     /*
      * NOTE: This is the only place where I can access the zone signature invalidation update properly
@@ -1257,10 +1361,10 @@ rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata*
                 {
                     /* remove it from the chain */
                     *rrsig_recordp = rrsig_record->next;
-#ifndef NDEBUG
+#if !defined(NDEBUG) && (ZDB_EXPLICIT_READER_ZONE_LOCK != 2)
                     rrsig_record->next = (zdb_packed_ttlrdata*)~0;
 #endif
-                    ZDB_RECORD_ZFREE(rrsig_record);
+                    zdb_record_retire(rrsig_record);
                     
                     warning = FALSE;
 
@@ -1284,7 +1388,11 @@ rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata*
 
         zdb_packed_ttlrdata* tmp = sig;
         sig = sig->next;
-        free(tmp);
+
+        if(release)
+        {
+            free(tmp);
+        }
     }
 
     /*
@@ -1298,6 +1406,8 @@ rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata*
 
     sig = added_rrsig_sll;
 
+    u32 added_valid_until = MAX_U32;
+
     while(sig != NULL)
     {
         zdb_packed_ttlrdata* rrsig_record;
@@ -1305,6 +1415,8 @@ rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata*
         u8* rdata = ZDB_PACKEDRECORD_PTR_RDATAPTR(sig);
         u32 rdata_size = ZDB_PACKEDRECORD_PTR_RDATASIZE(sig);
 
+        added_valid_until = MIN(ntohl(GET_U32_AT(rdata[8])), added_valid_until);
+
 #ifndef NDEBUG
         rdata_desc rdatadesc={TYPE_RRSIG, rdata_size, rdata};
         log_debug5("rrsig: updating: adding: %{dnsnamestack} %{typerdatadesc}", name, &rdatadesc);
@@ -1347,7 +1459,21 @@ rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata*
 
         zdb_packed_ttlrdata* tmp = sig;
         sig = sig->next;
-        free(tmp);
+
+        if(release)
+        {
+            free(tmp);
+        }
+    }
+
+    /* Keep track of the label for the incremental signature maintenance */
+
+    if((added_valid_until != MAX_U32) && rrsig_expiration_index_enabled())
+    {
+        u8 fqdn[MAX_DOMAIN_LENGTH];
+
+        dnsname_stack_to_dnsname(name, fqdn);
+        rrsig_expiration_index_add(&zone->sig_expiration, fqdn, added_valid_until);
     }
 
 #ifndef NDEBUG
@@ -1390,6 +1516,98 @@ rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata*
     }
 }
 
+/**
+ * Takes the result of an update and commits it to the label
+ *
+ * @todo Have an alternative function using the scheduler.
+ */
+
+void
+rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_packed_ttlrdata* added_rrsig_sll, zdb_rr_label* label, zdb_zone* zone, dnsname_stack* name)
+{
+    rrsig_update_commit_sll(removed_rrsig_sll, added_rrsig_sll, label, zone, name, TRUE);
+}
+
+rrsig_update_batch*
+rrsig_update_batch_new(zdb_zone* zone)
+{
+    rrsig_update_batch* batch;
+
+    MALLOC_OR_DIE(rrsig_update_batch*, batch, sizeof(rrsig_update_batch), RRSIG_UPDATE_BATCH_TAG);
+
+    batch->zone = zone;
+    batch->arena = NULL;
+    batch->count = 0;
+    batch->path_count = 0;
+
+    return batch;
+}
+
+bool
+rrsig_update_batch_full(const rrsig_update_batch* batch, const dnsname_stack* path)
+{
+    return (batch->count == RRSIG_UPDATE_BATCH_SIZE) || (batch->path_count + path->size + 1 > RRSIG_UPDATE_BATCH_PATH_SIZE);
+}
+
+void
+rrsig_update_batch_add(rrsig_update_batch* batch, zdb_rr_label* label, const dnsname_stack* path, bool delegation)
+{
+    zassert(!rrsig_update_batch_full(batch, path));
+
+    rrsig_update_query* query = &batch->queries[batch->count++];
+
+    query->label = label;
+    query->added_rrsig_sll = NULL;
+    query->removed_rrsig_sll = NULL;
+    query->path_offset = batch->path_count;
+    query->path_size = path->size;
+    query->delegation = delegation;
+
+    MEMCOPY(&batch->path[batch->path_count], &path->labels[0], (path->size + 1) * sizeof (u8*));
+    batch->path_count += path->size + 1;
+}
+
+void
+rrsig_update_batch_get_path(const rrsig_update_batch* batch, const rrsig_update_query* query, dnsname_stack* path)
+{
+    MEMCOPY(&path->labels[0], &batch->path[query->path_offset], (query->path_size + 1) * sizeof (u8*));
+    path->size = query->path_size;
+}
+
+void
+rrsig_update_batch_commit(rrsig_update_batch* batch)
+{
+    dnsname_stack path;
+
+    for(u32 i = 0; i < batch->count; i++)
+    {
+        rrsig_update_query* query = &batch->queries[i];
+
+        rrsig_update_batch_get_path(batch, query, &path);
+
+        rrsig_update_commit_sll(query->removed_rrsig_sll, query->added_rrsig_sll, query->label, batch->zone, &path, FALSE);
+    }
+}
+
+void
+rrsig_update_batch_free(rrsig_update_batch* batch)
+{
+    rrsig_output_arena* arena = batch->arena;
+
+    while(arena != NULL)
+    {
+        rrsig_output_arena* next = arena->next;
+        free(arena);
+        arena = next;
+    }
+
+#ifndef NDEBUG
+    memset(batch, 0xfe, sizeof(rrsig_update_batch));
+#endif
+
+    free(batch);
+}
+
 zdb_packed_ttlrdata*
 rrsig_find(const zdb_rr_label* label, u16 type)
 {
@@ -1474,7 +1692,7 @@ rrsig_delete(const u8 *dname, zdb_rr_label* label, u16 type)
             {
                 *prev = rrsig->next; /* More than one RRSIG: unchain and delete */
 
-                ZDB_RECORD_ZFREE(rrsig);                
+                zdb_record_retire(rrsig);
                 rrsig = *prev;
                 
                 if(rrsig == NULL)
@@ -0,0 +1,246 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup rrsig RRSIG functions
+ *  @ingroup dnsdbdnssec
+ *  @brief Index of the signature expirations of a zone
+ *
+ *  Each bucket is a vector of names.  Consecutive additions of the same name
+ *  (all the signatures of a label) are merged.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dnscore/dnscore.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/ptr_vector.h>
+
+#include "dnsdb/rrsig_expiration.h"
+
+#define RRSIGEXB_TAG 0x4258454749535252 /* RRSIGEXB */
+
+typedef struct rrsig_expiration_bucket rrsig_expiration_bucket;
+
+struct rrsig_expiration_bucket
+{
+    ptr_vector names;
+};
+
+static bool rrsig_expiration_index_is_enabled = FALSE;
+
+void
+rrsig_expiration_index_enable(bool enable)
+{
+    rrsig_expiration_index_is_enabled = enable;
+}
+
+bool
+rrsig_expiration_index_enabled()
+{
+    return rrsig_expiration_index_is_enabled;
+}
+
+void
+rrsig_expiration_index_init(rrsig_expiration_index* index)
+{
+    avl_init(&index->buckets);
+    mutex_init(&index->mutex);
+    index->count = 0;
+    index->nsec3_invalid_first = MAX_U32;
+}
+
+static void
+rrsig_expiration_bucket_free(void* data)
+{
+    rrsig_expiration_bucket* bucket = (rrsig_expiration_bucket*)data;
+
+    for(s32 i = 0; i <= bucket->names.offset; i++)
+    {
+        free(bucket->names.data[i]);
+    }
+
+    ptr_vector_destroy(&bucket->names);
+    free(bucket);
+}
+
+void
+rrsig_expiration_index_destroy(rrsig_expiration_index* index)
+{
+    avl_callback_and_destroy(index->buckets, rrsig_expiration_bucket_free);
+    avl_init(&index->buckets);
+    index->count = 0;
+    mutex_destroy(&index->mutex);
+}
+
+void
+rrsig_expiration_index_add(rrsig_expiration_index* index, const u8* fqdn, u32 valid_until)
+{
+    if(!rrsig_expiration_index_is_enabled)
+    {
+        return;
+    }
+
+    hashcode key = valid_until / RRSIG_EXPIRATION_BUCKET_SECONDS;
+
+    mutex_lock(&index->mutex);
+
+    void** bucketp = avl_insert(&index->buckets, key);
+    rrsig_expiration_bucket* bucket = (rrsig_expiration_bucket*)*bucketp;
+
+    if(bucket == NULL)
+    {
+        MALLOC_OR_DIE(rrsig_expiration_bucket*, bucket, sizeof(rrsig_expiration_bucket), RRSIGEXB_TAG);
+        ptr_vector_init(&bucket->names);
+        *bucketp = bucket;
+    }
+    else if((bucket->names.offset >= 0) && dnsname_equals((u8*)bucket->names.data[bucket->names.offset], fqdn))
+    {
+        /* same label, another signature */
+
+        mutex_unlock(&index->mutex);
+
+        return;
+    }
+
+    ptr_vector_append(&bucket->names, dnsname_dup(fqdn));
+    index->count++;
+
+    mutex_unlock(&index->mutex);
+}
+
+void
+rrsig_expiration_index_add_nsec3(rrsig_expiration_index* index, u32 valid_until)
+{
+    mutex_lock(&index->mutex);
+    index->nsec3_invalid_first = MIN(index->nsec3_invalid_first, valid_until);
+    mutex_unlock(&index->mutex);
+}
+
+void
+rrsig_expiration_index_clear_nsec3(rrsig_expiration_index* index)
+{
+    mutex_lock(&index->mutex);
+    index->nsec3_invalid_first = MAX_U32;
+    mutex_unlock(&index->mutex);
+}
+
+bool
+rrsig_expiration_index_pop(rrsig_expiration_index* index, u32 until, u8* fqdn)
+{
+    hashcode until_key = until / RRSIG_EXPIRATION_BUCKET_SECONDS;
+
+    mutex_lock(&index->mutex);
+
+    for(;;)
+    {
+        avl_iterator iter;
+        avl_iterator_init(index->buckets, &iter);
+
+        if(!avl_iterator_hasnext(&iter))
+        {
+            break;
+        }
+
+        avl_node* node = avl_iterator_next_node(&iter);
+
+        /* only buckets entirely in the window : all their signatures will be regenerated */
+
+        if(node->hash >= until_key)
+        {
+            break;
+        }
+
+        rrsig_expiration_bucket* bucket = (rrsig_expiration_bucket*)node->data;
+
+        if(bucket->names.offset >= 0)
+        {
+            u8* name = (u8*)bucket->names.data[bucket->names.offset--];
+            dnsname_copy(fqdn, name);
+            free(name);
+            index->count--;
+
+            mutex_unlock(&index->mutex);
+
+            return TRUE;
+        }
+
+        /* the bucket is empty : drop it and look at the next one */
+
+        avl_delete(&index->buckets, node->hash);
+        ptr_vector_destroy(&bucket->names);
+        free(bucket);
+    }
+
+    mutex_unlock(&index->mutex);
+
+    return FALSE;
+}
+
+u32
+rrsig_expiration_index_first(rrsig_expiration_index* index)
+{
+    u32 first;
+
+    mutex_lock(&index->mutex);
+
+    first = index->nsec3_invalid_first;
+
+    avl_iterator iter;
+    avl_iterator_init(index->buckets, &iter);
+
+    while(avl_iterator_hasnext(&iter))
+    {
+        avl_node* node = avl_iterator_next_node(&iter);
+        rrsig_expiration_bucket* bucket = (rrsig_expiration_bucket*)node->data;
+
+        if(bucket->names.offset >= 0)
+        {
+            first = MIN(first, (node->hash + 1) * RRSIG_EXPIRATION_BUCKET_SECONDS);
+            break;
+        }
+    }
+
+    mutex_unlock(&index->mutex);
+
+    return first;
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
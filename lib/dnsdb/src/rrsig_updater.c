@@ -112,9 +112,9 @@ rrsig_updater_thread(void* context_)
         log_debug("rrsig_updater_thread(%i): dequeue (WAIT)", id);
 #endif
 
-        rrsig_update_query* query = (rrsig_update_query*)threaded_queue_dequeue(dnssec_task_query_queue);
+        rrsig_update_batch* batch = (rrsig_update_batch*)threaded_queue_dequeue(dnssec_task_query_queue);
 
-        if(query == NULL)
+        if(batch == NULL)
         {
             /* From this point I should not use the context anymore */
 
@@ -124,43 +124,57 @@ rrsig_updater_thread(void* context_)
             break;
         }
 
+        /*
+         * All the signatures of the batch go to its arena.
+         * The queries with something to commit are kept at the front of the batch.
+         */
+
+        context->sig_context.output_arenap = &batch->arena;
+
+        u32 results = 0;
+
+        for(u32 i = 0; i < batch->count; i++)
+        {
+            rrsig_update_query* query = &batch->queries[i];
+
 #if DNSSEC_DEBUGLEVEL>3
-        { /* DEBUG */
-            char label[MAX_DOMAIN_LENGTH + 1];
-            dnsname_stack_to_cstr(&query->path, label);
-            log_debug("rrsig_updater_thread(): processing records for '%s'", label);
-        }
+            { /* DEBUG */
+                dnsname_stack path;
+                rrsig_update_batch_get_path(batch, query, &path);
+                log_debug("rrsig_updater_thread(): processing records for '%{dnsnamestack}'", &path);
+            }
 #endif
 
-        /**
-         * The path to the label to sign is in the query.
-         * @todo: use the path from the query :
-         *
-         * rrsig_update_context_add_label
-         * rrsig_update_context_remove_label
-         *
-         */
+            rrsig_update_context_push_label(&context->sig_context, query->label);
+            rrsig_update_label(&context->sig_context, query->label, query->delegation);
 
-#ifndef NDEBUG
-        zassert(query->added_rrsig_sll != ((zdb_packed_ttlrdata*)0xfefefefefefefefe));
-#endif
+            /*
+             * Retrieve the old signatures (to be deleted)
+             * Retrieve the new signatures (to be added)
+             */
 
-        rrsig_update_context_push_label(&context->sig_context, query->label);
-        rrsig_update_label(&context->sig_context, query->label, query->delegation);
+            query->added_rrsig_sll = context->sig_context.added_rrsig_sll;
+            query->removed_rrsig_sll = context->sig_context.removed_rrsig_sll;
 
-        /*
-         * Retrieve the old signatures (to be deleted)
-         * Retrieve the new signatures (to be added)
-         *
-         * This has to be injected as an answer query.
-         */
+            rrsig_update_context_pop_label(&context->sig_context);
 
-        query->added_rrsig_sll = context->sig_context.added_rrsig_sll;
-        query->removed_rrsig_sll = context->sig_context.removed_rrsig_sll;
+            if(query->added_rrsig_sll != NULL || query->removed_rrsig_sll != NULL)
+            {
+                if(results != i)
+                {
+                    batch->queries[results] = *query;
+                }
 
-        rrsig_update_context_pop_label(&context->sig_context);
+                results++;
+            }
+        }
+
+        context->sig_context.output_arenap = NULL;
+        context->job_count += batch->count;
+
+        batch->count = results;
 
-        /* All the signatures for this set have been computer.  Queue the result. */
+        /* All the signatures for this batch have been computed.  Queue the result. */
 
         /*******************************************************************
          * QUEUE THE ANSWER
@@ -170,20 +184,13 @@ rrsig_updater_thread(void* context_)
         log_debug("rrsig_updater_thread(%i): enqueue (RESULT)", id);
 #endif
 
-#ifndef NDEBUG
-        if(query != NULL)
+        if(results > 0)
         {
-            zassert(query->added_rrsig_sll != ((zdb_packed_ttlrdata*)0xfefefefefefefefe));
-        }
-#endif
-
-        if(query->added_rrsig_sll != NULL || query->removed_rrsig_sll != NULL)
-        {
-            threaded_queue_enqueue(dnssec_task_answer_queue, query);
+            threaded_queue_enqueue(dnssec_task_answer_queue, batch);
         }
         else
         {
-            free(query);
+            rrsig_update_batch_free(batch);
         }
 
 #if DNSSEC_DEBUGLEVEL>1
@@ -235,9 +242,9 @@ rrsig_updater_result_process(threaded_queue* dnssec_answer_query_queue, bool sch
         log_debug("dnssec_updater_result_thread(): loop #%i", count);
 #endif
 
-        rrsig_update_query* task = (rrsig_update_query*)threaded_queue_dequeue(dnssec_answer_query_queue);
+        rrsig_update_batch* batch = (rrsig_update_batch*)threaded_queue_dequeue(dnssec_answer_query_queue);
 
-        if(task == NULL)
+        if(batch == NULL)
         {
             /* Terminating ... */
 
@@ -248,30 +255,21 @@ rrsig_updater_result_process(threaded_queue* dnssec_answer_query_queue, bool sch
         }
 
 #if DNSSEC_DEBUGLEVEL>3
-        { /* DEBUG */
-            char label[MAX_DOMAIN_LENGTH + 1];
-            dnsname_stack_to_cstr(&task->path, label);
-            log_debug("dnssec_updater_result_thread() : retrieving results for %s", label);
-        }
+        log_debug("dnssec_updater_result_thread() : retrieving results for %u labels", batch->count);
 #endif
 
         if(schedule)
         {
            /**
-            * The "task" structure will be destroyed at the end of the scheduled task
+            * The "batch" structure will be destroyed at the end of the scheduled task
             */
-            scheduler_task_rrsig_update_commit(task->removed_rrsig_sll, task->added_rrsig_sll, task->label, task->zone, &task->path, task);
 
+            scheduler_task_rrsig_update_batch_commit(batch);
         }
         else
         {
-            rrsig_update_commit(task->removed_rrsig_sll, task->added_rrsig_sll, task->label, task->zone, &task->path);
-
-#ifndef NDEBUG
-            memset(task, 0xfe, sizeof(rrsig_update_query));
-#endif
-
-            free(task);
+            rrsig_update_batch_commit(batch);
+            rrsig_update_batch_free(batch);
         }
 
 #if DNSSEC_DUMPSIGNCOUNT!=0
@@ -349,7 +347,8 @@ dnssec_task_descriptor dnssec_updater_task_descriptor = {
     rrsig_updater_finalize,
     rrsig_updater_thread,
     rrsig_updater_result_thread,
-    "RRSIG updater"
+    "RRSIG updater",
+    RRSIG_UPDATE_BATCH_QUEUE_SIZE
 };
 
 dnssec_task_descriptor dnssec_updater_task_descriptor_scheduled = {
@@ -357,7 +356,8 @@ dnssec_task_descriptor dnssec_updater_task_descriptor_scheduled = {
     rrsig_updater_finalize,
     rrsig_updater_thread,
     rrsig_updater_result_thread_scheduled,
-    "RRSIG scheduled updater"
+    "RRSIG scheduled updater",
+    RRSIG_UPDATE_BATCH_QUEUE_SIZE
 };
 
 /** @} */
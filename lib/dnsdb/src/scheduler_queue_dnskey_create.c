@@ -110,9 +110,9 @@ scheduler_queue_dnskey_create_thread(void* data_)
 
     dnsname_to_cstr(origin, data->zone->origin);
 
-    dnssec_key* key;
+    dnssec_key* key = NULL;
     
-    if(ISOK(return_value = dnssec_key_createnew(DNSKEY_ALGORITHM_RSASHA1_NSEC3, data->size, data->flags, origin, &key)))
+    if(ISOK(return_value = dnssec_key_createnew(data->algorithm, data->size, data->flags, origin, &key)))
     {
         if(ISOK(return_value = dnssec_key_store_private(key)))
         {
@@ -165,6 +165,20 @@ scheduler_queue_dnskey_create(zdb_zone* zone, u16 flags, u8 algorithm, u16 size)
 
     scheduler_dnskey_create* data;
 
+    switch(algorithm)
+    {
+        case DNSKEY_ALGORITHM_RSASHA1:
+        case DNSKEY_ALGORITHM_RSASHA1_NSEC3:
+        case DNSKEY_ALGORITHM_ECDSAP256SHA256:  /* the size is implied, 0 or 256 */
+        case DNSKEY_ALGORITHM_ECDSAP384SHA384:  /* the size is implied, 0 or 384 */
+            break;
+        default:
+        {
+            log_err("dnssec: key creation %{dnsname} %hd %hhd %hd: %r", zone->origin, flags, algorithm, size, DNSSEC_ERROR_UNSUPPORTEDKEYALGORITHM);
+            return;
+        }
+    }
+
     log_info("dnssec: queueing key creation %{dnsname} %hd %hhd %hd", zone->origin, flags, algorithm, size);
 
     MALLOC_OR_DIE(scheduler_dnskey_create*, data, sizeof (scheduler_dnskey_create), GENERIC_TAG);
@@ -56,6 +56,7 @@
 
 #include <dnscore/scheduler.h>
 #include "dnsdb/zdb_zone_write.h"
+#include "dnsdb/zdb_zone_snapshot.h"
 
 #define MODULE_MSG_HANDLE g_database_logger
 
@@ -72,6 +73,8 @@ extern logger_handle* g_database_logger;
 #define ZONE_FORMAT "%s/%{dnsname}-zone.txt"	/* requires path and origin */
 #define ZONE_TMP_SUFFIX ".$y$"
 
+static bool scheduler_queue_zone_write_snapshot = FALSE;
+
 typedef struct zone_write_param zone_write_param;
 
 struct zone_write_param
@@ -115,6 +118,34 @@ scheduler_queue_zone_write_callback(void* data_)
     return SCHEDULER_TASK_FINISHED; /* Mark the end of the writer job */
 }
 
+/**
+ * Writes the snapshot of the zone next to its text file.
+ * The snapshot is tied to the text file (size & time) that has just been written.
+ */
+
+static void
+scheduler_queue_zone_write_snapshot_file(zdb_zone *zone, const char *text_file_path, const char *file_path)
+{
+    struct stat text_stat;
+    char snapshot_path[MAX_PATH];
+    
+    if(FAIL(snformat(snapshot_path, sizeof(snapshot_path), "%s%s", file_path, ZDB_ZONE_SNAPSHOT_SUFFIX)))
+    {
+        log_err("zone write snapshot: path '%s%s' is too big", file_path, ZDB_ZONE_SNAPSHOT_SUFFIX);
+        
+        return;
+    }
+    
+    if(stat(text_file_path, &text_stat) < 0)
+    {
+        log_err("zone write snapshot: cannot stat '%s': %r", text_file_path, ERRNO_ERROR);
+        
+        return;
+    }
+    
+    zdb_zone_write_snapshot_file(zone, snapshot_path, text_stat.st_size, text_stat.st_mtime);
+}
+
 static void*
 scheduler_queue_zone_write_thread(void* data_)
 {
@@ -184,6 +215,12 @@ scheduler_queue_zone_write_thread(void* data_)
     
     zdb_zone_lock(zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
     zdb_zone_write_text_file(zone, fullname_tmp, FALSE);
+    
+    if(scheduler_queue_zone_write_snapshot)
+    {
+        scheduler_queue_zone_write_snapshot_file(zone, fullname_tmp, zwp->file_path);
+    }
+    
     zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
       
     log_info("zone write text: renaming '%s' to '%s'", fullname_tmp, zwp->file_path);
@@ -226,6 +263,13 @@ scheduler_queue_zone_write(zdb_zone* zone, const char* path, callback_function *
 
     return SUCCESS;
 }
+
+void
+scheduler_queue_zone_write_set_snapshot(bool enabled)
+{
+    scheduler_queue_zone_write_snapshot = enabled;
+}
+
 /** @} */
 
 /*----------------------------------------------------------------------------*/
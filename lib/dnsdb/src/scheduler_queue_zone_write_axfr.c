@@ -63,6 +63,7 @@
 
 #include "dnsdb/zdb_zone.h"
 #include "dnsdb/zdb_types.h"
+#include "dnsdb/zdb_zone_axfr_input_stream.h"
 
 #define MODULE_MSG_HANDLE g_database_logger
 
@@ -130,6 +131,10 @@ extern logger_handle* g_database_logger;
 #define MAX_PATH 4096
 #endif
 
+/* The AXFR answers are streamed from the zone unless this is set (then they go through a file in the xfr directory) */
+
+static bool scheduler_queue_zone_axfr_file_cache = FALSE;
+
 typedef struct scheduler_queue_zone_write_axfr_args scheduler_queue_zone_write_axfr_args;
 
 struct scheduler_queue_zone_write_axfr_args
@@ -250,6 +255,45 @@ scheduler_queue_zone_write_axfr_callback(void* data_)
     return SCHEDULER_TASK_FINISHED; /* Notify the end of the writer job */
 }
 
+/*
+ * Answers the AXFR query in mesg with a SERVFAIL, then closes its socket and releases it.
+ */
+
+static void
+scheduler_queue_zone_write_axfr_servfail(message_data *mesg)
+{
+    if(mesg == NULL)
+    {
+        /* the image is only being stored */
+        
+        return;
+    }
+    
+    if(mesg->sockfd >= 0)
+    {
+        message_make_error(mesg, RCODE_SERVFAIL);
+        
+        if(TSIG_ENABLED(mesg))
+        {
+            tsig_sign_answer(mesg);
+        }
+        
+        message_update_tcp_length(mesg);
+        
+        if(writefully(mesg->sockfd, mesg->buffer_tcp_len, mesg->send_length + 2) != mesg->send_length + 2)
+        {
+            log_err("zone write axfr: could not send the error: %r", ERRNO_ERROR);
+        }
+        
+        close_ex(mesg->sockfd);
+    }
+    
+    free(mesg);
+}
+
+static void scheduler_queue_zone_write_axfr_send(message_data *mesg, int tcpfd, input_stream *fis_, const u8 *origin, u32 serial,
+                                                 u32 packet_size_limit, u32 packet_records_limit, bool compress_dname_rdata);
+
 static void*
 scheduler_queue_zone_write_axfr_thread(void* data_)
 {
@@ -272,26 +316,20 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
  
         scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data); /** @todo: Check I must release the lock */
 
-        close_ex(mesg->sockfd);
-       
-        free(mesg);
+        scheduler_queue_zone_write_axfr_servfail(mesg);
 
         return NULL;
     }
 
     if(FAIL(zdb_zone_getserial(data->zone, &serial)))
     {
-        /** @todo error other than "does not exists" : SERVFAIL */
-
         log_err("zone write axfr: no SOA in %{dnsname}", data->zone->origin);
 
         zdb_zone_unlock(data->zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
 
         scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data); /** @todo: Check I must release the lock */
 
-        close_ex(mesg->sockfd);
-       
-        free(mesg);
+        scheduler_queue_zone_write_axfr_servfail(mesg);
 
         return NULL;
     }
@@ -304,8 +342,7 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
 
         scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data); /** @todo: Check I must release the lock */
 
-        close_ex(mesg->sockfd);       
-        free(mesg);
+        scheduler_queue_zone_write_axfr_servfail(mesg);
 
         return NULL;
     }
@@ -322,8 +359,7 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
 
         /* WARNING: From this point forward, 'data' cannot be used anymore */
 
-        close_ex(mesg->sockfd);
-        free(mesg);
+        scheduler_queue_zone_write_axfr_servfail(mesg);
         return NULL;
     }
 
@@ -331,8 +367,6 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
     {
         if(errno != ENOENT)
         {
-            /** @todo error other than "does not exists" : SERVFAIL */
-
             data->return_code = ERRNO_ERROR;
             
             log_err("zone write axfr: error accessing '%s': %r", path, data->return_code);
@@ -341,8 +375,7 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
 
             /* WARNING: From this point forward, 'data' cannot be used anymore */
 
-            close_ex(mesg->sockfd);
-            free(mesg);
+            scheduler_queue_zone_write_axfr_servfail(mesg);
             return NULL;
         }
 
@@ -362,14 +395,11 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
             log_err("zone write axfr: file create error for '" AXFR_FORMAT "': %r",
                     data_path, data->zone->origin, serial, data->return_code);
 
-            /** @todo cannot create error : SERVFAIL ? */
-
             scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data); /* TODO: Check I must release the lock */
 
             /* WARNING: From this point forward, 'data' cannot be used anymore */
 
-            close_ex(mesg->sockfd);
-            free(mesg);
+            scheduler_queue_zone_write_axfr_servfail(mesg);
             return NULL;
         }
 
@@ -396,22 +426,17 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
         {
             log_err("zone write axfr: write error %r for '" AXFR_FORMAT "'", data->return_code, data_path, data->zone->origin, serial);
 
-            /** @todo cannot create error : SERVFAIL */
-
             scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data); /* TODO: Check I must release the lock */
 
             /* WARNING: From this point forward, 'data' cannot be used anymore */
 
-            close_ex(mesg->sockfd);
-            free(mesg);
+            scheduler_queue_zone_write_axfr_servfail(mesg);
             
             return NULL;
         }
 
         if(rename(pathpart, path) < 0)
         {
-            /** @todo cannot rename error : SERVFAIL */
-
             data->return_code = MAKE_ERRNO_ERROR(errno);
             log_err("zone write axfr: error renaming '%s' into '%s': %r", pathpart, path, data->return_code);
 
@@ -419,12 +444,22 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
 
             /* WARNING: From this point forward, 'data' cannot be used anymore */
 
-            close_ex(mesg->sockfd);
-            free(mesg);
+            scheduler_queue_zone_write_axfr_servfail(mesg);
             return NULL;
         }
     }
 
+    if(mesg == NULL)
+    {
+        /* the image was only to be stored */
+
+        scheduler_queue_zone_write_axfr_clean_older(data_path, data->zone->origin, serial);
+
+        scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data);
+
+        return NULL;
+    }
+
     u32 packet_size_limit = data->packet_size_limit;
 
     if(packet_size_limit < UDPPACKET_MAX_LENGTH)
@@ -462,17 +497,14 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
 
     if(FAIL(ret = file_input_stream_open(path, &fis)))
     {
-        /** @todo cannot open error : SERVFAIL */
-
-        close_ex(tcpfd);
-
         log_err("zone write axfr: error opening '%s': %r", path, ret);
 
         scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data);
 
         /* WARNING: From this point forward, 'data' cannot be used anymore */
 
-        free(mesg);
+        mesg->sockfd = tcpfd;
+        scheduler_queue_zone_write_axfr_servfail(mesg);
         return NULL;
     }
 
@@ -502,13 +534,33 @@ scheduler_queue_zone_write_axfr_thread(void* data_)
         return NULL;
     }
 
+    buffer_input_stream_init(&fis, &fis, FILE_BUFFER_SIZE);
+
+    scheduler_queue_zone_write_axfr_send(mesg, tcpfd, &fis, origin, serial, packet_size_limit, packet_records_limit, compress_dname_rdata);
+
+    return NULL;
+}
+
+/*
+ * Answers the AXFR query in mesg by sending, on tcpfd, the records read from
+ * the AXFR image in fis_.
+ * Closes the streams and releases mesg.
+ */
+
+static void
+scheduler_queue_zone_write_axfr_send(message_data *mesg, int tcpfd, input_stream *fis_, const u8 *origin, u32 serial,
+                                     u32 packet_size_limit, u32 packet_records_limit, bool compress_dname_rdata)
+{
+    char path[MAX_PATH]; /* used as a buffer */
+    input_stream fis = *fis_;
+    ya_result ret;
+
     log_info("zone write axfr: sending AXFR %{dnsname} %d", origin, serial);
 
     output_stream tcpos;
 
     fd_output_stream_attach(tcpfd, &tcpos);
 
-    buffer_input_stream_init(&fis, &fis, FILE_BUFFER_SIZE);
     buffer_output_stream_init(&tcpos, &tcpos, TCP_BUFFER_SIZE);
 
     MESSAGE_HIFLAGS(mesg->buffer) |= AA_BITS|QR_BITS;
@@ -906,7 +958,54 @@ scheduler_queue_zone_write_axfr_thread_exit:
     input_stream_close(&fis);
 
     free(mesg);
+}
+
+/*
+ * Answers an AXFR with the records read from the zone while they are sent.
+ * The writers are not held (see zdb_zone_axfr_input_stream.h)
+ */
+
+static void*
+scheduler_queue_zone_send_axfr_stream_thread(void* data_)
+{
+    scheduler_queue_zone_write_axfr_args* data = (scheduler_queue_zone_write_axfr_args*)data_;
+    message_data *mesg = data->mesg;
+    input_stream is;
+    u32 serial = 0;
+    u8 origin[MAX_DOMAIN_LENGTH];
+    
+    dnsname_copy(origin, data->zone->origin);
+
+    if(FAIL(data->return_code = zdb_zone_axfr_input_stream_open(data->zone, &is, &serial)))
+    {
+        log_err("zone send axfr: %{dnsname}: %r", origin, data->return_code);
+ 
+        scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data);
 
+        scheduler_queue_zone_write_axfr_servfail(mesg);
+
+        return NULL;
+    }
+    
+    u32 packet_size_limit = MAX(data->packet_size_limit, UDPPACKET_MAX_LENGTH);
+    u32 packet_records_limit = (data->packet_records_limit != 0)?data->packet_records_limit:0xffffffff; /* 0 means no limit */
+    bool compress_dname_rdata = data->compress_dname_rdata;
+    
+    mesg->size_limit = 32768;
+
+    int tcpfd = mesg->sockfd;
+    mesg->sockfd = -1;
+    
+    /* Sends the "Write unlocked" notification */
+    
+    scheduler_schedule_task(scheduler_queue_zone_write_axfr_callback, data);
+
+    /* WARNING: From this point forward, 'data' cannot be used anymore */
+
+    data = NULL;
+    
+    scheduler_queue_zone_write_axfr_send(mesg, tcpfd, &is, origin, serial, packet_size_limit, packet_records_limit, compress_dname_rdata);
+    
     return NULL;
 }
 
@@ -956,7 +1055,21 @@ scheduler_queue_zone_send_axfr(zdb_zone* zone, const char* directory, u32 packet
     args->packet_size_limit = packet_size_limit;
     args->packet_records_limit = packet_records_limit;
     args->compress_dname_rdata = compress_dname_rdata;
-    scheduler_schedule_thread(NULL, scheduler_queue_zone_write_axfr_thread, args, "scheduler_queue_zone_send_axfr");
+    
+    if(scheduler_queue_zone_axfr_file_cache)
+    {
+        scheduler_schedule_thread(NULL, scheduler_queue_zone_write_axfr_thread, args, "scheduler_queue_zone_send_axfr");
+    }
+    else
+    {
+        scheduler_schedule_thread(NULL, scheduler_queue_zone_send_axfr_stream_thread, args, "scheduler_queue_zone_send_axfr");
+    }
+}
+
+void
+scheduler_queue_zone_send_axfr_set_file_cache(bool enabled)
+{
+    scheduler_queue_zone_axfr_file_cache = enabled;
 }
 
 /** @} */
@@ -48,6 +48,7 @@
 #include <dirent.h>
 
 #include <dnscore/logger.h>
+#include <dnscore/fdtools.h>
 #include <dnscore/thread_pool.h>
 #include <dnscore/file_output_stream.h>
 #include <dnscore/file_input_stream.h>
@@ -66,6 +67,7 @@
 
 #include "dnsdb/zdb_zone.h"
 #include "dnsdb/zdb_types.h"
+#include "dnsdb/zdb_zone_ixfr_image.h"
 
 /* dnssec_scheduler.h */
 
@@ -73,16 +75,6 @@ void      scheduler_queue_zone_send_axfr(zdb_zone *zone, const char *directory,
 
 #define MODULE_MSG_HANDLE g_database_logger
 
-#define TCP_BUFFER_SIZE     4096
-#define FILE_BUFFER_SIZE    4096
-
-#define RECORD_MODE_DELETE  0
-#define RECORD_MODE_ADD     1
-
-/*
- * Typically it goes 4 3 [2,1]+ 0
- */
-
 extern logger_handle* g_database_logger;
 
 #ifndef MAX_PATH
@@ -117,101 +109,11 @@ scheduler_queue_zone_write_ixfr_callback(void* data_)
     return SCHEDULER_TASK_FINISHED; /* Notify the end of the writer job */
 }
 
-static ya_result
-scheduler_queue_zone_write_ixfr_read_record(input_stream *is, u8 *qname, u32 *qname_sizep, struct type_class_ttl_rdlen *tctrlp, u8 *rdata_buffer, u32 *rdata_sizep)
-{
-    ya_result return_code;
-
-    /* Read the next DNAME from the stored INCREMENTAL */
-
-    if(FAIL(return_code = input_stream_read_dnsname(is, qname)))
-    {
-        log_err("zone write ixfr: error reading IXFR qname: %r", return_code);
-        return return_code;
-    }
-
-    *qname_sizep = return_code;
-
-    if(return_code > 0)
-    {
-        /* read the next type+class+ttl+rdatalen from the stored IXFR */
-
-        tctrlp->qtype = 0;
-        tctrlp->rdlen = 0;
-
-        if(FAIL(return_code = input_stream_read_fully(is, (u8*) tctrlp, 10)))
-        {
-            log_err("zone write ixfr: error reading IXFR record: %r", return_code);
-
-            return return_code;
-        }
-
-        if(FAIL(return_code = input_stream_read_fully(is, rdata_buffer, ntohs(tctrlp->rdlen))))
-        {
-            log_err("zone write ixfr: error reading IXFR record rdata: %r", return_code);
-
-            return return_code;
-        }
-
-        *rdata_sizep = return_code;
-
-        return_code = *qname_sizep + 10 + *rdata_sizep;
-    }
-
-    return return_code;
-}
-
-/*
- * mesg is needed for TSIG
- */
-
-static ya_result
-scheduler_queue_zone_write_ixfr_send_message(output_stream *tcpos, packet_writer *pw, message_data *mesg, tsig_tcp_message_position pos)
-{
-    ya_result return_code;
-    
-    /*
-     * Flush and stop
-     */
-
-#ifndef NDEBUG
-    log_debug("zone write ixfr: sending message for %{dnsname}", mesg->qname);
-#endif
-
-    mesg->send_length = pw->packet_offset; /** @todo: I need to put this in a packet_writer function */
-
-    if(TSIG_ENABLED(mesg))
-    {
-        mesg->ar_start = &pw->packet[pw->packet_offset];
-
-        if(FAIL(return_code = tsig_sign_tcp_message(mesg, pos)))
-        {
-            log_err("zone write ixfr: failed to sign the answer: %r", return_code);
-
-            return return_code;
-        }
-    }
-
-    pw->packet_offset = mesg->send_length; /** @todo: I need to put this in a packet_writer function */
-    if(FAIL(return_code = write_tcp_packet(pw, tcpos)))
-    {
-        log_err("zone write ixfr: error sending IXFR packet: %r", return_code);
-    }
-
-    return return_code;
-}
-
 /*
- * IXFR is much more complicated than AXFR
- * 
- * There are many annoying cases.
- * 
- * We need to handle multiple incremental files (in sequence)
- * 
- * What about an update close to the limit of the file size ?
- * 
- * There is an easy way but it's far from optimal.
+ * The answer is built once per delta (zdb_zone_ixfr_image) and every slave
+ * asking for the same delta is answered from it.
  * 
+ * If the journal does not cover the serial of the slave, an AXFR is sent.
  */
 
 static void*
@@ -220,17 +122,9 @@ scheduler_queue_zone_write_ixfr_thread(void* data_)
     scheduler_queue_zone_write_ixfr_args* data = (scheduler_queue_zone_write_ixfr_args*)data_;
     message_data *mesg = data->mesg;
 
-    /* The TCP output stream */
-
-    output_stream tcpos;
+    /* The answer */
 
-    /* The incremental file input stream */
-
-    input_stream fis;
-    
-    /* The packet writer */
-
-    packet_writer pw;
+    zdb_zone_ixfr_image *image;
 
     /* Current SOA */
 
@@ -238,42 +132,18 @@ scheduler_queue_zone_write_ixfr_thread(void* data_)
     u32 current_soa_rdata_size;
     u8 current_soa_rdata_buffer[780];
 
-    /*
-     */
-
-    u8 *rdata_buffer = NULL;
-    struct type_class_ttl_rdlen tctrl;
-    u32 qname_size;
-    u32 rdata_size;
-    u8 fqdn[MAX_DOMAIN_LENGTH];
-
     /*
      */
 
     ya_result return_code;
 
     u32 serial = 0;
-    u16 an_record_count = 0;
-    u8  record_mode;
-    
-    u32 packet_size_limit;
-    u32 packet_size_trigger;
-
-    tsig_tcp_message_position pos = TSIG_START;
-
-    /*
-     */
-
-    u32 last_valid_serial;
-    u32 last_valid_offset;
-    u16 last_valid_count;
 
     /*
      * relevant data for when data is not usable anymore
      */
 
     u8 origin[MAX_DOMAIN_LENGTH];
-    char directory[MAX_PATH];
 
     /*
      */
@@ -328,7 +198,6 @@ scheduler_queue_zone_write_ixfr_thread(void* data_)
     /*
      * Adjust the message received size
      * get the queried serial number
-     * Set the answer bit and clean the NS count
      */
 
     packet_unpack_reader_data purd;
@@ -354,11 +223,6 @@ scheduler_queue_zone_write_ixfr_thread(void* data_)
     packet_reader_read(&purd, (u8*)&serial, 4);
     serial=ntohl(serial);
 
-    MESSAGE_HIFLAGS(mesg->buffer) |= AA_BITS|QR_BITS;
-    MESSAGE_NS(mesg->buffer) = 0;
-
-    MALLOC_OR_DIE(u8*, rdata_buffer, RDATA_MAX_LENGTH, GENERIC_TAG);    /* rdata max size */
-
     /***********************************************************************/
     
     char data_path[1024];
@@ -367,66 +231,41 @@ scheduler_queue_zone_write_ixfr_thread(void* data_)
     {
         log_err("zone write ixfr: unable to make folder for %{dnsname}: %r", data->zone->origin, return_code);
         
-        free(rdata_buffer);
-        
         scheduler_queue_zone_send_axfr(data->zone, data->directory, data->packet_size_limit, data->packet_records_limit, data->compress_dname_rdata, mesg);
         scheduler_schedule_task(scheduler_queue_zone_write_ixfr_callback, data);
         
         return NULL;
     }
 
-    /* Try to read the first queried SOA */
+    /* Get the answer from the queried SOA */
 
-    log_info("zone write ixfr: fetching first SOA %{dnsname} %d", data->zone->origin, serial);
+    log_info("zone write ixfr: fetching answer %{dnsname} %d", data->zone->origin, serial);
 
-    if(FAIL(return_code = zdb_icmtl_open_ix_get_soa(data->zone->origin, data_path, serial, &fis,  &tctrl, rdata_buffer, &rdata_size)))
+    if(FAIL(return_code = zdb_zone_ixfr_image_acquire(data->zone->origin, data_path, serial, &current_soa_tctrl, current_soa_rdata_buffer, current_soa_rdata_size, &image)))
     {
         log_err("zone write ixfr: path '" ICMTL_WIRE_FILE_FORMAT "': %r", data_path, data->zone->origin, return_code);
 
         /*
-        close(data->mesg->sockfd);
-        // TODO: Check I must release the lock
-        scheduler_schedule_task(scheduler_queue_zone_write_ixfr_callback, data);
-        */
-
-        free(rdata_buffer);
-
-        /*
-        free(mesg);
-        */
-
-        /*
-         * @TODO DO NOT DESTROY ANYTHING, INSTEAD HOOK-UP TO AN AXFR ANSWER
-         * @TODO ENSURE THAT IS IS THE RIGHT WAY
+         * Answer with an AXFR instead
          */
+        
         scheduler_queue_zone_send_axfr(data->zone, data->directory, data->packet_size_limit, data->packet_records_limit, data->compress_dname_rdata, mesg);
         scheduler_schedule_task(scheduler_queue_zone_write_ixfr_callback, data);
         
         return NULL;
     }
 
-    /*
-     * We will need to output the current SOA
-     * But first, we have some setup to do.
-     */
-
     data->return_code = SCHEDULER_TASK_FINISHED;
 
     /* It's TCP, my limit is 16 bits */
 
-    packet_size_limit = DNSPACKET_MAX_LENGTH;
-    
-    packet_size_trigger = packet_size_limit / 2;
-
-    mesg->size_limit = packet_size_limit;
+    mesg->size_limit = DNSPACKET_MAX_LENGTH;
 
     int tcpfd = data->mesg->sockfd;
     data->mesg->sockfd = -1;
     
     dnsname_copy(origin, data->zone->origin);
 
-    strcpy(directory, data->directory);
-
     /* Sends the "Write unlocked" notification */
 
     log_info("zone write ixfr: releasing implicit write lock %{dnsname} %d", data->zone->origin, serial);
@@ -439,250 +278,17 @@ scheduler_queue_zone_write_ixfr_thread(void* data_)
 
     /***********************************************************************/
 
-    log_info("zone write ixfr: sending journal %{dnsname} %d", origin, serial);
-
-    /* attach the tcp descriptor and put a buffer filter in front of the input and the output*/
-
-    fd_output_stream_attach(tcpfd, &tcpos);
-
-    buffer_input_stream_init(&fis, &fis, FILE_BUFFER_SIZE);
-    buffer_output_stream_init(&tcpos, &tcpos, TCP_BUFFER_SIZE);
+    log_info("zone write ixfr: sending journal %{dnsname} %d (%llu bytes)", origin, serial, zdb_zone_ixfr_image_size(image));
 
-    packet_writer_init(&pw, mesg->buffer, mesg->received, packet_size_limit - 780);
-
-    /*
-     * Init
-     */
-
-    packet_writer_add_fqdn(&pw, (const u8*)origin);
-    packet_writer_add_bytes(&pw, (const u8*)&current_soa_tctrl, 8);
-    packet_writer_add_rdata(&pw, TYPE_SOA, current_soa_rdata_buffer, current_soa_rdata_size);
-    
-    /*
-     * Begin
-     */
-
-    packet_writer_add_fqdn(&pw, (const u8*)origin);
-    packet_writer_add_bytes(&pw, (const u8*)&tctrl, 8);
-    packet_writer_add_rdata(&pw, tctrl.qtype, rdata_buffer, rdata_size);
-
-    an_record_count = 2;
-
-    record_mode = RECORD_MODE_DELETE;
-
-    for(;;)
+    if(ISOK(return_code = zdb_zone_ixfr_image_send(image, tcpfd, mesg)))
     {
-        if(FAIL(return_code = scheduler_queue_zone_write_ixfr_read_record(&fis, fqdn, &qname_size, &tctrl, rdata_buffer, &rdata_size)))
-        {
-            /*
-             * Critical error.
-             */
-
-            log_info("zone write ixfr: read record failed %{dnsname} %d: %r", origin, serial, return_code);
-
-            break;
-        }
-
-        if(return_code > 0)
-        {
-            if(pw.packet_offset + return_code <= pw.packet_limit)
-            {
-                if(tctrl.qtype == TYPE_SOA)
-                {
-                    if(record_mode != RECORD_MODE_DELETE)
-                    {
-                        record_mode = RECORD_MODE_DELETE;
-
-                        rr_soa_get_serial(rdata_buffer, rdata_size, &last_valid_serial);
-                        last_valid_offset = pw.packet_offset;
-                        last_valid_count  = an_record_count;
-
-                        /*
-                         * Check if we already got (beyond) the "being nice" limit
-                         */
-
-                        if(pw.packet_offset >= packet_size_trigger)
-                        {
-                            /*
-                             * Yes : flush
-                             */
-
-                            /*
-                             * End
-                             */
-
-                            packet_writer_add_fqdn(&pw, (const u8*)origin);
-                            packet_writer_add_bytes(&pw, (const u8*)&current_soa_tctrl, 8);
-                            packet_writer_add_rdata(&pw, TYPE_SOA, current_soa_rdata_buffer, current_soa_rdata_size);
-
-                            an_record_count++;
-
-                            MESSAGE_AN(mesg->buffer) = htons(an_record_count);
-                            mesg->send_length = pw.packet_offset;
-
-                            if(FAIL(return_code = scheduler_queue_zone_write_ixfr_send_message(&tcpos, &pw, mesg, pos)))
-                            {
-                                log_err("zone write ixfr: send message failed %{dnsname}: %r", origin, return_code);
-
-                                break;
-                            }
-
-                            pos = TSIG_MIDDLE;
-
-                            packet_writer_init(&pw, mesg->buffer, mesg->received, packet_size_limit - 780);
-
-                            /*
-                             * Init
-                             */
-
-                            packet_writer_add_fqdn(&pw, (const u8*)origin);
-                            packet_writer_add_bytes(&pw, (const u8*)&current_soa_tctrl, 8);
-                            packet_writer_add_rdata(&pw, TYPE_SOA, current_soa_rdata_buffer, current_soa_rdata_size);
-
-                            an_record_count = 1;
-                        }
-                    }
-                    else
-                    {
-                        record_mode = RECORD_MODE_ADD;
-                    }
-                }
-
-                /* Add the record */
-
-                packet_writer_add_fqdn(&pw, (const u8*)fqdn);
-                packet_writer_add_bytes(&pw, (const u8*)&tctrl, 8);
-                packet_writer_add_rdata(&pw, tctrl.qtype, rdata_buffer, rdata_size);
-
-                an_record_count++;
-            }
-            else
-            {
-                /*
-                 * packet would overflow
-                 *
-                 * This is a case I want to avoid.  So I will always try to properly
-                 * flush at half the packet_limit, but an update of almost 64K will
-                 * still trigger this.
-                 *
-                 * We have to cut at the last good serial, then add the end soa and
-                 * send the paquet.
-                 *
-                 * Then we have to rewind to the cut.
-                 */
-
-                serial = last_valid_serial;
-                pw.packet_offset = last_valid_offset;
-                an_record_count = last_valid_count;
-
-                /*
-                 * End
-                 */
-
-                packet_writer_add_fqdn(&pw, (const u8*)origin);
-                packet_writer_add_bytes(&pw, (const u8*)&current_soa_tctrl, 8);
-                packet_writer_add_rdata(&pw, TYPE_SOA, current_soa_rdata_buffer, current_soa_rdata_size);
-
-                an_record_count++;
-
-                MESSAGE_AN(mesg->buffer) = htons(an_record_count);
-                mesg->send_length = pw.packet_offset;
-
-                if(FAIL(return_code = scheduler_queue_zone_write_ixfr_send_message(&tcpos, &pw, mesg, pos)))
-                {
-                    log_err("zone write ixfr: send message failed %{dnsname}: %r", origin, return_code);
-
-                    break;
-                }
-
-                pos = TSIG_MIDDLE;
-
-                input_stream_close(&fis);
-
-                if(FAIL(return_code = zdb_icmtl_open_ix_get_soa(origin, directory, serial, &fis,  &tctrl, rdata_buffer, &rdata_size)))
-                {
-                    log_err("zone write ixfr: path '" ICMTL_WIRE_FILE_FORMAT "': %r", directory, origin, return_code);
-
-                    break;
-                }
-
-                buffer_input_stream_init(&fis, &fis, FILE_BUFFER_SIZE);
-
-                packet_writer_init(&pw, mesg->buffer, mesg->received, packet_size_limit - 780);
-
-                /*
-                 * Init
-                 */
-
-                packet_writer_add_fqdn(&pw, (const u8*)origin);
-                packet_writer_add_bytes(&pw, (const u8*)&current_soa_tctrl, 8);
-                packet_writer_add_rdata(&pw, TYPE_SOA, current_soa_rdata_buffer, current_soa_rdata_size);
-
-                /*
-                 * Begin
-                 */
-
-                packet_writer_add_fqdn(&pw, (const u8*)origin);
-                packet_writer_add_bytes(&pw, (const u8*)&tctrl, 8);
-                packet_writer_add_rdata(&pw, tctrl.qtype, rdata_buffer, rdata_size);
-
-                an_record_count = 2;
-
-                /*
-                 * Loop up and redo the job from where we did cut
-                 */
-            }
-        }
-        else
-        {
-            /*
-             * EOF
-             *
-             * We have to add the end soa and send the paquet.
-             * Then we are done.
-             */
-
-            /*
-             * End
-             */
-
-            packet_writer_add_fqdn(&pw, (const u8*)origin);
-            packet_writer_add_bytes(&pw, (const u8*)&current_soa_tctrl, 8);
-            packet_writer_add_rdata(&pw, TYPE_SOA, current_soa_rdata_buffer, current_soa_rdata_size);
-
-            an_record_count++;
-
-            MESSAGE_AN(mesg->buffer) = htons(an_record_count);
-            mesg->send_length = pw.packet_offset;
-
-            if(pos != TSIG_START)
-            {
-                pos = TSIG_END;
-            }
-            else
-            {
-                pos = TSIG_WHOLE;
-            }
-
-            if(FAIL(return_code = scheduler_queue_zone_write_ixfr_send_message(&tcpos, &pw, mesg, pos)))
-            {
-                log_err("zone write ixfr: send message failed %{dnsname}: %r", origin, return_code);
-            }
-
-            break;
-        }
+        log_info("zone write ixfr: %{dnsname} journal sent", origin);
     }
     
-    log_info("zone write ixfr: %{dnsname} journal sent", origin);
+    zdb_zone_ixfr_image_release(image);
 
-    output_stream_close(&tcpos);
-
-    if(input_stream_valid(&fis))
-    {
-        input_stream_close(&fis);
-    }
+    close_ex(tcpfd);
 
-    free(rdata_buffer);
     free(mesg);
 
     return NULL;
@@ -110,6 +110,32 @@ scheduler_task_rrsig_update_commit(zdb_packed_ttlrdata* removed_rrsig_sll, zdb_p
     /* WARNING: From this point forward, 'rrsig_update' cannot be used anymore */
 }
 
+static ya_result
+scheduler_task_rrsig_update_batch_commit_task(void* data_)
+{
+    rrsig_update_batch *batch = (rrsig_update_batch*)data_;
+
+#if DNSSEC_DEBUGLEVEL >= 1
+    log_debug("scheduler_task_rrsig_update_batch_commit_task: %u labels", batch->count);
+#endif
+
+    zdb_zone_lock(batch->zone, ZDB_ZONE_MUTEX_RRSIG_UPDATER);
+    rrsig_update_batch_commit(batch);
+    zdb_zone_unlock(batch->zone, ZDB_ZONE_MUTEX_RRSIG_UPDATER);
+
+    rrsig_update_batch_free(batch);
+
+    return SCHEDULER_TASK_PROGRESS;
+}
+
+void
+scheduler_task_rrsig_update_batch_commit(rrsig_update_batch* batch)
+{
+    scheduler_schedule_task(scheduler_task_rrsig_update_batch_commit_task, batch);
+
+    /* WARNING: From this point forward, 'batch' cannot be used anymore */
+}
+
 /** @} */
 
 /*----------------------------------------------------------------------------*/
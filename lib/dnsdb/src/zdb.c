@@ -61,6 +61,13 @@ zdb_rdtsc_registations(){
 #include "dnsdb/zdb_utils.h"
 #include "dnsdb/zdb_dnsname.h"
 #include "dnsdb/dictionary.h"
+#include "dnsdb/zdb_epoch.h"
+#include "dnsdb/zdb_answer_cache.h"
+#include "dnsdb/zdb_icmtl.h"
+
+#if ZDB_NSEC3_SUPPORT != 0
+#include "dnsdb/nsec3_proof_cache.h"
+#endif
 
 #if ZDB_DNSSEC_SUPPORT != 0
 #include "dnsdb/dnssec_keystore.h"
@@ -254,6 +261,16 @@ zdb_finalize()
 
     zdb_init_done = FALSE;
 
+    zdb_icmtl_finalize();
+
+    zdb_answer_cache_finalize();
+
+#if ZDB_NSEC3_SUPPORT != 0
+    nsec3_proof_cache_finalize();
+#endif
+
+    zdb_epoch_finalize();
+
 #if ZDB_DNSSEC_SUPPORT != 0
     dnssec_keystore_destroy();
     dnssec_keystore_resetpath();
@@ -325,6 +342,9 @@ zdb_create(zdb* db)
         btree_init(&zone_label->global_resource_record_set);
 #endif
         db->root[i] = zone_label;
+
+        htoa_init(&db->zone_index[i]);
+        db->zone_index_depth[i] = 0;
     }
 
     db->alarm_handle = alarm_open((const u8*)"\010database");
@@ -792,6 +812,7 @@ zdb_destroy(zdb* db)
         alarm_close(db->alarm_handle);
         db->alarm_handle = ALARM_HANDLE_INVALID;
         zdb_zone_label_destroy(&db->root[zclass]);
+        htoa_destroy(&db->zone_index[zclass]);
     }
 }
 
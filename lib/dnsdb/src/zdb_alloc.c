@@ -71,6 +71,12 @@ zdb_set_zowner(pthread_t owner)
 
 #define ZDB_ZALLOC_DEBUG 0
 
+#if (ZDB_ZALLOC_THREAD_SAFE != 0) && (ZDB_ZALLOC_MAGAZINE_SIZE > 1)
+#define ZDB_ZALLOC_USES_MAGAZINES 1
+#else
+#define ZDB_ZALLOC_USES_MAGAZINES 0
+#endif
+
 #ifndef MAP_ANONYMOUS
 
 /*
@@ -368,6 +374,187 @@ zalloc_page(u32 size, u32 chunk_size)
     return map_pointer;
 }
 
+/**
+ * INTERNAL
+ *
+ * Takes one slot from the shared pool of a line, growing it if needed.
+ * The line mutex must be held.
+ */
+
+static inline void**
+zdb_line_pop(u32 page_index)
+{
+    if(line_count[page_index] == 0)
+    {
+        u32 size = (page_index + 1) << 3;
+        void* next = zalloc_page(page_size[page_index], size);
+        u32 count = page_size[page_index] / size;
+        line_count[page_index] += count;
+        heap_total[page_index] += count;
+
+        line_sll[page_index] = next;
+    }
+
+    line_count[page_index]--;
+
+    zassert(line_count[page_index] >= 0);
+    
+    void** ret = line_sll[page_index];
+    line_sll[page_index] = *ret;
+    
+    return ret;
+}
+
+/**
+ * INTERNAL
+ *
+ * Gives one slot back to the shared pool of a line.
+ * The line mutex must be held.
+ */
+
+static inline void
+zdb_line_push(u32 page_index, void* ptr)
+{
+    void** ret = (void**)ptr;
+    *ret = line_sll[page_index];
+    line_sll[page_index] = ret;
+
+    line_count[page_index]++;
+
+    if(line_count[page_index] > heap_total[page_index])
+    {
+        log_err("zdb_mfree: page #%d count (%d) > total (%d)", page_index, line_count[page_index], heap_total[page_index]);
+    }
+}
+
+#if ZDB_ZALLOC_USES_MAGAZINES
+
+/*
+ * Each thread has its own set of magazines : a bounded list of free slots by
+ * line.  The shared pool (and its mutex) is only touched when a magazine is
+ * empty (refill half of it) or full (drain half of it).
+ */
+
+#define ZMAGAZN_TAG 0x4e5a4147414d5a /* ZMAGAZN */
+
+typedef struct zdb_magazine_set zdb_magazine_set;
+
+struct zdb_magazine_set
+{
+    void* sll[ZDB_ALLOC_PG_SIZE_COUNT];
+    u32 count[ZDB_ALLOC_PG_SIZE_COUNT];
+    u64 hits;
+    u64 misses;
+    zdb_magazine_set *next;
+};
+
+static pthread_key_t zdb_magazine_key;
+static pthread_once_t zdb_magazine_key_once = PTHREAD_ONCE_INIT;
+
+static mutex_t zdb_magazine_mtx = MUTEX_INITIALIZER;
+static zdb_magazine_set *zdb_magazine_sets = NULL;
+static u64 zdb_magazine_retired_hits = 0;
+static u64 zdb_magazine_retired_misses = 0;
+
+/**
+ * INTERNAL
+ *
+ * Gives back the slots of a magazine to the shared pool until only keep are left.
+ */
+
+static void
+zdb_magazine_drain(zdb_magazine_set *set, u32 page_index, u32 keep)
+{
+    mutex_lock(&line_mutex[page_index]);
+
+    while(set->count[page_index] > keep)
+    {
+        void** slot = (void**)set->sll[page_index];
+        set->sll[page_index] = *slot;
+        set->count[page_index]--;
+
+        zdb_line_push(page_index, slot);
+    }
+
+    mutex_unlock(&line_mutex[page_index]);
+}
+
+/**
+ * INTERNAL
+ *
+ * Called when a thread ends.
+ */
+
+static void
+zdb_magazine_release(void *set_)
+{
+    zdb_magazine_set *set = (zdb_magazine_set*)set_;
+
+    for(u32 page_index = 0; page_index < ZDB_ALLOC_PG_SIZE_COUNT; page_index++)
+    {
+        if(set->count[page_index] > 0)
+        {
+            zdb_magazine_drain(set, page_index, 0);
+        }
+    }
+
+    mutex_lock(&zdb_magazine_mtx);
+    
+    zdb_magazine_set **setp = &zdb_magazine_sets;
+
+    while(*setp != NULL)
+    {
+        if(*setp == set)
+        {
+            *setp = set->next;
+            break;
+        }
+
+        setp = &(*setp)->next;
+    }
+    
+    zdb_magazine_retired_hits += set->hits;
+    zdb_magazine_retired_misses += set->misses;
+    
+    mutex_unlock(&zdb_magazine_mtx);
+
+    free(set);
+}
+
+static void
+zdb_magazine_key_create()
+{
+    if(pthread_key_create(&zdb_magazine_key, zdb_magazine_release) != 0)
+    {
+        log_quit("zdb_malloc: pthread_key_create failed");
+    }
+}
+
+static inline zdb_magazine_set*
+zdb_magazine_get()
+{
+    zdb_magazine_set *set;
+    
+    pthread_once(&zdb_magazine_key_once, zdb_magazine_key_create);
+
+    if((set = (zdb_magazine_set*)pthread_getspecific(zdb_magazine_key)) == NULL)
+    {
+        MALLOC_OR_DIE(zdb_magazine_set*, set, sizeof(zdb_magazine_set), ZMAGAZN_TAG);
+        ZEROMEMORY(set, sizeof(zdb_magazine_set));
+
+        mutex_lock(&zdb_magazine_mtx);
+        set->next = zdb_magazine_sets;
+        zdb_magazine_sets = set;
+        mutex_unlock(&zdb_magazine_mtx);
+
+        pthread_setspecific(zdb_magazine_key, set);
+    }
+
+    return set;
+}
+
+#endif
+
 /**
  * @brief Allocates one slot in a memory set
  *
@@ -384,32 +571,54 @@ void*
 zdb_malloc(u32 page_index)
 {
     zassert(page_index < ZDB_ALLOC_PG_SIZE_COUNT);
-    
-#if ZDB_ZALLOC_THREAD_SAFE != 0
-    mutex_lock(&line_mutex[page_index]);
-#endif
 
 #if ZDB_ZALLOC_DEBUG!=0
     page_index++;
 #endif
+    
+    void** ret;
+    
+#if ZDB_ZALLOC_USES_MAGAZINES
+    zdb_magazine_set *set = zdb_magazine_get();
 
-    if(line_count[page_index] == 0)
+    if(set->count[page_index] == 0)
     {
-        u32 size = (page_index + 1) << 3;
-        void* next = zalloc_page(page_size[page_index], size);
-        u32 count = page_size[page_index] / size;
-        line_count[page_index] += count;
-        heap_total[page_index] += count;
+        set->misses++;
 
-        line_sll[page_index] = next;
+        mutex_lock(&line_mutex[page_index]);
+
+        for(u32 i = 0; i < ZDB_ZALLOC_MAGAZINE_SIZE / 2; i++)
+        {
+            void** slot = zdb_line_pop(page_index);
+            *slot = set->sll[page_index];
+            set->sll[page_index] = slot;
+        }
+
+        mutex_unlock(&line_mutex[page_index]);
+
+        set->count[page_index] = ZDB_ZALLOC_MAGAZINE_SIZE / 2;
+    }
+    else
+    {
+        set->hits++;
     }
 
-    line_count[page_index]--;
+    set->count[page_index]--;
+    ret = (void**)set->sll[page_index];
+    set->sll[page_index] = *ret;
+#else
+    
+#if ZDB_ZALLOC_THREAD_SAFE != 0
+    mutex_lock(&line_mutex[page_index]);
+#endif
 
-    zassert(line_count[page_index] >= 0);
+    ret = zdb_line_pop(page_index);
     
-    void** ret = line_sll[page_index];
-    line_sll[page_index] = *ret;
+#if ZDB_ZALLOC_THREAD_SAFE != 0
+    mutex_unlock(&line_mutex[page_index]);
+#endif
+    
+#endif
 
     *ret = NULL; /* erases ZALLOC pointer */
 
@@ -424,14 +633,13 @@ zdb_malloc(u32 page_index)
 #endif
 
 #if ZDB_ZALLOC_STATISTICS!=0
+#if ZDB_ZALLOC_THREAD_SAFE != 0
+    __sync_fetch_and_add(&zalloc_memory_allocated, (page_index + 1) << 3);
+#else
     zalloc_memory_allocated += (page_index + 1) << 3;
 #endif
-    
-#if ZDB_ZALLOC_THREAD_SAFE != 0
-    mutex_unlock(&line_mutex[page_index]);
 #endif
 
-
     return ret;
 }
 
@@ -454,11 +662,6 @@ zdb_mfree(void* ptr, u32 page_index)
     
     if(ptr != NULL)
     {
-
-#if ZDB_ZALLOC_THREAD_SAFE != 0
-        mutex_lock(&line_mutex[page_index]);
-#endif
-        
 #if ZDB_ZALLOC_DEBUG!=0
         u64* hdr = (u64*)ptr;
         hdr--;
@@ -474,25 +677,121 @@ zdb_mfree(void* ptr, u32 page_index)
 #endif
 
 #if ZDB_ZALLOC_STATISTICS!=0
+#if ZDB_ZALLOC_THREAD_SAFE != 0
+        __sync_fetch_and_sub(&zalloc_memory_allocated, (page_index + 1) << 3);
+#else
         zalloc_memory_allocated -= (page_index + 1) << 3;
 #endif
+#endif
 
-        void** ret = (void**)ptr;
-        *ret = line_sll[page_index];
-        line_sll[page_index] = ret;
-
-        line_count[page_index]++;
+#if ZDB_ZALLOC_USES_MAGAZINES
+        zdb_magazine_set *set = zdb_magazine_get();
+        
+        void** slot = (void**)ptr;
+        *slot = set->sll[page_index];
+        set->sll[page_index] = slot;
 
-        if(line_count[page_index] > heap_total[page_index])
+        if(++set->count[page_index] > ZDB_ZALLOC_MAGAZINE_SIZE)
         {
-            log_err("zdb_mfree: page #%d count (%d) > total (%d)", page_index, line_count[page_index] > heap_total[page_index]);
+            zdb_magazine_drain(set, page_index, ZDB_ZALLOC_MAGAZINE_SIZE / 2);
         }
+#else
+        
+#if ZDB_ZALLOC_THREAD_SAFE != 0
+        mutex_lock(&line_mutex[page_index]);
+#endif
+
+        zdb_line_push(page_index, ptr);
         
 #if ZDB_ZALLOC_THREAD_SAFE != 0
         mutex_unlock(&line_mutex[page_index]);
 #endif
+        
+#endif
+    }
+}
+
+/**
+ * Gives all the slots cached by the current thread back to the shared pool.
+ * The counters are kept.
+ */
+
+void
+zdb_mcache_flush()
+{
+#if ZDB_ZALLOC_USES_MAGAZINES
+    pthread_once(&zdb_magazine_key_once, zdb_magazine_key_create);
+    
+    zdb_magazine_set *set = (zdb_magazine_set*)pthread_getspecific(zdb_magazine_key);
+
+    if(set != NULL)
+    {
+        for(u32 page_index = 0; page_index < ZDB_ALLOC_PG_SIZE_COUNT; page_index++)
+        {
+            if(set->count[page_index] > 0)
+            {
+                zdb_magazine_drain(set, page_index, 0);
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * Returns the number of slots of a memory set held in the thread caches.
+ * The value is only indicative.
+ */
+
+u64
+zdb_mcached(u32 page_index)
+{
+    u64 return_value = 0;
+    
+#if ZDB_ZALLOC_USES_MAGAZINES
+    if(page_index < ZDB_ALLOC_PG_SIZE_COUNT)
+    {
+        mutex_lock(&zdb_magazine_mtx);
+
+        for(zdb_magazine_set *set = zdb_magazine_sets; set != NULL; set = set->next)
+        {
+            return_value += set->count[page_index];
+        }
+
+        mutex_unlock(&zdb_magazine_mtx);
+    }
+#endif
+    
+    return return_value;
+}
+
+/**
+ * Returns the number of allocations served by (hits) or missed (misses) by
+ * the thread caches.  A miss is a refill from the shared pool.
+ */
 
+void
+zdb_mcache_stats(u64 *hits, u64 *misses)
+{
+    u64 h = 0;
+    u64 m = 0;
+    
+#if ZDB_ZALLOC_USES_MAGAZINES
+    mutex_lock(&zdb_magazine_mtx);
+    
+    h = zdb_magazine_retired_hits;
+    m = zdb_magazine_retired_misses;
+
+    for(zdb_magazine_set *set = zdb_magazine_sets; set != NULL; set = set->next)
+    {
+        h += set->hits;
+        m += set->misses;
     }
+
+    mutex_unlock(&zdb_magazine_mtx);
+#endif
+    
+    *hits = h;
+    *misses = m;
 }
 
 #ifdef zdb_mused
@@ -526,6 +825,11 @@ zdb_mheap(u32 page_index)
     return 0;
 }
 
+/**
+ * Returns the number of free slots in a memory set, including the ones
+ * held in the thread caches.
+ */
+
 u64
 zdb_mavail(u32 page_index)
 {
@@ -541,7 +845,7 @@ zdb_mavail(u32 page_index)
         mutex_unlock(&line_mutex[page_index]);
 #endif
         
-        return return_value;
+        return return_value + zdb_mcached(page_index);
 
     }
 
@@ -552,19 +856,7 @@ u64
 zdb_mused()
 {
 #if ZDB_ZALLOC_STATISTICS!=0
-    
-#if ZDB_ZALLOC_THREAD_SAFE != 0
-    mutex_lock(&line_mutex[page_index]);
-#endif
-
-    u64 return_value = zalloc_memory_allocated;
-
-#if ZDB_ZALLOC_THREAD_SAFE != 0
-    mutex_unlock(&line_mutex[page_index]);
-#endif
-
-    return return_value;
-    
+    return zalloc_memory_allocated;
 #else
     return 0;
 #endif
@@ -0,0 +1,695 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup answer_cache Cache of fully built answers
+ *  @ingroup dnsdb
+ *  @brief Cache of fully built answers
+ *
+ *  The buckets are shared between ZDB_ANSWER_CACHE_STRIPES stripes
+ *  (bucket index modulo the number of stripes).  Each stripe has its own
+ *  mutex, LRU list, memory budget and counters so that two workers only
+ *  collide when they hit the same stripe.
+ *
+ *  An entry holds its qname and the answer as it has been sent.  On a hit,
+ *  the ID and the question name (the case may differ) are taken from the
+ *  query.
+ *
+ *  An entry is stale when the zone that answered it has been released by a
+ *  writer since (zone->answer_cache_generation) or when the zones of the
+ *  database have changed (mount, destroy).
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dnscore/dnscore.h>
+#include <dnscore/mutex.h>
+#include <dnscore/logger.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/message.h>
+#if HAS_TSIG_SUPPORT
+#include <dnscore/tsig.h>
+#endif
+
+#include "dnsdb/zdb_answer_cache.h"
+#include "dnsdb/zdb_zone_label.h"
+#include "dnsdb/hash.h"
+
+extern logger_handle* g_database_logger;
+#define MODULE_MSG_HANDLE g_database_logger
+
+#define ANSCACHE_TAG 0x4548434143534e41 /* ANSCACHE */
+#define ANSCBKTS_TAG 0x53544b4243534e41 /* ANSCBKTS */
+
+#define ZDB_ANSWER_CACHE_CACHE_LINE_SIZE 64
+
+/* The query flags that survive message_process and are echoed in the answer */
+
+#define ZDB_ANSWER_CACHE_QUERY_FLAGS ((((u16)(OPCODE_BITS|RD_BITS)) << 8) | (AD_BITS|CD_BITS|Z_BITS))
+
+typedef struct zdb_answer_cache_entry zdb_answer_cache_entry;
+
+struct zdb_answer_cache_entry
+{
+    zdb_answer_cache_entry *next;       /* bucket */
+    zdb_answer_cache_entry *lru_prev;   /* stripe, most recently used first */
+    zdb_answer_cache_entry *lru_next;
+    zdb_zone *zone;                     /* for the access filter */
+    u32 hash;
+    u32 zones_generation;
+    u32 generation;                     /* of the zone */
+    u32 rcode_ext;
+    finger_print status;
+    u16 qtype;
+    u16 qclass;
+    u16 flags;
+    u16 answer_size;
+    u8 size_class;
+    u8 edns;
+    u8 referral;
+    u8 qname_len;
+    u8 data[1];                         /* qname then answer */
+};
+
+typedef struct zdb_answer_cache_stripe zdb_answer_cache_stripe;
+
+struct zdb_answer_cache_stripe
+{
+    mutex_t mtx;
+    zdb_answer_cache_entry *lru_head;
+    zdb_answer_cache_entry *lru_tail;
+    u64 hits;
+    u64 misses;
+    u32 count;
+    u32 bytes;
+} __attribute__ ((aligned (ZDB_ANSWER_CACHE_CACHE_LINE_SIZE)));
+
+typedef struct zdb_answer_cache_key zdb_answer_cache_key;
+
+struct zdb_answer_cache_key
+{
+    const u8 *qname;
+    u32 hash;
+    u32 rcode_ext;
+    u16 qtype;
+    u16 qclass;
+    u16 flags;
+    u8 size_class;
+    u8 edns;
+    u8 qname_len;
+};
+
+static zdb_answer_cache_stripe zdb_answer_cache_stripes[ZDB_ANSWER_CACHE_STRIPES];
+static zdb_answer_cache_entry **zdb_answer_cache_buckets = NULL;
+static u32 zdb_answer_cache_mask = 0;
+static u32 zdb_answer_cache_stripe_max_bytes = 0;
+
+/* bumped when the zones of the database change : the entries cannot even look at their zone anymore */
+
+static volatile u32 zdb_answer_cache_zones_gen = 1;
+
+/*
+ * Helpers
+ */
+
+static inline u8
+zdb_answer_cache_size_class(u16 size_limit)
+{
+    if(size_limit <= 512)
+    {
+        return 0;
+    }
+    if(size_limit <= 1232)
+    {
+        return 1;
+    }
+    if(size_limit <= 1472)
+    {
+        return 2;
+    }
+    if(size_limit <= 4096)
+    {
+        return 3;
+    }
+    
+    return 4;
+}
+
+static void
+zdb_answer_cache_key_init(zdb_answer_cache_key *key, const message_data *mesg)
+{
+    /* message_process has already lower-cased the qname */
+    
+    key->qname = mesg->qname;
+    key->qname_len = dnsname_len(mesg->qname);
+    key->qtype = mesg->qtype;
+    key->qclass = mesg->qclass;
+    key->flags = GET_U16_AT(mesg->buffer[2]) & NU16(ZDB_ANSWER_CACHE_QUERY_FLAGS);
+    key->rcode_ext = mesg->rcode_ext;
+    key->edns = (mesg->edns)?1:0;
+    key->size_class = zdb_answer_cache_size_class(mesg->size_limit);
+    
+    u32 h = hash_dnsname(mesg->qname);
+    h ^= ((u32)key->qtype << 16) | key->qclass;
+    h *= 0x9e3779b1;
+    h ^= h >> 15;
+    h ^= ((u32)key->flags << 8) ^ (key->rcode_ext >> 8) ^ ((u32)key->size_class << 4) ^ key->edns;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    
+    key->hash = h;
+}
+
+static inline bool
+zdb_answer_cache_entry_matches(const zdb_answer_cache_entry *entry, const zdb_answer_cache_key *key)
+{
+    return  (entry->hash == key->hash) &&
+            (entry->qtype == key->qtype) &&
+            (entry->qclass == key->qclass) &&
+            (entry->flags == key->flags) &&
+            (entry->rcode_ext == key->rcode_ext) &&
+            (entry->size_class == key->size_class) &&
+            (entry->edns == key->edns) &&
+            (entry->qname_len == key->qname_len) &&
+            (memcmp(entry->data, key->qname, key->qname_len) == 0);
+}
+
+static inline u32
+zdb_answer_cache_entry_size(const zdb_answer_cache_entry *entry)
+{
+    return sizeof(zdb_answer_cache_entry) - 1 + entry->qname_len + entry->answer_size;
+}
+
+static inline void
+zdb_answer_cache_lru_unlink(zdb_answer_cache_stripe *stripe, zdb_answer_cache_entry *entry)
+{
+    if(entry->lru_prev != NULL)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else
+    {
+        stripe->lru_head = entry->lru_next;
+    }
+    
+    if(entry->lru_next != NULL)
+    {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else
+    {
+        stripe->lru_tail = entry->lru_prev;
+    }
+}
+
+static inline void
+zdb_answer_cache_lru_push(zdb_answer_cache_stripe *stripe, zdb_answer_cache_entry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = stripe->lru_head;
+    
+    if(stripe->lru_head != NULL)
+    {
+        stripe->lru_head->lru_prev = entry;
+    }
+    else
+    {
+        stripe->lru_tail = entry;
+    }
+    
+    stripe->lru_head = entry;
+}
+
+/**
+ * Removes an entry from its bucket and from the LRU of its stripe, then frees it.
+ * The stripe must be locked.
+ */
+
+static void
+zdb_answer_cache_entry_delete(zdb_answer_cache_stripe *stripe, zdb_answer_cache_entry *entry)
+{
+    zdb_answer_cache_entry **prevp = &zdb_answer_cache_buckets[entry->hash & zdb_answer_cache_mask];
+    
+    while(*prevp != entry)
+    {
+        zassert(*prevp != NULL);
+        
+        prevp = &(*prevp)->next;
+    }
+    
+    *prevp = entry->next;
+    
+    zdb_answer_cache_lru_unlink(stripe, entry);
+    
+    stripe->bytes -= zdb_answer_cache_entry_size(entry);
+    stripe->count--;
+    
+    free(entry);
+}
+
+/**
+ * Finds the zone that would have been used by zdb_query_ex to answer.
+ * (Including the DS-at-the-apex case that is answered by the parent.)
+ */
+
+static zdb_zone*
+zdb_answer_cache_find_zone(const zdb *db, const message_data *mesg)
+{
+    dnsname_vector name;
+    zdb_zone_label_pointer_array zone_label_stack;
+    
+    dnsname_to_dnsname_vector(mesg->qname, &name);
+    
+#if ZDB_RECORDS_MAX_CLASS == 1
+    s32 sp = zdb_zone_label_match(db, &name, CLASS_IN, zone_label_stack);
+#else
+    s32 sp = zdb_zone_label_match(db, &name, ntohs(mesg->qclass), zone_label_stack);
+#endif
+    
+    if((mesg->qtype == TYPE_DS) && (name.size == sp - 1))
+    {
+        /* answered from the parent, if any */
+        
+        while(--sp >= 0)
+        {
+            if(zone_label_stack[sp]->zone != NULL)
+            {
+                return zone_label_stack[sp]->zone;
+            }
+        }
+        
+        return NULL;
+    }
+    
+    while(sp >= 0)
+    {
+        if(zone_label_stack[sp]->zone != NULL)
+        {
+            return zone_label_stack[sp]->zone;
+        }
+        
+        sp--;
+    }
+    
+    return NULL;
+}
+
+/*
+ * API
+ */
+
+void
+zdb_answer_cache_init(u32 max_bytes)
+{
+    if(zdb_answer_cache_buckets != NULL)
+    {
+        return;
+    }
+    
+    if(max_bytes == 0)
+    {
+        return;
+    }
+    
+    /* one bucket for every ~512 bytes of budget */
+    
+    u32 bucket_count = ZDB_ANSWER_CACHE_BUCKETS_MIN;
+    
+    while((bucket_count < ZDB_ANSWER_CACHE_BUCKETS_MAX) && (bucket_count < (max_bytes >> 9)))
+    {
+        bucket_count <<= 1;
+    }
+    
+    MALLOC_OR_DIE(zdb_answer_cache_entry**, zdb_answer_cache_buckets, sizeof(zdb_answer_cache_entry*) * bucket_count, ANSCBKTS_TAG);
+    memset(zdb_answer_cache_buckets, 0, sizeof(zdb_answer_cache_entry*) * bucket_count);
+    
+    zdb_answer_cache_mask = bucket_count - 1;
+    zdb_answer_cache_stripe_max_bytes = max_bytes / ZDB_ANSWER_CACHE_STRIPES;
+    
+    for(u32 i = 0; i < ZDB_ANSWER_CACHE_STRIPES; i++)
+    {
+        zdb_answer_cache_stripe *stripe = &zdb_answer_cache_stripes[i];
+        
+        mutex_init(&stripe->mtx);
+        stripe->lru_head = NULL;
+        stripe->lru_tail = NULL;
+        stripe->hits = 0;
+        stripe->misses = 0;
+        stripe->count = 0;
+        stripe->bytes = 0;
+    }
+    
+    log_info("answer cache: %u bytes, %u buckets", max_bytes, bucket_count);
+}
+
+void
+zdb_answer_cache_finalize()
+{
+    if(zdb_answer_cache_buckets == NULL)
+    {
+        return;
+    }
+    
+    for(u32 i = 0; i < ZDB_ANSWER_CACHE_STRIPES; i++)
+    {
+        zdb_answer_cache_stripe *stripe = &zdb_answer_cache_stripes[i];
+        
+        zdb_answer_cache_entry *entry = stripe->lru_head;
+        
+        while(entry != NULL)
+        {
+            zdb_answer_cache_entry *next = entry->lru_next;
+            free(entry);
+            entry = next;
+        }
+        
+        stripe->lru_head = NULL;
+        stripe->lru_tail = NULL;
+        stripe->count = 0;
+        stripe->bytes = 0;
+        
+        mutex_destroy(&stripe->mtx);
+    }
+    
+    free(zdb_answer_cache_buckets);
+    zdb_answer_cache_buckets = NULL;
+    zdb_answer_cache_mask = 0;
+}
+
+bool
+zdb_answer_cache_enabled()
+{
+    return zdb_answer_cache_buckets != NULL;
+}
+
+void
+zdb_answer_cache_snapshot_init(zdb_answer_cache_snapshot *snapshot, const zdb *db, const message_data *mesg)
+{
+    /* the zones first : a zone mounted from now on makes the snapshot obsolete */
+    
+    snapshot->zones_generation = zdb_answer_cache_zones_gen;
+    __sync_synchronize();
+    snapshot->zone = zdb_answer_cache_find_zone(db, mesg);
+    snapshot->generation = (snapshot->zone != NULL) ? snapshot->zone->answer_cache_generation : 0;
+}
+
+void
+zdb_answer_cache_invalidate(zdb_zone *zone)
+{
+    __sync_add_and_fetch(&zone->answer_cache_generation, 1);
+}
+
+void
+zdb_answer_cache_invalidate_all()
+{
+    u32 gen = __sync_add_and_fetch(&zdb_answer_cache_zones_gen, 1);
+    
+    if(gen == 0)
+    {
+        __sync_bool_compare_and_swap(&zdb_answer_cache_zones_gen, 0, 1);
+    }
+}
+
+bool
+zdb_answer_cache_get(message_data *mesg, const zdb_zone **zonep)
+{
+#if HAS_TSIG_SUPPORT
+    if(TSIG_ENABLED(mesg))
+    {
+        return FALSE;
+    }
+#endif
+    
+    zdb_answer_cache_key key;
+    zdb_answer_cache_key_init(&key, mesg);
+    
+    u32 bucket = key.hash & zdb_answer_cache_mask;
+    zdb_answer_cache_stripe *stripe = &zdb_answer_cache_stripes[bucket & (ZDB_ANSWER_CACHE_STRIPES - 1)];
+    
+    u32 zones_gen = zdb_answer_cache_zones_gen;
+    
+    mutex_lock(&stripe->mtx);
+    
+    zdb_answer_cache_entry *entry = zdb_answer_cache_buckets[bucket];
+    
+    while(entry != NULL)
+    {
+        if(zdb_answer_cache_entry_matches(entry, &key))
+        {
+            break;
+        }
+        
+        entry = entry->next;
+    }
+    
+    if(entry != NULL)
+    {
+        /* the zone can only be looked at if the zones have not changed */
+        
+        if((entry->zones_generation != zones_gen) || (entry->generation != entry->zone->answer_cache_generation))
+        {
+            /* the database has changed since */
+            
+            zdb_answer_cache_entry_delete(stripe, entry);
+            entry = NULL;
+        }
+        else if((entry->answer_size > mesg->size_limit) ||
+                FAIL(entry->zone->query_access_filter(mesg, entry->zone->extension)))
+        {
+            /* let zdb_query_ex build the (truncated or rejected) answer */
+            
+            entry = NULL;
+        }
+    }
+    
+    if(entry == NULL)
+    {
+        stripe->misses++;
+        
+        mutex_unlock(&stripe->mtx);
+        
+        return FALSE;
+    }
+    
+    stripe->hits++;
+    
+    if(stripe->lru_head != entry)
+    {
+        zdb_answer_cache_lru_unlink(stripe, entry);
+        zdb_answer_cache_lru_push(stripe, entry);
+    }
+    
+    /* keep the ID and the question name as they have been sent */
+    
+    const u8 *answer = &entry->data[entry->qname_len];
+    u32 question_end = DNS_HEADER_LENGTH + entry->qname_len;
+    
+    memcpy(&mesg->buffer[2], &answer[2], DNS_HEADER_LENGTH - 2);
+    memcpy(&mesg->buffer[question_end], &answer[question_end], entry->answer_size - question_end);
+    
+    mesg->send_length = entry->answer_size;
+    mesg->status = entry->status;
+    mesg->referral = entry->referral;
+    
+    if(zonep != NULL)
+    {
+        *zonep = entry->zone;
+    }
+    
+    mutex_unlock(&stripe->mtx);
+    
+    return TRUE;
+}
+
+void
+zdb_answer_cache_put(message_data *mesg, const zdb_answer_cache_snapshot *snapshot)
+{
+    zdb_zone *zone = snapshot->zone;
+    
+    if(zone == NULL)
+    {
+        return;
+    }
+    
+    if(MESSAGE_TC(mesg->buffer) != 0)
+    {
+        return;
+    }
+    
+    if((mesg->status != FP_BASIC_RECORD_FOUND) && (mesg->status != FP_BASIC_LABEL_NOTFOUND))
+    {
+        /* only NOERROR & NXDOMAIN (their values) */
+        
+        return;
+    }
+    
+#if HAS_TSIG_SUPPORT
+    if(TSIG_ENABLED(mesg))
+    {
+        return;
+    }
+#endif
+    
+    /*
+     * A CNAME has been followed : qname is its target now, and the answer may
+     * come from other zones too.
+     */
+    
+    if(!dnsname_equals_ignorecase(mesg->qname, &mesg->buffer[DNS_HEADER_LENGTH]))
+    {
+        return;
+    }
+    
+    zdb_answer_cache_key key;
+    zdb_answer_cache_key_init(&key, mesg);
+    
+    if(mesg->send_length < DNS_HEADER_LENGTH + key.qname_len + 4)
+    {
+        return;
+    }
+    
+    u32 size = sizeof(zdb_answer_cache_entry) - 1 + key.qname_len + mesg->send_length;
+    
+    if(size > zdb_answer_cache_stripe_max_bytes)
+    {
+        return;
+    }
+    
+    zdb_answer_cache_entry *entry;
+    
+    MALLOC_OR_DIE(zdb_answer_cache_entry*, entry, size, ANSCACHE_TAG);
+    
+    entry->zone = zone;
+    entry->hash = key.hash;
+    entry->zones_generation = snapshot->zones_generation;
+    entry->generation = snapshot->generation;
+    entry->rcode_ext = key.rcode_ext;
+    entry->status = mesg->status;
+    entry->qtype = key.qtype;
+    entry->qclass = key.qclass;
+    entry->flags = key.flags;
+    entry->answer_size = mesg->send_length;
+    entry->size_class = key.size_class;
+    entry->edns = key.edns;
+    entry->referral = mesg->referral;
+    entry->qname_len = key.qname_len;
+    memcpy(entry->data, key.qname, key.qname_len);
+    memcpy(&entry->data[key.qname_len], mesg->buffer, mesg->send_length);
+    
+    u32 bucket = key.hash & zdb_answer_cache_mask;
+    zdb_answer_cache_stripe *stripe = &zdb_answer_cache_stripes[bucket & (ZDB_ANSWER_CACHE_STRIPES - 1)];
+    
+    mutex_lock(&stripe->mtx);
+    
+    if((snapshot->zones_generation != zdb_answer_cache_zones_gen) || (snapshot->generation != zone->answer_cache_generation))
+    {
+        /* the answer may have been computed from a changing database */
+        
+        mutex_unlock(&stripe->mtx);
+        
+        free(entry);
+        
+        return;
+    }
+    
+    /* replace the previous version, if any */
+    
+    zdb_answer_cache_entry *old = zdb_answer_cache_buckets[bucket];
+    
+    while(old != NULL)
+    {
+        if(zdb_answer_cache_entry_matches(old, &key))
+        {
+            zdb_answer_cache_entry_delete(stripe, old);
+            break;
+        }
+        
+        old = old->next;
+    }
+    
+    /* make room, least recently used first */
+    
+    while(stripe->bytes + size > zdb_answer_cache_stripe_max_bytes)
+    {
+        zassert(stripe->lru_tail != NULL);
+        
+        zdb_answer_cache_entry_delete(stripe, stripe->lru_tail);
+    }
+    
+    entry->next = zdb_answer_cache_buckets[bucket];
+    zdb_answer_cache_buckets[bucket] = entry;
+    zdb_answer_cache_lru_push(stripe, entry);
+    
+    stripe->bytes += size;
+    stripe->count++;
+    
+    mutex_unlock(&stripe->mtx);
+}
+
+void
+zdb_answer_cache_get_stats(zdb_answer_cache_stats *stats)
+{
+    stats->hits = 0;
+    stats->misses = 0;
+    stats->count = 0;
+    stats->bytes = 0;
+    
+    if(zdb_answer_cache_buckets == NULL)
+    {
+        return;
+    }
+    
+    for(u32 i = 0; i < ZDB_ANSWER_CACHE_STRIPES; i++)
+    {
+        zdb_answer_cache_stripe *stripe = &zdb_answer_cache_stripes[i];
+        
+        mutex_lock(&stripe->mtx);
+        
+        stats->hits += stripe->hits;
+        stats->misses += stripe->misses;
+        stats->count += stripe->count;
+        stats->bytes += stripe->bytes;
+        
+        mutex_unlock(&stripe->mtx);
+    }
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
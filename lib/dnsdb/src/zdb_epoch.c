@@ -0,0 +1,447 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup epoch Epoch-based reclamation for the zone readers
+ *  @ingroup dnsdb
+ *  @brief Epoch-based reclamation for the zone readers
+ *
+ *  A reader stores the global epoch in its slot when it enters, and 0 when it
+ *  leaves.  Every deferred item is stamped with the global epoch at the time
+ *  it was retired.  An item can be released once no reader slot holds an
+ *  epoch lower or equal to its stamp.
+ *
+ *  The slots are only written by their owner, and each one has its own cache
+ *  line, so the readers do not share anything but the (read-mostly) global
+ *  epoch.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <dnscore/mutex.h>
+#include <dnscore/logger.h>
+
+#include "dnsdb/zdb_epoch.h"
+
+extern logger_handle* g_database_logger;
+#define MODULE_MSG_HANDLE g_database_logger
+
+#define EPOCHLMB_TAG 0x424d4c48434f5045 /* EPOCHLMB */
+
+#define ZDB_EPOCH_CACHE_LINE_SIZE 64
+
+/*
+ * The global epoch wraps around : epochs are compared by their (signed)
+ * distance.  0 is never used as an epoch as it marks a quiescent slot.
+ */
+
+#define ZDB_EPOCH_BEFORE(a_, b_) (((s32)((a_) - (b_))) < 0)
+
+typedef struct zdb_epoch_slot zdb_epoch_slot;
+
+struct zdb_epoch_slot
+{
+    volatile u32 epoch;     /* 0 means quiescent */
+    u32 nest;               /* only accessed by the owner */
+    volatile u32 owned;
+    u8 padding[ZDB_EPOCH_CACHE_LINE_SIZE - 3 * sizeof(u32)];
+};
+
+typedef struct zdb_epoch_item zdb_epoch_item;
+
+struct zdb_epoch_item
+{
+    zdb_epoch_free_callback *callback;
+    void *ptr;
+    u32 epoch;
+};
+
+typedef struct zdb_epoch_limbo zdb_epoch_limbo;
+
+struct zdb_epoch_limbo
+{
+    zdb_epoch_limbo *next;
+    u32 first;
+    u32 count;
+    zdb_epoch_item items[ZDB_EPOCH_LIMBO_CHUNK_SIZE];
+};
+
+static zdb_epoch_slot zdb_epoch_slots[ZDB_EPOCH_READER_MAX] __attribute__ ((aligned (ZDB_EPOCH_CACHE_LINE_SIZE)));
+
+/* Only the slots below this mark have ever been used */
+
+static volatile u32 zdb_epoch_slots_mark = 0;
+
+/* 0 is reserved to mark a quiescent slot */
+
+static volatile u32 zdb_epoch_global = 1;
+
+static pthread_key_t zdb_epoch_slot_key;
+static pthread_once_t zdb_epoch_slot_key_once = PTHREAD_ONCE_INIT;
+
+/* The limbo is a FIFO : the stamps are increasing from the head to the tail */
+
+static mutex_t zdb_epoch_limbo_mtx = MUTEX_INITIALIZER;
+static zdb_epoch_limbo *zdb_epoch_limbo_head = NULL;
+static zdb_epoch_limbo *zdb_epoch_limbo_tail = NULL;
+static volatile u32 zdb_epoch_limbo_pending = 0;
+
+static void
+zdb_epoch_slot_release(void *slot_)
+{
+    zdb_epoch_slot *slot = (zdb_epoch_slot*)slot_;
+    
+    slot->nest = 0;
+    __sync_lock_release(&slot->epoch);
+    __sync_lock_release(&slot->owned);
+}
+
+static void
+zdb_epoch_slot_key_create()
+{
+    if(pthread_key_create(&zdb_epoch_slot_key, zdb_epoch_slot_release) != 0)
+    {
+        log_quit("zdb_epoch: pthread_key_create failed");
+    }
+}
+
+static zdb_epoch_slot*
+zdb_epoch_slot_acquire()
+{
+    pthread_once(&zdb_epoch_slot_key_once, zdb_epoch_slot_key_create);
+    
+    for(;;)
+    {
+        for(u32 i = 0; i < ZDB_EPOCH_READER_MAX; i++)
+        {
+            zdb_epoch_slot *slot = &zdb_epoch_slots[i];
+
+            if((slot->owned == 0) && __sync_bool_compare_and_swap(&slot->owned, 0, 1))
+            {
+                slot->nest = 0;
+                slot->epoch = 0;
+                
+                u32 mark;
+
+                while((mark = zdb_epoch_slots_mark) <= i)
+                {
+                    __sync_bool_compare_and_swap(&zdb_epoch_slots_mark, mark, i + 1);
+                }
+
+                pthread_setspecific(zdb_epoch_slot_key, slot);
+
+                return slot;
+            }
+        }
+
+        /*
+         * More than ZDB_EPOCH_READER_MAX threads are querying the database.
+         * This only happens if the limit is badly set.
+         */
+        
+        log_warn("zdb_epoch: all %u reader slots are taken", ZDB_EPOCH_READER_MAX);
+
+        sched_yield();
+    }
+}
+
+static inline zdb_epoch_slot*
+zdb_epoch_slot_get()
+{
+    zdb_epoch_slot *slot = NULL;
+    
+    if(zdb_epoch_slots_mark != 0)
+    {
+        slot = (zdb_epoch_slot*)pthread_getspecific(zdb_epoch_slot_key);
+    }
+
+    if(slot == NULL)
+    {
+        slot = zdb_epoch_slot_acquire();
+    }
+
+    return slot;
+}
+
+void
+zdb_epoch_enter()
+{
+    zdb_epoch_slot *slot = zdb_epoch_slot_get();
+
+    if(slot->nest++ == 0)
+    {
+        slot->epoch = zdb_epoch_global;
+
+        /* the announce MUST be visible before anything is read from the zone */
+        
+        __sync_synchronize();
+    }
+}
+
+void
+zdb_epoch_leave()
+{
+    zdb_epoch_slot *slot = (zdb_epoch_slot*)pthread_getspecific(zdb_epoch_slot_key);
+
+    zassert(slot != NULL && slot->nest > 0);
+
+    if(--slot->nest == 0)
+    {
+        __sync_lock_release(&slot->epoch);
+    }
+}
+
+/**
+ * Starts a new epoch and returns it.
+ */
+
+static u32
+zdb_epoch_advance()
+{
+    u32 epoch = __sync_add_and_fetch(&zdb_epoch_global, 1);
+    
+    if(epoch == 0) /* wrapped */
+    {
+        epoch = __sync_add_and_fetch(&zdb_epoch_global, 1);
+    }
+    
+    __sync_synchronize();
+    
+    return epoch;
+}
+
+/**
+ * Returns the lowest epoch announced by a reader, or the current epoch if
+ * nobody is reading.  Also starts a new epoch.
+ */
+
+static u32
+zdb_epoch_oldest_reader()
+{
+    u32 oldest = zdb_epoch_advance();
+
+    u32 mark = zdb_epoch_slots_mark;
+
+    for(u32 i = 0; i < mark; i++)
+    {
+        u32 epoch = zdb_epoch_slots[i].epoch;
+
+        if((epoch != 0) && ZDB_EPOCH_BEFORE(epoch, oldest))
+        {
+            oldest = epoch;
+        }
+    }
+
+    return oldest;
+}
+
+/**
+ * Releases at most max items stamped before the given epoch.
+ * An epoch of 0 releases the items whatever their stamp.
+ * The limbo mutex must be held.
+ */
+
+static void
+zdb_epoch_release_before(u32 epoch, u32 max)
+{
+    zdb_epoch_limbo *limbo;
+
+    while((limbo = zdb_epoch_limbo_head) != NULL)
+    {
+        while(limbo->first < limbo->count)
+        {
+            zdb_epoch_item *item = &limbo->items[limbo->first];
+
+            if(((epoch != 0) && !ZDB_EPOCH_BEFORE(item->epoch, epoch)) || (max == 0))
+            {
+                return;
+            }
+
+            max--;
+
+            item->callback(item->ptr);
+            limbo->first++;
+            zdb_epoch_limbo_pending--;
+        }
+
+        if(limbo->count < ZDB_EPOCH_LIMBO_CHUNK_SIZE)
+        {
+            /* the tail: keep it but reset it */
+            
+            limbo->first = 0;
+            limbo->count = 0;
+
+            return;
+        }
+
+        zdb_epoch_limbo_head = limbo->next;
+
+        if(zdb_epoch_limbo_head == NULL)
+        {
+            zdb_epoch_limbo_tail = NULL;
+        }
+
+        free(limbo);
+    }
+}
+
+void
+zdb_epoch_defer(zdb_epoch_free_callback *callback, void *ptr)
+{
+    mutex_lock(&zdb_epoch_limbo_mtx);
+
+    zdb_epoch_limbo *limbo = zdb_epoch_limbo_tail;
+
+    if((limbo == NULL) || (limbo->count == ZDB_EPOCH_LIMBO_CHUNK_SIZE))
+    {
+        MALLOC_OR_DIE(zdb_epoch_limbo*, limbo, sizeof(zdb_epoch_limbo), EPOCHLMB_TAG);
+        limbo->next = NULL;
+        limbo->first = 0;
+        limbo->count = 0;
+
+        if(zdb_epoch_limbo_tail != NULL)
+        {
+            zdb_epoch_limbo_tail->next = limbo;
+        }
+        else
+        {
+            zdb_epoch_limbo_head = limbo;
+        }
+
+        zdb_epoch_limbo_tail = limbo;
+    }
+
+    zdb_epoch_item *item = &limbo->items[limbo->count++];
+    item->callback = callback;
+    item->ptr = ptr;
+    item->epoch = zdb_epoch_global;
+
+    zdb_epoch_limbo_pending++;
+
+    mutex_unlock(&zdb_epoch_limbo_mtx);
+}
+
+u32
+zdb_epoch_reclaim()
+{
+    mutex_lock(&zdb_epoch_limbo_mtx);
+
+    if(zdb_epoch_limbo_pending > 0)
+    {
+        zdb_epoch_release_before(zdb_epoch_oldest_reader(), MAX_U32);
+    }
+
+    u32 pending = zdb_epoch_limbo_pending;
+
+    mutex_unlock(&zdb_epoch_limbo_mtx);
+
+    return pending;
+}
+
+void
+zdb_epoch_reclaim_bounded()
+{
+    if(zdb_epoch_limbo_pending < ZDB_EPOCH_RECLAIM_THRESHOLD)
+    {
+        return;
+    }
+    
+    /* another writer is already at it */
+    
+    if(mutex_trylock(&zdb_epoch_limbo_mtx) != 0)
+    {
+        return;
+    }
+    
+    zdb_epoch_release_before(zdb_epoch_oldest_reader(), ZDB_EPOCH_RECLAIM_MAX);
+    
+    mutex_unlock(&zdb_epoch_limbo_mtx);
+}
+
+void
+zdb_epoch_synchronize()
+{
+    u32 epoch = zdb_epoch_advance();
+
+    u32 mark = zdb_epoch_slots_mark;
+
+    for(u32 i = 0; i < mark; i++)
+    {
+        zdb_epoch_slot *slot = &zdb_epoch_slots[i];
+
+        for(;;)
+        {
+            u32 slot_epoch = slot->epoch;
+
+            if((slot_epoch == 0) || !ZDB_EPOCH_BEFORE(slot_epoch, epoch))
+            {
+                break;
+            }
+
+            sched_yield();
+        }
+    }
+
+    /* every item stamped before epoch can go now */
+
+    mutex_lock(&zdb_epoch_limbo_mtx);
+    zdb_epoch_release_before(epoch, MAX_U32);
+    mutex_unlock(&zdb_epoch_limbo_mtx);
+}
+
+void
+zdb_epoch_finalize()
+{
+    mutex_lock(&zdb_epoch_limbo_mtx);
+    zdb_epoch_release_before(0, MAX_U32);
+    
+    if(zdb_epoch_limbo_head != NULL)
+    {
+        free(zdb_epoch_limbo_head);
+        zdb_epoch_limbo_head = NULL;
+        zdb_epoch_limbo_tail = NULL;
+    }
+    
+    mutex_unlock(&zdb_epoch_limbo_mtx);
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
@@ -102,6 +102,8 @@ zdb_register_errors()
     error_register(ZDB_READER_MIXED_DNSSEC_VERSIONS, "ZDB_READER_MIXED_DNSSEC_VERSIONS");
     error_register(ZDB_READER_ALREADY_LOADED, "ZDB_READER_ALREADY_LOADED");
     
+    error_register(ZDB_ERROR_ZONE_CHANGED_DURING_AXFR, "ZDB_ERROR_ZONE_CHANGED_DURING_AXFR");
+    
     error_register(DNSSEC_ERROR_BASE, "DNSSEC_ERROR_BASE");
 
     error_register(DNSSEC_ERROR_NOENGINE, "DNSSEC_ERROR_NOENGINE");
@@ -125,6 +127,7 @@ zdb_register_errors()
     error_register(DNSSEC_ERROR_KEYISTOOBIG, "DNSSEC_ERROR_KEYISTOOBIG");
 
     error_register(DNSSEC_ERROR_RSASIGNATUREFAILED, "DNSSEC_ERROR_RSASIGNATUREFAILED");
+    error_register(DNSSEC_ERROR_ECDSASIGNATUREFAILED, "DNSSEC_ERROR_ECDSASIGNATUREFAILED");
 
     error_register(DNSSEC_ERROR_NSEC3_INVALIDZONESTATE, "DNSSEC_ERROR_NSEC3_INVALIDZONESTATE");
     error_register(DNSSEC_ERROR_NSEC3_LABELTODIGESTFAILED, "DNSSEC_ERROR_NSEC3_LABELTODIGESTFAILED");
@@ -47,8 +47,10 @@
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <dirent.h>
 
 #include "dnsdb/zdb_icmtl.h"
@@ -66,10 +68,14 @@
 #include <dnscore/file_input_stream.h>
 #include <dnscore/buffer_input_stream.h>
 #include <dnscore/buffer_output_stream.h>
+#include <dnscore/bytearray_output_stream.h>
+#include <dnscore/fdtools.h>
+#include <dnscore/ptr_vector.h>
 
 #include <dnscore/clone_input_output_stream.h>
 
-#include "dnsdb/icmtl_input_stream.h"
+#include "dnsdb/zdb_icmtl_index.h"
+#include "dnsdb/zdb_zone_snapshot.h"
 
 #include "dnsdb/dynupdate.h"
 
@@ -84,18 +90,23 @@
 #endif
 
 #define ICMTLNSA_TAG 0x41534e4c544d4349
+#define ICMTLSPL_TAG 0x4c50534c544d4349 /* ICMTLSPL */
+#define ICMTLSYN_TAG 0x4e59534c544d4349 /* ICMTLSYN */
 
 extern logger_handle* g_database_logger;
 #define MODULE_MSG_HANDLE g_database_logger
 
 #define ICMTL_REMOVE_TMP_FILE_FORMAT  "%s/%{dnsname}%08x.ir.tmp"
 #define ICMTL_ADD_TMP_FILE_FORMAT     "%s/%{dnsname}%08x.ia.tmp"
-#define ICMTL_SUMMARY_TMP_FILE_FORMAT "%s/%{dnsname}%08x.is.tmp"
 
 #define ICMTL_BUFFER_SIZE    4096
+#define ICMTL_COPY_BUFFER_SIZE 65536
 #define ICMTL_FILE_MODE      0600
 #define ICMTL_SOA_INCREMENT  1
 
+/* the changes are recorded in memory up to this size, then in a temporary file */
+#define ICMTL_SPILL_SIZE     0x100000
+
 static u32 icmtl_index_base = 0;
 
 static const u8 SOA_IN[4] = {0,6,0,1};
@@ -131,75 +142,578 @@ zdb_icmtl_skip_rdata(input_stream *is, u32 len)
 }
 
 static ya_result
-zdb_icmtl_rename_file(zdb_icmtl* icmtl, const char* fromf, const char* tof, const char* folder, u32 old_serial, u32 new_serial)
+zdb_icmtl_unlink_file(const char* name)
 {
-    ya_result return_code = SUCCESS;
+    ya_result err = SUCCESS;
+    
+    if(unlink(name) < 0)
+    {
+     
+        err = ERRNO_ERROR;
+        
+        log_err("journal: unable to delete '%s' : %r", name, err);
+    }
     
-    char old_name[1024];
-    char new_name[1024];
+    return err;
+}
+
+/*
+ * The changes are recorded in memory.  Past ICMTL_SPILL_SIZE bytes they are moved into a temporary file.
+ * This way most updates do not touch the disk before being appended to the journal.
+ */
 
-    snformat(old_name, sizeof (old_name), fromf, folder, icmtl->zone->origin, icmtl->patch_index);
-    snformat(new_name, sizeof (new_name), tof, folder, icmtl->zone->origin, old_serial, new_serial);
+typedef struct zdb_icmtl_spill_output_stream_data zdb_icmtl_spill_output_stream_data;
 
-    /** @todo: unlink */
-    if(rename(old_name, new_name) < 0)
+struct zdb_icmtl_spill_output_stream_data
+{
+    output_stream memory;
+    output_stream file;
+    u64 size;
+    bool spilled;
+    char path[1024];
+};
+
+static ya_result
+zdb_icmtl_spill_output_stream_write(output_stream* stream, const u8* buffer, u32 len)
+{
+    zdb_icmtl_spill_output_stream_data *data = (zdb_icmtl_spill_output_stream_data*)stream->data;
+    ya_result return_code;
+    
+    if(!data->spilled)
     {
-        /** @todo: log */
-        return_code = ERRNO_ERROR;
+        if(data->size + len <= ICMTL_SPILL_SIZE)
+        {
+            data->size += len;
+            
+            return output_stream_write(&data->memory, buffer, len);
+        }
+        
+        if(FAIL(return_code = file_output_stream_create(data->path, ICMTL_FILE_MODE, &data->file)))
+        {
+            log_err("journal: cannot create '%s': %r", data->path, return_code);
+            
+            return return_code;
+        }
+        
+        buffer_output_stream_init(&data->file, &data->file, ICMTL_BUFFER_SIZE);
+        
+        data->spilled = TRUE;
+        
+        if(FAIL(return_code = output_stream_write(&data->file, bytearray_output_stream_buffer(&data->memory), bytearray_output_stream_size(&data->memory))))
+        {
+            return return_code;
+        }
+        
+        bytearray_output_stream_reset(&data->memory);
     }
-
-    return return_code;
+    
+    data->size += len;
+    
+    return output_stream_write(&data->file, buffer, len);
 }
 
 static ya_result
-zdb_icmtl_unlink_file(const char* name)
+zdb_icmtl_spill_output_stream_flush(output_stream* stream)
 {
-    ya_result err = SUCCESS;
+    zdb_icmtl_spill_output_stream_data *data = (zdb_icmtl_spill_output_stream_data*)stream->data;
     
-    if(unlink(name) < 0)
+    if(data->spilled)
     {
-     
-        err = ERRNO_ERROR;
+        return output_stream_flush(&data->file);
+    }
+    
+    return SUCCESS;
+}
+
+static void
+zdb_icmtl_spill_output_stream_close(output_stream* stream)
+{
+    zdb_icmtl_spill_output_stream_data *data = (zdb_icmtl_spill_output_stream_data*)stream->data;
+    
+    output_stream_close(&data->memory);
+    
+    if(data->spilled)
+    {
+        output_stream_close(&data->file);
         
-        log_err("journal: unable to delete '%s' : %r", name, err);
+        zdb_icmtl_unlink_file(data->path);
     }
     
-    return err;
+    free(data);
+    
+    output_stream_set_void(stream);
 }
 
+static output_stream_vtbl zdb_icmtl_spill_output_stream_vtbl =
+{
+    zdb_icmtl_spill_output_stream_write,
+    zdb_icmtl_spill_output_stream_flush,
+    zdb_icmtl_spill_output_stream_close,
+    "zdb_icmtl_spill_output_stream",
+};
+
+static void
+zdb_icmtl_spill_output_stream_init(output_stream* stream, const char *path)
+{
+    zdb_icmtl_spill_output_stream_data *data;
+    
+    MALLOC_OR_DIE(zdb_icmtl_spill_output_stream_data*, data, sizeof(zdb_icmtl_spill_output_stream_data), ICMTLSPL_TAG);
+    
+    bytearray_output_stream_init_ex(NULL, 0, &data->memory, BYTEARRAY_DYNAMIC);
+    data->size = 0;
+    data->spilled = FALSE;
+    strcpy(data->path, path);
+    
+    stream->data = data;
+    stream->vtbl = &zdb_icmtl_spill_output_stream_vtbl;
+}
+
+/*
+ * Appends what has been recorded to the file, updating the checksum.
+ */
+
 static ya_result
-zdb_icmtl_unlink(zdb_icmtl* icmtl, const char* fmt, const char* folder, u32 old_serial, u32 new_serial)
+zdb_icmtl_spill_output_stream_copy(output_stream* stream, int fd, u64 *checksump)
+{
+    zdb_icmtl_spill_output_stream_data *data = (zdb_icmtl_spill_output_stream_data*)stream->data;
+    ya_result return_code;
+    
+    if(!data->spilled)
+    {
+        u8 *buffer = bytearray_output_stream_buffer(&data->memory);
+        u32 size = bytearray_output_stream_size(&data->memory);
+        
+        if(writefully(fd, buffer, size) != (ssize_t)size)
+        {
+            return ERRNO_ERROR;
+        }
+        
+        *checksump = zdb_zone_snapshot_checksum(*checksump, buffer, size);
+        
+        return SUCCESS;
+    }
+    
+    if(FAIL(return_code = output_stream_flush(&data->file)))
+    {
+        return return_code;
+    }
+    
+    int in_fd = open(data->path, O_RDONLY);
+    
+    if(in_fd < 0)
+    {
+        return ERRNO_ERROR;
+    }
+    
+    u8 *buffer;
+    
+    MALLOC_OR_DIE(u8*, buffer, ICMTL_COPY_BUFFER_SIZE, ICMTLSPL_TAG);
+    
+    return_code = SUCCESS;
+    
+    for(;;)
+    {
+        ssize_t n = readfully(in_fd, buffer, ICMTL_COPY_BUFFER_SIZE);
+        
+        if(n <= 0)
+        {
+            if(n < 0)
+            {
+                return_code = ERRNO_ERROR;
+            }
+            
+            break;
+        }
+        
+        *checksump = zdb_zone_snapshot_checksum(*checksump, buffer, n);
+        
+        if(writefully(fd, buffer, n) != n)
+        {
+            return_code = ERRNO_ERROR;
+            break;
+        }
+    }
+    
+    free(buffer);
+    
+    close_ex(in_fd);
+    
+    return return_code;
+}
+
+/*
+ * Group commit.
+ * 
+ * A committer alone syncs its journal (with its index, and the directory if the journal has just been
+ * created) by itself, right away.
+ * When other syncs are already pending or running, the journal is synced at most zdb_icmtl_sync_window ms
+ * later, by the sync thread: the committers wait for the batch holding their journal to be synced and all
+ * the commits made in the meantime are made durable by that one sync.
+ * With a window of 0, the journal is always synced by the committer.
+ */
+
+typedef struct zdb_icmtl_sync_item zdb_icmtl_sync_item;
+
+struct zdb_icmtl_sync_item
+{
+    u64 device;
+    u64 inode;
+    int fd;
+    bool directory;
+};
+
+static pthread_mutex_t zdb_icmtl_sync_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zdb_icmtl_sync_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t zdb_icmtl_sync_done_cond = PTHREAD_COND_INITIALIZER;
+static ptr_vector zdb_icmtl_sync_pending = EMPTY_PTR_VECTOR;
+static u64 zdb_icmtl_sync_batch = 1;    /* the batch being filled */
+static u64 zdb_icmtl_sync_done = 0;     /* the last batch synced */
+static struct timespec zdb_icmtl_sync_deadline;
+static pthread_t zdb_icmtl_sync_thread_id;
+static bool zdb_icmtl_sync_thread_started = FALSE;
+static bool zdb_icmtl_sync_thread_stop = FALSE;
+static u32 zdb_icmtl_sync_active = 0;   /* the syncs running : committers alone and the sync thread */
+static u32 zdb_icmtl_sync_window = ZDB_ICMTL_SYNC_WINDOW_DEFAULT;
+
+void
+zdb_icmtl_set_sync_window(u32 milliseconds)
+{
+    zdb_icmtl_sync_window = milliseconds;
+}
+
+static void
+zdb_icmtl_sync_fd(int fd, bool directory)
+{
+    if(((directory)?fsync(fd):fdatasync(fd)) < 0)
+    {
+        log_err("journal: sync failed: %r", ERRNO_ERROR);
+    }
+    
+    close_ex(fd);
+}
+
+static void*
+zdb_icmtl_sync_thread(void *args)
+{
+    pthread_mutex_lock(&zdb_icmtl_sync_mtx);
+    
+    for(;;)
+    {
+        if(zdb_icmtl_sync_pending.offset < 0)
+        {
+            if(zdb_icmtl_sync_thread_stop)
+            {
+                break;
+            }
+            
+            pthread_cond_wait(&zdb_icmtl_sync_cond, &zdb_icmtl_sync_mtx);
+            
+            continue;
+        }
+        
+        if(!zdb_icmtl_sync_thread_stop)
+        {
+            struct timespec now;
+            
+            clock_gettime(CLOCK_REALTIME, &now);
+            
+            if((now.tv_sec < zdb_icmtl_sync_deadline.tv_sec) ||
+               ((now.tv_sec == zdb_icmtl_sync_deadline.tv_sec) && (now.tv_nsec < zdb_icmtl_sync_deadline.tv_nsec)))
+            {
+                pthread_cond_timedwait(&zdb_icmtl_sync_cond, &zdb_icmtl_sync_mtx, &zdb_icmtl_sync_deadline);
+                
+                continue;
+            }
+        }
+        
+        ptr_vector batch = zdb_icmtl_sync_pending;
+        ptr_vector empty = EMPTY_PTR_VECTOR;
+        zdb_icmtl_sync_pending = empty;
+        
+        /* the commits from now on go to the next batch */
+        
+        u64 batch_id = zdb_icmtl_sync_batch++;
+        
+        zdb_icmtl_sync_active++;
+        
+        pthread_mutex_unlock(&zdb_icmtl_sync_mtx);
+        
+        /* the journals, then the directories naming them */
+        
+        for(int directories = 0; directories <= 1; directories++)
+        {
+            for(s32 i = 0; i <= batch.offset; i++)
+            {
+                zdb_icmtl_sync_item *item = (zdb_icmtl_sync_item*)ptr_vector_get(&batch, i);
+                
+                if(item->directory == (directories != 0))
+                {
+                    zdb_icmtl_sync_fd(item->fd, item->directory);
+                }
+            }
+        }
+        
+        for(s32 i = 0; i <= batch.offset; i++)
+        {
+            free(ptr_vector_get(&batch, i));
+        }
+        
+        ptr_vector_destroy(&batch);
+        
+        pthread_mutex_lock(&zdb_icmtl_sync_mtx);
+        
+        zdb_icmtl_sync_done = batch_id;
+        zdb_icmtl_sync_active--;
+        
+        pthread_cond_broadcast(&zdb_icmtl_sync_done_cond);
+    }
+    
+    pthread_mutex_unlock(&zdb_icmtl_sync_mtx);
+    
+    return NULL;
+}
+
+/*
+ * Adds a file to the batch being filled, unless it is already in it.
+ * Takes ownership of the fd.  The mutex is locked.
+ */
+
+static void
+zdb_icmtl_sync_enqueue(int fd, const struct stat *st, bool directory)
+{
+    for(s32 i = 0; i <= zdb_icmtl_sync_pending.offset; i++)
+    {
+        zdb_icmtl_sync_item *item = (zdb_icmtl_sync_item*)ptr_vector_get(&zdb_icmtl_sync_pending, i);
+        
+        if((item->device == (u64)st->st_dev) && (item->inode == (u64)st->st_ino))
+        {
+            /* that file is already waiting: its sync will cover these changes */
+            
+            close_ex(fd);
+            
+            return;
+        }
+    }
+    
+    zdb_icmtl_sync_item *item;
+    
+    MALLOC_OR_DIE(zdb_icmtl_sync_item*, item, sizeof(zdb_icmtl_sync_item), ICMTLSYN_TAG);
+    item->device = st->st_dev;
+    item->inode = st->st_ino;
+    item->fd = fd;
+    item->directory = directory;
+    
+    if(zdb_icmtl_sync_pending.offset < 0)
+    {
+        /* the window starts with the first journal waiting */
+        
+        clock_gettime(CLOCK_REALTIME, &zdb_icmtl_sync_deadline);
+        
+        zdb_icmtl_sync_deadline.tv_sec += zdb_icmtl_sync_window / 1000;
+        zdb_icmtl_sync_deadline.tv_nsec += (zdb_icmtl_sync_window % 1000) * 1000000;
+        
+        if(zdb_icmtl_sync_deadline.tv_nsec >= 1000000000)
+        {
+            zdb_icmtl_sync_deadline.tv_sec++;
+            zdb_icmtl_sync_deadline.tv_nsec -= 1000000000;
+        }
+        
+        pthread_cond_signal(&zdb_icmtl_sync_cond);
+    }
+    
+    ptr_vector_append(&zdb_icmtl_sync_pending, item);
+}
+
+/*
+ * Syncs the files (directories last) and closes them.
+ */
+
+static void
+zdb_icmtl_sync_fds(int *fds, bool *directories, int count)
+{
+    for(int directory = 0; directory <= 1; directory++)
+    {
+        for(int i = 0; i < count; i++)
+        {
+            if(directories[i] == (directory != 0))
+            {
+                zdb_icmtl_sync_fd(fds[i], directories[i]);
+            }
+        }
+    }
+}
+
+/*
+ * Takes ownership of the fd of a journal that has just been appended to, and of the fd of its index (-1 if none).
+ * folder is the directory of a journal that has just been created, NULL if it already existed.
+ * Returns once they have been synced.
+ */
+
+static void
+zdb_icmtl_sync(int fd, int index_fd, const char *folder)
+{
+    struct stat st[3];
+    int fds[3];
+    bool directories[3];
+    int count = 0;
+    
+    fds[count] = fd;
+    directories[count++] = FALSE;
+    
+    if(index_fd >= 0)
+    {
+        fds[count] = index_fd;
+        directories[count++] = FALSE;
+    }
+    
+    if(folder != NULL)
+    {
+        int dir_fd = open(folder, O_RDONLY|O_DIRECTORY);
+
+        if(dir_fd >= 0)
+        {
+            fds[count] = dir_fd;
+            directories[count++] = TRUE;
+        }
+        else
+        {
+            log_err("journal: cannot open '%s': %r", folder, ERRNO_ERROR);
+        }
+    }
+    
+    bool alone = (zdb_icmtl_sync_window == 0);
+    
+    for(int i = 0; (i < count) && !alone; i++)
+    {
+        alone = (fstat(fds[i], &st[i]) < 0);
+    }
+    
+    pthread_mutex_lock(&zdb_icmtl_sync_mtx);
+    
+    if(!alone)
+    {
+        /* nothing to share the sync with : waiting for the window would only delay the commit */
+        
+        alone = (zdb_icmtl_sync_pending.offset < 0) && (zdb_icmtl_sync_active == 0);
+    }
+    
+    if(!alone && !zdb_icmtl_sync_thread_started)
+    {
+        if(pthread_create(&zdb_icmtl_sync_thread_id, NULL, zdb_icmtl_sync_thread, NULL) == 0)
+        {
+            zdb_icmtl_sync_thread_started = TRUE;
+        }
+        else
+        {
+            log_err("journal: unable to start the sync thread");
+            
+            alone = TRUE;
+        }
+    }
+    
+    if(alone)
+    {
+        zdb_icmtl_sync_active++;
+        
+        pthread_mutex_unlock(&zdb_icmtl_sync_mtx);
+        
+        zdb_icmtl_sync_fds(fds, directories, count);
+        
+        pthread_mutex_lock(&zdb_icmtl_sync_mtx);
+        
+        zdb_icmtl_sync_active--;
+        
+        pthread_mutex_unlock(&zdb_icmtl_sync_mtx);
+        
+        return;
+    }
+    
+    for(int i = 0; i < count; i++)
+    {
+        zdb_icmtl_sync_enqueue(fds[i], &st[i], directories[i]);
+    }
+    
+    u64 batch_id = zdb_icmtl_sync_batch;
+    
+    while(zdb_icmtl_sync_done < batch_id)
+    {
+        pthread_cond_wait(&zdb_icmtl_sync_done_cond, &zdb_icmtl_sync_mtx);
+    }
+    
+    pthread_mutex_unlock(&zdb_icmtl_sync_mtx);
+}
+
+void
+zdb_icmtl_finalize()
 {
-    char new_name[1024];
+    pthread_mutex_lock(&zdb_icmtl_sync_mtx);
+    
+    bool started = zdb_icmtl_sync_thread_started;
     
-    snformat(new_name, sizeof (new_name), fmt, folder, icmtl->zone->origin, old_serial, new_serial);
+    zdb_icmtl_sync_thread_stop = TRUE;
+    
+    pthread_cond_signal(&zdb_icmtl_sync_cond);
+    
+    pthread_mutex_unlock(&zdb_icmtl_sync_mtx);
+    
+    if(started)
+    {
+        pthread_join(zdb_icmtl_sync_thread_id, NULL);
+    }
+    
+    zdb_icmtl_sync_thread_started = FALSE;
+    zdb_icmtl_sync_thread_stop = FALSE;
+    
+    zdb_icmtl_index_finalize();
+}
 
-    return zdb_icmtl_unlink_file(new_name);
+/*
+ * Gives the serial a journal found in the directory ends at.
+ * It has been appended to since it was named if the index knows it ends later.
+ */
+
+static u32
+zdb_icmtl_get_end(const u8 *origin, const char *folder, const char *name, u32 from, u32 to)
+{
+    char path[1024];
+    u32 end = to;
+    int fd;
+    
+    snprintf(path, sizeof(path), "%s/%s", folder, name);
+    
+    if((fd = open(path, O_RDONLY)) >= 0)
+    {
+        if(FAIL(zdb_icmtl_index_get_end(origin, folder, fd, from, to, &end)))
+        {
+            end = to;
+        }
+        
+        close_ex(fd);
+    }
+    
+    return end;
 }
 
 /**
  * 
  * Seek for the "ix" file that ends where the caller wants to start.
- * Renames the file, if found, to match its new content.
- * Opens the file for append.
  *
  */
 
 static ya_result
-zdb_icmtl_find_ix(zdb_icmtl* icmtl, const char* folder, u32 end_at_serial, u32 new_end_at_serial, output_stream* target_os)
+zdb_icmtl_find_ix(const u8 *origin, const char* folder, u32 end_at_serial, u32 *fromp, u32 *name_top)
 {
     struct dirent entry;
     struct dirent *result;
     u32 from;
     u32 to;
-    ya_result return_code = ERROR;
+    ya_result return_code = ZDB_ERROR_ICMTL_NOTFOUND;
 
-    char name[1024];
     char fqdn[MAX_DOMAIN_LENGTH + 1];
 
     /* returns the number of bytes = strlen(x) + 1 */
 
-    s32 fqdn_len = dnsname_to_cstr(fqdn, icmtl->zone->origin) - 1 ;
+    s32 fqdn_len = dnsname_to_cstr(fqdn, origin) - 1 ;
     
     DIR* dir = opendir(folder);
     if(dir != NULL)
@@ -234,29 +748,17 @@ zdb_icmtl_find_ix(zdb_icmtl* icmtl, const char* folder, u32 end_at_serial, u32 n
 
                             if(converted == 2)
                             {
-                                if(to == end_at_serial)
+                                /* the name may be older than the last changes appended */
+                                
+                                if((to == end_at_serial) ||
+                                   (serial_lt(to, end_at_serial) && serial_gt(end_at_serial, from) && (zdb_icmtl_get_end(origin, folder, result->d_name, from, to) == end_at_serial)))
                                 {
-                                    snprintf(name, sizeof(name), "%s/%s", folder, result->d_name);
-
-                                    return_code = file_output_stream_open_ex(name, O_WRONLY|O_APPEND, ICMTL_FILE_MODE, target_os);
-
-                                    if(ISOK(return_code))
-                                    {
-                                        char new_name[1024];
-
-                                        snformat(new_name, sizeof (new_name), ICMTL_WIRE_FILE_FORMAT, folder, icmtl->zone->origin, from, new_end_at_serial);
-
-                                        if(rename(name, new_name) < 0)
-                                        {
-                                            output_stream_close(target_os);
-                                            
-                                            /** @todo: log */
-
-                                            return_code = ERRNO_ERROR;
-                                        }
-                                        
-                                        break;
-                                    }
+                                    *fromp = from;
+                                    *name_top = to;
+                                    
+                                    return_code = SUCCESS;
+                                    
+                                    break;
                                 }
                             }
                         }
@@ -271,27 +773,38 @@ zdb_icmtl_find_ix(zdb_icmtl* icmtl, const char* folder, u32 end_at_serial, u32 n
     return return_code;
 }
 
-ya_result
-zdb_icmtl_open_ix(const u8 *origin, const char *folder, u32 serial, input_stream *target_is, u32 *serial_limit, char** out_file_name)
+/*
+ * Opens the journal holding the serial.
+ * The index knows the name of the journal, else it is looked for in the directory.
+ */
+
+static ya_result
+zdb_icmtl_open_ix_range(const u8 *origin, const char *folder, u32 serial, input_stream *target_is, u32 *fromp, u32 *top, u32 *name_top, char *out_name, size_t out_name_size)
 {
     struct dirent entry;
     struct dirent *result;
     DIR* dir;
     u32 from;
     u32 to;
+    u32 name_to;
     u32 fqdn_len;
     ya_result return_code = ERROR;
     char name[1024];
 
-#ifndef NDEBUG
-    log_debug("journal: zdb_icmtl_open_ix(%{dnsname}, %s, %08x, %p, &%x, %p)", origin, folder, serial, target_is, (serial_limit!=NULL)?*serial_limit:0, out_file_name);
-#endif
-
-    if(out_file_name != NULL)
+    if(zdb_icmtl_index_get_range(origin, folder, &from, &to, &name_to) && serial_ge(serial, from) && serial_lt(serial, to))
     {
-        *out_file_name = NULL;
+        snformat(out_name, out_name_size, ICMTL_WIRE_FILE_FORMAT, folder, origin, from, name_to);
+        
+        if(ISOK(return_code = file_input_stream_open(out_name, target_is)))
+        {
+            *fromp = from;
+            *top = to;
+            *name_top = name_to;
+            
+            return return_code;
+        }
     }
-
+    
     dir = opendir(folder);
     
     if(dir != NULL)
@@ -332,6 +845,15 @@ zdb_icmtl_open_ix(const u8 *origin, const char *folder, u32 serial, input_stream
 
                             if(converted == 2)
                             {
+                                name_to = to;
+                                
+                                /* the name may be older than the last changes appended */
+                                
+                                if(serial_ge(serial, from) && serial_ge(serial, to))
+                                {
+                                    to = zdb_icmtl_get_end(origin, folder, result->d_name, from, name_to);
+                                }
+                                
                                 /*
                                  * check if from <= serial <= to
                                  */
@@ -341,21 +863,15 @@ zdb_icmtl_open_ix(const u8 *origin, const char *folder, u32 serial, input_stream
                                     /*
                                      * We are in range
                                      */
-                                    snprintf(name, sizeof(name), "%s/%s", folder, result->d_name);
+                                    snprintf(out_name, out_name_size, "%s/%s", folder, result->d_name);
 
-                                    return_code = file_input_stream_open(name, target_is);
+                                    return_code = file_input_stream_open(out_name, target_is);
 
                                     if(ISOK(return_code))
                                     {
-                                        if(serial_limit != NULL)
-                                        {
-                                            *serial_limit = to;
-                                        }
-                                        
-                                        if(out_file_name != NULL)
-                                        {
-                                            *out_file_name = strdup(name);
-                                        }
+                                        *fromp = from;
+                                        *top = to;
+                                        *name_top = name_to;
 
                                         break;
                                     }
@@ -394,6 +910,60 @@ zdb_icmtl_open_ix(const u8 *origin, const char *folder, u32 serial, input_stream
     return return_code;
 }
 
+ya_result
+zdb_icmtl_open_ix(const u8 *origin, const char *folder, u32 serial, input_stream *target_is, u32 *serial_limit, char** out_file_name)
+{
+    ya_result return_code;
+    u32 from;
+    u32 to;
+    u32 name_to;
+    char name[1024];
+
+#ifndef NDEBUG
+    log_debug("journal: zdb_icmtl_open_ix(%{dnsname}, %s, %08x, %p, &%x, %p)", origin, folder, serial, target_is, (serial_limit!=NULL)?*serial_limit:0, out_file_name);
+#endif
+
+    if(out_file_name != NULL)
+    {
+        *out_file_name = NULL;
+    }
+
+    if(ISOK(return_code = zdb_icmtl_open_ix_range(origin, folder, serial, target_is, &from, &to, &name_to, name, sizeof(name))))
+    {
+        if(serial_limit != NULL)
+        {
+            *serial_limit = to;
+        }
+
+        if(out_file_name != NULL)
+        {
+            *out_file_name = strdup(name);
+        }
+    }
+
+    return return_code;
+}
+
+/*
+ * Moves the stream to the changes starting from the serial, found in the index of the journal.
+ * If they cannot be found, the stream is not moved and the caller scans the journal.
+ */
+
+static void
+zdb_icmtl_seek_serial(const u8 *origin, const char *folder, input_stream *is, u32 journal_from, u32 journal_to, u32 serial)
+{
+    u64 offset;
+    
+    if(is_fd_input_stream(is))
+    {
+        int fd = fd_input_stream_get_filedescriptor(is);
+        
+        if(ISOK(zdb_icmtl_index_find(origin, folder, fd, journal_from, journal_to, serial, &offset)))
+        {
+            fd_input_stream_seek(is, offset);
+        }
+    }
+}
 
 ya_result
 zdb_icmtl_skip_until(input_stream *is, zdb_zone *zone)
@@ -632,18 +1202,24 @@ ya_result
 zdb_icmtl_open_ix_get_soa(const u8 *origin, const char *directory, u32 serial, input_stream *is, struct type_class_ttl_rdlen *tctrp, u8 *rdata_buffer_780, u32 *rdata_sizep)
 {
     ya_result return_code;
+    u32 from;
+    u32 to;
+    u32 name_to;
     
     u8 fqdn[256];
+    char name[1024];
     
-    if(FAIL(return_code = zdb_icmtl_open_ix(origin, directory, serial, is, NULL, NULL)))
+    if(FAIL(return_code = zdb_icmtl_open_ix_range(origin, directory, serial, is, &from, &to, &name_to, name, sizeof(name))))
     {
         return return_code;
     }
 
     /*
-     * This is for the next step : synchronize on the right SOA in the middle of the journal file.
+     * Synchronize on the right SOA in the middle of the journal file.
      */
 
+    zdb_icmtl_seek_serial(origin, directory, is, from, name_to, serial);
+
     /*
      * Get the SOA matching the serial we want
      */
@@ -757,7 +1333,12 @@ zdb_icmtl_replay(zdb_zone *zone, const char* directory, u64 serial_offset, u32 u
         log_info("journal: %{dnsname}: trying to replay from serial %u (%s)",zone->origin, serial, directory);
     }
            
-    if(FAIL(return_code = zdb_icmtl_open_ix(zone->origin, directory, serial , &is, NULL, NULL)))
+    u32 journal_from;
+    u32 journal_to;
+    u32 journal_name_to;
+    char journal_name[1024];
+    
+    if(FAIL(return_code = zdb_icmtl_open_ix_range(zone->origin, directory, serial, &is, &journal_from, &journal_to, &journal_name_to, journal_name, sizeof(journal_name))))
     {
         /*
          * This error code only means there were no relevant IX files.
@@ -788,6 +1369,10 @@ zdb_icmtl_replay(zdb_zone *zone, const char* directory, u64 serial_offset, u32 u
             fd_input_stream_seek(&is, serial_offset);
         }
     }
+    else
+    {
+        zdb_icmtl_seek_serial(zone->origin, directory, &is, journal_from, journal_name_to, serial);
+    }
 
     buffer_input_stream_init(&is, &is, 4096);
 
@@ -1346,40 +1931,6 @@ zdb_icmtl_get_last_serial_from(u32 serial, u8 *origin, const char* directory, u3
     return return_code;
 }
 
-static ya_result
-zdb_icmtl_unlink_remove(zdb_icmtl* icmtl, const char* folder)
-{
-    char tmp_name[1024];
-    
-    ya_result return_code;
-    
-    if(FAIL(return_code = snformat(tmp_name, sizeof (tmp_name), ICMTL_REMOVE_TMP_FILE_FORMAT, folder, icmtl->zone->origin, icmtl->patch_index)))
-    {
-        log_err("incremental: error making 'remove' tmp file name: %r", return_code);
-    }
-
-    unlink(tmp_name);
-    
-    return return_code;
-}
-
-static ya_result
-zdb_icmtl_unlink_add(zdb_icmtl* icmtl, const char* folder)
-{
-    char tmp_name[1024];
-    
-    ya_result return_code;
-    
-    if(FAIL(return_code = snformat(tmp_name, sizeof (tmp_name), ICMTL_ADD_TMP_FILE_FORMAT, folder, icmtl->zone->origin, icmtl->patch_index)))
-    {
-        log_err("incremental: error making 'remove' tmp file name: %r", return_code);
-    }
-
-    unlink(tmp_name);
-    
-    return return_code;
-}
-
 ya_result
 zdb_icmtl_get_last_soa_from(u32 serial, u8 *origin, const char* directory, u32 *last_serial, u32 *ttl, u16 *rdata_size, u8 *rdata)
 {
@@ -1521,6 +2072,8 @@ zdb_icmtl_begin(zdb_zone* zone, zdb_icmtl* icmtl, const char* folder)
     
     if(FAIL(return_code = xfr_copy_make_data_path(folder, zone->origin, data_path, sizeof(data_path))))
     {
+        UNICITY_RELEASE(icmtl);
+        
         return return_code;
     }
     
@@ -1532,116 +2085,318 @@ zdb_icmtl_begin(zdb_zone* zone, zdb_icmtl* icmtl, const char* folder)
     }
 
     icmtl->patch_index = icmtl_index_base++;
+    
+    zdb_packed_ttlrdata* soa = zdb_record_find(&zone->apex->resource_record_set, TYPE_SOA);
+    
+    if(soa == NULL)
+    {
+        log_err("journal: no soa found at %{dnsname}", zone->origin);
+        
+        UNICITY_RELEASE(icmtl);
+        
+        return ZDB_ERROR_NOSOAATAPEX;
+    }
 
-    if(ISOK(return_code = snformat(remove_name, sizeof(remove_name), ICMTL_REMOVE_TMP_FILE_FORMAT, folder, zone->origin, icmtl->patch_index)))
+    /* the names of the temporary files, only used for big changes */
+    
+    if(FAIL(return_code = snformat(remove_name, sizeof(remove_name), ICMTL_REMOVE_TMP_FILE_FORMAT, folder, zone->origin, icmtl->patch_index)) ||
+       FAIL(return_code = snformat(add_name, sizeof(add_name), ICMTL_ADD_TMP_FILE_FORMAT, folder, zone->origin, icmtl->patch_index)))
     {
-        if(ISOK(return_code = file_output_stream_create(remove_name, ICMTL_FILE_MODE, &icmtl->os_remove_)))
-        {
-            buffer_output_stream_init(&icmtl->os_remove_, &icmtl->os_remove_, ICMTL_BUFFER_SIZE);
-            counter_output_stream_init(&icmtl->os_remove_, &icmtl->os_remove, &icmtl->os_remove_stats);
+        UNICITY_RELEASE(icmtl);
+        
+        return return_code;
+    }
+    
+    zdb_icmtl_spill_output_stream_init(&icmtl->os_remove_, remove_name);
+    counter_output_stream_init(&icmtl->os_remove_, &icmtl->os_remove, &icmtl->os_remove_stats);
+    
+    zdb_icmtl_spill_output_stream_init(&icmtl->os_add_, add_name);
+    counter_output_stream_init(&icmtl->os_add_, &icmtl->os_add, &icmtl->os_add_stats);
 
-            if(ISOK(return_code = snformat(add_name, sizeof(add_name), ICMTL_ADD_TMP_FILE_FORMAT, folder, zone->origin, icmtl->patch_index)))
-            {
-                if(ISOK(return_code = file_output_stream_create(add_name, ICMTL_FILE_MODE, &icmtl->os_add_)))
-                {
-                    buffer_output_stream_init(&icmtl->os_add_, &icmtl->os_add_, ICMTL_BUFFER_SIZE);
-                    counter_output_stream_init(&icmtl->os_add_, &icmtl->os_add, &icmtl->os_add_stats);
+    dynupdate_icmtlhook_enable(zone->origin, &icmtl->os_remove, &icmtl->os_add);
 
-                    dynupdate_icmtlhook_enable(zone->origin, &icmtl->os_remove, &icmtl->os_add);
+    icmtl->zone = zone;
+    icmtl->serial_increment = ICMTL_SOA_INCREMENT;
 
-                    icmtl->zone = zone;
+    /* After this call, the database can be edited. */
 
-                    /* After this call, the database can be edited. */
-                    
-                    zdb_packed_ttlrdata* soa = zdb_record_find(&zone->apex->resource_record_set, TYPE_SOA);    
-                    
-                    if(soa != NULL)
-                    {
-                        icmtl->soa_ttl = soa->ttl;                    
-                        icmtl->soa_rdata_size  = ZDB_PACKEDRECORD_PTR_RDATASIZE(soa);
-                        memcpy(icmtl->soa_rdata, ZDB_PACKEDRECORD_PTR_RDATAPTR(soa), ZDB_PACKEDRECORD_PTR_RDATASIZE(soa));
-                    }
-                    else
-                    {
-                        output_stream_close(&icmtl->os_remove);
-                        output_stream_close(&icmtl->os_add);
-                        
-                        unlink(remove_name);
-                        unlink(add_name);
-                        
-                        log_err("journal: no soa found at %{dnsname}", zone->origin);
-                        
-                        return_code = ZDB_ERROR_NOSOAATAPEX;
-                    }
-                }
-                else
+    icmtl->soa_ttl = soa->ttl;
+    icmtl->soa_rdata_size  = ZDB_PACKEDRECORD_PTR_RDATASIZE(soa);
+    memcpy(icmtl->soa_rdata, ZDB_PACKEDRECORD_PTR_RDATAPTR(soa), ZDB_PACKEDRECORD_PTR_RDATASIZE(soa));
+
+    return SUCCESS;
+}
+
+static void
+output_stream_write_packed_ttlrdata(output_stream* os, u8* origin, u16 type, zdb_packed_ttlrdata* record)
+{
+    output_stream_write_dnsname(os, origin);
+    output_stream_write_u16(os, type); /** @note NATIVETYPE */
+    output_stream_write_u16(os, CLASS_IN); /** @note NATIVECLASS */
+    output_stream_write_nu32(os, record->ttl);
+    output_stream_write_nu16(os, record->rdata_size);
+    output_stream_write(os, &record->rdata_start[0], record->rdata_size);
+}
+
+static ya_result
+zdb_icmtl_close(zdb_icmtl* icmtl)
+{
+    dynupdate_icmtlhook_disable();
+    
+    output_stream_close(&icmtl->os_remove);
+    output_stream_close(&icmtl->os_remove_);
+    output_stream_close(&icmtl->os_add);
+    output_stream_close(&icmtl->os_add_);
+
+    UNICITY_RELEASE(icmtl);
+    
+    return SUCCESS;
+}
+
+static u32
+zdb_icmtl_soa_to_wire(u8 *buffer, const u8 *origin, u32 ttl, const u8 *rdata, u16 rdata_size)
+{
+    u32 origin_len = dnsname_len(origin);
+    
+    memcpy(buffer, origin, origin_len);
+    
+    u8 *p = &buffer[origin_len];
+    
+    SET_U16_AT(p[0], TYPE_SOA); /** @note NATIVETYPE */
+    SET_U16_AT(p[2], CLASS_IN); /** @note NATIVECLASS */
+    SET_U32_AT(p[4], htonl(ttl));
+    SET_U16_AT(p[8], htons(rdata_size));
+    memcpy(&p[10], rdata, rdata_size);
+    
+    return origin_len + 10 + rdata_size;
+}
+
+static ya_result
+zdb_icmtl_writev_fully(int fd, struct iovec *iov, int iovcnt)
+{
+    while(iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt);
+        
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            
+            return ERRNO_ERROR;
+        }
+        
+        while((iovcnt > 0) && ((size_t)n >= iov->iov_len))
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (u8*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    
+    return SUCCESS;
+}
+
+/*
+ * Writes the changes at the end of the journal : old SOA, removed records, new SOA, added records.
+ * Unless the changes did not fit in memory, it is done with one write.
+ */
+
+static ya_result
+zdb_icmtl_write_delta(zdb_icmtl* icmtl, int fd, u8 *old_soa, u32 old_soa_size, u8 *new_soa, u32 new_soa_size, u64 *sizep, u64 *checksump)
+{
+    zdb_icmtl_spill_output_stream_data *removed = (zdb_icmtl_spill_output_stream_data*)icmtl->os_remove_.data;
+    zdb_icmtl_spill_output_stream_data *added = (zdb_icmtl_spill_output_stream_data*)icmtl->os_add_.data;
+    ya_result return_code;
+    u64 checksum = 0;
+    
+    *sizep = old_soa_size + removed->size + new_soa_size + added->size;
+    
+    if(!removed->spilled && !added->spilled)
+    {
+        struct iovec iov[4];
+        
+        iov[0].iov_base = old_soa;
+        iov[0].iov_len = old_soa_size;
+        iov[1].iov_base = bytearray_output_stream_buffer(&removed->memory);
+        iov[1].iov_len = bytearray_output_stream_size(&removed->memory);
+        iov[2].iov_base = new_soa;
+        iov[2].iov_len = new_soa_size;
+        iov[3].iov_base = bytearray_output_stream_buffer(&added->memory);
+        iov[3].iov_len = bytearray_output_stream_size(&added->memory);
+        
+        for(int i = 0; i < 4; i++)
+        {
+            checksum = zdb_zone_snapshot_checksum(checksum, (const u8*)iov[i].iov_base, iov[i].iov_len);
+        }
+        
+        return_code = zdb_icmtl_writev_fully(fd, iov, 4);
+    }
+    else
+    {
+        return_code = ERRNO_ERROR;
+        
+        if(writefully(fd, old_soa, old_soa_size) == (ssize_t)old_soa_size)
+        {
+            checksum = zdb_zone_snapshot_checksum(checksum, old_soa, old_soa_size);
+            
+            if(ISOK(return_code = zdb_icmtl_spill_output_stream_copy(&icmtl->os_remove_, fd, &checksum)))
+            {
+                return_code = ERRNO_ERROR;
+                
+                if(writefully(fd, new_soa, new_soa_size) == (ssize_t)new_soa_size)
                 {
-                    output_stream_close(&icmtl->os_remove);
-                    unlink(remove_name);
+                    checksum = zdb_zone_snapshot_checksum(checksum, new_soa, new_soa_size);
+                    
+                    return_code = zdb_icmtl_spill_output_stream_copy(&icmtl->os_add_, fd, &checksum);
                 }
             }
         }
     }
-
-    if(FAIL(return_code))
-    {
-        UNICITY_RELEASE(icmtl);
-    }
-
+    
+    *checksump = checksum;
+    
     return return_code;
 }
 
-static void
-output_stream_write_packed_ttlrdata(output_stream* os, u8* origin, u16 type, zdb_packed_ttlrdata* record)
-{
-    output_stream_write_dnsname(os, origin);
-    output_stream_write_u16(os, type); /** @note NATIVETYPE */
-    output_stream_write_u16(os, CLASS_IN); /** @note NATIVECLASS */
-    output_stream_write_nu32(os, record->ttl);
-    output_stream_write_nu16(os, record->rdata_size);
-    output_stream_write(os, &record->rdata_start[0], record->rdata_size);
-}
+/*
+ * Appends the changes to the journal ending at the old serial, in place : the journal keeps the name it was
+ * created with and its index knows where it ends.
+ * The journal is found through its index, else in the directory, else it is created.
+ */
 
 static ya_result
-zdb_icmtl_close(zdb_icmtl* icmtl, const char* folder)
+zdb_icmtl_append(zdb_icmtl* icmtl, const char* folder, zdb_packed_ttlrdata* soa, u32 old_serial, u32 new_serial)
 {
+    const u8 *origin = icmtl->zone->origin;
+    zdb_icmtl_index_entry entry;
     ya_result return_code;
-    char data_path[1024];
+    u32 from;
+    u32 to;
+    u32 name_to;
+    int fd = -1;
     
-    dynupdate_icmtlhook_disable();
+    char name[1024];
+    u8 old_soa[MAX_DOMAIN_LENGTH + 10 + 532];
+    u8 new_soa[MAX_DOMAIN_LENGTH + 10 + 532];
     
-    output_stream_close(&icmtl->os_remove);
-    output_stream_close(&icmtl->os_remove_);
-    output_stream_close(&icmtl->os_add);
-    output_stream_close(&icmtl->os_add_);
+    if(zdb_icmtl_index_get_range(origin, folder, &from, &to, &name_to) && (to == old_serial))
+    {
+        snformat(name, sizeof(name), ICMTL_WIRE_FILE_FORMAT, folder, origin, from, name_to);
+        
+        fd = open(name, O_RDWR|O_APPEND);
+    }
     
-    if(FAIL(return_code = xfr_copy_get_data_path(folder, icmtl->zone->origin, data_path, sizeof(data_path))))
+    if((fd < 0) && ISOK(zdb_icmtl_find_ix(origin, folder, old_serial, &from, &name_to)))
+    {
+        snformat(name, sizeof(name), ICMTL_WIRE_FILE_FORMAT, folder, origin, from, name_to);
+        
+        fd = open(name, O_RDWR|O_APPEND);
+    }
+    
+    bool new_journal = (fd < 0);
+    
+    if(new_journal)
+    {
+        /**
+         * @Note: if the original serial from the zone file is older than the start of the returned file,
+         *        we MUST store the zone on disk ASAP and cut the journal.
+         */
+        
+        from = old_serial;
+        name_to = new_serial;
+        
+        snformat(name, sizeof(name), ICMTL_WIRE_FILE_FORMAT, folder, origin, old_serial, new_serial);
+        
+        if((fd = open(name, O_RDWR|O_APPEND|O_CREAT|O_TRUNC, ICMTL_FILE_MODE)) < 0)
+        {
+            return_code = ERRNO_ERROR;
+            
+            log_err("journal: cannot create '%s': %r", name, return_code);
+            
+            return return_code;
+        }
+    }
+    
+#ifndef NDEBUG
+    log_debug("journal: appending changes from %u to %u to '%s'", old_serial, new_serial, name);
+#endif
+    
+    if(FAIL(return_code = zdb_icmtl_index_prepare_append(origin, folder, fd, from, name_to, &entry.offset)))
     {
+        log_err("journal: cannot append to '%s': %r", name, return_code);
+        
+        close_ex(fd);
+        
         return return_code;
     }
-
-    folder = data_path;
     
-    zdb_icmtl_unlink_remove(icmtl, folder);
-    zdb_icmtl_unlink_add(icmtl, folder);
-
-    UNICITY_RELEASE(icmtl);
+    icmtl->file_size_before_append = entry.offset;
+    icmtl->file_size_after_append = entry.offset;
     
-    return SUCCESS;
+    u32 old_soa_size = zdb_icmtl_soa_to_wire(old_soa, origin, icmtl->soa_ttl, icmtl->soa_rdata, icmtl->soa_rdata_size);
+    u32 new_soa_size = zdb_icmtl_soa_to_wire(new_soa, origin, soa->ttl, &soa->rdata_start[0], soa->rdata_size);
+    
+    entry.serial_from = old_serial;
+    entry.serial_to = new_serial;
+    
+    if(FAIL(return_code = zdb_icmtl_write_delta(icmtl, fd, old_soa, old_soa_size, new_soa, new_soa_size, &entry.size, &entry.checksum)))
+    {
+        log_err("journal: appending changes from %u to %u to '%s' failed: %r", old_serial, new_serial, name, return_code);
+        
+        zdb_icmtl_index_append(origin, folder, NULL);
+        
+        if(new_journal)
+        {
+            close_ex(fd);
+            
+            zdb_icmtl_unlink_file(name);
+        }
+        else
+        {
+            /* the journal is cut back to its last complete changes */
+            
+            if(ftruncate(fd, entry.offset) < 0)
+            {
+                log_err("journal: current journal has been partially modified and should be cut at size %lld", entry.offset);
+                
+                /**
+                 * @TODO: disable dynamic updates globally: SERVFAIL
+                 */
+                
+                log_err("journal: CRITICAL ERROR. UPDATES DISABLED. UNABLE TO UPDATE ANYMORE: INVESTIGATE, FIX, RESTART.");
+            }
+            
+            close_ex(fd);
+        }
+        
+        return return_code;
+    }
+    
+    icmtl->file_size_after_append = entry.offset + entry.size;
+    
+    zdb_icmtl_index_append(origin, folder, &entry);
+    
+    /* the directory only changed if the journal has just been created */
+    
+    zdb_icmtl_sync(fd, zdb_icmtl_index_dup_file(origin), (new_journal)?folder:NULL);
+    
+    return return_code;
 }
 
 ya_result
 zdb_icmtl_end(zdb_icmtl* icmtl, const char* folder)
 {
-    output_stream icmtl_out;
-
     ya_result return_code;
 
-    char remove_tmp_name[1024];
-    char add_tmp_name[1024];
-    char summary_tmp_name[1024];
-    char wire_name[1024];
-    char buffer[1024];
     char data_path[1024];
     
     icmtl->file_size_before_append = 0;
@@ -1652,21 +2407,14 @@ zdb_icmtl_end(zdb_icmtl* icmtl, const char* folder)
     
     if(soa == NULL)
     {
-        /** @todo: files are useless: remove the icmtlr & icmtla files that have just been closed */
-        
-        zdb_icmtl_close(icmtl, folder);
+        zdb_icmtl_close(icmtl);
 
         return ZDB_ERROR_NOSOAATAPEX;
     }
     
     if(FAIL(return_code = xfr_copy_get_data_path(folder, icmtl->zone->origin, data_path, sizeof(data_path))))
     {
-        dynupdate_icmtlhook_disable();
-    
-        output_stream_close(&icmtl->os_remove);
-        output_stream_close(&icmtl->os_remove_);
-        output_stream_close(&icmtl->os_add);
-        output_stream_close(&icmtl->os_add_);
+        zdb_icmtl_close(icmtl);
     
         return return_code;
     }
@@ -1690,7 +2438,7 @@ zdb_icmtl_end(zdb_icmtl* icmtl, const char* folder)
     // soa changed => no
     // no bytes written => no
     
-    u32 written = icmtl->os_add_stats.writed_count + icmtl->os_remove_stats.writed_count;
+    u64 written = icmtl->os_add_stats.writed_count + icmtl->os_remove_stats.writed_count;
     
     bool must_increment_serial;
     
@@ -1702,7 +2450,9 @@ zdb_icmtl_end(zdb_icmtl* icmtl, const char* folder)
     {
         if(written == 0)
         {
-            zdb_icmtl_close(icmtl, folder);
+            log_info("incremental: no change registered.");
+            
+            zdb_icmtl_close(icmtl);
 
             return return_code;
         }
@@ -1712,7 +2462,7 @@ zdb_icmtl_end(zdb_icmtl* icmtl, const char* folder)
     
     if(must_increment_serial)
     {
-        rr_soa_increase_serial(&soa->rdata_start[0], soa->rdata_size, ICMTL_SOA_INCREMENT);
+        rr_soa_increase_serial(&soa->rdata_start[0], soa->rdata_size, icmtl->serial_increment);
     }
 
 #if ZDB_DNSSEC_SUPPORT != 0
@@ -1794,271 +2544,26 @@ zdb_icmtl_end(zdb_icmtl* icmtl, const char* folder)
     
     dynupdate_icmtlhook_disable();
 
-    output_stream_close(&icmtl->os_remove);
-    output_stream_close(&icmtl->os_remove_);
-    output_stream_close(&icmtl->os_add);
-    output_stream_close(&icmtl->os_add_);
+    output_stream_flush(&icmtl->os_remove);
+    output_stream_flush(&icmtl->os_add);
 
     /*
      * The main work is done.
      *
-     * I have yet to store the previous (current) SOA and all its signatures
-     * Then I have to increment the serial, store the new SOA, sign it in this
-     * very thread and store the signature(s)
-     *
-     * This last storage part has to be done in the file called "tmp_name"
+     * The previous (current) SOA, the removed records, the new SOA and the added records
+     * are now appended to the journal.
      */
-    
-    if(FAIL(return_code = snformat(remove_tmp_name, sizeof(remove_tmp_name), ICMTL_REMOVE_TMP_FILE_FORMAT, folder, icmtl->zone->origin, icmtl->patch_index)))
-    {
-        log_err("incremental: error making 'remove' tmp file name: %r", return_code);
-
-        UNICITY_RELEASE(icmtl);
-
-        return return_code;
-    }
-    
-    struct stat file_stat;
-    if(stat(remove_tmp_name, &file_stat) < 0)
-    {
-        log_err("incremental: unable to stat '%s': %r", remove_tmp_name, return_code);
-
-        UNICITY_RELEASE(icmtl);
-
-        return ERRNO_ERROR;
-    }
-
-    /**/
-    
-    if(FAIL(return_code = snformat(add_tmp_name, sizeof(add_tmp_name), ICMTL_ADD_TMP_FILE_FORMAT, folder, icmtl->zone->origin, icmtl->patch_index)))
-    {
-        log_err("incremental: error making 'add' tmp file name: %r", return_code);
-
-        UNICITY_RELEASE(icmtl);
-
-        return return_code;
-    }
-
-    off_t total_size = file_stat.st_size;
-
-    if(stat(add_tmp_name, &file_stat) < 0)
-    {
-        log_err("incremental: unable to stat '%s': %r", add_tmp_name, return_code);
-
-        UNICITY_RELEASE(icmtl);
-
-        return ERRNO_ERROR;
-    }
-
-    total_size += file_stat.st_size;    /* size of the incremental 'added' and 'removed' files */
-
-    if(!soa_changed && (total_size == 0))
-    {
-        log_info("incremental: no change registered.");
-
-        zdb_icmtl_unlink_file(remove_tmp_name);
-        zdb_icmtl_unlink_file(add_tmp_name);
-
-        UNICITY_RELEASE(icmtl);
-
-        return SUCCESS;
-    }
-
-    if(FAIL(return_code = snformat(summary_tmp_name, sizeof(summary_tmp_name), ICMTL_SUMMARY_TMP_FILE_FORMAT, folder, icmtl->zone->origin, icmtl->patch_index)))
-    {
-        log_err("incremental: error making summary file name: %r", return_code);
-
-        UNICITY_RELEASE(icmtl);
-
-        return return_code;
-    }
-
-    if(FAIL(return_code = file_output_stream_create(summary_tmp_name, ICMTL_FILE_MODE, &icmtl_out)))
-    {
-        log_err("incremental: error creating file '%s': %r", summary_tmp_name, return_code);
-        
-        UNICITY_RELEASE(icmtl);
-
-        return return_code;
-    }
-
-    if(FAIL(return_code = buffer_output_stream_init(&icmtl_out, &icmtl_out, ICMTL_BUFFER_SIZE)))
-    {
-        output_stream_close(&icmtl_out);
-        unlink(summary_tmp_name);
-        UNICITY_RELEASE(icmtl);
-
-        return return_code;
-    }
-
-    /* Store current SOA */
 
     u32 old_serial;
-
-    rr_soa_get_serial(icmtl->soa_rdata, icmtl->soa_rdata_size, &old_serial);
-
-    output_stream_write_dnsname(&icmtl_out, icmtl->zone->origin);
-    output_stream_write_u16(&icmtl_out, TYPE_SOA); /** @note NATIVETYPE */
-    output_stream_write_u16(&icmtl_out, CLASS_IN); /** @note NATIVECLASS */
-    output_stream_write_nu32(&icmtl_out, icmtl->soa_ttl);
-    output_stream_write_nu16(&icmtl_out, icmtl->soa_rdata_size);
-    output_stream_write(&icmtl_out, icmtl->soa_rdata, icmtl->soa_rdata_size);
-    
     u32 new_serial;
 
+    rr_soa_get_serial(icmtl->soa_rdata, icmtl->soa_rdata_size, &old_serial);
     rr_soa_get_serial(&soa->rdata_start[0], soa->rdata_size, &new_serial);
     rr_soa_get_minimumttl(&soa->rdata_start[0], soa->rdata_size, &icmtl->zone->min_ttl);
 
-    /* Store new SOA */
-
-    output_stream_write_packed_ttlrdata(&icmtl_out, icmtl->zone->origin, TYPE_SOA, soa);
-    
-    output_stream_close(&icmtl_out);
-
-    /**
-     * Now rename the files to their final names
-     *
-     * @todo: The add/remove files should not be required anymore at this point.
-     *
-     */
-
-    if(ISOK(return_code = zdb_icmtl_rename_file(icmtl, ICMTL_REMOVE_TMP_FILE_FORMAT  , ICMTL_REMOVE_FILE_FORMAT, folder, old_serial, new_serial)))
-    {
-        if(ISOK(return_code = zdb_icmtl_rename_file(icmtl, ICMTL_ADD_TMP_FILE_FORMAT , ICMTL_ADD_FILE_FORMAT, folder, old_serial, new_serial)))
-        {
-            return_code = zdb_icmtl_rename_file(icmtl, ICMTL_SUMMARY_TMP_FILE_FORMAT , ICMTL_SUMMARY_FILE_FORMAT, folder, old_serial, new_serial);
-        }
-    }
-
-    if(ISOK(return_code))
-    {
-        /*
-         * convert into a standard I(xfr) file
-         */
-
-        snformat(wire_name, sizeof(wire_name), ICMTL_WIRE_FILE_FORMAT, folder, icmtl->zone->origin, old_serial, new_serial);
+    return_code = zdb_icmtl_append(icmtl, folder, soa, old_serial, new_serial);
 
-#ifndef NDEBUG
-        log_debug("incremental: building wire: '%s'", wire_name);
-#endif
-
-        /*
-         * Try to find the previous "ix" file that ends with the old_serial
-         */
-        
-        output_stream wire_os;
-        input_stream icmtl_is;
-
-        bool append_ix = FALSE;
-        
-        if(ISOK(return_code = icmtl_input_stream_open(icmtl->zone->origin, old_serial, new_serial, &icmtl_is, folder)))
-        {
-            /*
-             * The first and last records are meaningless.
-             * They are just a repeat of the last recorded SOA
-             */
-
-            icmtl_input_stream_skip_headtail(&icmtl_is);
-
-            append_ix = TRUE;
-
-            if(FAIL(return_code = zdb_icmtl_find_ix(icmtl, folder, old_serial, new_serial, &wire_os)))
-            {
-                /**
-                 * @Note: it is the right place to make icmtl optimization (if we ever support this, which is a bad idea IMHO)
-                 *
-                 */
-
-                /**
-                 * @Note: if the original serial from the zone file is older than the start of the returned file,
-                 *        we MUST store the zone on disk ASAP and cut the journal.
-                 */
-
-                append_ix = FALSE;
-
-                return_code = file_output_stream_create(wire_name, ICMTL_FILE_MODE, &wire_os);
-            }
-            
-            if(ISOK(return_code))
-            {
-                /* at this point wire_os is supposed to be a file_output_stream with the file pointer set at the end of the file */
-                
-                if(is_fd_output_stream(&wire_os))
-                {
-                    int fd = fd_output_stream_get_filedescriptor(&wire_os);
-                    icmtl->file_size_before_append = lseek(fd, 0, SEEK_CUR);
-                    icmtl->file_size_after_append = icmtl->file_size_before_append;
-                }
-                
-                /* append ... */
-                
-                ya_result n;
-
-                while((n = input_stream_read(&icmtl_is, (u8*)buffer, sizeof(buffer))) > 0)
-                {
-                    if(FAIL(n = output_stream_write(&wire_os, (u8*)buffer,n)))
-                    {
-                        break;
-                    }
-                    
-                    icmtl->file_size_after_append += n;
-                }
-
-                /*
-                 * If no error occurred, we can remove the source.
-                 */
-
-                if(ISOK(n))
-                {
-                    zdb_icmtl_unlink(icmtl, ICMTL_REMOVE_FILE_FORMAT, folder, old_serial, new_serial);
-                    zdb_icmtl_unlink(icmtl, ICMTL_ADD_FILE_FORMAT, folder, old_serial, new_serial);
-                    zdb_icmtl_unlink(icmtl, ICMTL_SUMMARY_FILE_FORMAT, folder, old_serial, new_serial);
-                }
-
-                output_stream_close(&wire_os);
-                input_stream_close(&icmtl_is);
-
-                return_code = n;
-            }
-        }
-
-        if(FAIL(return_code))
-        {
-            log_err("incremental: building wire: '%s' %s failed: %r",
-                    wire_name,
-                    (append_ix)?"(append)":"",
-                    return_code);
-            
-            if(icmtl->file_size_after_append > icmtl->file_size_before_append)
-            {
-                log_err("incremental: current journal has been partially modified and should be cut at size %lld", icmtl->file_size_before_append);
-            }
-
-            /*
-             * We can only remove the file if it is a new one.  Else we loose past changes.
-             * Oh, and if we were doing an append we are now in a critical state.
-             * We have to start a recovery:
-             *      _ remove the broken records
-             *      _ redo
-             * 
-             * But the problem is that the issue is most likely a resource issue (disk full ?)
-             * So we can only complain and disable dynamic updates.
-             * 
-             * @TODO: disable dynamic updates globally: SERVFAIL
-             */
-
-            if(append_ix)
-            {
-                log_err("incremental: CRITICAL ERROR. UPDATES DISABLED. UNABLE TO UPDATE ANYMORE: INVESTIGATE, FIX, RESTART.");
-            }
-            else
-            {
-                zdb_icmtl_unlink_file(wire_name);
-            }
-        }
-    }
-
-    UNICITY_RELEASE(icmtl);
+    zdb_icmtl_close(icmtl);
 
     return return_code;
 }
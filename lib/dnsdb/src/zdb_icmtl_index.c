@@ -0,0 +1,795 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbicmtl Journal
+ *  @ingroup dnsdb
+ *  @brief Index of the deltas of a zone journal
+ *
+ *  One index per zone is kept in memory, loaded from its file on first use.
+ *  Before it is used, it is checked against the journal (inode, first serial,
+ *  size, checksum of the last delta) and completed by scanning the part of
+ *  the journal that follows its last delta.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include <dnscore/logger.h>
+#include <dnscore/format.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/rfc.h>
+#include <dnscore/serial.h>
+#include <dnscore/fdtools.h>
+#include <dnscore/input_stream.h>
+#include <dnscore/file_input_stream.h>
+#include <dnscore/buffer_input_stream.h>
+
+#include "dnsdb/zdb_error.h"
+#include "dnsdb/zdb_utils.h"
+#include "dnsdb/zdb_zone_snapshot.h"
+#include "dnsdb/zdb_icmtl_index.h"
+#include "dnsdb/treeset.h"
+
+extern logger_handle* g_database_logger;
+#define MODULE_MSG_HANDLE g_database_logger
+
+#define ICMTLIDX_TAG 0x5844494c544d4349 /* ICMTLIDX */
+#define ICMTLIDE_TAG 0x4544494c544d4349 /* ICMTLIDE */
+#define ICMTLIDB_TAG 0x4244494c544d4349 /* ICMTLIDB */
+
+#define ZDB_ICMTL_INDEX_BUFFER_SIZE     65536
+#define ZDB_ICMTL_INDEX_FILE_MODE       0600
+
+typedef struct zdb_icmtl_index zdb_icmtl_index;
+
+struct zdb_icmtl_index
+{
+    u8 *origin;
+    zdb_icmtl_index_entry *entries;
+    u32 count;
+    u32 capacity;
+    u32 journal_from;
+    u32 journal_to;     /* the serial the name of the journal ends at */
+    u64 device;
+    u64 inode;
+    u64 covered;        /* end of the last delta of the index */
+    u64 append_offset;  /* where a delta is being appended */
+    int fd;             /* the index file, -1 if it is not available */
+    bool loaded;        /* the index file has been read */
+    bool verified;      /* the last delta has been checked against the journal */
+    bool appending;     /* a delta is being appended */
+};
+
+static int
+zdb_icmtl_index_origin_compare(const void *a, const void *b)
+{
+    return dnsname_compare((const u8*)a, (const u8*)b);
+}
+
+static pthread_mutex_t zdb_icmtl_index_mtx = PTHREAD_MUTEX_INITIALIZER;
+static treeset_tree zdb_icmtl_index_set = {NULL, zdb_icmtl_index_origin_compare};
+
+static void
+zdb_icmtl_index_set_u64(u8 *p, u64 value)
+{
+    SET_U32_AT(p[0], htonl((u32)(value >> 32)));
+    SET_U32_AT(p[4], htonl((u32)value));
+}
+
+static u64
+zdb_icmtl_index_get_u64(const u8 *p)
+{
+    return (((u64)ntohl(GET_U32_AT(p[0]))) << 32) | ntohl(GET_U32_AT(p[4]));
+}
+
+static void
+zdb_icmtl_index_entry_encode(u8 *p, const zdb_icmtl_index_entry *entry)
+{
+    SET_U32_AT(p[0], htonl(entry->serial_from));
+    SET_U32_AT(p[4], htonl(entry->serial_to));
+    zdb_icmtl_index_set_u64(&p[8], entry->offset);
+    zdb_icmtl_index_set_u64(&p[16], entry->size);
+    zdb_icmtl_index_set_u64(&p[24], entry->checksum);
+}
+
+static void
+zdb_icmtl_index_entry_decode(zdb_icmtl_index_entry *entry, const u8 *p)
+{
+    entry->serial_from = ntohl(GET_U32_AT(p[0]));
+    entry->serial_to = ntohl(GET_U32_AT(p[4]));
+    entry->offset = zdb_icmtl_index_get_u64(&p[8]);
+    entry->size = zdb_icmtl_index_get_u64(&p[16]);
+    entry->checksum = zdb_icmtl_index_get_u64(&p[24]);
+}
+
+static zdb_icmtl_index*
+zdb_icmtl_index_get(const u8 *origin)
+{
+    treeset_node *node = treeset_avl_find(&zdb_icmtl_index_set, origin);
+
+    if(node != NULL)
+    {
+        return (zdb_icmtl_index*)node->data;
+    }
+
+    zdb_icmtl_index *index;
+
+    MALLOC_OR_DIE(zdb_icmtl_index*, index, sizeof(zdb_icmtl_index), ICMTLIDX_TAG);
+    ZEROMEMORY(index, sizeof(zdb_icmtl_index));
+    index->origin = dnsname_dup(origin);
+    index->fd = -1;
+
+    node = treeset_avl_insert(&zdb_icmtl_index_set, index->origin);
+    node->data = index;
+
+    return index;
+}
+
+static void
+zdb_icmtl_index_close_file(zdb_icmtl_index *index)
+{
+    if(index->fd >= 0)
+    {
+        close_ex(index->fd);
+        index->fd = -1;
+    }
+}
+
+static void
+zdb_icmtl_index_push(zdb_icmtl_index *index, const zdb_icmtl_index_entry *entry)
+{
+    if(index->count == index->capacity)
+    {
+        zdb_icmtl_index_entry *entries;
+        u32 capacity = MAX(index->capacity * 2, 64);
+
+        MALLOC_OR_DIE(zdb_icmtl_index_entry*, entries, capacity * sizeof(zdb_icmtl_index_entry), ICMTLIDE_TAG);
+
+        if(index->entries != NULL)
+        {
+            MEMCOPY(entries, index->entries, index->count * sizeof(zdb_icmtl_index_entry));
+            free(index->entries);
+        }
+
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+
+    index->entries[index->count++] = *entry;
+    index->covered = entry->offset + entry->size;
+}
+
+/*
+ * Adds the entry in memory and in the index file
+ */
+
+static void
+zdb_icmtl_index_add(zdb_icmtl_index *index, const zdb_icmtl_index_entry *entry)
+{
+    zdb_icmtl_index_push(index, entry);
+
+    if(index->fd >= 0)
+    {
+        u8 buffer[ZDB_ICMTL_INDEX_ENTRY_SIZE];
+
+        zdb_icmtl_index_entry_encode(buffer, entry);
+
+        off_t position = ZDB_ICMTL_INDEX_HEADER_SIZE + (off_t)(index->count - 1) * ZDB_ICMTL_INDEX_ENTRY_SIZE;
+
+        if(pwrite(index->fd, buffer, sizeof(buffer), position) != sizeof(buffer))
+        {
+            log_warn("journal: %{dnsname}: cannot write the index: %r", index->origin, ERRNO_ERROR);
+
+            zdb_icmtl_index_close_file(index);
+        }
+    }
+}
+
+/*
+ * Keeps the first count entries
+ */
+
+static void
+zdb_icmtl_index_cut(zdb_icmtl_index *index, u32 count)
+{
+    index->count = count;
+    index->covered = (count > 0)?index->entries[count - 1].offset + index->entries[count - 1].size:0;
+
+    if(index->fd >= 0)
+    {
+        if(ftruncate(index->fd, ZDB_ICMTL_INDEX_HEADER_SIZE + (off_t)count * ZDB_ICMTL_INDEX_ENTRY_SIZE) < 0)
+        {
+            zdb_icmtl_index_close_file(index);
+        }
+    }
+}
+
+/*
+ * Starts an empty index for the journal
+ */
+
+static void
+zdb_icmtl_index_reset(zdb_icmtl_index *index, const char *folder, u32 journal_from, u32 journal_to, const struct stat *journal_stat)
+{
+    char path[1024];
+    u8 header[ZDB_ICMTL_INDEX_HEADER_SIZE];
+
+    index->count = 0;
+    index->covered = 0;
+    index->journal_from = journal_from;
+    index->journal_to = journal_to;
+    index->device = journal_stat->st_dev;
+    index->inode = journal_stat->st_ino;
+    index->verified = TRUE;
+
+    zdb_icmtl_index_close_file(index);
+
+    snformat(path, sizeof(path), ICMTL_INDEX_FILE_FORMAT, folder, index->origin);
+
+    if((index->fd = open(path, O_RDWR|O_CREAT|O_TRUNC, ZDB_ICMTL_INDEX_FILE_MODE)) < 0)
+    {
+        log_warn("journal: %{dnsname}: cannot create the index '%s': %r", index->origin, path, ERRNO_ERROR);
+
+        return;
+    }
+
+    ZEROMEMORY(header, sizeof(header));
+    SET_U32_AT(header[0], htonl(ZDB_ICMTL_INDEX_MAGIC));
+    SET_U16_AT(header[4], htons(ZDB_ICMTL_INDEX_VERSION));
+    SET_U32_AT(header[8], htonl(journal_from));
+    SET_U32_AT(header[12], htonl(journal_to));
+    zdb_icmtl_index_set_u64(&header[16], index->device);
+    zdb_icmtl_index_set_u64(&header[24], index->inode);
+
+    if(writefully(index->fd, header, sizeof(header)) != sizeof(header))
+    {
+        log_warn("journal: %{dnsname}: cannot write the index '%s': %r", index->origin, path, ERRNO_ERROR);
+
+        zdb_icmtl_index_close_file(index);
+    }
+}
+
+/*
+ * Reads the index file.  Whatever does not follow (serial and position) is cut.
+ */
+
+static void
+zdb_icmtl_index_load(zdb_icmtl_index *index, const char *folder)
+{
+    char path[1024];
+    u8 buffer[ZDB_ICMTL_INDEX_ENTRY_SIZE * 256];
+    struct stat st;
+    int fd;
+
+    index->loaded = TRUE;
+
+    snformat(path, sizeof(path), ICMTL_INDEX_FILE_FORMAT, folder, index->origin);
+
+    if((fd = open(path, O_RDWR)) < 0)
+    {
+        return;
+    }
+
+    if((fstat(fd, &st) < 0) ||
+       (readfully(fd, buffer, ZDB_ICMTL_INDEX_HEADER_SIZE) != ZDB_ICMTL_INDEX_HEADER_SIZE) ||
+       (ntohl(GET_U32_AT(buffer[0])) != ZDB_ICMTL_INDEX_MAGIC) ||
+       (ntohs(GET_U16_AT(buffer[4])) != ZDB_ICMTL_INDEX_VERSION))
+    {
+        close_ex(fd);
+
+        return;
+    }
+
+    index->journal_from = ntohl(GET_U32_AT(buffer[8]));
+    index->journal_to = ntohl(GET_U32_AT(buffer[12]));
+    index->device = zdb_icmtl_index_get_u64(&buffer[16]);
+    index->inode = zdb_icmtl_index_get_u64(&buffer[24]);
+    index->count = 0;
+    index->covered = 0;
+    index->verified = FALSE;
+    index->fd = fd;
+
+    u64 remaining = (st.st_size - ZDB_ICMTL_INDEX_HEADER_SIZE) / ZDB_ICMTL_INDEX_ENTRY_SIZE;
+    bool broken = ((st.st_size - ZDB_ICMTL_INDEX_HEADER_SIZE) % ZDB_ICMTL_INDEX_ENTRY_SIZE) != 0;
+
+    while((remaining > 0) && !broken)
+    {
+        u32 n = MIN(remaining, sizeof(buffer) / ZDB_ICMTL_INDEX_ENTRY_SIZE);
+
+        if(readfully(fd, buffer, n * ZDB_ICMTL_INDEX_ENTRY_SIZE) != n * ZDB_ICMTL_INDEX_ENTRY_SIZE)
+        {
+            broken = TRUE;
+            break;
+        }
+
+        for(u32 i = 0; i < n; i++)
+        {
+            zdb_icmtl_index_entry entry;
+
+            zdb_icmtl_index_entry_decode(&entry, &buffer[i * ZDB_ICMTL_INDEX_ENTRY_SIZE]);
+
+            u32 expected_from = (index->count > 0)?index->entries[index->count - 1].serial_to:index->journal_from;
+
+            if((entry.offset != index->covered) || (entry.serial_from != expected_from))
+            {
+                broken = TRUE;
+                break;
+            }
+
+            zdb_icmtl_index_push(index, &entry);
+        }
+
+        remaining -= n;
+    }
+
+    if(broken)
+    {
+        log_warn("journal: %{dnsname}: index '%s' cut after %u entries", index->origin, path, index->count);
+
+        zdb_icmtl_index_cut(index, index->count);
+    }
+}
+
+static ya_result
+zdb_icmtl_index_checksum_range(int fd, u64 offset, u64 size, u64 *checksump)
+{
+    u8 *buffer;
+    u64 checksum = 0;
+    ya_result return_code = SUCCESS;
+
+    MALLOC_OR_DIE(u8*, buffer, ZDB_ICMTL_INDEX_BUFFER_SIZE, ICMTLIDB_TAG);
+
+    while(size > 0)
+    {
+        ssize_t n = pread(fd, buffer, MIN(size, ZDB_ICMTL_INDEX_BUFFER_SIZE), offset);
+
+        if(n <= 0)
+        {
+            return_code = (n < 0)?ERRNO_ERROR:UNABLE_TO_COMPLETE_FULL_READ;
+            break;
+        }
+
+        checksum = zdb_zone_snapshot_checksum(checksum, buffer, n);
+        offset += n;
+        size -= n;
+    }
+
+    free(buffer);
+
+    *checksump = checksum;
+
+    return return_code;
+}
+
+/*
+ * Indexes the complete deltas following the last one of the index.
+ *
+ * A delta is : SOA (from), removed records, SOA (to), added records.
+ * It ends where the next SOA starts, or at the end of the journal.
+ */
+
+static void
+zdb_icmtl_index_scan(zdb_icmtl_index *index, int fd, u64 size)
+{
+    input_stream is;
+    zdb_icmtl_index_entry entry;
+    u8 *record;
+    int scan_fd;
+
+    if((scan_fd = dup(fd)) < 0)
+    {
+        return;
+    }
+
+    fd_input_stream_attach(scan_fd, &is);
+    fd_input_stream_seek(&is, index->covered);
+    buffer_input_stream_init(&is, &is, ZDB_ICMTL_INDEX_BUFFER_SIZE);
+
+    MALLOC_OR_DIE(u8*, record, MAX_DOMAIN_LENGTH + 10 + 65535, ICMTLIDB_TAG);
+
+    u64 position = index->covered;
+    u32 soa_count = 0;
+    u32 added = 0;
+
+    entry.offset = position;
+    entry.checksum = 0;
+
+    while(position < size)
+    {
+        ya_result n;
+
+        if((n = input_stream_read_dnsname(&is, record)) <= 0)
+        {
+            break;
+        }
+
+        u32 record_size = n;
+
+        if(FAIL(input_stream_read_fully(&is, &record[record_size], 10)))
+        {
+            break;
+        }
+
+        u16 rtype = GET_U16_AT(record[record_size]); /** @note : NATIVETYPE */
+        u16 rdata_size = ntohs(GET_U16_AT(record[record_size + 8]));
+
+        record_size += 10;
+
+        if(FAIL(input_stream_read_fully(&is, &record[record_size], rdata_size)))
+        {
+            break;
+        }
+
+        if(rtype == TYPE_SOA)
+        {
+            u32 serial;
+
+            if(FAIL(rr_soa_get_serial(&record[record_size], rdata_size, &serial)))
+            {
+                break;
+            }
+
+            if(soa_count == 2)
+            {
+                entry.size = position - entry.offset;
+                zdb_icmtl_index_add(index, &entry);
+                added++;
+
+                entry.offset = position;
+                entry.checksum = 0;
+                soa_count = 0;
+            }
+
+            if(soa_count == 0)
+            {
+                entry.serial_from = serial;
+            }
+            else
+            {
+                entry.serial_to = serial;
+            }
+
+            soa_count++;
+        }
+        else if(soa_count == 0)
+        {
+            break;  /* a delta starts with a SOA */
+        }
+
+        record_size += rdata_size;
+
+        entry.checksum = zdb_zone_snapshot_checksum(entry.checksum, record, record_size);
+        position += record_size;
+    }
+
+    if((soa_count == 2) && (position == size))
+    {
+        entry.size = position - entry.offset;
+        zdb_icmtl_index_add(index, &entry);
+        added++;
+    }
+
+    free(record);
+
+    input_stream_close(&is);
+
+#ifndef NDEBUG
+    log_debug("journal: %{dnsname}: indexed %u deltas, up to %llu/%llu", index->origin, added, index->covered, size);
+#endif
+}
+
+/*
+ * Makes the index match the journal.
+ * The mutex must be held.
+ */
+
+static ya_result
+zdb_icmtl_index_update(zdb_icmtl_index *index, const char *folder, int fd, u32 journal_from, u32 journal_to, u64 *sizep)
+{
+    struct stat st;
+
+    if(fstat(fd, &st) < 0)
+    {
+        return ERRNO_ERROR;
+    }
+    
+    u64 size = st.st_size;
+
+    if(!index->loaded)
+    {
+        zdb_icmtl_index_load(index, folder);
+    }
+
+    if((index->device != (u64)st.st_dev) ||
+       (index->inode != (u64)st.st_ino) ||
+       (index->journal_from != journal_from) ||
+       (index->journal_to != journal_to) ||
+       (index->covered > (u64)st.st_size))
+    {
+        if(index->count > 0)
+        {
+            log_info("journal: %{dnsname}: the index does not match the journal anymore", index->origin);
+        }
+
+        zdb_icmtl_index_reset(index, folder, journal_from, journal_to, &st);
+    }
+
+    if(!index->verified)
+    {
+        index->verified = TRUE;
+
+        if(index->count > 0)
+        {
+            zdb_icmtl_index_entry *last = &index->entries[index->count - 1];
+            u64 checksum;
+
+            if(FAIL(zdb_icmtl_index_checksum_range(fd, last->offset, last->size, &checksum)) || (checksum != last->checksum))
+            {
+                log_warn("journal: %{dnsname}: changes from %u to %u do not match their checksum", index->origin, last->serial_from, last->serial_to);
+
+                zdb_icmtl_index_cut(index, index->count - 1);
+            }
+        }
+    }
+
+    if(index->appending && (index->append_offset < size))
+    {
+        size = index->append_offset;    /* not written completely yet */
+    }
+
+    if(index->covered < size)
+    {
+        zdb_icmtl_index_scan(index, fd, size);
+    }
+
+    *sizep = size;
+
+    return SUCCESS;
+}
+
+bool
+zdb_icmtl_index_get_range(const u8 *origin, const char *folder, u32 *fromp, u32 *top, u32 *name_top)
+{
+    pthread_mutex_lock(&zdb_icmtl_index_mtx);
+
+    zdb_icmtl_index *index = zdb_icmtl_index_get(origin);
+
+    if(!index->loaded)
+    {
+        zdb_icmtl_index_load(index, folder);
+    }
+
+    bool ret = index->count > 0;
+
+    if(ret)
+    {
+        *fromp = index->entries[0].serial_from;
+        *top = index->entries[index->count - 1].serial_to;
+        *name_top = index->journal_to;
+    }
+
+    pthread_mutex_unlock(&zdb_icmtl_index_mtx);
+
+    return ret;
+}
+
+ya_result
+zdb_icmtl_index_get_end(const u8 *origin, const char *folder, int fd, u32 journal_from, u32 journal_to, u32 *top)
+{
+    ya_result return_code;
+    u64 size;
+
+    pthread_mutex_lock(&zdb_icmtl_index_mtx);
+
+    zdb_icmtl_index *index = zdb_icmtl_index_get(origin);
+
+    if(ISOK(return_code = zdb_icmtl_index_update(index, folder, fd, journal_from, journal_to, &size)))
+    {
+        if(index->count > 0)
+        {
+            *top = index->entries[index->count - 1].serial_to;
+        }
+        else
+        {
+            return_code = ZDB_ERROR_ICMTL_NOTFOUND;
+        }
+    }
+
+    pthread_mutex_unlock(&zdb_icmtl_index_mtx);
+
+    return return_code;
+}
+
+ya_result
+zdb_icmtl_index_find(const u8 *origin, const char *folder, int fd, u32 journal_from, u32 journal_to, u32 serial, u64 *offsetp)
+{
+    ya_result return_code;
+    u64 size;
+
+    pthread_mutex_lock(&zdb_icmtl_index_mtx);
+
+    zdb_icmtl_index *index = zdb_icmtl_index_get(origin);
+
+    if(ISOK(return_code = zdb_icmtl_index_update(index, folder, fd, journal_from, journal_to, &size)))
+    {
+        u32 lo = 0;
+        u32 hi = index->count;
+
+        return_code = ZDB_ERROR_ICMTL_SOANOTFOUND;
+
+        while(lo < hi)
+        {
+            u32 mid = (lo + hi) >> 1;
+            u32 mid_serial = index->entries[mid].serial_from;
+
+            if(mid_serial == serial)
+            {
+                *offsetp = index->entries[mid].offset;
+                return_code = SUCCESS;
+                break;
+            }
+
+            if(serial_lt(mid_serial, serial))
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&zdb_icmtl_index_mtx);
+
+    return return_code;
+}
+
+ya_result
+zdb_icmtl_index_prepare_append(const u8 *origin, const char *folder, int fd, u32 journal_from, u32 journal_to, u64 *offsetp)
+{
+    ya_result return_code;
+    u64 size;
+
+    pthread_mutex_lock(&zdb_icmtl_index_mtx);
+
+    zdb_icmtl_index *index = zdb_icmtl_index_get(origin);
+
+    if(ISOK(return_code = zdb_icmtl_index_update(index, folder, fd, journal_from, journal_to, &size)))
+    {
+        if(index->covered < size)
+        {
+            log_warn("journal: %{dnsname}: cutting %llu bytes of incomplete changes at the end of the journal", origin, size - index->covered);
+
+            if(ftruncate(fd, index->covered) < 0)
+            {
+                return_code = ERRNO_ERROR;
+            }
+        }
+
+        *offsetp = index->covered;
+        
+        index->append_offset = index->covered;
+        index->appending = TRUE;
+    }
+
+    pthread_mutex_unlock(&zdb_icmtl_index_mtx);
+
+    return return_code;
+}
+
+void
+zdb_icmtl_index_append(const u8 *origin, const char *folder, const zdb_icmtl_index_entry *entry)
+{
+    pthread_mutex_lock(&zdb_icmtl_index_mtx);
+
+    zdb_icmtl_index *index = zdb_icmtl_index_get(origin);
+    
+    index->appending = FALSE;
+
+    if(entry == NULL)
+    {
+        /* nothing has been appended */
+    }
+    else if(index->covered == entry->offset)
+    {
+        zdb_icmtl_index_add(index, entry);
+    }
+    else
+    {
+        /* will be rebuilt from the journal on its next use */
+
+        log_warn("journal: %{dnsname}: changes from %u to %u written at %llu, index ends at %llu", origin, entry->serial_from, entry->serial_to, entry->offset, index->covered);
+    }
+
+    pthread_mutex_unlock(&zdb_icmtl_index_mtx);
+}
+
+int
+zdb_icmtl_index_dup_file(const u8 *origin)
+{
+    int fd = -1;
+
+    pthread_mutex_lock(&zdb_icmtl_index_mtx);
+
+    zdb_icmtl_index *index = zdb_icmtl_index_get(origin);
+
+    if(index->fd >= 0)
+    {
+        fd = dup(index->fd);
+    }
+
+    pthread_mutex_unlock(&zdb_icmtl_index_mtx);
+
+    return fd;
+}
+
+void
+zdb_icmtl_index_finalize()
+{
+    pthread_mutex_lock(&zdb_icmtl_index_mtx);
+
+    treeset_avl_iterator iter;
+    treeset_avl_iterator_init(&zdb_icmtl_index_set, &iter);
+
+    while(treeset_avl_iterator_hasnext(&iter))
+    {
+        treeset_node *node = treeset_avl_iterator_next_node(&iter);
+        zdb_icmtl_index *index = (zdb_icmtl_index*)node->data;
+
+        zdb_icmtl_index_close_file(index);
+        free(index->entries);
+        free(index->origin);
+        free(index);
+    }
+
+    treeset_avl_destroy(&zdb_icmtl_index_set);
+
+    pthread_mutex_unlock(&zdb_icmtl_index_mtx);
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
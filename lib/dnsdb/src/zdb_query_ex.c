@@ -78,8 +78,12 @@
 #define LOCK(a_)    zdb_zone_lock((a_), ZDB_ZONE_MUTEX_SIMPLEREADER)
 #define UNLOCK(a_)  zdb_zone_unlock((a_), ZDB_ZONE_MUTEX_SIMPLEREADER)
 #else
-#define LOCK(a_)   
-#define UNLOCK(a_) 
+/*
+ * == 2: the caller stays in an epoch (zdb_epoch_enter) for the whole query and answer.
+ * Only the NSEC/NSEC3 chains are changed in place : a DNSSEC query on such a zone locks it.
+ */
+#define LOCK(a_)    do { zone_locked = dnssec && (((a_)->apex->flags & (ZDB_RR_LABEL_NSEC|ZDB_RR_LABEL_NSEC3|ZDB_RR_LABEL_DNSSEC_EDIT)) != 0); if(zone_locked) zdb_zone_lock((a_), ZDB_ZONE_MUTEX_SIMPLEREADER); } while(0)
+#define UNLOCK(a_)  do { if(zone_locked) zdb_zone_unlock((a_), ZDB_ZONE_MUTEX_SIMPLEREADER); } while(0)
 #endif
 
 /**
@@ -1667,6 +1671,9 @@ zdb_query_ex(const zdb *db, message_data *mesg, zdb_query_ex_answer *ans_auth_ad
 #endif
 
     bool dnssec = (mesg->rcode_ext & RCODE_EXT_DNSSEC) != 0;
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    bool zone_locked = FALSE;
+#endif
 
     /**
      *  MANDATORY, INITIALISES A LOCAL MEMORY POOL
@@ -1765,6 +1772,8 @@ zdb_query_ex(const zdb *db, message_data *mesg, zdb_query_ex_answer *ans_auth_ad
             found_zones = TRUE;
 #endif
             zdb_zone *zone = zone_label->zone;
+            
+            ans_auth_add->zone = zone;
 
             /*
              * lock
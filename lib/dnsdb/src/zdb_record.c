@@ -56,6 +56,7 @@
 #include "dnsdb/zdb_error.h"
 
 #include "dnsdb/btree.h"
+#include "dnsdb/zdb_epoch.h"
 
 /** @brief Frees a resource record
  *
@@ -73,6 +74,48 @@ zdb_record_free(zdb_packed_ttlrdata* record)
     ZDB_RECORD_ZFREE(record);
 }
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+
+static void
+zdb_record_free_epoch_callback(void* record)
+{
+    zdb_record_free((zdb_packed_ttlrdata*)record);
+}
+
+static void zdb_record_destroy_callback(void* record_list_);
+
+static void
+zdb_record_list_free_epoch_callback(void* record_list)
+{
+    zdb_record_destroy_callback(record_list);
+}
+
+static void
+zdb_record_collection_free_epoch_callback(void* collection)
+{
+    btree_callback_and_destroy((zdb_rr_collection)collection, zdb_record_destroy_callback);
+}
+
+#define zdb_record_list_retire(record_list_) zdb_epoch_defer(zdb_record_list_free_epoch_callback, (record_list_))
+
+#endif
+
+/*
+ * A record removed from a zone may still be read by a query.
+ * Its release is postponed after the readers have moved on.
+ * The next field is kept intact so a reader standing on it can continue.
+ */
+
+void
+zdb_record_retire(zdb_packed_ttlrdata* record)
+{
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    zdb_epoch_defer(zdb_record_free_epoch_callback, record);
+#else
+    zdb_record_free(record);
+#endif
+}
+
 /** @brief Inserts a resource record into the resource collection, assume no dups
  *
  *  Assume there are no dups.
@@ -155,9 +198,14 @@ zdb_record_insert_checked(zdb_rr_collection* collection, u16 type, zdb_packed_tt
     }
     else
     {
-        ZDB_RECORD_SAFE_ZFREE(*record_sll);
+        zdb_packed_ttlrdata* old_record = *record_sll;
         record->next = NULL;
         *record_sll = record;
+
+        if(old_record != NULL)
+        {
+            zdb_record_retire(old_record);
+        }
     }
 
     return TRUE;
@@ -248,6 +296,9 @@ zdb_record_delete(zdb_rr_collection* collection, u16 type)
         {
             /* We have the data of the node that has just been deleted */
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+            zdb_record_list_retire(record_list);
+#else
             do
             {
                 zdb_packed_ttlrdata* tmp = record_list;
@@ -255,6 +306,7 @@ zdb_record_delete(zdb_rr_collection* collection, u16 type)
                 zdb_record_free(tmp);
             }
             while(record_list != NULL);
+#endif
 
             return SUCCESS;
         }
@@ -263,7 +315,17 @@ zdb_record_delete(zdb_rr_collection* collection, u16 type)
     }
     else
     {
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+        /* detach the whole collection, readers may still be walking it */
+        
+        if(*collection != NULL)
+        {
+            zdb_epoch_defer(zdb_record_collection_free_epoch_callback, *collection);
+            *collection = NULL;
+        }
+#else
         zdb_record_destroy(collection); /* FB: This should be handled by the caller */
+#endif
 
         return SUCCESS;
     }
@@ -373,14 +435,14 @@ zdb_record_delete_exact(zdb_rr_collection* collection, u16 type, zdb_ttlrdata* t
                         ret = SUCCESS_LAST_RECORD;                  /* There is still at least one record of this type available */
                     }
 
-                    zdb_record_free(record_list);
+                    zdb_record_retire(record_list);
 
                     return ret;
                 }
 
                 prev->next = record_list->next;
 
-                zdb_record_free(record_list);
+                zdb_record_retire(record_list);
 
                 return SUCCESS_STILL_RECORDS; /* There is still at least one record of this type available */
             }
@@ -54,6 +54,7 @@
 #include "dnsdb/zdb_listener.h"
 
 #include "dnsdb/dictionary.h"
+#include "dnsdb/zdb_epoch.h"
 
 static void zdb_rr_label_destroy_callback(dictionary_node* rr_label_record, void* arg);
 
@@ -106,6 +107,30 @@ zdb_rr_label_free(zdb_zone* zone, zdb_rr_label* label)
 
 }
 
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+static void
+zdb_rr_label_free_epoch_callback(void* rr_label)
+{
+    zdb_rr_label_free(NULL, (zdb_rr_label*)rr_label);
+}
+#endif
+
+/**
+ * Releases a label that has been (or is being) detached from a zone being read.
+ * With the epoch reader lock, the label and its content stay available until
+ * all the readers that could have reached it have left.
+ */
+
+static inline void
+zdb_rr_label_retire(zdb_zone* zone, zdb_rr_label* label)
+{
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    zdb_epoch_defer(zdb_rr_label_free_epoch_callback, label);
+#else
+    zdb_rr_label_free(zone, label);
+#endif
+}
+
 /**
  * @brief INTERNAL callback
  */
@@ -552,7 +577,7 @@ zdb_rr_label_delete_record_process_callback(void* a, dictionary_node* node)
 
             if(RR_LABEL_IRRELEVANT(rr_label))
             {
-                zdb_rr_label_free(args->zone, rr_label);
+                zdb_rr_label_retire(args->zone, rr_label);
 
                 return COLLECTION_PROCESS_DELETENODE;
             }
@@ -615,7 +640,7 @@ zdb_rr_label_delete_record_process_callback(void* a, dictionary_node* node)
          * iterate through it calling the passed function.
          */
 
-        zdb_rr_label_free(args->zone, rr_label);
+        zdb_rr_label_retire(args->zone, rr_label);
 
         return COLLECTION_PROCESS_DELETENODE;
     }
@@ -658,7 +683,7 @@ zdb_rr_label_delete_record(zdb_zone* zone, dnslabel_vector_reference path, s32 p
             /*
             if(RR_LABEL_IRRELEVANT(apex))
             {
-                zdb_rr_label_free(zone, apex);
+                zdb_rr_label_retire(zone, apex);
                 zone->apex = NULL;
 
                 return ZDB_RR_LABEL_DELETE_TREE;
@@ -685,7 +710,7 @@ zdb_rr_label_delete_record(zdb_zone* zone, dnslabel_vector_reference path, s32 p
     {
         if(RR_LABEL_IRRELEVANT(apex))
         {
-            zdb_rr_label_free(zone, apex);
+            zdb_rr_label_retire(zone, apex);
             zone->apex = NULL;
 
             return ZDB_RR_LABEL_DELETE_TREE;
@@ -769,7 +794,7 @@ zdb_rr_label_delete_record_exact_process_callback(void* a, dictionary_node* node
 
             if(RR_LABEL_IRRELEVANT(rr_label))
             {
-                zdb_rr_label_free(args->zone, rr_label);
+                zdb_rr_label_retire(args->zone, rr_label);
 
                 return COLLECTION_PROCESS_DELETENODE;
             }
@@ -845,7 +870,7 @@ zdb_rr_label_delete_record_exact_process_callback(void* a, dictionary_node* node
          * iterate through it calling the passed function.
          */
 
-        zdb_rr_label_free(args->zone, rr_label);
+        zdb_rr_label_retire(args->zone, rr_label);
 
         return COLLECTION_PROCESS_DELETENODE;
     }
@@ -888,7 +913,7 @@ zdb_rr_label_delete_record_exact(zdb_zone* zone, dnslabel_vector_reference path,
 #endif
             if(RR_LABEL_IRRELEVANT(apex))
             {
-                zdb_rr_label_free(zone, apex);
+                zdb_rr_label_retire(zone, apex);
                 zone->apex = NULL;
 
                 return ZDB_RR_LABEL_DELETE_TREE;
@@ -917,7 +942,7 @@ zdb_rr_label_delete_record_exact(zdb_zone* zone, dnslabel_vector_reference path,
     {
         if(RR_LABEL_IRRELEVANT(apex))
         {
-            zdb_rr_label_free(zone, apex);
+            zdb_rr_label_retire(zone, apex);
             zone->apex = NULL;
 
             return COLLECTION_PROCESS_DELETENODE;
@@ -44,6 +44,7 @@
  * USE INCLUDES */
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <dnscore/dnscore.h>
 
@@ -53,6 +54,10 @@
 
 #include "dnsdb/dnssec.h"
 #include "dnsdb/dnssec_task.h"
+#include "dnsdb/rrsig_expiration.h"
+#include "dnsdb/zdb_record.h"
+#include "dnsdb/zdb_rr_label.h"
+#include "dnsdb/zdb_zone.h"
 
 extern logger_handle* g_database_logger;
 #define MODULE_MSG_HANDLE g_database_logger
@@ -65,6 +70,10 @@ extern dnssec_task_descriptor dnssec_nsec3_updater_task_descriptor;
 extern dnssec_task_descriptor dnssec_nsec3_updater_task_descriptor_scheduled;
 #endif
 
+/* signatures per second for the incremental maintenance, 0 for whole zone passes */
+
+static u32 zdb_update_signatures_rate = 0;
+
 typedef struct zdb_update_zone_signatures_thread_args zdb_update_zone_signatures_thread_args;
 
 struct zdb_update_zone_signatures_thread_args
@@ -113,9 +122,226 @@ zdb_update_zone_signatures_schedule(zdb_zone *zone)
 }
 
 ya_result
-zdb_update_zone_signatures_alarm(void *zone)
+zdb_update_zone_signatures_alarm(void *zone_)
 {
-    return zdb_update_zone_signatures_schedule((zdb_zone*)zone);
+    zdb_zone *zone = (zdb_zone*)zone_;
+
+    if(zdb_update_signatures_rate == 0)
+    {
+        return zdb_update_zone_signatures_schedule(zone);
+    }
+
+    u32 next_epoch;
+
+    ya_result return_code = zdb_update_zone_signatures_slice(zone, zdb_update_signatures_rate, &next_epoch);
+
+    if(return_code == ZDB_ERROR_ZONE_IS_ALREADY_BEING_SIGNED)
+    {
+        return ALARM_REARM;
+    }
+
+    if(ISOK(return_code) && (next_epoch != MAX_U32))
+    {
+        alarm_event_node *event = alarm_event_alloc();
+        event->epoch = next_epoch;
+        event->function = zdb_update_zone_signatures_alarm;
+        event->args = zone;
+        event->key = ALARM_KEY_ZONE_SIGNATURE_UPDATE;
+        event->flags = ALARM_DUP_REMOVE_LATEST;
+        event->text = "zdb_update_zone_signatures_alarm";
+
+        alarm_set(zone->alarm_handle, event);
+    }
+
+    return SUCCESS;
+}
+
+void
+zdb_update_zone_signatures_set_rate(u32 signatures_per_second)
+{
+    zdb_update_signatures_rate = signatures_per_second;
+
+    rrsig_expiration_index_enable(signatures_per_second != 0);
+}
+
+u32
+zdb_update_zone_signatures_get_rate()
+{
+    return zdb_update_signatures_rate;
+}
+
+u32
+zdb_update_zone_signatures_next_epoch(zdb_zone* zone)
+{
+    u32 first = rrsig_expiration_index_first(&zone->sig_expiration);
+
+    if(first == MAX_U32)
+    {
+        return MAX_U32;
+    }
+
+    return (first > zone->sig_validity_regeneration_seconds) ? first - zone->sig_validity_regeneration_seconds : 0;
+}
+
+typedef struct zdb_update_zone_signatures_slice_args zdb_update_zone_signatures_slice_args;
+
+struct zdb_update_zone_signatures_slice_args
+{
+    u32 until;
+    u32 signatures_max;
+    u32 signatures;
+    u32 labels;
+};
+
+/*
+ * Finds the label of the fqdn in the zone and sets the path to it.
+ * The path only points to the labels names in the database.
+ */
+
+static zdb_rr_label*
+zdb_update_zone_signatures_find_label(zdb_zone* zone, const u8* fqdn, dnsname_stack* path)
+{
+    dnsname_vector name;
+
+    dnsname_to_dnsname_vector(fqdn, &name);
+
+    s32 index = (name.size - zone->origin_vector.size) - 1;
+
+    dnsname_to_dnsname_stack(zone->origin, path);
+
+    zdb_rr_label* label = zone->apex;
+
+    while((label != NULL) && (index >= 0))
+    {
+        if((label = zdb_rr_label_find_child(label, name.labels[index])) != NULL)
+        {
+            dnsname_stack_push_label(path, label->name);
+        }
+
+        index--;
+    }
+
+    return label;
+}
+
+static ya_result
+zdb_update_zone_signatures_slice_body(zdb_zone* zone, dnssec_task* task, void* args_)
+{
+    zdb_update_zone_signatures_slice_args* args = (zdb_update_zone_signatures_slice_args*)args_;
+
+    u8 fqdn[MAX_DOMAIN_LENGTH];
+
+    while((args->signatures < args->signatures_max) && !dnscore_shuttingdown())
+    {
+        if(!rrsig_expiration_index_pop(&zone->sig_expiration, args->until, fqdn))
+        {
+            break;
+        }
+
+        zdb_rr_label* label = zdb_update_zone_signatures_find_label(zone, fqdn, &task->path);
+
+        if((label == NULL) || !LABEL_HAS_RECORDS(label))
+        {
+            /* the label has been removed since */
+
+            continue;
+        }
+
+        bool delegation = (label != zone->apex) && (zdb_record_find(&label->resource_record_set, TYPE_NS) != NULL);
+
+        /* the cost of the label is its current number of signatures */
+
+        u32 signatures = 0;
+
+        for(zdb_packed_ttlrdata* rrsig = zdb_record_find(&label->resource_record_set, TYPE_RRSIG); rrsig != NULL; rrsig = rrsig->next)
+        {
+            signatures++;
+        }
+
+        args->signatures += MAX(signatures, 1);
+        args->labels++;
+
+        dnssec_process_queue_label(zone, task, label, delegation);
+    }
+
+    return SUCCESS;
+}
+
+ya_result
+zdb_update_zone_signatures_slice(zdb_zone* zone, u32 signatures_max, u32 *next_epochp)
+{
+    *next_epochp = MAX_U32;
+
+    if(!zdb_zone_is_dnssec(zone))
+    {
+        return ZDB_ERROR_ZONE_IS_NOT_SIGNED;
+    }
+
+    if(!zdb_zone_trylock(zone, ZDB_ZONE_MUTEX_RRSIG_UPDATER|0x80))
+    {
+        return ZDB_ERROR_ZONE_IS_ALREADY_BEING_SIGNED;
+    }
+
+    u32 now = time(NULL);
+
+    zdb_update_zone_signatures_slice_args args;
+    args.until = now + zone->sig_validity_regeneration_seconds;
+    args.signatures_max = signatures_max;
+    args.signatures = 0;
+    args.labels = 0;
+
+    ya_result ret = SUCCESS;
+
+    dnssec_task task;
+
+    if(zdb_update_zone_signatures_next_epoch(zone) <= now)
+    {
+        if(ISOK(ret = dnssec_process_initialize(&task, &dnssec_updater_task_descriptor_scheduled)))
+        {
+            ret = dnssec_process_zone_journal(zone, &task, &zdb_update_zone_signatures_slice_body, &args);
+        }
+
+        dnssec_process_finalize(&task);
+
+        log_debug("zdb_update_zone_signatures_slice(%{dnsname}): %u labels, %u signatures", zone->origin, args.labels, args.signatures);
+    }
+
+#if ZDB_NSEC3_SUPPORT != 0
+    /*
+     * The NSEC3 signatures are not bound to labels : the chain is processed as a whole when its first signature is due.
+     * After the pass, no signature of the chain expires before the end of the current window so the next check
+     * is set one regeneration period from now.
+     */
+
+    if(ISOK(ret) && zdb_zone_is_nsec3(zone) && !dnscore_shuttingdown() && (zone->sig_expiration.nsec3_invalid_first <= args.until))
+    {
+        rrsig_expiration_index_clear_nsec3(&zone->sig_expiration);
+
+        if(ISOK(ret = dnssec_process_initialize(&task, &dnssec_nsec3_updater_task_descriptor_scheduled)))
+        {
+            ret = dnssec_process_zone_nsec3(zone, &task);
+        }
+
+        dnssec_process_finalize(&task);
+
+        rrsig_expiration_index_add_nsec3(&zone->sig_expiration, args.until + zone->sig_validity_regeneration_seconds);
+    }
+#endif
+
+    zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_RRSIG_UPDATER|0x80);
+
+    if(ISOK(ret))
+    {
+        u32 next_epoch = zdb_update_zone_signatures_next_epoch(zone);
+
+        /* more to do in this window : continue in a second */
+
+        *next_epochp = (next_epoch <= now) ? now + 1 : next_epoch;
+
+        ret = args.labels;
+    }
+
+    return ret;
 }
 
 ya_result
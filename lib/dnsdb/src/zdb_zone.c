@@ -41,6 +41,7 @@
  */
 
 #include <unistd.h>
+#include <sched.h>
 #include <arpa/inet.h>
 
 #ifndef NDEBUG
@@ -65,6 +66,8 @@
 #include "dnsdb/dnsrdata.h"
 
 #include "dnsdb/zdb_listener.h"
+#include "dnsdb/zdb_epoch.h"
+#include "dnsdb/zdb_answer_cache.h"
 
 #if ZDB_NSEC_SUPPORT != 0
 #include "dnsdb/nsec.h"
@@ -411,6 +414,7 @@ zdb_zone_create(const u8* origin, u16 zclass)
     zone->sig_validity_regeneration_seconds = 7*24*3600;    /* 1 week */
     zone->sig_validity_jitter_seconds = 86400;              /* 1 day */
     zone->sig_invalid_first = MAX_U32;
+    rrsig_expiration_index_init(&zone->sig_expiration);
 #endif
 
     zone->alarm_handle = alarm_open(zone->origin);
@@ -420,8 +424,17 @@ zdb_zone_create(const u8* origin, u16 zclass)
 
     zone->query_access_filter = zdb_default_query_access_filter;
     zone->extension = NULL;
+    
+    zone->answer_cache_generation = 0;
+#if ZDB_NSEC3_SUPPORT != 0
+    zone->proof_cache_generation = 0;
+#endif
+    zone->axfr_stream_locked = FALSE;
 
     mutex_init(&zone->mutex);
+#if MUTEX_USE_SPINLOCK == 0
+    pthread_cond_init(&zone->mutex_cond, NULL);
+#endif
     zone->mutex_owner = ZDB_ZONE_MUTEX_NOBODY;
     zone->mutex_count = 0;
 
@@ -446,6 +459,21 @@ zdb_zone_truncate_invalidate(zdb_zone* zone)
 
         if(zone->apex != NULL)
         {
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+            /*
+             * The zone is still reachable : queries coming from now on will
+             * see it invalid, the ones already in it have to leave first.
+             */
+            
+            zone->apex->flags |= ZDB_RR_LABEL_INVALID_ZONE;
+#endif
+            
+            zdb_answer_cache_invalidate(zone);
+#if ZDB_NSEC3_SUPPORT != 0
+            nsec3_proof_cache_invalidate(zone);
+#endif
+            
+            zdb_epoch_synchronize();
 
 #if ZDB_NSEC_SUPPORT != 0
             if(zdb_zone_is_nsec(zone))
@@ -495,6 +523,18 @@ zdb_zone_destroy(zdb_zone* zone)
          *		    dnslabel_vector_reference path,s32 path_index);
          */
 
+        /*
+         * The zone has been detached : wait for the queries that could still be in it.
+         * Done before taking the lock as such a query may be waiting for it.
+         */
+        
+        zdb_answer_cache_invalidate_all();
+#if ZDB_NSEC3_SUPPORT != 0
+        nsec3_proof_cache_invalidate_all();
+#endif
+        
+        zdb_epoch_synchronize();
+        
         while(!zdb_zone_trylock(zone, ZDB_ZONE_MUTEX_DESTROY))
         {
             log_warn("zone: waiting to destroy zone locked by #%i (wait)", zone->mutex_owner);
@@ -529,12 +569,19 @@ zdb_zone_destroy(zdb_zone* zone)
             }
         }
 
+#if ZDB_DNSSEC_SUPPORT != 0
+        rrsig_expiration_index_destroy(&zone->sig_expiration);
+#endif
+
         ZFREE_STRING(zone->origin);
 
 #ifndef NDEBUG
         zone->origin = NULL;
 #endif
 
+#if MUTEX_USE_SPINLOCK == 0
+        pthread_cond_destroy(&zone->mutex_cond);
+#endif
         mutex_destroy(&zone->mutex);
 
         ZFREE(zone, zdb_zone);
@@ -626,6 +673,27 @@ zdb_zone_get_dnskey_rrset(zdb_zone *zone)
  * Zone lock
  */
 
+/**
+ * Tells if the owner of the lock can have changed the content of the zone.
+ * The readers (queries, transfers) cannot.
+ */
+
+static inline bool
+zdb_zone_mutex_owner_writes(u8 owner)
+{
+    switch(owner & 0x7f)
+    {
+        case ZDB_ZONE_MUTEX_RRSIG_UPDATER: /* and ZDB_ZONE_MUTEX_NSEC3_UPDATER */
+        case ZDB_ZONE_MUTEX_REFRESH & 0x7f:
+        case ZDB_ZONE_MUTEX_DYNUPDATE & 0x7f:
+        case ZDB_ZONE_MUTEX_UNFREEZE & 0x7f:
+        case ZDB_ZONE_MUTEX_DESTROY & 0x7f:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
 void
 zdb_zone_lock(zdb_zone *zone, u8 owner)
 {
@@ -633,6 +701,42 @@ zdb_zone_lock(zdb_zone *zone, u8 owner)
     log_notice("acquiring lock for zone %{dnsname} for %x", zone->origin, owner);
 #endif
 
+#if MUTEX_USE_SPINLOCK == 0
+    mutex_lock(&zone->mutex);
+    
+    for(;;)
+    {
+        /*
+            An simple way to ensure that a lock can be shared
+            by similar entities or not.
+            Sharable entities have their msb off.
+        */
+
+        u8 co = zone->mutex_owner & 0x7f;
+        
+        if(co == ZDB_ZONE_MUTEX_NOBODY || co == owner)
+        {
+            zassert(zone->mutex_count != 255);
+
+#if ZONE_MUTEX_LOG
+            log_notice("acquired lock for zone %{dnsname} for %x", zone->origin, owner);
+#endif
+            
+            zone->mutex_owner = owner & 0x7f;
+            zone->mutex_count++;
+            
+            break;
+        }
+        
+        /*
+         * Sleep until the lock is released instead of polling it.
+         */
+        
+        pthread_cond_wait(&zone->mutex_cond, &zone->mutex);
+    }
+    
+    mutex_unlock(&zone->mutex);
+#else
     for(;;)
     {
         mutex_lock(&zone->mutex);
@@ -663,17 +767,11 @@ zdb_zone_lock(zdb_zone *zone, u8 owner)
 
         mutex_unlock(&zone->mutex);
 
-        /*
-         * Don't set this too low.
-         * A lock basically slows down a task to 100000Hz
-         * Waiting close to 0.00001 seconds is counterproductive.
-         * Given that we are using locks for slow tasks, waiting 1ms seems reasonable.
-         * 
-         * todo: use broadcasts
-         */
+        /* a spinlock cannot be waited on */
 
-        usleep(1000);
+        sched_yield();
     }
+#endif
 }
 
 bool
@@ -729,9 +827,30 @@ zdb_zone_unlock(zdb_zone *zone, u8 owner)
     if(zone->mutex_count == 0)
     {
         zone->mutex_owner = ZDB_ZONE_MUTEX_NOBODY;
+        
+#if MUTEX_USE_SPINLOCK == 0
+        pthread_cond_broadcast(&zone->mutex_cond);
+#endif
     }
     
     mutex_unlock(&zone->mutex);
+    
+    /* a writer is done : release what the readers cannot see anymore (a bounded amount, it is on its way out) */
+    
+    if(zdb_zone_mutex_owner_writes(owner))
+    {
+        zdb_answer_cache_invalidate(zone);
+#if ZDB_NSEC3_SUPPORT != 0
+        nsec3_proof_cache_invalidate(zone);
+#endif
+        zdb_epoch_reclaim_bounded();
+    }
+}
+
+bool
+zdb_zone_iswritelocked(zdb_zone *zone)
+{
+    return zdb_zone_mutex_owner_writes(zone->mutex_owner);
 }
 
 bool
@@ -750,6 +869,10 @@ zdb_zone_transferlock(zdb_zone *zone, u8 owner, u8 newowner)
     if((r = (co == owner)))
     {
         zone->mutex_owner = newowner;
+        
+#if MUTEX_USE_SPINLOCK == 0
+        pthread_cond_broadcast(&zone->mutex_cond);
+#endif
     }
 
     mutex_unlock(&zone->mutex);
@@ -791,12 +914,37 @@ zdb_zone_xchg_with_invalid(zdb *db, const u8 *origin, u16 zclass, u16 or_flags)
         
         zone_label->zone = zone;
         
-        
+        zdb_answer_cache_invalidate_all();
+#if ZDB_NSEC3_SUPPORT != 0
+        nsec3_proof_cache_invalidate_all();
+#endif
     }
     
     return old;
 }
 
+zdb_zone*
+zdb_zone_xchg(zdb *db, zdb_zone *zone)
+{
+    dnsname_vector name;    
+    dnsname_to_dnsname_vector(zone->origin, &name);
+    
+    zdb_zone_label *zone_label = zdb_zone_label_add(db, &name, zdb_zone_getclass(zone));
+    
+    /* the content of the zone must be visible before the zone is */
+    
+    __sync_synchronize();
+    
+    zdb_zone *old = __sync_lock_test_and_set(&zone_label->zone, zone);
+    
+    zdb_answer_cache_invalidate_all();
+#if ZDB_NSEC3_SUPPORT != 0
+    nsec3_proof_cache_invalidate_all();
+#endif
+    
+    return old;
+}
+
 bool
 zdb_zone_isinvalid(zdb *db, const u8 *origin, u16 zclass)
 {
@@ -0,0 +1,615 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbscheduler Scheduled tasks of the database
+ *  @ingroup dnsdb
+ *  @brief AXFR stream of a zone
+ *
+ *  The stream keeps its position in the zone (label iterator, record set
+ *  iterator, record, NSEC3 chain and item) and fills its buffer with as many
+ *  whole records as it can hold each time it has been read through.
+ *
+ *  Every fill checks that no writer has taken or released the zone since the
+ *  stream has been opened, so a cut transfer is detected as early as
+ *  possible.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dnscore/logger.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/base32hex.h>
+#include <dnscore/rfc.h>
+
+#include "dnsdb/zdb_zone.h"
+#include "dnsdb/zdb_zone_label_iterator.h"
+#include "dnsdb/zdb_record.h"
+#include "dnsdb/zdb_epoch.h"
+#include "dnsdb/zdb_error.h"
+#include "dnsdb/zdb_zone_axfr_input_stream.h"
+
+#if ZDB_NSEC3_SUPPORT != 0
+#include "dnsdb/nsec3.h"
+#endif
+
+extern logger_handle* g_database_logger;
+#define MODULE_MSG_HANDLE g_database_logger
+
+#define ZAXSTRM_TAG 0x4d5254535841415a /* ZAAXSTRM */
+
+#define TCTS_SIZE 10
+
+/* name + type class ttl rdata size + mname + rname + 5 u32 */
+
+#define ZDB_ZONE_AXFR_STREAM_SOA_SIZE       (MAX_DOMAIN_LENGTH + TCTS_SIZE + MAX_DOMAIN_LENGTH + MAX_DOMAIN_LENGTH + 20)
+
+#define ZDB_ZONE_AXFR_STREAM_LABELS         0
+#define ZDB_ZONE_AXFR_STREAM_NSEC3          1
+#define ZDB_ZONE_AXFR_STREAM_SOA            2
+#define ZDB_ZONE_AXFR_STREAM_DONE           3
+#define ZDB_ZONE_AXFR_STREAM_CUT            4
+
+typedef struct zdb_zone_axfr_input_stream_data zdb_zone_axfr_input_stream_data;
+
+struct zdb_zone_axfr_input_stream_data
+{
+    zdb_zone *zone;
+    
+    zdb_zone_label_iterator label_iter;
+    btree_iterator type_iter;
+    zdb_packed_ttlrdata *rr;            /* next record of the current record set */
+    
+#if ZDB_NSEC3_SUPPORT != 0
+    nsec3_zone *n3;                     /* current NSEC3 chain */
+    nsec3_avl_iterator n3_iter;
+    nsec3_zone_item *n3_first;
+    nsec3_zone_item *n3_item;           /* next item of the current chain, NULL if the chain has not been started */
+    nsec3_zone_item *n3_next;           /* the item following n3_item (the first one for the last item) */
+    zdb_packed_ttlrdata *rrsig;         /* next signature of the last item written */
+    u32 minimum_ttl;
+#endif
+    
+    u32 generation;                     /* answer_cache_generation of the zone when the stream was opened */
+    u32 serial;
+    u32 offset;
+    u32 size;
+    u32 fqdn_len;
+    u32 soa_size;
+    u16 rtype;
+    u16 rclass;
+    u8 state;
+    bool locked;                        /* the reader lock is held instead of the epoch */
+    
+    u8 fqdn[MAX_DOMAIN_LENGTH + 2];     /* owner of the current records, with room for the wildcard label */
+    u8 soa[ZDB_ZONE_AXFR_STREAM_SOA_SIZE];
+    u8 buffer[ZDB_ZONE_AXFR_INPUT_STREAM_BUFFER_SIZE];
+};
+
+static const u8 wild_wire[2] = {1, '*'};
+
+static inline void
+zdb_zone_axfr_input_stream_write(zdb_zone_axfr_input_stream_data *data, const void *bytes, u32 len)
+{
+    MEMCOPY(&data->buffer[data->size], bytes, len);
+    data->size += len;
+}
+
+/*
+ * Writes a record owned by data->fqdn, if it fits in the buffer
+ */
+
+static bool
+zdb_zone_axfr_input_stream_write_record(zdb_zone_axfr_input_stream_data *data, u16 rtype, const zdb_packed_ttlrdata *rr)
+{
+    if(data->size + data->fqdn_len + TCTS_SIZE + rr->rdata_size > sizeof(data->buffer))
+    {
+        return FALSE;
+    }
+    
+    zdb_zone_axfr_input_stream_write(data, data->fqdn, data->fqdn_len);
+    SET_U16_AT(data->buffer[data->size], rtype);        /** @note: NATIVETYPE */
+    SET_U16_AT(data->buffer[data->size + 2], data->rclass); /** @note: NATIVECLASS */
+    SET_U32_AT(data->buffer[data->size + 4], htonl(rr->ttl));
+    SET_U16_AT(data->buffer[data->size + 8], htons(rr->rdata_size));
+    data->size += TCTS_SIZE;
+    zdb_zone_axfr_input_stream_write(data, rr->rdata_start, rr->rdata_size);
+    
+    return TRUE;
+}
+
+/*
+ * TRUE if a writer has taken or released the zone since the stream has been opened
+ */
+
+static bool
+zdb_zone_axfr_input_stream_changed(zdb_zone_axfr_input_stream_data *data)
+{
+    if(data->locked)
+    {
+        return FALSE;
+    }
+    
+    __sync_synchronize();
+    
+    return zdb_zone_iswritelocked(data->zone) || (data->zone->answer_cache_generation != data->generation);
+}
+
+/*
+ * The records sent so far cannot be trusted anymore : the transfer fails before its closing SOA
+ */
+
+static void
+zdb_zone_axfr_input_stream_cut(zdb_zone_axfr_input_stream_data *data)
+{
+    log_warn("zone axfr stream: %{dnsname} %d has been changed during the transfer: cutting it", data->zone->origin, data->serial);
+    
+    /* the next transfer of the zone will not be cut */
+    
+    data->zone->axfr_stream_locked = TRUE;
+    
+    data->state = ZDB_ZONE_AXFR_STREAM_CUT;
+}
+
+#if ZDB_NSEC3_SUPPORT != 0
+
+/*
+ * Writes the NSEC3 record of data->n3_item, if it fits in the buffer
+ */
+
+static ya_result
+zdb_zone_axfr_input_stream_write_nsec3(zdb_zone_axfr_input_stream_data *data)
+{
+    nsec3_zone *n3 = data->n3;
+    nsec3_zone_item *item = data->n3_item;
+    
+    u8 digest_len = NSEC3_NODE_DIGEST_SIZE(item);
+    u32 rdata_hash_offset = NSEC3_ZONE_RDATA_SIZE(n3);
+    u32 encoded_digest_len = BASE32HEX_ENCODED_LEN(digest_len);
+    u32 origin_len = dnsname_len(data->zone->origin);
+    u32 rdata_size = rdata_hash_offset + digest_len + 1 + item->type_bit_maps_size;
+    
+    if(rdata_size > RDATA_MAX_LENGTH)
+    {
+        return ZDB_ERROR_GENERAL;
+    }
+    
+    if(data->size + 1 + encoded_digest_len + origin_len + TCTS_SIZE + rdata_size > sizeof(data->buffer))
+    {
+        return 0;
+    }
+    
+    /* the owner is kept for the signatures */
+    
+    data->fqdn[0] = encoded_digest_len;
+    base32hex_encode(NSEC3_NODE_DIGEST_PTR(item), digest_len, (char*)&data->fqdn[1]);
+    MEMCOPY(&data->fqdn[1 + encoded_digest_len], data->zone->origin, origin_len);
+    data->fqdn_len = 1 + encoded_digest_len + origin_len;
+    
+    zdb_zone_axfr_input_stream_write(data, data->fqdn, data->fqdn_len);
+    SET_U16_AT(data->buffer[data->size], TYPE_NSEC3);  /** @note NATIVETYPE */
+    SET_U16_AT(data->buffer[data->size + 2], CLASS_IN); /** @note NATIVECLASS */
+    SET_U32_AT(data->buffer[data->size + 4], htonl(data->minimum_ttl));
+    SET_U16_AT(data->buffer[data->size + 8], htons(rdata_size));
+    data->size += TCTS_SIZE;
+    
+    data->buffer[data->size++] = n3->rdata[0];
+    data->buffer[data->size++] = item->flags;
+    zdb_zone_axfr_input_stream_write(data, &n3->rdata[2], rdata_hash_offset - 2);
+    zdb_zone_axfr_input_stream_write(data, data->n3_next->digest, digest_len + 1);
+    zdb_zone_axfr_input_stream_write(data, item->type_bit_maps, item->type_bit_maps_size);
+    
+    return 1;
+}
+
+#endif
+
+/*
+ * Refills the (consumed) buffer with the next records.
+ * Leaves it empty at the end of the stream.
+ */
+
+static ya_result
+zdb_zone_axfr_input_stream_fill(zdb_zone_axfr_input_stream_data *data)
+{
+    data->offset = 0;
+    data->size = 0;
+    
+    if((data->state < ZDB_ZONE_AXFR_STREAM_DONE) && zdb_zone_axfr_input_stream_changed(data))
+    {
+        zdb_zone_axfr_input_stream_cut(data);
+    }
+    
+    for(;;)
+    {
+        switch(data->state)
+        {
+            case ZDB_ZONE_AXFR_STREAM_LABELS:
+            {
+                if(data->rr != NULL)
+                {
+                    if(!zdb_zone_axfr_input_stream_write_record(data, data->rtype, data->rr))
+                    {
+                        return SUCCESS;
+                    }
+                    
+                    data->rr = data->rr->next;
+                    
+                    continue;
+                }
+                
+                if(btree_iterator_hasnext(&data->type_iter))
+                {
+                    btree_node *type_node = btree_iterator_next_node(&data->type_iter);
+                    
+                    if(type_node->hash != TYPE_SOA)
+                    {
+                        data->rtype = (u16)type_node->hash; /** @note: NATIVETYPE */
+                        data->rr = (zdb_packed_ttlrdata*)type_node->data;
+                    }
+                    
+                    continue;
+                }
+                
+                if(zdb_zone_label_iterator_hasnext(&data->label_iter))
+                {
+                    data->fqdn_len = zdb_zone_label_iterator_nextname(&data->label_iter, &data->fqdn[sizeof(wild_wire)]);
+                    
+                    zdb_rr_label *label = zdb_zone_label_iterator_next(&data->label_iter);
+                    
+                    if((label->flags & ZDB_RR_LABEL_GOT_WILD) != 0)
+                    {
+                        MEMCOPY(data->fqdn, wild_wire, sizeof(wild_wire));
+                        data->fqdn_len += sizeof(wild_wire);
+                    }
+                    else
+                    {
+                        memmove(data->fqdn, &data->fqdn[sizeof(wild_wire)], data->fqdn_len);
+                    }
+                    
+                    btree_iterator_init(label->resource_record_set, &data->type_iter);
+                    
+                    continue;
+                }
+                
+#if ZDB_NSEC3_SUPPORT != 0
+                data->state = ZDB_ZONE_AXFR_STREAM_NSEC3;
+#else
+                data->state = ZDB_ZONE_AXFR_STREAM_SOA;
+#endif
+                continue;
+            }
+#if ZDB_NSEC3_SUPPORT != 0
+            case ZDB_ZONE_AXFR_STREAM_NSEC3:
+            {
+                if(data->rrsig != NULL)
+                {
+                    if(!zdb_zone_axfr_input_stream_write_record(data, TYPE_RRSIG, data->rrsig))
+                    {
+                        return SUCCESS;
+                    }
+                    
+                    data->rrsig = data->rrsig->next;
+                    
+                    continue;
+                }
+                
+                if(data->n3_item == NULL)
+                {
+                    /* start the next chain */
+                    
+                    if(data->n3 == NULL)
+                    {
+                        data->state = ZDB_ZONE_AXFR_STREAM_SOA;
+                        continue;
+                    }
+                    
+                    nsec3_avl_iterator_init(&data->n3->items, &data->n3_iter);
+                    
+                    if(!nsec3_avl_iterator_hasnext(&data->n3_iter))
+                    {
+                        data->n3 = data->n3->next;
+                        continue;
+                    }
+                    
+                    data->n3_first = nsec3_avl_iterator_next_node(&data->n3_iter);
+                    data->n3_item = data->n3_first;
+                    data->n3_next = (nsec3_avl_iterator_hasnext(&data->n3_iter))?nsec3_avl_iterator_next_node(&data->n3_iter):data->n3_first;
+                }
+                
+                ya_result return_code = zdb_zone_axfr_input_stream_write_nsec3(data);
+                
+                if(return_code <= 0)
+                {
+                    return return_code; /* error or no room left */
+                }
+                
+                data->rrsig = data->n3_item->rrsig;
+                
+                if(data->n3_next != data->n3_first)
+                {
+                    data->n3_item = data->n3_next;
+                    data->n3_next = (nsec3_avl_iterator_hasnext(&data->n3_iter))?nsec3_avl_iterator_next_node(&data->n3_iter):data->n3_first;
+                }
+                else
+                {
+                    /* the chain is done once the signatures of its last item are */
+                    
+                    data->n3_item = NULL;
+                    data->n3 = data->n3->next;
+                }
+                
+                continue;
+            }
+#endif
+            case ZDB_ZONE_AXFR_STREAM_SOA:
+            {
+                /* the records read so far are only consistent if no writer has been there in the mean time */
+                
+                if(zdb_zone_axfr_input_stream_changed(data))
+                {
+                    zdb_zone_axfr_input_stream_cut(data);
+                    continue;
+                }
+                
+                if(data->size + data->soa_size > sizeof(data->buffer))
+                {
+                    return SUCCESS;
+                }
+                
+                zdb_zone_axfr_input_stream_write(data, data->soa, data->soa_size);
+                
+                data->state = ZDB_ZONE_AXFR_STREAM_DONE;
+                
+                return SUCCESS;
+            }
+            case ZDB_ZONE_AXFR_STREAM_DONE:
+            {
+                return SUCCESS;
+            }
+            default: /* ZDB_ZONE_AXFR_STREAM_CUT */
+            {
+                data->size = 0;
+                
+                return ZDB_ERROR_ZONE_CHANGED_DURING_AXFR;
+            }
+        }
+    }
+}
+
+static ya_result
+zdb_zone_axfr_input_stream_read(input_stream* stream, u8* buffer, u32 len)
+{
+    zdb_zone_axfr_input_stream_data *data = (zdb_zone_axfr_input_stream_data*)stream->data;
+    u32 total = 0;
+    
+    while(len > 0)
+    {
+        u32 available = data->size - data->offset;
+        
+        if(available == 0)
+        {
+            ya_result return_code;
+            
+            if(FAIL(return_code = zdb_zone_axfr_input_stream_fill(data)))
+            {
+                return (total > 0)?total:return_code;
+            }
+            
+            if(data->size == 0)
+            {
+                break; /* end of the stream */
+            }
+            
+            continue;
+        }
+        
+        u32 n = MIN(len, available);
+        
+        MEMCOPY(buffer, &data->buffer[data->offset], n);
+        data->offset += n;
+        buffer += n;
+        len -= n;
+        total += n;
+    }
+    
+    return total;
+}
+
+static ya_result
+zdb_zone_axfr_input_stream_skip(input_stream* stream, u32 len)
+{
+    zdb_zone_axfr_input_stream_data *data = (zdb_zone_axfr_input_stream_data*)stream->data;
+    u32 total = 0;
+    
+    while(len > 0)
+    {
+        u32 available = data->size - data->offset;
+        
+        if(available == 0)
+        {
+            ya_result return_code;
+            
+            if(FAIL(return_code = zdb_zone_axfr_input_stream_fill(data)))
+            {
+                return (total > 0)?total:return_code;
+            }
+            
+            if(data->size == 0)
+            {
+                break; /* end of the stream */
+            }
+            
+            continue;
+        }
+        
+        u32 n = MIN(len, available);
+        
+        data->offset += n;
+        len -= n;
+        total += n;
+    }
+    
+    return total;
+}
+
+static void
+zdb_zone_axfr_input_stream_close(input_stream* stream)
+{
+    zdb_zone_axfr_input_stream_data *data = (zdb_zone_axfr_input_stream_data*)stream->data;
+    
+    if(data->locked)
+    {
+        zdb_zone_unlock(data->zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
+    }
+    else
+    {
+        zdb_epoch_leave();
+    }
+    
+    free(data);
+    
+    stream->data = NULL;
+    stream->vtbl = NULL;
+}
+
+static const input_stream_vtbl zdb_zone_axfr_input_stream_vtbl =
+{
+    zdb_zone_axfr_input_stream_read,
+    zdb_zone_axfr_input_stream_skip,
+    zdb_zone_axfr_input_stream_close,
+    "zdb_zone_axfr_input_stream",
+};
+
+/*
+ * API
+ */
+
+ya_result
+zdb_zone_axfr_input_stream_open(zdb_zone *zone, input_stream *is, u32 *serialp)
+{
+    zdb_zone_axfr_input_stream_data *data;
+    zdb_packed_ttlrdata *soa;
+    ya_result return_code;
+    u32 serial;
+    
+    /* no writer can be in the zone while the position is taken */
+    
+    zdb_zone_lock(zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
+    
+    if(ZDB_ZONE_INVALID(zone))
+    {
+        zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
+        
+        return ZDB_ERROR_ZONENOTLOADED;
+    }
+    
+    if(FAIL(return_code = zdb_zone_getserial(zone, &serial)) || ((soa = zdb_record_find(&zone->apex->resource_record_set, TYPE_SOA)) == NULL))
+    {
+        zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
+        
+        return ZDB_ERROR_NOSOAATAPEX;
+    }
+    
+    MALLOC_OR_DIE(zdb_zone_axfr_input_stream_data*, data, sizeof(zdb_zone_axfr_input_stream_data), ZAXSTRM_TAG);
+    
+    data->zone = zone;
+    data->serial = serial;
+    data->rclass = zdb_zone_getclass(zone); /** @note: NATIVECLASS */
+    data->offset = 0;
+    data->size = 0;
+    
+    /* the SOA opens and closes the stream : the same one, whatever happens to the zone */
+    
+    data->fqdn_len = dnsname_len(zone->origin);
+    MEMCOPY(data->fqdn, zone->origin, data->fqdn_len);
+    zdb_zone_axfr_input_stream_write_record(data, TYPE_SOA, soa);
+    MEMCOPY(data->soa, data->buffer, data->size);
+    data->soa_size = data->size;
+    
+    zdb_zone_label_iterator_init(zone, &data->label_iter);
+    btree_iterator_init(NULL, &data->type_iter);
+    data->rr = NULL;
+    
+#if ZDB_NSEC3_SUPPORT != 0
+    data->n3 = ((zone->apex->flags & ZDB_RR_LABEL_NSEC3) != 0)?zone->nsec.nsec3:NULL;
+    data->n3_first = NULL;
+    data->n3_item = NULL;
+    data->n3_next = NULL;
+    data->rrsig = NULL;
+    zdb_zone_getminttl(zone, &data->minimum_ttl);
+#endif
+    
+    data->state = ZDB_ZONE_AXFR_STREAM_LABELS;
+    data->generation = zone->answer_cache_generation;
+    
+#if ZDB_EXPLICIT_READER_ZONE_LOCK == 2
+    data->locked = zone->axfr_stream_locked;
+    
+    if(!data->locked)
+    {
+        /* the epoch keeps what the stream can reach until it is closed */
+        
+        zdb_epoch_enter();
+        
+        zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
+    }
+    else
+    {
+        /* a previous transfer has been cut : this one holds back the writers, the next ones will not */
+        
+        zone->axfr_stream_locked = FALSE;
+        
+        log_info("zone axfr stream: %{dnsname} %d is sent under the reader lock", zone->origin, serial);
+    }
+#else
+    data->locked = TRUE; /* the readers are not protected by an epoch */
+#endif
+    
+    is->data = data;
+    is->vtbl = (input_stream_vtbl*)&zdb_zone_axfr_input_stream_vtbl;
+    
+    *serialp = serial;
+    
+    return SUCCESS;
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
@@ -0,0 +1,935 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbscheduler Scheduled tasks of the database
+ *  @ingroup dnsdb
+ *  @brief Pre-framed IXFR answers kept in the xfr directory
+ *
+ *  The images are registered in a list protected by a mutex.  A transfer
+ *  finding the image of its delta being built waits for it.  The images of a
+ *  zone are dropped as soon as the zone has a new serial, and the idle ones
+ *  are dropped, least recently used first, past ZDB_ZONE_IXFR_IMAGE_IDLE_MAX.
+ *
+ *  An image keeps its file open : the file can be removed from the directory
+ *  while it is being sent.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#ifdef __linux__
+/* sendfile */
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include <dnscore/logger.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/format.h>
+#include <dnscore/fdtools.h>
+#include <dnscore/file_output_stream.h>
+#include <dnscore/buffer_output_stream.h>
+#include <dnscore/buffer_input_stream.h>
+#include <dnscore/packet_writer.h>
+#include <dnscore/serial.h>
+#include <dnscore/tsig.h>
+
+#include "dnsdb/zdb_icmtl.h"
+#include "dnsdb/zdb_utils.h"
+#include "dnsdb/zdb_zone_ixfr_image.h"
+
+extern logger_handle* g_database_logger;
+#define MODULE_MSG_HANDLE g_database_logger
+
+#define ZIXIMAGE_TAG 0x4547414d4958495a /* ZIXIMAGE */
+#define ZIXIPCKT_TAG 0x544b43504958495a /* ZIXIPCKT */
+
+#define FILE_BUFFER_SIZE    4096
+
+#define RECORD_MODE_DELETE  0
+#define RECORD_MODE_ADD     1
+
+#define ZDB_ZONE_IXFR_IMAGE_BUILDING    0
+#define ZDB_ZONE_IXFR_IMAGE_READY       1
+#define ZDB_ZONE_IXFR_IMAGE_FAILED      2
+
+/* Images nobody is sending that are kept for the next slaves */
+
+#define ZDB_ZONE_IXFR_IMAGE_IDLE_MAX    256
+
+struct zdb_zone_ixfr_image
+{
+    zdb_zone_ixfr_image *next;
+    char *path;
+    u64 size;
+    u32 from_serial;
+    u32 to_serial;
+    u32 rc;
+    u32 message_count;
+    ya_result build_code;
+    int fd;
+    u8 state;
+    bool obsolete;
+    u8 origin[MAX_DOMAIN_LENGTH];
+};
+
+static pthread_mutex_t zdb_zone_ixfr_image_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zdb_zone_ixfr_image_cond = PTHREAD_COND_INITIALIZER;
+static zdb_zone_ixfr_image *zdb_zone_ixfr_image_list = NULL;
+static u32 zdb_zone_ixfr_image_idle_count = 0;
+
+/*
+ * The registry mutex must be held
+ */
+
+static void
+zdb_zone_ixfr_image_unlink_and_free(zdb_zone_ixfr_image *image)
+{
+    zdb_zone_ixfr_image **prevp = &zdb_zone_ixfr_image_list;
+    
+    while(*prevp != image)
+    {
+        prevp = &(*prevp)->next;
+    }
+    
+    *prevp = image->next;
+    
+    if(image->fd >= 0)
+    {
+        close_ex(image->fd);
+    }
+    
+    if(image->obsolete || (image->state != ZDB_ZONE_IXFR_IMAGE_READY))
+    {
+        unlink(image->path);
+    }
+    
+    free(image->path);
+    free(image);
+}
+
+/*
+ * The registry mutex must be held
+ */
+
+static void
+zdb_zone_ixfr_image_trim()
+{
+    while(zdb_zone_ixfr_image_idle_count > ZDB_ZONE_IXFR_IMAGE_IDLE_MAX)
+    {
+        zdb_zone_ixfr_image *last_idle = NULL;
+        
+        for(zdb_zone_ixfr_image *image = zdb_zone_ixfr_image_list; image != NULL; image = image->next)
+        {
+            if(image->rc == 0)
+            {
+                last_idle = image;
+            }
+        }
+        
+        if(last_idle == NULL)
+        {
+            break;
+        }
+        
+        last_idle->obsolete = TRUE;
+        
+        zdb_zone_ixfr_image_unlink_and_free(last_idle);
+        
+        zdb_zone_ixfr_image_idle_count--;
+    }
+}
+
+/*
+ * Removes the answers of older serials of the zone (from this run or a previous one)
+ */
+
+static void
+zdb_zone_ixfr_image_clean_older(const char *data_path, const u8 *origin, u32 to_serial)
+{
+    char fqdn[MAX_DOMAIN_TEXT_LENGTH + 1];
+    char path[1024];
+    struct dirent entry;
+    struct dirent *result;
+    
+    s32 fqdn_len = dnsname_to_cstr(fqdn, origin) - 1;
+
+    DIR* dir = opendir(data_path);
+    
+    if(dir == NULL)
+    {
+        return;
+    }
+
+    for(;;)
+    {
+        readdir_r(dir, &entry, &result);
+
+        if(result == NULL)
+        {
+            break;
+        }
+
+        if(memcmp(result->d_name, fqdn, fqdn_len) != 0)
+        {
+            continue;
+        }
+        
+        const char* serials = &result->d_name[fqdn_len];
+
+        if((strlen(serials) == 8 + 1 + 8 + 5) && (strcmp(&serials[8 + 1 + 8], ".ixfr") == 0))
+        {
+            u32 from;
+            u32 to;
+
+            if(sscanf(serials, "%08x-%08x", &from, &to) == 2)
+            {
+                if(serial_lt(to, to_serial))
+                {
+                    if(ISOK(snformat(path, sizeof(path), "%s/%s", data_path, result->d_name)))
+                    {
+                        log_debug("zone ixfr image: removing obsolete '%s'", path);
+
+                        unlink(path);
+                    }
+                }
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+static ya_result
+zdb_zone_ixfr_image_read_record(input_stream *is, u8 *qname, u32 *qname_sizep, struct type_class_ttl_rdlen *tctrlp, u8 *rdata_buffer, u32 *rdata_sizep)
+{
+    ya_result return_code;
+
+    /* Read the next DNAME from the stored INCREMENTAL */
+
+    if(FAIL(return_code = input_stream_read_dnsname(is, qname)))
+    {
+        log_err("zone ixfr image: error reading IXFR qname: %r", return_code);
+        return return_code;
+    }
+
+    *qname_sizep = return_code;
+
+    if(return_code > 0)
+    {
+        /* read the next type+class+ttl+rdatalen from the stored IXFR */
+
+        tctrlp->qtype = 0;
+        tctrlp->rdlen = 0;
+
+        if(FAIL(return_code = input_stream_read_fully(is, (u8*) tctrlp, 10)))
+        {
+            log_err("zone ixfr image: error reading IXFR record: %r", return_code);
+
+            return return_code;
+        }
+
+        if(FAIL(return_code = input_stream_read_fully(is, rdata_buffer, ntohs(tctrlp->rdlen))))
+        {
+            log_err("zone ixfr image: error reading IXFR record rdata: %r", return_code);
+
+            return return_code;
+        }
+
+        *rdata_sizep = return_code;
+
+        return_code = *qname_sizep + 10 + *rdata_sizep;
+    }
+
+    return return_code;
+}
+
+/*
+ * Closes the current message : adds the end SOA, sets the count and writes it with its TCP length.
+ */
+
+static ya_result
+zdb_zone_ixfr_image_write_message(zdb_zone_ixfr_image *image, output_stream *os, packet_writer *pw, u16 an_record_count, const struct type_class_ttl_rdlen *soa_tctrl, const u8 *soa_rdata, u32 soa_rdata_size)
+{
+    ya_result return_code;
+    
+    packet_writer_add_fqdn(pw, image->origin);
+    packet_writer_add_bytes(pw, (const u8*)soa_tctrl, 8);
+    packet_writer_add_rdata(pw, TYPE_SOA, soa_rdata, soa_rdata_size);
+
+    an_record_count++;
+
+    MESSAGE_AN(pw->packet) = htons(an_record_count);
+    
+    if(ISOK(return_code = write_tcp_packet(pw, os)))
+    {
+        image->size += 2 + pw->packet_offset;
+        image->message_count++;
+    }
+    
+    return return_code;
+}
+
+/*
+ * Starts a message : the header, the question, the current SOA and the SOA the delta starts from.
+ */
+
+static u16
+zdb_zone_ixfr_image_begin_message(zdb_zone_ixfr_image *image, packet_writer *pw, u32 question_end, const struct type_class_ttl_rdlen *tctrl, const u8 *rdata, u32 rdata_size, const struct type_class_ttl_rdlen *soa_tctrl, const u8 *soa_rdata, u32 soa_rdata_size)
+{
+    packet_writer_init(pw, pw->packet, question_end, DNSPACKET_MAX_LENGTH - 780);
+    
+    /*
+     * Init
+     */
+    
+    packet_writer_add_fqdn(pw, image->origin);
+    packet_writer_add_bytes(pw, (const u8*)soa_tctrl, 8);
+    packet_writer_add_rdata(pw, TYPE_SOA, soa_rdata, soa_rdata_size);
+    
+    if(tctrl == NULL)
+    {
+        return 1;
+    }
+    
+    /*
+     * Begin
+     */
+    
+    packet_writer_add_fqdn(pw, image->origin);
+    packet_writer_add_bytes(pw, (const u8*)tctrl, 8);
+    packet_writer_add_rdata(pw, tctrl->qtype, rdata, rdata_size);
+    
+    return 2;
+}
+
+/*
+ * Writes the messages in the file, as the IXFR thread used to send them.
+ * 
+ * Every message is a complete answer (current SOA ... current SOA).
+ * Messages are closed at the first SOA boundary past half of the packet size.
+ * If a delta does not fit, the message is cut at the last SOA boundary and the
+ * journal is opened again from there.
+ */
+
+static ya_result
+zdb_zone_ixfr_image_build(zdb_zone_ixfr_image *image, const char *data_path, const struct type_class_ttl_rdlen *soa_tctrl, const u8 *soa_rdata, u32 soa_rdata_size)
+{
+    input_stream fis;
+    output_stream os;
+    packet_writer pw;
+    struct type_class_ttl_rdlen tctrl;
+    ya_result return_code;
+    u32 qname_size;
+    u32 rdata_size;
+    u32 serial = image->from_serial;
+    u32 last_valid_serial = serial;
+    u32 last_valid_offset;
+    u16 last_valid_count;
+    u16 an_record_count;
+    u8 record_mode;
+    u8 fqdn[MAX_DOMAIN_LENGTH];
+    u8 *rdata_buffer;
+    u8 *packet;
+    
+    u32 packet_size_trigger = DNSPACKET_MAX_LENGTH / 2;
+    
+    MALLOC_OR_DIE(u8*, rdata_buffer, RDATA_MAX_LENGTH, GENERIC_TAG);    /* rdata max size */
+
+    if(FAIL(return_code = zdb_icmtl_open_ix_get_soa(image->origin, data_path, serial, &fis, &tctrl, rdata_buffer, &rdata_size)))
+    {
+        log_info("zone ixfr image: %{dnsname} %d not in the journal: %r", image->origin, serial, return_code);
+        
+        free(rdata_buffer);
+        
+        return return_code;
+    }
+    
+    /* the file may exist : do not write into an inode that could be read by a previous run */
+    
+    unlink(image->path);
+    
+    if((image->fd = open(image->path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0)
+    {
+        return_code = ERRNO_ERROR;
+        
+        log_err("zone ixfr image: cannot create '%s': %r", image->path, return_code);
+        
+        input_stream_close(&fis);
+        free(rdata_buffer);
+        
+        return return_code;
+    }
+    
+    fd_output_stream_attach(dup(image->fd), &os);
+    
+    buffer_input_stream_init(&fis, &fis, FILE_BUFFER_SIZE);
+    buffer_output_stream_init(&os, &os, FILE_BUFFER_SIZE);
+    
+    MALLOC_OR_DIE(u8*, packet, DNSPACKET_MAX_LENGTH, ZIXIPCKT_TAG);
+    
+    /*
+     * The header and the question are set once.
+     * ID and flags are put by each transfer.
+     */
+    
+    ZEROMEMORY(packet, DNS_HEADER_LENGTH);
+    MESSAGE_HIFLAGS(packet) = QR_BITS|AA_BITS;
+    MESSAGE_QD(packet) = NU16(1);
+    
+    u32 question_end = DNS_HEADER_LENGTH + dnsname_copy(&packet[DNS_HEADER_LENGTH], image->origin);
+    SET_U16_AT(packet[question_end], TYPE_IXFR);
+    SET_U16_AT(packet[question_end + 2], CLASS_IN);
+    question_end += 4;
+    
+    pw.packet = packet;
+    
+    an_record_count = zdb_zone_ixfr_image_begin_message(image, &pw, question_end, &tctrl, rdata_buffer, rdata_size, soa_tctrl, soa_rdata, soa_rdata_size);
+    
+    last_valid_offset = pw.packet_offset;
+    last_valid_count = an_record_count;
+
+    record_mode = RECORD_MODE_DELETE;
+
+    for(;;)
+    {
+        if(FAIL(return_code = zdb_zone_ixfr_image_read_record(&fis, fqdn, &qname_size, &tctrl, rdata_buffer, &rdata_size)))
+        {
+            log_err("zone ixfr image: read record failed %{dnsname} %d: %r", image->origin, serial, return_code);
+
+            break;
+        }
+
+        if(return_code == 0)
+        {
+            /*
+             * EOF
+             */
+            
+            return_code = zdb_zone_ixfr_image_write_message(image, &os, &pw, an_record_count, soa_tctrl, soa_rdata, soa_rdata_size);
+            
+            break;
+        }
+        
+        if(pw.packet_offset + return_code <= pw.packet_limit)
+        {
+            if(tctrl.qtype == TYPE_SOA)
+            {
+                if(record_mode != RECORD_MODE_DELETE)
+                {
+                    record_mode = RECORD_MODE_DELETE;
+
+                    rr_soa_get_serial(rdata_buffer, rdata_size, &last_valid_serial);
+                    last_valid_offset = pw.packet_offset;
+                    last_valid_count  = an_record_count;
+
+                    /*
+                     * Check if we already got (beyond) the "being nice" limit
+                     */
+
+                    if(pw.packet_offset >= packet_size_trigger)
+                    {
+                        if(FAIL(return_code = zdb_zone_ixfr_image_write_message(image, &os, &pw, an_record_count, soa_tctrl, soa_rdata, soa_rdata_size)))
+                        {
+                            break;
+                        }
+
+                        an_record_count = zdb_zone_ixfr_image_begin_message(image, &pw, question_end, NULL, NULL, 0, soa_tctrl, soa_rdata, soa_rdata_size);
+                    }
+                }
+                else
+                {
+                    record_mode = RECORD_MODE_ADD;
+                }
+            }
+
+            /* Add the record */
+
+            packet_writer_add_fqdn(&pw, fqdn);
+            packet_writer_add_bytes(&pw, (const u8*)&tctrl, 8);
+            packet_writer_add_rdata(&pw, tctrl.qtype, rdata_buffer, rdata_size);
+
+            an_record_count++;
+        }
+        else
+        {
+            /*
+             * The message would overflow : cut at the last good serial, send, then rewind to the cut.
+             */
+
+            serial = last_valid_serial;
+            pw.packet_offset = last_valid_offset;
+            
+            if(FAIL(return_code = zdb_zone_ixfr_image_write_message(image, &os, &pw, last_valid_count, soa_tctrl, soa_rdata, soa_rdata_size)))
+            {
+                break;
+            }
+
+            input_stream_close(&fis);
+
+            if(FAIL(return_code = zdb_icmtl_open_ix_get_soa(image->origin, data_path, serial, &fis, &tctrl, rdata_buffer, &rdata_size)))
+            {
+                log_err("zone ixfr image: path '" ICMTL_WIRE_FILE_FORMAT "': %r", data_path, image->origin, return_code);
+                
+                /* what has been written is still a valid answer */
+                
+                return_code = SUCCESS;
+
+                break;
+            }
+
+            buffer_input_stream_init(&fis, &fis, FILE_BUFFER_SIZE);
+
+            an_record_count = zdb_zone_ixfr_image_begin_message(image, &pw, question_end, &tctrl, rdata_buffer, rdata_size, soa_tctrl, soa_rdata, soa_rdata_size);
+            
+            last_valid_offset = pw.packet_offset;
+            last_valid_count = an_record_count;
+            
+            record_mode = RECORD_MODE_DELETE;
+        }
+    }
+    
+    output_stream_close(&os);
+
+    if(ISOK(return_code))
+    {
+        return_code = SUCCESS;
+    }
+
+    if(input_stream_valid(&fis))
+    {
+        input_stream_close(&fis);
+    }
+    
+    free(packet);
+    free(rdata_buffer);
+    
+    return return_code;
+}
+
+static ya_result
+zdb_zone_ixfr_image_pread_fully(int fd, u8 *buffer, u32 len, off_t offset)
+{
+    u32 total = 0;
+    
+    while(total < len)
+    {
+        ssize_t n = pread(fd, &buffer[total], len - total, offset + total);
+        
+        if(n <= 0)
+        {
+            if(n == 0)
+            {
+                return UNEXPECTED_EOF;
+            }
+            
+            int err = errno;
+            
+            if(err == EINTR)
+            {
+                continue;
+            }
+            
+            return MAKE_ERRNO_ERROR(err);
+        }
+        
+        total += n;
+    }
+    
+    return total;
+}
+
+/*
+ * Sends the message at offset, whose header has been set in header, without going through user space
+ */
+
+static ya_result
+zdb_zone_ixfr_image_send_message(zdb_zone_ixfr_image *image, int tcpfd, u8 *header, u16 len, off_t offset)
+{
+    if(writefully(tcpfd, header, 2 + DNS_HEADER_LENGTH) != 2 + DNS_HEADER_LENGTH)
+    {
+        return ERRNO_ERROR;
+    }
+    
+    offset += 2 + DNS_HEADER_LENGTH;
+    len -= DNS_HEADER_LENGTH;
+    
+#ifdef __linux__
+    while(len > 0)
+    {
+        ssize_t n = sendfile(tcpfd, image->fd, &offset, len);
+        
+        if(n <= 0)
+        {
+            if(n == 0)
+            {
+                return UNEXPECTED_EOF;
+            }
+            
+            int err = errno;
+            
+            if(err == EINTR)
+            {
+                continue;
+            }
+            
+            return MAKE_ERRNO_ERROR(err);
+        }
+        
+        len -= n;
+    }
+#else
+    u8 buffer[FILE_BUFFER_SIZE];
+    
+    while(len > 0)
+    {
+        u32 n = MIN(len, sizeof(buffer));
+        ya_result return_code;
+        
+        if(FAIL(return_code = zdb_zone_ixfr_image_pread_fully(image->fd, buffer, n, offset)))
+        {
+            return return_code;
+        }
+        
+        if(writefully(tcpfd, buffer, n) != n)
+        {
+            return ERRNO_ERROR;
+        }
+        
+        offset += n;
+        len -= n;
+    }
+#endif
+    
+    return SUCCESS;
+}
+
+/*
+ * API
+ */
+
+ya_result
+zdb_zone_ixfr_image_acquire(const u8 *origin, const char *data_path, u32 from_serial, const struct type_class_ttl_rdlen *soa_tctrl, const u8 *soa_rdata, u32 soa_rdata_size, zdb_zone_ixfr_image **imagep)
+{
+    zdb_zone_ixfr_image *image;
+    zdb_zone_ixfr_image *next;
+    ya_result return_code;
+    u32 to_serial;
+    char path[1024];
+    
+    if(FAIL(return_code = rr_soa_get_serial(soa_rdata, soa_rdata_size, &to_serial)))
+    {
+        return return_code;
+    }
+    
+    pthread_mutex_lock(&zdb_zone_ixfr_image_mtx);
+    
+    for(image = zdb_zone_ixfr_image_list; image != NULL; image = next)
+    {
+        next = image->next;
+        
+        if(!dnsname_equals(image->origin, origin))
+        {
+            continue;
+        }
+        
+        if(image->to_serial != to_serial)
+        {
+            /* the zone has changed since : the image will not be used anymore */
+            
+            image->obsolete = TRUE;
+            
+            if(image->rc == 0)
+            {
+                zdb_zone_ixfr_image_unlink_and_free(image);
+                
+                zdb_zone_ixfr_image_idle_count--;
+            }
+            
+            continue;
+        }
+        
+        if((image->from_serial == from_serial) && (image->state != ZDB_ZONE_IXFR_IMAGE_FAILED))
+        {
+            break;
+        }
+    }
+    
+    if(image != NULL)
+    {
+        if(image->rc++ == 0)
+        {
+            zdb_zone_ixfr_image_idle_count--;
+        }
+        
+        while(image->state == ZDB_ZONE_IXFR_IMAGE_BUILDING)
+        {
+            pthread_cond_wait(&zdb_zone_ixfr_image_cond, &zdb_zone_ixfr_image_mtx);
+        }
+        
+        if(image->state == ZDB_ZONE_IXFR_IMAGE_FAILED)
+        {
+            return_code = image->build_code;
+            
+            if(--image->rc == 0)
+            {
+                zdb_zone_ixfr_image_unlink_and_free(image);
+            }
+            
+            image = NULL;
+        }
+        
+        pthread_mutex_unlock(&zdb_zone_ixfr_image_mtx);
+        
+        *imagep = image;
+        
+        return return_code;
+    }
+    
+    if(FAIL(return_code = snformat(path, sizeof(path), ZDB_ZONE_IXFR_IMAGE_FILE_FORMAT, data_path, origin, from_serial, to_serial)))
+    {
+        pthread_mutex_unlock(&zdb_zone_ixfr_image_mtx);
+        
+        return return_code;
+    }
+    
+    /* not found : build it */
+    
+    MALLOC_OR_DIE(zdb_zone_ixfr_image*, image, sizeof(zdb_zone_ixfr_image), ZIXIMAGE_TAG);
+    image->path = strdup(path);
+    image->size = 0;
+    image->from_serial = from_serial;
+    image->to_serial = to_serial;
+    image->rc = 1;
+    image->message_count = 0;
+    image->build_code = SUCCESS;
+    image->fd = -1;
+    image->state = ZDB_ZONE_IXFR_IMAGE_BUILDING;
+    image->obsolete = FALSE;
+    dnsname_copy(image->origin, origin);
+    
+    image->next = zdb_zone_ixfr_image_list;
+    zdb_zone_ixfr_image_list = image;
+    
+    pthread_mutex_unlock(&zdb_zone_ixfr_image_mtx);
+    
+    log_info("zone ixfr image: building %{dnsname} %d to %d", origin, from_serial, to_serial);
+    
+    zdb_zone_ixfr_image_clean_older(data_path, origin, to_serial);
+    
+    return_code = zdb_zone_ixfr_image_build(image, data_path, soa_tctrl, soa_rdata, soa_rdata_size);
+    
+    pthread_mutex_lock(&zdb_zone_ixfr_image_mtx);
+    
+    if(ISOK(return_code))
+    {
+        image->state = ZDB_ZONE_IXFR_IMAGE_READY;
+        
+        log_info("zone ixfr image: built %{dnsname} %d to %d (%u messages, %llu bytes)", origin, from_serial, to_serial, image->message_count, image->size);
+    }
+    else
+    {
+        image->state = ZDB_ZONE_IXFR_IMAGE_FAILED;
+        image->build_code = return_code;
+        
+        if(--image->rc == 0)
+        {
+            zdb_zone_ixfr_image_unlink_and_free(image);
+        }
+        
+        image = NULL;
+    }
+    
+    pthread_cond_broadcast(&zdb_zone_ixfr_image_cond);
+    
+    pthread_mutex_unlock(&zdb_zone_ixfr_image_mtx);
+    
+    *imagep = image;
+    
+    return return_code;
+}
+
+void
+zdb_zone_ixfr_image_release(zdb_zone_ixfr_image *image)
+{
+    pthread_mutex_lock(&zdb_zone_ixfr_image_mtx);
+    
+    if(--image->rc == 0)
+    {
+        if(image->obsolete)
+        {
+            zdb_zone_ixfr_image_unlink_and_free(image);
+        }
+        else
+        {
+            zdb_zone_ixfr_image_idle_count++;
+            
+            zdb_zone_ixfr_image_trim();
+        }
+    }
+    
+    pthread_mutex_unlock(&zdb_zone_ixfr_image_mtx);
+}
+
+ya_result
+zdb_zone_ixfr_image_send(zdb_zone_ixfr_image *image, int tcpfd, message_data *mesg)
+{
+    ya_result return_code = SUCCESS;
+    tsig_tcp_message_position pos = TSIG_START;
+    u8 header[2 + DNS_HEADER_LENGTH];
+    off_t offset = 0;
+    u32 index = 0;
+    
+    u16 id = MESSAGE_ID(mesg->buffer);
+    u8 hiflags = MESSAGE_HIFLAGS(mesg->buffer) | AA_BITS | QR_BITS;
+    u8 loflags = MESSAGE_LOFLAGS(mesg->buffer);
+    
+    bool tsig = TSIG_ENABLED(mesg);
+    
+#ifdef __linux__
+    int cork = 1;
+    
+    if(!tsig)
+    {
+        /* the header and the records of a message go in the same segments */
+        
+        setsockopt(tcpfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+    }
+#endif
+    
+    while(index < image->message_count)
+    {
+        if(FAIL(return_code = zdb_zone_ixfr_image_pread_fully(image->fd, header, sizeof(header), offset)))
+        {
+            break;
+        }
+        
+        u16 len = GET_U16_AT(header[0]);
+        len = ntohs(len);
+        
+        if(!tsig)
+        {
+            u8 *packet = &header[2];
+            
+            MESSAGE_ID(packet) = id;
+            MESSAGE_HIFLAGS(packet) = hiflags;
+            MESSAGE_LOFLAGS(packet) = loflags;
+            
+            if(FAIL(return_code = zdb_zone_ixfr_image_send_message(image, tcpfd, header, len, offset)))
+            {
+                break;
+            }
+        }
+        else
+        {
+            if(FAIL(return_code = zdb_zone_ixfr_image_pread_fully(image->fd, mesg->buffer, len, offset + 2)))
+            {
+                break;
+            }
+            
+            MESSAGE_ID(mesg->buffer) = id;
+            MESSAGE_HIFLAGS(mesg->buffer) = hiflags;
+            MESSAGE_LOFLAGS(mesg->buffer) = loflags;
+            
+            mesg->send_length = len;
+            mesg->ar_start = &mesg->buffer[len];
+            
+            if(index + 1 == image->message_count)
+            {
+                pos = (pos != TSIG_START)?TSIG_END:TSIG_WHOLE;
+            }
+            
+            if(FAIL(return_code = tsig_sign_tcp_message(mesg, pos)))
+            {
+                log_err("zone ixfr image: failed to sign the answer: %r", return_code);
+                
+                break;
+            }
+            
+            pos = TSIG_MIDDLE;
+            
+            message_update_tcp_length(mesg);
+            
+            if(writefully(tcpfd, mesg->buffer_tcp_len, mesg->send_length + 2) != mesg->send_length + 2)
+            {
+                return_code = ERRNO_ERROR;
+                
+                break;
+            }
+        }
+        
+        offset += 2 + len;
+        index++;
+    }
+    
+#ifdef __linux__
+    if(!tsig)
+    {
+        cork = 0;
+        
+        setsockopt(tcpfd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+    }
+#endif
+    
+    if(FAIL(return_code))
+    {
+        log_err("zone ixfr image: error sending %{dnsname} %d to %d: %r", image->origin, image->from_serial, image->to_serial, return_code);
+    }
+    
+    return return_code;
+}
+
+u64
+zdb_zone_ixfr_image_size(const zdb_zone_ixfr_image *image)
+{
+    return image->size;
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
@@ -49,6 +49,7 @@
 #include "dnsdb/zdb_dnsname.h"
 #include "dnsdb/zdb_utils.h"
 #include "dnsdb/zdb_error.h"
+#include "dnsdb/zdb_epoch.h"
 
 /**
  * @brief INTERNAL callback, tests for a match between a label and a node.
@@ -80,10 +81,34 @@ zdb_zone_label_create(const void *data)
     btree_init(&zone_label->global_resource_record_set);
 #endif
     zone_label->zone = NULL;
+    zone_label->parent = NULL;
+    zone_label->index_next = NULL;
 
     return (dictionary_node *)zone_label;
 }
 
+static void
+zdb_zone_label_free_epoch_callback(void *zone_label_)
+{
+    zdb_zone_label *zone_label = (zdb_zone_label*)zone_label_;
+
+    ZFREE_STRING(zone_label->name);
+    ZFREE(zone_label, zdb_zone_label);
+}
+
+/**
+ * @brief INTERNAL, releases a label removed from the tree and the index.
+ *
+ * A reader may still be walking the index through it (index_next, parent):
+ * the memory is only released after the readers have left their epoch.
+ */
+
+static inline void
+zdb_zone_label_retire(zdb_zone_label *zone_label)
+{
+    zdb_epoch_defer(zdb_zone_label_free_epoch_callback, zone_label);
+}
+
 /**
  * @brief INTERNAL callback, destroys a node instance and its collections.
  */
@@ -104,11 +129,125 @@ zdb_zone_label_destroy_callback(dictionary_node * zone_label_record)
 #if ZDB_CACHE_ENABLED!=0
     zdb_record_destroy(&zone_label->global_resource_record_set);
 #endif
-    ZFREE_STRING(zone_label->name);
-
     zdb_zone_destroy(zone_label->zone);
 
-    ZFREE(zone_label_record, zdb_zone_label);
+    zdb_zone_label_retire(zone_label);
+}
+
+/**
+ * The zone labels are indexed by a hash of their full name so a name can be
+ * matched without descending the tree one level at a time.
+ *
+ * The hash of a name is built from the hash of its parent name and the hash
+ * of its first label.  The root has the hash 0 and is not in the index.
+ */
+
+#define ZDB_ZONE_LABEL_INDEX_HASH(parent_hash_, label_hash_) ((((parent_hash_) << 5) | ((parent_hash_) >> 27)) ^ (label_hash_))
+
+/**
+ * @brief INTERNAL, adds a label to the index
+ */
+
+static void
+zdb_zone_label_index_insert(htoa *zone_index, hashcode hash, zdb_zone_label *zone_label)
+{
+    zdb_zone_label **zone_labelp = (zdb_zone_label**)htoa_insert(zone_index, hash);
+
+    zone_label->index_next = *zone_labelp;
+
+    /* the label must be complete before a reader can reach it */
+
+    __sync_synchronize();
+
+    *zone_labelp = zone_label;
+}
+
+/**
+ * @brief INTERNAL, removes a label from the index
+ */
+
+static void
+zdb_zone_label_index_remove(htoa *zone_index, hashcode hash, zdb_zone_label *zone_label)
+{
+    zdb_zone_label **headp = (zdb_zone_label**)htoa_findp(*zone_index, hash);
+
+    if(headp == NULL)
+    {
+        return;
+    }
+
+    zdb_zone_label **zone_labelp = headp;
+
+    while(*zone_labelp != NULL)
+    {
+        if(*zone_labelp == zone_label)
+        {
+            /* index_next is kept : a reader may be on this label */
+
+            *zone_labelp = zone_label->index_next;
+            break;
+        }
+
+        zone_labelp = &(*zone_labelp)->index_next;
+    }
+
+    if(*headp == NULL)
+    {
+        htoa_delete(zone_index, hash);
+    }
+}
+
+/**
+ * @brief INTERNAL, removes a label and all the labels below it from the index
+ */
+
+static void
+zdb_zone_label_index_remove_tree(htoa *zone_index, hashcode hash, zdb_zone_label *zone_label)
+{
+    dictionary_iterator iter;
+    dictionary_iterator_init(&zone_label->sub, &iter);
+
+    while(dictionary_iterator_hasnext(&iter))
+    {
+        zdb_zone_label *sub_label = *(zdb_zone_label**)dictionary_iterator_next(&iter);
+
+        zdb_zone_label_index_remove_tree(zone_index, ZDB_ZONE_LABEL_INDEX_HASH(hash, hash_dnslabel(sub_label->name)), sub_label);
+    }
+
+    zdb_zone_label_index_remove(zone_index, hash, zone_label);
+}
+
+/**
+ * @brief INTERNAL, finds the label of sections[top] .. sections[size] in the index
+ *
+ * Entries sharing the hash are told apart by comparing their path up to the root.
+ */
+
+static zdb_zone_label*
+zdb_zone_label_index_find(const htoa zone_index, hashcode hash, const_dnslabel_stack_reference sections, s32 top, s32 size)
+{
+    zdb_zone_label *zone_label = (zdb_zone_label*)htoa_find(zone_index, hash);
+
+    while(zone_label != NULL)
+    {
+        const zdb_zone_label *label = zone_label;
+        s32 index = top;
+
+        while((index <= size) && (label != NULL) && dnslabel_equals(label->name, sections[index]))
+        {
+            label = label->parent;
+            index++;
+        }
+
+        if((index > size) && (label != NULL) && (label->parent == NULL))
+        {
+            return zone_label;
+        }
+
+        zone_label = zone_label->index_next;
+    }
+
+    return NULL;
 }
 
 /**
@@ -128,6 +267,7 @@ zdb_zone_label*
 zdb_zone_label_find(zdb * db, dnsname_vector* origin, u16 zclass)
 {
     zdb_zone_label* zone_label;
+    htoa zone_index;
 
 #if ZDB_RECORDS_MAX_CLASS==1
     zone_label = db->root[0]; /* the "." zone */
@@ -138,20 +278,35 @@ zdb_zone_label_find(zdb * db, dnsname_vector* origin, u16 zclass)
     dnslabel_stack_reference sections = origin->labels;
     s32 index = origin->size;
 
-    /* look into the sub level */
-
-    while(zone_label != NULL && index >= 0)
+    if(zone_label == NULL || index < 0)
     {
-        u8* label = sections[index];
-        hashcode hash = hash_dnslabel(label);
+        return zone_label;
+    }
 
-        zone_label =
-                (zdb_zone_label*)dictionary_find(&zone_label->sub, hash, label,
-                                                 zdb_zone_label_zlabel_match);
+    /* one probe in the index for the whole name */
+
+    hashcode hash = 0;
 
+    while(index >= 0)
+    {
+        hash = ZDB_ZONE_LABEL_INDEX_HASH(hash, hash_dnslabel(sections[index]));
         index--;
     }
 
+    /* the index is changed without a lock : it can only be read inside an epoch */
+
+    zdb_epoch_enter();
+
+#if ZDB_RECORDS_MAX_CLASS==1
+    zone_index = db->zone_index[0];
+#else
+    zone_index = db->zone_index[zclass - 1];
+#endif
+
+    zone_label = zdb_zone_label_index_find(zone_index, hash, sections, 0, origin->size);
+
+    zdb_epoch_leave();
+
     return zone_label;
 }
 
@@ -207,8 +362,7 @@ zdb_zone_label_destroy(zdb_zone_label* * zone_labelp)
         zdb_record_destroy(&zone_label->global_resource_record_set);
 #endif
         zdb_zone_destroy(zone_label->zone);
-        ZFREE_STRING(zone_label->name);
-        ZFREE(zone_label, zdb_zone_label);
+        zdb_zone_label_retire(zone_label);
         *zone_labelp = NULL;
     }
 }
@@ -231,42 +385,73 @@ zdb_zone_label_match(const zdb * db, const dnsname_vector* origin, u16 zclass,
                      zdb_zone_label_pointer_array zone_label_stack)
 {
     zdb_zone_label* zone_label;
+    htoa zone_index;
+    s32 depth;
 
 #if ZDB_RECORDS_MAX_CLASS==1
     zone_label = db->root[0]; /* the "." zone */
+    depth = db->zone_index_depth[0];
 #else
     zone_label = db->root[zclass - 1]; /* the "." zone */
+    depth = db->zone_index_depth[zclass - 1];
 #endif
 
     const_dnslabel_stack_reference sections = origin->labels;
-    s32 index = origin->size;
-
-    s32 sp = 0;
+    s32 size = origin->size;
+    s32 index;
 
     zone_label_stack[0] = zone_label;
 
-    /* look into the sub level */
+    /* the hashes of all the parent names, from the top */
 
-    while(/*zone_label!=NULL&& */ index >= 0)
+    hashcode hashes[DNSNAME_MAX_SECTIONS];
+    hashcode hash = 0;
+
+    for(index = size; index >= 0; index--)
     {
-        u8* label = sections[index];
-        hashcode hash = hash_dnslabel(label);
+        hash = ZDB_ZONE_LABEL_INDEX_HASH(hash, hash_dnslabel(sections[index]));
+        hashes[index] = hash;
+    }
 
-        zone_label =
-                (zdb_zone_label*)dictionary_find(&zone_label->sub, hash, label,
-                                                 zdb_zone_label_zlabel_match);
+    /*
+     * Look for the longest name first, skipping the ones deeper than any label.
+     * The tree holds every parent of a label so the first hit is the deepest match.
+     */
+
+    s32 top = 0;
+
+    /* the index is changed without a lock : it can only be read inside an epoch */
+
+    zdb_epoch_enter();
+
+#if ZDB_RECORDS_MAX_CLASS==1
+    zone_index = db->zone_index[0];
+#else
+    zone_index = db->zone_index[zclass - 1];
+#endif
+
+    for(index = MAX(size + 1 - depth, 0); index <= size; index++)
+    {
+        zone_label = zdb_zone_label_index_find(zone_index, hashes[index], sections, index, size);
 
-        if(zone_label == NULL)
+        if(zone_label != NULL)
         {
-            break;
-        }
+            s32 sp = size - index + 1;
+            top = sp;
 
-        zone_label_stack[++sp] = zone_label;
+            while(sp > 0)
+            {
+                zone_label_stack[sp--] = zone_label;
+                zone_label = zone_label->parent;
+            }
 
-        index--;
+            break;
+        }
     }
 
-    return sp;
+    zdb_epoch_leave();
+
+    return top;
 }
 
 /**
@@ -285,20 +470,33 @@ zdb_zone_label*
 zdb_zone_label_add(zdb * db, dnsname_vector* origin, u16 zclass)
 {
     zdb_zone_label* zone_label;
+    htoa* zone_index;
+    u8* depthp;
 
 #if ZDB_RECORDS_MAX_CLASS==1
     zone_label = db->root[0]; /* the "." zone */
+    zone_index = &db->zone_index[0];
+    depthp = &db->zone_index_depth[0];
 #else
     zone_label = db->root[zclass - 1]; /* the "." zone */
+    zone_index = &db->zone_index[zclass - 1];
+    depthp = &db->zone_index_depth[zclass - 1];
 #endif
 
+    if(*depthp < origin->size + 1)
+    {
+        *depthp = origin->size + 1;
+    }
+
     dnslabel_stack_reference sections = origin->labels;
     s32 index = origin->size;
+    hashcode index_hash = 0;
 
     /* look into the sub level */
 
     while(index >= 0)
     {
+        zdb_zone_label* parent_label = zone_label;
         u8* label = sections[index];
         hashcode hash = hash_dnslabel(label);
         zone_label =
@@ -306,6 +504,16 @@ zdb_zone_label_add(zdb * db, dnsname_vector* origin, u16 zclass)
                                                 zdb_zone_label_zlabel_match,
                                                 zdb_zone_label_create);
 
+        index_hash = ZDB_ZONE_LABEL_INDEX_HASH(index_hash, hash);
+
+        if(zone_label->parent == NULL)
+        {
+            /* new label */
+
+            zone_label->parent = parent_label;
+            zdb_zone_label_index_insert(zone_index, index_hash, zone_label);
+        }
+
         index--;
     }
 
@@ -319,6 +527,8 @@ struct zdb_zone_label_delete_process_callback_args
 {
     dnslabel_stack_reference sections;
     s32 top;
+    htoa* zone_index;
+    hashcode index_hash; /* hash of the name of the parent label */
 };
 
 /**
@@ -360,12 +570,15 @@ zdb_zone_label_delete_process_callback(void *a, dictionary_node * node)
 
     /* match */
 
+    hashcode index_hash = ZDB_ZONE_LABEL_INDEX_HASH(args->index_hash, hash_dnslabel(label));
+
     if(top > 0)
     {
         /* go to the next level */
 
         label = args->sections[--args->top];
         hashcode hash = hash_dnslabel(label);
+        args->index_hash = index_hash;
 
         ya_result err;
         if((err =
@@ -379,14 +592,15 @@ zdb_zone_label_delete_process_callback(void *a, dictionary_node * node)
             {
                 /* Irrelevant means that only the name remains */
 
+                zdb_zone_label_index_remove(args->zone_index, index_hash, zone_label);
+
                 dictionary_destroy(&zone_label->sub,
                                    zdb_zone_label_destroy_callback);
 #if ZDB_CACHE_ENABLED!=0
                 zdb_record_destroy(&zone_label->global_resource_record_set);
 #endif
                 zdb_zone_destroy(zone_label->zone);
-                ZFREE_STRING(zone_label->name);
-                ZFREE(zone_label, zdb_zone_label);
+                zdb_zone_label_retire(zone_label);
 
                 return COLLECTION_PROCESS_DELETENODE;
             }
@@ -406,13 +620,14 @@ zdb_zone_label_delete_process_callback(void *a, dictionary_node * node)
      * iterate through it calling the passed function.
      */
 
+    zdb_zone_label_index_remove_tree(args->zone_index, index_hash, zone_label);
+
     dictionary_destroy(&zone_label->sub, zdb_zone_label_destroy_callback);
 #if ZDB_CACHE_ENABLED!=0
     zdb_record_destroy(&zone_label->global_resource_record_set);
 #endif
     zdb_zone_destroy(zone_label->zone);
-    ZFREE_STRING(zone_label->name);
-    ZFREE(zone_label, zdb_zone_label);
+    zdb_zone_label_retire(zone_label);
 
     return COLLECTION_PROCESS_DELETENODE;
 }
@@ -452,6 +667,12 @@ zdb_zone_label_delete(zdb * db, dnsname_vector* name, u16 zclass)
     zdb_zone_label_delete_process_callback_args args;
     args.sections = name->labels;
     args.top = name->size;
+#if ZDB_RECORDS_MAX_CLASS==1
+    args.zone_index = &db->zone_index[0];
+#else
+    args.zone_index = &db->zone_index[zclass - 1];
+#endif
+    args.index_hash = 0;
 
     hashcode hash = hash_dnslabel(args.sections[args.top]);
 
@@ -476,6 +697,8 @@ struct zdb_zone_label_delete_record_process_callback_args
 {
     dnslabel_stack_reference sections;
     s32 top;
+    htoa* zone_index;
+    hashcode index_hash; /* hash of the name of the parent label */
     u16 type;
 };
 
@@ -519,12 +742,15 @@ zdb_zone_label_delete_record_process_callback(void *a,
 
     /* match */
 
+    hashcode index_hash = ZDB_ZONE_LABEL_INDEX_HASH(args->index_hash, hash_dnslabel(label));
+
     if(top > 0)
     {
         /* go to the next level */
 
         label = args->sections[--args->top];
         hashcode hash = hash_dnslabel(label);
+        args->index_hash = index_hash;
 
         ya_result err;
         if((err =
@@ -536,12 +762,13 @@ zdb_zone_label_delete_record_process_callback(void *a,
 
             if(ZONE_LABEL_IRRELEVANT(zone_label))
             {
+                zdb_zone_label_index_remove(args->zone_index, index_hash, zone_label);
+
                 dictionary_destroy(&zone_label->sub,
                                    zdb_zone_label_destroy_callback);
                 zdb_record_destroy(&zone_label->global_resource_record_set);
                 zdb_zone_destroy(zone_label->zone);
-                ZFREE_STRING(zone_label->name);
-                ZFREE(zone_label, zdb_zone_label);
+                zdb_zone_label_retire(zone_label);
 
                 return COLLECTION_PROCESS_DELETENODE;
             }
@@ -573,11 +800,12 @@ zdb_zone_label_delete_record_process_callback(void *a,
      * iterate through it calling the passed function.
      */
 
+    zdb_zone_label_index_remove_tree(args->zone_index, index_hash, zone_label);
+
     dictionary_destroy(&zone_label->sub, zdb_zone_label_destroy_callback);
     zdb_record_destroy(&zone_label->global_resource_record_set);
     zdb_zone_destroy(zone_label->zone);
-    ZFREE_STRING(zone_label->name);
-    ZFREE(zone_label, zdb_zone_label);
+    zdb_zone_label_retire(zone_label);
 
     return COLLECTION_PROCESS_DELETENODE;
 }
@@ -619,6 +847,12 @@ zdb_zone_label_delete_record(zdb * db, dnsname_vector* origin, u16 zclass,
     zdb_zone_label_delete_record_process_callback_args args;
     args.sections = origin->labels;
     args.top = origin->size;
+#if ZDB_RECORDS_MAX_CLASS==1
+    args.zone_index = &db->zone_index[0];
+#else
+    args.zone_index = &db->zone_index[zclass - 1];
+#endif
+    args.index_hash = 0;
     args.type = type;
 
     hashcode hash = hash_dnslabel(args.sections[args.top]);
@@ -634,8 +868,7 @@ zdb_zone_label_delete_record(zdb * db, dnsname_vector* origin, u16 zclass,
             dictionary_destroy(&root_label->sub,
                                zdb_zone_label_destroy_callback);
             zdb_record_destroy(&root_label->global_resource_record_set);
-            ZFREE_STRING(root_label->name);
-            ZFREE(root_label, zdb_zone_label);
+            zdb_zone_label_retire(root_label);
 
 #if ZDB_RECORDS_MAX_CLASS==1
             db->root[0] = NULL;
@@ -659,6 +892,8 @@ struct zdb_zone_label_delete_record_exact_process_callback_args
 {
     dnslabel_stack_reference sections;
     s32 top;
+    htoa* zone_index;
+    hashcode index_hash; /* hash of the name of the parent label */
     u16 type;
     zdb_ttlrdata* ttlrdata;
 };
@@ -703,12 +938,15 @@ zdb_zone_label_delete_record_exact_process_callback(void *a,
 
     /* match */
 
+    hashcode index_hash = ZDB_ZONE_LABEL_INDEX_HASH(args->index_hash, hash_dnslabel(label));
+
     if(top > 0)
     {
         /* go to the next level */
 
         label = args->sections[--args->top];
         hashcode hash = hash_dnslabel(label);
+        args->index_hash = index_hash;
 
         ya_result err;
         if((err =
@@ -724,12 +962,13 @@ zdb_zone_label_delete_record_exact_process_callback(void *a,
                  * Still, it's not because a collection is empty that it does not uses memory.
                  */
 
+                zdb_zone_label_index_remove(args->zone_index, index_hash, zone_label);
+
                 dictionary_destroy(&zone_label->sub,
                                    zdb_zone_label_destroy_callback);
                 zdb_record_destroy(&zone_label->global_resource_record_set);
                 zdb_zone_destroy(zone_label->zone);
-                ZFREE_STRING(zone_label->name);
-                ZFREE(zone_label, zdb_zone_label);
+                zdb_zone_label_retire(zone_label);
 
                 return COLLECTION_PROCESS_DELETENODE;
             }
@@ -761,11 +1000,12 @@ zdb_zone_label_delete_record_exact_process_callback(void *a,
      * iterate through it calling the passed function.
      */
 
+    zdb_zone_label_index_remove_tree(args->zone_index, index_hash, zone_label);
+
     dictionary_destroy(&zone_label->sub, zdb_zone_label_destroy_callback);
     zdb_record_destroy(&zone_label->global_resource_record_set);
     zdb_zone_destroy(zone_label->zone);
-    ZFREE_STRING(zone_label->name);
-    ZFREE(zone_label, zdb_zone_label);
+    zdb_zone_label_retire(zone_label);
 
     return COLLECTION_PROCESS_DELETENODE;
 }
@@ -809,6 +1049,12 @@ zdb_zone_label_delete_record_exact(zdb * db, dnsname_vector* origin,
     zdb_zone_label_delete_record_exact_process_callback_args args;
     args.sections = origin->labels;
     args.top = origin->size;
+#if ZDB_RECORDS_MAX_CLASS==1
+    args.zone_index = &db->zone_index[0];
+#else
+    args.zone_index = &db->zone_index[zclass - 1];
+#endif
+    args.index_hash = 0;
     args.type = type;
     args.ttlrdata = ttlrdata;
 
@@ -825,8 +1071,7 @@ zdb_zone_label_delete_record_exact(zdb * db, dnsname_vector* origin,
             dictionary_destroy(&root_label->sub,
                                zdb_zone_label_destroy_callback);
             zdb_record_destroy(&root_label->global_resource_record_set);
-            ZFREE_STRING(root_label->name);
-            ZFREE(root_label, zdb_zone_label);
+            zdb_zone_label_retire(root_label);
 
 #if ZDB_RECORDS_MAX_CLASS==1
             db->root[0] = NULL;
@@ -71,6 +71,7 @@
 #endif
 
 #include "dnsdb/zdb_zone_load.h"
+#include "dnsdb/zdb_answer_cache.h"
 
 extern logger_handle *g_zone_logger;
 #define MODULE_MSG_HANDLE g_zone_logger
@@ -114,6 +115,17 @@ resource_record_resetcontent(resource_record* entry)
     bytearray_output_stream_reset(&entry->os_rdata);
 }
 
+#if ZDB_NSEC3_SUPPORT != 0
+
+static bool
+zdb_zone_load_nsec3_digest_hint(void *args, const u8 *nsec3param_rdata, const u8 *fqdn, u32 fqdn_len, u8 *digest)
+{
+    zone_reader *zr = (zone_reader*)args;
+    
+    return zr->vtbl->zone_reader_nsec3_digest(zr, nsec3param_rdata, fqdn, fqdn_len, digest);
+}
+
+#endif
 
 /**
  * @brief Load a zone in the database.
@@ -258,6 +270,11 @@ zdb_zone_load(zdb *db, zone_reader *zone_data, zdb_zone **zone_pointer_out, cons
 
 #if ZDB_NSEC3_SUPPORT != 0
     nsec3_load_init(&nsec3_context, zone);
+    
+    if(zone_data->vtbl->zone_reader_nsec3_digest != NULL)
+    {
+        nsec3_load_set_digest_hint(&nsec3_context, zdb_zone_load_nsec3_digest_hint, zone_data);
+    }
 #endif
 
     zone->apex->flags |= ZDB_RR_APEX_LABEL_LOADING;
@@ -366,6 +383,7 @@ zdb_zone_load(zdb *db, zone_reader *zone_data, zdb_zone **zone_pointer_out, cons
             {
                 u32 valid_until = ntohl(GET_U32_AT(rdata[8]));  /* offset the the "valid until" 32 bits field */
                 zone->sig_invalid_first = MIN(valid_until, zone->sig_invalid_first);
+                rrsig_expiration_index_add_nsec3(&zone->sig_expiration, valid_until);
             }
 
             if(FAIL(return_code = nsec3_load_add_rrsig(&nsec3_context, entry.name, /*entry.ttl*/soa_min_ttl, rdata, rdata_len)))
@@ -407,6 +425,14 @@ zdb_zone_load(zdb *db, zone_reader *zone_data, zdb_zone **zone_pointer_out, cons
                             nsec_keys = TRUE;
                             break;
                         }
+                        case DNSKEY_ALGORITHM_ECDSAP256SHA256:
+                        case DNSKEY_ALGORITHM_ECDSAP384SHA384:
+                        {
+                            /* RFC 6605 algorithms can be used with both NSEC and NSEC3 */
+                            nsec_keys = TRUE;
+                            nsec3_keys = TRUE;
+                            break;
+                        }
                         default:
                         {
                             log_info("zone load: unknown key algorithm for K%{dnsname}+%03d+%05hd", zone->origin, algorithm, tag);
@@ -471,6 +497,7 @@ zdb_zone_load(zdb *db, zone_reader *zone_data, zdb_zone **zone_pointer_out, cons
                     {
                         u32 valid_until = ntohl(GET_U32_AT(rdata[8]));  /* offset the the "valid until" 32 bits field */
                         zone->sig_invalid_first = MIN(valid_until, zone->sig_invalid_first);
+                        rrsig_expiration_index_add(&zone->sig_expiration, entry.name, valid_until);
                     }
 #endif
                     if((GET_U16_AT(*rdata)) == TYPE_NSEC3PARAM)
@@ -756,6 +783,11 @@ zdb_zone_load_exit:
             */
 
             zone_label->zone = zone;
+            
+            zdb_answer_cache_invalidate_all();
+#if ZDB_NSEC3_SUPPORT != 0
+            nsec3_proof_cache_invalidate_all();
+#endif
 
             *zone_pointer_out = zone;
         }
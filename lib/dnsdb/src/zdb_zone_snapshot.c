@@ -0,0 +1,671 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup dnsdbzone Zone related functions
+ *  @ingroup dnsdb
+ *  @brief Binary snapshot of a zone
+ *
+ *  The snapshot is streamed through a filter that computes the checksum and
+ *  keeps track of the offsets.  The header is written last, at the beginning
+ *  of the file.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <dnscore/logger.h>
+#include <dnscore/format.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/base32hex.h>
+#include <dnscore/output_stream.h>
+#include <dnscore/file_output_stream.h>
+#include <dnscore/buffer_output_stream.h>
+#include <dnscore/bytearray_output_stream.h>
+
+#include "dnsdb/zdb_zone.h"
+#include "dnsdb/zdb_zone_label_iterator.h"
+#include "dnsdb/zdb_record.h"
+#include "dnsdb/zdb_utils.h"
+#include "dnsdb/zdb_zone_snapshot.h"
+
+#if ZDB_NSEC3_SUPPORT!=0
+#include "dnsdb/nsec3.h"
+#endif
+
+extern logger_handle* g_database_logger;
+#define MODULE_MSG_HANDLE g_database_logger
+
+#define ZSNAPIDX_TAG 0x584449504e41535a /* ZSNAPIDX */
+
+#ifndef MAX_PATH
+#define MAX_PATH 4096
+#endif
+
+#define ZDB_ZONE_SNAPSHOT_BUFFER_SIZE 65536
+
+#define ZDB_ZONE_SNAPSHOT_TMP_SUFFIX ".tmp"
+
+static const u8 wild_wire[2] = {1, '*'};
+
+u64
+zdb_zone_snapshot_checksum(u64 checksum, const u8 *buffer, size_t size)
+{
+    u32 a = (u32)checksum;
+    u32 b = (u32)(checksum >> 32);
+    const u8 *limit = &buffer[size];
+
+    while(buffer < limit)
+    {
+        a += *buffer++;
+        b += a;
+    }
+
+    return (((u64)b) << 32) | a;
+}
+
+u32
+zdb_zone_snapshot_name_hash(const u8 *name, u32 name_len)
+{
+    /* FNV-1a */
+
+    u32 h = 2166136261U;
+
+    for(u32 i = 0; i < name_len; i++)
+    {
+        h ^= name[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+/*
+ * Checksum & offset filter
+ */
+
+typedef struct zdb_zone_snapshot_output_stream_data zdb_zone_snapshot_output_stream_data;
+
+struct zdb_zone_snapshot_output_stream_data
+{
+    output_stream *filtered;
+    u64 offset;
+    u64 checksum;
+};
+
+static ya_result
+zdb_zone_snapshot_output_stream_write(output_stream* stream, const u8* buffer, u32 len)
+{
+    zdb_zone_snapshot_output_stream_data *data = (zdb_zone_snapshot_output_stream_data*)stream->data;
+    ya_result return_code;
+
+    if(ISOK(return_code = output_stream_write(data->filtered, buffer, len)))
+    {
+        data->checksum = zdb_zone_snapshot_checksum(data->checksum, buffer, len);
+        data->offset += len;
+    }
+
+    return return_code;
+}
+
+static ya_result
+zdb_zone_snapshot_output_stream_flush(output_stream* stream)
+{
+    zdb_zone_snapshot_output_stream_data *data = (zdb_zone_snapshot_output_stream_data*)stream->data;
+
+    return output_stream_flush(data->filtered);
+}
+
+static void
+zdb_zone_snapshot_output_stream_close(output_stream* stream)
+{
+    output_stream_set_void(stream);
+}
+
+static output_stream_vtbl zdb_zone_snapshot_output_stream_vtbl =
+{
+    zdb_zone_snapshot_output_stream_write,
+    zdb_zone_snapshot_output_stream_flush,
+    zdb_zone_snapshot_output_stream_close,
+    "zdb_zone_snapshot_output_stream",
+};
+
+/*
+ * Records
+ */
+
+static ya_result
+zdb_zone_snapshot_write_rrset(output_stream *os, u16 rtype, const zdb_packed_ttlrdata *rr_sll, u32 *record_countp)
+{
+    const zdb_packed_ttlrdata *rr;
+    ya_result return_code;
+    u16 count = 0;
+
+    for(rr = rr_sll; rr != NULL; rr = rr->next)
+    {
+        count++;
+    }
+
+    output_stream_write_u16(os, rtype); /** @note: NATIVETYPE */
+
+    if(FAIL(return_code = output_stream_write_nu16(os, count)))
+    {
+        return return_code;
+    }
+
+    for(rr = rr_sll; rr != NULL; rr = rr->next)
+    {
+        output_stream_write_nu32(os, rr->ttl);
+        output_stream_write_nu16(os, rr->rdata_size);
+
+        if(FAIL(return_code = output_stream_write(os, rr->rdata_start, rr->rdata_size)))
+        {
+            return return_code;
+        }
+    }
+
+    *record_countp += count;
+
+    return SUCCESS;
+}
+
+static ya_result
+zdb_zone_snapshot_write_label(output_stream *os, const u8 *fqdn, u32 fqdn_len, zdb_rr_label *label, u32 *record_countp)
+{
+    btree_iterator type_iter;
+    ya_result return_code;
+    u16 rrset_count = 0;
+
+    btree_iterator_init(label->resource_record_set, &type_iter);
+
+    while(btree_iterator_hasnext(&type_iter))
+    {
+        btree_node* type_node = btree_iterator_next_node(&type_iter);
+
+        if(type_node->hash != TYPE_SOA)
+        {
+            rrset_count++;
+        }
+    }
+
+    if(rrset_count == 0)
+    {
+        /* empty non-terminal : will be re-created by its children */
+
+        return SUCCESS;
+    }
+
+    output_stream_write(os, fqdn, fqdn_len);
+
+    if(FAIL(return_code = output_stream_write_nu16(os, rrset_count)))
+    {
+        return return_code;
+    }
+
+    btree_iterator_init(label->resource_record_set, &type_iter);
+
+    while(btree_iterator_hasnext(&type_iter))
+    {
+        btree_node* type_node = btree_iterator_next_node(&type_iter);
+
+        if(type_node->hash == TYPE_SOA)
+        {
+            continue;
+        }
+
+        if(FAIL(return_code = zdb_zone_snapshot_write_rrset(os, (u16)type_node->hash, (zdb_packed_ttlrdata*)type_node->data, record_countp)))
+        {
+            return return_code;
+        }
+    }
+
+    return SUCCESS;
+}
+
+#if ZDB_NSEC3_SUPPORT != 0
+
+static ya_result
+zdb_zone_snapshot_write_nsec3(output_stream *os, const zdb_zone *zone, u32 *record_countp)
+{
+    u8 fqdn[MAX_DOMAIN_LENGTH];
+    ya_result return_code;
+    u32 origin_len = dnsname_len(zone->origin);
+    u32 minimum_ttl;
+
+    zdb_zone_getminttl((zdb_zone*)zone, &minimum_ttl);
+
+    for(nsec3_zone* n3 = zone->nsec.nsec3; n3 != NULL; n3 = n3->next)
+    {
+        nsec3_avl_iterator nsec3_items_iter;
+        nsec3_avl_iterator_init(&n3->items, &nsec3_items_iter);
+
+        if(!nsec3_avl_iterator_hasnext(&nsec3_items_iter))
+        {
+            continue;
+        }
+
+        nsec3_zone_item *first = nsec3_avl_iterator_next_node(&nsec3_items_iter);
+        nsec3_zone_item *item = first;
+        nsec3_zone_item *next_item;
+
+        u8 digest_len = NSEC3_NODE_DIGEST_SIZE(first);
+        u32 rdata_hash_offset = NSEC3_ZONE_RDATA_SIZE(n3);
+        u32 encoded_digest_len = BASE32HEX_ENCODED_LEN(digest_len);
+
+        do
+        {
+            if(nsec3_avl_iterator_hasnext(&nsec3_items_iter))
+            {
+                next_item = nsec3_avl_iterator_next_node(&nsec3_items_iter);
+            }
+            else
+            {
+                next_item = first;
+            }
+
+            u32 rdata_size = rdata_hash_offset + digest_len + 1 + item->type_bit_maps_size;
+
+            if(rdata_size > RDATA_MAX_LENGTH)
+            {
+                return ZDB_ERROR_GENERAL;
+            }
+
+            fqdn[0] = encoded_digest_len;
+            base32hex_encode(NSEC3_NODE_DIGEST_PTR(item), digest_len, (char*)&fqdn[1]);
+
+            output_stream_write(os, fqdn, encoded_digest_len + 1);
+            output_stream_write(os, zone->origin, origin_len);
+            output_stream_write_nu16(os, (item->rrsig != NULL)?2:1);
+
+            /* the NSEC3 */
+
+            output_stream_write_u16(os, TYPE_NSEC3); /** @note NATIVETYPE */
+            output_stream_write_nu16(os, 1);
+            output_stream_write_nu32(os, minimum_ttl);
+            output_stream_write_nu16(os, rdata_size);
+            output_stream_write_u8(os, n3->rdata[0]);
+            output_stream_write_u8(os, item->flags);
+            output_stream_write(os, &n3->rdata[2], rdata_hash_offset - 2);
+            output_stream_write(os, next_item->digest, digest_len + 1);
+
+            if(FAIL(return_code = output_stream_write(os, item->type_bit_maps, item->type_bit_maps_size)))
+            {
+                return return_code;
+            }
+
+            (*record_countp)++;
+
+            /* its signatures */
+
+            if(item->rrsig != NULL)
+            {
+                if(FAIL(return_code = zdb_zone_snapshot_write_rrset(os, TYPE_RRSIG, item->rrsig, record_countp)))
+                {
+                    return return_code;
+                }
+            }
+
+            item = next_item;
+        }
+        while(next_item != first);
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * NSEC3 digest index
+ */
+
+static void
+zdb_zone_snapshot_index_add(u32 *slots, u32 slot_mask, output_stream *entries, const u8 *fqdn, u32 fqdn_len, const u8 *digest)
+{
+    u32 slot = zdb_zone_snapshot_name_hash(fqdn, fqdn_len) & slot_mask;
+
+    while(slots[slot] != 0)
+    {
+        slot = (slot + 1) & slot_mask;
+    }
+
+    slots[slot] = bytearray_output_stream_size(entries) + 1;
+
+    output_stream_write(entries, fqdn, fqdn_len);
+    output_stream_write(entries, &digest[1], digest[0]);
+}
+
+static ya_result
+zdb_zone_snapshot_write_index(output_stream *os, const zdb_zone *zone)
+{
+    zdb_zone_label_iterator iter;
+    u32 chain_count = 0;
+    u32 label_count = 0;
+
+    for(nsec3_zone* n3 = zone->nsec.nsec3; n3 != NULL; n3 = n3->next)
+    {
+        chain_count++;
+    }
+
+    zdb_zone_label_iterator_init(zone, &iter);
+
+    while(zdb_zone_label_iterator_hasnext(&iter))
+    {
+        zdb_rr_label *label = zdb_zone_label_iterator_next(&iter);
+
+        if(label->nsec.nsec3 != NULL)
+        {
+            label_count++;
+        }
+    }
+
+    /* two names per label, and the slots at most half full */
+
+    u32 slot_count = 16;
+
+    while(slot_count < label_count * 4)
+    {
+        slot_count <<= 1;
+    }
+
+    u32 slot_mask = slot_count - 1;
+    u32 *slots;
+    output_stream entries;
+    ya_result return_code = SUCCESS;
+
+    MALLOC_OR_DIE(u32*, slots, slot_count * sizeof(u32), ZSNAPIDX_TAG);
+
+    bytearray_output_stream_init_ex(NULL, 0, &entries, BYTEARRAY_DYNAMIC);
+
+    output_stream_write_nu16(os, chain_count);
+
+    u32 chain_index = 0;
+
+    for(nsec3_zone* n3 = zone->nsec.nsec3; n3 != NULL; n3 = n3->next, chain_index++)
+    {
+        u8 fqdn[2 + MAX_DOMAIN_LENGTH];
+
+        memset(slots, 0, slot_count * sizeof(u32));
+        bytearray_output_stream_reset(&entries);
+
+        zdb_zone_label_iterator_init(zone, &iter);
+
+        while(zdb_zone_label_iterator_hasnext(&iter))
+        {
+            u32 fqdn_len = zdb_zone_label_iterator_nextname(&iter, &fqdn[2]);
+
+            zdb_rr_label *label = zdb_zone_label_iterator_next(&iter);
+
+            nsec3_label_extension *n3ext = label->nsec.nsec3;
+
+            for(u32 i = 0; (n3ext != NULL) && (i < chain_index); i++)
+            {
+                n3ext = n3ext->next;
+            }
+
+            if(n3ext == NULL)
+            {
+                continue;
+            }
+
+            if(n3ext->self != NULL)
+            {
+                zdb_zone_snapshot_index_add(slots, slot_mask, &entries, &fqdn[2], fqdn_len, n3ext->self->digest);
+            }
+
+            if((n3ext->star != NULL) && (fqdn_len + sizeof(wild_wire) <= MAX_DOMAIN_LENGTH))
+            {
+                memcpy(fqdn, wild_wire, sizeof(wild_wire));
+
+                zdb_zone_snapshot_index_add(slots, slot_mask, &entries, fqdn, fqdn_len + sizeof(wild_wire), n3ext->star->digest);
+            }
+        }
+
+        output_stream_write_nu16(os, NSEC3_ZONE_RDATA_SIZE(n3));
+        output_stream_write(os, n3->rdata, NSEC3_ZONE_RDATA_SIZE(n3));
+        output_stream_write_u8(os, nsec3_hash_len(NSEC3_ZONE_ALGORITHM(n3)));
+        output_stream_write_nu32(os, slot_count);
+        output_stream_write_nu32(os, bytearray_output_stream_size(&entries));
+
+        for(u32 i = 0; i < slot_count; i++)
+        {
+            output_stream_write_nu32(os, slots[i]);
+        }
+
+        if(FAIL(return_code = output_stream_write(os, bytearray_output_stream_buffer(&entries), bytearray_output_stream_size(&entries))))
+        {
+            break;
+        }
+    }
+
+    output_stream_close(&entries);
+    free(slots);
+
+    return return_code;
+}
+
+#endif
+
+static void
+zdb_zone_snapshot_set_u64(u8 *p, u64 value)
+{
+    SET_U32_AT(p[0], htonl((u32)(value >> 32)));
+    SET_U32_AT(p[4], htonl((u32)value));
+}
+
+static ya_result
+zdb_zone_snapshot_write(const zdb_zone *zone, int fd, u64 source_size, u64 source_mtime)
+{
+    output_stream fos;
+    output_stream bos;
+    output_stream os;
+    zdb_zone_snapshot_output_stream_data os_data;
+    ya_result return_code;
+    u32 serial;
+    u32 record_count = 0;
+    u64 records_offset;
+    u64 index_offset = 0;
+
+    u8 header[ZDB_ZONE_SNAPSHOT_HEADER_SIZE];
+    u8 fqdn[MAX_DOMAIN_LENGTH];
+
+    zdb_packed_ttlrdata* soa = zdb_record_find(&zone->apex->resource_record_set, TYPE_SOA);
+
+    if(soa == NULL)
+    {
+        return ZDB_ERROR_GENERAL;
+    }
+
+    if(FAIL(return_code = zdb_zone_getserial(zone, &serial)))
+    {
+        return return_code;
+    }
+
+    fd_output_stream_attach(fd, &fos);
+    buffer_output_stream_init(&fos, &bos, ZDB_ZONE_SNAPSHOT_BUFFER_SIZE);
+
+    /* room for the header, that is not part of the checksum */
+
+    memset(header, 0, sizeof(header));
+    output_stream_write(&bos, header, sizeof(header));
+
+    os_data.filtered = &bos;
+    os_data.offset = sizeof(header);
+    os_data.checksum = 0;
+    os.data = &os_data;
+    os.vtbl = &zdb_zone_snapshot_output_stream_vtbl;
+
+    u32 origin_len = dnsname_len(zone->origin);
+
+    output_stream_write(&os, zone->origin, origin_len);
+
+    records_offset = os_data.offset;
+
+    /* the SOA, alone */
+
+    output_stream_write(&os, zone->origin, origin_len);
+    output_stream_write_nu16(&os, 1);
+
+    if(FAIL(return_code = zdb_zone_snapshot_write_rrset(&os, TYPE_SOA, soa, &record_count)))
+    {
+        output_stream_close(&bos);
+        return return_code;
+    }
+
+    /* the labels, parents before their children */
+
+    zdb_zone_label_iterator iter;
+    zdb_zone_label_iterator_init(zone, &iter);
+
+    while(zdb_zone_label_iterator_hasnext(&iter))
+    {
+        u32 fqdn_len = zdb_zone_label_iterator_nextname(&iter, fqdn);
+
+        zdb_rr_label *label = zdb_zone_label_iterator_next(&iter);
+
+        if(FAIL(return_code = zdb_zone_snapshot_write_label(&os, fqdn, fqdn_len, label, &record_count)))
+        {
+            output_stream_close(&bos);
+            return return_code;
+        }
+    }
+
+#if ZDB_NSEC3_SUPPORT != 0
+
+    if((zone->apex->flags & ZDB_RR_LABEL_NSEC3) != 0)
+    {
+        if(FAIL(return_code = zdb_zone_snapshot_write_nsec3(&os, zone, &record_count)))
+        {
+            output_stream_close(&bos);
+            return return_code;
+        }
+
+        index_offset = os_data.offset;
+
+        if(FAIL(return_code = zdb_zone_snapshot_write_index(&os, zone)))
+        {
+            output_stream_close(&bos);
+            return return_code;
+        }
+    }
+
+#endif
+
+    if(FAIL(return_code = output_stream_flush(&bos)))
+    {
+        output_stream_close(&bos);
+        return return_code;
+    }
+
+    SET_U32_AT(header[ZDB_ZONE_SNAPSHOT_MAGIC_OFFSET], htonl(ZDB_ZONE_SNAPSHOT_MAGIC));
+    SET_U16_AT(header[ZDB_ZONE_SNAPSHOT_VERSION_OFFSET], htons(ZDB_ZONE_SNAPSHOT_VERSION));
+    SET_U16_AT(header[ZDB_ZONE_SNAPSHOT_CLASS_OFFSET], zdb_zone_getclass(zone)); /** @note: NATIVECLASS */
+    SET_U32_AT(header[ZDB_ZONE_SNAPSHOT_SERIAL_OFFSET], htonl(serial));
+    SET_U32_AT(header[ZDB_ZONE_SNAPSHOT_COUNT_OFFSET], htonl(record_count));
+    zdb_zone_snapshot_set_u64(&header[ZDB_ZONE_SNAPSHOT_SOURCE_SIZE_OFFSET], source_size);
+    zdb_zone_snapshot_set_u64(&header[ZDB_ZONE_SNAPSHOT_SOURCE_MTIME_OFFSET], source_mtime);
+    zdb_zone_snapshot_set_u64(&header[ZDB_ZONE_SNAPSHOT_RECORDS_OFFSET], records_offset);
+    zdb_zone_snapshot_set_u64(&header[ZDB_ZONE_SNAPSHOT_INDEX_OFFSET], index_offset);
+    zdb_zone_snapshot_set_u64(&header[ZDB_ZONE_SNAPSHOT_SIZE_OFFSET], os_data.offset);
+    zdb_zone_snapshot_set_u64(&header[ZDB_ZONE_SNAPSHOT_CHECKSUM_OFFSET], os_data.checksum);
+
+    if(pwrite(fd, header, sizeof(header), 0) != sizeof(header))
+    {
+        return_code = ERRNO_ERROR;
+    }
+    else
+    {
+        return_code = record_count;
+    }
+
+    output_stream_close(&bos); /* closes fd */
+
+    return return_code;
+}
+
+ya_result
+zdb_zone_write_snapshot_file(const zdb_zone *zone, const char *path, u64 source_size, u64 source_mtime)
+{
+    ya_result return_code;
+    int fd;
+
+    char path_tmp[MAX_PATH];
+
+    if(FAIL(return_code = snformat(path_tmp, sizeof(path_tmp), "%s%s", path, ZDB_ZONE_SNAPSHOT_TMP_SUFFIX)))
+    {
+        return return_code;
+    }
+
+    if((fd = open(path_tmp, O_RDWR|O_CREAT|O_TRUNC, 0644)) < 0)
+    {
+        return_code = ERRNO_ERROR;
+
+        log_err("zone snapshot: cannot create '%s': %r", path_tmp, return_code);
+
+        return return_code;
+    }
+
+    if(FAIL(return_code = zdb_zone_snapshot_write(zone, fd, source_size, source_mtime)))
+    {
+        log_err("zone snapshot: cannot write '%s': %r", path_tmp, return_code);
+
+        unlink(path_tmp);
+
+        return return_code;
+    }
+
+    if(rename(path_tmp, path) < 0)
+    {
+        return_code = ERRNO_ERROR;
+
+        log_err("zone snapshot: unable to rename '%s' into '%s': %r", path_tmp, path, return_code);
+
+        unlink(path_tmp);
+
+        return return_code;
+    }
+
+    log_info("zone snapshot: %{dnsname} written into '%s' (%d records)", zone->origin, path, return_code);
+
+    return return_code;
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
@@ -51,12 +51,14 @@
 #include "dnsdb/zdb_zone.h"
 #include "dnsdb/zdb_zone_label.h"
 #include "dnsdb/zdb_utils.h"
+#include "dnsdb/zdb_answer_cache.h"
 
 #include <dnscore/input_stream.h>
 
 #if ZDB_NSEC3_SUPPORT!=0
 #include "dnsdb/nsec3_icmtl.h"
 #include "dnsdb/nsec3_load.h"
+#include "dnsdb/nsec3_proof_cache.h"
 #endif
 
 #include <dnscore/rfc.h>
@@ -574,6 +576,11 @@ zdb_zone_update_ixfr(zdb* db, input_stream* is)
             nsec3_load_destroy(&nsec3_context);
 #endif
             zone_label->zone = zone;
+            
+            zdb_answer_cache_invalidate_all();
+#if ZDB_NSEC3_SUPPORT != 0
+            nsec3_proof_cache_invalidate_all();
+#endif
 
             return err;
 #if ZDB_NSEC3_SUPPORT != 0
@@ -0,0 +1,1056 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright
+*          notice, this list of conditions and the following disclaimer in the
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be
+*          used to endorse or promote products derived from this software
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup test Micro-benchmarks of the database structures
+ *  @ingroup dnsdb
+ *  @brief Micro-benchmarks of the database structures
+ *
+ *  Not installed, built by "make check".
+ *
+ *  dnsdb_bench <benchmark> [args]
+ *
+ *  dictionary [count ...]  insert/lookup/miss/delete on the AVL, htbt and htoa
+ *                          dictionaries (default counts: 10 1000 100000 10000000)
+ *  packet_writer [size ...]
+ *                          AXFR-like packets filled with compressed owners and
+ *                          NS rdata (default sizes: 4096 65535)
+ *  nsec3 [iterations ...]  NSEC3 SHA-1 digests, one name at a time then by
+ *                          batches (multi-buffer), 100000 names (default
+ *                          iterations: 0 1 10 100)
+ *  rrsig [signers ...]     hand-off of 1000000 labels from the zone walk to the
+ *                          signers and the committer, one label at a time then
+ *                          by batches, then the signature of a 1000000 labels
+ *                          zone with a generated RSASHA1-NSEC3 key through the
+ *                          same batches (default signers: 1 2 4)
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <dnscore/dnscore.h>
+#include <dnscore/sys_types.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/packet_writer.h>
+#include <dnscore/rfc.h>
+#include <dnscore/threaded_queue.h>
+
+#include <dnsdb/zdb.h>
+#include <dnsdb/dictionary.h>
+#include <dnsdb/hash.h>
+#include <dnsdb/nsec3_hash.h>
+#if ZDB_DNSSEC_SUPPORT != 0
+#include <dnsdb/rrsig.h>
+#include <dnsdb/dnssec.h>
+#include <dnsdb/dnssec_task.h>
+#include <dnsdb/dnssec_keystore.h>
+#include <dnsdb/zdb_zone.h>
+#include <dnsdb/zdb_record.h>
+#if ZDB_USE_THREADPOOL != 0
+#include <dnscore/thread_pool.h>
+#endif
+#endif
+
+#define BENCHDIC_TAG 0x43494448434e4542 /* BENCHDIC */
+#define BENCHPKT_TAG 0x544b5048434e4542 /* BENCHPKT */
+#define BENCHNS3_TAG 0x33534e48434e4542 /* BENCHNS3 */
+#define BENCHSIG_TAG 0x47495348434e4542 /* BENCHSIG */
+
+/* the dictionary backends, as selected by dictionary_init */
+
+void dictionary_btree_init(dictionary* dico);
+void dictionary_htbt_init(dictionary* dico);
+void dictionary_htoa_init(dictionary* dico);
+
+static double
+bench_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*******************************************************************************************************************
+ *
+ * dictionary
+ *
+ ******************************************************************************************************************/
+
+typedef struct bench_node bench_node;
+
+struct bench_node
+{
+    dictionary_node *next;
+    u8 label[16];
+};
+
+static bench_node *bench_nodes = NULL;
+static u32 bench_nodes_next = 0;
+
+static int
+bench_node_match(const void *label, const dictionary_node *node)
+{
+    const u8 *l = (const u8*)label;
+
+    return memcmp(l, ((const bench_node*)node)->label, l[0] + 1) == 0;
+}
+
+static dictionary_node*
+bench_node_create(const void *label)
+{
+    bench_node *node = &bench_nodes[bench_nodes_next++];
+    memcpy(node->label, label, ((const u8*)label)[0] + 1);
+    node->next = NULL;
+
+    return (dictionary_node*)node;
+}
+
+static void
+bench_node_destroy(dictionary_node *node)
+{
+    /* the nodes are in one array */
+}
+
+static ya_result
+bench_node_delete(void *label, dictionary_node *node)
+{
+    return bench_node_match(label, node) ? COLLECTION_PROCESS_DELETENODE : COLLECTION_PROCESS_NEXT;
+}
+
+static void
+bench_label(u8 *label, const char *prefix, u32 i)
+{
+    label[0] = (u8)snprintf((char*)&label[1], 15, "%s%u", prefix, (u32)(i * 2654435761U % 1000000007U));
+}
+
+static int
+bench_dictionary_count(u32 n)
+{
+    static const char *names[3] = {"avl ", "htbt", "htoa"};
+    static dictionary_init_method *inits[3] = {dictionary_btree_init, dictionary_htbt_init, dictionary_htoa_init};
+
+    u8 (*labels)[16];
+    hashcode *hashes;
+    u32 *order;
+
+    MALLOC_OR_DIE(u8(*)[16], labels, 16 * (size_t)n, BENCHDIC_TAG);
+    MALLOC_OR_DIE(hashcode*, hashes, sizeof(hashcode) * (size_t)n, BENCHDIC_TAG);
+    MALLOC_OR_DIE(u32*, order, sizeof(u32) * (size_t)n, BENCHDIC_TAG);
+    MALLOC_OR_DIE(bench_node*, bench_nodes, sizeof(bench_node) * (size_t)n, BENCHDIC_TAG);
+
+    for(u32 i = 0; i < n; i++)
+    {
+        bench_label(labels[i], "d", i);
+        hashes[i] = hash_dnslabel(labels[i]);
+        order[i] = i;
+    }
+
+    /* the lookups and deletes are made in a random order */
+
+    srand(1);
+
+    for(u32 i = n - 1; i > 0; i--)
+    {
+        u32 j = rand() % (i + 1);
+        u32 tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    u32 lookups = MAX(n, 2000000);
+    int ret = EXIT_SUCCESS;
+
+    for(int b = 0; b < 3; b++)
+    {
+        dictionary d;
+        inits[b](&d);
+        d.threshold = ~0;   /* never switch to another backend */
+        bench_nodes_next = 0;
+
+        double t0 = bench_now();
+
+        for(u32 i = 0; i < n; i++)
+        {
+            dictionary_add(&d, hashes[i], labels[i], bench_node_match, bench_node_create);
+        }
+
+        double t1 = bench_now();
+
+        u32 found = 0;
+
+        for(u32 k = 0; k < lookups; k++)
+        {
+            u32 i = order[k % n];
+            found += (dictionary_find(&d, hashes[i], labels[i], bench_node_match) != NULL) ? 1 : 0;
+        }
+
+        double t2 = bench_now();
+
+        u32 missed = 0;
+
+        for(u32 k = 0; k < lookups; k++)
+        {
+            u8 label[16];
+            bench_label(label, "m", k % n);
+            missed += (dictionary_find(&d, hash_dnslabel(label), label, bench_node_match) == NULL) ? 1 : 0;
+        }
+
+        double t3 = bench_now();
+
+        u32 removed = 0;
+
+        for(u32 k = 0; k < n; k++)
+        {
+            u32 i = order[k];
+            removed += (dictionary_process(&d, hashes[i], labels[i], bench_node_delete) == COLLECTION_PROCESS_DELETENODE) ? 1 : 0;
+        }
+
+        double t4 = bench_now();
+
+        if((found != lookups) || (missed != lookups) || (removed != n) || (d.count != 0))
+        {
+            printf("dictionary %s n=%u: found %u/%u, missed %u/%u, removed %u/%u, %u left\n", names[b], n, found, lookups, missed, lookups, removed, n, d.count);
+            ret = EXIT_FAILURE;
+        }
+
+        printf("dictionary %s n=%-9u insert %7.1f ns  lookup %7.1f ns  miss (+hash) %7.1f ns  delete %7.1f ns\n",
+                names[b], n,
+                (t1 - t0) * 1e9 / n,
+                (t2 - t1) * 1e9 / lookups,
+                (t3 - t2) * 1e9 / lookups,
+                (t4 - t3) * 1e9 / n);
+
+        dictionary_destroy(&d, bench_node_destroy);
+    }
+
+    free(bench_nodes);
+    bench_nodes = NULL;
+    free(order);
+    free(hashes);
+    free(labels);
+
+    return ret;
+}
+
+static int
+bench_dictionary(int argc, char **argv)
+{
+    static const u32 counts[] = {10, 1000, 100000, 10000000};
+    int ret = EXIT_SUCCESS;
+
+    if(argc == 0)
+    {
+        for(int i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++)
+        {
+            ret |= bench_dictionary_count(counts[i]);
+        }
+    }
+    else
+    {
+        for(int i = 0; i < argc; i++)
+        {
+            ret |= bench_dictionary_count(atoi(argv[i]));
+        }
+    }
+
+    return ret;
+}
+
+/*******************************************************************************************************************
+ *
+ * packet_writer
+ *
+ ******************************************************************************************************************/
+
+#define BENCH_PACKET_NAMES      100000  /* owners of the synthetic zone */
+#define BENCH_PACKET_RECORDS    4000000 /* records written for each packet size */
+
+static int
+bench_packet_writer_size(u32 size, u8 (*owners)[64], u8 (*targets)[64])
+{
+    static const u8 origin[] = "\007example\003com";
+
+    packet_writer *pw;
+    u8 *packet;
+
+    /* the dictionary makes the packet_writer too big for the stack */
+
+    MALLOC_OR_DIE(packet_writer*, pw, sizeof(packet_writer), BENCHPKT_TAG);
+    MALLOC_OR_DIE(u8*, packet, size, BENCHPKT_TAG);
+
+    memset(packet, 0, DNS_HEADER_LENGTH);
+    memcpy(&packet[DNS_HEADER_LENGTH], origin, sizeof(origin));
+    SET_U16_AT(packet[DNS_HEADER_LENGTH + sizeof(origin)], TYPE_AXFR);
+    SET_U16_AT(packet[DNS_HEADER_LENGTH + sizeof(origin) + 2], CLASS_IN);
+
+    u32 question_end = DNS_HEADER_LENGTH + sizeof(origin) + 4;
+    u64 bytes = 0;
+    u32 packets = 0;
+    u32 records = 0;
+
+    double t0 = bench_now();
+
+    while(records < BENCH_PACKET_RECORDS)
+    {
+        packet_writer_init(pw, packet, question_end, size);
+
+        /* an owner, its type/class/ttl/rdlen, then the name server : at most 2 * 255 + 10 bytes */
+
+        while((pw->packet_limit - pw->packet_offset) >= 2 * MAX_DOMAIN_LENGTH + 10)
+        {
+            u32 i = records % BENCH_PACKET_NAMES;
+
+            packet_writer_add_fqdn(pw, owners[i]);
+            packet_writer_add_u16(pw, TYPE_NS);
+            packet_writer_add_u16(pw, CLASS_IN);
+            packet_writer_add_u32(pw, NU32(86400));
+
+            u32 rdata_offset = pw->packet_offset + 2;
+            pw->packet_offset = rdata_offset;
+            packet_writer_add_fqdn(pw, targets[i]);
+            packet_writer_set_u16(pw, htons(pw->packet_offset - rdata_offset), rdata_offset - 2);
+
+            records++;
+        }
+
+        bytes += pw->packet_offset;
+        packets++;
+    }
+
+    double t1 = bench_now();
+
+    printf("packet_writer size=%-5u %7u packets  %6.1f records/packet  %6.1f bytes/record  %7.1f ns/record  %9.1f ns/packet\n",
+            size, packets,
+            (double)records / packets,
+            (double)bytes / records,
+            (t1 - t0) * 1e9 / records,
+            (t1 - t0) * 1e9 / packets);
+
+    free(packet);
+    free(pw);
+
+    return EXIT_SUCCESS;
+}
+
+static int
+bench_packet_writer(int argc, char **argv)
+{
+    static const u32 sizes[] = {4096, 65535};
+
+    u8 (*owners)[64];
+    u8 (*targets)[64];
+
+    MALLOC_OR_DIE(u8(*)[64], owners, 64 * BENCH_PACKET_NAMES, BENCHPKT_TAG);
+    MALLOC_OR_DIE(u8(*)[64], targets, 64 * BENCH_PACKET_NAMES, BENCHPKT_TAG);
+
+    /* the owners of a delegation-heavy zone, in their AXFR order, and a few shared name servers */
+
+    for(u32 i = 0; i < BENCH_PACKET_NAMES; i++)
+    {
+        char text[64];
+
+        snprintf(text, sizeof(text), "host%u.zone%u.example.com.", i, i / 64);
+        cstr_to_dnsname(owners[i], text);
+        snprintf(text, sizeof(text), "ns%u.provider%u.net.", i & 1, (i * 2654435761U) % 97);
+        cstr_to_dnsname(targets[i], text);
+    }
+
+    int ret = EXIT_SUCCESS;
+
+    if(argc == 0)
+    {
+        for(int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+        {
+            ret |= bench_packet_writer_size(sizes[i], owners, targets);
+        }
+    }
+    else
+    {
+        for(int i = 0; i < argc; i++)
+        {
+            u32 size = atoi(argv[i]);
+
+            if((size < 1024) || (size > 65535))
+            {
+                printf("packet_writer: size %u is not in [1024;65535]\n", size);
+                ret = EXIT_FAILURE;
+                continue;
+            }
+
+            ret |= bench_packet_writer_size(size, owners, targets);
+        }
+    }
+
+    free(targets);
+    free(owners);
+
+    return ret;
+}
+
+/*******************************************************************************************************************
+ *
+ * nsec3
+ *
+ ******************************************************************************************************************/
+
+#define BENCH_NSEC3_NAMES   100000
+#define BENCH_NSEC3_BATCH   64      /* as NSEC3_UPDATE_BATCH_SIZE */
+
+static int
+bench_nsec3_iterations(u32 iterations)
+{
+    static const u8 salt[8] = {0xde, 0xad, 0xbe, 0xef, 0x01, 0x23, 0x45, 0x67};
+    static const u8 origin[] = "\007example\003com";   /* the terminating 0 is the one of the string */
+
+    u8 (*names)[32];
+    u8 (*scalar)[20];
+    u8 (*batch)[20];
+    u8 **name_ptrs;
+    u8 **batch_ptrs;
+    u32 *name_lens;
+
+    MALLOC_OR_DIE(u8(*)[32], names, 32 * BENCH_NSEC3_NAMES, BENCHNS3_TAG);
+    MALLOC_OR_DIE(u8(*)[20], scalar, 20 * BENCH_NSEC3_NAMES, BENCHNS3_TAG);
+    MALLOC_OR_DIE(u8(*)[20], batch, 20 * BENCH_NSEC3_NAMES, BENCHNS3_TAG);
+    MALLOC_OR_DIE(u8**, name_ptrs, sizeof(u8*) * BENCH_NSEC3_NAMES, BENCHNS3_TAG);
+    MALLOC_OR_DIE(u8**, batch_ptrs, sizeof(u8*) * BENCH_NSEC3_NAMES, BENCHNS3_TAG);
+    MALLOC_OR_DIE(u32*, name_lens, sizeof(u32) * BENCH_NSEC3_NAMES, BENCHNS3_TAG);
+
+    for(u32 i = 0; i < BENCH_NSEC3_NAMES; i++)
+    {
+        bench_label(names[i], "n", i);
+        memcpy(&names[i][names[i][0] + 1], origin, sizeof(origin));
+        name_lens[i] = names[i][0] + 1 + sizeof(origin);
+        name_ptrs[i] = names[i];
+        batch_ptrs[i] = batch[i];
+    }
+
+    nsec3_hash_function *digest = nsec3_hash_get_function(1);
+    nsec3_hash_batch_function *digest_batch = nsec3_hash_get_batch_function(1);
+
+    double t0 = bench_now();
+
+    for(u32 i = 0; i < BENCH_NSEC3_NAMES; i++)
+    {
+        digest(names[i], name_lens[i], salt, sizeof(salt), iterations, scalar[i], FALSE);
+    }
+
+    double t1 = bench_now();
+
+    for(u32 i = 0; i < BENCH_NSEC3_NAMES; i += BENCH_NSEC3_BATCH)
+    {
+        u32 count = MIN(BENCH_NSEC3_BATCH, BENCH_NSEC3_NAMES - i);
+
+        digest_batch((const u8 * const *)&name_ptrs[i], &name_lens[i], count, salt, sizeof(salt), iterations, &batch_ptrs[i], FALSE);
+    }
+
+    double t2 = bench_now();
+
+    int ret = EXIT_SUCCESS;
+
+    if(memcmp(scalar, batch, 20 * BENCH_NSEC3_NAMES) != 0)
+    {
+        printf("nsec3 iterations=%u: the batch digests differ from the serial ones\n", iterations);
+        ret = EXIT_FAILURE;
+    }
+
+    printf("nsec3 iterations=%-4u serial %8.1f ns/name  batch %8.1f ns/name  (x%.2f)\n",
+            iterations,
+            (t1 - t0) * 1e9 / BENCH_NSEC3_NAMES,
+            (t2 - t1) * 1e9 / BENCH_NSEC3_NAMES,
+            (t1 - t0) / (t2 - t1));
+
+    free(name_lens);
+    free(batch_ptrs);
+    free(name_ptrs);
+    free(batch);
+    free(scalar);
+    free(names);
+
+    return ret;
+}
+
+static int
+bench_nsec3(int argc, char **argv)
+{
+    static const u32 iterations[] = {0, 1, 10, 100};
+    int ret = EXIT_SUCCESS;
+
+    if(argc == 0)
+    {
+        for(int i = 0; i < (int)(sizeof(iterations) / sizeof(iterations[0])); i++)
+        {
+            ret |= bench_nsec3_iterations(iterations[i]);
+        }
+    }
+    else
+    {
+        for(int i = 0; i < argc; i++)
+        {
+            ret |= bench_nsec3_iterations(atoi(argv[i]));
+        }
+    }
+
+    return ret;
+}
+
+/*******************************************************************************************************************
+ *
+ * rrsig
+ *
+ ******************************************************************************************************************/
+
+#if ZDB_DNSSEC_SUPPORT != 0
+
+#define BENCH_RRSIG_LABELS  1000000
+#define BENCH_RRSIG_ZONES   (BENCH_RRSIG_LABELS / 64)
+
+typedef struct bench_rrsig_query bench_rrsig_query;
+
+/* the work unit of one label, as the zone walk queued it before the batches */
+
+struct bench_rrsig_query
+{
+    zdb_zone* zone;
+    zdb_rr_label* label;
+    zdb_packed_ttlrdata* added_rrsig_sll;
+    zdb_packed_ttlrdata* removed_rrsig_sll;
+    dnsname_stack path;
+    bool delegation;
+};
+
+typedef struct bench_rrsig_args bench_rrsig_args;
+
+struct bench_rrsig_args
+{
+    threaded_queue query;
+    threaded_queue answer;
+    u8 (*hosts)[16];
+    u8 (*zones)[16];
+    u32 signers;
+    bool batched;
+};
+
+static void
+bench_rrsig_path(bench_rrsig_args *args, dnsname_stack *path, u32 i)
+{
+    static const u8 com[] = "\003com";
+    static const u8 example[] = "\007example";
+
+    path->labels[0] = (u8*)com;
+    path->labels[1] = (u8*)example;
+    path->labels[2] = args->zones[i / 64];
+    path->labels[3] = args->hosts[i];
+    path->size = 3;
+}
+
+/* the zone walk */
+
+static void*
+bench_rrsig_walk(void *args_)
+{
+    bench_rrsig_args *args = (bench_rrsig_args*)args_;
+    dnsname_stack path;
+
+    if(args->batched)
+    {
+        rrsig_update_batch *batch = NULL;
+
+        for(u32 i = 0; i < BENCH_RRSIG_LABELS; i++)
+        {
+            bench_rrsig_path(args, &path, i);
+
+            if((batch != NULL) && rrsig_update_batch_full(batch, &path))
+            {
+                threaded_queue_enqueue(&args->query, batch);
+                batch = NULL;
+            }
+
+            if(batch == NULL)
+            {
+                batch = rrsig_update_batch_new(NULL);
+            }
+
+            rrsig_update_batch_add(batch, NULL, &path, FALSE);
+        }
+
+        if(batch != NULL)
+        {
+            threaded_queue_enqueue(&args->query, batch);
+        }
+    }
+    else
+    {
+        for(u32 i = 0; i < BENCH_RRSIG_LABELS; i++)
+        {
+            bench_rrsig_query *query;
+
+            MALLOC_OR_DIE(bench_rrsig_query*, query, sizeof(bench_rrsig_query), BENCHSIG_TAG);
+
+            bench_rrsig_path(args, &query->path, i);
+            query->zone = NULL;
+            query->label = NULL;
+            query->added_rrsig_sll = NULL;
+            query->removed_rrsig_sll = NULL;
+            query->delegation = FALSE;
+
+            threaded_queue_enqueue(&args->query, query);
+        }
+    }
+
+    for(u32 i = 0; i < args->signers; i++)
+    {
+        threaded_queue_enqueue(&args->query, NULL);
+    }
+
+    return NULL;
+}
+
+/* the signers only pass the work on : this measures the cost of the hand-off */
+
+static void*
+bench_rrsig_signer(void *args_)
+{
+    bench_rrsig_args *args = (bench_rrsig_args*)args_;
+    void *item;
+
+    while((item = threaded_queue_dequeue(&args->query)) != NULL)
+    {
+        threaded_queue_enqueue(&args->answer, item);
+    }
+
+    return NULL;
+}
+
+static int
+bench_rrsig_signers(u8 (*hosts)[16], u8 (*zones)[16], u32 signers)
+{
+    bench_rrsig_args args;
+    pthread_t walk;
+    pthread_t *signer;
+    double t[3];
+    u64 check[2];
+
+    MALLOC_OR_DIE(pthread_t*, signer, sizeof(pthread_t) * signers, BENCHSIG_TAG);
+
+    args.hosts = hosts;
+    args.zones = zones;
+    args.signers = signers;
+
+    t[0] = bench_now();
+
+    for(int mode = 0; mode < 2; mode++)
+    {
+        args.batched = (mode != 0);
+
+        /* as the updater descriptors size the queries queue */
+
+        threaded_queue_init(&args.query, args.batched ? RRSIG_UPDATE_BATCH_QUEUE_SIZE : QUEUE_MAX_SIZE);
+        threaded_queue_init(&args.answer, QUEUE_MAX_SIZE);
+
+        pthread_create(&walk, NULL, bench_rrsig_walk, &args);
+
+        for(u32 i = 0; i < signers; i++)
+        {
+            pthread_create(&signer[i], NULL, bench_rrsig_signer, &args);
+        }
+
+        /* the committer, reading back the path of every label */
+
+        dnsname_stack path;
+        u32 labels = 0;
+
+        check[mode] = 0;
+
+        while(labels < BENCH_RRSIG_LABELS)
+        {
+            if(args.batched)
+            {
+                rrsig_update_batch *batch = (rrsig_update_batch*)threaded_queue_dequeue(&args.answer);
+
+                for(u32 i = 0; i < batch->count; i++)
+                {
+                    rrsig_update_batch_get_path(batch, &batch->queries[i], &path);
+                    check[mode] += path.labels[path.size][0];
+                }
+
+                labels += batch->count;
+
+                rrsig_update_batch_free(batch);
+            }
+            else
+            {
+                bench_rrsig_query *query = (bench_rrsig_query*)threaded_queue_dequeue(&args.answer);
+
+                check[mode] += query->path.labels[query->path.size][0];
+                labels++;
+
+                free(query);
+            }
+        }
+
+        pthread_join(walk, NULL);
+
+        for(u32 i = 0; i < signers; i++)
+        {
+            pthread_join(signer[i], NULL);
+        }
+
+        threaded_queue_finalize(&args.answer);
+        threaded_queue_finalize(&args.query);
+
+        t[mode + 1] = bench_now();
+    }
+
+    int ret = EXIT_SUCCESS;
+
+    if(check[0] != check[1])
+    {
+        printf("rrsig signers=%u: the batches did not carry the same labels\n", signers);
+        ret = EXIT_FAILURE;
+    }
+
+    printf("rrsig signers=%-2u per label %7.1f ns/label  batch %7.1f ns/label  (x%.2f)\n",
+            signers,
+            (t[1] - t[0]) * 1e9 / BENCH_RRSIG_LABELS,
+            (t[2] - t[1]) * 1e9 / BENCH_RRSIG_LABELS,
+            (t[1] - t[0]) / (t[2] - t[1]));
+
+    free(signer);
+
+    return ret;
+}
+
+/*
+ * The signature of a real zone : the labels h<i>.z<i/64>.example.com. with
+ * one A record each, signed by the signers of the RRSIG updater.
+ */
+
+#define BENCH_RRSIG_KEY_ALGORITHM   DNSKEY_ALGORITHM_RSASHA1_NSEC3
+#define BENCH_RRSIG_KEY_SIZE        1024
+
+extern dnssec_task_descriptor dnssec_updater_task_descriptor;
+
+static const u8 bench_rrsig_origin[] = "\007example\003com";
+
+static zdb_zone*
+bench_rrsig_zone_create(u8 (*hosts)[16], u8 (*zones)[16], dnssec_key *key)
+{
+    static const u8 soa_names[] = "\002ns\007example\003com\012hostmaster\007example\003com";
+
+    zdb_zone *zone = zdb_zone_create(bench_rrsig_origin, CLASS_IN);
+    zdb_packed_ttlrdata *ttlrdata;
+    u8 rdata[sizeof(soa_names) - 1 + 20];
+
+    memcpy(rdata, soa_names, sizeof(soa_names) - 1);
+    SET_U32_AT(rdata[sizeof(soa_names) - 1 +  0], htonl(1));
+    SET_U32_AT(rdata[sizeof(soa_names) - 1 +  4], htonl(3600));
+    SET_U32_AT(rdata[sizeof(soa_names) - 1 +  8], htonl(600));
+    SET_U32_AT(rdata[sizeof(soa_names) - 1 + 12], htonl(864000));
+    SET_U32_AT(rdata[sizeof(soa_names) - 1 + 16], htonl(3600));
+
+    ZDB_RECORD_ZALLOC(ttlrdata, 86400, sizeof(rdata), rdata);
+    zdb_zone_record_add(zone, NULL, -1, TYPE_SOA, ttlrdata);
+
+    dnssec_key_addrecord(zone, key);
+
+    for(u32 i = 0; i < BENCH_RRSIG_LABELS; i++)
+    {
+        u8 *labels[2] = {hosts[i], zones[i / 64]};
+
+        SET_U32_AT(rdata[0], htonl(0x0a000000 | i));
+
+        ZDB_RECORD_ZALLOC(ttlrdata, 86400, 4, rdata);
+        zdb_zone_record_add(zone, labels, 1, TYPE_A, ttlrdata);
+    }
+
+    return zone;
+}
+
+/*
+ * Queues the labels to the signers (task != NULL), else counts the labels with
+ * records and the signed ones.
+ */
+
+static void
+bench_rrsig_zone_label(zdb_zone *zone, dnssec_task *task, zdb_rr_label *label, u32 *counts)
+{
+    if(LABEL_HAS_RECORDS(label))
+    {
+        if(task != NULL)
+        {
+            dnssec_process_queue_label(zone, task, label, FALSE);
+        }
+        else
+        {
+            counts[0]++;
+
+            if(zdb_record_find(&label->resource_record_set, TYPE_RRSIG) != NULL)
+            {
+                counts[1]++;
+            }
+        }
+    }
+
+    dictionary_iterator iter;
+    dictionary_iterator_init(&label->sub, &iter);
+
+    while(dictionary_iterator_hasnext(&iter))
+    {
+        zdb_rr_label *sub = *(zdb_rr_label**)dictionary_iterator_next(&iter);
+
+        if(task != NULL)
+        {
+            dnsname_stack_push_label(&task->path, sub->name);
+        }
+
+        bench_rrsig_zone_label(zone, task, sub, counts);
+
+        if(task != NULL)
+        {
+            dnsname_stack_pop_label(&task->path);
+        }
+    }
+}
+
+static ya_result
+bench_rrsig_zone_walk(zdb_zone *zone, dnssec_task *task, void *args)
+{
+    dnsname_to_dnsname_stack(zone->origin, &task->path);
+    bench_rrsig_zone_label(zone, task, zone->apex, NULL);
+
+    return SUCCESS;
+}
+
+static int
+bench_rrsig_sign(u8 (*hosts)[16], u8 (*zones)[16], dnssec_key *key, u32 signers)
+{
+    dnssec_task task;
+    ya_result ret;
+    u32 counts[2] = {0, 0};
+
+#if ZDB_USE_THREADPOOL != 0
+    /* the signers and the committer are jobs of the pool */
+
+    thread_pool_init(signers + 2);
+#endif
+
+    dnssec_process_setthreadcount(signers);
+
+    /* a new zone each time, else the signatures would still be valid */
+
+    zdb_zone *zone = bench_rrsig_zone_create(hosts, zones, key);
+
+    zdb_zone_lock(zone, ZDB_ZONE_MUTEX_RRSIG_UPDATER);
+
+    double t0 = bench_now();
+
+    if(ISOK(ret = dnssec_process_initialize(&task, &dnssec_updater_task_descriptor)))
+    {
+        ret = dnssec_process_task(zone, &task, bench_rrsig_zone_walk, NULL);
+    }
+
+    dnssec_process_finalize(&task);
+
+    double t1 = bench_now();
+
+    zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_RRSIG_UPDATER);
+
+    bench_rrsig_zone_label(zone, NULL, zone->apex, counts);
+
+    zdb_zone_destroy(zone);
+
+    if(FAIL(ret) || (counts[1] != counts[0]))
+    {
+        printf("rrsig signers=%u: %u labels signed out of %u (%08x)\n", signers, counts[1], counts[0], ret);
+
+        return EXIT_FAILURE;
+    }
+
+    printf("rrsig signers=%-2u signing  %9.0f labels/s\n", signers, counts[0] / (t1 - t0));
+
+    return EXIT_SUCCESS;
+}
+
+static int
+bench_rrsig(int argc, char **argv)
+{
+    static const u32 signers[] = {1, 2, 4};
+
+    u8 (*hosts)[16];
+    u8 (*zones)[16];
+
+    MALLOC_OR_DIE(u8(*)[16], hosts, 16 * BENCH_RRSIG_LABELS, BENCHSIG_TAG);
+    MALLOC_OR_DIE(u8(*)[16], zones, 16 * BENCH_RRSIG_ZONES, BENCHSIG_TAG);
+
+    for(u32 i = 0; i < BENCH_RRSIG_LABELS; i++)
+    {
+        bench_label(hosts[i], "h", i);
+    }
+
+    for(u32 i = 0; i < BENCH_RRSIG_ZONES; i++)
+    {
+        bench_label(zones[i], "z", i);
+    }
+
+    /* the key stays in the keystore, where the signers will look for it */
+
+    dnssec_key *key;
+    ya_result err;
+
+    if(FAIL(err = dnssec_key_createnew(BENCH_RRSIG_KEY_ALGORITHM, BENCH_RRSIG_KEY_SIZE, DNSKEY_FLAG_ZONEKEY, "example.com.", &key)))
+    {
+        printf("rrsig: cannot generate the key (%08x)\n", err);
+
+        free(zones);
+        free(hosts);
+
+        return EXIT_FAILURE;
+    }
+
+    int ret = EXIT_SUCCESS;
+
+    if(argc == 0)
+    {
+        for(int i = 0; i < (int)(sizeof(signers) / sizeof(signers[0])); i++)
+        {
+            ret |= bench_rrsig_signers(hosts, zones, signers[i]);
+            ret |= bench_rrsig_sign(hosts, zones, key, signers[i]);
+        }
+    }
+    else
+    {
+        for(int i = 0; i < argc; i++)
+        {
+            u32 count = atoi(argv[i]);
+
+            if(count == 0)
+            {
+                printf("rrsig: at least one signer is needed\n");
+                ret = EXIT_FAILURE;
+                continue;
+            }
+
+            ret |= bench_rrsig_signers(hosts, zones, count);
+            ret |= bench_rrsig_sign(hosts, zones, key, count);
+        }
+    }
+
+    free(zones);
+    free(hosts);
+
+    return ret;
+}
+
+#endif
+
+/*******************************************************************************************************************
+ *
+ * main
+ *
+ ******************************************************************************************************************/
+
+typedef int bench_function(int argc, char **argv);
+
+typedef struct bench_entry bench_entry;
+
+struct bench_entry
+{
+    const char *name;
+    bench_function *function;
+};
+
+static const bench_entry bench_table[] =
+{
+    {"dictionary", bench_dictionary},
+    {"packet_writer", bench_packet_writer},
+    {"nsec3", bench_nsec3},
+#if ZDB_DNSSEC_SUPPORT != 0
+    {"rrsig", bench_rrsig},
+#endif
+    {NULL, NULL}
+};
+
+int
+main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        printf("usage: %s <benchmark> [args]\nbenchmarks:", argv[0]);
+
+        for(const bench_entry *e = bench_table; e->name != NULL; e++)
+        {
+            printf(" %s", e->name);
+        }
+
+        puts("");
+
+        return EXIT_FAILURE;
+    }
+
+    dnscore_init();
+    zdb_init();
+
+    int ret = EXIT_FAILURE;
+
+    for(const bench_entry *e = bench_table; e->name != NULL; e++)
+    {
+        if(strcmp(e->name, argv[1]) == 0)
+        {
+            ret = e->function(argc - 2, &argv[2]);
+            break;
+        }
+    }
+
+    /*
+     * The results are printed with stdio : they have to be out before
+     * dnscore closes the standard output at exit.
+     */
+
+    fflush(stdout);
+
+    zdb_finalize();
+
+    return ret;
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
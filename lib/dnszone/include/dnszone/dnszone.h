@@ -92,6 +92,8 @@ extern "C" {
 #define     ZRE_CRAP_AT_END_OF_RECORD       ZONEREAD_ERROR_CODE(21)
 #define     ZRE_UNBALANCED_QUOTES           ZONEREAD_ERROR_CODE(24)
 #define     ZRE_AXFR_FILE_NOT_FOUND         ZONEREAD_ERROR_CODE(25)
+#define     ZRE_SNAPSHOT_INVALID            ZONEREAD_ERROR_CODE(26)
+#define     ZRE_SNAPSHOT_OUTDATED           ZONEREAD_ERROR_CODE(27)
 /*
  * This fingerprint feature has been added so libraries could check they are compatible
  */
@@ -77,6 +77,7 @@ ya_result   rr_get_origin(const char *, u8 **);     /* parse */
 ya_result   rr_get_ttl(const char *, u32 *);        /* parse */
 
 ya_result   rr_parse_line(char *, const u8 *, u8 *, u32 *, resource_record *, int *);
+ya_result   rr_parse_line_ex(char *, const u8 *, u8 *, u32 *, resource_record *, int *, bool *);
 
 void        rr_print(output_stream*, resource_record *, const char *, u8);
     void    rr_print_all(output_stream*, resource_record *, const char *, u8);
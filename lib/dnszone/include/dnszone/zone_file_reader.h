@@ -99,6 +99,23 @@
 
 ya_result zone_file_reader_open(const char* fullpath, zone_reader *dst);
 
+/** @brief Opens a zone file, to be parsed by a pool of threads
+ *
+ *  The records are read in the order of the file, with the same errors
+ *  as zone_file_reader_open.
+ *
+ *  @param[in]  fullpath the path and name of the file to open
+ *  @param[out] zone a pointer to a structure that will be used by the function
+ *              to hold the zone-file information
+ *  @param[in]  parser_count the number of parser threads (0 for zone_file_reader_open)
+ *
+ *  @return     A result code
+ *  @retval     OK   : the file has been opened successfully
+ *  @retval     else : an error occurred
+ */
+
+ya_result zone_file_reader_parallel_open(const char* fullpath, zone_reader *dst, u32 parser_count);
+
 #endif
 
 /*    ------------------------------------------------------------    */
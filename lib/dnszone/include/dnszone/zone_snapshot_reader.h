@@ -0,0 +1,73 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup zonesnapshot Zone snapshot loader module
+ *  @ingroup dnszone
+ *  @brief
+ *
+ * @{
+ */
+/*----------------------------------------------------------------------------*/
+
+#ifndef ZONE_SNAPSHOT_READER_H
+#define	ZONE_SNAPSHOT_READER_H
+
+#include <dnszone/dnszone.h>
+
+/** @brief Opens the binary snapshot of a zone
+ *
+ *  The snapshot is mapped in memory and checked.  It is only accepted if it
+ *  has been made with the current version of the text file of the zone
+ *  (same size and modification time), if its checksum matches and if its
+ *  serial is not older than the one of the text file.
+ *
+ *  The reader gives the NSEC3 digests stored in the snapshot to zdb_zone_load.
+ *
+ *  @param[in]  snapshot_path the path and name of the snapshot
+ *  @param[in]  source_path the path and name of the text file of the zone
+ *  @param[out] dst a pointer to the reader
+ *
+ *  @return     A result code
+ *  @retval     OK   : the snapshot has been opened successfully
+ *  @retval     ZRE_SNAPSHOT_OUTDATED : the snapshot does not match the text file
+ *  @retval     ZRE_SNAPSHOT_INVALID : the snapshot is corrupted
+ *  @retval     else : an error occurred
+ */
+
+ya_result zone_snapshot_reader_open(const char* snapshot_path, const char* source_path, zone_reader *dst);
+
+#endif	/* ZONE_SNAPSHOT_READER_H */
+
+/*    ------------------------------------------------------------    */
+
+/** @} */
@@ -105,6 +105,8 @@ dnszone_register_errors()
     error_register(ZRE_UNBALANCED_QUOTES,"ZRE_UNBALANCED_QUOTES");
     
     error_register(ZRE_AXFR_FILE_NOT_FOUND,"ZRE_AXFR_FILE_NOT_FOUND");
+    error_register(ZRE_SNAPSHOT_INVALID,"ZRE_SNAPSHOT_INVALID");
+    error_register(ZRE_SNAPSHOT_OUTDATED,"ZRE_SNAPSHOT_OUTDATED");
 }
 
 logger_handle *g_zone_logger = NULL;
@@ -280,6 +280,22 @@ rr_check_rdata(char *src, resource_record *rr, const u16 qtype, const u8 *origin
  */
 ya_result
 rr_parse_line(char *src, const u8 *origin, u8 *label, u32 *ttl, resource_record *rr, int *bracket_status)
+{
+    bool ttl_found;
+    
+    return rr_parse_line_ex(src, origin, label, ttl, rr, bracket_status, &ttl_found);
+}
+
+/** @brief Parse the resource record in its components
+ *
+ *  Same as rr_parse_line but also tells if the first line of the record
+ *  had a TTL (ttl_found is only written for the first line of a record)
+ *
+ *  It is used by the parallel reader, which applies the default TTL of the
+ *  zone once the records are back in the order of the file.
+ */
+ya_result
+rr_parse_line_ex(char *src, const u8 *origin, u8 *label, u32 *ttl, resource_record *rr, int *bracket_status, bool *ttl_found)
 {
     ya_result                                              return_code = OK;
     char                                                   *needle = NULL;
@@ -336,6 +352,8 @@ rr_parse_line(char *src, const u8 *origin, u8 *label, u32 *ttl, resource_record
         {
             *ttl = rr->ttl;
         }
+        
+        *ttl_found = !no_ttl;
     }
 
 //    format("rr_parse_line 4: %s\n", src);
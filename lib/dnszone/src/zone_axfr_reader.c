@@ -179,6 +179,7 @@ static zone_reader_vtbl zone_axfr_reader_vtbl =
     zone_axfr_reader_free_record,
     zone_axfr_reader_close,
     zone_axfr_reader_handle_error,
+    NULL,
     "zone_axfr_reader"
 };
 
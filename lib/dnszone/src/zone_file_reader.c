@@ -51,16 +51,28 @@
 
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>		/* or netinet/in.h */
 
 #include <dnscore/format.h>
 #include <dnscore/logger.h>
 #include <dnscore/buffer_input_stream.h>
 #include <dnscore/file_input_stream.h>
+#include <dnscore/bytearray_output_stream.h>
+#include <dnscore/threaded_queue.h>
+#include <dnscore/timems.h>
 
 #include "dnszone/zone_file_reader.h"
 
 #define ZFREADER_TAG 0x524544414552465a
+#define ZFPREADR_TAG 0x524441455250465a
+#define ZFPBATCH_TAG 0x484354414250465a
+#define ZFPITEMS_TAG 0x534d45544950465a
+#define ZFPTEXT_TAG  0x5f5458455450465a
+#define ZFPWIRE_TAG  0x5f4552495750465a
+#define ZFPTHRDS_TAG 0x534452485450465a
+#define ZFPRSCRR_TAG 0x525243535250465a
 
 #ifndef NAME_MAX
 #define NAME_MAX 1024
@@ -390,6 +402,7 @@ static zone_reader_vtbl zone_file_reader_vtbl =
     zone_file_reader_free_record,
     zone_file_reader_close,
     zone_file_reader_handle_error,
+    NULL,
     "zone_file_reader"
 };
 
@@ -455,6 +468,1001 @@ zone_file_reader_open(const char* fullpath, zone_reader *dst)
     return OK;
 }
 
+/***************************************************************************************************/
+/* Parallel reader                                                                                 */
+/*                                                                                                 */
+/* A chunker thread reads the lines, handles the directives and cuts the file into batches of      */
+/* whole records.  Parser threads convert the records of a batch to wire format.  The thread       */
+/* calling zone_reader_read_record gets the batches back in the order of the file, applies what    */
+/* depends on the previous records (owner, default TTL, class, SOA checks) and returns them one by */
+/* one, with the same errors and line numbers as zone_file_reader_read_record.                     */
+/*                                                                                                 */
+/***************************************************************************************************/
+
+#define ZONE_FILE_PARALLEL_READ_BUFFER_SIZE     65536
+#define ZONE_FILE_BATCH_ITEMS_MAX               1024
+#define ZONE_FILE_BATCH_TEXT_MAX                65536
+#define ZONE_FILE_BATCHES_BY_PARSER             4
+#define ZONE_FILE_PROGRESS_PERIOD               5000000     /* us */
+
+#define ZFP_RECORD              0
+#define ZFP_TTL                 1
+#define ZFP_ORIGIN              2
+#define ZFP_ERROR               3
+
+#define ZFP_COMPLETE            0x01    /* the closing bracket has been read */
+#define ZFP_OWNER_INHERITED     0x02    /* the line started with a blank */
+#define ZFP_TTL_FOUND           0x04    /* the record had its own TTL */
+
+#define ZFP_ERROR_ORIGIN        0
+#define ZFP_ERROR_TTL           1
+#define ZFP_ERROR_INCLUDE       2
+#define ZFP_ERROR_GENERATE      3
+
+#define ZFP_NO_ORIGIN           MAX_U32
+
+#define ZFP_ALIGN(x__)          (((x__) + 3) & ~3)
+
+/*
+ * A physical line of the file, stored in the text of a batch.
+ * The lines of a record are linked because a directive can be found in the middle.
+ */
+
+typedef struct zone_file_line zone_file_line;
+struct zone_file_line
+{
+    u32 line_number;
+    u32 next;
+    char text[];
+};
+
+typedef struct zone_file_item zone_file_item;
+struct zone_file_item
+{
+    /* set by the chunker */
+
+    u32 text_offset;        /* first line of the record or of the directive */
+    u32 last_offset;        /* last line, the one logged by the class & SOA checks */
+    u32 origin_offset;      /* origin in the text, or ZFP_NO_ORIGIN */
+    u16 line_count;
+    u8 kind;
+    u8 flags;
+
+    /* set by the parser (or by the chunker for directives) */
+
+    ya_result error;
+    u32 error_offset;       /* line the error has been found on */
+    u32 ttl;                /* of the record or of $TTL, or the ZFP_ERROR_* of an error */
+    u32 wire_offset;        /* owner followed by the rdata */
+    u16 rdata_size;
+    u16 rtype;
+    u16 rclass;
+};
+
+typedef struct zone_file_batch zone_file_batch;
+struct zone_file_batch
+{
+    zone_file_item *items;
+    u8 *text;
+    u8 *wire;
+    u32 item_count;
+    u32 item_capacity;
+    u32 text_size;
+    u32 text_capacity;
+    u32 wire_size;
+    u32 wire_capacity;
+    u32 index;              /* next item given to the loader */
+    volatile bool parsed;
+    bool last;
+};
+
+typedef struct zone_file_parallel_reader zone_file_parallel_reader;
+struct zone_file_parallel_reader
+{
+    input_stream ins;
+
+    threaded_queue order_queue;         /* batches, in the order of the file, for the loader */
+    threaded_queue parse_queue;         /* batches, for the parsers */
+
+    pthread_mutex_t mtx;
+    pthread_cond_t parsed_cond;
+
+    pthread_t chunker;
+    pthread_t *parsers;
+    u32 parser_count;
+
+    zone_file_batch *batch;             /* batch being read by the loader */
+
+    char *path;
+    u64 file_size;
+
+    volatile bool stop;
+    bool last_seen;
+
+    ya_result status;                   /* OK, then 1 (end of file) or the error */
+
+    u32 default_ttl;
+    u16 qclass;
+    bool soa_found;
+    u8  label[MAX_DOMAIN_LENGTH];
+};
+
+static zone_file_batch*
+zone_file_batch_new()
+{
+    zone_file_batch *batch;
+
+    MALLOC_OR_DIE(zone_file_batch*, batch, sizeof(zone_file_batch), ZFPBATCH_TAG);
+
+    batch->item_capacity = ZONE_FILE_BATCH_ITEMS_MAX + 16;
+    batch->text_capacity = ZONE_FILE_BATCH_TEXT_MAX + 2 * MAX_LINE_SIZE;
+    batch->wire_capacity = ZONE_FILE_BATCH_TEXT_MAX;
+
+    MALLOC_OR_DIE(zone_file_item*, batch->items, sizeof(zone_file_item) * batch->item_capacity, ZFPITEMS_TAG);
+    MALLOC_OR_DIE(u8*, batch->text, batch->text_capacity, ZFPTEXT_TAG);
+    MALLOC_OR_DIE(u8*, batch->wire, batch->wire_capacity, ZFPWIRE_TAG);
+
+    batch->item_count = 0;
+    batch->text_size = 0;
+    batch->wire_size = 0;
+    batch->index = 0;
+    batch->parsed = FALSE;
+    batch->last = FALSE;
+
+    return batch;
+}
+
+static void
+zone_file_batch_free(zone_file_batch *batch)
+{
+    free(batch->items);
+    free(batch->text);
+    free(batch->wire);
+    free(batch);
+}
+
+static zone_file_item*
+zone_file_batch_add_item(zone_file_batch *batch, u8 kind, u32 text_offset, u32 origin_offset)
+{
+    if(batch->item_count == batch->item_capacity)
+    {
+        batch->item_capacity *= 2;
+        REALLOC_OR_DIE(zone_file_item*, batch->items, sizeof(zone_file_item) * batch->item_capacity, ZFPITEMS_TAG);
+    }
+
+    zone_file_item *item = &batch->items[batch->item_count++];
+
+    item->text_offset = text_offset;
+    item->last_offset = text_offset;
+    item->origin_offset = origin_offset;
+    item->line_count = 0;
+    item->kind = kind;
+    item->flags = 0;
+    item->error = OK;
+    item->error_offset = text_offset;
+    item->ttl = 0;
+    item->wire_offset = 0;
+    item->rdata_size = 0;
+    item->rtype = 0;
+    item->rclass = 0;
+
+    return item;
+}
+
+static u32
+zone_file_batch_reserve_text(zone_file_batch *batch, u32 size)
+{
+    u32 offset = batch->text_size;
+
+    size = ZFP_ALIGN(size);
+
+    if(offset + size > batch->text_capacity)
+    {
+        batch->text_capacity = MAX(batch->text_capacity * 2, offset + size);
+        REALLOC_OR_DIE(u8*, batch->text, batch->text_capacity, ZFPTEXT_TAG);
+    }
+
+    batch->text_size += size;
+
+    return offset;
+}
+
+static u32
+zone_file_batch_add_line(zone_file_batch *batch, u32 line_number, const char *line, size_t line_len)
+{
+    u32 offset = zone_file_batch_reserve_text(batch, sizeof(zone_file_line) + line_len + 1);
+
+    zone_file_line *zl = (zone_file_line*)&batch->text[offset];
+    zl->line_number = line_number;
+    zl->next = offset;
+    memcpy(zl->text, line, line_len + 1);
+
+    return offset;
+}
+
+static u32
+zone_file_batch_add_origin(zone_file_batch *batch, const u8 *origin)
+{
+    u32 origin_len = dnsname_len(origin);
+    u32 offset = zone_file_batch_reserve_text(batch, origin_len);
+
+    memcpy(&batch->text[offset], origin, origin_len);
+
+    return offset;
+}
+
+static inline zone_file_line*
+zone_file_batch_line(zone_file_batch *batch, u32 offset)
+{
+    return (zone_file_line*)&batch->text[offset];
+}
+
+static u32
+zone_file_batch_add_wire(zone_file_batch *batch, const u8 *bytes, u32 size)
+{
+    u32 offset = batch->wire_size;
+
+    if(offset + size > batch->wire_capacity)
+    {
+        batch->wire_capacity = MAX(batch->wire_capacity * 2, offset + size);
+        REALLOC_OR_DIE(u8*, batch->wire, batch->wire_capacity, ZFPWIRE_TAG);
+    }
+
+    memcpy(&batch->wire[offset], bytes, size);
+    batch->wire_size += size;
+
+    return offset;
+}
+
+/**
+ * Gives the line at offset the way zone_file_reader_read_record logs it
+ */
+
+static u32
+zone_file_batch_line_bak(zone_file_batch *batch, u32 offset, char *line_bak, size_t line_bak_size)
+{
+    zone_file_line *zl = zone_file_batch_line(batch, offset);
+
+    strncpy(line_bak, zl->text, line_bak_size - 1);
+    line_bak[line_bak_size - 1] = '\0';
+
+    return zl->line_number;
+}
+
+static void
+zone_file_parallel_reader_post(zone_file_parallel_reader *zfr, zone_file_batch *batch)
+{
+    threaded_queue_enqueue(&zfr->order_queue, batch);
+    threaded_queue_enqueue(&zfr->parse_queue, batch);
+}
+
+static void
+zone_file_parallel_reader_wait_parsed(zone_file_parallel_reader *zfr, zone_file_batch *batch)
+{
+    pthread_mutex_lock(&zfr->mtx);
+
+    while(!batch->parsed)
+    {
+        pthread_cond_wait(&zfr->parsed_cond, &zfr->mtx);
+    }
+
+    pthread_mutex_unlock(&zfr->mtx);
+}
+
+/**
+ * The chunker.
+ *
+ * Reads the file the way zone_file_reader_read_record does and cuts it at record boundaries.
+ * It stops at the first directive error, with an error item in the last batch.
+ */
+
+static void*
+zone_file_parallel_reader_chunker_thread(void *args)
+{
+    zone_file_parallel_reader *zfr = (zone_file_parallel_reader*)args;
+
+    char *needle;
+    u8 *origin = NULL;
+    u64 bytes_read = 0;
+    u64 start = timeus();
+    u64 next_progress = start + ZONE_FILE_PROGRESS_PERIOD;
+    u32 line_number = 0;
+    u32 record_count = 0;
+    u32 origin_offset = ZFP_NO_ORIGIN;
+    u32 record_index = MAX_U32;      /* item of the record being read, if any */
+    int bracket_status = BRACKET_CLOSED;
+    ya_result return_code;
+    char line[MAX_LINE_SIZE];
+
+    zone_file_batch *batch = zone_file_batch_new();
+
+    while((return_code = buffer_input_stream_read_line(&zfr->ins, line, sizeof(line))) > 0)
+    {
+        line_number++;
+        bytes_read += return_code;
+
+        /* If comment at the beginning of the line, skip the line completely */
+        if((line[0] == '#') | (line[0] == ';'))
+        {
+            continue;
+        }
+
+        /* Remove unwanted comments and white spaces at the end of the line */
+        TRIM_RR_LINE2(line);
+
+        size_t line_len = strlen(line);
+
+        if(line_len == 0)
+        {
+            continue;
+        }
+
+        if(*line == '$')
+        {
+            u32 text_offset = batch->text_size;
+
+            if((needle = strstr(line, "$ORIGIN")) != 0)
+            {
+                text_offset = zone_file_batch_add_line(batch, line_number, line, line_len);
+
+                SKIP_WORD(needle);
+
+                if(FAIL(return_code = rr_get_origin(needle, &origin)))
+                {
+                    zone_file_item *item = zone_file_batch_add_item(batch, ZFP_ERROR, text_offset, origin_offset);
+                    item->error = return_code;
+                    item->ttl = ZFP_ERROR_ORIGIN;
+                    break;
+                }
+
+                origin_offset = zone_file_batch_add_origin(batch, origin);
+
+                zone_file_batch_add_item(batch, ZFP_ORIGIN, text_offset, origin_offset);
+
+                continue;
+            }
+            else if((needle = strstr(line, "$TTL")) != 0) /* Check for $TTL directive */
+            {
+                u32 ttl;
+
+                text_offset = zone_file_batch_add_line(batch, line_number, line, line_len);
+
+                SKIP_WORD(needle);
+
+                if(FAIL(return_code = rr_get_ttl(needle, &ttl)))
+                {
+                    zone_file_item *item = zone_file_batch_add_item(batch, ZFP_ERROR, text_offset, origin_offset);
+                    item->error = return_code;
+                    item->ttl = ZFP_ERROR_TTL;
+                    break;
+                }
+
+                zone_file_item *item = zone_file_batch_add_item(batch, ZFP_TTL, text_offset, origin_offset);
+                item->ttl = ttl;
+
+                continue;
+            }
+            else if((needle = strstr(line, "$INCLUDE")) != 0)
+            {
+                zone_file_item *item = zone_file_batch_add_item(batch, ZFP_ERROR, text_offset, origin_offset);
+                item->error = ERROR;
+                item->ttl = ZFP_ERROR_INCLUDE;
+                break;
+            }
+            else if((needle = strstr(line, "$GENERATE")) != 0)
+            {
+                zone_file_item *item = zone_file_batch_add_item(batch, ZFP_ERROR, text_offset, origin_offset);
+                item->error = ERROR;
+                item->ttl = ZFP_ERROR_GENERATE;
+                break;
+            }
+            else
+            {
+                /* parse error ? */
+            }
+        }
+
+        /* Must be (part of) a resource record */
+
+        if(bracket_status == BRACKET_CLOSED)
+        {
+            /* a new record : the batch is only cut between two records */
+
+            if((batch->item_count >= ZONE_FILE_BATCH_ITEMS_MAX) || (batch->text_size >= ZONE_FILE_BATCH_TEXT_MAX))
+            {
+                zone_file_parallel_reader_post(zfr, batch);
+
+                batch = zone_file_batch_new();
+
+                origin_offset = (origin != NULL)?zone_file_batch_add_origin(batch, origin):ZFP_NO_ORIGIN;
+
+                if(zfr->stop)
+                {
+                    record_index = MAX_U32;
+                    break;
+                }
+
+                u64 now = timeus();
+
+                if(now >= next_progress)
+                {
+                    next_progress = now + ZONE_FILE_PROGRESS_PERIOD;
+
+                    log_info("zone file: '%s': %llu/%llu bytes read (%llu%%), line %u", zfr->path, bytes_read, zfr->file_size, (100 * bytes_read) / MAX(zfr->file_size, 1), line_number);
+                }
+            }
+
+            zone_file_item *item = zone_file_batch_add_item(batch, ZFP_RECORD, batch->text_size, origin_offset);
+
+            if(isspace(line[0]))
+            {
+                item->flags |= ZFP_OWNER_INHERITED;
+            }
+
+            record_index = batch->item_count - 1;
+            record_count++;
+        }
+
+        zone_file_item *item = &batch->items[record_index];
+
+        u32 text_offset = zone_file_batch_add_line(batch, line_number, line, line_len);
+
+        if(item->line_count != 0)
+        {
+            zone_file_batch_line(batch, item->last_offset)->next = text_offset;
+        }
+
+        item->last_offset = text_offset;
+        item->line_count++;
+
+        /* the brackets are what tells where a record ends */
+
+        for(needle = line; *needle != '\0'; needle++)
+        {
+            if(*needle == '(')
+            {
+                bracket_status = BRACKET_OPEN;
+            }
+            else if(*needle == ')')
+            {
+                bracket_status = BRACKET_CLOSED;
+            }
+        }
+
+        if(bracket_status == BRACKET_CLOSED)
+        {
+            item->flags |= ZFP_COMPLETE;
+        }
+    }
+
+    /*
+     * An unclosed record at the end is still parsed (for its errors) but never returned,
+     * as zone_file_reader_read_record does.
+     */
+
+    batch->last = TRUE;
+
+    zone_file_parallel_reader_post(zfr, batch);
+
+    for(u32 i = 0; i < zfr->parser_count; i++)
+    {
+        threaded_queue_enqueue(&zfr->parse_queue, NULL);
+    }
+
+    free(origin);
+
+    log_debug("zone file: '%s': %u lines, %u records, read in %llums by %u parser(s)", zfr->path, line_number, record_count, (timeus() - start) / 1000, zfr->parser_count);
+
+    return NULL;
+}
+
+static void
+zone_file_parallel_reader_parse_batch(zone_file_batch *batch, resource_record *rr)
+{
+    ya_result return_code;
+    char line[MAX_LINE_SIZE];
+    u8 label[MAX_DOMAIN_LENGTH];
+
+    for(u32 i = 0; i < batch->item_count; i++)
+    {
+        zone_file_item *item = &batch->items[i];
+
+        if(item->kind != ZFP_RECORD)
+        {
+            continue;
+        }
+
+        const u8 *origin = (item->origin_offset != ZFP_NO_ORIGIN)?&batch->text[item->origin_offset]:NULL;
+        u32 offset = item->text_offset;
+        u32 ttl = 0;
+        int bracket_status = BRACKET_CLOSED;
+        bool ttl_found = FALSE;
+
+        /*
+         * The owner of a record starting with a blank is only known by the loader.
+         * An empty label makes rr_parse_line use the origin meanwhile.
+         */
+
+        label[0] = '\0';
+
+        rr->type = 0;
+        rr->class = 0;
+        rr->rdata[0] = '\0';
+        bytearray_output_stream_reset(&rr->os_rdata);
+
+        for(u16 l = 0; l < item->line_count; l++)
+        {
+            zone_file_line *zl = zone_file_batch_line(batch, offset);
+
+            strcpy(line, zl->text); /* the text is kept intact for the messages */
+
+            if(FAIL(return_code = rr_parse_line_ex(line, origin, label, &ttl, rr, &bracket_status, &ttl_found)))
+            {
+                item->error = return_code;
+                item->error_offset = offset;
+                break;
+            }
+
+            offset = zl->next;
+        }
+
+        if(FAIL(item->error) || (bracket_status != BRACKET_CLOSED) || ((item->flags & ZFP_COMPLETE) == 0))
+        {
+            item->flags &= ~ZFP_COMPLETE;
+            continue;
+        }
+
+        u32 rdata_size = bytearray_output_stream_size(&rr->os_rdata);
+
+        item->wire_offset = zone_file_batch_add_wire(batch, rr->name, dnsname_len(rr->name));
+        zone_file_batch_add_wire(batch, bytearray_output_stream_buffer(&rr->os_rdata), rdata_size);
+        item->rdata_size = rdata_size;
+        item->rtype = rr->type;
+        item->rclass = rr->class;
+        item->ttl = rr->ttl;
+
+        if(ttl_found)
+        {
+            item->flags |= ZFP_TTL_FOUND;
+        }
+    }
+}
+
+static void*
+zone_file_parallel_reader_parser_thread(void *args)
+{
+    zone_file_parallel_reader *zfr = (zone_file_parallel_reader*)args;
+
+    resource_record *rr;
+
+    MALLOC_OR_DIE(resource_record*, rr, sizeof(resource_record), ZFPRSCRR_TAG);   /* too big for a stack */
+
+    resource_record_init(rr);
+
+    zone_file_batch *batch;
+
+    while((batch = (zone_file_batch*)threaded_queue_dequeue(&zfr->parse_queue)) != NULL)
+    {
+        zone_file_parallel_reader_parse_batch(batch, rr);
+
+        pthread_mutex_lock(&zfr->mtx);
+        batch->parsed = TRUE;
+        pthread_cond_broadcast(&zfr->parsed_cond);
+        pthread_mutex_unlock(&zfr->mtx);
+    }
+
+    resource_record_freecontent(rr);
+
+    free(rr);
+
+    return NULL;
+}
+
+/**
+ * Does, in the order of the file, what zone_file_reader_read_record does after rr_parse_line.
+ */
+
+static ya_result
+zone_file_parallel_reader_return_record(zone_file_parallel_reader *zfr, zone_file_batch *batch, zone_file_item *item, resource_record *entry)
+{
+    const u8 *owner = &batch->wire[item->wire_offset];
+    u32 owner_len = dnsname_len(owner);
+    char line_bak[160];
+
+    if((item->flags & ZFP_OWNER_INHERITED) != 0)
+    {
+        if(zfr->label[0] == '\0')
+        {
+            dnsname_copy(zfr->label, owner);    /* the parser has put the origin there */
+        }
+
+        dnsname_copy(entry->name, zfr->label);
+    }
+    else
+    {
+        dnsname_copy(entry->name, owner);
+        dnsname_copy(zfr->label, owner);
+    }
+
+    if((item->flags & ZFP_TTL_FOUND) != 0)
+    {
+        zfr->default_ttl = item->ttl;           /* the found TTL is the new default one (RFC1035) */
+    }
+
+    entry->ttl = zfr->default_ttl;
+    entry->type = item->rtype;
+    entry->class = item->rclass;
+
+    if(zfr->qclass == 0)
+    {
+        if(entry->class != 0)
+        {
+            zfr->qclass = entry->class;
+        }
+        else
+        {
+            u32 line_number = zone_file_batch_line_bak(batch, item->last_offset, line_bak, sizeof(line_bak));
+
+            log_err("zone file: parse: class error at line %i: '%s': %r", line_number, line_bak, ZRE_NO_CLASS_FOUND);
+
+            return ZRE_NO_CLASS_FOUND;
+        }
+    }
+    else
+    {
+        /* Check for existing class */
+        if(entry->class == 0)
+        {
+            entry->class = zfr->qclass;
+        }
+        else if(entry->class != zfr->qclass)
+        {
+            u32 line_number = zone_file_batch_line_bak(batch, item->last_offset, line_bak, sizeof(line_bak));
+
+            log_err("zone file: parse: class error at line %i: '%s': %r", line_number, line_bak, ZRE_DIFFERENT_CLASSES);
+
+            return ZRE_DIFFERENT_CLASSES;
+        }
+    }
+
+    /* Init SOA type found marker */
+    if(!zfr->soa_found)
+    {
+        /* First resource record  must be of "type" SOA */
+        if(entry->type != TYPE_SOA)
+        {
+            u32 line_number = zone_file_batch_line_bak(batch, item->last_offset, line_bak, sizeof(line_bak));
+
+            log_err("zone file: parse: apex error at line %i: '%s': %r", line_number, line_bak, ZRE_WRONG_APEX);
+
+            return ZRE_WRONG_APEX;
+        }
+        zfr->soa_found = TRUE;
+    }
+    else
+    {
+        if(entry->type == TYPE_SOA)
+        {
+            u32 line_number = zone_file_batch_line_bak(batch, item->last_offset, line_bak, sizeof(line_bak));
+
+            log_err("zone file: parse: SOA error at line %i: '%s': %r", line_number, line_bak, ZRE_DUPLICATED_SOA);
+
+            return ZRE_DUPLICATED_SOA;
+        }
+    }
+
+    output_stream_write(&entry->os_rdata, &batch->wire[item->wire_offset + owner_len], item->rdata_size);
+
+    return OK;
+}
+
+static ya_result
+zone_file_parallel_reader_read_record(zone_reader *zr, resource_record *entry)
+{
+    zassert((zr != NULL) && (entry != NULL));
+
+    zone_file_parallel_reader *zfr = (zone_file_parallel_reader*)zr->data;
+
+    ya_result return_code;
+    u32 line_number;
+    char line_bak[160];
+
+    /* after the end or an error, keep returning the same */
+
+    if(zfr->status != OK)
+    {
+        return zfr->status;
+    }
+
+    /* reset resource record entry */
+
+    entry->type     = 0;
+
+    entry->rdata[0] = '\0';
+
+    for(;;)
+    {
+        zone_file_batch *batch = zfr->batch;
+
+        if(batch == NULL)
+        {
+            batch = (zone_file_batch*)threaded_queue_dequeue(&zfr->order_queue);
+
+            zone_file_parallel_reader_wait_parsed(zfr, batch);
+
+            zfr->batch = batch;
+        }
+
+        if(batch->index == batch->item_count)
+        {
+            zfr->last_seen = batch->last;
+            zfr->batch = NULL;
+
+            zone_file_batch_free(batch);
+
+            if(zfr->last_seen)
+            {
+                zfr->status = 1;
+
+                return 1;
+            }
+
+            continue;
+        }
+
+        zone_file_item *item = &batch->items[batch->index++];
+
+        switch(item->kind)
+        {
+            case ZFP_RECORD:
+            {
+                if(FAIL(item->error))
+                {
+                    line_number = zone_file_batch_line_bak(batch, item->error_offset, line_bak, sizeof(line_bak));
+
+                    log_err("zone file: parse: error at line %i: '%s': %r", line_number, line_bak, item->error);
+
+                    zfr->status = item->error;
+
+                    return item->error;
+                }
+
+                if((item->flags & ZFP_COMPLETE) == 0)
+                {
+                    break;
+                }
+
+                if(FAIL(return_code = zone_file_parallel_reader_return_record(zfr, batch, item, entry)))
+                {
+                    zfr->status = return_code;
+                }
+
+                return return_code;
+            }
+            case ZFP_TTL:
+            {
+                zfr->default_ttl = item->ttl;
+                break;
+            }
+            case ZFP_ORIGIN:
+            {
+                /* If okay reset label */
+                zfr->label[0] = '\0';
+                break;
+            }
+            case ZFP_ERROR:
+            {
+                switch(item->ttl)
+                {
+                    case ZFP_ERROR_ORIGIN:
+                        line_number = zone_file_batch_line_bak(batch, item->text_offset, line_bak, sizeof(line_bak));
+                        log_err("zone file: parse: origin error at line %i: '%s': %r", line_number, line_bak, item->error);
+                        break;
+                    case ZFP_ERROR_TTL:
+                        line_number = zone_file_batch_line_bak(batch, item->text_offset, line_bak, sizeof(line_bak));
+                        log_err("zone file: parse: ttl error at line %i: '%s': %r", line_number, line_bak, item->error);
+                        break;
+                    case ZFP_ERROR_INCLUDE:
+                        log_err("zone file: parse: $INCLUDE not supported");
+                        break;
+                    case ZFP_ERROR_GENERATE:
+                        log_err("zone file: parse: $GENERATE not supported");
+                        break;
+                }
+
+                zfr->status = item->error;
+
+                return item->error;
+            }
+        }
+    }
+}
+
+/**
+ * Stops the threads and releases everything.
+ *
+ * The chunker may be waiting for room in the order queue so the remaining batches are consumed first.
+ */
+
+static void
+zone_file_parallel_reader_destroy(zone_file_parallel_reader *zfr, bool chunker_started)
+{
+    zfr->stop = TRUE;
+
+    if(chunker_started)
+    {
+        if(zfr->batch != NULL)
+        {
+            zfr->last_seen = zfr->batch->last;
+            zone_file_batch_free(zfr->batch);
+            zfr->batch = NULL;
+        }
+
+        while(!zfr->last_seen)
+        {
+            zone_file_batch *batch = (zone_file_batch*)threaded_queue_dequeue(&zfr->order_queue);
+
+            zone_file_parallel_reader_wait_parsed(zfr, batch);
+
+            zfr->last_seen = batch->last;
+
+            zone_file_batch_free(batch);
+        }
+
+        pthread_join(zfr->chunker, NULL);
+    }
+    else
+    {
+        for(u32 i = 0; i < zfr->parser_count; i++)
+        {
+            threaded_queue_enqueue(&zfr->parse_queue, NULL);
+        }
+    }
+
+    for(u32 i = 0; i < zfr->parser_count; i++)
+    {
+        pthread_join(zfr->parsers[i], NULL);
+    }
+
+    threaded_queue_finalize(&zfr->parse_queue);
+    threaded_queue_finalize(&zfr->order_queue);
+
+    pthread_cond_destroy(&zfr->parsed_cond);
+    pthread_mutex_destroy(&zfr->mtx);
+
+#if (DNSDB_USE_POSIX_ADVISE != 0) && (_XOPEN_SOURCE >= 600 || _POSIX_C_SOURCE >= 200112L)
+    int fd = fd_input_stream_get_filedescriptor(&zfr->ins);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+    input_stream_close(&zfr->ins);
+
+    free(zfr->parsers);
+    free(zfr->path);
+    free(zfr);
+}
+
+static void
+zone_file_parallel_reader_close(zone_reader *zr)
+{
+    zassert(zr != NULL);
+
+    zone_file_parallel_reader *zfr = (zone_file_parallel_reader*)zr->data;
+
+    zone_file_parallel_reader_destroy(zfr, TRUE);
+
+    zr->data = NULL;
+    zr->vtbl = NULL;
+}
+
+static zone_reader_vtbl zone_file_parallel_reader_vtbl =
+{
+    zone_file_parallel_reader_read_record,
+    zone_file_reader_free_record,
+    zone_file_parallel_reader_close,
+    zone_file_reader_handle_error,
+    NULL,
+    "zone_file_parallel_reader"
+};
+
+/** @brief Opens a zone file, to be parsed by a pool of threads
+ *
+ *  Opens a zone file.  A thread cuts it in batches of records that are
+ *  converted to wire by parser_count threads.  The records are read in the
+ *  order of the file, with the same errors as zone_file_reader_open.
+ *
+ *  @param[in]  fullpath the path and name of the file to open
+ *  @param[out] dst a pointer to a structure that will be used by the function
+ *              to hold the zone-file information
+ *  @param[in]  parser_count the number of parser threads (0 for zone_file_reader_open)
+ *
+ *  @return     A result code
+ *  @retval     OK   : the file has been opened successfully
+ *  @retval     else : an error occurred
+ */
+ya_result
+zone_file_reader_parallel_open(const char* fullpath, zone_reader *dst, u32 parser_count)
+{
+    zone_file_parallel_reader *zfr;
+
+    input_stream ins;
+    ya_result return_value;
+    struct stat st;
+
+    if(parser_count == 0)
+    {
+        return zone_file_reader_open(fullpath, dst);
+    }
+
+    if(FAIL(return_value = file_input_stream_open(fullpath, &ins)))
+    {
+            log_debug("zone file: cannot open: '%s': %r", fullpath, return_value);
+            return ZRE_FILE_OPEN_ERR;
+    }
+
+#if (DNSDB_USE_POSIX_ADVISE != 0) && (_XOPEN_SOURCE >= 600 || _POSIX_C_SOURCE >= 200112L)
+    int fd = fd_input_stream_get_filedescriptor(&ins);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+    /*    ------------------------------------------------------------    */
+
+    MALLOC_OR_DIE(zone_file_parallel_reader*, zfr, sizeof(zone_file_parallel_reader), ZFPREADR_TAG);
+
+    ZEROMEMORY(zfr, sizeof(zone_file_parallel_reader));
+
+    buffer_input_stream_init(&ins, &zfr->ins, ZONE_FILE_PARALLEL_READ_BUFFER_SIZE);
+
+    zfr->path = strdup(fullpath);
+    zfr->file_size = (stat(fullpath, &st) >= 0)?st.st_size:0;
+
+    /*
+     * The loader has at most one batch out of the order queue, so the parse queue never holds
+     * more than one batch above the size of the order queue : the chunker cannot block on it.
+     */
+
+    threaded_queue_init(&zfr->order_queue, parser_count * ZONE_FILE_BATCHES_BY_PARSER);
+    threaded_queue_init(&zfr->parse_queue, parser_count * ZONE_FILE_BATCHES_BY_PARSER + 2 + parser_count);
+
+    pthread_mutex_init(&zfr->mtx, NULL);
+    pthread_cond_init(&zfr->parsed_cond, NULL);
+
+    MALLOC_OR_DIE(pthread_t*, zfr->parsers, sizeof(pthread_t) * parser_count, ZFPTHRDS_TAG);
+
+    zfr->status = OK;
+
+    int ret;
+
+    for(zfr->parser_count = 0; zfr->parser_count < parser_count; zfr->parser_count++)
+    {
+        if((ret = pthread_create(&zfr->parsers[zfr->parser_count], NULL, zone_file_parallel_reader_parser_thread, zfr)) != 0)
+        {
+            log_warn("zone file: '%s': could only start %u parser(s) out of %u: %r", fullpath, zfr->parser_count, parser_count, MAKE_ERRNO_ERROR(ret));
+            break;
+        }
+    }
+
+    if(zfr->parser_count == 0)
+    {
+        zone_file_parallel_reader_destroy(zfr, FALSE);
+
+        return MAKE_ERRNO_ERROR(ret);
+    }
+
+    if((ret = pthread_create(&zfr->chunker, NULL, zone_file_parallel_reader_chunker_thread, zfr)) != 0)
+    {
+        log_err("zone file: '%s': cannot start the reader: %r", fullpath, MAKE_ERRNO_ERROR(ret));
+
+        zone_file_parallel_reader_destroy(zfr, FALSE);
+
+        return MAKE_ERRNO_ERROR(ret);
+    }
+
+    dst->data = zfr;
+    dst->vtbl = &zone_file_parallel_reader_vtbl;
+
+    return OK;
+}
 
 /** @} */
 
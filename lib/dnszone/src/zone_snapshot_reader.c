@@ -0,0 +1,607 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup zonesnapshot Zone snapshot loader module
+ *  @ingroup dnszone
+ *  @brief
+ *
+ *  Reads the records from a snapshot written by zdb_zone_write_snapshot_file.
+ *  The file is mapped, the records are copied straight from the map.
+ *
+ * @{
+ */
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+#include <string.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <dnscore/format.h>
+#include <dnscore/logger.h>
+#include <dnscore/serial.h>
+#include <dnscore/bytearray_output_stream.h>
+
+#include <dnsdb/zdb_utils.h>
+#include <dnsdb/nsec3_types.h>
+#include <dnsdb/zdb_zone_snapshot.h>
+
+#include "dnszone/zone_file_reader.h"
+#include "dnszone/zone_snapshot_reader.h"
+
+#define ZSREADER_TAG 0x524544414552535a /* ZSREADER */
+#define ZSCHAINS_TAG 0x534e49414843535a /* ZSCHAINS */
+
+extern logger_handle *g_zone_logger;
+#define MODULE_MSG_HANDLE g_zone_logger
+
+typedef struct zone_snapshot_chain zone_snapshot_chain;
+struct zone_snapshot_chain
+{
+    const u8 *nsec3param_rdata;
+    const u8 *slots;
+    const u8 *entries;
+    u32 entries_size;
+    u32 slot_mask;
+    u16 nsec3param_rdata_size;
+    u8 digest_len;
+};
+
+typedef struct zone_snapshot_reader zone_snapshot_reader;
+struct zone_snapshot_reader
+{
+    u8 *base;
+    size_t size;
+    
+    const u8 *p;                    /* next record */
+    const u8 *limit;                /* end of the records */
+    const u8 *name;                 /* owner of the current group */
+    
+    zone_snapshot_chain *chains;
+    char *file_path;
+    
+    u32 name_len;
+    u16 rrsets_left;                /* in the current group */
+    u16 records_left;               /* in the current rrset */
+    u16 type;
+    u16 class;
+    u16 chain_count;
+};
+
+static u64
+zone_snapshot_reader_get_u64(const u8 *p)
+{
+    return (((u64)ntohl(GET_U32_AT(p[0]))) << 32) | ntohl(GET_U32_AT(p[4]));
+}
+
+/*
+ * Returns the length of the name at p, or an error if it is not a valid one before limit.
+ */
+
+static ya_result
+zone_snapshot_reader_name_len(const u8 *p, const u8 *limit)
+{
+    const u8 *name = p;
+
+    while(p < limit)
+    {
+        u8 len = *p;
+
+        if(len > MAX_LABEL_LENGTH)
+        {
+            break;
+        }
+
+        p += len + 1;
+
+        if(p - name > MAX_DOMAIN_LENGTH)
+        {
+            break;
+        }
+
+        if(len == 0)
+        {
+            return p - name;
+        }
+    }
+
+    return ZRE_SNAPSHOT_INVALID;
+}
+
+static ya_result
+zone_snapshot_reader_read_record(zone_reader *zr, resource_record *entry)
+{
+    zassert((zr != NULL) && (entry != NULL));
+
+    zone_snapshot_reader *zone = (zone_snapshot_reader*)zr->data;
+    ya_result return_value;
+
+    if(zone->records_left == 0)
+    {
+        if(zone->rrsets_left == 0)
+        {
+            if(zone->p == zone->limit)
+            {
+                return 1;   /* done */
+            }
+
+            if(FAIL(return_value = zone_snapshot_reader_name_len(zone->p, zone->limit)))
+            {
+                return return_value;
+            }
+
+            zone->name = zone->p;
+            zone->name_len = return_value;
+            zone->p += return_value;
+
+            if(zone->limit - zone->p < 2)
+            {
+                return ZRE_SNAPSHOT_INVALID;
+            }
+
+            zone->rrsets_left = ntohs(GET_U16_AT(zone->p[0]));
+            zone->p += 2;
+
+            if(zone->rrsets_left == 0)
+            {
+                return ZRE_SNAPSHOT_INVALID;
+            }
+        }
+
+        if(zone->limit - zone->p < 4)
+        {
+            return ZRE_SNAPSHOT_INVALID;
+        }
+
+        zone->type = GET_U16_AT(zone->p[0]); /** @note: NATIVETYPE */
+        zone->records_left = ntohs(GET_U16_AT(zone->p[2]));
+        zone->p += 4;
+        zone->rrsets_left--;
+
+        if(zone->records_left == 0)
+        {
+            return ZRE_SNAPSHOT_INVALID;
+        }
+    }
+
+    if(zone->limit - zone->p < 6)
+    {
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    u32 ttl = ntohl(GET_U32_AT(zone->p[0]));
+    u16 rdata_size = ntohs(GET_U16_AT(zone->p[4]));
+    zone->p += 6;
+
+    if(zone->limit - zone->p < rdata_size)
+    {
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    memcpy(entry->name, zone->name, zone->name_len);
+    entry->type = zone->type;
+    entry->class = zone->class;
+    entry->ttl = ttl;
+
+    if(FAIL(return_value = output_stream_write(&entry->os_rdata, zone->p, rdata_size)))
+    {
+        return return_value;
+    }
+
+    zone->p += rdata_size;
+    zone->records_left--;
+
+    return OK;
+}
+
+static ya_result
+zone_snapshot_reader_free_record(zone_reader *zone, resource_record *entry)
+{
+    return OK;
+}
+
+static void
+zone_snapshot_reader_close(zone_reader *zr)
+{
+    zassert(zr != NULL);
+
+    zone_snapshot_reader *zone = (zone_snapshot_reader*)zr->data;
+
+    munmap(zone->base, zone->size);
+
+    free(zone->chains);
+    free(zone->file_path);
+    free(zone);
+
+    zr->data = NULL;
+    zr->vtbl = NULL;
+}
+
+static void
+zone_snapshot_reader_handle_error(zone_reader *zr, ya_result error_code)
+{
+    /*
+     * If an error occurred loading the snapshot : delete it
+     */
+
+    zassert(zr != NULL);
+
+    if(FAIL(error_code))
+    {
+        zone_snapshot_reader *zone = (zone_snapshot_reader*)zr->data;
+
+        log_warn("zone snapshot: deleting broken snapshot: %s", zone->file_path);
+
+        if(unlink(zone->file_path) < 0)
+        {
+            log_err("zone snapshot: unlink(%s): %r", zone->file_path, ERRNO_ERROR);
+        }
+    }
+}
+
+static bool
+zone_snapshot_reader_nsec3_digest(zone_reader *zr, const u8 *nsec3param_rdata, const u8 *fqdn, u32 fqdn_len, u8 *digest)
+{
+    zone_snapshot_reader *zone = (zone_snapshot_reader*)zr->data;
+    
+    u16 nsec3param_rdata_size = NSEC3_ZONE_RDATA_SIZE_FROM_SALT(nsec3param_rdata[4]);
+
+    for(u16 i = 0; i < zone->chain_count; i++)
+    {
+        zone_snapshot_chain *chain = &zone->chains[i];
+
+        /* same algorithm, iterations and salt (the flags do not matter) */
+
+        if((chain->nsec3param_rdata_size != nsec3param_rdata_size) ||
+           (chain->nsec3param_rdata[0] != nsec3param_rdata[0]) ||
+           (memcmp(&chain->nsec3param_rdata[2], &nsec3param_rdata[2], nsec3param_rdata_size - 2) != 0))
+        {
+            continue;
+        }
+
+        if(chain->digest_len != digest[0])
+        {
+            return FALSE;
+        }
+
+        u32 slot = zdb_zone_snapshot_name_hash(fqdn, fqdn_len) & chain->slot_mask;
+
+        for(u32 probes = 0; probes <= chain->slot_mask; probes++)
+        {
+            u32 entry_offset = ntohl(GET_U32_AT(chain->slots[slot << 2]));
+
+            if(entry_offset-- == 0)
+            {
+                break;
+            }
+
+            if((u64)entry_offset + fqdn_len + chain->digest_len <= chain->entries_size)
+            {
+                const u8 *entry = &chain->entries[entry_offset];
+
+                /* the name ends with the root label so a match cannot be a prefix of another name */
+
+                if(memcmp(entry, fqdn, fqdn_len) == 0)
+                {
+                    memcpy(&digest[1], &entry[fqdn_len], chain->digest_len);
+
+                    return TRUE;
+                }
+            }
+
+            slot = (slot + 1) & chain->slot_mask;
+        }
+
+        return FALSE;
+    }
+
+    return FALSE;
+}
+
+static zone_reader_vtbl zone_snapshot_reader_vtbl =
+{
+    zone_snapshot_reader_read_record,
+    zone_snapshot_reader_free_record,
+    zone_snapshot_reader_close,
+    zone_snapshot_reader_handle_error,
+    zone_snapshot_reader_nsec3_digest,
+    "zone_snapshot_reader"
+};
+
+/*
+ * Reads the NSEC3 digest index
+ */
+
+static ya_result
+zone_snapshot_reader_index_init(zone_snapshot_reader *zone, u64 index_offset)
+{
+    const u8 *p = &zone->base[index_offset];
+    const u8 *limit = &zone->base[zone->size];
+
+    if(limit - p < 2)
+    {
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    zone->chain_count = ntohs(GET_U16_AT(p[0]));
+    p += 2;
+
+    if(zone->chain_count == 0)
+    {
+        return SUCCESS;
+    }
+
+    MALLOC_OR_DIE(zone_snapshot_chain*, zone->chains, zone->chain_count * sizeof(zone_snapshot_chain), ZSCHAINS_TAG);
+
+    for(u16 i = 0; i < zone->chain_count; i++)
+    {
+        zone_snapshot_chain *chain = &zone->chains[i];
+
+        if(limit - p < 2)
+        {
+            return ZRE_SNAPSHOT_INVALID;
+        }
+
+        chain->nsec3param_rdata_size = ntohs(GET_U16_AT(p[0]));
+        p += 2;
+
+        if((chain->nsec3param_rdata_size < NSEC3PARAM_MINIMUM_LENGTH) || (limit - p < chain->nsec3param_rdata_size + 9))
+        {
+            return ZRE_SNAPSHOT_INVALID;
+        }
+
+        chain->nsec3param_rdata = p;
+        p += chain->nsec3param_rdata_size;
+
+        chain->digest_len = *p++;
+        u32 slot_count = ntohl(GET_U32_AT(p[0]));
+        chain->entries_size = ntohl(GET_U32_AT(p[4]));
+        p += 8;
+
+        if((slot_count == 0) || ((slot_count & (slot_count - 1)) != 0) || ((u64)(limit - p) < ((u64)slot_count << 2) + chain->entries_size))
+        {
+            return ZRE_SNAPSHOT_INVALID;
+        }
+
+        chain->slot_mask = slot_count - 1;
+        chain->slots = p;
+        p += (u64)slot_count << 2;
+        chain->entries = p;
+        p += chain->entries_size;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Checks the mapped snapshot against its own header and against the text file of the zone.
+ */
+
+static ya_result
+zone_snapshot_reader_check(zone_snapshot_reader *zone, const char *source_path)
+{
+    const u8 *header = zone->base;
+    struct stat source_stat;
+    ya_result return_value;
+
+    if(zone->size < ZDB_ZONE_SNAPSHOT_HEADER_SIZE + 1)
+    {
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    if((ntohl(GET_U32_AT(header[ZDB_ZONE_SNAPSHOT_MAGIC_OFFSET])) != ZDB_ZONE_SNAPSHOT_MAGIC) ||
+       (ntohs(GET_U16_AT(header[ZDB_ZONE_SNAPSHOT_VERSION_OFFSET])) != ZDB_ZONE_SNAPSHOT_VERSION) ||
+       (zone_snapshot_reader_get_u64(&header[ZDB_ZONE_SNAPSHOT_SIZE_OFFSET]) != zone->size))
+    {
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    /* the snapshot has been made with the current text file */
+
+    if(stat(source_path, &source_stat) < 0)
+    {
+        return ERRNO_ERROR;
+    }
+
+    if((zone_snapshot_reader_get_u64(&header[ZDB_ZONE_SNAPSHOT_SOURCE_SIZE_OFFSET]) != (u64)source_stat.st_size) ||
+       (zone_snapshot_reader_get_u64(&header[ZDB_ZONE_SNAPSHOT_SOURCE_MTIME_OFFSET]) != (u64)source_stat.st_mtime))
+    {
+        return ZRE_SNAPSHOT_OUTDATED;
+    }
+
+    /* sections */
+
+    u64 records_offset = zone_snapshot_reader_get_u64(&header[ZDB_ZONE_SNAPSHOT_RECORDS_OFFSET]);
+    u64 index_offset = zone_snapshot_reader_get_u64(&header[ZDB_ZONE_SNAPSHOT_INDEX_OFFSET]);
+    u64 records_limit = (index_offset != 0)?index_offset:zone->size;
+
+    if(FAIL(return_value = zone_snapshot_reader_name_len(&zone->base[ZDB_ZONE_SNAPSHOT_HEADER_SIZE], &zone->base[zone->size])))
+    {
+        return return_value;
+    }
+
+    if((records_offset != ZDB_ZONE_SNAPSHOT_HEADER_SIZE + (u64)return_value) || (records_limit < records_offset) || (records_limit > zone->size))
+    {
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    /* content */
+
+    u64 checksum = zdb_zone_snapshot_checksum(0, &zone->base[ZDB_ZONE_SNAPSHOT_HEADER_SIZE], zone->size - ZDB_ZONE_SNAPSHOT_HEADER_SIZE);
+
+    if(checksum != zone_snapshot_reader_get_u64(&header[ZDB_ZONE_SNAPSHOT_CHECKSUM_OFFSET]))
+    {
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    zone->p = &zone->base[records_offset];
+    zone->limit = &zone->base[records_limit];
+    zone->class = GET_U16_AT(header[ZDB_ZONE_SNAPSHOT_CLASS_OFFSET]); /** @note: NATIVECLASS */
+
+    if((index_offset != 0) && FAIL(return_value = zone_snapshot_reader_index_init(zone, index_offset)))
+    {
+        return return_value;
+    }
+
+    /* serial : the SOA of the snapshot and the one of the text file */
+
+    u32 serial = ntohl(GET_U32_AT(header[ZDB_ZONE_SNAPSHOT_SERIAL_OFFSET]));
+    u32 soa_serial;
+    u32 file_serial;
+    zone_reader zr;
+    resource_record entry;
+
+    zr.data = zone;
+    zr.vtbl = &zone_snapshot_reader_vtbl;
+
+    resource_record_init(&entry);
+
+    return_value = zone_snapshot_reader_read_record(&zr, &entry);
+
+    if((return_value != OK) || (entry.type != TYPE_SOA) || !dnsname_equals(entry.name, &zone->base[ZDB_ZONE_SNAPSHOT_HEADER_SIZE]) ||
+       FAIL(rr_soa_get_serial(bytearray_output_stream_buffer(&entry.os_rdata), bytearray_output_stream_size(&entry.os_rdata), &soa_serial)) ||
+       (soa_serial != serial))
+    {
+        resource_record_freecontent(&entry);
+
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    resource_record_resetcontent(&entry);
+
+    /* rewind, the SOA is read again by the loader */
+
+    zone->p = &zone->base[records_offset];
+    zone->rrsets_left = 0;
+    zone->records_left = 0;
+
+    if(ISOK(return_value = zone_file_reader_open(source_path, &zr)))
+    {
+        if(ISOK(return_value = zone_reader_read_record(&zr, &entry)))
+        {
+            if(entry.type == TYPE_SOA)
+            {
+                return_value = rr_soa_get_serial(bytearray_output_stream_buffer(&entry.os_rdata), bytearray_output_stream_size(&entry.os_rdata), &file_serial);
+            }
+            else
+            {
+                return_value = ZDB_READER_FIRST_RECORD_NOT_SOA;
+            }
+        }
+
+        zone_reader_close(&zr);
+    }
+
+    resource_record_freecontent(&entry);
+
+    if(FAIL(return_value))
+    {
+        return return_value;
+    }
+
+    if(serial_lt(serial, file_serial))
+    {
+        return ZRE_SNAPSHOT_OUTDATED;
+    }
+
+    return SUCCESS;
+}
+
+ya_result
+zone_snapshot_reader_open(const char* snapshot_path, const char* source_path, zone_reader *dst)
+{
+    zone_snapshot_reader *zone;
+    struct stat snapshot_stat;
+    ya_result return_value;
+    int fd;
+
+    if((fd = open(snapshot_path, O_RDONLY)) < 0)
+    {
+        return ERRNO_ERROR;
+    }
+
+    if(fstat(fd, &snapshot_stat) < 0)
+    {
+        return_value = ERRNO_ERROR;
+
+        close(fd);
+
+        return return_value;
+    }
+
+    if(snapshot_stat.st_size <= ZDB_ZONE_SNAPSHOT_HEADER_SIZE)
+    {
+        close(fd);
+
+        return ZRE_SNAPSHOT_INVALID;
+    }
+
+    void *base = mmap(NULL, snapshot_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if(base == MAP_FAILED)
+    {
+        return ERRNO_ERROR;
+    }
+
+    posix_madvise(base, snapshot_stat.st_size, POSIX_MADV_SEQUENTIAL);
+
+    /*    ------------------------------------------------------------    */
+    
+    MALLOC_OR_DIE(zone_snapshot_reader*, zone, sizeof (zone_snapshot_reader), ZSREADER_TAG);
+    ZEROMEMORY(zone, sizeof (zone_snapshot_reader));
+
+    zone->base = (u8*)base;
+    zone->size = snapshot_stat.st_size;
+    zone->file_path = strdup(snapshot_path);
+
+    dst->data = zone;
+    dst->vtbl = &zone_snapshot_reader_vtbl;
+
+    if(FAIL(return_value = zone_snapshot_reader_check(zone, source_path)))
+    {
+        zone_snapshot_reader_close(dst);
+
+        return return_value;
+    }
+
+    return SUCCESS;
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
@@ -819,6 +819,7 @@ config_update(config_data* config)
     
     config->thread_count = sys_get_cpu_count() + 2;
     config->thread_count += config->max_tcp_queries;
+    config->thread_count += config->tcp_mux_thread_count;
                 
     config->dnssec_thread_count = BOUND(1, config->dnssec_thread_count, sys_get_cpu_count());
    
@@ -905,6 +906,8 @@ config_free()
     free(g_config->log_path);
     free(g_config->pid_path);
     free(g_config->pid_file);
+    free(g_config->queries_log_file);
+    free(g_config->statistics_file);
 
     free(g_config->server_port);
     free(g_config->version_chaos);
@@ -69,6 +69,25 @@ extern "C" {
 #define     THREAD_POOL_SIZE_MAX        255 /* 8 bits ! */
 #define     TCP_QUERIES_MIN             0
 #define     TCP_QUERIES_MAX             512
+#define     TCP_MUX_THREADS_MIN         0
+#define     TCP_MUX_THREADS_MAX         64
+#define     TCP_CONNECTIONS_MIN         1
+#define     TCP_CONNECTIONS_MAX         65536
+#define     TCP_IDLE_TIMEOUT_MIN        1
+#define     TCP_IDLE_TIMEOUT_MAX        3600
+#define     UDP_BATCH_SIZE_MIN          1
+#define     UDP_BATCH_SIZE_MAX          64
+#define     ZONE_LOAD_THREADS_MIN       0
+#define     ZONE_LOAD_THREADS_MAX       64
+#define     ZONE_LOAD_WORKERS_MIN       0
+#define     ZONE_LOAD_WORKERS_MAX       256
+#define     ZONE_LOAD_BUDGET_MIN        1
+#define     ZONE_LOAD_BUDGET_MAX        1048576
+#define     THREAD_AFFINITY_CPU_MAX     1024
+#define     ANSWER_CACHE_SIZE_MIN       0
+#define     ANSWER_CACHE_SIZE_MAX       0x40000000
+#define     NSEC3_PROOF_CACHE_SIZE_MIN  0
+#define     NSEC3_PROOF_CACHE_SIZE_MAX  0x100000
 #define     AXFR_PACKET_SIZE_MIN        512
 #define     AXFR_PACKET_SIZE_MAX        65535
 #define     AXFR_RECORD_BY_PACKET_MIN   0
@@ -77,6 +96,16 @@ extern "C" {
 #define     AXFR_RETRY_DELAY_MAX        86400
 #define     AXFR_RETRY_JITTER_MIN       60
 #define     AXFR_RETRY_JITTER_MAX       "don't use me, use the axfr_retry_delay value instead"
+#define     XFR_MAX_CONCURRENT_MIN      1
+#define     XFR_MAX_CONCURRENT_MAX      256
+#define     XFR_MAX_PER_MASTER_MIN      1
+#define     XFR_MAX_PER_MASTER_MAX      64
+#define     JOURNAL_SYNC_WINDOW_MIN     0
+#define     JOURNAL_SYNC_WINDOW_MAX     10000
+#define     UPDATE_BATCH_WINDOW_MIN     0
+#define     UPDATE_BATCH_WINDOW_MAX     1000
+#define     UPDATE_BATCH_MAX_MIN        1
+#define     UPDATE_BATCH_MAX_MAX        65535
     
 #define     MAX_CONFIG_STRING           50
 #define     PRINTARGLEN                 10
@@ -105,6 +134,8 @@ extern "C" {
 #define     S_SYSLOG                    "0"
 #define     S_STATISTICS                "1"
 #define     S_STATISTICS_MAX_PERIOD     "60" /* 1 -> 31 * 86400 */
+#define     S_STATISTICS_DETAILED       "0"  /* qtype, latency and zone histograms */
+#define     S_STATISTICS_FILE           ""   /* JSON snapshot, in the log directory (empty: none) */
 #define     S_DAEMONRUN                 "0"
 #define     S_ANSWER_FORMERR_PACKETS    "1"
 
@@ -115,7 +146,17 @@ extern "C" {
     /* */
 #define     S_CPU_COUNT_OVERRIDE        "0" /* max 256 */
 #define     S_THREAD_COUNT_BY_ADDRESS   "0" /* -1 for auto */
+#define     S_UDP_BATCH_SIZE            "1" /* max 64, 1 disables the recvmmsg/sendmmsg path */
+#define     S_UDP_REUSEPORT             "0" /* one SO_REUSEPORT socket per worker */
+#define     S_UDP_CPU_STEERING          "0" /* kernel steers the packets to the socket of the current cpu */
+#define     S_THREAD_AFFINITY           ""  /* cpu list for the workers, ie: "0-3,8,9" (empty: no pinning) */
+#define     S_ANSWER_CACHE_SIZE         "0" /* bytes, max 1GB, 0 disables the answer cache */
+#define     S_NSEC3_PROOF_CACHE_SIZE    "4096" /* NSEC3 name error proofs, max 1M, 0 disables the cache */
 #define     S_DNSSEC_THREAD_COUNT       "0" /* max 1024 */
+#define     S_ZONE_LOAD_THREADS         "0" /* zone file parsers, 0 for auto, max 64 */
+#define     S_ZONE_LOAD_WORKERS         "0" /* zones loaded at the same time, 0 for auto, max 256 */
+#define     S_ZONE_LOAD_BUDGET          "1024" /* MB of zone files loading at the same time */
+#define     S_ZONE_SNAPSHOT             "0" /* binary snapshot next to the zone files of the masters */
 
     /* Chroot, uid and gid */
 #define     S_CHROOT                    "0"
@@ -129,18 +170,29 @@ extern "C" {
 #define     S_TOTALINTERFACES           1
 #define     S_MAX_TCP_QUERIES           "5"     /* max 512 */
 #define     S_TCP_QUERY_MIN_RATE        "4096"  /* bytes per second minimum rate */
+#define     S_TCP_MUX_THREADS           "2"     /* 0 : one thread per TCP connection */
+#define     S_MAX_TCP_CONNECTIONS       "4096"  /* max 65536 */
+#define     S_TCP_IDLE_TIMEOUT          "10"    /* seconds */
 
 #define     S_MAX_AXFR                  "10"
 
 #define     S_AXFR_MAX_RECORD_BY_PACKET "0"    /** No limit.  Old applications can only work with this set to 1 */
 #define     S_AXFR_PACKET_SIZE_MAX      "4096" /** plus TSIG */
 #define     S_AXFR_COMPRESS_PACKETS     "1"
+#define     S_AXFR_FILE_CACHE           "0" /* opt-in: AXFR answers are sent from a file in the xfr directory */
 #define     S_AXFR_RETRY_DELAY          "600"
 #define     S_AXFR_RETRY_JITTER         "180"
     
 #define     S_XFR_CONNECT_TIMEOUT       "5"    /* seconds */
+#define     S_XFR_MAX_CONCURRENT        "8"    /* slave transfers running at the same time */
+#define     S_XFR_MAX_PER_MASTER        "4"    /* ... and from the same master */
+#define     S_JOURNAL_SYNC_WINDOW       "5"    /* ms the journal appends wait to be synced together, behind a sync in progress */
+#define     S_UPDATE_BATCH_WINDOW       "5"    /* ms the updates of a zone wait to be applied together */
+#define     S_UPDATE_BATCH_MAX          "256"  /* updates applied together at most */
+#define     S_UPDATE_SERIAL_PER_MESSAGE "0"    /* the serial is increased once per batch */
     
-#define     S_QUERIES_LOG_TYPE          "1"    /* 0: none, 1: YADIFA, 2: bind 3:both */
+#define     S_QUERIES_LOG_TYPE          "1"    /* 0: none, 1: YADIFA, 2: bind 3:both 4:binary */
+#define     S_QUERIES_LOG_FILE          "queries.fstrm" /* binary records, in the log directory */
 
 #define     S_ALLOW_QUERY               "any"
 #define     S_ALLOW_UPDATE              "none"
@@ -172,6 +224,7 @@ extern "C" {
 #define     S_SIG_VALIDITY_REGENERATION "168"           /*  7 days in hours  24->168 */
 #define     S_SIG_VALIDITY_JITTER       "3600"          /*  1 hour in seconds        */
 #define     S_SIG_SIGNING_TYPE          "65534"
+#define     S_SIG_SIGNING_RATE          "0"             /*  0 = whole zone passes    */
     
 #define     S_NOTIFY_RETRY_COUNT           "5"          /* 5 retries */
 #define     S_NOTIFY_RETRY_PERIOD          "1"          /* first after 1 minute */
@@ -218,6 +271,12 @@ extern "C" {
 #define     SERVER_FL_DAEMON            0x02
 #define     SERVER_FL_STATISTICS        0x04
 #define     SERVER_FL_ANSWER_FORMERR    0x08
+#define     SERVER_FL_UDP_REUSEPORT     0x10
+#define     SERVER_FL_UDP_CPU_STEERING  0x20
+#define     SERVER_FL_AXFR_FILE_CACHE   0x40
+#define     SERVER_FL_STATISTICS_DETAILED 0x80
+#define     SERVER_FL_ZONE_SNAPSHOT     0x100
+#define     SERVER_FL_UPDATE_SERIAL_PER_MESSAGE 0x200
 
     /* IP flags */
 #define     IP_FLAGS_IPV4               0x01
@@ -234,6 +293,9 @@ extern "C" {
 #define     SIGNATURE_VALIDITY_JITTER_MIN       0
 #define     SIGNATURE_VALIDITY_JITTER_MAX       86400
 #define     SIGNATURE_VALIDITY_JITTER_S         1
+
+#define     SIGNATURE_SIGNING_RATE_MIN          0       /* signatures per second, 0 = whole zone passes */
+#define     SIGNATURE_SIGNING_RATE_MAX          1000000
     
 #define     NOTIFY_RETRY_COUNT_MIN              0
 #define     NOTIFY_RETRY_COUNT_MAX              10
@@ -252,6 +314,14 @@ extern "C" {
     {
         struct addrinfo *addr;
         int sockfd;
+        
+        /*
+         * With udp-reuseport, one socket per worker is bound to the address.
+         * reuseport_sockfd[0] is sockfd.
+         */
+        
+        int *reuseport_sockfd;
+        u32 reuseport_count;
     };
 
     typedef struct tcp tcp;
@@ -321,9 +391,21 @@ extern "C" {
         int                                                total_interfaces;
         int                                              cpu_count_override;
         int                                         thread_count_by_address;
+        int                                                  udp_batch_size;
+        char                                               *thread_affinity;
+        u16                                           *thread_affinity_cpus;
+        u32                                           thread_affinity_count;
+        int                                               answer_cache_size;
+        int                                          nsec3_proof_cache_size;
         int                                             dnssec_thread_count;
+        int                                          zone_load_thread_count;
+        int                                          zone_load_worker_count;
+        int                                                zone_load_budget;
         int                                                 max_tcp_queries;
         int                                              tcp_query_min_rate;
+        int                                            tcp_mux_thread_count;
+        int                                             max_tcp_connections;
+        int                                                tcp_idle_timeout;
         int                                                        max_axfr;
         int                                       axfr_max_record_by_packet;
         int                                            axfr_max_packet_size;
@@ -331,8 +413,14 @@ extern "C" {
         int                                                axfr_retry_delay;
         int                                               axfr_retry_jitter;
         int                                             xfr_connect_timeout;
+        int                                              xfr_max_concurrent;
+        int                                              xfr_max_per_master;
+        int                                             journal_sync_window;
+        int                                             update_batch_window;
+        int                                                update_batch_max;
         int                                                    thread_count;
         int                                           statistics_max_period;
+        char                                                *statistics_file;
         int                                                  edns0_max_size;
 
         /* Zone file variables */
@@ -378,11 +466,13 @@ extern "C" {
         database_t                                                  *database;
 
         u32                                                  queries_log_type;
+        char                                                *queries_log_file;
         
 #if HAS_DNSSEC_SUPPORT != 0
         u32                                             sig_validity_interval;
         u32                                         sig_validity_regeneration;
         u32                                               sig_validity_jitter;
+        u32                                                  sig_signing_rate;
         u16                                                  sig_signing_type;
 #endif
 
@@ -40,10 +40,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <strings.h>
 
 #include <dnscore/format.h>
 #include <dnscore/sys_get_cpu_count.h>
 
+#include <dnsdb/dnssec_scheduler.h>
+#include <dnsdb/dnssec.h>
+#include <dnsdb/zdb_icmtl.h>
+
 
 #include "confs.h"
 #include "config_error.h"
@@ -87,12 +93,33 @@ CONFS_FLAG16(   chroot                      , S_CHROOT                  , server
 CONFS_PATH(     chroot_path                 , S_CHROOTPATH               )
 CONFS_U32(      cpu_count_override          , S_CPU_COUNT_OVERRIDE       )
 CONFS_U32(      thread_count_by_address     , S_THREAD_COUNT_BY_ADDRESS  )
+/* Number of UDP messages read (recvmmsg) and answered (sendmmsg) at once by a worker */
+CONFS_U32(      udp_batch_size              , S_UDP_BATCH_SIZE           )
+/* Each worker gets its own SO_REUSEPORT socket */
+CONFS_FLAG16(   udp_reuseport               , S_UDP_REUSEPORT           , server_flags,  SERVER_FL_UDP_REUSEPORT       )
+/* The kernel gives a packet to the socket of the cpu that received it */
+CONFS_FLAG16(   udp_cpu_steering            , S_UDP_CPU_STEERING        , server_flags,  SERVER_FL_UDP_CPU_STEERING    )
+/* The cpus the workers are pinned to */
+CONFS_STRING(   thread_affinity             , S_THREAD_AFFINITY          )
+/* Memory given to the cache of fully built answers */
+CONFS_U32(      answer_cache_size           , S_ANSWER_CACHE_SIZE        )
+/* Number of NSEC3 name error proofs kept ready */
+CONFS_U32(      nsec3_proof_cache_size      , S_NSEC3_PROOF_CACHE_SIZE   )
 CONFS_STRING(   config_file                 , S_CONFIGDIR S_CONFIGFILE   )
 CONFS_STRING(   config_file_dynamic         , S_CONFIGDIR S_CONFIGFILEDYNAMIC )
 /* Path to data which will be used for relative data */
 CONFS_PATH(     data_path                   , S_DATAPATH                 )
 CONFS_PATH(     xfr_path                    , S_XFRPATH                  )
 CONFS_U32(      dnssec_thread_count         , S_DNSSEC_THREAD_COUNT      )
+/* Threads converting the text of a zone file to records while it is loaded */
+CONFS_U32(      zone_load_thread_count      , S_ZONE_LOAD_THREADS        )
+CONFS_ALIAS(zone_load_threads, zone_load_thread_count)
+/* Zones loaded at the same time, and the size of the zone files they can sum up to (MB) */
+CONFS_U32(      zone_load_worker_count      , S_ZONE_LOAD_WORKERS        )
+CONFS_ALIAS(zone_load_workers, zone_load_worker_count)
+CONFS_U32(      zone_load_budget            , S_ZONE_LOAD_BUDGET         )
+/* Keep a binary snapshot of the master zones to restart from */
+CONFS_FLAG16(   zone_snapshot               , S_ZONE_SNAPSHOT           , server_flags,  SERVER_FL_ZONE_SNAPSHOT       )
 /* Interactive mode or not                      */
 CONFS_FLAG16(   daemon                      , S_DAEMONRUN               , server_flags,  SERVER_FL_DAEMON              )
 /* size of an EDNS0 packet */
@@ -113,6 +140,12 @@ CONFS_U32(      max_axfr                    , S_MAX_AXFR                 )
 /* Max number of TCP queries  */
 CONFS_U32(      max_tcp_queries             , S_MAX_TCP_QUERIES          )
 CONFS_U32(      tcp_query_min_rate          , S_TCP_QUERY_MIN_RATE       )
+/* Threads multiplexing the TCP connections (0 = one thread per connection) */
+CONFS_U32(      tcp_mux_thread_count        , S_TCP_MUX_THREADS          )
+CONFS_ALIAS(tcp_mux_threads, tcp_mux_thread_count)
+/* Max number of TCP connections handled by the multiplexer */
+CONFS_U32(      max_tcp_connections         , S_MAX_TCP_CONNECTIONS      )
+CONFS_U32(      tcp_idle_timeout            , S_TCP_IDLE_TIMEOUT         )
 /* Ignores messages that would be answered by a FORMERR */ 
 CONFS_FLAG16(   answer_formerr_packets      , S_ANSWER_FORMERR_PACKETS  , server_flags,  SERVER_FL_ANSWER_FORMERR)
 /* PID file folder                             */
@@ -128,10 +161,24 @@ CONFS_FLAG16(   recursion                   , S_RECURSION               , proces
 CONFS_FLAG16(   statistics                  , S_STATISTICS              , server_flags,  SERVER_FL_STATISTICS
 /* Maximum number of seconds between two statistics lines */)
 CONFS_U32(      statistics_max_period       , S_STATISTICS_MAX_PERIOD    )
+/* Switch for the qtype, latency and zone histograms */
+CONFS_FLAG16(   statistics_detailed         , S_STATISTICS_DETAILED     , server_flags,  SERVER_FL_STATISTICS_DETAILED
+/* File of the log directory the statistics snapshot is written into */)
+CONFS_STRING(   statistics_file             , S_STATISTICS_FILE          )
 
 CONFS_U32(      xfr_connect_timeout         , S_XFR_CONNECT_TIMEOUT      )
+CONFS_U32(      xfr_max_concurrent          , S_XFR_MAX_CONCURRENT       )
+CONFS_U32(      xfr_max_per_master          , S_XFR_MAX_PER_MASTER       )
+/* Milliseconds the journal appends of all zones are gathered before being synced to disk */
+CONFS_U32(      journal_sync_window         , S_JOURNAL_SYNC_WINDOW      )
+/* Milliseconds the dynamic updates of a zone are gathered to be applied, signed and journaled together */
+CONFS_U32(      update_batch_window         , S_UPDATE_BATCH_WINDOW      )
+CONFS_U32(      update_batch_max            , S_UPDATE_BATCH_MAX         )
+/* Increase the serial once per dynamic update instead of once per batch */
+CONFS_FLAG16(   update_serial_per_message   , S_UPDATE_SERIAL_PER_MESSAGE, server_flags,  SERVER_FL_UPDATE_SERIAL_PER_MESSAGE)
 
 CONFS_U32(      queries_log_type            , S_QUERIES_LOG_TYPE         )
+CONFS_STRING(   queries_log_file            , S_QUERIES_LOG_FILE         )
 
  /* ip address used as source for transfers     */
 /* CONFS_STRING(   transfer_source             , S_TRANSFER_SOURCE          ) */
@@ -152,12 +199,15 @@ CONFS_U32(      sig_signing_type            , S_SIG_SIGNING_TYPE         )
 CONFS_U32(      sig_validity_interval       , S_SIG_VALIDITY_INTERVAL    ) /* 7 to 365 days = 30 */
 CONFS_U32(      sig_validity_regeneration   , S_SIG_VALIDITY_REGENERATION) /* 24 hours to 168 hours */
 CONFS_U32(      sig_validity_jitter         , S_SIG_VALIDITY_JITTER      ) /* 0 to 86400 = 3600*/
+CONFS_U32(      sig_signing_rate            , S_SIG_SIGNING_RATE         ) /* 0 to 1000000 = 0 */
 CONFS_ALIAS(sig_jitter, sig_validity_jitter)
 #endif
 
 CONFS_U32(      axfr_max_record_by_packet   , S_AXFR_MAX_RECORD_BY_PACKET)
 CONFS_U32(      axfr_max_packet_size        , S_AXFR_PACKET_SIZE_MAX     )
 CONFS_U32(      axfr_compress_packets       , S_AXFR_COMPRESS_PACKETS    )
+/* Store the AXFR answers in the xfr directory and send them from there */
+CONFS_FLAG16(   axfr_file_cache             , S_AXFR_FILE_CACHE         , server_flags,  SERVER_FL_AXFR_FILE_CACHE     )
 CONFS_U32(      axfr_retry_delay            , S_AXFR_RETRY_DELAY         )
 CONFS_U32(      axfr_retry_jitter           , S_AXFR_RETRY_JITTER        )
 
@@ -179,6 +229,101 @@ CONFS_ALIAS(axfr_compresspackets, axfr_compress_packets)
 
 CONFS_END(config_tab)
 
+/**
+ * Parses a cpu list: comma-separated cpu indexes or ranges (ie: "0-3,8,9")
+ * An empty list (or "none") means no pinning.
+ */
+
+static ya_result
+config_main_parse_cpu_list(const char *text, u16 **cpusp, u32 *countp)
+{
+    u16 cpus[THREAD_AFFINITY_CPU_MAX];
+    u32 count = 0;
+    
+    *cpusp = NULL;
+    *countp = 0;
+    
+    if((text == NULL) || (*text == '\0') || (strcasecmp(text, "none") == 0))
+    {
+        return SUCCESS;
+    }
+    
+    const char *p = text;
+    
+    while(*p != '\0')
+    {
+        char *end;
+        
+        while(isspace(*p) || (*p == ','))
+        {
+            p++;
+        }
+        
+        if(*p == '\0')
+        {
+            break;
+        }
+        
+        long from = strtol(p, &end, 10);
+        
+        if(end == p)
+        {
+            return ERROR;
+        }
+        
+        long to = from;
+        p = end;
+        
+        if(*p == '-')
+        {
+            p++;
+            
+            to = strtol(p, &end, 10);
+            
+            if(end == p)
+            {
+                return ERROR;
+            }
+            
+            p = end;
+        }
+        
+        if((from < 0) || (to < from) || (to >= THREAD_AFFINITY_CPU_MAX))
+        {
+            return ERROR;
+        }
+        
+        for(long cpu = from; cpu <= to; cpu++)
+        {
+            if(count == THREAD_AFFINITY_CPU_MAX)
+            {
+                return ERROR;
+            }
+            
+            cpus[count++] = (u16)cpu;
+        }
+        
+        while(isspace(*p))
+        {
+            p++;
+        }
+        
+        if((*p != ',') && (*p != '\0'))
+        {
+            return ERROR;
+        }
+    }
+    
+    if(count > 0)
+    {
+        MALLOC_OR_DIE(u16*, *cpusp, count * sizeof(u16), GENERIC_TAG);
+        memcpy(*cpusp, cpus, count * sizeof(u16));
+        *countp = count;
+    }
+    
+    return SUCCESS;
+}
+
 static ya_result
 config_main_check_dir_exists(config_data *config, const char *dir)
 {
@@ -335,6 +480,11 @@ static ya_result config_main_section_assign(config_data *config)
         return ERROR;
     }
     
+    if(!config_check_bounds_s32(SIGNATURE_SIGNING_RATE_MIN, SIGNATURE_SIGNING_RATE_MAX, config->sig_signing_rate, "sig-signing-rate"))
+    {
+        return ERROR;
+    }
+    
     if(!config_check_bounds_s32(EDNS0_MIN_LENGTH, EDNS0_MAX_LENGTH, config->edns0_max_size, "edns0-max-size"))
     {
         return ERROR;
@@ -355,6 +505,69 @@ static ya_result config_main_section_assign(config_data *config)
         return ERROR;
     }
     
+    if(!config_check_bounds_s32(TCP_MUX_THREADS_MIN, TCP_MUX_THREADS_MAX, config->tcp_mux_thread_count, "tcp-mux-threads"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(TCP_CONNECTIONS_MIN, TCP_CONNECTIONS_MAX, config->max_tcp_connections, "max-tcp-connections"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(TCP_IDLE_TIMEOUT_MIN, TCP_IDLE_TIMEOUT_MAX, config->tcp_idle_timeout, "tcp-idle-timeout"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(UDP_BATCH_SIZE_MIN, UDP_BATCH_SIZE_MAX, config->udp_batch_size, "udp-batch-size"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(ZONE_LOAD_THREADS_MIN, ZONE_LOAD_THREADS_MAX, config->zone_load_thread_count, "zone-load-threads"))
+    {
+        return ERROR;
+    }
+    
+    if(config->zone_load_thread_count == 0)
+    {
+        config->zone_load_thread_count = MAX(sys_get_cpu_count() - 1, 1);  /* the loading thread inserts the records */
+    }
+    
+    if(!config_check_bounds_s32(ZONE_LOAD_WORKERS_MIN, ZONE_LOAD_WORKERS_MAX, config->zone_load_worker_count, "zone-load-workers"))
+    {
+        return ERROR;
+    }
+    
+    if(config->zone_load_worker_count == 0)
+    {
+        config->zone_load_worker_count = sys_get_cpu_count();
+    }
+    
+    if(!config_check_bounds_s32(ZONE_LOAD_BUDGET_MIN, ZONE_LOAD_BUDGET_MAX, config->zone_load_budget, "zone-load-budget"))
+    {
+        return ERROR;
+    }
+    
+    free(config->thread_affinity_cpus);
+    
+    if(FAIL(config_main_parse_cpu_list(config->thread_affinity, &config->thread_affinity_cpus, &config->thread_affinity_count)))
+    {
+        osformatln(termerr, "config: main: thread-affinity: cannot parse cpu list '%s'", config->thread_affinity);
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(ANSWER_CACHE_SIZE_MIN, ANSWER_CACHE_SIZE_MAX, config->answer_cache_size, "answer-cache-size"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(NSEC3_PROOF_CACHE_SIZE_MIN, NSEC3_PROOF_CACHE_SIZE_MAX, config->nsec3_proof_cache_size, "nsec3-proof-cache-size"))
+    {
+        return ERROR;
+    }
+    
     if(!config_check_bounds_s32(AXFR_PACKET_SIZE_MIN, AXFR_PACKET_SIZE_MAX, config->axfr_max_packet_size, "axfr-max-packet-size"))
     {
         return ERROR;
@@ -372,11 +585,48 @@ static ya_result config_main_section_assign(config_data *config)
         
     config->axfr_retry_jitter = BOUND(AXFR_RETRY_JITTER_MIN, config->axfr_retry_jitter,config->axfr_retry_delay);
     
+    if(!config_check_bounds_s32(XFR_MAX_CONCURRENT_MIN, XFR_MAX_CONCURRENT_MAX, config->xfr_max_concurrent, "xfr-max-concurrent"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(XFR_MAX_PER_MASTER_MIN, XFR_MAX_PER_MASTER_MAX, config->xfr_max_per_master, "xfr-max-per-master"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(JOURNAL_SYNC_WINDOW_MIN, JOURNAL_SYNC_WINDOW_MAX, config->journal_sync_window, "journal-sync-window"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(UPDATE_BATCH_WINDOW_MIN, UPDATE_BATCH_WINDOW_MAX, config->update_batch_window, "update-batch-window"))
+    {
+        return ERROR;
+    }
+    
+    if(!config_check_bounds_s32(UPDATE_BATCH_MAX_MIN, UPDATE_BATCH_MAX_MAX, config->update_batch_max, "update-batch-max"))
+    {
+        return ERROR;
+    }
+    
+    zdb_icmtl_set_sync_window(config->journal_sync_window);
+    
+    scheduler_queue_zone_send_axfr_set_file_cache((config->server_flags & SERVER_FL_AXFR_FILE_CACHE) != 0);
+    
+    scheduler_queue_zone_write_set_snapshot((config->server_flags & SERVER_FL_ZONE_SNAPSHOT) != 0);
+    
+#if HAS_DNSSEC_SUPPORT != 0
+    zdb_update_zone_signatures_set_rate(config->sig_signing_rate);
+#endif
+    
     config->dnssec_thread_count = BOUND(1, config->dnssec_thread_count, sys_get_cpu_count());
     
     config->thread_count = sys_get_cpu_count() + 2;
     config->thread_count += config->max_tcp_queries;                   /* else the pool will starve */
+    config->thread_count += config->tcp_mux_thread_count;              /* they never leave the pool */
     config->thread_count += config->dnssec_thread_count + 2;           /* else the pool will starve */
+    config->thread_count += config->xfr_max_concurrent;                /* the slave transfers are pool jobs */
     config->thread_count = BOUND(2, config->thread_count, THREAD_POOL_SIZE_MAX);    /* and if it's too much, then too bad : it'll wait */
     
     if(strcmp(config->config_file, config->config_file_dynamic) == 0)
@@ -48,6 +48,9 @@
 /*------------------------------------------------------------------------------
  *
  * USE INCLUDES */
+#include <pthread.h>
+#include <unistd.h>
+
 #include <dnscore/packet_reader.h>
 
 #include <dnscore/dnsname.h>
@@ -62,14 +65,21 @@
 #include <dnsdb/zdb_icmtl.h>
 #include <dnsdb/dnssec.h>
 #include <dnsdb/dynupdate.h>
+#include <dnsdb/treeset.h>
 #include <dnsdb/zdb_zone_label.h>
 #include <dnsdb/zdb_zone_load.h>
+#include <dnsdb/zdb_epoch.h>
+#include <dnsdb/zdb_answer_cache.h>
+#if HAS_NSEC3_SUPPORT != 0
+#include <dnsdb/nsec3_proof_cache.h>
+#endif
 
 #include <dnszone/dnszone.h>
 #include <dnszone/zone_file_reader.h>
 #include <dnszone/zone_axfr_reader.h>
 
 #include "server.h"
+#include "server_statistics.h"
 #include "database.h"
 #include "scheduler_xfr.h"
 #include "scheduler_database_load_zone.h"
@@ -84,6 +94,7 @@
 #define DBSCHEDP_TAG 0x5044454843534244
 #define DBUPSIGP_TAG 0x5047495350554244
 #define DBREFALP_TAG 0x504c414645524244
+#define DBUPDQUE_TAG 0x4555514450554244
 
 #define MODULE_MSG_HANDLE g_server_logger
 
@@ -142,12 +153,21 @@ database_init()
     
     zdb_init();
     dnszone_init();
+    
+    zdb_answer_cache_init(g_config->answer_cache_size);
+#if HAS_NSEC3_SUPPORT != 0
+    nsec3_proof_cache_init(g_config->nsec3_proof_cache_size);
+#endif
     dnscore_reset_timer();
 }
 
+static void database_update_queues_finalize();
+
 void
 database_finalize()
 {
+    database_update_queues_finalize();
+    
     zdb_finalize();
 }
 
@@ -289,6 +309,34 @@ database_query(database_t *database, message_data *mesg)
     
     zdb_query_ex_answer_create(&ans_auth_add);
 
+    /* the answer references the records: they must not be released until it has been written */
+    
+    zdb_epoch_enter();
+    
+    bool answer_cache = zdb_answer_cache_enabled();
+    zdb_answer_cache_snapshot answer_cache_snapshot;
+    
+    if(answer_cache)
+    {
+        if(zdb_answer_cache_get(mesg, &ans_auth_add.zone))
+        {
+            if(g_statistics_detailed)
+            {
+                server_statistics_zone_query(ans_auth_add.zone);
+            }
+            
+            zdb_epoch_leave();
+            
+            zdb_query_ex_answer_destroy(&ans_auth_add);
+            
+            return; /* TSIG queries are never answered from the cache */
+        }
+        
+        /* read before the query : a change during the query makes the answer unfit for the cache */
+        
+        zdb_answer_cache_snapshot_init(&answer_cache_snapshot, db, mesg);
+    }
+
     query_fp = zdb_query_ex(db, mesg, &ans_auth_add, mesg->pool_buffer);
 
     /**
@@ -299,6 +347,20 @@ database_query(database_t *database, message_data *mesg)
     mesg->send_length = zdb_query_message_update(mesg, &ans_auth_add);
     mesg->referral = ans_auth_add.delegation;
 
+    /* the zone cannot be released before the end of the epoch */
+    
+    if(g_statistics_detailed)
+    {
+        server_statistics_zone_query(ans_auth_add.zone);
+    }
+    
+    if(answer_cache)
+    {
+        zdb_answer_cache_put(mesg, &answer_cache_snapshot);
+    }
+    
+    zdb_epoch_leave();
+
     zdb_query_ex_answer_destroy(&ans_auth_add);
 
 #if HAS_TSIG_SUPPORT
@@ -378,300 +440,461 @@ database_dynupdate_readsection(packet_unpack_reader_data *reader, u16 count)
     return total;
 }
 
-/** @todo  icmtl, checks, fp, soa, ...
- *   - dynupdate_icmtlhook_enable must be called if there are some slave name severs
- *   - check the functions, which is not tested yet
- *   - fingerprint instead of ya_result for return_code
- *   - soa has to be called
- *   - check BUFFER_OVERRUN
+/**
+ * The updates delegated to the main thread are coalesced per zone :
+ * 
+ * The first update arriving for a zone waits update-batch-window milliseconds then schedules the batch task.
+ * Every update arriving for that zone in the meantime (or while the task waits its turn on the scheduler) joins the batch.
+ * 
+ * Each update of a batch is checked on its own (ACL, prerequisites, dry run) then applied, so it sees the changes
+ * of the ones before it.  The NSEC/NSEC3 chains and the signatures are fixed once, in a single journal page, for the
+ * whole batch.  Each client gets its own answer.
  */
-finger_print
-database_update(database_t *database, message_data *mesg)
+
+typedef struct database_update_request database_update_request;
+
+struct database_update_request
 {
-    ya_result return_code;
+    database_update_request *next;
+    message_data *mesg;
+    threaded_ringbuffer *sync;          /* the delegate waiting for the answer, NULL if not delegated */
+    finger_print return_value;
+};
 
-    u16 count;
-    /*    u16    qdcount; */
-    packet_unpack_reader_data reader;
-    dnsname_vector name;
-    zdb_zone *zone;
+typedef struct database_update_queue database_update_queue;
+
+struct database_update_queue
+{
+    u8 *origin;
+    database_t *database;
+    database_update_request *first;
+    database_update_request *last;
+    u16 qclass;
+    bool scheduled;                     /* the batch task has been (or is about to be) scheduled */
+};
+
+static int database_update_queue_compare(const void *node_a, const void *node_b);
+
+static pthread_mutex_t database_update_mtx = PTHREAD_MUTEX_INITIALIZER;
+static treeset_tree database_update_queues = {NULL, database_update_queue_compare};
+
+static int
+database_update_queue_compare(const void *node_a, const void *node_b)
+{
+    const database_update_queue *a = (const database_update_queue*)node_a;
+    const database_update_queue *b = (const database_update_queue*)node_b;
     
-    u8 wire[MAX_DOMAIN_LENGTH + 10 + 65535];
+    if(a->qclass != b->qclass)
+    {
+        return (int)a->qclass - (int)b->qclass;
+    }
+    
+    return dnsname_compare(a->origin, b->origin);
+}
 
-    return_code = FP_NOZONE_FOUND;
+/**
+ * Releases the update queues of the zones.
+ * No update can be pending anymore.
+ */
 
-    zone_data *zone_config = zone_getbydnsname(mesg->qname);
+static void
+database_update_queues_finalize()
+{
+    pthread_mutex_lock(&database_update_mtx);
+    
+    treeset_avl_iterator iter;
+    treeset_avl_iterator_init(&database_update_queues, &iter);
 
-    if(zone_config != NULL)
-    {       
-        switch(zone_config->type)
+    while(treeset_avl_iterator_hasnext(&iter))
+    {
+        treeset_node *node = treeset_avl_iterator_next_node(&iter);
+        database_update_queue *queue = (database_update_queue*)node->data;
+        
+        zassert(queue->first == NULL);
+        
+        free(queue->origin);
+        free(queue);
+    }
+    
+    treeset_avl_destroy(&database_update_queues);
+    
+    pthread_mutex_unlock(&database_update_mtx);
+}
+
+/**
+ * Sets the rcode and signs the answer
+ */
+
+static void
+database_update_answer(message_data *mesg)
+{
+    MESSAGE_LOFLAGS(mesg->buffer) = (MESSAGE_LOFLAGS(mesg->buffer)&~RCODE_BITS) | mesg->status;
+
+#if HAS_TSIG_SUPPORT
+    if(TSIG_ENABLED(mesg))
+    {
+        log_debug("database: update: signing reply");
+        
+        tsig_sign_answer(mesg);
+    }
+#endif
+}
+
+/**
+ * If the zone is DNSSEC and we don't have all the keys or don't know how to use them : SERVFAIL
+ */
+
+static ya_result
+database_update_check_keys(zdb_zone *zone)
+{
+    ya_result return_code = SUCCESS;
+    
+    if(zdb_zone_is_dnssec(zone))
+    {
+        /*
+         * Fetch all private keys
+         */
+
+        log_debug("database: update: checking DNSKEY availability");
+
+        const zdb_packed_ttlrdata *dnskey = zdb_zone_get_dnskey_rrset(zone);
+
+        if(dnskey != NULL)
         {
-            case ZT_MASTER:
+            char origin[MAX_DOMAIN_LENGTH];
+
+            dnsname_to_cstr(origin, zone->origin);
+
+            do
             {
-                /*    ------------------------------------------------------------    */
-                
-                MESSAGE_HIFLAGS(mesg->buffer) |= QR_BITS;
+                u16 flags = DNSKEY_FLAGS(*dnskey);
+                u8  algorithm = DNSKEY_ALGORITHM(*dnskey);
+                u16 tag = DNSKEY_TAG(*dnskey);                  // note: expensive
+                dnssec_key *key = NULL;
 
-                /*
-                 * Unpack the query
-                 */
-                packet_reader_init(mesg->buffer, mesg->received, &reader);
-                reader.offset = DNS_HEADER_LENGTH;
+                if(FAIL(return_code = dnssec_key_load_private(algorithm, tag, flags, origin, &key)))
+                {
+                    log_err("database: update: unable to load private key 'K%{dnsname}+%03d+%05d': %r", zone->origin, algorithm, tag, return_code);
+                    break;
+                }
 
-                /*    qdcount = MESSAGE_QD(mesg->buffer); */
+                dnskey = dnskey->next;
+            }
+            while(dnskey != NULL);
+        }
+        else
+        {
+            log_err("database: update: there are no private keys in the zone %{dnsname}", zone->origin);
 
-                dnsname_to_dnsname_vector(mesg->qname, &name);
+            return_code = DNSSEC_ERROR_RRSIG_NOZONEKEYS;
+        }
+    }
+    
+    return return_code;
+}
 
-                zone = zdb_zone_find((zdb *)database, &name, mesg->qclass);
+/**
+ * Checks and applies one update of a batch.
+ * The journal page is opened by the first update that passed its dry run.
+ * 
+ * The zone must be locked (ZDB_ZONE_MUTEX_DYNUPDATE)
+ */
 
-                if(zone != NULL && !ZDB_ZONE_INVALID(zone))
-                {
-                    /*
-                     * If the zone is marked as:
-                     * _ frozen
-                     * _ updating
-                     * _ signing
-                     * _ dumping
-                     * => don't do it
-                     */
-                    if((zone->apex->flags & ZDB_RR_APEX_LABEL_FROZEN) == 0)
-                    {
+static finger_print
+database_update_apply(zone_data *zone_config, zdb_zone *zone, message_data *mesg, ya_result keys_status, dynupdate_batch *batch, zdb_icmtl *icmtl, bool *journal_opened)
+{
+    ya_result return_code;
+    u16 count;
+    packet_unpack_reader_data reader;
+    
+    u8 wire[MAX_DOMAIN_LENGTH + 10 + 65535];
+    
 #if HAS_ACL_SUPPORT == 1
-                        if(ACL_REJECTED(acl_check_access_filter(mesg, &zone_config->ac.allow_update)))
-                        {
-                            /* notauth */
+    if(ACL_REJECTED(acl_check_access_filter(mesg, &zone_config->ac.allow_update)))
+    {
+        /* notauth */
 
-                            log_info("database: update: not authorised");
+        log_info("database: update: not authorised");
 
-                            return (finger_print)ACL_UPDATE_REJECTED;
-                        }
+        return (finger_print)ACL_UPDATE_REJECTED;
+    }
 #endif
-                        
-                        /*
-                         * If the zone is DNSSEC and we don't have all the keys or don't know how to use them : SERVFAIL
-                         */
-                        
-                        return_code = SUCCESS;
-                        
-                        if(zdb_zone_is_dnssec(zone))
-                        {
-                            /*
-                             * Fetch all private keys
-                             */
-                            
-                            log_debug("database: update: checking DNSKEY availability");
-                            
-                            const zdb_packed_ttlrdata *dnskey = zdb_zone_get_dnskey_rrset(zone);
-                                                        
-                            if(dnskey != NULL)
-                            {
-                                char origin[MAX_DOMAIN_LENGTH];
-                                
-                                dnsname_to_cstr(origin, zone->origin);
-                            
-                                do
-                                {
-                                    u16 flags = DNSKEY_FLAGS(*dnskey);
-                                    u8  protocol = DNSKEY_PROTOCOL(*dnskey);
-                                    u8  algorithm = DNSKEY_ALGORITHM(*dnskey);
-                                    u16 tag = DNSKEY_TAG(*dnskey);                  // note: expensive
-                                    dnssec_key *key = NULL;
-
-                                    if(FAIL(return_code = dnssec_key_load_private(algorithm, tag, flags, origin, &key)))
-                                    {
-                                        log_err("database: update: unable to load private key 'K%{dnsname}+%03d+%05d': %r", zone->origin, algorithm, tag, return_code);
-                                        break;
-                                    }
-
-                                    dnskey = dnskey->next;
-                                }
-                                while(dnskey != NULL);
-                            }
-                            else
-                            {
-                                log_err("database: update: there are no private keys in the zone %{dnsname}", zone->origin);
-                                
-                                return_code = DNSSEC_ERROR_RRSIG_NOZONEKEYS;
-                            }
-                        }
+    
+    if(FAIL(keys_status))
+    {
+        /*
+         * ZONE CANNOT BE UPDATED (missing private keys)                             
+         */
 
-                        if(ISOK(return_code))   // 
-                        {
-                            /* The reader is positioned after the header : read the QR section */
-                            
-                            if(ISOK(return_code = packet_reader_read_zone_record(&reader, wire, sizeof(wire))))
-                            {
-                                /*
-                                * The zone is known with the previous record.
-                                * Since I'm just testing the update per se, I'll ignore this.
-                                */
-
-                                count = ntohs(MESSAGE_PR(mesg->buffer));
-                                
-                                /* The reader is positioned after the QR section, read AN section */
-
-                                zdb_zone_lock(zone, ZDB_ZONE_MUTEX_DYNUPDATE);
-                                
-                                log_debug("database: update: processing %d prerequisites", count);
-
-                                if(ISOK(return_code = dynupdate_check_prerequisites(zone, &reader, count)))
-                                {
-                                    count = ntohs(MESSAGE_UP(mesg->buffer));
-
-                                    u32 reader_up_offset = reader.offset;
-                                    /*
-                                     * Dry run the update for the section
-                                     * (so the DB will not be broken if the query is bogus)
-                                     */
-                                    
-                                    log_debug("database: update: dryrun of %d updates", count);
-                                    
-                                    if(ISOK(return_code = dynupdate_update(zone, &reader, count, DYNUPDATE_UPDATE_DRYRUN)))
-                                    {
-                                        /*
-                                         * Really run the update for the section
-                                         */
-
-                                        reader.offset = reader_up_offset;
-
-                                        /**
-                                         * @todo At this point it should not fail anymore.
-                                         */
-
-                                        log_debug("database: update: opening journal page");
-                                        
-                                        zdb_icmtl icmtl;
-                                        
-                                        if(ISOK(return_code = zdb_icmtl_begin(zone, &icmtl, g_config->xfr_path)))
-                                        {
-                                            log_debug("database: update: run of %d updates", count);
-                                            
-                                            ya_result len = dynupdate_update(zone, &reader, count, DYNUPDATE_UPDATE_RUN);
-
-                                            if(ISOK(len))
-                                            {
-                                                mesg->send_length = mesg->received;
-
-                                                /* @TODO I have to be able to cancel the icmtl if it failed */
-                                            }
-                                            else
-                                            {
-                                                log_err("database: update: update of zone '%{dnsname}' failed even if the dryrun succeeded: %r", zone->origin, len);
-                                            }
-
-                                            zdb_icmtl_end(&icmtl, g_config->xfr_path);
-                                            
-                                            log_debug("database: update: closed journal page");
-
-                                            /**
-                                                * 
-                                                * @todo postponed after 1.0.0
-                                                * 
-                                                * The journal file may exceed limits ...
-                                                * 
-                                                * In that case the server will want to:
-                                                * 
-                                                * _ disable dynamic updates
-                                                * _ update the zone file on disk to the current version
-                                                * _ cut the journal up to the last few serials
-                                                * _ enable dynamic updates
-                                                * 
-                                                * How to define limits:
-                                                * 
-                                                * _ size on disk (easy)
-                                                * _ number of records (hard to keep track in the current journal format so : no)
-                                                * _ relative size on disk (proportional to the size of zone axfr/text) (easy too)
-                                                * _ serial range of the incremental file is too big; too big being at most 2^30 but
-                                                *   practically 2^17 increments of serial is very expensive already.
-                                                * 
-                                                * These limits must be made available to the server so it can take measures to
-                                                * fix them.
-                                                * 
-                                                */
-
-                                            mesg->status = FP_MESG_OK; /* @TODO handle error codes too */
-
-                                            notify_slaves(zone->origin);
-                                        }
-                                        else
-                                        {
-                                            mesg->status = (finger_print)RCODE_SERVFAIL;
-                                            mesg->send_length = mesg->received;
-                                        }
-                                    }
-                                    else
-                                    {
-                                        /*
-                                         * ZONE CANNOT BE UPDATED (internal error or rejected)
-                                         */
-
-                                        mesg->status = (finger_print)RCODE_SERVFAIL;
-                                        mesg->send_length = mesg->received;
-                                    }
-
-                                }
-                                else
-                                {
-                                    /*
-                                     * ZONE CANNOT BE UPDATED (prerequisites not met)
-                                     */
-
-                                    mesg->status = (finger_print)RCODE_SERVFAIL;
-                                    mesg->send_length = mesg->received;
-                                }
-
-                                zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_DYNUPDATE);
-                            }
-                            else
-                            {
-                                mesg->status = (finger_print)RCODE_FORMERR;
-                                mesg->send_length = mesg->received;
-                            }
-                        }
-                        else
-                        {
-                            /*
-                             * ZONE CANNOT BE UPDATED (missing private keys)                             
-                             */
-                            
-                            mesg->status = FP_CANNOT_DYNUPDATE;
-                            mesg->send_length = mesg->received;
-                        }
-                    }
-                    else
-                    {
-                        /*
-                         * ZONE CANNOT BE UPDATED (frozen)
-                         */
+        mesg->status = FP_CANNOT_DYNUPDATE;
+        mesg->send_length = mesg->received;
+        
+        return (finger_print)keys_status;
+    }
+    
+    /*
+     * Unpack the query
+     */
+    packet_reader_init(mesg->buffer, mesg->received, &reader);
+    reader.offset = DNS_HEADER_LENGTH;
+    
+    /* The reader is positioned after the header : read the QR section */
 
-                        mesg->status = FP_CANNOT_DYNUPDATE;
+    if(FAIL(return_code = packet_reader_read_zone_record(&reader, wire, sizeof(wire))))
+    {
+        mesg->status = (finger_print)RCODE_FORMERR;
+        mesg->send_length = mesg->received;
+        
+        return (finger_print)return_code;
+    }
+    
+    /*
+    * The zone is known with the previous record.
+    * Since I'm just testing the update per se, I'll ignore this.
+    */
 
-                        mesg->send_length = mesg->received;
-                    }
-                }
-                else
-                {
-                    /**
-                     * 2136:
-                     *
-                     * if any RR's NAME is not
-                     * within the zone specified in the Zone Section, signal NOTZONE to the
-                     * requestor.
-                     *
-                     */
+    count = ntohs(MESSAGE_PR(mesg->buffer));
 
-                    if(zone == NULL)
-                    {
-                        mesg->status = FP_UPDATE_UNKNOWN_ZONE;
-                    }
-                    else
-                    {
-                        mesg->status = FP_INVALID_ZONE;
-                    }
-                }
-                
-                break;
+    /* The reader is positioned after the QR section, read AN section */
+
+    log_debug("database: update: processing %d prerequisites", count);
+
+    if(FAIL(return_code = dynupdate_check_prerequisites(zone, &reader, count)))
+    {
+        /*
+         * ZONE CANNOT BE UPDATED (prerequisites not met)
+         */
+
+        mesg->status = (finger_print)RCODE_SERVFAIL;
+        mesg->send_length = mesg->received;
+        
+        return (finger_print)return_code;
+    }
+    
+    count = ntohs(MESSAGE_UP(mesg->buffer));
+
+    u32 reader_up_offset = reader.offset;
+    
+    /*
+     * Dry run the update for the section
+     * (so the DB will not be broken if the query is bogus)
+     */
+
+    log_debug("database: update: dryrun of %d updates", count);
+
+    if(FAIL(return_code = dynupdate_update(zone, &reader, count, DYNUPDATE_UPDATE_DRYRUN)))
+    {
+        /*
+         * ZONE CANNOT BE UPDATED (internal error or rejected)
+         */
+
+        mesg->status = (finger_print)RCODE_SERVFAIL;
+        mesg->send_length = mesg->received;
+        
+        return (finger_print)return_code;
+    }
+    
+    /*
+     * Really run the update for the section
+     */
+
+    reader.offset = reader_up_offset;
+    
+    if(!*journal_opened)
+    {
+        log_debug("database: update: opening journal page");
+
+        if(FAIL(return_code = zdb_icmtl_begin(zone, icmtl, g_config->xfr_path)))
+        {
+            mesg->status = (finger_print)RCODE_SERVFAIL;
+            mesg->send_length = mesg->received;
+            
+            return (finger_print)return_code;
+        }
+        
+        *journal_opened = TRUE;
+    }
+
+    /**
+     * @todo At this point it should not fail anymore.
+     */
+
+    log_debug("database: update: run of %d updates", count);
+
+    ya_result len = dynupdate_batch_update(zone, batch, &reader, count);
+
+    if(ISOK(len))
+    {
+        mesg->send_length = mesg->received;
+
+        /* @TODO I have to be able to cancel the icmtl if it failed */
+    }
+    else
+    {
+        log_err("database: update: update of zone '%{dnsname}' failed even if the dryrun succeeded: %r", zone->origin, len);
+    }
+    
+    mesg->status = FP_MESG_OK; /* @TODO handle error codes too */
+    
+    return SUCCESS;
+}
+
+static void
+database_update_master(database_t *database, zone_data *zone_config, database_update_request *requests)
+{
+    database_update_request *request;
+    dnsname_vector name;
+    
+    for(request = requests; request != NULL; request = request->next)
+    {
+        MESSAGE_HIFLAGS(request->mesg->buffer) |= QR_BITS;
+        
+        request->return_value = FP_NOZONE_FOUND;
+    }
+    
+    dnsname_to_dnsname_vector(requests->mesg->qname, &name);
+
+    zdb_zone *zone = zdb_zone_find((zdb *)database, &name, requests->mesg->qclass);
+    
+    if(zone == NULL || ZDB_ZONE_INVALID(zone))
+    {
+        /**
+         * 2136:
+         *
+         * if any RR's NAME is not
+         * within the zone specified in the Zone Section, signal NOTZONE to the
+         * requestor.
+         *
+         */
+        
+        for(request = requests; request != NULL; request = request->next)
+        {
+            request->mesg->status = (zone == NULL)?FP_UPDATE_UNKNOWN_ZONE:FP_INVALID_ZONE;
+            
+            database_update_answer(request->mesg);
+        }
+        
+        return;
+    }
+    
+    /*
+     * If the zone is marked as:
+     * _ frozen
+     * _ updating
+     * _ signing
+     * _ dumping
+     * => don't do it
+     */
+    
+    if((zone->apex->flags & ZDB_RR_APEX_LABEL_FROZEN) != 0)
+    {
+        /*
+         * ZONE CANNOT BE UPDATED (frozen)
+         */
+        
+        for(request = requests; request != NULL; request = request->next)
+        {
+            request->mesg->status = FP_CANNOT_DYNUPDATE;
+            request->mesg->send_length = request->mesg->received;
+            
+            database_update_answer(request->mesg);
+        }
+        
+        return;
+    }
+    
+    ya_result keys_status = database_update_check_keys(zone);
+    
+    dynupdate_batch batch;
+    zdb_icmtl icmtl;
+    bool journal_opened = FALSE;
+    
+    dynupdate_batch_init(&batch);
+    
+    zdb_zone_lock(zone, ZDB_ZONE_MUTEX_DYNUPDATE);
+    
+    for(request = requests; request != NULL; request = request->next)
+    {
+        request->return_value = database_update_apply(zone_config, zone, request->mesg, keys_status, &batch, &icmtl, &journal_opened);
+    }
+    
+    if(journal_opened)
+    {
+        u32 applied = batch.count;
+        ya_result return_code;
+        
+        if(applied > 1)
+        {
+            log_debug("database: update: %{dnsname}: %u updates applied as one batch", zone->origin, applied);
+            
+            if((g_config->server_flags & SERVER_FL_UPDATE_SERIAL_PER_MESSAGE) != 0)
+            {
+                icmtl.serial_increment = applied;
             }
+        }
+        
+        if(FAIL(return_code = dynupdate_batch_commit(zone, &batch)))
+        {
+            log_err("database: update: %{dnsname}: unable to update the DNSSEC chains and signatures: %r", zone->origin, return_code);
+        }
+        
+        zdb_icmtl_end(&icmtl, g_config->xfr_path);
+
+        log_debug("database: update: closed journal page");
+
+        /**
+            * 
+            * @todo postponed after 1.0.0
+            * 
+            * The journal file may exceed limits ...
+            * 
+            * In that case the server will want to:
+            * 
+            * _ disable dynamic updates
+            * _ update the zone file on disk to the current version
+            * _ cut the journal up to the last few serials
+            * _ enable dynamic updates
+            * 
+            * How to define limits:
+            * 
+            * _ size on disk (easy)
+            * _ number of records (hard to keep track in the current journal format so : no)
+            * _ relative size on disk (proportional to the size of zone axfr/text) (easy too)
+            * _ serial range of the incremental file is too big; too big being at most 2^30 but
+            *   practically 2^17 increments of serial is very expensive already.
+            * 
+            * These limits must be made available to the server so it can take measures to
+            * fix them.
+            * 
+            */
+
+        notify_slaves(zone->origin);
+    }
+    
+    zdb_zone_unlock(zone, ZDB_ZONE_MUTEX_DYNUPDATE);
+    
+    for(request = requests; request != NULL; request = request->next)
+    {
+        if(request->return_value != (finger_print)ACL_UPDATE_REJECTED)
+        {
+            database_update_answer(request->mesg);
+        }
+    }
+}
+
+/**
+ * Updates of a zone this server is not the master of.
+ */
+
+static finger_print
+database_update_other(zone_data *zone_config, message_data *mesg)
+{
+    ya_result return_code = FP_NOZONE_FOUND;
+    
+    if(zone_config != NULL)
+    {
+        switch(zone_config->type)
+        {
             /**
              * @todo : dynamic update forwarding ...
              */
@@ -742,37 +965,135 @@ database_update(database_t *database, message_data *mesg)
 
         mesg->status = FP_UPDATE_UNKNOWN_ZONE;
     }
+    
+    database_update_answer(mesg);
+    
+    return (finger_print)return_code;
+}
 
-    MESSAGE_LOFLAGS(mesg->buffer) = (MESSAGE_LOFLAGS(mesg->buffer)&~RCODE_BITS) | mesg->status;
+/**
+ * Processes a list of updates for the same zone.
+ */
 
-#if HAS_TSIG_SUPPORT
-    if(TSIG_ENABLED(mesg))
+static void
+database_update_process(database_t *database, database_update_request *requests)
+{
+    zone_data *zone_config = zone_getbydnsname(requests->mesg->qname);
+
+    if((zone_config != NULL) && (zone_config->type == ZT_MASTER))
     {
-        log_debug("database: update: signing reply");
+        database_update_master(database, zone_config, requests);
+    }
+    else
+    {
+        database_update_request *request;
         
-        tsig_sign_answer(mesg);
+        for(request = requests; request != NULL; request = request->next)
+        {
+            request->return_value = database_update_other(zone_config, request->mesg);
+        }
     }
-#endif
-
-    return (finger_print)return_code;
 }
 
-struct database_delegate_update_args
+/** @todo  icmtl, checks, fp, soa, ...
+ *   - dynupdate_icmtlhook_enable must be called if there are some slave name severs
+ *   - check the functions, which is not tested yet
+ *   - fingerprint instead of ya_result for return_code
+ *   - soa has to be called
+ *   - check BUFFER_OVERRUN
+ */
+finger_print
+database_update(database_t *database, message_data *mesg)
 {
-    database_t *database;
-    message_data *mesg;
-    threaded_ringbuffer *sync;
-    finger_print return_value;
-};
-
-typedef struct database_schedule_update_param database_schedule_update_param;
+    database_update_request request;
+    
+    request.next = NULL;
+    request.mesg = mesg;
+    request.sync = NULL;
+    request.return_value = FP_NOZONE_FOUND;
+    
+    database_update_process(database, &request);
+    
+    return request.return_value;
+}
 
 static ya_result
-database_delegate_update_task(void* parms_)
+database_update_batch_task(void* parms_)
 {
-    struct database_delegate_update_args *parms = (struct database_delegate_update_args*)parms_;
-    parms->return_value = database_update(parms->database, parms->mesg);
-    threaded_ringbuffer_enqueue(parms->sync, NULL);
+    database_update_queue *queue = (database_update_queue*)parms_;
+    database_update_request *requests;
+    database_update_request *request;
+    u32 count;
+    bool more;
+    bool idle;
+    
+    /* take the updates waiting, at most update-batch-max of them */
+    
+    pthread_mutex_lock(&database_update_mtx);
+    
+    requests = queue->first;
+    request = requests;
+    
+    for(count = 1; (count < (u32)g_config->update_batch_max) && (request->next != NULL); count++)
+    {
+        request = request->next;
+    }
+    
+    queue->first = request->next;
+    request->next = NULL;
+    
+    if(queue->first == NULL)
+    {
+        queue->last = NULL;
+        queue->scheduled = FALSE;
+        more = FALSE;
+    }
+    else
+    {
+        more = TRUE;
+    }
+    
+    pthread_mutex_unlock(&database_update_mtx);
+    
+    database_update_process(queue->database, requests);
+    
+    /* wake up the delegates (the request lives on the stack of its delegate) */
+    
+    while(requests != NULL)
+    {
+        request = requests;
+        requests = requests->next;
+        
+        threaded_ringbuffer_enqueue(request->sync, NULL);
+    }
+    
+    if(more)
+    {
+        scheduler_schedule_task(database_update_batch_task, queue);
+    }
+    else
+    {
+        /* drained : unless an update joined meanwhile, the queue goes away */
+
+        pthread_mutex_lock(&database_update_mtx);
+
+        idle = !queue->scheduled;
+
+        if(idle)
+        {
+            zassert(queue->first == NULL);
+
+            treeset_avl_delete(&database_update_queues, queue);
+        }
+
+        pthread_mutex_unlock(&database_update_mtx);
+
+        if(idle)
+        {
+            free(queue->origin);
+            free(queue);
+        }
+    }
    
     return SCHEDULER_TASK_FINISHED; /* Mark the end of the writer job */
 }
@@ -783,24 +1104,105 @@ database_delegate_update(database_t *database, message_data *mesg)
     /**
      * @todo check that the server can be updated right now, else send servfail
      * 
-     * The task "database_schedule_update_task" will be started on the main thread
+     * The task "database_update_batch_task" will be started on the main thread
      * with exclusive access.
      * The queue is used to know when the result is available.
      */
     
-    struct database_delegate_update_args parms;
+    database_update_request request;
+    database_update_queue key;
+    database_update_queue *queue;
     threaded_ringbuffer sync;
-    parms.database = database;
-    parms.mesg = mesg;
-    parms.sync = &sync;
+    bool leader;
+    
+    /*
+     * Only the authorised updates of a zone this server is the master of get
+     * a queue : the others are answered right away.
+     */
+    
+    zone_data *zone_config = zone_getbydnsname(mesg->qname);
+    
+    if((zone_config == NULL) || (zone_config->type != ZT_MASTER))
+    {
+        return database_update_other(zone_config, mesg);
+    }
+    
+#if HAS_ACL_SUPPORT == 1
+    if(ACL_REJECTED(acl_check_access_filter(mesg, &zone_config->ac.allow_update)))
+    {
+        /* notauth */
+        
+        MESSAGE_HIFLAGS(mesg->buffer) |= QR_BITS;
+
+        log_info("database: update: not authorised");
+
+        return (finger_print)ACL_UPDATE_REJECTED;
+    }
+#endif
+    
+    request.next = NULL;
+    request.mesg = mesg;
+    request.sync = &sync;
+    request.return_value = FP_NOZONE_FOUND;
     
     threaded_ringbuffer_init(&sync, 1);
-    scheduler_schedule_task(database_delegate_update_task, &parms);
+    
+    key.origin = mesg->qname;
+    key.qclass = mesg->qclass;
+    
+    pthread_mutex_lock(&database_update_mtx);
+    
+    treeset_node *node = treeset_avl_insert(&database_update_queues, &key);
+    
+    if(node->data == NULL)
+    {
+        MALLOC_OR_DIE(database_update_queue*, queue, sizeof(database_update_queue), DBUPDQUE_TAG);
+        queue->origin = dnsname_dup(mesg->qname);
+        queue->database = database;
+        queue->first = NULL;
+        queue->last = NULL;
+        queue->qclass = mesg->qclass;
+        queue->scheduled = FALSE;
+        
+        node->key = queue;
+        node->data = queue;
+    }
+    
+    queue = (database_update_queue*)node->data;
+    
+    if(queue->last != NULL)
+    {
+        queue->last->next = &request;
+    }
+    else
+    {
+        queue->first = &request;
+    }
+    
+    queue->last = &request;
+    
+    leader = !queue->scheduled;
+    queue->scheduled = TRUE;
+    
+    pthread_mutex_unlock(&database_update_mtx);
+    
+    if(leader)
+    {
+        /* give the other updates of the zone a chance to join the batch */
+        
+        if(g_config->update_batch_window > 0)
+        {
+            usleep(g_config->update_batch_window * 1000);
+        }
+        
+        scheduler_schedule_task(database_update_batch_task, queue);
+    }
+    
     threaded_ringbuffer_dequeue(&sync);
     log_debug("database: update delegated");
     threaded_ringbuffer_finalize(&sync);
     
-    return parms.return_value;
+    return request.return_value;
 }
 
 /** @brief Close the database
@@ -868,11 +1270,21 @@ database_update_signatures_alarm(void *parmp)
         return DATABASE_ZONE_NOT_FOUND;
     }
 
-    if((return_code = zdb_update_zone_signatures(dbz, TRUE)) == ZDB_ERROR_ZONE_IS_ALREADY_BEING_SIGNED)
+    if(zdb_update_zone_signatures_get_rate() > 0)
+    {
+        /*
+         * Time-sliced maintenance: signs what is due within the budget then
+         * re-arms the zone alarm on its own at the next expiration.
+         */
+        
+        return_code = zdb_update_zone_signatures_alarm(dbz);
+    }
+    else if((return_code = zdb_update_zone_signatures(dbz, TRUE)) == ZDB_ERROR_ZONE_IS_ALREADY_BEING_SIGNED)
     {
         return_code = ALARM_REARM;
     }
-    else
+    
+    if(return_code != ALARM_REARM)
     {
         free(parm->domain);
         free(parm);
@@ -918,15 +1330,21 @@ database_signature_maintenance(database_t *database)
 
                 if((zone != NULL) && ZDB_ZONE_VALID(zone))
                 {
+                    /*
+                     * With a signing rate, the slices start ahead of the first expiration by the regeneration period
+                     */
+                    
+                    u32 sig_invalid_first = (zdb_update_zone_signatures_get_rate() > 0)?zdb_update_zone_signatures_next_epoch(zone):zone->sig_invalid_first;
+                    
                     /**
                      * If the zone's scheduled invalidation time is after the zone's database (and thus real) invalidation time
                      * 
                      * zdb_zone_is_dnssec(zone) for zdb_zone* ...
                      */
 
-                    if((zone_desc->scheduled_sig_invalid_first >= zone->sig_invalid_first) && (zone->sig_invalid_first != MAX_U32))
+                    if((zone_desc->scheduled_sig_invalid_first >= sig_invalid_first) && (sig_invalid_first != MAX_U32))
                     {
-                        log_info("database: scheduling signature update for '%s' at %d (%d)", zone_desc->domain, zone->sig_invalid_first, zone_desc->scheduled_sig_invalid_first);
+                        log_info("database: scheduling signature update for '%s' at %d (%d)", zone_desc->domain, sig_invalid_first, zone_desc->scheduled_sig_invalid_first);
 
                         database_update_signatures_parm *parm;
                         MALLOC_OR_DIE(database_update_signatures_parm*, parm, sizeof(database_update_signatures_parm), DBUPSIGP_TAG);
@@ -940,7 +1358,7 @@ database_signature_maintenance(database_t *database)
                          */
 
                         alarm_event_node *event = alarm_event_alloc();
-                        event->epoch = zone->sig_invalid_first;
+                        event->epoch = sig_invalid_first;
                         event->function = database_update_signatures_alarm;
                         event->args = parm;
                         event->key = ALARM_KEY_ZONE_SIGNATURE_UPDATE;
@@ -949,7 +1367,7 @@ database_signature_maintenance(database_t *database)
 
                         alarm_set(zone->alarm_handle, event);
 
-                        zone_desc->scheduled_sig_invalid_first = zone->sig_invalid_first;
+                        zone_desc->scheduled_sig_invalid_first = sig_invalid_first;
                     }
                 }
                 else
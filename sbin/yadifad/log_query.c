@@ -56,6 +56,7 @@
 
 logger_handle* g_queries_logger = NULL;
 log_query_function* log_query = log_query_yadifa;
+log_query_function* log_answer = log_query_none;
 
 static u8
 log_query_add_du16(char *dest, u16 v)
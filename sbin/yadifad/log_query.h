@@ -66,7 +66,13 @@ extern logger_handle* g_queries_logger;
 typedef void log_query_function(int, message_data*);
 #endif
 
+/**
+ * log_query is called before a query is answered, log_answer after the answer has been built.
+ * The text formats only use the former, the binary format (log_query_binary.h) only uses the latter.
+ */
+
 extern log_query_function* log_query;
+extern log_query_function* log_answer;
 
 void log_query_bind(int socket_fd, message_data *mesg);
 
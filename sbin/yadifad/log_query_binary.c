@@ -0,0 +1,598 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup logging Server logging
+ *  @ingroup yadifad
+ *  @brief Binary query log
+ *
+ *  Each thread answering queries gets its own single-producer single-consumer ring the first time it logs.
+ *  The producer only writes the record and publishes the new head.  The writer is the only consumer.
+ *  When the ring is full, the record is dropped and counted: the answering threads never wait for the disk.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <dnscore/logger.h>
+#include <dnscore/format.h>
+#include <dnscore/timems.h>
+#include <dnscore/file_output_stream.h>
+#include <dnscore/buffer_output_stream.h>
+#include <dnscore/file_input_stream.h>
+#include <dnscore/buffer_input_stream.h>
+
+#include "log_query_binary.h"
+
+extern logger_handle *g_server_logger;
+#define MODULE_MSG_HANDLE g_server_logger
+
+#define LQBRING_TAG 0x5f474e495242514c
+
+/* records by ring, must be a power of two */
+
+#define LOG_QUERY_BINARY_RING_SIZE      2048
+#define LOG_QUERY_BINARY_RING_MASK      (LOG_QUERY_BINARY_RING_SIZE - 1)
+
+#define LOG_QUERY_BINARY_CACHE_LINE     64
+
+/* the writer sleeps that long (us) when the rings are empty */
+
+#define LOG_QUERY_BINARY_DRAIN_PERIOD   10000
+
+/* minimum time (s) between two warnings about dropped records */
+
+#define LOG_QUERY_BINARY_DROP_PERIOD    60
+
+#define LOG_QUERY_BINARY_FILE_BUFFER    65536
+
+#define FSTRM_CONTROL_START             2
+#define FSTRM_CONTROL_STOP              3
+#define FSTRM_CONTROL_FIELD_CONTENT_TYPE 1
+
+typedef struct log_query_binary_record log_query_binary_record;
+
+struct log_query_binary_record
+{
+    u64 time;
+    u8 address[16];
+    u16 port;           /* network order */
+    u16 id;             /* network order */
+    u16 qtype;          /* network order */
+    u16 qclass;         /* network order */
+    u16 answer_size;
+    u8 hiflags;
+    u8 loflags;
+    u8 family;
+    u8 protocol;
+    u8 flags;
+    u8 status;
+    u8 qname_size;
+    u8 qname[MAX_DOMAIN_LENGTH];
+};
+
+typedef struct log_query_binary_ring log_query_binary_ring;
+
+struct log_query_binary_ring
+{
+    log_query_binary_ring *next;
+    u32 dropped_reported;
+    volatile bool orphaned;
+    
+    /* written by the producer */
+    volatile u32 head;
+    volatile u32 dropped;
+    u8 padding0[LOG_QUERY_BINARY_CACHE_LINE - 2 * sizeof(u32)];
+    
+    /* written by the consumer */
+    volatile u32 tail;
+    u8 padding1[LOG_QUERY_BINARY_CACHE_LINE - sizeof(u32)];
+    
+    log_query_binary_record records[LOG_QUERY_BINARY_RING_SIZE];
+};
+
+static pthread_mutex_t log_query_binary_mtx = PTHREAD_MUTEX_INITIALIZER;
+static log_query_binary_ring *log_query_binary_rings = NULL;
+static pthread_key_t log_query_binary_key;
+static bool log_query_binary_key_created = FALSE;
+
+static pthread_t log_query_binary_writer_id;
+static output_stream log_query_binary_os;
+static volatile bool log_query_binary_running = FALSE;
+static volatile bool log_query_binary_stopping = FALSE;
+
+/*******************************************************************************************************************
+ *
+ * Producers
+ *
+ ******************************************************************************************************************/
+
+/**
+ * Called when the thread owning the ring ends: the writer will free the ring once it is empty.
+ */
+
+static void
+log_query_binary_ring_orphan(void *ring_)
+{
+    log_query_binary_ring *ring = (log_query_binary_ring*)ring_;
+    
+    __sync_synchronize();
+    
+    ring->orphaned = TRUE;
+}
+
+static log_query_binary_ring*
+log_query_binary_ring_get()
+{
+    log_query_binary_ring *ring = (log_query_binary_ring*)pthread_getspecific(log_query_binary_key);
+    
+    if(ring == NULL)
+    {
+        MALLOC_OR_DIE(log_query_binary_ring*, ring, sizeof(log_query_binary_ring), LQBRING_TAG);
+        ZEROMEMORY(ring, offsetof(log_query_binary_ring, records));
+        
+        pthread_setspecific(log_query_binary_key, ring);
+        
+        pthread_mutex_lock(&log_query_binary_mtx);
+        ring->next = log_query_binary_rings;
+        log_query_binary_rings = ring;
+        pthread_mutex_unlock(&log_query_binary_mtx);
+    }
+    
+    return ring;
+}
+
+void
+log_query_binary(int socket_fd, message_data *mesg)
+{
+    if(!log_query_binary_running)
+    {
+        return;
+    }
+    
+    log_query_binary_ring *ring = log_query_binary_ring_get();
+    
+    u32 head = ring->head;
+    
+    if(head - ring->tail >= LOG_QUERY_BINARY_RING_SIZE)
+    {
+        ring->dropped++;
+        
+        return;
+    }
+    
+    log_query_binary_record *record = &ring->records[head & LOG_QUERY_BINARY_RING_MASK];
+    
+    record->time = timeus();
+    
+    switch(mesg->other.sa.sa_family)
+    {
+        case AF_INET:
+        {
+            record->family = 4;
+            record->port = mesg->other.sa4.sin_port;
+            memcpy(record->address, &mesg->other.sa4.sin_addr, 4);
+            break;
+        }
+        case AF_INET6:
+        {
+            record->family = 6;
+            record->port = mesg->other.sa6.sin6_port;
+            memcpy(record->address, &mesg->other.sa6.sin6_addr, 16);
+            break;
+        }
+        default:
+        {
+            record->family = 0;
+            record->port = 0;
+            break;
+        }
+    }
+    
+    record->id = MESSAGE_ID(mesg->buffer);
+    record->hiflags = MESSAGE_HIFLAGS(mesg->buffer);
+    record->loflags = MESSAGE_LOFLAGS(mesg->buffer);
+    record->qtype = mesg->qtype;
+    record->qclass = mesg->qclass;
+    record->answer_size = (MESSAGE_QR(mesg->buffer) != 0)?mesg->send_length:0;
+    record->protocol = mesg->protocol;
+    record->flags = ((mesg->tsig.tsig != NULL)?LOG_QUERY_BINARY_TSIG:0) |
+                    ((mesg->edns)?LOG_QUERY_BINARY_EDNS:0) |
+                    (((mesg->rcode_ext & RCODE_EXT_DNSSEC) != 0)?LOG_QUERY_BINARY_DNSSEC:0);
+    record->status = mesg->status;
+    record->qname_size = dnsname_copy(record->qname, mesg->qname);
+    
+    /* the record must be complete before the writer can see it */
+    
+    __sync_synchronize();
+    
+    ring->head = head + 1;
+}
+
+/*******************************************************************************************************************
+ *
+ * Writer
+ *
+ ******************************************************************************************************************/
+
+static void
+log_query_binary_write_control(output_stream *os, u32 type)
+{
+    output_stream_write_nu32(os, 0);
+    
+    if(type == FSTRM_CONTROL_START)
+    {
+        output_stream_write_nu32(os, 4 + 4 + 4 + sizeof(LOG_QUERY_BINARY_CONTENT_TYPE) - 1);
+        output_stream_write_nu32(os, type);
+        output_stream_write_nu32(os, FSTRM_CONTROL_FIELD_CONTENT_TYPE);
+        output_stream_write_nu32(os, sizeof(LOG_QUERY_BINARY_CONTENT_TYPE) - 1);
+        output_stream_write(os, (const u8*)LOG_QUERY_BINARY_CONTENT_TYPE, sizeof(LOG_QUERY_BINARY_CONTENT_TYPE) - 1);
+    }
+    else
+    {
+        output_stream_write_nu32(os, 4);
+        output_stream_write_nu32(os, type);
+    }
+}
+
+static void
+log_query_binary_write_record(output_stream *os, const log_query_binary_record *record)
+{
+    u8 header[LOG_QUERY_BINARY_HEADER_SIZE];
+    
+    SET_U32_AT(header[0], htonl(record->time >> 32));
+    SET_U32_AT(header[4], htonl(record->time));
+    header[8] = LOG_QUERY_BINARY_VERSION;
+    header[9] = record->family;
+    header[10] = record->protocol;
+    header[11] = record->flags;
+    SET_U16_AT(header[12], record->port);
+    SET_U16_AT(header[14], record->id);
+    header[16] = record->hiflags;
+    header[17] = record->loflags;
+    SET_U16_AT(header[18], record->qtype);
+    SET_U16_AT(header[20], record->qclass);
+    SET_U16_AT(header[22], htons(record->answer_size));
+    header[24] = record->status;
+    header[25] = record->qname_size;
+    memcpy(&header[26], record->address, 16);
+    
+    output_stream_write_nu32(os, LOG_QUERY_BINARY_HEADER_SIZE + record->qname_size);
+    output_stream_write(os, header, LOG_QUERY_BINARY_HEADER_SIZE);
+    output_stream_write(os, record->qname, record->qname_size);
+}
+
+/**
+ * Writes all the records available in the rings and frees the rings of the threads that ended.
+ *
+ * @return the number of records written
+ */
+
+static u32
+log_query_binary_drain(u32 *droppedp)
+{
+    u32 count = 0;
+    u32 dropped = 0;
+    
+    pthread_mutex_lock(&log_query_binary_mtx);
+    
+    log_query_binary_ring **ringp = &log_query_binary_rings;
+    log_query_binary_ring *ring;
+    
+    while((ring = *ringp) != NULL)
+    {
+        bool orphaned = ring->orphaned;
+        
+        __sync_synchronize();
+        
+        u32 tail = ring->tail;
+        u32 head = ring->head;
+        
+        __sync_synchronize();
+        
+        while(tail != head)
+        {
+            log_query_binary_write_record(&log_query_binary_os, &ring->records[tail & LOG_QUERY_BINARY_RING_MASK]);
+            tail++;
+            count++;
+        }
+        
+        /* the records have been copied before the producer can reuse their slots */
+        
+        __sync_synchronize();
+        
+        ring->tail = tail;
+        
+        u32 ring_dropped = ring->dropped;
+        dropped += ring_dropped - ring->dropped_reported;
+        ring->dropped_reported = ring_dropped;
+        
+        if(orphaned)
+        {
+            *ringp = ring->next;
+            free(ring);
+        }
+        else
+        {
+            ringp = &ring->next;
+        }
+    }
+    
+    pthread_mutex_unlock(&log_query_binary_mtx);
+    
+    *droppedp += dropped;
+    
+    return count;
+}
+
+static void*
+log_query_binary_writer(void *args)
+{
+    u32 dropped = 0;
+    time_t dropped_time = 0;
+    
+    while(!log_query_binary_stopping)
+    {
+        if(log_query_binary_drain(&dropped) > 0)
+        {
+            output_stream_flush(&log_query_binary_os);
+        }
+        else
+        {
+            usleep(LOG_QUERY_BINARY_DRAIN_PERIOD);
+        }
+        
+        if(dropped > 0)
+        {
+            time_t now = time(NULL);
+            
+            if(now - dropped_time >= LOG_QUERY_BINARY_DROP_PERIOD)
+            {
+                log_warn("queries-log: %u records dropped, the writer cannot keep up", dropped);
+                
+                dropped = 0;
+                dropped_time = now;
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+ya_result
+log_query_binary_start(const char *path)
+{
+    output_stream fos;
+    ya_result return_code;
+    
+    if(log_query_binary_running)
+    {
+        return SUCCESS;
+    }
+    
+    if(!log_query_binary_key_created)
+    {
+        if(pthread_key_create(&log_query_binary_key, log_query_binary_ring_orphan) != 0)
+        {
+            return ERRNO_ERROR;
+        }
+        
+        log_query_binary_key_created = TRUE;
+    }
+    
+    if(FAIL(return_code = file_output_stream_open_ex(path, O_WRONLY|O_CREAT|O_APPEND, 0640, &fos)))
+    {
+        return return_code;
+    }
+    
+    buffer_output_stream_init(&fos, &log_query_binary_os, LOG_QUERY_BINARY_FILE_BUFFER);
+    
+    log_query_binary_write_control(&log_query_binary_os, FSTRM_CONTROL_START);
+    output_stream_flush(&log_query_binary_os);
+    
+    log_query_binary_stopping = FALSE;
+    
+    if((return_code = pthread_create(&log_query_binary_writer_id, NULL, log_query_binary_writer, NULL)) != 0)
+    {
+        output_stream_close(&log_query_binary_os);
+        
+        return MAKE_ERRNO_ERROR(return_code);
+    }
+    
+    log_query_binary_running = TRUE;
+    
+    log_info("queries-log: binary records are written to '%s'", path);
+    
+    return SUCCESS;
+}
+
+void
+log_query_binary_stop()
+{
+    u32 dropped = 0;
+    
+    if(!log_query_binary_running)
+    {
+        return;
+    }
+    
+    log_query_binary_running = FALSE;
+    log_query_binary_stopping = TRUE;
+    
+    pthread_join(log_query_binary_writer_id, NULL);
+    
+    log_query_binary_drain(&dropped);
+    
+    log_query_binary_write_control(&log_query_binary_os, FSTRM_CONTROL_STOP);
+    output_stream_close(&log_query_binary_os);
+    
+    /* the rings of the threads still alive are kept: they still point to them */
+}
+
+/*******************************************************************************************************************
+ *
+ * Offline rendering
+ *
+ ******************************************************************************************************************/
+
+static void
+log_query_binary_print_record(output_stream *os, const u8 *record, u32 size)
+{
+    socketaddress sa;
+    struct tm t;
+    u64 time_us;
+    time_t time_s;
+    u16 id;
+    u16 qtype;
+    u16 qclass;
+    u16 answer_size;
+    u8 hiflags = record[16];
+    u8 loflags = record[17];
+    u8 flags = record[11];
+    u8 qname[MAX_DOMAIN_LENGTH];
+    
+    /* the qname is stored with its terminating root label */
+    
+    if((size < LOG_QUERY_BINARY_HEADER_SIZE) || (size != LOG_QUERY_BINARY_HEADER_SIZE + record[25]) || (record[8] != LOG_QUERY_BINARY_VERSION) ||
+       (record[25] == 0) || (record[LOG_QUERY_BINARY_HEADER_SIZE + record[25] - 1] != 0))
+    {
+        osformatln(os, "; unexpected record of %u bytes", size);
+        return;
+    }
+    
+    time_us = ntohl(GET_U32_AT(record[0]));
+    time_us <<= 32;
+    time_us |= ntohl(GET_U32_AT(record[4]));
+    time_s = time_us / 1000000;
+    gmtime_r(&time_s, &t);
+    
+    id = ntohs(GET_U16_AT(record[14]));
+    qtype = GET_U16_AT(record[18]);     /* the format handlers expect network order */
+    qclass = GET_U16_AT(record[20]);
+    answer_size = ntohs(GET_U16_AT(record[22]));
+    
+    memcpy(qname, &record[LOG_QUERY_BINARY_HEADER_SIZE], record[25]);
+    
+    ZEROMEMORY(&sa, sizeof(sa));
+    
+    if(record[9] == 6)
+    {
+        sa.sa6.sin6_family = AF_INET6;
+        memcpy(&sa.sa6.sin6_addr, &record[26], 16);
+    }
+    else
+    {
+        sa.sa4.sin_family = AF_INET;
+        memcpy(&sa.sa4.sin_addr, &record[26], 4);
+    }
+    
+    osformatln(os, "%04u-%02u-%02u %02u:%02u:%02u.%06u query [%04hx] {%c%c%c%c%c%c%c} %{dnsname} %{dnsclass} %{dnstype} (%{sockaddrip}#%hu) status %u rcode %u size %hu",
+            t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (u32)(time_us % 1000000),
+            id,
+            ((hiflags & RD_BITS) != 0)?'+':'-',
+            ((flags & LOG_QUERY_BINARY_TSIG) != 0)?'S':'-',
+            ((flags & LOG_QUERY_BINARY_EDNS) != 0)?'E':'-',
+            (record[10] == IPPROTO_TCP)?'T':'-',
+            ((flags & LOG_QUERY_BINARY_DNSSEC) != 0)?'D':'-',
+            ((loflags & CD_BITS) != 0)?'C':'-',
+            ((loflags & AD_BITS) != 0)?'A':'-',
+            qname, &qclass, &qtype,
+            &sa.sa, ntohs(GET_U16_AT(record[12])),
+            record[24], loflags & RCODE_BITS, answer_size);
+}
+
+ya_result
+log_query_binary_print(const char *path, output_stream *os)
+{
+    input_stream fis;
+    input_stream is;
+    ya_result return_code;
+    u32 size;
+    u8 frame[LOG_QUERY_BINARY_HEADER_SIZE + MAX_DOMAIN_LENGTH];
+    
+    if(FAIL(return_code = file_input_stream_open(path, &fis)))
+    {
+        return return_code;
+    }
+    
+    buffer_input_stream_init(&fis, &is, LOG_QUERY_BINARY_FILE_BUFFER);
+    
+    while((return_code = input_stream_read_nu32(&is, &size)) == 4)
+    {
+        if(size == 0)
+        {
+            /* control frame: START or STOP, skipped */
+            
+            if(FAIL(return_code = input_stream_read_nu32(&is, &size)))
+            {
+                break;
+            }
+            
+            if(FAIL(return_code = input_stream_skip_fully(&is, size)))
+            {
+                break;
+            }
+            
+            continue;
+        }
+        
+        if(size > sizeof(frame))
+        {
+            osformatln(os, "; unexpected frame of %u bytes", size);
+            
+            if(FAIL(return_code = input_stream_skip_fully(&is, size)))
+            {
+                break;
+            }
+            
+            continue;
+        }
+        
+        if(FAIL(return_code = input_stream_read_fully(&is, frame, size)))
+        {
+            break;
+        }
+        
+        log_query_binary_print_record(os, frame, size);
+    }
+    
+    input_stream_close(&is);
+    
+    return (return_code >= 0)?SUCCESS:return_code;
+}
+
+/** @} */
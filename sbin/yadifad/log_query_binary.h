@@ -0,0 +1,128 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup logging Server logging
+ *  @ingroup yadifad
+ *  @brief Binary query log
+ *
+ *  With queries-log-type 4, each answered query is stored as a fixed-size binary record in a ring owned by the
+ *  thread that answered it.  No lock, no allocation, no text formatting is done on that thread.
+ *  A background writer drains the rings into queries-log-file, in the log directory.
+ *
+ *  The file is a sequence of frames in the Frame Streams format used by dnstap:
+ *
+ *  _ a control frame: u32 0, u32 length, u32 type (2 = START or 3 = STOP), and for START
+ *    the content type field (u32 1, u32 length, "yadifa-queries-1")
+ *  _ a data frame: u32 length, then the record
+ *
+ *  All integers are big-endian.  A record is:
+ *
+ *  @code
+ *   0 u64 time in microseconds since the epoch
+ *   8 u8  record version (1)
+ *   9 u8  address family (4 or 6)
+ *  10 u8  protocol (17 = UDP, 6 = TCP)
+ *  11 u8  LOG_QUERY_BINARY_* flags
+ *  12 u16 client port
+ *  14 u16 message id
+ *  16 u8  header flags (byte 2) of the answer, or of the query if it has not been answered inline (transfers)
+ *  17 u8  header flags (byte 3, with the rcode) of the answer, or of the query
+ *  18 u16 qtype
+ *  20 u16 qclass
+ *  22 u16 answer size
+ *  24 u8  answer status (finger print)
+ *  25 u8  qname length
+ *  26 u8  client address (16 bytes, an IPv4 address uses the first 4)
+ *  42 u8  qname, in wire format
+ *  @endcode
+ *
+ *  "yadifad --print-queries <file>" renders such a file as text.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _LOG_QUERY_BINARY_H
+#define _LOG_QUERY_BINARY_H
+
+#include <dnscore/message.h>
+#include <dnscore/output_stream.h>
+
+#define LOG_QUERY_BINARY_CONTENT_TYPE   "yadifa-queries-1"
+
+#define LOG_QUERY_BINARY_VERSION        1
+
+#define LOG_QUERY_BINARY_TSIG           0x01
+#define LOG_QUERY_BINARY_EDNS           0x02
+#define LOG_QUERY_BINARY_DNSSEC         0x04
+
+#define LOG_QUERY_BINARY_HEADER_SIZE    42
+
+/**
+ * Stores the answered query in the ring of the current thread.
+ * The record is dropped if the ring is full.
+ * Has the log_query_function signature.
+ */
+
+void log_query_binary(int socket_fd, message_data *mesg);
+
+/**
+ * Opens (appends to) the file and starts the writer.
+ *
+ * @param path the file
+ *
+ * @return an error code
+ */
+
+ya_result log_query_binary_start(const char *path);
+
+/**
+ * Writes what remains in the rings, closes the file and stops the writer.
+ */
+
+void log_query_binary_stop();
+
+/**
+ * Renders a binary query log file as text.
+ *
+ * @param path the file
+ * @param os where to write the text
+ *
+ * @return an error code
+ */
+
+ya_result log_query_binary_print(const char *path, output_stream *os);
+
+#endif
+
+/** @} */
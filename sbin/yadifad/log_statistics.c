@@ -43,6 +43,8 @@
 
 #define LOG_STATISTICS_C_
 
+#include <dnsdb/zdb_answer_cache.h>
+
 #include "log_statistics.h"
 
 #define SHOW_REFERRAL 1
@@ -73,6 +75,13 @@ log_statistics_legend()
             "\tax : axfr query count \n"
             "\tix : ixfr query count \n"
             "\tov : (tcp) connection overflow \n"
+            "\tbc : (udp) batch count \n"
+            "\tbm : (udp) messages read by batches \n"
+            "\tbf : (udp) completely filled batch count \n"
+            "\thi : answer cache hit count \n"
+            "\tmi : answer cache miss count \n"
+            "\tce : answer cache entry count \n"
+            "\tcb : answer cache bytes \n"
             "\n"
             "output:\n"
             "\n"
@@ -102,6 +111,10 @@ log_statistics_legend()
 void
 log_statistics(server_statistics_t *server_statistics)
 {
+    zdb_answer_cache_stats answer_cache_stats;
+    
+    zdb_answer_cache_get_stats(&answer_cache_stats);
+    
     logger_handle_msg(g_statistics_logger,
             MSG_INFO,
 #if 0
@@ -122,6 +135,10 @@ log_statistics(server_statistics_t *server_statistics)
 #endif
                   "ax=%llu ix=%llu ov=%llu) "
             
+             "udpb (bc=%llu bm=%llu bf=%llu) "
+            
+             "ac (hi=%llu mi=%llu ce=%u cb=%u) "
+            
             "udpa (OK=%llu FE=%llu SF=%llu NE=%llu "
                   "NI=%llu RE=%llu XD=%llu XR=%llu "
                   "NR=%llu NA=%llu NZ=%llu BV=%llu "
@@ -172,6 +189,19 @@ log_statistics(server_statistics_t *server_statistics)
             server_statistics->tcp_ixfr_count,
             server_statistics->tcp_overflow_count,
             
+            // udp batches
+            
+            server_statistics->udp_batch_count,
+            server_statistics->udp_batch_fill_total,
+            server_statistics->udp_batch_full_count,
+            
+            // answer cache
+            
+            answer_cache_stats.hits,
+            answer_cache_stats.misses,
+            answer_cache_stats.count,
+            answer_cache_stats.bytes,
+            
             // udp fp
                         
             server_statistics->udp_fp[RCODE_NOERROR],
@@ -457,7 +457,13 @@ notify_process(database_t *database, message_data *mesg)
                         MESSAGE_HIFLAGS(mesg->buffer) |= QR_BITS|AA_BITS;
                         mesg->send_length = mesg->received;
                         message_transform_to_error(mesg);
-                        udp_send_message_data(mesg);
+                        
+                        /* over TCP, the caller writes the prepared answer on the connection */
+                        
+                        if(mesg->protocol != IPPROTO_TCP)
+                        {
+                            udp_send_message_data(mesg);
+                        }
 
                         if(zone_isidle(zone_config))
                         {
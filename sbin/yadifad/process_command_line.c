@@ -46,6 +46,7 @@
 #include <dnscore/parsing.h>
 
 #include "confs.h"
+#include "log_query_binary.h"
 
 #include "server_error.h"
 #include "config_error.h"
@@ -67,6 +68,7 @@ show_usage(void)
     puts("\n"
          "\t\toptions:\n"
          "\t\t--config/-c <config_file>   : use <config_file> as configuration\n"
+         "\t\t--print-queries/-Q <file>    : print a binary queries log file as text\n"
 		 "\n"
 		 "\t\t--version/-V                : view version\n"
          "\t\t--help/-h                   : show this help text\n"
@@ -114,7 +116,7 @@ print_version(int level)
     }
 }
 
-static const char            *short_options = "c:dD:mp:hil:L:P:rsvVz:u:g:t:";
+static const char            *short_options = "c:dD:mp:hil:L:P:Q:rsvVz:u:g:t:";
 
 static struct option long_options[] =
     {
@@ -123,6 +125,7 @@ static struct option long_options[] =
         { "listen",      1,          0, /*O_LISTEN*/      'L'},
         { "port",        1,          0, /*O_PORT*/        'P'},
         { "print",       0,          0, /*O_PRINT*/       'p'},
+        { "print-queries", 1,        0, /*O_PRINTQUERIES*/'Q'},
         { "version",     0,          0, /*O_VERSION*/     'V'},
         { "uid",         1,          0, /*O_UID*/         'u'},
         { "gid",         1,          0, /*O_GID*/         'g'},
@@ -226,6 +229,24 @@ process_command_line(int argc, char **argv, config_data *config)
                 break;
             }
 
+            case 'Q':
+            {
+                /* Renders a binary queries log & exits */
+                
+                ya_result return_code;
+                
+                if(FAIL(return_code = log_query_binary_print(optarg, termout)))
+                {
+                    osformatln(termerr, "cannot print '%s': %r", optarg, return_code);
+                    flusherr();
+                    flushout();
+                    exit(EXIT_FAILURE);
+                }
+                
+                flushout();
+                exit(EXIT_SUCCESS);
+            }
+
             case 'u':
             {
                 if(FAIL(config_adjust("uid", optarg, config)))
@@ -52,13 +52,13 @@
 #include <dnscore/format.h>
 #include <dnscore/scheduler.h>
 #include <dnscore/serial.h>
-#include <dnscore/threaded_queue.h>
 #include <dnscore/thread_pool.h>
 #include <dnscore/bytearray_output_stream.h>
 #include <dnscore/file_input_stream.h>
 #include <dnscore/fdtools.h>
 #include <dnscore/xfr_copy.h>
 #include <dnscore/tcp_io_stream.h>
+#include <dnscore/timems.h>
 
 #include <dnsdb/zdb_zone_label.h>
 #include <dnsdb/zdb_zone.h>
@@ -66,10 +66,13 @@
 #include <dnsdb/zdb_zone_write.h>
 #include <dnsdb/zdb_icmtl.h>
 #include <dnsdb/zdb_utils.h>
+#include <dnsdb/zdb_zone_snapshot.h>
+#include <dnsdb/treeset.h>
 
 #include <dnsdb/zdb_zone_load.h>
 #include <dnszone/zone_file_reader.h>
 #include <dnszone/zone_axfr_reader.h>
+#include <dnszone/zone_snapshot_reader.h>
 
 #include "scheduler_database_load_zone.h"
 
@@ -83,6 +86,9 @@
 #define MODULE_MSG_HANDLE g_server_logger
 
 #define DBLOADQ_TAG 0x5144414f4c4244
+#define DBLOADW_TAG 0x5744414f4c4244
+
+#define ZONE_LOAD_PARALLEL_PARSE_MIN_SIZE   0x100000    /* smaller files are parsed by the worker loading them */
 
 typedef struct scheduler_database_load_zone_args scheduler_database_load_zone_args;
 
@@ -280,6 +286,28 @@ scheduler_database_invalidate_zone(zdb *db, zone_data *zone_desc, bool load_afte
 
 /**********************************************************************************************************************/
 
+static u32 database_load_in_flight_count();
+
+/**
+ * The parser threads are not worth it for small files, the other workers are loading zones meanwhile.
+ * The workers loading a zone share the parser threads allowed, so a cold start does not run one pool per worker.
+ */
+
+static u32
+scheduler_database_load_zone_parser_count(const char *file_name)
+{
+    struct stat file_stat;
+    
+    if((stat(file_name, &file_stat) >= 0) && (file_stat.st_size < ZONE_LOAD_PARALLEL_PARSE_MIN_SIZE))
+    {
+        return 0;
+    }
+    
+    u32 in_flight = database_load_in_flight_count();
+    
+    return g_config->zone_load_thread_count / MAX(in_flight, 1);
+}
+
 /**
  * Loads a MASTER zone file from disc into memory.
  * Returns a pointer to the zone structure.
@@ -324,17 +352,69 @@ scheduler_database_load_zone_master(zdb *db, zone_data *zone_desc, zdb_zone **zo
     zone_reader zr;
     zdb_zone *zone_pointer_out;
     ya_result return_value;
+    struct stat file_stat;
+    bool snapshot = FALSE;
+    bool from_snapshot = FALSE;
     char file_name[1024];
+    char snapshot_name[1024];
         
     snformat(file_name, sizeof(file_name), "%s%s", g_config->data_path, zone_desc->file_name);
-
-    log_info("zone load: loading '%s'", file_name);
+    
+    if((g_config->server_flags & SERVER_FL_ZONE_SNAPSHOT) != 0)
+    {
+        snformat(snapshot_name, sizeof(snapshot_name), "%s%s", file_name, ZDB_ZONE_SNAPSHOT_SUFFIX);
+        
+        /* the snapshot made after loading the text file is tied to this version of it */
+        
+        snapshot = (stat(file_name, &file_stat) >= 0);
+        
+        if(ISOK(return_value = zone_snapshot_reader_open(snapshot_name, file_name, &zr)))
+        {
+            log_info("zone load: loading snapshot '%s'", snapshot_name);
+            
+            return_value = zdb_zone_load(db, &zr, &zone_pointer_out, g_config->xfr_path, zone_desc->origin, ZDB_ZONE_REPLAY_JOURNAL|(zone_desc->dnssec_mode << ZDB_ZONE_DNSSEC_SHIFT));
+            
+            if(FAIL(return_value) && (return_value != ZDB_READER_ALREADY_LOADED))
+            {
+                log_warn("zone load: cannot load snapshot '%s': %r", snapshot_name, return_value);
+                
+                zone_reader_handle_error(&zr, return_value);
+            }
+            else
+            {
+                from_snapshot = TRUE;
+            }
+            
+            zone_reader_close(&zr);
+        }
+        else if(return_value != MAKE_ERRNO_ERROR(ENOENT))
+        {
+            log_info("zone load: snapshot '%s' not used: %r", snapshot_name, return_value);
+        }
+    }
  
-    if(ISOK(return_value = zone_file_reader_open(file_name, &zr)))
+    if(!from_snapshot)
+    {
+        log_info("zone load: loading '%s'", file_name);
+    }
+    
+    if(from_snapshot || ISOK(return_value = zone_file_reader_parallel_open(file_name, &zr, scheduler_database_load_zone_parser_count(file_name))))
     {
-        return_value = zdb_zone_load(db, &zr, &zone_pointer_out, g_config->xfr_path, zone_desc->origin, ZDB_ZONE_REPLAY_JOURNAL|(zone_desc->dnssec_mode << ZDB_ZONE_DNSSEC_SHIFT));
+        if(!from_snapshot)
+        {
+            return_value = zdb_zone_load(db, &zr, &zone_pointer_out, g_config->xfr_path, zone_desc->origin, ZDB_ZONE_REPLAY_JOURNAL|(zone_desc->dnssec_mode << ZDB_ZONE_DNSSEC_SHIFT));
 
-        zone_reader_close(&zr);
+            zone_reader_close(&zr);
+            
+            if(snapshot && ISOK(return_value))
+            {
+                /* the next start will not have to parse the text */
+                
+                zdb_zone_lock(zone_pointer_out, ZDB_ZONE_MUTEX_SIMPLEREADER);
+                zdb_zone_write_snapshot_file(zone_pointer_out, snapshot_name, file_stat.st_size, file_stat.st_mtime);
+                zdb_zone_unlock(zone_pointer_out, ZDB_ZONE_MUTEX_SIMPLEREADER);
+            }
+        }
 
         /* If the zone load failed for any reason but "loaded already" ... */
 
@@ -832,7 +912,7 @@ scheduler_database_load_zone_slave(zdb *db, zone_data *zone_desc, zdb_zone **zon
     {
         log_info("zone load: loading %{dnsname} file '%s'", zone_desc->origin, file_name);
 
-        if(FAIL(return_value = zone_file_reader_open(file_name, &zr)))
+        if(FAIL(return_value = zone_file_reader_parallel_open(file_name, &zr, scheduler_database_load_zone_parser_count(file_name))))
         {
             log_err("zone load: unexpectedly unable to load '%s' when it had just been found earlier", file_name);
 
@@ -967,161 +1047,328 @@ scheduler_database_load_zone_slave(zdb *db, zone_data *zone_desc, zdb_zone **zon
     return return_value;
 }
 
-void
-database_load_message_free(database_message *message);
+/*
+ * The load service
+ * 
+ * The operations queued are kept ordered by weight (the size of the zone file) so the small zones are
+ * available first, and processed by zone-load-workers threads.
+ * A zone only starts to load if the weight of the zones being loaded stays within zone-load-budget, unless
+ * nothing else is loading (a zone bigger than the budget is loaded alone).
+ * A zone has at most one operation queued (the latest) and is never processed by two workers at once.
+ */
 
-static pthread_t database_load_thread_id = 0;
-static threaded_queue database_load_queue;
+static int database_load_priority_compare(const void *node_a, const void *node_b);
+static int database_load_origin_compare(const void *node_a, const void *node_b);
+
+static pthread_mutex_t database_load_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t database_load_cond = PTHREAD_COND_INITIALIZER;
+static treeset_tree database_load_queue = {NULL, database_load_priority_compare};
+static treeset_tree database_load_queued = {NULL, database_load_origin_compare};  /* origin -> queued message */
+static treeset_tree database_load_busy = {NULL, database_load_origin_compare};    /* origins being processed */
+static u64 database_load_weight_in_flight = 0;
+static u32 database_load_in_flight = 0;
+static u32 database_load_sequence = 0;
+static pthread_t *database_load_thread_ids = NULL;
+static u32 database_load_thread_count = 0;
+static bool database_load_stopping = FALSE;
+
+static u32
+database_load_in_flight_count()
+{
+    pthread_mutex_lock(&database_load_mtx);
+    u32 in_flight = database_load_in_flight;
+    pthread_mutex_unlock(&database_load_mtx);
+    
+    return in_flight;
+}
 
-static void *
-database_load_thread(void *args_)
+static int
+database_load_priority_compare(const void *node_a, const void *node_b)
 {
-    /*
-     * while the program is running
-     */
+    const database_message *a = (const database_message*)node_a;
+    const database_message *b = (const database_message*)node_b;
     
-    thread_pool_setup_random_ctx();
+    if(a->weight != b->weight)
+    {
+        return (a->weight < b->weight)?-1:1;
+    }
     
-    for(;;)
+    return (s32)(a->sequence - b->sequence);
+}
+
+static int
+database_load_origin_compare(const void *node_a, const void *node_b)
+{
+    return dnsname_compare((const u8*)node_a, (const u8*)node_b);
+}
+
+static u64
+database_load_zone_weight(const u8 *origin)
+{
+    zone_data *zone_desc = zone_getbydnsname(origin);
+    struct stat file_stat;
+    char file_name[1024];
+    
+    if((zone_desc == NULL) || (zone_desc->file_name == NULL))
     {
-        /*
-         * dequeue command
-         */
-        
-        database_message *message = (database_message*)threaded_queue_try_dequeue(&database_load_queue);
+        return 0;
+    }
+    
+    snformat(file_name, sizeof(file_name), "%s%s", g_config->data_path, zone_desc->file_name);
+    
+    if(stat(file_name, &file_stat) < 0)
+    {
+        return 0;
+    }
+    
+    return file_stat.st_size;
+}
 
-        if(message == NULL)
+static void
+database_load_enqueue(database_message *message)
+{
+    pthread_mutex_lock(&database_load_mtx);
+    
+    treeset_node *node = treeset_avl_find(&database_load_queued, message->origin);
+    
+    if(node != NULL)
+    {
+        database_message *queued = (database_message*)node->data;
+        
+        if(queued->payload.type == message->payload.type)
         {
-            sleep(1);
+            pthread_mutex_unlock(&database_load_mtx);
             
-            if(dnscore_shuttingdown())
-            {
-                break;
-            }
+            log_debug("zone load: operation %d on %{dnsname} already queued", message->payload.type, message->origin);
+            
+            database_load_message_free(message);
             
+            return;
+        }
+        
+        /* the latest operation replaces the one queued */
+        
+        treeset_avl_delete(&database_load_queue, queued);
+        treeset_avl_delete(&database_load_queued, queued->origin);
+        
+        database_load_message_free(queued);
+    }
+    
+    message->sequence = database_load_sequence++;
+    
+    node = treeset_avl_insert(&database_load_queued, message->origin);
+    node->data = message;
+    treeset_avl_insert(&database_load_queue, message);
+    
+    pthread_cond_signal(&database_load_cond);
+    
+    pthread_mutex_unlock(&database_load_mtx);
+}
+
+/*
+ * Takes the next operation that can be processed.
+ * 
+ * The mutex must be held
+ */
+
+static database_message *
+database_load_next()
+{
+    u64 budget = ((u64)g_config->zone_load_budget) << 20;
+    
+    treeset_avl_iterator iter;
+    treeset_avl_iterator_init(&database_load_queue, &iter);
+
+    while(treeset_avl_iterator_hasnext(&iter))
+    {
+        treeset_node *node = treeset_avl_iterator_next_node(&iter);
+        database_message *message = (database_message*)node->key;
+        
+        if(treeset_avl_find(&database_load_busy, message->origin) != NULL)
+        {
             continue;
         }
         
-        log_debug("database_load_thread: dequeued operation %d on %{dnsname}", message->payload.type, message->origin);
+        if((database_load_in_flight > 0) && (database_load_weight_in_flight + message->weight > budget))
+        {
+            break; /* the next ones are heavier */
+        }
         
-        /*
-         * NULL => shutdown the thread
-         */
+        treeset_avl_delete(&database_load_queue, message);
+        treeset_avl_delete(&database_load_queued, message->origin);
+        treeset_avl_insert(&database_load_busy, message->origin);
         
-        /*
-         * load command ?
-         */
+        database_load_weight_in_flight += message->weight;
+        database_load_in_flight++;
         
-        switch(message->payload.type)
+        return message;
+    }
+    
+    return NULL;
+}
+
+static void
+database_load_process(database_message *message)
+{
+    switch(message->payload.type)
+    {
+        case DATABASE_LOAD_LOAD_ZONE:
         {
-            case DATABASE_LOAD_LOAD_ZONE:
+            ya_result return_value;
+            
+            /*
+             * Invalidate the zone
+             * Empty the current zone if any
+             */
+            
+            zone_data *zone_desc = zone_getbydnsname(message->origin);
+            
+            /*
+             * If the zone descriptor (config) exists and it can be locked by the loader ...
+             */
+            
+            if((zone_desc != NULL) && ISOK(zone_lock(zone_desc, ZONE_LOCK_LOAD)))
             {
-                ya_result return_value;
-                
-                /*
-                 * Invalidate the zone
-                 * Empty the current zone if any
-                 */
-                
-                zone_data *zone_desc = zone_getbydnsname(message->origin);
-                
-                /*
-                 * If the zone descriptor (config) exists and it can be locked by the loader ...
-                 */
-                
-                if((zone_desc != NULL) && ISOK(zone_lock(zone_desc, ZONE_LOCK_LOAD)))
+                if(!zdb_zone_isinvalid((zdb*)g_config->database, zone_desc->origin, zone_desc->qclass))
                 {
-                    if(!zdb_zone_isinvalid((zdb*)g_config->database, zone_desc->origin, zone_desc->qclass))
-                    {
-                        scheduler_database_invalidate_zone((zdb*)g_config->database, zone_desc, TRUE);
-                        
-                        zone_unlock(zone_desc, ZONE_LOCK_LOAD);
+                    scheduler_database_invalidate_zone((zdb*)g_config->database, zone_desc, TRUE);
+                    
+                    zone_unlock(zone_desc, ZONE_LOCK_LOAD);
 
-                        break;
-                    }
+                    break;
+                }
 
-                    // wait
+                // wait
+                
+                u64 load_start = timeus();
 
-                    if(zone_desc->type == ZT_MASTER)
-                    {
-                        /*
-                         * load master ?
-                         * => load the file
-                         * => schedule the xchg with the invalidated zone
-                         */
-                        
-                        zdb_zone *zone;
+                if(zone_desc->type == ZT_MASTER)
+                {
+                    /*
+                     * load master ?
+                     * => load the file
+                     * => schedule the xchg with the invalidated zone
+                     */
+                    
+                    zdb_zone *zone;
 
-                        if(FAIL(return_value = scheduler_database_load_zone_master((zdb*)g_config->database, zone_desc, &zone)))
-                        {
-                            log_err("database_load_thread: error loading master %{dnsname}: %r", zone_desc->origin, return_value);
-                        }
-                    }
-                    else if(zone_desc->type == ZT_SLAVE)
+                    if(FAIL(return_value = scheduler_database_load_zone_master((zdb*)g_config->database, zone_desc, &zone)))
                     {
-                        /*
-                         * load slave
-                         * 
-                         * if no file/axfr is available => axfr (responsible to requeue the load) and continue
-                         * 
-                         * if file/axfr is available => load the file/axfr
-                         * 
-                         * => schedule the xchg with the invalidated zone
-                         * 
-                         */
-
-                        zdb_zone *zone;
-
-                        if(FAIL(return_value = scheduler_database_load_zone_slave((zdb*)g_config->database, zone_desc, &zone)))
-                        {
-                            log_err("database_load_thread: error loading slave %{dnsname}: %r", zone_desc->origin, return_value);
-                        }
+                        log_err("database_load_thread: error loading master %{dnsname}: %r", zone_desc->origin, return_value);
                     }
-                    else /* not master nor slave */
+                }
+                else if(zone_desc->type == ZT_SLAVE)
+                {
+                    /*
+                     * load slave
+                     * 
+                     * if no file/axfr is available => axfr (responsible to requeue the load) and continue
+                     * 
+                     * if file/axfr is available => load the file/axfr
+                     * 
+                     * => schedule the xchg with the invalidated zone
+                     * 
+                     */
+
+                    zdb_zone *zone;
+
+                    if(FAIL(return_value = scheduler_database_load_zone_slave((zdb*)g_config->database, zone_desc, &zone)))
                     {
-                        /* other types */
-                        
-                        zone_unlock(zone_desc, ZONE_LOCK_LOAD);
-
-                        log_err("zone load: unknown zone type");
-                        
-                        break;
+                        log_err("database_load_thread: error loading slave %{dnsname}: %r", zone_desc->origin, return_value);
                     }
                 }
-                
-                zone_setstartingup(zone_desc, FALSE);
-                
-                break;
-            }
-            case DATABASE_LOAD_UNLOAD_ZONE:
-            {
-                /*
-                 * Invalidate the zone
-                 * Empty the current zone if any
-                 */
-                
-                zone_data *zone_desc = zone_getbydnsname(message->origin);
-                
-                if((zone_desc != NULL) && ISOK(zone_lock(zone_desc, ZONE_LOCK_UNLOAD)))
+                else /* not master nor slave */
                 {
-                    scheduler_database_invalidate_zone((zdb*)g_config->database, zone_desc, FALSE);
+                    /* other types */
                     
-                    zone_unlock(zone_desc, ZONE_LOCK_UNLOAD);
+                    zone_unlock(zone_desc, ZONE_LOCK_LOAD);
+
+                    log_err("zone load: unknown zone type");
+                    
+                    break;
                 }
                 
-                // wait
+                u64 load_time = timeus() - load_start;
+                
+                log_info("zone load: %{dnsname} processed in %llu.%06llus", zone_desc->origin, load_time / 1000000, load_time % 1000000);
             }
-
-            default:
+            
+            zone_setstartingup(zone_desc, FALSE);
+            
+            break;
+        }
+        case DATABASE_LOAD_UNLOAD_ZONE:
+        {
+            /*
+             * Invalidate the zone
+             * Empty the current zone if any
+             */
+            
+            zone_data *zone_desc = zone_getbydnsname(message->origin);
+            
+            if((zone_desc != NULL) && ISOK(zone_lock(zone_desc, ZONE_LOCK_UNLOAD)))
             {
-                break;
+                scheduler_database_invalidate_zone((zdb*)g_config->database, zone_desc, FALSE);
+                
+                zone_unlock(zone_desc, ZONE_LOCK_UNLOAD);
             }
+            
+            // wait
         }
+
+        default:
+        {
+            break;
+        }
+    }
+}
+
+static void *
+database_load_thread(void *args_)
+{
+    /*
+     * while the program is running
+     */
+    
+    thread_pool_setup_random_ctx();
+    
+    pthread_mutex_lock(&database_load_mtx);
+    
+    while(!database_load_stopping && !dnscore_shuttingdown())
+    {
+        database_message *message = database_load_next();
+
+        if(message == NULL)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec++;
+            
+            pthread_cond_timedwait(&database_load_cond, &database_load_mtx, &deadline);
+            
+            continue;
+        }
+        
+        pthread_mutex_unlock(&database_load_mtx);
+        
+        log_debug("database_load_thread: dequeued operation %d on %{dnsname}", message->payload.type, message->origin);
+        
+        database_load_process(message);
+        
+        pthread_mutex_lock(&database_load_mtx);
+        
+        treeset_avl_delete(&database_load_busy, message->origin);
+        database_load_weight_in_flight -= message->weight;
+        database_load_in_flight--;
+        
+        pthread_cond_broadcast(&database_load_cond); /* the zone and its weight are available again */
         
         database_load_message_free(message);
     }
     
-    log_info("zone load: service stopped");
+    pthread_mutex_unlock(&database_load_mtx);
+    
+    log_debug("zone load: worker stopped");
     
     return NULL;
 }
@@ -1129,17 +1376,22 @@ database_load_thread(void *args_)
 void
 database_load_startup()
 {
-    if(database_load_thread_id == 0)
+    if(database_load_thread_ids == NULL)
     {
-        log_info("zone load: service start");
+        database_load_thread_count = g_config->zone_load_worker_count;
+        
+        log_info("zone load: service start (%u workers)", database_load_thread_count);
         
-        /** for 1M zones, this should be increased */
+        database_load_stopping = FALSE;
         
-        threaded_queue_init(&database_load_queue, 4096);   /* maximum updates total per 30 seconds ... */
+        MALLOC_OR_DIE(pthread_t*, database_load_thread_ids, sizeof(pthread_t) * database_load_thread_count, DBLOADW_TAG);
 
-        if(pthread_create(&database_load_thread_id, NULL, database_load_thread, NULL) != 0)
+        for(u32 i = 0; i < database_load_thread_count; i++)
         {
-            exit(EXIT_CODE_THREADCREATE_ERROR);
+            if(pthread_create(&database_load_thread_ids[i], NULL, database_load_thread, NULL) != 0)
+            {
+                exit(EXIT_CODE_THREADCREATE_ERROR);
+            }
         }
     }
 }
@@ -1147,33 +1399,38 @@ database_load_startup()
 void
 database_load_shutdown()
 {
-    database_message *message;
-
-    if(database_load_thread_id != 0)
+    if(database_load_thread_ids != NULL)
     {
         log_info("zone load: service stop");
         
-        database_message *message = database_load_message_alloc((u8*)"", DATABASE_LOAD_STOP);
+        pthread_mutex_lock(&database_load_mtx);
+        database_load_stopping = TRUE;
+        pthread_cond_broadcast(&database_load_cond);
+        pthread_mutex_unlock(&database_load_mtx);
         
-        threaded_queue_enqueue(&database_load_queue, message);
+        for(u32 i = 0; i < database_load_thread_count; i++)
+        {
+            pthread_join(database_load_thread_ids[i], NULL);
+        }
         
-        pthread_join(database_load_thread_id, NULL);
+        free(database_load_thread_ids);
+        database_load_thread_ids = NULL;
         
-        for(;;)
-        {
-            database_message *message = (database_message*)threaded_queue_try_dequeue(&database_load_queue);
+        /* drop what has not been processed */
+        
+        treeset_avl_iterator iter;
+        treeset_avl_iterator_init(&database_load_queue, &iter);
 
-            if(message == NULL)
-            {
-                break;
-            }
+        while(treeset_avl_iterator_hasnext(&iter))
+        {
+            treeset_node *node = treeset_avl_iterator_next_node(&iter);
             
-            database_load_message_free(message);
+            database_load_message_free((database_message*)node->key);
         }
         
-        threaded_queue_finalize(&database_load_queue);
-        
-        database_load_thread_id = 0;
+        treeset_avl_destroy(&database_load_queued);
+        treeset_avl_destroy(&database_load_queue);
+        treeset_avl_destroy(&database_load_busy);
     }
 }
 
@@ -1181,8 +1438,10 @@ void
 database_load_zone_load(const u8 *origin)
 {
     database_message *message = database_load_message_alloc(origin, DATABASE_LOAD_LOAD_ZONE);
+    
+    message->weight = database_load_zone_weight(origin);
 
-    threaded_queue_enqueue(&database_load_queue, message);
+    database_load_enqueue(message);
 }
 
 void
@@ -1190,7 +1449,7 @@ database_load_zone_unload(const u8 *origin)
 {
     database_message *message = database_load_message_alloc(origin, DATABASE_LOAD_UNLOAD_ZONE);
 
-    threaded_queue_enqueue(&database_load_queue, message);
+    database_load_enqueue(message);
 }
 
 
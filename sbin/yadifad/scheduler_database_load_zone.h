@@ -84,6 +84,9 @@ struct database_message
         
         
     } payload;
+    
+    u64 weight;     /* size of the zone source, the lightest zones are loaded first */
+    u32 sequence;   /* order of arrival, for equal weights */
 };
 
 /**
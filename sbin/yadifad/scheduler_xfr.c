@@ -40,6 +40,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include <dnsdb/zdb_zone.h>
 #include <dnsdb/zdb_zone_label.h>
@@ -48,6 +49,7 @@
 #include <dnsdb/zdb_types.h>
 
 #include <dnsdb/zdb_zone_load.h>
+#include <dnsdb/treeset.h>
 #include <dnszone/zone_axfr_reader.h>
 
 #include <dnscore/host_address.h>
@@ -90,6 +92,386 @@ struct axfr_query_axfr_load_param
 
 static ya_result scheduler_axfr_query_alarm(void* xqspp);
 
+static void* xfr_query_thread(void *data);
+
+/*
+ * Transfer engine
+ * 
+ * The transfers from the masters do not go through the (one at a time) scheduler threads anymore.
+ * They are queued here and started on the thread pool, up to xfr-max-concurrent at a time and
+ * xfr-max-per-master at a time for a given master.
+ * 
+ * A zone is only queued once : the requests (NOTIFY, refresh, retry) for a zone already waiting
+ * are merged into the one waiting, an AXFR taking over an IXFR.
+ * 
+ * The zones waiting are started AXFR first (they are not served), then the longest not refreshed first.
+ * 
+ * Each master has its own queue of the zones ready to be transferred from it.  The first zone of the
+ * queue of every master with a free slot is kept in a tree of the same order, so the next transfer
+ * to start is the first zone of that tree : the masters already at xfr-max-per-master are never
+ * looked at.
+ */
+
+#define XFRENGZ_TAG 0x5a474e4552465858 /* XXFRENGZ */
+#define XFRENGM_TAG 0x4d474e4552465858 /* XXFRENGM */
+
+typedef struct xfr_engine_master xfr_engine_master;
+
+struct xfr_engine_master
+{
+    xfr_engine_master *next;
+    struct xfr_engine_zone *head;       /* the first zone of the queue, if it is in the ready tree */
+    treeset_tree queue;                 /* the zones ready to be transferred from this master */
+    host_address address;
+    u32 active;
+};
+
+typedef struct xfr_engine_zone xfr_engine_zone;
+
+struct xfr_engine_zone
+{
+    u8 *origin;
+    xfr_query_schedule_param *pending;  /* the transfer waiting, if any */
+    xfr_engine_master *master;          /* the master of the transfer running, if any */
+    xfr_engine_master *queued;          /* the master the pending transfer is queued on, if any */
+    u32 refreshed_time;
+    bool axfr;
+    bool busy;                          /* transferred or loaded : not to be started again yet */
+};
+
+static int xfr_engine_origin_compare(const void *node_a, const void *node_b);
+static int xfr_engine_priority_compare(const void *node_a, const void *node_b);
+
+static pthread_mutex_t xfr_engine_mtx = PTHREAD_MUTEX_INITIALIZER;
+static treeset_tree xfr_engine_zones = {NULL, xfr_engine_origin_compare};
+static treeset_tree xfr_engine_ready = {NULL, xfr_engine_priority_compare}; /* the head of the queue of every master with a free slot */
+static xfr_engine_master *xfr_engine_masters = NULL;
+static u32 xfr_engine_active = 0;
+
+static int
+xfr_engine_origin_compare(const void *node_a, const void *node_b)
+{
+    return dnsname_compare((const u8*)node_a, (const u8*)node_b);
+}
+
+static int
+xfr_engine_priority_compare(const void *node_a, const void *node_b)
+{
+    const xfr_engine_zone *a = (const xfr_engine_zone*)node_a;
+    const xfr_engine_zone *b = (const xfr_engine_zone*)node_b;
+    
+    if(a->axfr != b->axfr)
+    {
+        return (a->axfr)?-1:1;
+    }
+    
+    if(a->refreshed_time != b->refreshed_time)
+    {
+        return (a->refreshed_time < b->refreshed_time)?-1:1;
+    }
+    
+    return dnsname_compare(a->origin, b->origin);
+}
+
+static void
+xfr_engine_param_free(xfr_query_schedule_param *xqsp)
+{
+    free(xqsp->origin);
+    free(xqsp);
+}
+
+/*
+ * The engine mutex must be held
+ */
+
+static xfr_engine_master *
+xfr_engine_get_master(host_address *address)
+{
+    xfr_engine_master *master;
+    
+    for(master = xfr_engine_masters; master != NULL; master = master->next)
+    {
+        if(host_address_equals(&master->address, address))
+        {
+            return master;
+        }
+    }
+    
+    MALLOC_OR_DIE(xfr_engine_master*, master, sizeof(xfr_engine_master), XFRENGM_TAG);
+    memcpy(&master->address, address, sizeof(host_address));
+    master->address.next = NULL;
+    master->active = 0;
+    master->head = NULL;
+    master->queue.root = NULL;
+    master->queue.compare = xfr_engine_priority_compare;
+    master->next = xfr_engine_masters;
+    xfr_engine_masters = master;
+    
+    return master;
+}
+
+/*
+ * Puts the first zone of the queue of the master in the ready tree if the master has a free slot,
+ * takes it out otherwise.
+ * 
+ * The engine mutex must be held
+ */
+
+static void
+xfr_engine_master_update(xfr_engine_master *master)
+{
+    xfr_engine_zone *head = NULL;
+    
+    if((master->active < (u32)g_config->xfr_max_per_master) && (master->queue.root != NULL))
+    {
+        treeset_node *node = master->queue.root;
+        
+        while(node->children.lr.left != NULL)
+        {
+            node = node->children.lr.left;
+        }
+        
+        head = (xfr_engine_zone*)node->key;
+    }
+    
+    if(head != master->head)
+    {
+        if(master->head != NULL)
+        {
+            treeset_avl_delete(&xfr_engine_ready, master->head);
+        }
+        
+        if(head != NULL)
+        {
+            treeset_node *node = treeset_avl_insert(&xfr_engine_ready, head);
+            node->data = master;
+        }
+        
+        master->head = head;
+    }
+}
+
+/*
+ * Queues the pending transfer of the zone on its master.
+ * 
+ * The engine mutex must be held
+ */
+
+static void
+xfr_engine_queue_zone(xfr_engine_zone *ez)
+{
+    xfr_engine_master *master = xfr_engine_get_master(ez->pending->servers);
+    
+    treeset_avl_insert(&master->queue, ez);
+    ez->queued = master;
+    
+    xfr_engine_master_update(master);
+}
+
+/*
+ * Takes the zone out of the queue of its master.
+ * 
+ * The engine mutex must be held
+ */
+
+static void
+xfr_engine_unqueue_zone(xfr_engine_zone *ez)
+{
+    xfr_engine_master *master = ez->queued;
+    
+    if(master->head == ez)
+    {
+        treeset_avl_delete(&xfr_engine_ready, ez);
+        master->head = NULL;
+    }
+    
+    treeset_avl_delete(&master->queue, ez);
+    ez->queued = NULL;
+    
+    xfr_engine_master_update(master);
+}
+
+/*
+ * Starts the transfers waiting, as long as the limits allow it.
+ * 
+ * The engine mutex must be held
+ */
+
+static void
+xfr_engine_dispatch()
+{
+    while((xfr_engine_active < (u32)g_config->xfr_max_concurrent) && (xfr_engine_ready.root != NULL))
+    {
+        treeset_node *node = xfr_engine_ready.root;
+        
+        while(node->children.lr.left != NULL)
+        {
+            node = node->children.lr.left;
+        }
+        
+        xfr_engine_zone *ez = (xfr_engine_zone*)node->key;
+        xfr_engine_master *master = (xfr_engine_master*)node->data;
+        
+        master->active++;
+        xfr_engine_unqueue_zone(ez);
+        
+        xfr_query_schedule_param *xqsp = ez->pending;
+        ez->pending = NULL;
+        ez->master = master;
+        ez->busy = TRUE;
+        xfr_engine_active++;
+        
+        log_debug("slave: %{dnstype}: starting transfer of %{dnsname} (%u running)", &xqsp->type, xqsp->origin, xfr_engine_active);
+        
+        thread_pool_schedule_job(xfr_query_thread, xqsp, NULL, "xfr query");
+    }
+}
+
+/*
+ * Queues a transfer.  Takes ownership of xqsp.
+ */
+
+static void
+xfr_engine_enqueue(xfr_query_schedule_param *xqsp)
+{
+    pthread_mutex_lock(&xfr_engine_mtx);
+    
+    treeset_node *node = treeset_avl_find(&xfr_engine_zones, xqsp->origin);
+    xfr_engine_zone *ez;
+    
+    if(node == NULL)
+    {
+        MALLOC_OR_DIE(xfr_engine_zone*, ez, sizeof(xfr_engine_zone), XFRENGZ_TAG);
+        ez->origin = dnsname_dup(xqsp->origin);
+        ez->pending = NULL;
+        ez->master = NULL;
+        ez->queued = NULL;
+        ez->refreshed_time = 0;
+        ez->axfr = FALSE;
+        ez->busy = FALSE;
+        
+        node = treeset_avl_insert(&xfr_engine_zones, ez->origin);
+        node->data = ez;
+    }
+    else
+    {
+        ez = (xfr_engine_zone*)node->data;
+    }
+    
+    if(ez->pending != NULL)
+    {
+        /* already waiting : merge */
+        
+        if((xqsp->type == TYPE_AXFR) && !ez->axfr)
+        {
+            /* the order changes : out of the queue while it does */
+            
+            if(ez->queued != NULL)
+            {
+                xfr_engine_unqueue_zone(ez);
+                
+                ez->pending->type = TYPE_AXFR;
+                ez->axfr = TRUE;
+                
+                xfr_engine_queue_zone(ez);
+            }
+            else
+            {
+                ez->pending->type = TYPE_AXFR;
+                ez->axfr = TRUE;
+            }
+        }
+        
+        log_debug("slave: %{dnstype}: transfer of %{dnsname} already queued", &xqsp->type, xqsp->origin);
+        
+        xfr_engine_param_free(xqsp);
+    }
+    else
+    {
+        zone_data *zone_desc = zone_getbydnsname(xqsp->origin);
+        
+        ez->pending = xqsp;
+        ez->axfr = (xqsp->type == TYPE_AXFR);
+        ez->refreshed_time = (zone_desc != NULL)?zone_desc->refresh.refreshed_time:0;
+        
+        /* a zone being transferred is queued again once its current transfer is done */
+        
+        if(!ez->busy)
+        {
+            xfr_engine_queue_zone(ez);
+        }
+    }
+    
+    xfr_engine_dispatch();
+    
+    pthread_mutex_unlock(&xfr_engine_mtx);
+}
+
+/*
+ * Called when the network part of the transfer of the zone is over (successfully or not).
+ * The zone stays busy until xfr_engine_done.
+ */
+
+static void
+xfr_engine_transferred(const u8 *origin)
+{
+    pthread_mutex_lock(&xfr_engine_mtx);
+    
+    treeset_node *node = treeset_avl_find(&xfr_engine_zones, (void*)origin);
+    
+    if(node != NULL)
+    {
+        xfr_engine_zone *ez = (xfr_engine_zone*)node->data;
+        
+        if(ez->master != NULL)
+        {
+            ez->master->active--;
+            xfr_engine_master_update(ez->master);
+            ez->master = NULL;
+            xfr_engine_active--;
+        }
+    }
+    
+    xfr_engine_dispatch();
+    
+    pthread_mutex_unlock(&xfr_engine_mtx);
+}
+
+/*
+ * Called when the zone has been loaded (or not) after its transfer
+ */
+
+static void
+xfr_engine_done(const u8 *origin)
+{
+    pthread_mutex_lock(&xfr_engine_mtx);
+    
+    treeset_node *node = treeset_avl_find(&xfr_engine_zones, (void*)origin);
+    
+    if(node != NULL)
+    {
+        xfr_engine_zone *ez = (xfr_engine_zone*)node->data;
+        
+        ez->busy = FALSE;
+        
+        if(ez->pending != NULL)
+        {
+            xfr_engine_queue_zone(ez);
+        }
+        else
+        {
+            treeset_avl_delete(&xfr_engine_zones, ez->origin);
+            
+            free(ez->origin);
+            free(ez);
+        }
+    }
+    
+    xfr_engine_dispatch();
+    
+    pthread_mutex_unlock(&xfr_engine_mtx);
+}
+
 /*
  * Called after the load of a zone (AXFR/IXFR)
  * Updates expired/refreshed/retried timers
@@ -156,6 +538,23 @@ xfr_query_mark_zone_loaded(zdb* db, const u8 *origin, u32 refreshed_time, u32 re
     }
 }
 
+/*
+ * Releases the previous version of an AXFR-loaded zone.
+ * Waits for the queries still in it, so it is not done by the scheduler.
+ */
+
+static void*
+xfr_query_old_zone_destroy_thread(void *data)
+{
+    zdb_zone *old_zone = (zdb_zone*)data;
+    
+    log_debug("slave: releasing previous version of zone %{dnsname}", old_zone->origin);
+    
+    zdb_zone_destroy(old_zone);
+    
+    return NULL;
+}
+
 static ya_result
 xfr_query_final_callback(void* data)
 {
@@ -166,36 +565,35 @@ xfr_query_final_callback(void* data)
     if(zone_desc != NULL) /* the zone may have been dropped in the mean time */
     {
         /*
-         * Get the label
-         * Set the zone
-         * Destroy the placeholder
+         * Publish the shadow zone in place of the one being served
+         * Release the previous one once its readers are gone
          */
         
         if(aqalp->new_zone != NULL)
         {
-            dnsname_vector name;
-            DEBUG_RESET_dnsname(name);
-
-            dnsname_to_dnsname_vector(aqalp->origin, &name);
-
-            zdb_zone_label *zone_label = zdb_zone_label_add((zdb*)aqalp->db, &name,  zone_desc->qclass);
-
-            zdb_zone *placeholder_zone = zone_label->zone;
-
-            zone_label->zone = aqalp->new_zone;
-
-            log_info("slave: %{dnsname} zone mounted", aqalp->origin);
-
             aqalp->new_zone->extension = &zone_desc->ac;
             aqalp->new_zone->query_access_filter = acl_get_query_access_filter(&zone_desc->ac.allow_query);
+            
+            zdb_zone *old_zone = zdb_zone_xchg((zdb*)aqalp->db, aqalp->new_zone);
+
+            log_info("slave: %{dnsname} zone mounted", aqalp->origin);
 
             u32 now = time(NULL);
 
             zone_desc->refresh.refreshed_time = now;
             zone_desc->refresh.retried_time = now;
             
-            zdb_zone_unlock(placeholder_zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
-            zdb_zone_destroy(placeholder_zone);
+            if(old_zone != NULL)
+            {
+                if((old_zone->apex->flags & ZDB_RR_LABEL_INVALID_ZONE) != 0)
+                {
+                    /* the placeholder of a zone never loaded yet (zdb_zone_xchg_with_invalid) */
+                    
+                    zdb_zone_unlock(old_zone, ZDB_ZONE_MUTEX_SIMPLEREADER);
+                }
+                
+                thread_pool_schedule_job(xfr_query_old_zone_destroy_thread, old_zone, NULL, "axfr old zone release");
+            }
         }
         
         zone_setloading(zone_desc, FALSE);
@@ -203,10 +601,12 @@ xfr_query_final_callback(void* data)
         database_zone_refresh_maintenance(g_config->database, aqalp->origin);
     }
     
+    xfr_engine_done(aqalp->origin);
+    
 	free(aqalp->origin);
     free(aqalp);
     
-    return SCHEDULER_TASK_FINISHED;
+    return SCHEDULER_TASK_PROGRESS; /* the transfers are not scheduler threads */
 }
 
 static void*
@@ -230,15 +630,10 @@ xfr_query_axfr_load_thread(void *data)
     log_info("slave: zone %{dnsname} transferred", aqalp->origin);
     
     /**
-     * Behaviour change : loading an zone file (axfr file) into memory will now drop (invalidate) the zone before
-     * loading it.  Else loading a zone like .com would lead to potentially twice the amount of memory made readily
-     * available to yadifa when most of it will remain untouched.
+     * The zone is built aside (shadow) while the previous version keeps being served.
+     * It is only mounted by xfr_query_final_callback, with a single pointer exchange.
      * 
-     * so:
-     * 
-     * invalidate the zone
-     * drop the zone
-     * load the zone
+     * The price is that both versions are in memory until the queries have left the previous one.
      */
 
     if(ISOK(return_value = zdb_zone_load((zdb*)aqalp->db, &aqalp->zr, &newzone, g_config->xfr_path, aqalp->origin, ZDB_ZONE_DESTROY_JOURNAL|ZDB_ZONE_IS_SLAVE)))
@@ -283,6 +678,10 @@ xfr_query_callback(void* data)
     u32 refreshed_time = 0;
     u32 retried_time = time(NULL);
     
+    /* the connection to the master is over : let the next transfer start */
+    
+    xfr_engine_transferred(xqsp->origin);
+    
     /*
      * Zone refresh will be enabled (again) here.
      * 
@@ -328,29 +727,13 @@ xfr_query_callback(void* data)
                 {
                     /*
                      * The system is ready to load an AXFR
-                     * A zone is already in place (by design), there may be an old zone that is now irrelevant.
-                     * At this point ...
-                     * 
-                     * If the serial are not the same
-                     *      MT the old zone must be destroyed (if it exist)
-                     *       then
-                     *      MT The new zone has to be created (loaded from the AXFR file)
-                     * Else
-                     *      ST The new zone is actually the old zone, and the old zone is non-existent
-                     * EndIf
-                     * 
-                     * then
+                     * A zone is already in place (by design) and keeps answering :
                      * 
-                     * ST The new zone and the placeholder zone have to be swapped, then the placeholder has to be destroyed
+                     * MT The new zone is loaded from the AXFR file, unmounted
+                     * ST The new zone and the zone in place are swapped
+                     * MT The zone that was in place is destroyed once the queries have left it
                      * 
                      */
-                    
-                    zdb_zone *zone = zdb_zone_find_from_dnsname((zdb*)xqsp->db, xqsp->origin, CLASS_IN);
-
-                    if(zone != NULL)
-                    {
-                        zdb_zone_truncate_invalidate(zone);
-                    }                    
 
                     /**
                      * schedule the axfr load
@@ -379,6 +762,8 @@ xfr_query_callback(void* data)
              */
 			
             log_err("slave: unable to load the axfr (retry set in %d seconds)", g_config->axfr_retry_delay);
+            
+            xfr_engine_done(xqsp->origin); /* before the alarm owns xqsp */
 
             alarm_event_node *event = alarm_event_alloc();
 
@@ -402,7 +787,7 @@ xfr_query_callback(void* data)
 
             /* DO NOT FREE xqsp, SO DO NOT BREAK : return now */
             
-            return SCHEDULER_TASK_FINISHED;
+            return SCHEDULER_TASK_PROGRESS;
         }
         
         case TYPE_IXFR:
@@ -467,10 +852,15 @@ xfr_query_callback(void* data)
         }
     }   /* switch return_value */
     
+    if(scheduler_status == SCHEDULER_TASK_FINISHED)
+    {
+        xfr_engine_done(xqsp->origin);
+    }
+    
     free(xqsp->origin);
     free(xqsp);
 
-	return scheduler_status;
+	return SCHEDULER_TASK_PROGRESS; /* the transfers are not scheduler threads */
 }
 
 static void*
@@ -495,8 +885,6 @@ xfr_query_thread(void *data)
                 break;
             }
 
-            random_ctx rndctx = thread_pool_get_random_ctx();
-
             if(ISOK(return_value = ixfr_query(xqsp->servers, zone, &xqsp->loaded_serial, &xqsp->serial_start_offset)))
             {
                 u16 type = (u16)return_value;
@@ -588,7 +976,7 @@ scheduler_ixfr_query(database_t *db, host_address *address_list, u8 *origin)
      * Disable refresh
      */
 
-    scheduler_schedule_thread(NULL, xfr_query_thread, xqsp, "scheduler_ixfr_query");
+    xfr_engine_enqueue(xqsp);
 
     return SUCCESS;
 }
@@ -652,7 +1040,7 @@ scheduler_axfr_query(database_t *db, host_address *address_list, u8 *origin)
      * Disable refresh
      */
 
-    scheduler_schedule_thread(NULL, xfr_query_thread, xqsp, "scheduler_axfr_query");
+    xfr_engine_enqueue(xqsp);
 
     return SUCCESS;
 }
@@ -668,7 +1056,7 @@ scheduler_axfr_query_alarm(void *xqspp)
      * Disable refresh
      */
 
-    scheduler_schedule_thread(NULL, xfr_query_thread, xqsp, "scheduler_axfr_query_alarm");
+    xfr_engine_enqueue(xqsp);
     
     return SUCCESS;
 }
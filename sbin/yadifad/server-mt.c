@@ -51,6 +51,11 @@
 
 #define SERVER_ST_C_
 
+#ifdef __linux__
+/* recvmmsg/sendmmsg & struct mmsghdr are GNU extensions */
+#define _GNU_SOURCE
+#endif
+
 /** @note: here we define the variable that is holding the default logger handle for the current source file
  *         Such a handle should NEVER been set in an include file.
  */
@@ -84,7 +89,9 @@
 #include "scheduler_database_load_zone.h"
 
 #include "log_statistics.h"
+#include "server_statistics.h"
 #include "log_query.h"
+#include "log_query_binary.h"
 #include "poll-util.h"
 
 #define POLLFDBF_TAG 0x464244464c4c4f50
@@ -100,6 +107,26 @@
 #define UDP_USE_MESSAGES 1
 #endif
 
+/**
+ * The batched UDP path (udp-batch-size > 1) reads and writes up to udp-batch-size
+ * datagrams per system call.  It is only available where the system has recvmmsg/sendmmsg.
+ */
+
+#if defined(__USE_GNU) && defined(MSG_WAITFORONE)
+#define UDP_USE_MMSG 1
+#else
+#define UDP_USE_MMSG 0
+#endif
+
+/**
+ * With the batched path, each slot gets its own small ancillary buffer.
+ * It only has to hold the destination address (IP_PKTINFO).
+ */
+
+#define UDP_BATCH_ANCILIARY_SIZE 256
+
+#define MMSGHDR_TAG 0x52444847534d4d
+
 /**
  * This contains the sum of statistics everytime they are all summed.
  */
@@ -119,6 +146,8 @@ struct synced_thread_t
 {
     interface *intf;
     pthread_t id;
+    int udp_sockfd;     /* the interface socket, or this worker's own socket with udp-reuseport */
+    s32 cpu;            /* the cpu the worker is pinned to, -1 if none */
     u16 idx;
 #if PAUSE_ALL_ON_TASK != 0
     volatile u32 paused;
@@ -132,7 +161,18 @@ struct synced_thread_t
     struct msghdr   udp_msghdr;
 #endif
     
-    server_statistics_t statistics;
+#if UDP_USE_MMSG != 0
+    /* batched mode: udp_batch_size slots, all of them read & written at once */
+    
+    message_data   *udp_batch_mesg;
+    struct mmsghdr *udp_batch_in;
+    struct mmsghdr *udp_batch_out;
+    struct iovec   *udp_batch_iovec;
+    u8             *udp_batch_control;
+    u32             udp_batch_size;
+#endif
+    
+    server_statistics_t *statistics;    /* the counters of the thread, set by the thread itself */
 };
 
 typedef struct synced_thread_t synced_thread_t;
@@ -150,6 +190,50 @@ struct synced_threads_t
 
 static struct synced_threads_t synced_threads;
 
+#if UDP_USE_MMSG != 0
+
+static void
+synced_batch_init(synced_thread_t *st, u32 batch_size)
+{
+    st->udp_batch_size = batch_size;
+    
+    if(batch_size <= 1)
+    {
+        return;
+    }
+    
+    MALLOC_OR_DIE(message_data*, st->udp_batch_mesg, batch_size * sizeof(message_data), MESGDATA_TAG);
+    ZEROMEMORY(st->udp_batch_mesg, batch_size * sizeof(message_data));
+    MALLOC_OR_DIE(struct mmsghdr*, st->udp_batch_in, batch_size * sizeof(struct mmsghdr), MMSGHDR_TAG);
+    ZEROMEMORY(st->udp_batch_in, batch_size * sizeof(struct mmsghdr));
+    MALLOC_OR_DIE(struct mmsghdr*, st->udp_batch_out, batch_size * sizeof(struct mmsghdr), MMSGHDR_TAG);
+    ZEROMEMORY(st->udp_batch_out, batch_size * sizeof(struct mmsghdr));
+    MALLOC_OR_DIE(struct iovec*, st->udp_batch_iovec, batch_size * sizeof(struct iovec), MMSGHDR_TAG);
+    
+#if UDP_USE_MESSAGES != 0
+    MALLOC_OR_DIE(u8*, st->udp_batch_control, batch_size * UDP_BATCH_ANCILIARY_SIZE, MSGHDR_TAG);
+#endif
+}
+
+static void
+synced_batch_finalize(synced_thread_t *st)
+{
+    if(st->udp_batch_size <= 1)
+    {
+        return;
+    }
+    
+    free(st->udp_batch_control);
+    free(st->udp_batch_iovec);
+    free(st->udp_batch_out);
+    free(st->udp_batch_in);
+    free(st->udp_batch_mesg);
+    
+    st->udp_batch_size = 0;
+}
+
+#endif
+
 static void
 synced_init(u32 count)
 {
@@ -168,9 +252,11 @@ synced_init(u32 count)
         synced_threads.threads[t].paused = 0;
 #endif
         synced_threads.threads[t].idx = t;
-        ZEROMEMORY(&synced_threads.threads[t].statistics, sizeof(server_statistics_t));
         MALLOC_OR_DIE(message_data*, synced_threads.threads[t].udp_mesg, sizeof(message_data), MESGDATA_TAG);
         ZEROMEMORY(synced_threads.threads[t].udp_mesg, sizeof(message_data));
+#if UDP_USE_MMSG != 0
+        synced_batch_init(&synced_threads.threads[t], g_config->udp_batch_size);
+#endif
     }
     
     synced_threads.thread_count = count;
@@ -181,6 +267,9 @@ synced_finalize()
 {
     for(u32 t = 0; t < synced_threads.thread_count; t++)
     {
+#if UDP_USE_MMSG != 0
+        synced_batch_finalize(&synced_threads.threads[t]);
+#endif
         free(synced_threads.threads[t].udp_mesg);
     }
     
@@ -292,11 +381,11 @@ synced_stop()
     
     synced_threads.terminate = TRUE;
     
-    /* break everybody's reader */
+    /* break everybody's reader, the sockets are closed by server_context_clear */
     
     for(u32 i = 0; i < synced_threads.thread_count; i++)
     {
-        close_ex(synced_threads.threads[i].intf->udp.sockfd);
+        shutdown(synced_threads.threads[i].udp_sockfd, SHUT_RDWR);
     }
     
     /* wait everybody has stopped */
@@ -515,15 +604,20 @@ server_mt_process_udp_update_thread(void *parms_)
     return NULL;
 }
 
+/**
+ * Clones the message (and its header if messages are used) and gives it to the update thread.
+ * The original message is then available for the next query.
+ */
+
 static void
-server_mt_process_udp_update(database_t *database, synced_thread_t *st)
+server_mt_process_udp_update(database_t *database, message_data *mesg, struct msghdr *msghdr)
 {
     message_data *mesg_clone;
     MALLOC_OR_DIE(message_data*, mesg_clone, sizeof(message_data), MESGDATA_TAG);
-    memcpy(mesg_clone, st->udp_mesg, sizeof(message_data));
-    st->udp_mesg->tsig.tsig = NULL;
-    st->udp_mesg->received = 0;
-    st->udp_mesg->send_length = 0;
+    memcpy(mesg_clone, mesg, sizeof(message_data));
+    mesg->tsig.tsig = NULL;
+    mesg->received = 0;
+    mesg->send_length = 0;
     
     struct server_mt_process_udp_update_args *parms;
     MALLOC_OR_DIE(struct server_mt_process_udp_update_args *, parms, sizeof(struct server_mt_process_udp_update_args), GENERIC_TAG);
@@ -540,110 +634,44 @@ server_mt_process_udp_update(database_t *database, synced_thread_t *st)
     
     parms->udp_iovec.iov_base = &mesg_clone->buffer[0];
     parms->udp_iovec.iov_len = sizeof(mesg_clone->buffer);
-    memcpy(&parms->udp_msghdr, &st->udp_msghdr, sizeof(struct msghdr));
+    memcpy(&parms->udp_msghdr, msghdr, sizeof(struct msghdr));
     MALLOC_OR_DIE(struct msghdr*, parms->udp_msghdr.msg_control, ANCILIARY_BUFFER_SIZE, MSGHDR_TAG);
-    memcpy(parms->udp_msghdr.msg_control, st->udp_msghdr.msg_control, ANCILIARY_BUFFER_SIZE);
+    memcpy(parms->udp_msghdr.msg_control, msghdr->msg_control, MIN(msghdr->msg_controllen, ANCILIARY_BUFFER_SIZE));
     parms->udp_msghdr.msg_name = &mesg_clone->other.sa;
     parms->udp_msghdr.msg_iov = &parms->udp_iovec;
 #endif
     
     if(FAIL(thread_pool_schedule_job(server_mt_process_udp_update_thread, parms, NULL, "server_mt_process_udp_update_thread")))
     {
+#if UDP_USE_MESSAGES != 0
+        free(parms->udp_msghdr.msg_control);
+#endif
         free(parms);
         free(mesg_clone);
     }
 }
 
-/** \brief Does the udp processing
+/** \brief Processes a received udp message
  *
- *  When pselect has an UDP request, this function reads the udp packet,
- *  processes dns packet and send reply
+ *  Processes the dns packet and prepares the answer in the message
  *
+ *  @param[in] database
+ *  @param[in] st the thread (for the statistics)
  *  @param[in,out] mesg
+ *  @param[in] msghdr the header the message has been received with (only used with messages)
  *
- *  @retval OK
- *  @return status of message is written in mesg->status
+ *  @return TRUE if the answer has to be sent back, FALSE if it has been dropped or delegated
  */
 
-static void
-server_mt_process_udp(database_t *database, synced_thread_t *st)
+static bool
+server_mt_process_udp_message(database_t *database, synced_thread_t *st, message_data *mesg, struct msghdr *msghdr)
 {
     int return_code;
     
-    server_statistics_t *local_statistics = &st->statistics;
-    
-    message_data *mesg = st->udp_mesg;
+    server_statistics_t *local_statistics = st->statistics;
     
     int fd = mesg->sockfd;
 
-    ssize_t n;
-    
-    for(;;)
-    {
-        while(synced_shouldpause())
-        {
-            // pause
-            synced_wait(st);
-        }
-
-#if UDP_USE_MESSAGES == 0
-        
-        n = recvfrom(fd, mesg->buffer, sizeof(mesg->buffer), 0, (struct sockaddr*)&mesg->other.sa, &mesg->addr_len);
-        
-        if(n >= 0)
-        {
-#ifdef DEBUG
-            log_debug("server_mt_process_udp: recvfrom: got %d bytes", n);
-#endif
-            break;
-        }
-        
-        /*
-        * errno is not a variable but a macro
-        *
-        */
-        int err = errno;
-
-        if(err != EINTR)
-        {
-#ifdef DEBUG
-            log_debug("server_mt_process_udp: recvfrom error: %r", MAKE_ERRNO_ERROR(err)); /* most likely: timeout/resource temporarily unavailable */
-#endif
-            return;
-        }
-#else
-
-        st->udp_iovec.iov_len = sizeof(st->udp_mesg->buffer);
-        st->udp_msghdr.msg_controllen = ANCILIARY_BUFFER_SIZE;
-
-        n = recvmsg(fd, &st->udp_msghdr, 0);
-        
-        if(n >= 0)
-        {
-#ifdef DEBUG
-            log_debug("server_mt_process_udp: recvmsg: got %d bytes", n);
-#endif
-            break;
-        }
-        
-        int err = errno;
-
-        if(err != EINTR)
-        {
-#ifdef DEBUG
-            log_err("server_mt_process_udp: recvmsg error: %r", MAKE_ERRNO_ERROR(err));
-#endif
-            return;
-        }
-#endif
-    }
-
-#if UDP_USE_MESSAGES != 0
-    struct sockadd_in *sav4;
-#endif
-    
-    mesg->received = n;
-
     /**
      * In case of processing error, message_process will return UNPROCESSABLE_MESSAGE
      * which means there must be no query/update/... done on it.
@@ -659,6 +687,8 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
     // wait until can resume
     
     local_statistics->udp_input_count++;
+    
+    u64 query_start = (g_statistics_detailed)?timeus():0;
         
     if(ISOK(return_code = message_process(mesg)))
     {
@@ -706,6 +736,13 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
                                 local_statistics->udp_fp[FP_INCORR_PROTO]++;
                                 break;
                         }
+                        
+                        log_answer(fd, mesg);
+                        
+                        if(g_statistics_detailed)
+                        {
+                            server_statistics_answer(local_statistics, mesg, query_start);
+                        }
 
                         break;
                     }
@@ -734,7 +771,7 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
                             
                             if(answer)
                             {
-                                return;
+                                return FALSE;
                             }
                             
                             message_transform_to_error(mesg);
@@ -744,7 +781,7 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
                         {
                             if(answer)
                             {
-                                return;
+                                return FALSE;
                             }
                         }
                     }
@@ -758,9 +795,9 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
 
                         local_statistics->udp_updates_count++;
 
-                        server_mt_process_udp_update(database, st);
+                        server_mt_process_udp_update(database, mesg, msghdr);
                         
-                        return; // break;
+                        return FALSE; // break;
                     }
                     default:
                     {
@@ -791,6 +828,14 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
                 if(MESSAGE_OP(mesg->buffer) == OPCODE_QUERY)
                 {
                     process_class_ch(mesg); // thread-safe
+                    
+                    log_answer(fd, mesg);
+                    
+                    if(g_statistics_detailed)
+                    {
+                        server_statistics_answer(local_statistics, mesg, query_start);
+                    }
+                    
                     local_statistics->udp_fp[mesg->status]++;
                 }
                 else
@@ -853,7 +898,7 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
         else
         {
             local_statistics->udp_dropped_count++;
-            return;
+            return FALSE;
         }
 
         /** @note Testing of performance in MIRROR_SWITCH mode can only be done in UDP
@@ -863,8 +908,6 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
 #endif
     /** @todo still needs to verify RCODE */
 
-        ssize_t sent;
-
 #ifndef NDEBUG
     if(mesg->send_length <= 12)
     {
@@ -873,6 +916,104 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
         log_memdump_ex(g_server_logger, LOG_DEBUG, mesg->buffer, mesg->send_length, 32, TRUE, TRUE, FALSE);
     }
 #endif
+    
+    return TRUE;
+}
+
+/** \brief Does the udp processing
+ *
+ *  When pselect has an UDP request, this function reads the udp packet,
+ *  processes dns packet and send reply
+ *
+ *  @param[in,out] mesg
+ *
+ *  @retval OK
+ *  @return status of message is written in mesg->status
+ */
+
+static void
+server_mt_process_udp(database_t *database, synced_thread_t *st)
+{
+    server_statistics_t *local_statistics = st->statistics;
+    
+    message_data *mesg = st->udp_mesg;
+    
+    int fd = mesg->sockfd;
+
+    ssize_t n;
+    
+    for(;;)
+    {
+        while(synced_shouldpause())
+        {
+            // pause
+            synced_wait(st);
+        }
+
+#if UDP_USE_MESSAGES == 0
+        
+        n = recvfrom(fd, mesg->buffer, sizeof(mesg->buffer), 0, (struct sockaddr*)&mesg->other.sa, &mesg->addr_len);
+        
+        if(n >= 0)
+        {
+#ifdef DEBUG
+            log_debug("server_mt_process_udp: recvfrom: got %d bytes", n);
+#endif
+            break;
+        }
+        
+        /*
+        * errno is not a variable but a macro
+        *
+        */
+        int err = errno;
+
+        if(err != EINTR)
+        {
+#ifdef DEBUG
+            log_debug("server_mt_process_udp: recvfrom error: %r", MAKE_ERRNO_ERROR(err)); /* most likely: timeout/resource temporarily unavailable */
+#endif
+            return;
+        }
+#else
+
+        st->udp_iovec.iov_len = sizeof(st->udp_mesg->buffer);
+        st->udp_msghdr.msg_controllen = ANCILIARY_BUFFER_SIZE;
+
+        n = recvmsg(fd, &st->udp_msghdr, 0);
+        
+        if(n >= 0)
+        {
+#ifdef DEBUG
+            log_debug("server_mt_process_udp: recvmsg: got %d bytes", n);
+#endif
+            break;
+        }
+        
+        int err = errno;
+
+        if(err != EINTR)
+        {
+#ifdef DEBUG
+            log_err("server_mt_process_udp: recvmsg error: %r", MAKE_ERRNO_ERROR(err));
+#endif
+            return;
+        }
+#endif
+    }
+    
+    mesg->received = n;
+
+#if UDP_USE_MESSAGES != 0
+    if(!server_mt_process_udp_message(database, st, mesg, &st->udp_msghdr))
+#else
+    if(!server_mt_process_udp_message(database, st, mesg, NULL))
+#endif
+    {
+        return;
+    }
+
+    ssize_t sent;
 
 #if !defined(HAS_DROPALL_SUPPORT)
     
@@ -929,6 +1070,186 @@ server_mt_process_udp(database_t *database, synced_thread_t *st)
 #endif
 }
 
+#if UDP_USE_MMSG != 0
+
+/**
+ * Prepares the batch slots of the thread: each slot has its message, its iovec, its header
+ * and (with messages) its own ancillary buffer.
+ */
+
+static void
+server_mt_process_udp_batch_setup(synced_thread_t *st)
+{
+    for(u32 i = 0; i < st->udp_batch_size; i++)
+    {
+        message_data *mesg = &st->udp_batch_mesg[i];
+        
+        ZEROMEMORY(mesg, sizeof(message_data));
+        
+        mesg->addr_len      = sizeof(mesg->other);
+        mesg->protocol      = IPPROTO_UDP;
+        mesg->size_limit    = UDPPACKET_MAX_LENGTH;
+        mesg->process_flags = ~0; /** @todo FIX ME */
+        mesg->sockfd        = st->udp_sockfd;
+        
+        st->udp_batch_iovec[i].iov_base = mesg->buffer;
+        st->udp_batch_iovec[i].iov_len = sizeof(mesg->buffer);
+        
+        struct msghdr *hdr = &st->udp_batch_in[i].msg_hdr;
+        
+        hdr->msg_name = &mesg->other.sa;
+        hdr->msg_namelen = sizeof(mesg->other);
+        hdr->msg_iov = &st->udp_batch_iovec[i];
+        hdr->msg_iovlen = 1;
+#if UDP_USE_MESSAGES != 0
+        hdr->msg_control = &st->udp_batch_control[i * UDP_BATCH_ANCILIARY_SIZE];
+        hdr->msg_controllen = UDP_BATCH_ANCILIARY_SIZE;
+#else
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+#endif
+        hdr->msg_flags = 0;
+    }
+}
+
+/** \brief Does the udp processing, udp_batch_size messages at a time
+ *
+ *  Reads all the available packets (up to udp_batch_size) with one recvmmsg,
+ *  processes them, then sends all the answers with one sendmmsg
+ */
+
+static void
+server_mt_process_udp_batch(database_t *database, synced_thread_t *st)
+{
+    server_statistics_t *local_statistics = st->statistics;
+    
+    int fd = st->udp_sockfd;
+    
+    int n;
+    
+    for(u32 i = 0; i < st->udp_batch_size; i++)
+    {
+        struct msghdr *hdr = &st->udp_batch_in[i].msg_hdr;
+        
+        st->udp_batch_iovec[i].iov_len = sizeof(st->udp_batch_mesg[i].buffer);
+        hdr->msg_namelen = sizeof(st->udp_batch_mesg[i].other);
+#if UDP_USE_MESSAGES != 0
+        hdr->msg_controllen = UDP_BATCH_ANCILIARY_SIZE;
+#endif
+    }
+    
+    for(;;)
+    {
+        while(synced_shouldpause())
+        {
+            // pause
+            synced_wait(st);
+        }
+        
+        /* blocks (up to the socket timeout) for the first one, then takes what is already there */
+        
+        n = recvmmsg(fd, st->udp_batch_in, st->udp_batch_size, MSG_WAITFORONE, NULL);
+        
+        if(n > 0)
+        {
+#ifdef DEBUG
+            log_debug("server_mt_process_udp_batch: recvmmsg: got %d messages", n);
+#endif
+            break;
+        }
+        
+        int err = errno;
+
+        if((n == 0) || (err != EINTR)) /* 0: the socket has been shut down */
+        {
+#ifdef DEBUG
+            log_debug("server_mt_process_udp_batch: recvmmsg error: %r", MAKE_ERRNO_ERROR(err)); /* most likely: timeout/resource temporarily unavailable */
+#endif
+            return;
+        }
+    }
+    
+    local_statistics->udp_batch_count++;
+    local_statistics->udp_batch_fill_total += n;
+    
+    if((u32)n == st->udp_batch_size)
+    {
+        local_statistics->udp_batch_full_count++;
+    }
+    
+    u32 out_count = 0;
+    
+    for(int i = 0; i < n; i++)
+    {
+        message_data *mesg = &st->udp_batch_mesg[i];
+        struct msghdr *hdr = &st->udp_batch_in[i].msg_hdr;
+        
+        mesg->received = st->udp_batch_in[i].msg_len;
+        mesg->addr_len = hdr->msg_namelen;
+        
+        if(!server_mt_process_udp_message(database, st, mesg, hdr))
+        {
+            continue;
+        }
+        
+        /* queue the answer: same destination, same ancillary data, the answer's length */
+        
+        st->udp_batch_iovec[i].iov_len = mesg->send_length;
+        memcpy(&st->udp_batch_out[out_count].msg_hdr, hdr, sizeof(struct msghdr));
+        st->udp_batch_out[out_count].msg_len = 0;
+        out_count++;
+    }
+
+#if !defined(HAS_DROPALL_SUPPORT)
+    
+    u32 out_index = 0;
+    
+    while(out_index < out_count)
+    {
+#ifdef DEBUG
+        log_debug("sendmmsg(%d, %p, %d, %d)", fd, &st->udp_batch_out[out_index], out_count - out_index, 0);
+#endif
+        
+        int sent_count = sendmmsg(fd, &st->udp_batch_out[out_index], out_count - out_index, 0);
+        
+        if(sent_count < 0)
+        {
+            int error_code = errno;
+            
+            if(error_code != EINTR)
+            {
+                /* the first message of the remaining ones could not be sent: skip it */
+                
+                log_err("sendmmsg: %r", MAKE_ERRNO_ERROR(error_code));
+                
+                out_index++;
+            }
+            
+            continue;
+        }
+        
+        for(int i = 0; i < sent_count; i++)
+        {
+            struct mmsghdr *out = &st->udp_batch_out[out_index + i];
+            
+            local_statistics->udp_output_size_total += out->msg_len;
+            
+            if(out->msg_len != out->msg_hdr.msg_iov->iov_len)
+            {
+                /** @warning server_st_process_udp needs to be modified */
+                log_err("short byte count sent (%i instead of %i)", out->msg_len, out->msg_hdr.msg_iov->iov_len);
+            }
+        }
+        
+        out_index += sent_count;
+    }
+#else
+    log_debug("udp_send_message_data: drop all");
+#endif
+}
+
+#endif
+
 /*******************************************************************************************************************
  *
  * Server loop
@@ -950,12 +1271,49 @@ static u64 server_run_loop_rate_tick         = 0;
 static u64 server_run_loop_rate_count        = 0;
 static s32 server_run_loop_timeout_countdown = 0;
 
+/**
+ * Pins the current thread to a cpu
+ */
+
+static void
+server_mt_set_thread_affinity(synced_thread_t *st)
+{
+    if(st->cpu < 0)
+    {
+        return;
+    }
+    
+#if defined(__USE_GNU) && defined(CPU_SET)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(st->cpu, &cpu_set);
+    
+    int err = pthread_setaffinity_np(st->id, sizeof(cpu_set), &cpu_set);
+    
+    if(err != 0)
+    {
+        log_warn("server-mt: unable to pin worker #%d to cpu %d: %r", st->idx, st->cpu, MAKE_ERRNO_ERROR(err));
+    }
+#ifdef DEBUG
+    else
+    {
+        log_debug("server-mt: worker #%d pinned to cpu %d", st->idx, st->cpu);
+    }
+#endif
+#else
+    log_warn("server-mt: thread-affinity is not supported on this system");
+#endif
+}
+
 void*
 server_mt_query_loop_udp(void* parm)
 {
     synced_thread_t *st = (synced_thread_t*)parm;
     
     st->id = pthread_self();
+    st->statistics = server_statistics_local();
+    
+    server_mt_set_thread_affinity(st);
 
     /*    ------------------------------------------------------------    */
 
@@ -966,7 +1324,7 @@ server_mt_query_loop_udp(void* parm)
     st->udp_mesg->protocol      = IPPROTO_UDP;
     st->udp_mesg->size_limit    = UDPPACKET_MAX_LENGTH;
     st->udp_mesg->process_flags = ~0; /** @todo FIX ME */
-    st->udp_mesg->sockfd = st->intf->udp.sockfd;
+    st->udp_mesg->sockfd = st->udp_sockfd;
     
     tcp_set_recvtimeout(st->udp_mesg->sockfd, 1, 0);
 
@@ -994,9 +1352,25 @@ server_mt_query_loop_udp(void* parm)
     
     log_debug("server-mt: reading on %p", st->intf);
     
+#if UDP_USE_MMSG != 0
+    if(st->udp_batch_size > 1)
+    {
+        log_debug("server-mt: reading by batches of %u", st->udp_batch_size);
+        
+        server_mt_process_udp_batch_setup(st);
+        
+        while(program_mode != SA_SHUTDOWN)
+        {
+            st->statistics->input_loop_count++;
+
+            server_mt_process_udp_batch(g_config->database, st);
+        }
+    }
+    else
+#endif
     while(program_mode != SA_SHUTDOWN)
     {
-        st->statistics.input_loop_count++;
+        st->statistics->input_loop_count++;
         
         server_mt_process_udp(g_config->database, st);
     }
@@ -1054,6 +1428,10 @@ server_mt_query_loop()
         case 3:
             log_query = log_query_both;
             break;
+        case 4:
+            log_query = log_query_none;
+            log_answer = log_query_binary;
+            break;
         default:
             log_query = log_query_none;
             break;
@@ -1094,6 +1472,18 @@ server_mt_query_loop()
     
     s32 cpu_count = sys_get_cpu_count();
     
+#if UDP_USE_MMSG != 0
+    if(g_config->udp_batch_size > 1)
+    {
+        log_info("server-mt: udp messages are read and answered by batches of %u", g_config->udp_batch_size);
+    }
+#else
+    if(g_config->udp_batch_size > 1)
+    {
+        log_warn("server-mt: udp-batch-size ignored: recvmmsg/sendmmsg are not available on this system");
+    }
+#endif
+    
     if(reader_by_fd >= cpu_count)
     {
         log_warn("server-mt: using too many threads per address is counter-productive on highly loaded systems (%d >= %d)", reader_by_fd, cpu_count);
@@ -1111,7 +1501,30 @@ server_mt_query_loop()
         {
             synced_threads.threads[tidx].intf = intf;
             
-            log_debug("server_mt_query_loop: pooling #%d=%d fd=%d", tidx, synced_threads.threads[tidx].idx, intf->udp.sockfd);
+            /*
+             * With udp-reuseport, the r-th reader of every address uses the r-th socket of the address.
+             * The r-th reader of every address is pinned to the same cpu.
+             */
+            
+            synced_threads.threads[tidx].udp_sockfd = (r < intf->udp.reuseport_count)?intf->udp.reuseport_sockfd[r]:intf->udp.sockfd;
+            synced_threads.threads[tidx].cpu = (g_config->thread_affinity_count > 0)?g_config->thread_affinity_cpus[r % g_config->thread_affinity_count]:-1;
+            
+#if UDP_USE_MESSAGES != 0
+            int sockopt_dstaddr = 1;
+            Setsockopt(synced_threads.threads[tidx].udp_sockfd, IPPROTO_IP, IP_PKTINFO, &sockopt_dstaddr, sizeof(sockopt_dstaddr));
+#endif
+
+#if defined(SO_INCOMING_CPU)
+            if((synced_threads.threads[tidx].cpu >= 0) && (intf->udp.reuseport_count > 1))
+            {
+                /* hint for the kernel: this socket is handled by this cpu */
+                
+                int incoming_cpu = synced_threads.threads[tidx].cpu;
+                Setsockopt(synced_threads.threads[tidx].udp_sockfd, SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, sizeof(incoming_cpu));
+            }
+#endif
+            
+            log_debug("server_mt_query_loop: pooling #%d=%d fd=%d cpu=%d", tidx, synced_threads.threads[tidx].idx, synced_threads.threads[tidx].udp_sockfd, synced_threads.threads[tidx].cpu);
             
             if(FAIL(return_code = thread_pool_schedule_job(server_mt_query_loop_udp, &synced_threads.threads[tidx], NULL, "server-mt-task")))
             {
@@ -1129,11 +1542,6 @@ server_mt_query_loop()
          * Update the select read set for the current interface (udp + tcp)
          */
 
-#if UDP_USE_MESSAGES != 0
-        int sockopt_dstaddr = 1;
-        Setsockopt(intf->udp.sockfd, IPPROTO_IP, IP_PKTINFO, &sockopt_dstaddr, sizeof(sockopt_dstaddr));
-#endif
-
         FD_SET(intf->tcp.sockfd, &read_set_init);
     }
 
@@ -1294,34 +1702,11 @@ server_mt_query_loop()
 
                     server_statistics.loop_rate_elapsed = delta;
                     
-                    memcpy(&server_statistics_sum, &server_statistics, sizeof(server_statistics_t));
-                    
-                    for(u32 i = 0; i < synced_threads.thread_count; i++)
-                    {
-                        server_statistics_t *stats = &synced_threads.threads[i].statistics;
-                        
-                        server_statistics_sum.input_loop_count += stats->input_loop_count;
-                        /* server_statistics_sum.input_timeout_count += stats->input_timeout_count; */
-                        
-                        server_statistics_sum.udp_output_size_total += stats->udp_output_size_total;
-#if 0
-                        server_statistics_sum.udp_referrals_count += stats->udp_referrals_count;
-#endif
-                        server_statistics_sum.udp_input_count += stats->udp_input_count;
-                        server_statistics_sum.udp_dropped_count += stats->udp_dropped_count;
-                        server_statistics_sum.udp_queries_count += stats->udp_queries_count;
-                        server_statistics_sum.udp_notify_input_count += stats->udp_notify_input_count;
-                        server_statistics_sum.udp_updates_count += stats->udp_updates_count;
-
-                        server_statistics_sum.udp_undefined_count += stats->udp_undefined_count;
-                        
-                        for(u32 j = 0; j < SERVER_STATISTICS_ERROR_CODES_COUNT; j++)
-                        {
-                            server_statistics_sum.udp_fp[j] += stats->udp_fp[j];
-                        }
-                    }
+                    server_statistics_aggregate(&server_statistics_sum);
                     
                     log_statistics(&server_statistics_sum);
+                    
+                    server_statistics_snapshot(&server_statistics_sum);
 
                     /*print_payload(termout, mesg.buffer, 30);*/
                     server_run_loop_rate_tick = now;
@@ -87,7 +87,9 @@
 #include "scheduler_database_load_zone.h"
 
 #include "log_statistics.h"
+#include "server_statistics.h"
 #include "log_query.h"
+#include "log_query_binary.h"
 #include "poll-util.h"
 
 #define POLLFDBF_TAG 0x464244464c4c4f50
@@ -235,6 +237,8 @@ server_st_process_udp(database_t *database, udp *udp_itf)
 #endif
 
     mesg->received = n;
+    
+    u64 query_start = (g_statistics_detailed)?timeus():0;
 
     /**
      * In case of processing error, message_process will return UNPROCESSABLE_MESSAGE
@@ -298,6 +302,13 @@ server_st_process_udp(database_t *database, udp *udp_itf)
                                 server_statistics.udp_fp[FP_INCORR_PROTO]++;
                                 break;
                         }
+                        
+                        log_answer(fd, mesg);
+                        
+                        if(g_statistics_detailed)
+                        {
+                            server_statistics_answer(server_statistics_local(), mesg, query_start);
+                        }
 
                         break;
                     }
@@ -403,6 +414,13 @@ server_st_process_udp(database_t *database, udp *udp_itf)
                     
                     process_class_ch(mesg);
                     
+                    log_answer(fd, mesg);
+                    
+                    if(g_statistics_detailed)
+                    {
+                        server_statistics_answer(server_statistics_local(), mesg, query_start);
+                    }
+                    
                     server_statistics.udp_fp[mesg->status]++;
                 }
                 else
@@ -561,6 +579,7 @@ server_st_process_udp(database_t *database, udp *udp_itf)
 static u64 server_run_loop_rate_tick         = 0;
 static u64 server_run_loop_rate_count        = 0;
 static s32 server_run_loop_timeout_countdown = 0;
+static server_statistics_t server_statistics_sum; /* the global counters plus the ones of the TCP threads */
 
 ya_result
 server_st_query_loop()
@@ -596,6 +615,10 @@ server_st_query_loop()
         case 3:
             log_query = log_query_both;
             break;
+        case 4:
+            log_query = log_query_none;
+            log_answer = log_query_binary;
+            break;
         default:
             log_query = log_query_none;
             break;
@@ -862,7 +885,12 @@ server_st_query_loop()
                     /* log_info specifically targeted to the g_statistics_logger handle */
 
                     server_statistics.loop_rate_elapsed = delta;
-                    log_statistics(&server_statistics);
+                    
+                    server_statistics_aggregate(&server_statistics_sum);
+                    
+                    log_statistics(&server_statistics_sum);
+                    
+                    server_statistics_snapshot(&server_statistics_sum);
 
                     /*print_payload(termout, mesg.buffer, 30);*/
                     server_run_loop_rate_tick = now;
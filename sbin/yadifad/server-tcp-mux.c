@@ -0,0 +1,1568 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/**
+ *  @defgroup server Server
+ *  @ingroup yadifad
+ *  @brief Event-driven TCP front end
+ *
+ *  The listening sockets are still watched by the main loop.
+ *  Each accepted connection is given, through a pipe, to one of the multiplexer threads.
+ *
+ *  A multiplexer thread waits for the events of its connections with epoll.
+ *  _ It reads as much as the socket gives and answers every complete query found in the input.
+ *  _ It writes the answers without blocking.  What could not be written is queued until the socket is writable.
+ *  _ It stops reading from a connection that does not read its answers.
+ *  _ It closes the connections that did not complete a message for tcp-idle-timeout seconds.
+ *
+ *  Updates are given to the thread pool.  The answer comes back through the pipe and is sent when it arrives,
+ *  which can be after the answers of queries received later on the same connection (RFC 7766 6.2.1.1).
+ *
+ *  AXFR and IXFR take the connection: it is removed from the multiplexer and given to the thread pool.
+ *
+ * @{
+ */
+/*----------------------------------------------------------------------------*/
+
+#define SERVER_TCP_MUX_C_
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define TCP_MUX_HAS_EPOLL 1
+#else
+#define TCP_MUX_HAS_EPOLL 0
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+/** @note: here we define the variable that is holding the default logger handle for the current source file
+ *         Such a handle should NEVER been set in an include file.
+ */
+
+#define MODULE_MSG_HANDLE g_server_logger
+
+#include <dnscore/logger.h>
+#include <dnscore/fdtools.h>
+#include <dnscore/tcp_io_stream.h>
+#include <dnscore/message.h>
+#include <dnscore/thread_pool.h>
+#include <dnscore/timems.h>
+
+#include "server-tcp-mux.h"
+
+#include "signals.h"
+#include "log_query.h"
+#include "server_statistics.h"
+#include "axfr.h"
+#include "ixfr.h"
+#include "process_class_ch.h"
+#include "notify.h"
+
+#define TCPMUXTH_TAG 0x485458554d504354
+#define TCPMUXCN_TAG 0x4e4358554d504354
+#define TCPMUXIN_TAG 0x4e4958554d504354
+#define TCPMUXOQ_TAG 0x514f58554d504354
+#define TCPMUXJB_TAG 0x424a58554d504354
+#define MESGDATA_TAG 0x415441444753454d
+
+/**
+ * The input buffer of a connection starts with this size and grows up to the biggest message it has to hold.
+ */
+
+#define TCP_MUX_INPUT_SIZE          1024
+
+/**
+ * A connection is not read anymore while more than this amount of answer bytes are waiting to be written.
+ */
+
+#define TCP_MUX_OUTPUT_MAX          0x40000
+
+#define TCP_MUX_EVENTS_MAX          256
+
+/**
+ * At shutdown, the period (in seconds) at which the updates still being processed are reported while they are waited for.
+ */
+
+#define TCP_MUX_SHUTDOWN_REPORT_PERIOD 5
+
+#define TCP_MUX_EVENT_CONNECTION    1
+#define TCP_MUX_EVENT_ANSWER        2
+
+/* what to do with a connection after a message has been processed */
+
+#define TCP_MUX_CONTINUE            0
+#define TCP_MUX_CLOSE               1
+#define TCP_MUX_DETACHED            2
+
+#if TCP_MUX_HAS_EPOLL
+
+typedef struct tcp_mux_output tcp_mux_output;
+
+struct tcp_mux_output
+{
+    tcp_mux_output *next;
+    u32 size;
+    u32 offset;
+    u8 data[];
+};
+
+typedef struct tcp_mux_connection tcp_mux_connection;
+
+struct tcp_mux_connection
+{
+    /* idle list, least recently active first */
+    tcp_mux_connection *prev;
+    tcp_mux_connection *next;
+    
+    tcp_mux_output *output_head;
+    tcp_mux_output *output_tail;
+    u8 *input;
+    u32 input_size;
+    u32 input_length;
+    u32 output_pending;         /* bytes queued for writing */
+    u32 events;                 /* epoll events currently registered */
+    s32 jobs;                   /* updates being processed for this connection */
+    time_t last_activity;
+    int sockfd;                 /* -1 once closed or detached */
+    int svr_sockfd;
+    bool eof;                   /* the client will not send anything anymore */
+    
+    socketaddress sa;
+    socklen_t addr_len;
+};
+
+typedef struct tcp_mux_thread tcp_mux_thread;
+
+struct tcp_mux_thread
+{
+    tcp_mux_connection idle;    /* sentinel of the idle list */
+    tcp_mux_connection *released; /* connections to free once the current epoll batch is done */
+    message_data *mesg;
+    u32 connection_count;
+    s32 jobs;
+    int epfd;
+    int pipefd[2];
+};
+
+typedef struct tcp_mux_event tcp_mux_event;
+
+struct tcp_mux_event
+{
+    u32 type;
+    void *data;
+};
+
+typedef struct tcp_mux_job tcp_mux_job;
+
+struct tcp_mux_job
+{
+    tcp_mux_thread *thread;
+    tcp_mux_connection *connection;
+    message_data *mesg;
+    tcp_mux_output *output;     /* AXFR/IXFR: answers to write before handing the connection */
+    finger_print return_code;
+};
+
+static database_t *tcp_mux_database = NULL;
+static tcp_mux_thread *tcp_mux_threads = NULL;
+static u32 tcp_mux_thread_count = 0;
+static u32 tcp_mux_next_thread = 0;
+static volatile s32 tcp_mux_connections = 0;
+static volatile bool tcp_mux_stopping = FALSE;
+
+static pthread_mutex_t tcp_mux_running_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tcp_mux_running_cond = PTHREAD_COND_INITIALIZER;
+static u32 tcp_mux_running = 0;
+
+/*******************************************************************************************************************
+ *
+ * Connections
+ *
+ ******************************************************************************************************************/
+
+static void
+tcp_mux_post(tcp_mux_thread *t, u32 type, void *data)
+{
+    tcp_mux_event event;
+    event.type = type;
+    event.data = data;
+    
+    /* sizeof(event) < PIPE_BUF : the write is atomic */
+    
+    while(write(t->pipefd[1], &event, sizeof(event)) < 0)
+    {
+        int err = errno;
+        
+        if(err != EINTR)
+        {
+            log_err("tcp: mux: cannot post event: %r", MAKE_ERRNO_ERROR(err));
+            break;
+        }
+    }
+}
+
+static void
+tcp_mux_idle_remove(tcp_mux_connection *c)
+{
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    c->prev = c;
+    c->next = c;
+}
+
+static void
+tcp_mux_idle_touch(tcp_mux_thread *t, tcp_mux_connection *c, time_t now)
+{
+    tcp_mux_idle_remove(c);
+    
+    c->last_activity = now;
+    c->prev = t->idle.prev;
+    c->next = &t->idle;
+    t->idle.prev->next = c;
+    t->idle.prev = c;
+}
+
+static void
+tcp_mux_output_free(tcp_mux_output *o)
+{
+    while(o != NULL)
+    {
+        tcp_mux_output *next = o->next;
+        free(o);
+        o = next;
+    }
+}
+
+/**
+ * Registers the events the connection has to wait for:
+ * input unless the client stopped sending or is not reading its answers, output if answers are queued.
+ */
+
+static void
+tcp_mux_connection_update_events(tcp_mux_thread *t, tcp_mux_connection *c)
+{
+    u32 events = 0;
+    
+    if(!c->eof && (c->output_pending < TCP_MUX_OUTPUT_MAX))
+    {
+        events |= EPOLLIN;
+    }
+    
+    if(c->output_head != NULL)
+    {
+        events |= EPOLLOUT;
+    }
+    
+    if(events != c->events)
+    {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = c;
+        
+        if(epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->sockfd, &ev) < 0)
+        {
+            log_err("tcp: mux: cannot update events of socket %i: %r", c->sockfd, ERRNO_ERROR);
+        }
+        
+        c->events = events;
+    }
+}
+
+/**
+ * The connection may still be referenced by a later entry of the current epoll batch,
+ * so it is only queued here and freed by tcp_mux_thread_free_released.
+ */
+
+static void
+tcp_mux_connection_free_if_unused(tcp_mux_thread *t, tcp_mux_connection *c)
+{
+    if((c->sockfd < 0) && (c->jobs == 0))
+    {
+        c->next = t->released;
+        t->released = c;
+    }
+}
+
+static void
+tcp_mux_thread_free_released(tcp_mux_thread *t)
+{
+    tcp_mux_connection *c = t->released;
+    
+    while(c != NULL)
+    {
+        tcp_mux_connection *next = c->next;
+        free(c);
+        c = next;
+    }
+    
+    t->released = NULL;
+}
+
+/**
+ * Removes the connection from the thread.
+ * The connection is freed unless an update is still being processed for it.
+ */
+
+static void
+tcp_mux_connection_release(tcp_mux_thread *t, tcp_mux_connection *c)
+{
+    epoll_ctl(t->epfd, EPOLL_CTL_DEL, c->sockfd, NULL);
+    
+    tcp_mux_idle_remove(c);
+    
+    tcp_mux_output_free(c->output_head);
+    c->output_head = NULL;
+    c->output_tail = NULL;
+    c->output_pending = 0;
+    
+    free(c->input);
+    c->input = NULL;
+    
+    c->sockfd = -1;
+    
+    t->connection_count--;
+    __sync_fetch_and_sub(&tcp_mux_connections, 1);
+    
+    tcp_mux_connection_free_if_unused(t, c);
+}
+
+static void
+tcp_mux_connection_close(tcp_mux_thread *t, tcp_mux_connection *c, bool abortive)
+{
+#ifndef NDEBUG
+    log_debug("tcp: mux: closing socket %i", c->sockfd);
+#endif
+    
+    int sockfd = c->sockfd;
+    
+    if(abortive)
+    {
+        tcp_set_abortive_close(sockfd);
+    }
+    
+    tcp_mux_connection_release(t, c);
+    
+    close_ex(sockfd);
+}
+
+/**
+ * Writes as much of the queued answers as the socket accepts.
+ * 
+ * @return FALSE if the connection has been closed
+ */
+
+static bool
+tcp_mux_connection_flush(tcp_mux_thread *t, tcp_mux_connection *c)
+{
+    tcp_mux_output *o;
+    
+    while((o = c->output_head) != NULL)
+    {
+        ssize_t n = write(c->sockfd, &o->data[o->offset], o->size - o->offset);
+        
+        if(n < 0)
+        {
+            int err = errno;
+            
+            if(err == EINTR)
+            {
+                continue;
+            }
+            
+            if(err == EAGAIN || err == EWOULDBLOCK)
+            {
+                break;
+            }
+            
+            log_err("tcp write error: %r", MAKE_ERRNO_ERROR(err));
+            
+            tcp_mux_connection_close(t, c, TRUE);
+            
+            return FALSE;
+        }
+        
+        o->offset += n;
+        c->output_pending -= n;
+        
+        if(o->offset < o->size)
+        {
+            break;
+        }
+        
+        c->output_head = o->next;
+        
+        free(o);
+    }
+    
+    if(c->output_head == NULL)
+    {
+        c->output_tail = NULL;
+    }
+    
+    return TRUE;
+}
+
+/**
+ * Sends the answer in the message.
+ * If the socket does not take it all at once, the remaining bytes are queued.
+ * 
+ * @return FALSE if the connection has been closed
+ */
+
+static bool
+tcp_mux_connection_send(tcp_mux_thread *t, tcp_mux_connection *c, message_data *mesg)
+{
+#if !defined(HAS_DROPALL_SUPPORT)
+    u32 size = mesg->send_length + 2;
+    u32 offset = 0;
+    
+    mesg->buffer_tcp_len[0] = (mesg->send_length >> 8);
+    mesg->buffer_tcp_len[1] = (mesg->send_length);
+    
+    if(c->output_head == NULL)
+    {
+        while(offset < size)
+        {
+            ssize_t n = write(c->sockfd, &mesg->buffer_tcp_len[offset], size - offset);
+            
+            if(n < 0)
+            {
+                int err = errno;
+                
+                if(err == EINTR)
+                {
+                    continue;
+                }
+                
+                if(err == EAGAIN || err == EWOULDBLOCK)
+                {
+                    break;
+                }
+                
+                log_err("tcp write error: %r", MAKE_ERRNO_ERROR(err));
+                
+                tcp_mux_connection_close(t, c, TRUE);
+                
+                return FALSE;
+            }
+            
+            offset += n;
+        }
+    }
+    
+    if(offset < size)
+    {
+        tcp_mux_output *o;
+        
+        MALLOC_OR_DIE(tcp_mux_output*, o, sizeof(tcp_mux_output) + size - offset, TCPMUXOQ_TAG);
+        o->next = NULL;
+        o->size = size - offset;
+        o->offset = 0;
+        memcpy(o->data, &mesg->buffer_tcp_len[offset], size - offset);
+        
+        if(c->output_tail != NULL)
+        {
+            c->output_tail->next = o;
+        }
+        else
+        {
+            c->output_head = o;
+        }
+        
+        c->output_tail = o;
+        c->output_pending += size - offset;
+    }
+#endif
+    
+    TCPSTATS(tcp_output_size_total += mesg->send_length);
+    
+    return TRUE;
+}
+
+/*******************************************************************************************************************
+ *
+ * Jobs
+ *
+ ******************************************************************************************************************/
+
+static void*
+tcp_mux_update_thread(void *parms_)
+{
+    tcp_mux_job *job = (tcp_mux_job*)parms_;
+    message_data *mesg = job->mesg;
+    
+    log_info("update (%04hx) %{dnsname} %{dnstype} (%{sockaddr})",
+            ntohs(MESSAGE_ID(mesg->buffer)),
+            mesg->qname,
+            &mesg->qtype,
+            &mesg->other.sa);
+    
+    job->return_code = database_delegate_update(tcp_mux_database, mesg);
+    
+    tcp_mux_post(job->thread, TCP_MUX_EVENT_ANSWER, job);
+    
+    return NULL;
+}
+
+/**
+ * The connection has been detached from the multiplexer.
+ * Writes the answers still queued for it then processes the transfer.
+ */
+
+static void*
+tcp_mux_xfr_thread(void *parms_)
+{
+    tcp_mux_job *job = (tcp_mux_job*)parms_;
+    message_data *mesg = job->mesg;
+    tcp_mux_output *o;
+    bool ok = TRUE;
+    
+    for(o = job->output; o != NULL; o = o->next)
+    {
+        ssize_t n = writefully_limited(mesg->sockfd, &o->data[o->offset], o->size - o->offset, g_config->tcp_query_min_rate_us);
+        
+        if(FAIL(n))
+        {
+            log_err("tcp write error: %r", (ya_result)n);
+            
+            ok = FALSE;
+            
+            break;
+        }
+    }
+    
+    tcp_mux_output_free(job->output);
+    
+    if(ok)
+    {
+        if(mesg->qtype == TYPE_AXFR)
+        {
+            axfr_process(mesg); /* AXFR PROCESSING: process then closes: all in background */
+        }
+        else
+        {
+            ixfr_process(mesg); /* IXFR PROCESSING: process then closes: all in background */
+        }
+    }
+    else
+    {
+        tcp_set_abortive_close(mesg->sockfd);
+        close_ex(mesg->sockfd);
+    }
+    
+    free(mesg);
+    free(job);
+    
+    return NULL;
+}
+
+static void
+tcp_mux_answer(tcp_mux_thread *t, tcp_mux_job *job)
+{
+    tcp_mux_connection *c = job->connection;
+    message_data *mesg = job->mesg;
+    
+    c->jobs--;
+    t->jobs--;
+    
+    if(c->sockfd >= 0)
+    {
+        bool alive = TRUE;
+        
+        if(ISOK(job->return_code))
+        {
+            TCPSTATS(tcp_fp[mesg->status]++);
+            
+            alive = tcp_mux_connection_send(t, c, mesg);
+        }
+        
+        if(alive)
+        {
+            if(c->eof && (c->output_head == NULL) && (c->jobs == 0))
+            {
+                tcp_mux_connection_close(t, c, FALSE);
+            }
+            else
+            {
+                tcp_mux_connection_update_events(t, c);
+            }
+        }
+    }
+    else
+    {
+        tcp_mux_connection_free_if_unused(t, c);
+    }
+    
+    free(mesg);
+    free(job);
+}
+
+static tcp_mux_job*
+tcp_mux_job_new(tcp_mux_thread *t, tcp_mux_connection *c, message_data *mesg)
+{
+    tcp_mux_job *job;
+    message_data *mesg_clone;
+    
+    MALLOC_OR_DIE(tcp_mux_job*, job, sizeof(tcp_mux_job), TCPMUXJB_TAG);
+    MALLOC_OR_DIE(message_data*, mesg_clone, sizeof(message_data), MESGDATA_TAG);
+    memcpy(mesg_clone, mesg, sizeof(message_data));
+    mesg->tsig.tsig = NULL;
+    
+    job->thread = t;
+    job->connection = c;
+    job->mesg = mesg_clone;
+    job->output = NULL;
+    job->return_code = SUCCESS;
+    
+    return job;
+}
+
+/**
+ * Gives the connection to a thread of the pool that will write the queued answers then process the transfer.
+ */
+
+static void
+tcp_mux_connection_detach_xfr(tcp_mux_thread *t, tcp_mux_connection *c, message_data *mesg)
+{
+    tcp_mux_job *job = tcp_mux_job_new(t, c, mesg);
+    int sockfd = c->sockfd;
+    
+    job->output = c->output_head;
+    c->output_head = NULL;
+    c->output_tail = NULL;
+    c->output_pending = 0;
+    
+    tcp_mux_connection_release(t, c);
+    
+    /* the transfer code expects a blocking socket */
+    
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    fcntl(sockfd, F_SETFL, flags & ~O_NONBLOCK);
+    
+    job->connection = NULL;
+    job->mesg->sockfd = sockfd;
+    
+    if(FAIL(thread_pool_schedule_job(tcp_mux_xfr_thread, job, NULL, "tcp_mux_xfr_thread")))
+    {
+        tcp_mux_output_free(job->output);
+        free(job->mesg);
+        free(job);
+        close_ex(sockfd);
+    }
+}
+
+static void
+tcp_mux_connection_update(tcp_mux_thread *t, tcp_mux_connection *c, message_data *mesg)
+{
+    tcp_mux_job *job = tcp_mux_job_new(t, c, mesg);
+    
+    c->jobs++;
+    t->jobs++;
+    
+    if(FAIL(thread_pool_schedule_job(tcp_mux_update_thread, job, NULL, "tcp_mux_update_thread")))
+    {
+        c->jobs--;
+        t->jobs--;
+        free(job->mesg);
+        free(job);
+    }
+}
+
+/*******************************************************************************************************************
+ *
+ * Messages
+ *
+ ******************************************************************************************************************/
+
+/**
+ * Processes one message read from the connection.
+ * 
+ * @return TCP_MUX_CONTINUE, TCP_MUX_CLOSE or TCP_MUX_DETACHED
+ */
+
+static int
+tcp_mux_connection_process_message(tcp_mux_thread *t, tcp_mux_connection *c, const u8 *buffer, u16 size)
+{
+    message_data *mesg = t->mesg;
+    ya_result return_code;
+    
+    mesg->sockfd = c->sockfd;
+    mesg->process_flags = ~0; /** @todo FIX ME */
+    memcpy(&mesg->other, &c->sa, c->addr_len);
+    mesg->addr_len = c->addr_len;
+    mesg->protocol = IPPROTO_TCP;
+    memcpy(mesg->buffer, buffer, size);
+    mesg->received = size;
+    
+    u64 query_start = (g_statistics_detailed)?timeus():0;
+    
+    if(FAIL(return_code = message_process(mesg)))
+    {
+        log_warn("query [%04hx] error %i : %r", ntohs(MESSAGE_ID(mesg->buffer)), mesg->status, return_code);
+        
+        TCPSTATS(tcp_fp[mesg->status]++);
+        
+        if( (return_code != INVALID_MESSAGE) && (((g_config->server_flags & SERVER_FL_ANSWER_FORMERR) != 0) || mesg->status != RCODE_FORMERR) && (MESSAGE_QR(mesg->buffer) == 0) )
+        {
+            message_transform_to_error(mesg);
+            
+            return (tcp_mux_connection_send(t, c, mesg))?TCP_MUX_CONTINUE:TCP_MUX_DETACHED;
+        }
+        
+        TCPSTATS(tcp_dropped_count++);
+        
+        return TCP_MUX_CLOSE;
+    }
+    
+    mesg->size_limit = DNSPACKET_MAX_LENGTH;
+    
+    switch(mesg->qclass)
+    {
+        case CLASS_IN:
+        {
+            switch(MESSAGE_OP(mesg->buffer))
+            {
+                case OPCODE_QUERY:
+                {
+                    log_query(c->svr_sockfd, mesg);
+                    
+                    if((mesg->qtype == TYPE_AXFR) || (mesg->qtype == TYPE_IXFR))
+                    {
+                        if(mesg->qtype == TYPE_AXFR)
+                        {
+                            TCPSTATS(tcp_axfr_count++);
+                        }
+                        else
+                        {
+                            TCPSTATS(tcp_ixfr_count++);
+                        }
+                        
+                        log_answer(c->svr_sockfd, mesg);
+                        
+                        tcp_mux_connection_detach_xfr(t, c, mesg);
+                        
+                        return TCP_MUX_DETACHED;
+                    }
+                    
+                    TCPSTATS(tcp_queries_count++);
+                    
+                    database_query(tcp_mux_database, mesg);
+                    
+                    log_answer(c->svr_sockfd, mesg);
+                    
+                    if(g_statistics_detailed)
+                    {
+                        server_statistics_answer(server_statistics_local(), mesg, query_start);
+                    }
+                    
+                    if(!tcp_mux_connection_send(t, c, mesg))
+                    {
+                        return TCP_MUX_DETACHED;
+                    }
+                    
+                    TCPSTATS(tcp_referrals_count += mesg->referral);
+                    TCPSTATS(tcp_fp[mesg->status]++);
+                    
+                    return TCP_MUX_CONTINUE;
+                }
+                case OPCODE_NOTIFY:
+                {
+                    TCPSTATS(tcp_notify_input_count++);
+                    
+                    log_info("notify (%04hx) %{dnsname} (%{sockaddr})",
+                            ntohs(MESSAGE_ID(mesg->buffer)),
+                            mesg->qname,
+                            &mesg->other.sa);
+                    
+                    bool answer = MESSAGE_QR(mesg->buffer);
+                    return_code = notify_process(tcp_mux_database, mesg); // thread-safe
+                    
+                    TCPSTATS(tcp_fp[mesg->status]++);
+                    
+                    if(answer)
+                    {
+                        if(FAIL(return_code))
+                        {
+                            log_err("notify (%04hx) %{dnsname} failed : %r",
+                                    ntohs(MESSAGE_ID(mesg->buffer)),
+                                    mesg->qname,
+                                    return_code);
+                        }
+                        
+                        return TCP_MUX_CONTINUE;
+                    }
+                    
+                    if(FAIL(return_code))
+                    {
+                        log_err("notify (%04hx) %{dnsname} failed : %r",
+                                ntohs(MESSAGE_ID(mesg->buffer)),
+                                mesg->qname,
+                                return_code);
+                        
+                        message_transform_to_error(mesg);
+                    }
+                    
+                    /* notify_process has prepared the answer, it is sent on the connection */
+                    
+                    break;
+                }
+                case OPCODE_UPDATE:
+                {
+                    TCPSTATS(tcp_updates_count++);
+                    
+                    tcp_mux_connection_update(t, c, mesg);
+                    
+                    return TCP_MUX_CONTINUE;
+                }
+                default:
+                {
+                    TCPSTATS(tcp_undefined_count++);
+                    
+                    log_warn("query (%04hx) Unhandled opcode %i (%{sockaddrip})", ntohs(MESSAGE_ID(mesg->buffer)), (MESSAGE_OP(mesg->buffer) & OPCODE_BITS) >> 3, &mesg->other.sa);
+                    
+                    message_make_error(mesg, FP_NOT_SUPP_OPC);
+                    TCPSTATS(tcp_fp[FP_NOT_SUPP_OPC]++);
+                    
+                    break;
+                }
+            }   /* switch opcode */
+            
+            break;
+        }
+        case CLASS_CH:
+        {
+            if(MESSAGE_OP(mesg->buffer) == OPCODE_QUERY)
+            {
+                log_query(c->svr_sockfd, mesg);
+                
+                process_class_ch(mesg);
+                
+                log_answer(c->svr_sockfd, mesg);
+                
+                if(g_statistics_detailed)
+                {
+                    server_statistics_answer(server_statistics_local(), mesg, query_start);
+                }
+                
+                TCPSTATS(tcp_fp[mesg->status]++);
+            }
+            else
+            {
+                log_warn("query [%04hx] %{dnsname} %{dnstype} CH (%{sockaddrip}) : unsupported operation %x",
+                        ntohs(MESSAGE_ID(mesg->buffer)),
+                        mesg->qname, &mesg->qtype,
+                        &mesg->other.sa, MESSAGE_OP(mesg->buffer));
+                
+                message_make_error(mesg, FP_NOT_SUPP_OPC);
+                TCPSTATS(tcp_fp[FP_NOT_SUPP_OPC]++);
+            }
+            
+            break;
+        }
+        default:
+        {
+            log_warn("query [%04hx] %{dnsname} %{dnstype} %{dnsclass} (%{sockaddrip}) : unsupported class",
+                    ntohs(MESSAGE_ID(mesg->buffer)),
+                    mesg->qname, &mesg->qtype, &mesg->qclass,
+                    &mesg->other.sa);
+            
+            mesg->status = FP_CLASS_NOTFOUND;
+            message_transform_to_error(mesg);
+            TCPSTATS(tcp_fp[FP_CLASS_NOTFOUND]++);
+            
+            break;
+        }
+    } /* switch class */
+    
+    return (tcp_mux_connection_send(t, c, mesg))?TCP_MUX_CONTINUE:TCP_MUX_DETACHED;
+}
+
+/**
+ * Processes all the complete messages of the input buffer.
+ * Stops early if the client does not read its answers.
+ * 
+ * @return FALSE if the connection has been closed or detached
+ */
+
+static bool
+tcp_mux_connection_process_input(tcp_mux_thread *t, tcp_mux_connection *c, time_t now)
+{
+    u8 *p = c->input;
+    u32 n = c->input_length;
+    
+    while((n >= 2) && (c->output_pending < TCP_MUX_OUTPUT_MAX))
+    {
+        u16 size = (((u16)p[0]) << 8) | p[1];
+        
+        if(size == 0)
+        {
+            log_err("tcp: message size is 0");
+            
+            tcp_mux_connection_close(t, c, TRUE);
+            
+            return FALSE;
+        }
+        
+        if(n < (u32)size + 2)
+        {
+            break;
+        }
+        
+        switch(tcp_mux_connection_process_message(t, c, &p[2], size))
+        {
+            case TCP_MUX_CONTINUE:
+            {
+                break;
+            }
+            case TCP_MUX_CLOSE:
+            {
+                tcp_mux_connection_close(t, c, TRUE);
+                
+                return FALSE;
+            }
+            default: /* TCP_MUX_DETACHED */
+            {
+                return FALSE;
+            }
+        }
+        
+        tcp_mux_idle_touch(t, c, now);
+        
+        p += size + 2;
+        n -= size + 2;
+    }
+    
+    if(p != c->input)
+    {
+        memmove(c->input, p, n);
+        c->input_length = n;
+    }
+    
+    /* make room for the next message if it does not fit */
+    
+    if(n >= 2)
+    {
+        u32 needed = ((((u32)c->input[0]) << 8) | c->input[1]) + 2;
+        
+        if(needed > c->input_size)
+        {
+            u8 *input;
+            MALLOC_OR_DIE(u8*, input, needed, TCPMUXIN_TAG);
+            memcpy(input, c->input, n);
+            free(c->input);
+            c->input = input;
+            c->input_size = needed;
+        }
+    }
+    
+    if(c->eof && (c->output_head == NULL) && (c->jobs == 0))
+    {
+        tcp_mux_connection_close(t, c, FALSE);
+        
+        return FALSE;
+    }
+    
+    tcp_mux_connection_update_events(t, c);
+    
+    return TRUE;
+}
+
+static void
+tcp_mux_connection_read(tcp_mux_thread *t, tcp_mux_connection *c, time_t now)
+{
+    ssize_t n;
+    
+    if(c->input_length == c->input_size)
+    {
+        /* nothing can be read before some of the input is processed */
+        
+        tcp_mux_connection_process_input(t, c, now);
+        
+        return;
+    }
+    
+    while((n = read(c->sockfd, &c->input[c->input_length], c->input_size - c->input_length)) < 0)
+    {
+        int err = errno;
+        
+        if(err == EINTR)
+        {
+            continue;
+        }
+        
+        if(err == EAGAIN || err == EWOULDBLOCK)
+        {
+            return;
+        }
+        
+        log_info("tcp: read error: %r", MAKE_ERRNO_ERROR(err));
+        
+        tcp_mux_connection_close(t, c, TRUE);
+        
+        return;
+    }
+    
+    if(n == 0)
+    {
+        /* the client will not send anymore, the pending answers can still be sent */
+        
+        c->eof = TRUE;
+        
+        if(c->input_length != 0)
+        {
+            log_info("tcp: incomplete message of %u bytes at end of stream", c->input_length);
+            
+            c->input_length = 0;
+        }
+    }
+    
+    c->input_length += n;
+    
+    tcp_mux_connection_process_input(t, c, now);
+}
+
+static void
+tcp_mux_connection_add(tcp_mux_thread *t, tcp_mux_connection *c, time_t now)
+{
+    struct epoll_event ev;
+    
+    MALLOC_OR_DIE(u8*, c->input, TCP_MUX_INPUT_SIZE, TCPMUXIN_TAG);
+    c->input_size = TCP_MUX_INPUT_SIZE;
+    c->prev = c;
+    c->next = c;
+    c->events = EPOLLIN;
+    
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    
+    if(epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->sockfd, &ev) < 0)
+    {
+        log_err("tcp: mux: cannot watch socket %i: %r", c->sockfd, ERRNO_ERROR);
+        
+        close_ex(c->sockfd);
+        free(c->input);
+        free(c);
+        
+        __sync_fetch_and_sub(&tcp_mux_connections, 1);
+        
+        return;
+    }
+    
+    t->connection_count++;
+    
+    tcp_mux_idle_touch(t, c, now);
+}
+
+/*******************************************************************************************************************
+ *
+ * Threads
+ *
+ ******************************************************************************************************************/
+
+static void
+tcp_mux_thread_read_events(tcp_mux_thread *t, time_t now)
+{
+    tcp_mux_event events[32];
+    ssize_t n;
+    
+    for(;;)
+    {
+        n = read(t->pipefd[0], events, sizeof(events));
+        
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            
+            break;
+        }
+        
+        n /= sizeof(tcp_mux_event);
+        
+        for(ssize_t i = 0; i < n; i++)
+        {
+            switch(events[i].type)
+            {
+                case TCP_MUX_EVENT_CONNECTION:
+                {
+                    tcp_mux_connection_add(t, (tcp_mux_connection*)events[i].data, now);
+                    break;
+                }
+                case TCP_MUX_EVENT_ANSWER:
+                {
+                    tcp_mux_answer(t, (tcp_mux_job*)events[i].data);
+                    break;
+                }
+            }
+        }
+        
+        if(n < (ssize_t)(sizeof(events) / sizeof(tcp_mux_event)))
+        {
+            break;
+        }
+    }
+}
+
+static void
+tcp_mux_thread_expire(tcp_mux_thread *t, time_t now)
+{
+    time_t limit = now - g_config->tcp_idle_timeout;
+    
+    tcp_mux_connection *c;
+    
+    while(((c = t->idle.next) != &t->idle) && (c->last_activity <= limit))
+    {
+        if(c->jobs > 0)
+        {
+            /* an answer is being computed */
+            
+            tcp_mux_idle_touch(t, c, now);
+            
+            continue;
+        }
+        
+        log_info("tcp: closing idle connection %{sockaddr}", &c->sa.sa);
+        
+        tcp_mux_connection_close(t, c, FALSE);
+    }
+}
+
+static void*
+tcp_mux_thread_loop(void *parms_)
+{
+    tcp_mux_thread *t = (tcp_mux_thread*)parms_;
+    struct epoll_event events[TCP_MUX_EVENTS_MAX];
+    time_t previous = 0;
+    
+    log_debug("tcp: mux: thread started");
+    
+    while(!tcp_mux_stopping && (program_mode != SA_SHUTDOWN))
+    {
+        int n = epoll_wait(t->epfd, events, TCP_MUX_EVENTS_MAX, 1000);
+        
+        if(n < 0)
+        {
+            int err = errno;
+            
+            if(err != EINTR)
+            {
+                log_err("tcp: mux: epoll_wait: %r", MAKE_ERRNO_ERROR(err));
+                
+                break;
+            }
+            
+            continue;
+        }
+        
+        time_t now = time(NULL);
+        
+        for(int i = 0; i < n; i++)
+        {
+            tcp_mux_connection *c = (tcp_mux_connection*)events[i].data.ptr;
+            
+            if(c == NULL)
+            {
+                tcp_mux_thread_read_events(t, now);
+                
+                continue;
+            }
+            
+            if(c->sockfd < 0)
+            {
+                /* closed or detached by an earlier event of this batch */
+                
+                continue;
+            }
+            
+            if((events[i].events & EPOLLOUT) != 0)
+            {
+                if(!tcp_mux_connection_flush(t, c))
+                {
+                    continue;
+                }
+                
+                tcp_mux_idle_touch(t, c, now);
+                
+                if(c->output_pending < TCP_MUX_OUTPUT_MAX)
+                {
+                    /* reading may have been suspended: process what has already been read */
+                    
+                    if(!tcp_mux_connection_process_input(t, c, now))
+                    {
+                        continue;
+                    }
+                }
+            }
+            
+            if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+            {
+                if((events[i].events & EPOLLERR) != 0)
+                {
+                    tcp_mux_connection_close(t, c, TRUE);
+                    
+                    continue;
+                }
+                
+                if((c->events & EPOLLIN) != 0)
+                {
+                    tcp_mux_connection_read(t, c, now);
+                }
+                else if((events[i].events & EPOLLHUP) != 0)
+                {
+                    tcp_mux_connection_close(t, c, TRUE);
+                }
+            }
+        }
+        
+        if(now != previous)
+        {
+            tcp_mux_thread_expire(t, now);
+            
+            previous = now;
+        }
+        
+        tcp_mux_thread_free_released(t);
+    }
+    
+    log_debug("tcp: mux: thread stopping");
+    
+    /* close everything */
+    
+    while(t->idle.next != &t->idle)
+    {
+        tcp_mux_connection_close(t, t->idle.next, FALSE);
+    }
+    
+    /*
+     * Collect the updates that are still running : they will post their answer to this thread,
+     * so it cannot be released before the last one is back.
+     */
+    
+    time_t report = time(NULL) + TCP_MUX_SHUTDOWN_REPORT_PERIOD;
+    
+    while(t->jobs > 0)
+    {
+        if(epoll_wait(t->epfd, events, 1, 1000) > 0)
+        {
+            tcp_mux_thread_read_events(t, time(NULL));
+        }
+        
+        /* a connection handed to the thread in the mean time */
+        
+        while(t->idle.next != &t->idle)
+        {
+            tcp_mux_connection_close(t, t->idle.next, FALSE);
+        }
+        
+        tcp_mux_thread_free_released(t);
+        
+        time_t now = time(NULL);
+        
+        if((t->jobs > 0) && (now >= report))
+        {
+            log_warn("tcp: mux: waiting for %i updates still running", t->jobs);
+            
+            report = now + TCP_MUX_SHUTDOWN_REPORT_PERIOD;
+        }
+    }
+    
+    tcp_mux_thread_free_released(t);
+    
+    pthread_mutex_lock(&tcp_mux_running_mtx);
+    tcp_mux_running--;
+    pthread_cond_broadcast(&tcp_mux_running_cond);
+    pthread_mutex_unlock(&tcp_mux_running_mtx);
+    
+    return NULL;
+}
+
+static void
+tcp_mux_thread_finalize(tcp_mux_thread *t)
+{
+    free(t->mesg);
+    t->mesg = NULL;
+    
+    if(t->epfd >= 0)
+    {
+        close_ex(t->epfd);
+        t->epfd = -1;
+    }
+    
+    /* the loop only returns once all the updates have posted their answer */
+    
+    if(t->pipefd[0] >= 0)
+    {
+        close_ex(t->pipefd[0]);
+        close_ex(t->pipefd[1]);
+    }
+    
+    t->pipefd[0] = -1;
+    t->pipefd[1] = -1;
+}
+
+static ya_result
+tcp_mux_thread_init(tcp_mux_thread *t)
+{
+    struct epoll_event ev;
+    
+    ZEROMEMORY(t, sizeof(tcp_mux_thread));
+    t->idle.prev = &t->idle;
+    t->idle.next = &t->idle;
+    t->released = NULL;
+    t->epfd = -1;
+    t->pipefd[0] = -1;
+    t->pipefd[1] = -1;
+    
+    if(pipe(t->pipefd) < 0)
+    {
+        t->pipefd[0] = -1;
+        t->pipefd[1] = -1;
+        
+        return ERRNO_ERROR;
+    }
+    
+    int flags = fcntl(t->pipefd[0], F_GETFL, 0);
+    fcntl(t->pipefd[0], F_SETFL, flags | O_NONBLOCK);
+    
+    if((t->epfd = epoll_create(g_config->max_tcp_connections / tcp_mux_thread_count + 1)) < 0)
+    {
+        return ERRNO_ERROR;
+    }
+    
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    
+    if(epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->pipefd[0], &ev) < 0)
+    {
+        return ERRNO_ERROR;
+    }
+    
+    MALLOC_OR_DIE(message_data*, t->mesg, sizeof(message_data), MESGDATA_TAG);
+    
+#ifndef NDEBUG
+    memset(t->mesg, 0xff, sizeof(message_data));
+#endif
+    
+    return SUCCESS;
+}
+
+#endif
+
+/*******************************************************************************************************************
+ *
+ * Interface
+ *
+ ******************************************************************************************************************/
+
+ya_result
+server_tcp_mux_start(database_t *database)
+{
+#if TCP_MUX_HAS_EPOLL
+    ya_result return_code;
+    u32 i;
+    
+    if(tcp_mux_threads != NULL)
+    {
+        return SUCCESS;
+    }
+    
+    tcp_mux_database = database;
+    tcp_mux_thread_count = g_config->tcp_mux_thread_count;
+    tcp_mux_stopping = FALSE;
+    tcp_mux_connections = 0;
+    
+    MALLOC_OR_DIE(tcp_mux_thread*, tcp_mux_threads, sizeof(tcp_mux_thread) * tcp_mux_thread_count, TCPMUXTH_TAG);
+    
+    for(i = 0; i < tcp_mux_thread_count; i++)
+    {
+        if(FAIL(return_code = tcp_mux_thread_init(&tcp_mux_threads[i])))
+        {
+            log_err("tcp: mux: cannot initialise thread #%u: %r", i, return_code);
+            
+            for(u32 j = 0; j <= i; j++)
+            {
+                tcp_mux_thread_finalize(&tcp_mux_threads[j]);
+            }
+            
+            free(tcp_mux_threads);
+            tcp_mux_threads = NULL;
+            
+            return return_code;
+        }
+    }
+    
+    for(i = 0; i < tcp_mux_thread_count; i++)
+    {
+        pthread_mutex_lock(&tcp_mux_running_mtx);
+        tcp_mux_running++;
+        pthread_mutex_unlock(&tcp_mux_running_mtx);
+        
+        if(FAIL(return_code = thread_pool_schedule_job(tcp_mux_thread_loop, &tcp_mux_threads[i], NULL, "tcp_mux_thread_loop")))
+        {
+            log_err("tcp: mux: unable to schedule thread #%u: %r", i, return_code);
+            
+            pthread_mutex_lock(&tcp_mux_running_mtx);
+            tcp_mux_running--;
+            pthread_mutex_unlock(&tcp_mux_running_mtx);
+            
+            /* stops the threads already started and releases all of them */
+            
+            server_tcp_mux_stop();
+            
+            return return_code;
+        }
+    }
+    
+    log_info("tcp: %u threads are handling up to %u connections, closed after %u idle seconds", tcp_mux_thread_count, g_config->max_tcp_connections, g_config->tcp_idle_timeout);
+    
+    return SUCCESS;
+#else
+    return MAKE_ERRNO_ERROR(ENOSYS);
+#endif
+}
+
+void
+server_tcp_mux_stop()
+{
+#if TCP_MUX_HAS_EPOLL
+    if(tcp_mux_threads == NULL)
+    {
+        return;
+    }
+    
+    tcp_mux_stopping = TRUE;
+    
+    pthread_mutex_lock(&tcp_mux_running_mtx);
+    
+    while(tcp_mux_running > 0)
+    {
+        pthread_cond_wait(&tcp_mux_running_cond, &tcp_mux_running_mtx);
+    }
+    
+    pthread_mutex_unlock(&tcp_mux_running_mtx);
+    
+    for(u32 i = 0; i < tcp_mux_thread_count; i++)
+    {
+        tcp_mux_thread_finalize(&tcp_mux_threads[i]);
+    }
+    
+    free(tcp_mux_threads);
+    tcp_mux_threads = NULL;
+    tcp_mux_thread_count = 0;
+#endif
+}
+
+bool
+server_tcp_mux_started()
+{
+#if TCP_MUX_HAS_EPOLL
+    return tcp_mux_threads != NULL;
+#else
+    return FALSE;
+#endif
+}
+
+void
+server_tcp_mux_accept(tcp *tcp_itf)
+{
+#if TCP_MUX_HAS_EPOLL
+    tcp_mux_connection *c;
+    socketaddress addr;
+    socklen_t addr_len = sizeof(addr);
+    int sockfd;
+    
+    /* don't test -1, test < 0 instead (test + js instead of add + stall + jz */
+    while((sockfd = accept(tcp_itf->sockfd, &addr.sa, &addr_len)) < 0)
+    {
+        int err = errno;
+        
+        if(err != EINTR)
+        {
+            log_err("tcp: accept returned %r", MAKE_ERRNO_ERROR(err));
+            
+            return;
+        }
+    }
+    
+    /**
+     * @note the connection is accepted then closed: the listening socket would stay readable otherwise
+     */
+    
+    if(tcp_mux_connections >= g_config->max_tcp_connections)
+    {
+        log_info("tcp: rejecting: already %d/%d handled", tcp_mux_connections, g_config->max_tcp_connections);
+        
+        TCPSTATS(tcp_overflow_count++);
+        
+        close_ex(sockfd);
+        
+        return;
+    }
+    
+    if(addr_len > MAX(sizeof(struct sockaddr_in),sizeof(struct sockaddr_in6)))
+    {
+        log_err("tcp: addr_len = %i, max allowed is %i", addr_len, MAX(sizeof(struct sockaddr_in),sizeof(struct sockaddr_in6)));
+        
+        close_ex(sockfd);
+        
+        return;
+    }
+    
+    TCPSTATS(tcp_input_count++);
+    
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+    
+    MALLOC_OR_DIE(tcp_mux_connection*, c, sizeof(tcp_mux_connection), TCPMUXCN_TAG);
+    ZEROMEMORY(c, sizeof(tcp_mux_connection));
+    memcpy(&c->sa, &addr, addr_len);
+    c->addr_len = addr_len;
+    c->sockfd = sockfd;
+    c->svr_sockfd = tcp_itf->sockfd;
+    
+    __sync_fetch_and_add(&tcp_mux_connections, 1);
+    
+    /* only the main loop accepts: no need to synchronise the round robin */
+    
+    tcp_mux_thread *t = &tcp_mux_threads[tcp_mux_next_thread++ % tcp_mux_thread_count];
+    
+    tcp_mux_post(t, TCP_MUX_EVENT_CONNECTION, c);
+#endif
+}
+
+/** @} */
@@ -0,0 +1,94 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/**
+ *  @defgroup server Server
+ *  @ingroup yadifad
+ *  @brief Event-driven TCP front end
+ *
+ *  A few threads multiplex all the TCP connections with epoll.
+ *  Queries are answered by these threads, pipelined queries included.
+ *  Updates are answered when they are done, possibly after queries that came later (RFC 7766).
+ *  AXFR and IXFR take the connection and are given to the thread pool.
+ *
+ * @{
+ */
+/*----------------------------------------------------------------------------*/
+
+#ifndef SERVER_TCP_MUX_H_
+#define SERVER_TCP_MUX_H_
+
+/*------------------------------------------------------------------------------
+ *
+ * USE INCLUDES */
+
+#include "server.h"
+
+/**
+ * Starts the TCP multiplexer threads (g_config->tcp_mux_thread_count of them).
+ * Once started, server_process_tcp gives all the connections it accepts to the multiplexer.
+ *
+ * @param database the database queries are answered from
+ *
+ * @return an error code if the multiplexer is not available on this system or could not be started
+ */
+
+ya_result server_tcp_mux_start(database_t *database);
+
+/**
+ * Stops the TCP multiplexer threads and closes all their connections.
+ * Does nothing if the multiplexer has not been started.
+ */
+
+void server_tcp_mux_stop();
+
+/**
+ * @return TRUE iff the multiplexer has been started
+ */
+
+bool server_tcp_mux_started();
+
+/**
+ * Accepts a connection on the TCP interface and gives it to one of the multiplexer threads.
+ * The connection is refused if max-tcp-connections are already opened.
+ *
+ * @param tcp_itf the listening TCP interface
+ */
+
+void server_tcp_mux_accept(tcp *tcp_itf);
+
+#endif /* SERVER_TCP_MUX_H_ */
+
+/*    ------------------------------------------------------------    */
+
+/** @} */
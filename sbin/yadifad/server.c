@@ -54,13 +54,17 @@
 #include <dnscore/fdtools.h>
 #include <dnscore/tcp_io_stream.h>
 #include <dnscore/thread_pool.h>
+#include <dnscore/timems.h>
 
 #include "signals.h"
 #include "scheduler_database_load_zone.h"
 #include "log_query.h"
+#include "log_query_binary.h"
+#include "server_statistics.h"
 #include "poll-util.h"
 #include "server-st.h"
 #include "server-mt.h"
+#include "server-tcp-mux.h"
 #include "notify.h"
 #include "server_context.h"
 #include "axfr.h"
@@ -182,6 +186,8 @@ server_process_tcp_task(database_t *database, message_data *mesg, u16 svr_sockfd
         }
 
         mesg->protocol = IPPROTO_TCP;
+        
+        u64 query_start = (g_statistics_detailed)?timeus():0;
 
         if(ISOK(return_code = message_process(mesg)))
         {
@@ -209,6 +215,8 @@ server_process_tcp_task(database_t *database, message_data *mesg, u16 svr_sockfd
 
                                 TCPSTATS(tcp_axfr_count++);
                                 
+                                log_answer(svr_sockfd, mesg);
+                                
                                 return_code = axfr_process(mesg);
 
 #ifndef NDEBUG
@@ -228,6 +236,7 @@ server_process_tcp_task(database_t *database, message_data *mesg, u16 svr_sockfd
                                  */
 
                                 TCPSTATS(tcp_ixfr_count++);
+                                log_answer(svr_sockfd, mesg);
                                 return_code = ixfr_process(mesg);
 
 #ifndef NDEBUG
@@ -253,6 +262,13 @@ server_process_tcp_task(database_t *database, message_data *mesg, u16 svr_sockfd
                             database_query(database, mesg);
 #endif
                             
+                            log_answer(svr_sockfd, mesg);
+                            
+                            if(g_statistics_detailed)
+                            {
+                                server_statistics_answer(server_statistics_local(), mesg, query_start);
+                            }
+                            
 #if 0
                             if(mesg->is_delegation)
                             {
@@ -341,6 +357,13 @@ server_process_tcp_task(database_t *database, message_data *mesg, u16 svr_sockfd
                         
                         process_class_ch(mesg);
                         
+                        log_answer(svr_sockfd, mesg);
+                        
+                        if(g_statistics_detailed)
+                        {
+                            server_statistics_answer(server_statistics_local(), mesg, query_start);
+                        }
+                        
                         TCPSTATS(tcp_fp[mesg->status]++);
                     }
                     else
@@ -477,6 +500,13 @@ server_process_tcp(database_t *database, tcp *tcp_itf)
 #ifndef NDEBUG
     log_debug("server_process_tcp_thread_start begin");
 #endif
+    
+    if(server_tcp_mux_started())
+    {
+        server_tcp_mux_accept(tcp_itf);
+        
+        return;
+    }
 
     int current_tcp = poll_update();
 
@@ -667,8 +697,7 @@ server_run()
 
     /* Resets the statistics */
 
-    ZEROMEMORY(&server_statistics, sizeof (server_statistics_t));
-    mutex_init(&server_statistics.mtx);
+    server_statistics_init();
     
     log_info("loading zones");
     
@@ -689,6 +718,30 @@ server_run()
     /* Initialises the TCP usage limit structure (It's global and defined at the beginning of server.c */
 
     poll_alloc(g_config->max_tcp_queries);
+    
+    /* Starts the TCP multiplexer, else each TCP connection gets its own thread */
+    
+    if(g_config->tcp_mux_thread_count > 0)
+    {
+        if(FAIL(return_code = server_tcp_mux_start(g_config->database)))
+        {
+            log_warn("tcp: multiplexer not available, using one thread per connection: %r", return_code);
+        }
+    }
+
+    /* The binary query log is written by its own thread */
+    
+    if(g_config->queries_log_type == 4)
+    {
+        char queries_log_path[PATH_MAX];
+        
+        snformat(queries_log_path, sizeof(queries_log_path), "%s/%s", g_config->log_path, g_config->queries_log_file);
+        
+        if(FAIL(return_code = log_query_binary_start(queries_log_path)))
+        {
+            log_err("queries-log: cannot open '%s': %r", queries_log_path, return_code);
+        }
+    }
 
     /* Go to work */
     
@@ -704,6 +757,10 @@ server_run()
         log_info("multiple workers engine");
         server_mt_query_loop();
     }
+    
+    server_tcp_mux_stop();
+    
+    log_query_binary_stop();
 
     notify_shutdown();
     
@@ -73,15 +73,14 @@ extern volatile int program_mode;
 typedef struct server_statistics_t server_statistics_t;
 
 /**
- * volatile is only needed for variables changed by another thread
+ * Only u64 counters: the blocks of the threads are summed as arrays.
+ * Each block has only one writer, volatile is for the thread summing them.
  */
 
 #define SERVER_STATISTICS_ERROR_CODES_COUNT 32
 
 struct server_statistics_t
 {
-    mutex_t mtx;
-    
     volatile u64 input_loop_count;
     volatile u64 input_timeout_count;
 
@@ -101,6 +100,12 @@ struct server_statistics_t
     volatile u64 udp_referrals_count;
 #endif
     
+    /* udp batches (recvmmsg) */
+    
+    volatile u64 udp_batch_count;       /* number of batches read */
+    volatile u64 udp_batch_fill_total;  /* number of messages read by batches */
+    volatile u64 udp_batch_full_count;  /* number of batches completely filled */
+    
     /* REFERRALS : !AA + NOERROR */
 
     /* tcp */
@@ -130,7 +135,14 @@ struct server_statistics_t
     volatile u64 tcp_fp[SERVER_STATISTICS_ERROR_CODES_COUNT];
 };
 
-#define TCPSTATS(__field__) mutex_lock(&server_statistics.mtx);server_statistics. __field__ ;mutex_unlock(&server_statistics.mtx)
+/**
+ * Returns the counters of the current thread, registering them on the first call.
+ * (server_statistics.c)
+ */
+
+server_statistics_t *server_statistics_local();
+
+#define TCPSTATS(__field__) server_statistics_local()-> __field__
 
 #ifndef SERVER_C_
 extern server_statistics_t server_statistics;
@@ -43,6 +43,10 @@
 #include <netdb.h>
 #include <netinet/in.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 #include <dnscore/sys_types.h>
 #include <dnscore/rfc.h>
 #include <dnscore/thread_pool.h>
@@ -58,6 +62,8 @@
 #include "server.h"
 
 #define ITFNAME_TAG 0x454d414e465449
+#define REUSEPRT_TAG 0x5452504553554552
+#define CBPFPROG_TAG 0x474f525046504243
 
 extern logger_handle *g_server_logger;
 #define MODULE_MSG_HANDLE g_server_logger
@@ -208,6 +214,17 @@ server_context_clear(config_data *config)
     /* Close all TCP & UDP connections */
     for(intf = config->interfaces; intf < config->interfaces_limit; intf++)
     {
+        /* reuseport_sockfd[0] is udp.sockfd */
+        
+        for(u32 i = 1; i < intf->udp.reuseport_count; i++)
+        {
+            close_ex(intf->udp.reuseport_sockfd[i]);
+        }
+        
+        free(intf->udp.reuseport_sockfd);
+        intf->udp.reuseport_sockfd = NULL;
+        intf->udp.reuseport_count = 0;
+        
         close_ex(intf->udp.sockfd);
         close_ex(intf->tcp.sockfd);
 
@@ -321,6 +338,168 @@ server_context_clear(config_data *config)
     /** @note: server_context_clear has to free server_context struct */
 }
 
+/**
+ * Creates and binds an UDP socket for the interface
+ *
+ * @param intf the interface
+ * @param reuseport TRUE if the socket will be one of a SO_REUSEPORT group
+ * @param sockfdp a pointer to the created socket
+ *
+ * @return an error code
+ */
+
+static ya_result
+server_context_udp_socket_create(interface *intf, bool reuseport, int *sockfdp)
+{
+    ya_result return_value;
+    const int on = 1;
+    
+    int sockfd = Socket(intf->udp.addr->ai_family, SOCK_DGRAM, 0);
+    
+    *sockfdp = sockfd;
+
+    /**
+     * This is distribution/system dependent. With this we ensure that IPv6 will only listen on IPv6 addresses.
+     */
+
+    if(intf->udp.addr->ai_family == AF_INET6)
+    {
+        if(FAIL(return_value = Setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&on, sizeof(on))))
+        {
+            return return_value;
+        }
+    }
+
+    if(FAIL(return_value = Setsockopt(sockfd,SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on))))
+    {
+        return return_value;
+    }
+    
+    if(reuseport)
+    {
+#ifdef SO_REUSEPORT
+        if(FAIL(return_value = Setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (void *) &on, sizeof(on))))
+        {
+            return return_value;
+        }
+#else
+        return MAKE_ERRNO_ERROR(ENOTSUP);
+#endif
+    }
+
+    /**
+     * Associate the name of the interface to the socket
+     */
+    
+    server_context_set_socket_name(sockfd, (struct sockaddr*)intf->udp.addr->ai_addr);
+
+    return_value = Bind(sockfd, (struct sockaddr*)intf->udp.addr->ai_addr, intf->udp.addr->ai_addrlen);
+    
+    return return_value;
+}
+
+/**
+ * Attaches a classic BPF program to a SO_REUSEPORT group so that a packet is given to the
+ * socket whose worker is pinned on the cpu that handled it.
+ * The r-th socket is read by the worker pinned on cpus[r % cpu_count].
+ * Packets handled by a cpu no worker is pinned on (or without a cpu list) go to the socket
+ * whose index is the cpu modulo the number of sockets.
+ * Combined with thread-affinity, the RX queue, the socket and the worker stay on the same core.
+ *
+ * @param sockfd any socket of the group (the program applies to the whole group)
+ * @param count the number of sockets in the group
+ * @param cpus the cpus the workers are pinned on
+ * @param cpu_count the number of cpus in the list, can be 0
+ *
+ * @return an error code
+ */
+
+static ya_result
+server_context_udp_cpu_steering_attach(int sockfd, u32 count, const u16 *cpus, u32 cpu_count)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+    struct sock_filter *code;
+    u32 n = 0;
+    
+    if(2 * count + 3 > BPF_MAXINSNS)
+    {
+        return MAKE_ERRNO_ERROR(E2BIG);
+    }
+    
+    MALLOC_OR_DIE(struct sock_filter*, code, (2 * count + 3) * sizeof(struct sock_filter), CBPFPROG_TAG);
+    
+    /* A = raw_smp_processor_id() */
+    
+    code[n].code = BPF_LD | BPF_W | BPF_ABS;
+    code[n].jt = 0;
+    code[n].jf = 0;
+    code[n].k = SKF_AD_OFF + SKF_AD_CPU;
+    n++;
+    
+    if(cpu_count > 0)
+    {
+        for(u32 r = 0; r < count; r++)
+        {
+            u16 cpu = cpus[r % cpu_count];
+            u32 i;
+            
+            for(i = 0; i < r; i++)
+            {
+                if(cpus[i % cpu_count] == cpu)
+                {
+                    break;
+                }
+            }
+            
+            if(i < r)
+            {
+                continue; /* that cpu already goes to an earlier socket */
+            }
+            
+            /* if(A == cpu) return r */
+            
+            code[n].code = BPF_JMP | BPF_JEQ | BPF_K;
+            code[n].jt = 0;
+            code[n].jf = 1;
+            code[n].k = cpu;
+            n++;
+            
+            code[n].code = BPF_RET | BPF_K;
+            code[n].jt = 0;
+            code[n].jf = 0;
+            code[n].k = r;
+            n++;
+        }
+    }
+    
+    /* return A % count */
+    
+    code[n].code = BPF_ALU | BPF_MOD | BPF_K;
+    code[n].jt = 0;
+    code[n].jf = 0;
+    code[n].k = count;
+    n++;
+    
+    code[n].code = BPF_RET | BPF_A;
+    code[n].jt = 0;
+    code[n].jf = 0;
+    code[n].k = 0;
+    n++;
+    
+    struct sock_fprog prog;
+    prog.len = n;
+    prog.filter = code;
+    
+    ya_result return_value = Setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+    
+    free(code);
+    
+    return return_value;
+#else
+    return MAKE_ERRNO_ERROR(ENOTSUP);
+#endif
+}
+
 /** \brief  Initialize sockets and copy the config parameters into server_context_t
  *
  *  @param[in] config
@@ -361,39 +540,55 @@ config_update_network(config_data *config)
         /*****************************************************************/
         /* Create UDP interfaces and initialize server_context structure */
         /*****************************************************************/
-
-        intf->udp.sockfd = Socket(intf->udp.addr->ai_family, SOCK_DGRAM, 0);
         
-        /**
-         * Associate the name of the interface to the socket
+        /*
+         * With udp-reuseport, each worker of the multiple workers engine gets its own socket
+         * so they don't all compete on the same receive queue.
          */
         
-        /**
-         * This is distribution/system dependent. With this we ensure that IPv6 will only listen on IPv6 addresses.
-         */
+        u32 udp_socket_count = 1;
         
-        if(intf->udp.addr->ai_family == AF_INET6)
+        if(((config->server_flags & SERVER_FL_UDP_REUSEPORT) != 0) && (config->thread_count_by_address > 1))
         {
-            if(FAIL(return_value = Setsockopt(intf->udp.sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (void *)&on, sizeof(on))))
+#ifdef SO_REUSEPORT
+            udp_socket_count = config->thread_count_by_address;
+#else
+            log_warn("udp-reuseport is not supported on this system");
+#endif
+        }
+        
+        log_info("binding %{sockaddr}", intf->udp.addr->ai_addr);
+        
+        MALLOC_OR_DIE(int*, intf->udp.reuseport_sockfd, udp_socket_count * sizeof(int), REUSEPRT_TAG);
+        
+        for(u32 i = 0; i < udp_socket_count; i++)
+        {
+            intf->udp.reuseport_sockfd[i] = -1;
+        }
+        
+        for(u32 i = 0; i < udp_socket_count; i++)
+        {
+            if(FAIL(return_value = server_context_udp_socket_create(intf, udp_socket_count > 1, &intf->udp.reuseport_sockfd[i])))
             {
                 return return_value;
             }
+            
+            intf->udp.reuseport_count++;
         }
-
-        if(FAIL(return_value = Setsockopt(intf->udp.sockfd,SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on))))
-        {
-            return return_value;
-        }
-
-        log_info("binding %{sockaddr}", intf->udp.addr->ai_addr);
         
-        server_context_set_socket_name(intf->udp.sockfd, (struct sockaddr*)intf->udp.addr->ai_addr);
+        intf->udp.sockfd = intf->udp.reuseport_sockfd[0];
         
-        if(FAIL(return_value = Bind(intf->udp.sockfd,
-                (struct sockaddr*)intf->udp.addr->ai_addr,
-                intf->udp.addr->ai_addrlen)))
+        if(udp_socket_count > 1)
         {
-            return return_value;
+            log_info("bound %u reuseport sockets to %{sockaddr}", udp_socket_count, intf->udp.addr->ai_addr);
+            
+            if((config->server_flags & SERVER_FL_UDP_CPU_STEERING) != 0)
+            {
+                if(FAIL(return_value = server_context_udp_cpu_steering_attach(intf->udp.sockfd, udp_socket_count, config->thread_affinity_cpus, config->thread_affinity_count)))
+                {
+                    log_warn("udp-cpu-steering cannot be enabled on %{sockaddr}: %r", intf->udp.addr->ai_addr, return_value);
+                }
+            }
         }
                 
 
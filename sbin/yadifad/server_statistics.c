@@ -0,0 +1,651 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup server Server
+ *  @ingroup yadifad
+ *  @brief Per-thread statistics
+ *
+ *  The blocks are never released before the end of the program: when a thread ends, its counters are still
+ *  part of the sum, and its block is handed over to the next thread that needs one.  There are never more
+ *  blocks than threads alive at the same time.
+ *
+ *  The queries by zone are counted by origin, so a zone that has been replaced (reloaded, transferred) keeps its
+ *  slot.  The origins are registered once, under the mutex, the first time a thread counts them : each one gets
+ *  an index the sums are made with.
+ *
+ *  The counters are read while their owner is updating them.  64 bits loads being atomic on the supported
+ *  64 bits architectures, the worst that can happen is to read a value that is one period late.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+
+#define SERVER_STATISTICS_C_ 1
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <dnscore/logger.h>
+#include <dnscore/format.h>
+#include <dnscore/timems.h>
+#include <dnscore/rfc.h>
+#include <dnscore/dnsname.h>
+#include <dnscore/file_output_stream.h>
+#include <dnscore/buffer_output_stream.h>
+
+#include <dnsdb/zdb_answer_cache.h>
+#include <dnsdb/treeset.h>
+#include <dnsdb/hash.h>
+
+#include "server_statistics.h"
+#include "confs.h"
+
+extern logger_handle *g_server_logger;
+#define MODULE_MSG_HANDLE g_server_logger
+
+#define SSTBLOCK_TAG 0x4b434f4c42545353
+#define SSTZONES_TAG 0x53454e4f5a545353
+#define SSTORIGN_TAG 0x4e4749524f545353
+
+#define SERVER_STATISTICS_CACHE_LINE        64
+
+#define SERVER_STATISTICS_COUNTERS          (sizeof(server_statistics_t) / sizeof(u64))
+
+#define SERVER_STATISTICS_FILE_BUFFER       4096
+
+typedef struct server_statistics_zone server_statistics_zone;
+
+struct server_statistics_zone
+{
+    const u8 * volatile origin;         /* registered origin, set once hash and id are */
+    u32 hash;
+    u32 id;                             /* index of the origin in the registry */
+    volatile u64 queries;
+};
+
+typedef struct server_statistics_block server_statistics_block;
+
+struct server_statistics_block
+{
+    server_statistics_t counters;       /* first: server_statistics_local() returns the block */
+    
+    volatile u64 qtype[SERVER_STATISTICS_QTYPE_COUNT];
+    volatile u64 latency[SERVER_STATISTICS_LATENCY_COUNT];
+    volatile u64 zone_overflow_count;   /* queries of zones that did not fit in the table */
+    
+    server_statistics_block *next;
+    server_statistics_block *free_next; /* in the free list while no thread owns the block */
+    void *allocated;
+    u32 zone_mask;                      /* slots - 1 */
+    
+    server_statistics_zone zone[];
+};
+
+typedef struct server_statistics_zone_sum server_statistics_zone_sum;
+
+struct server_statistics_zone_sum
+{
+    const u8 *origin;
+    u64 queries;
+};
+
+static int server_statistics_origin_compare(const void *node_a, const void *node_b);
+
+bool g_statistics_detailed = FALSE;
+
+static pthread_mutex_t server_statistics_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t server_statistics_once = PTHREAD_ONCE_INIT;
+static pthread_key_t server_statistics_key;
+static server_statistics_block *server_statistics_blocks = NULL;
+static server_statistics_block *server_statistics_free_blocks = NULL;
+static u32 server_statistics_block_count = 0;
+static u32 server_statistics_zone_slots = SERVER_STATISTICS_ZONE_COUNT;
+
+/* origins counted so far, by name and by index */
+
+static treeset_tree server_statistics_origin_set = {NULL, server_statistics_origin_compare};
+static u8 **server_statistics_origins = NULL;
+static u32 server_statistics_origin_count = 0;
+static u32 server_statistics_origin_size = 0;
+
+static const char *server_statistics_fp_names[SERVER_STATISTICS_ERROR_CODES_COUNT] =
+{
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED", "YXDOMAIN", "YXRRSET",
+    "NXRRSET", "NOTAUTH", "NOTZONE", "BADVERS", "BADSIG", "BADKEY", "BADTIME", "BADMODE",
+    "BADNAME", "BADALG", "BADTRUNC", NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+static int
+server_statistics_origin_compare(const void *node_a, const void *node_b)
+{
+    return dnsname_compare((const u8*)node_a, (const u8*)node_b);
+}
+
+/**
+ * Returns the registered copy of the origin and its index, registering it if needed.
+ */
+
+static const u8*
+server_statistics_origin_register(const u8 *origin, u32 *idp)
+{
+    pthread_mutex_lock(&server_statistics_mtx);
+    
+    treeset_node *node = treeset_avl_find(&server_statistics_origin_set, origin);
+    
+    if(node == NULL)
+    {
+        if(server_statistics_origin_count == server_statistics_origin_size)
+        {
+            server_statistics_origin_size = MAX(server_statistics_origin_size * 2, SERVER_STATISTICS_ZONE_COUNT);
+            
+            REALLOC_OR_DIE(u8**, server_statistics_origins, sizeof(u8*) * server_statistics_origin_size, SSTORIGN_TAG);
+        }
+        
+        u8 *copy = dnsname_dup(origin);
+        
+        node = treeset_avl_insert(&server_statistics_origin_set, copy);
+        node->data = (void*)(intptr)server_statistics_origin_count;
+        
+        server_statistics_origins[server_statistics_origin_count++] = copy;
+    }
+    
+    *idp = (u32)(intptr)node->data;
+    
+    const u8 *registered = (const u8*)node->key;
+    
+    pthread_mutex_unlock(&server_statistics_mtx);
+    
+    return registered;
+}
+
+/**
+ * Called when a thread exits.
+ * The block stays registered (its counts are part of the totals) and is given to the next thread that needs one.
+ */
+
+static void
+server_statistics_block_release(void *block_)
+{
+    server_statistics_block *block = (server_statistics_block*)block_;
+    
+    pthread_mutex_lock(&server_statistics_mtx);
+    block->free_next = server_statistics_free_blocks;
+    server_statistics_free_blocks = block;
+    pthread_mutex_unlock(&server_statistics_mtx);
+}
+
+static void
+server_statistics_key_create()
+{
+    if(pthread_key_create(&server_statistics_key, server_statistics_block_release) != 0)
+    {
+        log_quit("statistics: unable to create the thread key");
+    }
+}
+
+server_statistics_t*
+server_statistics_local()
+{
+    pthread_once(&server_statistics_once, server_statistics_key_create);
+    
+    server_statistics_block *block = (server_statistics_block*)pthread_getspecific(server_statistics_key);
+    
+    if(block == NULL)
+    {
+        /* take the block of a thread that has exited, if any */
+        
+        pthread_mutex_lock(&server_statistics_mtx);
+        
+        block = server_statistics_free_blocks;
+        
+        if(block != NULL)
+        {
+            server_statistics_free_blocks = block->free_next;
+            block->free_next = NULL;
+        }
+        
+        pthread_mutex_unlock(&server_statistics_mtx);
+        
+        if(block != NULL)
+        {
+            pthread_setspecific(server_statistics_key, block);
+            
+            return &block->counters;
+        }
+        
+        /* aligned on a cache line and rounded to a cache line : no block shares a line with another one */
+        
+        u32 slots = server_statistics_zone_slots;
+        size_t size = (sizeof(server_statistics_block) + sizeof(server_statistics_zone) * slots + SERVER_STATISTICS_CACHE_LINE - 1) & ~(SERVER_STATISTICS_CACHE_LINE - 1);
+        u8 *allocated;
+        
+        MALLOC_OR_DIE(u8*, allocated, size + SERVER_STATISTICS_CACHE_LINE, SSTBLOCK_TAG);
+        
+        block = (server_statistics_block*)(((intptr)allocated + SERVER_STATISTICS_CACHE_LINE - 1) & ~(intptr)(SERVER_STATISTICS_CACHE_LINE - 1));
+        ZEROMEMORY(block, size);
+        block->allocated = allocated;
+        block->zone_mask = slots - 1;
+        
+        pthread_setspecific(server_statistics_key, block);
+        
+        pthread_mutex_lock(&server_statistics_mtx);
+        block->next = server_statistics_blocks;
+        server_statistics_blocks = block;
+        server_statistics_block_count++;
+        pthread_mutex_unlock(&server_statistics_mtx);
+    }
+    
+    return &block->counters;
+}
+
+void
+server_statistics_init()
+{
+    ZEROMEMORY(&server_statistics, sizeof(server_statistics_t));
+    
+    g_statistics_detailed = (g_config->server_flags & (SERVER_FL_STATISTICS|SERVER_FL_STATISTICS_DETAILED)) == (SERVER_FL_STATISTICS|SERVER_FL_STATISTICS_DETAILED);
+    
+    pthread_once(&server_statistics_once, server_statistics_key_create);
+    
+    /* the blocks allocated from now on have room for twice the zones configured */
+    
+    u32 zone_count = 0;
+    
+    zone_set_lock(&g_config->zones);
+    
+    treeset_avl_iterator iter;
+    treeset_avl_iterator_init(&g_config->zones.set, &iter);
+    
+    while(treeset_avl_iterator_hasnext(&iter))
+    {
+        treeset_avl_iterator_next_node(&iter);
+        zone_count++;
+    }
+    
+    zone_set_unlock(&g_config->zones);
+    
+    u32 slots = SERVER_STATISTICS_ZONE_COUNT;
+    
+    while((slots < zone_count * 2) && (slots < SERVER_STATISTICS_ZONE_COUNT_MAX))
+    {
+        slots <<= 1;
+    }
+    
+    server_statistics_zone_slots = slots;
+}
+
+void
+server_statistics_aggregate(server_statistics_t *sum)
+{
+    memcpy(sum, (const void*)&server_statistics, sizeof(server_statistics_t));
+    
+    u64 *sum_counters = (u64*)sum;
+    
+    pthread_mutex_lock(&server_statistics_mtx);
+    
+    for(server_statistics_block *block = server_statistics_blocks; block != NULL; block = block->next)
+    {
+        const volatile u64 *counters = (const volatile u64*)&block->counters;
+        
+        for(u32 i = 0; i < SERVER_STATISTICS_COUNTERS; i++)
+        {
+            sum_counters[i] += counters[i];
+        }
+    }
+    
+    pthread_mutex_unlock(&server_statistics_mtx);
+}
+
+void
+server_statistics_answer(server_statistics_t *local, const message_data *mesg, u64 start)
+{
+    server_statistics_block *block = (server_statistics_block*)local;
+    
+    u16 qtype = ntohs(mesg->qtype);
+    
+    block->qtype[(qtype < SERVER_STATISTICS_QTYPE_COUNT - 1)?qtype:SERVER_STATISTICS_QTYPE_COUNT - 1]++;
+    
+    u64 elapsed = timeus() - start;
+    
+    u32 bucket = (elapsed != 0)?64 - __builtin_clzll(elapsed):0;
+    
+    block->latency[MIN(bucket, SERVER_STATISTICS_LATENCY_COUNT - 1)]++;
+}
+
+void
+server_statistics_zone_query(const zdb_zone *zone)
+{
+    if(zone == NULL)
+    {
+        return;
+    }
+    
+    server_statistics_block *block = (server_statistics_block*)server_statistics_local();
+    
+    u32 hash = hash_dnsname(zone->origin);
+    u32 slot = hash & block->zone_mask;
+    
+    for(u32 n = 0; n < SERVER_STATISTICS_ZONE_PROBE_MAX; n++)
+    {
+        server_statistics_zone *z = &block->zone[slot];
+        
+        if(z->origin == NULL)
+        {
+            /* the first query of this thread for the origin */
+            
+            z->hash = hash;
+            z->queries = 1;
+            
+            const u8 *origin = server_statistics_origin_register(zone->origin, &z->id);
+            
+            __sync_synchronize();
+            
+            z->origin = origin;
+            return;
+        }
+        
+        if((z->hash == hash) && dnsname_equals(z->origin, zone->origin))
+        {
+            z->queries++;
+            return;
+        }
+        
+        slot = (slot + 1) & block->zone_mask;
+    }
+    
+    block->zone_overflow_count++;
+}
+
+static void
+server_statistics_write_u64_object(output_stream *os, const char *name, const u64 *values, u32 count, const char **names)
+{
+    osformat(os, ",\n\"%s\":{", name);
+    
+    const char *separator = "";
+    
+    for(u32 i = 0; i < count; i++)
+    {
+        if((values[i] != 0) && (names[i] != NULL))
+        {
+            osformat(os, "%s\"%s\":%llu", separator, names[i], values[i]);
+            separator = ",";
+        }
+    }
+    
+    osprint(os, "}");
+}
+
+static void
+server_statistics_write_name(output_stream *os, const u8 *origin)
+{
+    char name[MAX_DOMAIN_LENGTH + 1];
+    
+    dnsname_to_cstr(name, origin);
+    
+    output_stream_write_u8(os, '"');
+    
+    for(const char *p = name; *p != '\0'; p++)
+    {
+        u8 c = (u8)*p;
+        
+        if((c == '"') || (c == '\\'))
+        {
+            output_stream_write_u8(os, '\\');
+            output_stream_write_u8(os, c);
+        }
+        else if(c < ' ')
+        {
+            osformat(os, "\\u%04x", c);
+        }
+        else
+        {
+            output_stream_write_u8(os, c);
+        }
+    }
+    
+    output_stream_write_u8(os, '"');
+}
+
+static void
+server_statistics_write_detailed(output_stream *os)
+{
+    u64 qtype[SERVER_STATISTICS_QTYPE_COUNT];
+    u64 latency[SERVER_STATISTICS_LATENCY_COUNT];
+    u64 zone_overflow_count = 0;
+    server_statistics_zone_sum *zones;
+    u32 zone_count;
+    
+    ZEROMEMORY(qtype, sizeof(qtype));
+    ZEROMEMORY(latency, sizeof(latency));
+    
+    pthread_mutex_lock(&server_statistics_mtx);
+    
+    /* the queries by origin index, the origins of the tables being all registered */
+    
+    zone_count = server_statistics_origin_count;
+    
+    MALLOC_OR_DIE(server_statistics_zone_sum*, zones, sizeof(server_statistics_zone_sum) * MAX(zone_count, 1), SSTZONES_TAG);
+    
+    for(u32 j = 0; j < zone_count; j++)
+    {
+        zones[j].origin = server_statistics_origins[j];
+        zones[j].queries = 0;
+    }
+    
+    for(server_statistics_block *block = server_statistics_blocks; block != NULL; block = block->next)
+    {
+        for(u32 i = 0; i < SERVER_STATISTICS_QTYPE_COUNT; i++)
+        {
+            qtype[i] += block->qtype[i];
+        }
+        
+        for(u32 i = 0; i < SERVER_STATISTICS_LATENCY_COUNT; i++)
+        {
+            latency[i] += block->latency[i];
+        }
+        
+        zone_overflow_count += block->zone_overflow_count;
+        
+        /* the same zone is in the table of each thread that answered for it */
+        
+        for(u32 i = 0; i <= block->zone_mask; i++)
+        {
+            server_statistics_zone *z = &block->zone[i];
+            
+            if(z->origin == NULL)
+            {
+                continue;
+            }
+            
+            __sync_synchronize();
+            
+            zones[z->id].queries += z->queries;
+        }
+    }
+    
+    pthread_mutex_unlock(&server_statistics_mtx);
+    
+    /* the registered origins are never released while the server runs */
+    
+    osprint(os, ",\n\"qtype\":{");
+    
+    const char *separator = "";
+    
+    for(u32 i = 0; i < SERVER_STATISTICS_QTYPE_COUNT; i++)
+    {
+        if(qtype[i] == 0)
+        {
+            continue;
+        }
+        
+        const char *name = (i < SERVER_STATISTICS_QTYPE_COUNT - 1)?get_name_from_type(htons((u16)i)):"OTHER";
+        
+        if(name != NULL)
+        {
+            osformat(os, "%s\"%s\":%llu", separator, name, qtype[i]);
+        }
+        else
+        {
+            osformat(os, "%s\"TYPE%u\":%llu", separator, i, qtype[i]);
+        }
+        
+        separator = ",";
+    }
+    
+    /* the key is the upper bound of the bucket in microseconds */
+    
+    osprint(os, "},\n\"latency_us\":{");
+    
+    for(u32 i = 0; i < SERVER_STATISTICS_LATENCY_COUNT - 1; i++)
+    {
+        osformat(os, "\"%llu\":%llu,", 1ULL << i, latency[i]);
+    }
+    
+    osformat(os, "\"inf\":%llu},\n\"zone\":{", latency[SERVER_STATISTICS_LATENCY_COUNT - 1]);
+    
+    separator = "";
+    
+    for(u32 j = 0; j < zone_count; j++)
+    {
+        if(zones[j].queries == 0)
+        {
+            continue;
+        }
+        
+        osprint(os, separator);
+        server_statistics_write_name(os, zones[j].origin);
+        osformat(os, ":%llu", zones[j].queries);
+        
+        separator = ",";
+    }
+    
+    osformat(os, "},\n\"zone_overflow\":%llu", zone_overflow_count);
+    
+    free(zones);
+}
+
+static ya_result
+server_statistics_write_snapshot(const char *path, const server_statistics_t *sum)
+{
+    output_stream fos;
+    output_stream os;
+    ya_result return_code;
+    char tmp_path[PATH_MAX];
+    
+    if(FAIL(return_code = snformat(tmp_path, sizeof(tmp_path), "%s.part", path)))
+    {
+        return return_code;
+    }
+    
+    if(FAIL(return_code = file_output_stream_create(tmp_path, 0644, &fos)))
+    {
+        return return_code;
+    }
+    
+    buffer_output_stream_init(&fos, &os, SERVER_STATISTICS_FILE_BUFFER);
+    
+    zdb_answer_cache_stats answer_cache_stats;
+    
+    zdb_answer_cache_get_stats(&answer_cache_stats);
+    
+    osformat(&os,
+            "{\n"
+            "\"time\":%llu,\n"
+            "\"period_ms\":%llu,\n"
+            "\"udp\":{\"input\":%llu,\"queries\":%llu,\"notify\":%llu,\"updates\":%llu,"
+                     "\"dropped\":%llu,\"output_bytes\":%llu,\"undefined\":%llu,\"referrals\":%llu,"
+                     "\"batches\":%llu,\"batch_messages\":%llu,\"batch_full\":%llu},\n"
+            "\"tcp\":{\"input\":%llu,\"queries\":%llu,\"notify\":%llu,\"updates\":%llu,"
+                     "\"dropped\":%llu,\"output_bytes\":%llu,\"undefined\":%llu,\"referrals\":%llu,"
+                     "\"axfr\":%llu,\"ixfr\":%llu,\"overflow\":%llu},\n"
+            "\"answer_cache\":{\"hits\":%llu,\"misses\":%llu,\"entries\":%u,\"bytes\":%u}",
+            timeus(),
+            sum->loop_rate_elapsed,
+            sum->udp_input_count, sum->udp_queries_count, sum->udp_notify_input_count, sum->udp_updates_count,
+            sum->udp_dropped_count, sum->udp_output_size_total, sum->udp_undefined_count, sum->udp_referrals_count,
+            sum->udp_batch_count, sum->udp_batch_fill_total, sum->udp_batch_full_count,
+            sum->tcp_input_count, sum->tcp_queries_count, sum->tcp_notify_input_count, sum->tcp_updates_count,
+            sum->tcp_dropped_count, sum->tcp_output_size_total, sum->tcp_undefined_count, sum->tcp_referrals_count,
+            sum->tcp_axfr_count, sum->tcp_ixfr_count, sum->tcp_overflow_count,
+            answer_cache_stats.hits, answer_cache_stats.misses, answer_cache_stats.count, answer_cache_stats.bytes);
+    
+    server_statistics_write_u64_object(&os, "udp_answers", (const u64*)sum->udp_fp, SERVER_STATISTICS_ERROR_CODES_COUNT, server_statistics_fp_names);
+    server_statistics_write_u64_object(&os, "tcp_answers", (const u64*)sum->tcp_fp, SERVER_STATISTICS_ERROR_CODES_COUNT, server_statistics_fp_names);
+    
+    if(g_statistics_detailed)
+    {
+        server_statistics_write_detailed(&os);
+    }
+    
+    osprint(&os, "\n}\n");
+    
+    output_stream_close(&os);
+    
+    if(rename(tmp_path, path) < 0)
+    {
+        return_code = ERRNO_ERROR;
+        
+        unlink(tmp_path);
+        
+        return return_code;
+    }
+    
+    return SUCCESS;
+}
+
+void
+server_statistics_snapshot(const server_statistics_t *sum)
+{
+    ya_result return_code;
+    char path[PATH_MAX];
+    
+    if((g_config->statistics_file == NULL) || (g_config->statistics_file[0] == '\0'))
+    {
+        return;
+    }
+    
+    snformat(path, sizeof(path), "%s/%s", g_config->log_path, g_config->statistics_file);
+    
+    if(FAIL(return_code = server_statistics_write_snapshot(path, sum)))
+    {
+        log_err("statistics: cannot write '%s': %r", path, return_code);
+    }
+}
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
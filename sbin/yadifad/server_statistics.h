@@ -0,0 +1,131 @@
+/*------------------------------------------------------------------------------
+*
+* Copyright (c) 2011, EURid. All rights reserved.
+* The YADIFA TM software product is provided under the BSD 3-clause license:
+* 
+* Redistribution and use in source and binary forms, with or without 
+* modification, are permitted provided that the following conditions
+* are met:
+*
+*        * Redistributions of source code must retain the above copyright 
+*          notice, this list of conditions and the following disclaimer.
+*        * Redistributions in binary form must reproduce the above copyright 
+*          notice, this list of conditions and the following disclaimer in the 
+*          documentation and/or other materials provided with the distribution.
+*        * Neither the name of EURid nor the names of its contributors may be 
+*          used to endorse or promote products derived from this software 
+*          without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*------------------------------------------------------------------------------
+*
+* DOCUMENTATION */
+/** @defgroup server Server
+ *  @ingroup yadifad
+ *  @brief Per-thread statistics
+ *
+ *  Every thread updating the counters owns a block of them, allocated on a cache line boundary the first time
+ *  the thread counts something, and registered in a list.  The owner is the only writer of its block so the
+ *  counters are updated without lock nor atomic instruction.  The blocks are summed when the statistics are read.
+ *
+ *  With statistics-detailed enabled, the block also holds a histogram of the query types, a histogram of the
+ *  time spent answering (log2 of the microseconds), and the number of queries by zone.
+ *
+ *  With statistics-file set, a JSON snapshot of the sum is written into that file of the log directory
+ *  each time the statistics are logged.
+ *
+ * @{
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _SERVER_STATISTICS_H
+#define _SERVER_STATISTICS_H
+
+#include <dnscore/message.h>
+
+#include <dnsdb/zdb_types.h>
+
+#include "server.h"
+
+/* qtypes 0 to 255 are counted individually, the others together */
+
+#define SERVER_STATISTICS_QTYPE_COUNT       257
+
+/* bucket i counts the answers computed in less than 2^i us, the last one counts the others */
+
+#define SERVER_STATISTICS_LATENCY_COUNT     24
+
+/*
+ * Zones counted by thread : the table of a thread has twice as many slots as zones configured (rounded up to a
+ * power of two) within these bounds.  A zone is looked for in at most SERVER_STATISTICS_ZONE_PROBE_MAX slots.
+ */
+
+#define SERVER_STATISTICS_ZONE_COUNT        128
+#define SERVER_STATISTICS_ZONE_COUNT_MAX    65536
+#define SERVER_STATISTICS_ZONE_PROBE_MAX    8
+
+#ifndef SERVER_STATISTICS_C_
+extern bool g_statistics_detailed;
+#endif
+
+/**
+ * Sets up the registry, reads the statistics-detailed setting, sizes the zone tables from the zones configured.
+ * Resets the global (main thread) counters.
+ */
+
+void server_statistics_init();
+
+/**
+ * Sums the global counters and the counters of every block registered so far.
+ *
+ * @param sum receives the sum
+ */
+
+void server_statistics_aggregate(server_statistics_t *sum);
+
+/**
+ * Counts an answer in the histograms of the thread.
+ * Only to be called if g_statistics_detailed is set.
+ *
+ * @param local the counters of the current thread, as returned by server_statistics_local()
+ * @param mesg the answered message
+ * @param start the time (timeus) the query has been received
+ */
+
+void server_statistics_answer(server_statistics_t *local, const message_data *mesg, u64 start);
+
+/**
+ * Counts a query for the zone in the current thread.
+ * Only to be called if g_statistics_detailed is set, inside the epoch the zone has been found in.
+ *
+ * @param zone the zone that answered, can be NULL
+ */
+
+void server_statistics_zone_query(const zdb_zone *zone);
+
+/**
+ * Writes the sum and the detailed counters as a JSON object in the statistics-file of the log directory.
+ * The file is replaced atomically.  Does nothing if statistics-file is not set.
+ *
+ * @param sum the sum of the counters, as given by server_statistics_aggregate
+ */
+
+void server_statistics_snapshot(const server_statistics_t *sum);
+
+#endif /* _SERVER_STATISTICS_H */
+
+/** @} */
+
+/*----------------------------------------------------------------------------*/
+
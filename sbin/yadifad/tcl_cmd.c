@@ -200,9 +200,9 @@ read_u16(char* argv[], int argc, int* argi, u16* val16)
 	return COMMAND_ARGUMENT_EXPECTED;
     }
 
-    if(FAIL(return_code = parse_u32_range(name, &val, 0, MAX_U16, BASE_10)))
+    if(ISOK(return_code = parse_u32_range(name, &val, 0, MAX_U16, BASE_10)))
     {
-	val16 = (u16)val;
+	*val16 = (u16)val;
     }
 
     return return_code;
@@ -462,6 +462,15 @@ tcl_updatesigs(ClientData clientData, Tcl_Interp *interp, int argc, char *argv[]
     return TCL_OK;
 }
 
+static value_name_table key_algorithm_enum[] =
+{
+    {DNSKEY_ALGORITHM_RSASHA1,          "rsasha1"        },
+    {DNSKEY_ALGORITHM_RSASHA1_NSEC3,    "nsec3rsasha1"   },
+    {DNSKEY_ALGORITHM_ECDSAP256SHA256,  "ecdsap256sha256"},
+    {DNSKEY_ALGORITHM_ECDSAP384SHA384,  "ecdsap384sha384"},
+    {0, NULL}
+};
+
 static int
 tcl_addkey(ClientData clientData, Tcl_Interp *interp, int argc, char *argv[])
 {
@@ -469,6 +478,7 @@ tcl_addkey(ClientData clientData, Tcl_Interp *interp, int argc, char *argv[])
     zdb_zone* zone;
     dnssec_key* key;
     u32 key_size;
+    u32 key_algorithm = DNSKEY_ALGORITHM_RSASHA1_NSEC3;
     int argi = 1;
     u16 key_flags;
 
@@ -487,13 +497,24 @@ tcl_addkey(ClientData clientData, Tcl_Interp *interp, int argc, char *argv[])
 	return -3;
     }
 
-    /* argv[1] is always the origin */
+    /* the algorithm is optional */
 
-    key = dnssec_key_createnew(DNSKEY_ALGORITHM_RSASHA1_NSEC3, key_size, key_flags, argv[1]);
+    if(argi < argc)
+    {
+	if(FAIL(get_value_from_casename(key_algorithm_enum, argv[argi], &key_algorithm)))
+	{
+	    fprintf(stdout, "Unsupported key algorithm '%s'\n", argv[argi]);
+	    fflush(stdout);
+	    return -4;
+	}
+    }
 
-    if(key == NULL)
+    /* argv[1] is always the origin */
+
+    if(FAIL(return_code = dnssec_key_createnew(key_algorithm, key_size, key_flags, argv[1], &key)))
     {
 	fprintf(stdout, "Key generation error\n");
+	fprintf(stdout, ERROR_CODE_HEX_DEC, return_code, return_code);
 	fflush(stdout);
 	return -4;
     }
@@ -713,6 +734,21 @@ tcl_meminfo(ClientData clientData, Tcl_Interp *interp, int argc, char *argv[])
 
     fprintf(stdout, "             %10llu  %10llu  %10llu\n", heap_size_total, heap_size_total - heap_avail_total, heap_avail_total);
 
+    u64 cache_hits;
+    u64 cache_misses;
+    u64 cache_slots = 0;
+
+    zdb_mcache_stats(&cache_hits, &cache_misses);
+
+    for(i = 0; i < ZDB_ALLOC_PG_SIZE_COUNT; i++)
+    {
+        cache_slots += zdb_mcached(i);
+    }
+
+    fprintf(stdout, "\nThread caches: %llu slots, %llu hits, %llu misses (%llu%%)\n",
+            cache_slots, cache_hits, cache_misses,
+            ((cache_hits + cache_misses) != 0)?(cache_hits * 100) / (cache_hits + cache_misses):0);
+
     fflush(stdout);
     return TCL_OK;
 }
@@ -757,7 +793,7 @@ static tcl_help_struct tcl_help_commands[] ={
     {"addnsec3param", "Adds the default nsec3param to the zone", "origin"},
     {"updatensec3", "Updates all the NSEC3 records for all the NSEC3PARAM records of the zone", "origin"},
     {"updatesigs", "Updates all the signatures of the zone", "origin"},
-    {"addkey", "Adds an NSEC3RSASHA1 key of the given size (bits) and flags to the zone", "origin size flags"},
+    {"addkey", "Adds a key of the given size (bits), flags and algorithm (default: nsec3rsasha1, or rsasha1, ecdsap256sha256, ecdsap384sha384) to the zone", "origin size flags [algorithm]"},
 
     {"writezone", "Writes the zone file", "origin"},
 